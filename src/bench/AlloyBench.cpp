@@ -0,0 +1,595 @@
+/*
+ * Copyright(C) 2015, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "bench/AlloyBenchmark.h"
+#include "image/AlloyImage.h"
+#include "image/AlloyVolume.h"
+#include "image/AlloyImageProcessing.h"
+#include "image/AlloyDistanceField.h"
+#include "math/AlloySparseMatrix.h"
+#include "math/AlloySparseSolve.h"
+#include "graphics/AlloyLocator.h"
+#include "graphics/AlloySpatialHash.h"
+#include "graphics/AlloyIntersector.h"
+#include "graphics/AlloyIsoSurface.h"
+#include "graphics/AlloyMesh.h"
+#include "graphics/AlloySubdivision.h"
+#include "graphics/MeshDecimation.h"
+#include "vision/AlloyMaxFlow.h"
+#include "vision/SLIC.h"
+#include "vision/Sift.h"
+#include "physics/fluid/LaplaceSolver.h"
+#include "system/AlloyFileUtil.h"
+#include <iostream>
+#include <fstream>
+#include <random>
+#include <cstring>
+using namespace aly;
+//Every input is synthetic and seeded so runs on different machines time the same work.
+static const unsigned int SEED = 8675309;
+static Image1f MakeNoiseImage(int w, int h) {
+	std::mt19937 gen(SEED);
+	std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+	Image1f img(w, h);
+	for (float1& v : img.data) {
+		v = float1(dist(gen));
+	}
+	return img;
+}
+//Smooth colored cells with noise, a stand-in for a natural image.
+static ImageRGBf MakeCellImage(int w, int h, int cells) {
+	std::mt19937 gen(SEED);
+	std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+	std::vector<float2> centers(cells);
+	std::vector<float3> colors(cells);
+	for (int n = 0; n < cells; n++) {
+		centers[n] = float2(dist(gen) * w, dist(gen) * h);
+		colors[n] = float3(dist(gen), dist(gen), dist(gen));
+	}
+	ImageRGBf img(w, h);
+	for (int j = 0; j < h; j++) {
+		for (int i = 0; i < w; i++) {
+			float best = 1E30f;
+			int bestIndex = 0;
+			for (int n = 0; n < cells; n++) {
+				float d = distanceSqr(centers[n], float2((float) i, (float) j));
+				if (d < best) {
+					best = d;
+					bestIndex = n;
+				}
+			}
+			img(i, j) = clamp(colors[bestIndex] + 0.05f * float3(dist(gen) - 0.5f),
+					0.0f, 1.0f);
+		}
+	}
+	return img;
+}
+//Gaussian blobs on a dark background, so SIFT finds a stable set of extrema.
+static Image1f MakeBlobImage(int w, int h, int blobs) {
+	std::mt19937 gen(SEED);
+	std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+	Image1f img(w, h);
+	img.set(float1(0.1f));
+	for (int n = 0; n < blobs; n++) {
+		float2 c(dist(gen) * w, dist(gen) * h);
+		float sigma = 2.0f + 10.0f * dist(gen);
+		float amp = 0.2f + 0.7f * dist(gen);
+		int r = (int) (3 * sigma);
+		for (int j = std::max(0, (int) c.y - r); j < std::min(h, (int) c.y + r);
+				j++) {
+			for (int i = std::max(0, (int) c.x - r);
+					i < std::min(w, (int) c.x + r); i++) {
+				float d2 = distanceSqr(c, float2((float) i, (float) j));
+				img(i, j).x += amp * std::exp(-d2 / (2 * sigma * sigma));
+			}
+		}
+	}
+	return img;
+}
+//Signed distance to a bumpy sphere filling most of the volume.
+static Volume1f MakeBlobVolume(int dim) {
+	Volume1f vol(dim, dim, dim);
+	float3 center(0.5f * dim);
+	float radius = 0.35f * dim;
+#pragma omp parallel for
+	for (int k = 0; k < dim; k++) {
+		for (int j = 0; j < dim; j++) {
+			for (int i = 0; i < dim; i++) {
+				float3 p = float3((float) i, (float) j, (float) k) - center;
+				float bump = 0.08f * radius * std::sin(6.0f * p.x / radius)
+						* std::sin(5.0f * p.y / radius) * std::sin(4.0f * p.z / radius);
+				vol(i, j, k).x = length(p) - radius + bump;
+			}
+		}
+	}
+	return vol;
+}
+static std::shared_ptr<Mesh> MakeBlobMesh(int dim) {
+	std::shared_ptr<Mesh> mesh(new Mesh());
+	IsoSurface isosurf;
+	isosurf.solve(MakeBlobVolume(dim), *mesh, MeshType::Triangle, false, 0.0f);
+	return mesh;
+}
+//Two-region segmentation of a noisy image: terminals from intensity, edges from contrast.
+static std::shared_ptr<GridMaxFlow> MakeSegmentationGraph(int w, int h, int d,
+		int connectivity) {
+	std::mt19937 gen(SEED);
+	std::normal_distribution<float> noise(0.0f, 0.3f);
+	std::vector<float> intensity((size_t) w * h * d);
+	for (int k = 0; k < d; k++) {
+		for (int j = 0; j < h; j++) {
+			for (int i = 0; i < w; i++) {
+				float3 p((i - 0.5f * w) / w, (j - 0.5f * h) / h,
+						(d > 1) ? (k - 0.5f * d) / d : 0.0f);
+				intensity[i + w * (j + h * (size_t) k)] =
+						((length(p) < 0.3f) ? 1.0f : 0.0f) + noise(gen);
+			}
+		}
+	}
+	std::shared_ptr<GridMaxFlow> graph(new GridMaxFlow(w, h, d, connectivity));
+	for (int k = 0; k < d; k++) {
+		for (int j = 0; j < h; j++) {
+			for (int i = 0; i < w; i++) {
+				float v = intensity[i + w * (j + h * (size_t) k)];
+				graph->addNodeCapacity(i, j, k, std::max(v - 0.5f, 0.0f),
+						std::max(0.5f - v, 0.0f));
+				for (int dir = 0; dir < graph->getNeighborCount(); dir += 2) {
+					int3 nbr = int3(i, j, k) + graph->getNeighborOffset(dir);
+					if (nbr.x < 0 || nbr.y < 0 || nbr.z < 0 || nbr.x >= w
+							|| nbr.y >= h || nbr.z >= d)
+						continue;
+					float diff = v - intensity[nbr.x + w * (nbr.y + h * (size_t) nbr.z)];
+					float cap = 0.5f * std::exp(-diff * diff / 0.18f);
+					graph->setEdgeCapacity(i, j, k, dir, cap, cap);
+				}
+			}
+		}
+	}
+	return graph;
+}
+//Pressure system for a tank with a wavy free surface and a baffle, labeled like FluidSimulation does.
+struct PressureProblem {
+	Image1ub labels;
+	Image1f levelSet;
+	Image1f divergence;
+};
+static std::shared_ptr<PressureProblem> MakePressureProblem(int dim) {
+	std::shared_ptr<PressureProblem> problem(new PressureProblem());
+	problem->labels.resize(dim, dim);
+	problem->levelSet.resize(dim, dim);
+	problem->divergence.resize(dim, dim);
+	std::mt19937 gen(SEED);
+	std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+	for (int j = 0; j < dim; j++) {
+		for (int i = 0; i < dim; i++) {
+			float surface = dim * (0.6f + 0.05f * std::sin(0.05f * i));
+			bool wall = (i < 2 || j < 2 || i >= dim - 2 || j >= dim - 2)
+					|| (std::abs(i - dim / 3) < dim / 20 && j < dim / 2);
+			ObjectType type =
+					wall ? ObjectType::WALL :
+					(j < surface) ? ObjectType::FLUID : ObjectType::AIR;
+			problem->labels(i, j).x = static_cast<char>(type);
+			problem->levelSet(i, j).x = 0.1f * (j - surface);
+			problem->divergence(i, j).x =
+					(type == ObjectType::FLUID) ? 10.0f * noise(gen) : 0.0f;
+		}
+	}
+	return problem;
+}
+static void AddBenchmarks(BenchmarkSuite& suite) {
+	suite.add("image/smooth_gaussian_1f_2048", "micro", 2048 * 2048, [] {
+		std::shared_ptr<Image1f> in(new Image1f(MakeNoiseImage(2048, 2048)));
+		std::shared_ptr<Image1f> out(new Image1f());
+		return [=] {
+			Smooth(*in, *out, 3.0f);
+		};
+	});
+	suite.add("image/gradient_5x5_rgbf_1024", "micro", 1024 * 1024, [] {
+		std::shared_ptr<ImageRGBf> in(new ImageRGBf(MakeCellImage(1024, 1024, 64)));
+		std::shared_ptr<ImageRGBf> gx(new ImageRGBf()), gy(new ImageRGBf());
+		return [=] {
+			Gradient5x5(*in, *gx, *gy);
+		};
+	});
+	suite.add("image/gaussian_pyramid_rgbf_2048", "micro", 2048 * 2048, [] {
+		std::shared_ptr<ImageRGBf> in(new ImageRGBf(MakeCellImage(2048, 2048, 64)));
+		std::shared_ptr<std::vector<ImageRGBf>> levels(new std::vector<ImageRGBf>());
+		return [=] {
+			BuildGaussianPyramid(*in, *levels, 8);
+		};
+	});
+	suite.add("image/laplacian_pyramid_collapse_rgbf_2048", "micro", 2048 * 2048,
+			[] {
+				std::shared_ptr<ImageRGBf> in(new ImageRGBf(MakeCellImage(2048, 2048, 64)));
+				std::shared_ptr<ImageRGBf> out(new ImageRGBf());
+				std::shared_ptr<std::vector<ImageRGBf>> levels(new std::vector<ImageRGBf>());
+				return [=] {
+					BuildLaplacianPyramid(*in, *levels, 8);
+					CollapseLaplacianPyramid(*levels, *out);
+				};
+			});
+	//Fixed iteration count so the timing does not depend on convergence.
+	const int CG_DIM = 256;
+	const int CG_ITERS = 200;
+	suite.add("sparse/cg_poisson2d_256", "micro", (int64_t) CG_DIM * CG_DIM * CG_ITERS,
+			[=] {
+				const int N = CG_DIM * CG_DIM;
+				SparseMatrix1f L(N, N);
+				for (int j = 0; j < CG_DIM; j++) {
+					for (int i = 0; i < CG_DIM; i++) {
+						int n = i + CG_DIM * j;
+						L(n, n) = float1(4.01f);
+						if (i > 0) L(n, n - 1) = float1(-1.0f);
+						if (i < CG_DIM - 1) L(n, n + 1) = float1(-1.0f);
+						if (j > 0) L(n, n - CG_DIM) = float1(-1.0f);
+						if (j < CG_DIM - 1) L(n, n + CG_DIM) = float1(-1.0f);
+					}
+				}
+				std::shared_ptr<CompressedSparseMatrix1f> A(new CompressedSparseMatrix1f(L));
+				std::shared_ptr<Vector1f> b(new Vector1f(N)), x(new Vector1f(N));
+				Image1f rhs = MakeNoiseImage(CG_DIM, CG_DIM);
+				for (int n = 0; n < N; n++) {
+					(*b)[n] = rhs.data[n];
+				}
+				return [=] {
+					x->set(0.0f);
+					SolveCG(*b, *A, *x, CG_ITERS, 0.0f);
+				};
+			});
+	const int LOCATOR_POINTS = 200000;
+	std::shared_ptr<std::vector<float3>> points(new std::vector<float3>(LOCATOR_POINTS));
+	{
+		std::mt19937 gen(SEED);
+		std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+		for (float3& pt : *points) {
+			pt = float3(dist(gen), dist(gen), dist(gen));
+		}
+	}
+	suite.add("locator/kdtree_build_200k", "micro", LOCATOR_POINTS, [=] {
+		return [=] {
+			Locator3f locator;
+			locator.insert(*points);
+		};
+	});
+	suite.add("locator/kdtree_closest_100k", "micro", 100000, [=] {
+		std::shared_ptr<Locator3f> locator(new Locator3f(*points));
+		std::shared_ptr<std::vector<float3>> queries(new std::vector<float3>(100000));
+		std::mt19937 gen(SEED + 1);
+		std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+		for (float3& pt : *queries) {
+			pt = float3(dist(gen), dist(gen), dist(gen));
+		}
+		return [=] {
+			int64_t sum = 0;
+			for (const float3& pt : *queries) {
+				sum += locator->closest(pt).index;
+			}
+			if (sum < 0)
+				std::cerr << "Locator returned no point." << std::endl;
+		};
+	});
+	const float LOCATOR_RADIUS = 0.05f;
+	suite.add("locator/kdtree_radius_200k", "micro", LOCATOR_POINTS, [=] {
+		std::shared_ptr<Locator3f> locator(new Locator3f(*points));
+		return [=] {
+			int64_t sum = 0;
+#pragma omp parallel for reduction(+:sum)
+			for (int n = 0; n < LOCATOR_POINTS; n++) {
+				std::vector<float3i> result;
+				locator->closest((*points)[n], LOCATOR_RADIUS, result);
+				sum += (int64_t) result.size();
+			}
+			if (sum < LOCATOR_POINTS)
+				std::cerr << "Locator missed points." << std::endl;
+		};
+	});
+	suite.add("locator/spatial_hash_build_200k", "micro", LOCATOR_POINTS, [=] {
+		return [=] {
+			SpatialHash3f hash(*points, LOCATOR_RADIUS);
+		};
+	});
+	suite.add("locator/spatial_hash_neighbors_200k", "micro", LOCATOR_POINTS, [=] {
+		std::shared_ptr<SpatialHash3f> hash(new SpatialHash3f(*points, LOCATOR_RADIUS));
+		return [=] {
+			std::vector<int> offsets, indexes;
+			hash->neighbors(LOCATOR_RADIUS, offsets, indexes, true);
+			if ((int) indexes.size() < LOCATOR_POINTS)
+				std::cerr << "Spatial hash missed points." << std::endl;
+		};
+	});
+	std::shared_ptr<std::shared_ptr<Mesh>> blobMesh(new std::shared_ptr<Mesh>());
+	auto getMesh = [blobMesh] {
+		if (blobMesh->get() == nullptr)
+			*blobMesh = MakeBlobMesh(128);
+		return *blobMesh;
+	};
+	suite.add("intersector/build_blob128", "micro", 0, [=] {
+		std::shared_ptr<Mesh> mesh = getMesh();
+		return [=] {
+			Intersector kdTree(*mesh, 12);
+		};
+	});
+	const int RAY_DIM = 512;
+	suite.add("intersector/ray_queries_512x512", "micro", RAY_DIM * RAY_DIM, [=] {
+		std::shared_ptr<Mesh> mesh = getMesh();
+		std::shared_ptr<Intersector> kdTree(new Intersector(*mesh, 12));
+		return [=] {
+			float3 center(64.0f);
+#pragma omp parallel for
+			for (int j = 0; j < RAY_DIM; j++) {
+				for (int i = 0; i < RAY_DIM; i++) {
+					float3 org(i * 128.0f / RAY_DIM, j * 128.0f / RAY_DIM, -16.0f);
+					kdTree->intersectRayDistance(org, normalize(center - org));
+				}
+			}
+		};
+	});
+	suite.add("intersector/closest_point_20k", "micro", 20000, [=] {
+		std::shared_ptr<Mesh> mesh = getMesh();
+		std::shared_ptr<Intersector> kdTree(new Intersector(*mesh, 12));
+		return [=] {
+			const int N = 20000;
+#pragma omp parallel for
+			for (int n = 0; n < N; n++) {
+				kdTree->closestPoint(64.0f + 60.0f * (*points)[n]);
+			}
+		};
+	});
+	const std::pair<std::string, DistanceFieldMethod> marchMethods[] = {
+			{ "heap", DistanceFieldMethod::FastMarching },
+			{ "bucketed", DistanceFieldMethod::Bucketed },
+			{ "fast_iterative", DistanceFieldMethod::FastIterative } };
+	for (auto pr : marchMethods) {
+		DistanceFieldMethod method = pr.second;
+		suite.add("fastmarch/distance_field_96_" + pr.first, "macro",
+				96 * 96 * 96, [=] {
+					std::shared_ptr<Volume1f> in(new Volume1f(MakeBlobVolume(96)));
+					std::shared_ptr<Volume1f> out(new Volume1f());
+					return [=] {
+						DistanceField3f df(method);
+						df.solve(*in, *out, 8.0f);
+					};
+				});
+	}
+	const std::pair<std::string, LaplacePreconditioner> pressureMethods[] = {
+			{ "mic", LaplacePreconditioner::IncompleteCholesky },
+			{ "multigrid", LaplacePreconditioner::Multigrid } };
+	for (auto pr : pressureMethods) {
+		LaplacePreconditioner method = pr.second;
+		suite.add("fluid/pressure_cg_256_" + pr.first, "macro", 256 * 256, [=] {
+			std::shared_ptr<PressureProblem> problem = MakePressureProblem(256);
+			Image1f x(256, 256);
+			x.set(float1(0.0f));
+			//Wall time does not show how well the preconditioner works, so report the iteration count as well.
+			int iterations = SolveLaplace2d(problem->labels, problem->levelSet, x,
+					problem->divergence, 1.0f / 256, method);
+			std::cerr << "converged in " << iterations << " iterations, ";
+			return [=] {
+				Image1f x(256, 256);
+				x.set(float1(0.0f));
+				SolveLaplace2d(problem->labels, problem->levelSet, x,
+						problem->divergence, 1.0f / 256, method);
+			};
+		});
+	}
+	suite.add("isosurface/triangles_256", "macro", 256 * 256 * 256, [] {
+		std::shared_ptr<Volume1f> in(new Volume1f(MakeBlobVolume(256)));
+		return [=] {
+			Mesh mesh;
+			IsoSurface isosurf;
+			isosurf.solve(*in, mesh, MeshType::Triangle, false, 0.0f);
+		};
+	});
+	suite.add("maxflow/bk_2d_4conn_512", "macro", 512 * 512, [] {
+		std::shared_ptr<GridMaxFlow> graph = MakeSegmentationGraph(512, 512, 1, 4);
+		return [=] {
+			GridMaxFlow flow = *graph;
+			flow.solve();
+		};
+	});
+	suite.add("maxflow/bk_3d_6conn_96", "macro", 96 * 96 * 96, [] {
+		std::shared_ptr<GridMaxFlow> graph = MakeSegmentationGraph(96, 96, 96, 6);
+		return [=] {
+			GridMaxFlow flow = *graph;
+			flow.solve();
+		};
+	});
+	suite.add("maxflow/push_relabel_3d_6conn_96", "macro", 96 * 96 * 96, [] {
+		std::shared_ptr<GridMaxFlow> graph = MakeSegmentationGraph(96, 96, 96, 6);
+		return [=] {
+			GridMaxFlow flow = *graph;
+			flow.solveParallel();
+		};
+	});
+	suite.add("vision/slic_rgbf_512", "macro", 512 * 512, [] {
+		std::shared_ptr<ImageRGBf> in(new ImageRGBf(MakeCellImage(512, 512, 96)));
+		return [=] {
+			SuperPixels superPixels;
+			superPixels.solve(*in, 1024, 10);
+		};
+	});
+	suite.add("vision/sift_1024", "macro", 1024 * 1024, [] {
+		std::shared_ptr<Image1f> in(new Image1f(MakeBlobImage(1024, 1024, 400)));
+		return [=] {
+			Sift sift;
+			sift.solve(*in, true);
+		};
+	});
+	suite.add("mesh/vertex_neighbors_blob128", "micro", 0, [=] {
+		std::shared_ptr<Mesh> mesh = getMesh();
+		return [=] {
+			//Include building the topology, not just reading the cached one.
+			mesh->invalidateTopology();
+			MeshListNeighborTable nbrTable;
+			CreateOrderedVertexNeighborTable(*mesh, nbrTable);
+		};
+	});
+	suite.add("mesh/smooth_normals_blob128", "micro", 0, [=] {
+		std::shared_ptr<Mesh> mesh(new Mesh());
+		getMesh()->clone(*mesh);
+		return [=] {
+			mesh->updateVertexNormals(false, 4);
+		};
+	});
+	suite.add("mesh/subdivide_loop_blob128", "macro", 0, [=] {
+		std::shared_ptr<Mesh> mesh = getMesh();
+		return [=] {
+			Mesh copy;
+			mesh->clone(copy);
+			Subdivide(copy, SubDivisionScheme::Loop);
+		};
+	});
+	suite.add("mesh/subdivide_catmull_clark_blob128", "macro", 0, [=] {
+		std::shared_ptr<Mesh> mesh = getMesh();
+		return [=] {
+			Mesh copy;
+			mesh->clone(copy);
+			Subdivide(copy, SubDivisionScheme::CatmullClark);
+		};
+	});
+	suite.add("mesh/decimate_quarter_blob128", "macro", 0, [=] {
+		std::shared_ptr<Mesh> mesh = getMesh();
+		return [=] {
+			Mesh copy;
+			mesh->clone(copy);
+			MeshDecimation decimate;
+			decimate.solveToTriangleCount(copy, copy.triIndexes.size() / 4);
+		};
+	});
+	suite.add("mesh/subdivide_stencil_eval_blob128", "micro", 0, [=] {
+		std::shared_ptr<Mesh> mesh = getMesh();
+		std::shared_ptr<SubdivisionStencils> stencils(new SubdivisionStencils());
+		stencils->build(*mesh, SubDivisionScheme::CatmullClark, 2);
+		std::shared_ptr<Mesh> refined(new Mesh());
+		return [=] {
+			stencils->evaluate(*mesh, *refined);
+		};
+	});
+	//Mesh files go to the working directory and are removed when the program exits.
+	suite.add("mesh/write_ply_binary", "macro", 0, [=] {
+		std::shared_ptr<Mesh> mesh = getMesh();
+		return [=] {
+			WritePlyMeshToFile("alloy_bench_mesh.ply", *mesh, true);
+		};
+	});
+	suite.add("mesh/read_ply_binary", "macro", 0, [=] {
+		WritePlyMeshToFile("alloy_bench_mesh.ply", *getMesh(), true);
+		return [] {
+			Mesh mesh;
+			ReadMeshFromFile("alloy_bench_mesh.ply", mesh);
+		};
+	});
+	suite.add("mesh/write_obj", "macro", 0, [=] {
+		std::shared_ptr<Mesh> mesh = getMesh();
+		return [=] {
+			WriteObjMeshToFile("alloy_bench_mesh.obj", *mesh);
+		};
+	});
+	suite.add("mesh/read_obj", "macro", 0, [=] {
+		WriteObjMeshToFile("alloy_bench_mesh.obj", *getMesh());
+		return [] {
+			Mesh mesh;
+			ReadObjMeshFromFile("alloy_bench_mesh.obj", mesh);
+		};
+	});
+}
+static void PrintUsage() {
+	std::cout
+			<< "Usage: alloy_bench [--list] [--filter text] [--runs N] [--warmup N] [--threads N]\n"
+			<< "                   [--format json|csv] [--output file] [--baseline file.csv] [--threshold 0.1]\n"
+			<< "Results go to stdout (or --output) and progress to stderr. With --baseline the exit\n"
+			<< "code is 2 if any median time grew by more than the threshold." << std::endl;
+}
+int main(int argc, char *argv[]) {
+	BenchmarkOptions options;
+	std::string format = "json";
+	std::string outputFile;
+	std::string baselineFile;
+	double threshold = 0.1;
+	bool list = false;
+	for (int n = 1; n < argc; n++) {
+		std::string arg = argv[n];
+		bool hasValue = (n + 1 < argc);
+		if (arg == "--list") {
+			list = true;
+		} else if (arg == "--filter" && hasValue) {
+			options.filter = argv[++n];
+		} else if (arg == "--runs" && hasValue) {
+			options.runs = std::max(1, atoi(argv[++n]));
+		} else if (arg == "--warmup" && hasValue) {
+			options.warmup = std::max(0, atoi(argv[++n]));
+		} else if (arg == "--threads" && hasValue) {
+			options.threads = atoi(argv[++n]);
+		} else if (arg == "--format" && hasValue) {
+			format = argv[++n];
+		} else if (arg == "--output" && hasValue) {
+			outputFile = argv[++n];
+		} else if (arg == "--baseline" && hasValue) {
+			baselineFile = argv[++n];
+		} else if (arg == "--threshold" && hasValue) {
+			threshold = atof(argv[++n]);
+		} else {
+			PrintUsage();
+			return (arg == "--help") ? 0 : 1;
+		}
+	}
+	if (format != "json" && format != "csv") {
+		PrintUsage();
+		return 1;
+	}
+	BenchmarkSuite suite;
+	AddBenchmarks(suite);
+	if (list) {
+		for (const std::string& name : suite.getNames()) {
+			std::cout << name << std::endl;
+		}
+		return 0;
+	}
+	int regressions = 0;
+	try {
+		std::vector<BenchmarkResult> results = suite.run(options, std::cerr);
+		std::ofstream file;
+		if (outputFile.size() > 0) {
+			file.open(outputFile);
+			if (!file.is_open()) {
+				throw std::runtime_error(
+						MakeString() << "Could not open " << outputFile << " for writing.");
+			}
+		}
+		std::ostream& out = (outputFile.size() > 0) ? file : std::cout;
+		if (format == "csv") {
+			WriteBenchmarkCSV(out, results);
+		} else {
+			WriteBenchmarkJSON(out, results, options);
+		}
+		if (baselineFile.size() > 0) {
+			regressions = CompareBenchmarkBaseline(baselineFile, results, threshold,
+					std::cerr);
+		}
+	} catch (std::exception& e) {
+		std::cerr << "Error: " << e.what() << std::endl;
+		regressions = -1;
+	}
+	RemoveFile("alloy_bench_mesh.ply");
+	RemoveFile("alloy_bench_mesh.obj");
+	if (regressions < 0)
+		return 1;
+	return (regressions > 0) ? 2 : 0;
+}
@@ -0,0 +1,222 @@
+/*
+ * Copyright(C) 2015, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "bench/AlloyBenchmark.h"
+#include "common/AlloyCommon.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <stdexcept>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <iomanip>
+#include <omp.h>
+namespace aly {
+void BenchmarkSuite::add(const std::string& name, const std::string& group,
+		int64_t items, const Factory& factory) {
+	Benchmark bench;
+	bench.name = name;
+	bench.group = group;
+	bench.items = items;
+	bench.factory = factory;
+	benchmarks.push_back(bench);
+}
+std::vector<std::string> BenchmarkSuite::getNames() const {
+	std::vector<std::string> names;
+	for (const Benchmark& bench : benchmarks) {
+		names.push_back(bench.name);
+	}
+	return names;
+}
+std::vector<BenchmarkResult> BenchmarkSuite::run(
+		const BenchmarkOptions& options, std::ostream& log) const {
+	typedef std::chrono::steady_clock Clock;
+	if (options.threads > 0) {
+		omp_set_num_threads(options.threads);
+	}
+	std::vector<BenchmarkResult> results;
+	for (const Benchmark& bench : benchmarks) {
+		if (options.filter.size() > 0
+				&& bench.name.find(options.filter) == std::string::npos) {
+			continue;
+		}
+		log << bench.name << " ... " << std::flush;
+		std::function<void()> func = bench.factory();
+		for (int n = 0; n < options.warmup; n++) {
+			func();
+		}
+		BenchmarkResult result;
+		result.name = bench.name;
+		result.group = bench.group;
+		result.items = bench.items;
+		for (int n = 0; n < std::max(options.runs, 1); n++) {
+			Clock::time_point start = Clock::now();
+			func();
+			result.times.push_back(
+					std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+		}
+		std::vector<double> sorted = result.times;
+		std::sort(sorted.begin(), sorted.end());
+		size_t N = sorted.size();
+		result.min = sorted.front();
+		result.max = sorted.back();
+		result.median =
+				(N % 2 == 1) ?
+						sorted[N / 2] : 0.5 * (sorted[N / 2 - 1] + sorted[N / 2]);
+		double sum = 0.0;
+		for (double t : sorted) {
+			sum += t;
+		}
+		result.mean = sum / N;
+		double var = 0.0;
+		for (double t : sorted) {
+			var += (t - result.mean) * (t - result.mean);
+		}
+		result.stddev = (N > 1) ? std::sqrt(var / (N - 1)) : 0.0;
+		log << result.median << " ms" << std::endl;
+		results.push_back(result);
+	}
+	return results;
+}
+static std::string JsonString(const std::string& str) {
+	std::stringstream ss;
+	ss << "\"";
+	for (char c : str) {
+		if (c == '"' || c == '\\') {
+			ss << '\\' << c;
+		} else if ((unsigned char) c < 0x20) {
+			ss << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+					<< (int) c << std::dec;
+		} else {
+			ss << c;
+		}
+	}
+	ss << "\"";
+	return ss.str();
+}
+void WriteBenchmarkJSON(std::ostream& out,
+		const std::vector<BenchmarkResult>& results,
+		const BenchmarkOptions& options) {
+	out << std::setprecision(9);
+	out << "{\n";
+	out << "  \"suite\": \"alloy_bench\",\n";
+	out << "  \"threads\": " << omp_get_max_threads() << ",\n";
+	out << "  \"runs\": " << options.runs << ",\n";
+	out << "  \"warmup\": " << options.warmup << ",\n";
+	out << "  \"benchmarks\": [";
+	for (size_t n = 0; n < results.size(); n++) {
+		const BenchmarkResult& r = results[n];
+		out << ((n > 0) ? ",\n" : "\n") << "    {";
+		out << "\"name\": " << JsonString(r.name) << ", ";
+		out << "\"group\": " << JsonString(r.group) << ", ";
+		out << "\"items\": " << r.items << ", ";
+		out << "\"min_ms\": " << r.min << ", ";
+		out << "\"median_ms\": " << r.median << ", ";
+		out << "\"mean_ms\": " << r.mean << ", ";
+		out << "\"max_ms\": " << r.max << ", ";
+		out << "\"stddev_ms\": " << r.stddev << ", ";
+		out << "\"items_per_sec\": " << r.throughput() << ", ";
+		out << "\"times_ms\": [";
+		for (size_t t = 0; t < r.times.size(); t++) {
+			out << ((t > 0) ? ", " : "") << r.times[t];
+		}
+		out << "]}";
+	}
+	out << "\n  ]\n}" << std::endl;
+}
+void WriteBenchmarkCSV(std::ostream& out,
+		const std::vector<BenchmarkResult>& results) {
+	out << std::setprecision(9);
+	out
+			<< "name,group,items,min_ms,median_ms,mean_ms,max_ms,stddev_ms,items_per_sec,times_ms"
+			<< std::endl;
+	for (const BenchmarkResult& r : results) {
+		out << r.name << "," << r.group << "," << r.items << "," << r.min << ","
+				<< r.median << "," << r.mean << "," << r.max << "," << r.stddev
+				<< "," << r.throughput() << ",";
+		for (size_t t = 0; t < r.times.size(); t++) {
+			out << ((t > 0) ? ";" : "") << r.times[t];
+		}
+		out << std::endl;
+	}
+}
+static std::vector<std::string> SplitCSV(const std::string& line) {
+	std::vector<std::string> tokens;
+	std::stringstream ss(line);
+	std::string token;
+	while (std::getline(ss, token, ',')) {
+		if (token.size() > 0 && token.back() == '\r')
+			token.pop_back();
+		tokens.push_back(token);
+	}
+	return tokens;
+}
+int CompareBenchmarkBaseline(const std::string& csvFile,
+		const std::vector<BenchmarkResult>& results, double threshold,
+		std::ostream& log) {
+	std::ifstream in(csvFile);
+	if (!in.is_open()) {
+		throw std::runtime_error(
+				MakeString() << "Could not open baseline " << csvFile);
+	}
+	std::string line;
+	std::getline(in, line);
+	std::vector<std::string> header = SplitCSV(line);
+	int nameColumn = -1, medianColumn = -1;
+	for (int c = 0; c < (int) header.size(); c++) {
+		if (header[c] == "name")
+			nameColumn = c;
+		if (header[c] == "median_ms")
+			medianColumn = c;
+	}
+	if (nameColumn < 0 || medianColumn < 0) {
+		throw std::runtime_error(
+				MakeString() << "Baseline " << csvFile
+						<< " has no name and median_ms columns.");
+	}
+	std::map<std::string, double> baseline;
+	while (std::getline(in, line)) {
+		std::vector<std::string> tokens = SplitCSV(line);
+		if ((int) tokens.size() > std::max(nameColumn, medianColumn)) {
+			baseline[tokens[nameColumn]] = std::atof(tokens[medianColumn].c_str());
+		}
+	}
+	int regressions = 0;
+	for (const BenchmarkResult& r : results) {
+		auto iter = baseline.find(r.name);
+		if (iter == baseline.end() || iter->second <= 0.0) {
+			log << r.name << ": no baseline" << std::endl;
+			continue;
+		}
+		double ratio = r.median / iter->second;
+		bool regressed = (ratio > 1.0 + threshold);
+		if (regressed)
+			regressions++;
+		std::stringstream change;
+		change << std::fixed << std::setprecision(2) << ratio;
+		log << r.name << ": " << iter->second << " ms -> " << r.median << " ms ("
+				<< change.str() << "x)" << (regressed ? " REGRESSION" : "")
+				<< std::endl;
+	}
+	return regressions;
+}
+}
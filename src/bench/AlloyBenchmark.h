@@ -0,0 +1,88 @@
+/*
+ * Copyright(C) 2015, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef ALLOYBENCHMARK_H_
+#define ALLOYBENCHMARK_H_
+#include <string>
+#include <vector>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <cstdint>
+namespace aly {
+/*
+ Headless harness for reproducible timing of library kernels. A benchmark
+ factory builds its synthetic inputs once and returns the function to time,
+ so only benchmarks that pass the filter pay for their setup. Results are
+ written as JSON or CSV, and a CSV from an earlier run can be used as a
+ baseline to flag regressions in the median time.
+ */
+struct BenchmarkResult {
+	std::string name;
+	std::string group;
+	int64_t items = 0;
+	std::vector<double> times;
+	double min = 0.0;
+	double max = 0.0;
+	double mean = 0.0;
+	double median = 0.0;
+	double stddev = 0.0;
+	//Work units per second at the median time, or zero if the benchmark does not count items.
+	double throughput() const {
+		return (items > 0 && median > 0.0) ? items / (median * 1E-3) : 0.0;
+	}
+};
+struct BenchmarkOptions {
+	int runs = 5;
+	int warmup = 1;
+	int threads = 0;
+	std::string filter;
+};
+class BenchmarkSuite {
+public:
+	typedef std::function<std::function<void()>()> Factory;
+protected:
+	struct Benchmark {
+		std::string name;
+		std::string group;
+		int64_t items;
+		Factory factory;
+	};
+	std::vector<Benchmark> benchmarks;
+public:
+	//items is the number of work units one run processes (pixels, queries, ...), or zero.
+	void add(const std::string& name, const std::string& group, int64_t items,
+			const Factory& factory);
+	std::vector<std::string> getNames() const;
+	//Times are in milliseconds. Progress is written to log.
+	std::vector<BenchmarkResult> run(const BenchmarkOptions& options,
+			std::ostream& log) const;
+};
+void WriteBenchmarkJSON(std::ostream& out,
+		const std::vector<BenchmarkResult>& results,
+		const BenchmarkOptions& options);
+void WriteBenchmarkCSV(std::ostream& out,
+		const std::vector<BenchmarkResult>& results);
+//Returns the number of benchmarks whose median grew by more than threshold (0.1 = 10%) over a CSV baseline.
+int CompareBenchmarkBaseline(const std::string& csvFile,
+		const std::vector<BenchmarkResult>& results, double threshold,
+		std::ostream& log);
+}
+#endif /* ALLOYBENCHMARK_H_ */
@@ -53,56 +53,77 @@ size_t Compress(const unsigned char* input, size_t input_sz,
 		return input_sz;
 	}
 }
-void Decompress(const unsigned char* input, size_t input_sz,
+size_t Decompress(const unsigned char* input, size_t input_sz,
 		unsigned char* output, size_t output_sz, CompressionType type) {
+	//Input may come straight from a file, so every decoder is bounded by both buffers and failures throw.
+	if (input_sz == 0)
+		return 0;
 	switch (type) {
 		case CompressionType::ZIP:
 		{
 			mz_ulong outSize = output_sz;
 			int ret = mz_uncompress(output, &outSize, input, input_sz);
-			assert(ret == MZ_OK);
-			break;
+			if (ret != MZ_OK)
+				throw std::runtime_error("ZIP decompression failed.");
+			return outSize;
 		}
 		case CompressionType::LFW:
-			DecompressLZF(input, input_sz, output, output_sz);
-			break;
+		{
+			unsigned int outSize = DecompressLZF(input, input_sz, output, output_sz);
+			if (outSize == 0)
+				throw std::runtime_error("LZF decompression failed.");
+			return outSize;
+		}
 		case CompressionType::ZSTD:
-			ZSTD_decompress(output, output_sz, input, input_sz);
-			break;
+		{
+			size_t outSize = ZSTD_decompress(output, output_sz, input, input_sz);
+			if (ZSTD_isError(outSize))
+				throw std::runtime_error(
+						std::string("ZSTD decompression failed: ")
+								+ ZSTD_getErrorName(outSize));
+			return outSize;
+		}
 		case CompressionType::LZ4:
-			LZ4_decompress_fast((const char*) input, (char*) output, output_sz);
-			break;
+		{
+			int outSize = LZ4_decompress_safe((const char*) input, (char*) output,
+					(int) input_sz, (int) output_sz);
+			if (outSize < 0)
+				throw std::runtime_error("LZ4 decompression failed.");
+			return outSize;
+		}
 		case CompressionType::NONE:
 		default:
+			if (input_sz > output_sz)
+				throw std::runtime_error("Uncompressed input exceeds output size.");
 			std::memcpy(output,input,input_sz);
-			break;
+			return input_sz;
 	}
 }
 size_t Compress(const std::string& input,std::string& output,CompressionType type){
 	size_t est=EstimateOutputSize(input.size(),type);
 	output.resize(est);
-	size_t sz=Compress((const unsigned char*)input.c_str(),input.size(),(unsigned char*)output.c_str(),sz,type);
+	size_t sz=Compress((const unsigned char*)input.c_str(),input.size(),(unsigned char*)output.c_str(),est,type);
 	if(est!=sz)output.erase(sz,est-sz);
 	return sz;
 }
-void Decompress(const std::string& input,std::string& output,CompressionType type){
+size_t Decompress(const std::string& input,std::string& output,CompressionType type){
 	if(output.size()==0){
 		throw std::runtime_error("Must pre-allocate output size before decompression.");
 	}
-	Decompress((const unsigned char*)input.c_str(),input.size(),(unsigned char*)output.c_str(),output.size(),type);
+	return Decompress((const unsigned char*)input.c_str(),input.size(),(unsigned char*)output.c_str(),output.size(),type);
 }
 
 size_t Compress(const std::vector<uint8_t>& input,std::vector<uint8_t>& output,CompressionType type){
 	size_t est=EstimateOutputSize(input.size(),type);
 	output.resize(est);
-	size_t sz=Compress((const unsigned char*)input.data(),input.size(),(unsigned char*)output.data(),sz,type);
+	size_t sz=Compress((const unsigned char*)input.data(),input.size(),(unsigned char*)output.data(),est,type);
 	if(est!=sz)output.erase(output.begin()+sz,output.end());
 	return sz;
 }
-void Decompress(const std::vector<uint8_t>& input,std::vector<uint8_t>& output,CompressionType type){
+size_t Decompress(const std::vector<uint8_t>& input,std::vector<uint8_t>& output,CompressionType type){
 	if(output.size()==0){
 		throw std::runtime_error("Must pre-allocate output size before decompression.");
 	}
-	Decompress((const unsigned char*)input.data(),input.size(),(unsigned char*)output.data(),output.size(),type);
+	return Decompress((const unsigned char*)input.data(),input.size(),(unsigned char*)output.data(),output.size(),type);
 }
 }
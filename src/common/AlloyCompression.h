@@ -34,13 +34,14 @@ namespace aly {
 	}
 	size_t EstimateOutputSize(size_t sz,CompressionType type);
 	size_t Compress(const unsigned char* input, size_t input_sz, unsigned char* output, size_t output_sz,CompressionType type);
-	void Decompress(const unsigned char* input, size_t input_sz, unsigned char* output, size_t output_sz,CompressionType type);
+	//Returns the number of bytes written to output. Throws if the input is corrupt or does not fit in output.
+	size_t Decompress(const unsigned char* input, size_t input_sz, unsigned char* output, size_t output_sz,CompressionType type);
 
 	size_t Compress(const std::string& input,std::string& output,CompressionType type);
-	void Decompress(const std::string& input,std::string& output,CompressionType type);
+	size_t Decompress(const std::string& input,std::string& output,CompressionType type);
 
 	size_t Compress(const std::vector<uint8_t>& input,std::vector<uint8_t>& output,CompressionType type);
-	void Decompress(const std::vector<uint8_t>& input,std::vector<uint8_t>& output,CompressionType type);
+	size_t Decompress(const std::vector<uint8_t>& input,std::vector<uint8_t>& output,CompressionType type);
 
 }
 #endif /* SRC_COMMON_ALLOYCOMPRESSION_H_ */
@@ -123,7 +123,7 @@ void MeshOptimizationEx::detailTransfer(aly::Mesh& src, const aly::Mesh& tar, bo
 		for (int i = 0; i < N; i += stride) {
 			int n = (stride == 1) ? i : RandomUniform(i, std::min(i + stride, N) - 1);
 			float3 pt;
-			KDTriangle* tri;
+			KDTrianglePtr tri;
 			double d = locator.closestPoint(src.vertexLocations[n], searchDistance, pt, tri);
 			if (d != NO_HIT_DISTANCE) {
 				float3 bary = float3(tri->toBary(pt));
@@ -144,11 +144,12 @@ void MeshSmoothEx::smooth() {
 		b[index] = pt;
 		index++;
 	}
+	AlgebraicMultigridPreconditioner<float, 3> preconditioner;
 	SolveBICGStab(b, A, mesh.vertexLocations, 100, 1E-6f,
-			[this](int iter,double error) {
-				textLabel->setLabel( MakeString() << "Smooth [" << iter << "] Error: " << error);
+			[this](int iter,double error,double elapsed) {
+				textLabel->setLabel( MakeString() << "Smooth [" << iter << "] Error: " << error<<" Time: "<<elapsed<<" sec");
 				return true;
-			});
+			}, &preconditioner);
 	mesh.updateVertexNormals();
 }
 void MeshSmoothEx::draw(AlloyContext* context) {
@@ -22,15 +22,27 @@
 #include "common/cereal/archives/xml.hpp"
 #include "graphics/AlloyCamera.h"
 #include "graphics/AlloyIntersector.h"
+#include "graphics/AlloyIsoContour.h"
+#include "graphics/AlloyIsoSurface.h"
 #include "graphics/AlloyLocator.h"
+#include "graphics/AlloySpatialHash.h"
 #include "image/AlloyDistanceField.h"
 #include "math/AlloySparseSolve.h"
 #include "math/AlloyVecMath.h"
 #include "image/AlloyImage.h"
+#include "image/AlloyBrickedVolume.h"
+#include "image/AlloyCompressedVolume.h"
+#include "vision/AlloyMaxFlow.h"
+#include "vision/NarrowBand.h"
+#include "system/AlloyExecutor.h"
+#include "ui/AlloyWorker.h"
 #include "math/AlloyVector.h"
 #include "system/AlloyFileUtil.h"
 #include "ui/AlloyUI.h"
 #include "graphics/AlloyMesh.h"
+#include "graphics/AlloyOBJ.h"
+#include "graphics/AlloySubdivision.h"
+#include "graphics/MeshDecimation.h"
 #include "math/AlloyDenseSolve.h"
 #include "image/AlloyImageProcessing.h"
 #include "math/AlloySparseMatrix.h"
@@ -41,6 +53,8 @@
 #include <iostream>
 #include <fstream>
 #include <random>
+#include <set>
+#include <chrono>
 #ifndef ALY_WINDOWS
 #pragma GCC diagnostic ignored "-Wunused-variable"
 #pragma GCC diagnostic ignored "-Wunused-but-set-variable"
@@ -413,17 +427,58 @@ namespace aly {
 		Vector1f x1(A.cols);
 
 		for (int i = 0; i < (int)A.rows; i++) {
-			for (int jj = -2; jj <= 2; jj++) {
+			for (int jj = std::max(-2, -i); jj <= std::min(2, (int)A.cols - 1 - i); jj++) {
 				A.set(i, i + jj, float4(0.2f));
 				A1.set(i, i + jj, float1(0.2f));
 			}
 			b[i] = float4((rand() % 1000) / 1000.0f);
 			b1[i] = float1((rand() % 1000) / 1000.0f);
 		}
+		CompressedSparseMatrix1f C1(A1);
+		Vector1f y1, z1;
+		Multiply(y1, A1, b1);
+		Multiply(z1, C1, b1);
+		float err = lengthL1(y1 - z1);
+		std::cout << "Compressed SpMV error " << err << std::endl;
+		if (err > 1E-4f) {
+			return false;
+		}
+		MultiplyTranspose(z1, C1, b1);
+		Multiply(y1, A1.transpose(), b1);
+		err = lengthL1(y1 - z1);
+		std::cout << "Compressed transpose SpMV error " << err << std::endl;
+		if (err > 1E-4f) {
+			return false;
+		}
 		SolveVecCG(b, A, x);
 		SolveCG(b1, A1, x1);
 		SolveVecBICGStab(b, A, x);
 		SolveBICGStab(b1, A1, x1);
+		{
+			SparseMatrix1f L(A1.rows, A1.cols);
+			for (int i = 0; i < (int)L.rows; i++) {
+				L.set(i, i, 2.001f);
+				if (i > 0) L.set(i, i - 1, -1.0f);
+				if (i < (int)L.rows - 1) L.set(i, i + 1, -1.0f);
+			}
+			JacobiPreconditioner<float, 1> jacobi;
+			IncompleteCholeskyPreconditioner<float, 1> ic;
+			IncompleteLUPreconditioner<float, 1> ilu;
+			AlgebraicMultigridPreconditioner<float, 1> amg(0.08, 16);
+			std::vector<std::pair<std::string, SparsePreconditioner<float, 1>*>> preconditioners = {
+				{ "None", nullptr },{ "Jacobi", &jacobi },{ "IC(0)", &ic },{ "ILU(0)", &ilu },{ "AMG", &amg } };
+			for (auto pr : preconditioners) {
+				int iterations = 0;
+				double elapsed = 0.0;
+				x1.setZero();
+				SolveCG(b1, L, x1, 1000, 1E-10f, [&](int iter, double, double seconds) {
+					iterations = iter;
+					elapsed = seconds;
+					return true;
+				}, pr.second);
+				std::cout << pr.first << " preconditioned CG iterations " << iterations << " time " << elapsed << " sec" << std::endl;
+			}
+		}
 		std::ofstream os("matrix.json");
 		cereal::JSONOutputArchive archiver(os);
 		archiver(A);
@@ -445,15 +500,23 @@ namespace aly {
 		Image1f distImg;
 		float voxelSize = maxDim / vol.rows;
 		float maxDistance = 3.0f *voxelSize;
-#pragma omp parallel for
+		std::vector<float3> queries(vol.size());
 		for (int k = 0; k < vol.slices; k++) {
 			for (int j = 0; j < vol.cols; j++) {
 				for (int i = 0; i < vol.rows; i++) {
-					float3 pt1 = bbox.position
+					queries[i + (j + k * vol.cols) * vol.rows] = bbox.position
 						+ bbox.dimensions
 						* float3((i + 0.5f) / vol.rows, (j + 0.5f) / vol.cols, (k + 0.5f) / vol.slices);
-					float3 lastPoint(0.0f);
-					double d = kdTree.closestPointSignedDistance(pt1,maxDistance);
+				}
+			}
+		}
+		IntersectorResult result;
+		kdTree.closestPointSignedDistance(queries, result, maxDistance);
+#pragma omp parallel for
+		for (int k = 0; k < vol.slices; k++) {
+			for (int j = 0; j < vol.cols; j++) {
+				for (int i = 0; i < vol.rows; i++) {
+					double d = result.distances[i + (j + k * vol.cols) * vol.rows];
 					if (d != NO_HIT_DISTANCE) {
 						vol(i, j, k).x = (float)d/ voxelSize;
 					}
@@ -479,7 +542,100 @@ namespace aly {
 		DistanceField2f df2;
 		df2.solve(img, distImg, 10.0f);
 		distImg.writeToXML("img_df.xml");
-		return true;
+		//Sparse voxels equal to the background (maxDistance + 0.5) are undefined.
+		EndlessGridFloat sparseVol({ 16, 8, 2 }, 10.5f);
+		{
+			EndlessGridAccessor<float> acc(sparseVol);
+			for (int k = 0; k < vol.slices; k++) {
+				for (int j = 0; j < vol.cols; j++) {
+					for (int i = 0; i < vol.rows; i++) {
+						float d = vol(i, j, k).x;
+						if (d != DistanceField3f::DISTANCE_UNDEFINED) {
+							acc.setValue(i, j, k, d);
+						}
+					}
+				}
+			}
+		}
+		df3.solve(sparseVol, 10.0f);
+		//The sparse grid has no boundary, so compare signs over the whole band.
+		int sparseSignErrors = 0;
+		{
+			EndlessGridAccessor<float> acc(sparseVol);
+			for (int k = 0; k < vol.slices; k++) {
+				for (int j = 0; j < vol.cols; j++) {
+					for (int i = 0; i < vol.rows; i++) {
+						float d = distVol(i, j, k).x;
+						if (std::abs(d) < 10.0f
+							&& aly::sign(acc.getValue(i, j, k)) != aly::sign(d)) {
+							sparseSignErrors++;
+						}
+					}
+				}
+			}
+		}
+		std::cout << "Sparse distance field sign errors " << sparseSignErrors
+			<< std::endl;
+		bool parallelOk = (sparseSignErrors == 0);
+		for (DistanceFieldMethod method : { DistanceFieldMethod::Bucketed,
+				DistanceFieldMethod::FastIterative }) {
+			Volume1f parallelVol;
+			Image1f parallelImg;
+			DistanceField3f(method).solve(vol, parallelVol, 10.0f);
+			DistanceField2f(method).solve(img, parallelImg, 10.0f);
+			//Signs must agree wherever both solvers marched. Voxels past the band keep the input sign.
+			float volError = 0.0f, imgError = 0.0f;
+			int signErrors = 0;
+			for (size_t i = 0; i < distVol.size(); i++) {
+				volError = std::max(volError,
+					std::abs(std::abs(parallelVol[i].x) - std::abs(distVol[i].x)));
+				if (std::abs(parallelVol[i].x) < 10.0f && std::abs(distVol[i].x) < 10.0f
+					&& aly::sign(parallelVol[i].x) != aly::sign(distVol[i].x)) {
+					signErrors++;
+				}
+			}
+			for (size_t i = 0; i < distImg.size(); i++) {
+				imgError = std::max(imgError,
+					std::abs(std::abs(parallelImg[i].x) - std::abs(distImg[i].x)));
+				if (std::abs(parallelImg[i].x) < 10.0f && std::abs(distImg[i].x) < 10.0f
+					&& aly::sign(parallelImg[i].x) != aly::sign(distImg[i].x)) {
+					signErrors++;
+				}
+			}
+			std::cout << "Distance field method " << (int)method
+				<< " volume error " << volError << " image error "
+				<< imgError << " sign errors " << signErrors << std::endl;
+			//Magnitudes differ by the upwind update, which stays within a few hundredths of a voxel.
+			parallelOk &= (signErrors == 0 && volError < 0.05f && imgError < 0.05f);
+		}
+
+		MappedVolume1f mappedVol("vol_closest.vol", vol.rows, vol.cols,
+			vol.slices, 16);
+		mappedVol.set(vol);
+		MappedVolume1f mappedDist("vol_df.vol", vol.rows, vol.cols, vol.slices,
+			16);
+		RebuildDistanceField(mappedVol, mappedDist, 10.0f);
+		Volume1f outOfCore;
+		mappedDist.get(outOfCore);
+		float maxError = 0.0f;
+		for (size_t i = 0; i < distVol.size(); i++) {
+			maxError = std::max(maxError,
+				std::abs(outOfCore[i].x - distVol[i].x));
+		}
+		std::cout << "Out-of-core distance field error " << maxError
+			<< std::endl;
+		mappedDist.close();
+		bool readOnlyRejected = false;
+		{
+			MappedVolume1f readOnly("vol_df.vol");
+			try {
+				RebuildDistanceField(readOnly, 10.0f);
+			} catch (std::exception& e) {
+				std::cout << e.what() << std::endl;
+				readOnlyRejected = true;
+			}
+		}
+		return (maxError < 1E-3f && parallelOk && readOnlyRejected);
 	}
 	bool SANITY_CHECK_KDTREE() {
 		Mesh mesh;
@@ -553,6 +709,38 @@ namespace aly {
 			}
 		}
 		rgba.writeToXML("closest_clamped.xml");
+		//Batched segments, including zero-length and zero-direction queries, must match single queries.
+		std::vector<float3> starts, ends;
+		for (int i = 0; i < rgba.width; i += 8) {
+			for (int j = 0; j < rgba.height; j += 8) {
+				float3 pt1 = camera.transformImageToWorld(
+					float3((float)i, (float)j, 0.0f), rgba.width,
+					rgba.height);
+				float3 pt2 = camera.transformImageToWorld(
+					float3((float)i, (float)j, 1.0f), rgba.width,
+					rgba.height);
+				starts.push_back(pt1);
+				ends.push_back(pt2);
+				starts.push_back(pt1);
+				ends.push_back(pt1);
+			}
+		}
+		IntersectorResult result;
+		kdTree.intersectSegmentDistance(starts, ends, result);
+		for (size_t n = 0; n < starts.size(); n++) {
+			double d = kdTree.intersectSegmentDistance(starts[n], ends[n]);
+			if (d != result.distances[n]) {
+				std::cout << "Segment " << n << " batched distance " << result.distances[n] << " != " << d << std::endl;
+				return false;
+			}
+		}
+		kdTree.intersectRayDistance(starts, std::vector<float3>(starts.size(), float3(0.0f)), result);
+		for (size_t n = 0; n < starts.size(); n++) {
+			if (result.distances[n] != NO_HIT_DISTANCE) {
+				std::cout << "Zero direction ray " << n << " hit at " << result.distances[n] << std::endl;
+				return false;
+			}
+		}
 		return true;
 	}
 	bool SANITY_CHECK_IMAGE_PROCESSING() {
@@ -620,6 +808,35 @@ namespace aly {
 		gX.writeToXML("gradient_x.xml");
 		gY.writeToXML("gradient_y.xml");
 
+		//Compare the separable engine against direct 2D convolution on 4K RGBA.
+		ImageRGBAf big(3840, 2160);
+		std::mt19937 rng(1234);
+		std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+		for (float4& val : big.data) {
+			val = float4(uniform(rng), uniform(rng), uniform(rng), uniform(rng));
+		}
+		for (float sigma : { 1.0f, 2.0f, 4.0f }) {
+			int fsz = (int) (5 * sigma);
+			if (fsz % 2 == 0)
+				fsz++;
+			std::vector<float> filter;
+			GaussianKernel(filter, fsz, fsz, sigma, sigma);
+			ImageRGBAf direct, separable;
+			auto t0 = std::chrono::steady_clock::now();
+			Convolve(big, direct, filter, fsz, fsz);
+			auto t1 = std::chrono::steady_clock::now();
+			Smooth(big, separable, sigma);
+			auto t2 = std::chrono::steady_clock::now();
+			float err = 0.0f;
+			for (size_t n = 0; n < big.size(); n++) {
+				err = std::max(err, max(abs(direct[n] - separable[n])));
+			}
+			std::cout << fsz << "x" << fsz << " direct "
+				<< std::chrono::duration<double>(t1 - t0).count()
+				<< " sec, separable "
+				<< std::chrono::duration<double>(t2 - t1).count()
+				<< " sec, max error " << err << std::endl;
+		}
 		return true;
 	}
 	bool SANITY_CHECK_ROBUST_SOLVE() {
@@ -763,7 +980,292 @@ namespace aly {
 		Tile(ilist, compose, 4, 2);
 		WriteImageToFile("compose2.png", compose);
 		diff.writeToXML("image_diff.xml");
-		return true;
+
+		std::cout << "Laplacian pyramid" << std::endl;
+		std::vector<ImageRGBAf> laplacian;
+		BuildLaplacianPyramid(img, laplacian, 5);
+		ImageRGBAf collapsed;
+		CollapseLaplacianPyramid(laplacian, collapsed);
+		float maxError = 0.0f;
+		for (size_t i = 0; i < img.size(); i++) {
+			maxError = std::max(maxError, lengthL1(img[i] - collapsed[i]));
+		}
+		std::cout << "Pyramid reconstruction error " << maxError << std::endl;
+		return (maxError < 1E-4f);
+	}
+	bool SANITY_CHECK_BRICKED_VOLUME() {
+		const int N = 512;
+		const int iterations = 4;
+		Volume1f linear(N, N, N);
+		std::mt19937 rng(1234);
+		std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+		for (float1& val : linear.data) {
+			val = float1(uniform(rng));
+		}
+		BrickedVolume1f bricked(linear);
+		//7-point Laplacian smoothing, first on the linear layout and then on the bricked layout.
+		auto t0 = std::chrono::steady_clock::now();
+		{
+			Volume1f tmp(N, N, N);
+			Volume1f* in = &linear;
+			Volume1f* out = &tmp;
+			for (int n = 0; n < iterations; n++) {
+#pragma omp parallel for
+				for (int k = 0; k < N; k++) {
+					for (int j = 0; j < N; j++) {
+						for (int i = 0; i < N; i++) {
+							const Volume1f& v = *in;
+							(*out)(i, j, k).x = v(i, j, k).x
+									+ (1.0f / 6.0f)
+											* (v(i - 1, j, k).x + v(i + 1, j, k).x
+													+ v(i, j - 1, k).x + v(i, j + 1, k).x
+													+ v(i, j, k - 1).x + v(i, j, k + 1).x
+													- 6.0f * v(i, j, k).x);
+						}
+					}
+				}
+				std::swap(in, out);
+			}
+		}
+		auto t1 = std::chrono::steady_clock::now();
+		{
+			BrickedVolume1f tmp(N, N, N);
+			for (int n = 0; n < iterations; n++) {
+				ForEachNeighborhood6(bricked,
+						[&](size_t offset, const Neighborhood6<float1>& nbrs) {
+							float c = nbrs.value().x;
+							tmp.data[offset].x = c
+									+ (1.0f / 6.0f)
+											* (nbrs[0].x + nbrs[1].x + nbrs[2].x
+													+ nbrs[3].x + nbrs[4].x + nbrs[5].x
+													- 6.0f * c);
+						});
+				bricked.data.swap(tmp.data);
+			}
+		}
+		auto t2 = std::chrono::steady_clock::now();
+		Volume1f result;
+		bricked.get(result);
+		float err = 0.0f;
+		for (size_t n = 0; n < linear.size(); n++) {
+			err = std::max(err, std::abs(linear[n].x - result[n].x));
+		}
+		std::cout << N << "^3 stencil linear "
+				<< std::chrono::duration<double>(t1 - t0).count()
+				<< " sec, bricked "
+				<< std::chrono::duration<double>(t2 - t1).count()
+				<< " sec, max error " << err << std::endl;
+		return (err < 1E-6f);
+	}
+	bool SANITY_CHECK_EXECUTOR() {
+		typedef std::chrono::steady_clock Clock;
+		bool pass = true;
+		ExecutorPtr executor = AlloyDefaultExecutor();
+		//Spawn latency from launch until the task body starts.
+		const int LATENCY_TASKS = 200;
+		double poolLatency = 0.0, threadLatency = 0.0;
+		for (int n = 0; n < LATENCY_TASKS; n++) {
+			Clock::time_point start = Clock::now();
+			Clock::time_point started = start;
+			executor->submit([&started] {started = Clock::now();}).wait();
+			poolLatency += std::chrono::duration<double, std::micro>(
+					started - start).count();
+			start = Clock::now();
+			std::thread worker([&started] {started = Clock::now();});
+			worker.join();
+			threadLatency += std::chrono::duration<double, std::micro>(
+					started - start).count();
+		}
+		std::cout << "Spawn latency: executor " << poolLatency / LATENCY_TASKS
+				<< " us, thread " << threadLatency / LATENCY_TASKS << " us"
+				<< std::endl;
+		//Throughput of small tasks against a thread per task.
+		const int POOL_TASKS = 100000;
+		const int THREAD_TASKS = 2000;
+		std::atomic<int> counter(0);
+		Clock::time_point t0 = Clock::now();
+		{
+			std::vector<std::future<void>> futures;
+			futures.reserve(POOL_TASKS);
+			for (int n = 0; n < POOL_TASKS; n++) {
+				futures.push_back(executor->submit([&counter] {counter++;}));
+			}
+			for (std::future<void>& f : futures) {
+				f.wait();
+			}
+		}
+		Clock::time_point t1 = Clock::now();
+		{
+			std::vector<std::thread> threads;
+			threads.reserve(THREAD_TASKS);
+			for (int n = 0; n < THREAD_TASKS; n++) {
+				threads.push_back(std::thread([&counter] {counter++;}));
+			}
+			for (std::thread& t : threads) {
+				t.join();
+			}
+		}
+		Clock::time_point t2 = Clock::now();
+		std::cout << "Throughput: executor "
+				<< POOL_TASKS / std::chrono::duration<double>(t1 - t0).count()
+				<< " tasks/sec, thread "
+				<< THREAD_TASKS / std::chrono::duration<double>(t2 - t1).count()
+				<< " tasks/sec, " << executor->getWorkerCount() << " workers"
+				<< std::endl;
+		if (counter != POOL_TASKS + THREAD_TASKS) {
+			std::cout << "Executor lost tasks." << std::endl;
+			pass = false;
+		}
+		//Tasks whose token is set before they start are dropped.
+		{
+			bool cancel = true;
+			bool ran = false;
+			executor->submit([&ran] {ran = true;}, TaskPriority::Normal, &cancel).wait();
+			if (ran) {
+				std::cout << "Canceled task ran." << std::endl;
+				pass = false;
+			}
+		}
+		//A single worker held behind a gate drains its deque by priority.
+		{
+			Executor single(1, 1);
+			std::promise<void> gate;
+			std::shared_future<void> opened = gate.get_future().share();
+			std::vector<int> order;
+			single.post([opened] {opened.wait();});
+			single.post([&order] {order.push_back(2);}, TaskPriority::Low);
+			single.post([&order] {order.push_back(1);}, TaskPriority::Normal);
+			std::future<void> last = single.submit([&order] {order.push_back(0);},
+					TaskPriority::High);
+			gate.set_value();
+			last.wait();
+			single.submit([] {}, TaskPriority::Low).wait();
+			if (order != std::vector<int> { 0, 1, 2 }) {
+				std::cout << "Executor ignored task priority." << std::endl;
+				pass = false;
+			}
+		}
+		//A task may drop the last reference to the executor it runs on.
+		{
+			std::promise<void> gate;
+			std::shared_future<void> opened = gate.get_future().share();
+			std::promise<void> released;
+			std::future<void> done = released.get_future();
+			std::shared_ptr<ExecutorPtr> handle = std::make_shared<ExecutorPtr>(
+					std::make_shared<Executor>(2, 2));
+			(*handle)->post([handle, opened, &released] {
+				opened.wait();
+				handle->reset();
+				released.set_value();
+			});
+			handle.reset();
+			gate.set_value();
+			if (done.wait_for(std::chrono::seconds(5)) != std::future_status::ready) {
+				std::cout << "Executor did not release from a worker." << std::endl;
+				pass = false;
+			}
+		}
+		//Periodic tasks run until they return false, then call the end task.
+		{
+			std::atomic<int> iterations(0);
+			bool ended = false;
+			RecurrentTask recurrent([&iterations](uint64_t iter) {
+				iterations++;
+				return (iter < 9);
+			}, [&ended] {ended = true;}, 5);
+			recurrent.execute();
+			Clock::time_point start = Clock::now();
+			while (!recurrent.isComplete()
+					&& Clock::now() - start < std::chrono::seconds(5)) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			}
+			double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+			std::cout << "Recurrent task ran " << iterations << " iterations in "
+					<< elapsed << " sec" << std::endl;
+			if (iterations != 10 || !ended) {
+				pass = false;
+			}
+		}
+		//Canceling a timer releases it at once and runs the failure callback.
+		{
+			bool succeeded = false, failed = false;
+			TimerTask timer([&succeeded] {succeeded = true;},
+					[&failed] {failed = true;}, 10000, 30);
+			timer.execute();
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			Clock::time_point start = Clock::now();
+			timer.cancel();
+			double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+			std::cout << "Timer canceled in " << elapsed << " sec" << std::endl;
+			if (succeeded || !failed || elapsed > 1.0) {
+				pass = false;
+			}
+		}
+		return pass;
+	}
+	bool SANITY_CHECK_MAXFLOW() {
+		std::mt19937 gen(1234);
+		std::uniform_real_distribution<float> edgeDist(0.0f, 1.0f);
+		std::uniform_real_distribution<float> termDist(-4.0f, 4.0f);
+		const int3 dims[4] = { int3(96, 80, 1), int3(96, 80, 1), int3(24, 20, 16),
+				int3(24, 20, 16) };
+		const int conns[4] = { 4, 8, 6, 26 };
+		bool pass = true;
+		for (int t = 0; t < 4; t++) {
+			const int3 d = dims[t];
+			GridMaxFlow bk(d.x, d.y, d.z, conns[t]);
+			GridMaxFlow pr(d.x, d.y, d.z, conns[t]);
+			MaxFlow ref;
+			ref.resize(d.x * d.y * d.z);
+			for (int k = 0; k < d.z; k++) {
+				for (int j = 0; j < d.y; j++) {
+					for (int i = 0; i < d.x; i++) {
+						int id = i + d.x * (j + d.y * k);
+						float w = termDist(gen);
+						bk.addNodeCapacity(i, j, k, std::max(w, 0.0f),
+								std::max(-w, 0.0f));
+						pr.addNodeCapacity(i, j, k, std::max(w, 0.0f),
+								std::max(-w, 0.0f));
+						ref.addNodeCapacity(id, std::max(w, 0.0f),
+								std::max(-w, 0.0f));
+						//Even directions cover every edge once.
+						for (int dir = 0; dir < bk.getNeighborCount(); dir += 2) {
+							int3 nbr = int3(i, j, k) + bk.getNeighborOffset(dir);
+							if (nbr.x < 0 || nbr.y < 0 || nbr.z < 0 || nbr.x >= d.x
+									|| nbr.y >= d.y || nbr.z >= d.z)
+								continue;
+							float fwd = edgeDist(gen);
+							float rev = edgeDist(gen);
+							bk.setEdgeCapacity(i, j, k, dir, fwd, rev);
+							pr.setEdgeCapacity(i, j, k, dir, fwd, rev);
+							ref.addEdge(id, nbr.x + d.x * (nbr.y + d.y * nbr.z), fwd,
+									rev);
+						}
+					}
+				}
+			}
+			auto t0 = std::chrono::steady_clock::now();
+			ref.solve();
+			auto t1 = std::chrono::steady_clock::now();
+			bk.solve();
+			auto t2 = std::chrono::steady_clock::now();
+			pr.solveParallel(nullptr, 16);
+			auto t3 = std::chrono::steady_clock::now();
+			float tol = 1E-4f * std::abs(ref.getTotalFlow());
+			std::cout << conns[t] << "-connected " << d << " flow "
+					<< ref.getTotalFlow() << " ("
+					<< std::chrono::duration<double>(t1 - t0).count()
+					<< " sec), grid " << bk.getTotalFlow() << " ("
+					<< std::chrono::duration<double>(t2 - t1).count()
+					<< " sec), parallel " << pr.getTotalFlow() << " ("
+					<< std::chrono::duration<double>(t3 - t2).count() << " sec)"
+					<< std::endl;
+			if (std::abs(bk.getTotalFlow() - ref.getTotalFlow()) > tol
+					|| std::abs(pr.getTotalFlow() - ref.getTotalFlow()) > tol) {
+				pass = false;
+			}
+		}
+		return pass;
 	}
 	bool SANITY_CHECK_MESH_IO() {
 		Mesh tmpMesh;
@@ -797,6 +1299,314 @@ namespace aly {
 		ReadMeshFromFile("icosahedron3.ply", tmpMesh);
 		return true;
 	}
+	bool SANITY_CHECK_PLY_STREAM() {
+		const int N = 10000;
+		std::mt19937 rng(2468);
+		std::uniform_int_distribution<uint32_t> index(0, N - 1);
+		std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+		Mesh mesh;
+		for (int n = 0; n < N; n++) {
+			mesh.vertexLocations.push_back(float3(uniform(rng), uniform(rng), uniform(rng)));
+			mesh.vertexNormals.push_back(normalize(float3(uniform(rng), uniform(rng), 1.0f)));
+			mesh.vertexColors.push_back(float4(std::floor(255.0f * uniform(rng)) / 255.0f, 0.0f, 1.0f, 1.0f));
+		}
+		for (int n = 0; n < N; n++) {
+			mesh.triIndexes.push_back(uint3(index(rng), index(rng), index(rng)));
+			if (n % 3 == 0)
+				mesh.quadIndexes.push_back(uint4(index(rng), index(rng), index(rng), index(rng)));
+		}
+		mesh.lineIndexes.push_back(uint2(index(rng), index(rng)));
+		mesh.pointIndexes.push_back(index(rng));
+		//The binary file goes through the mapped fast path and the ascii file through PLYReaderWriter.
+		WritePlyMeshToFile("stream_binary.ply", mesh, true);
+		WritePlyMeshToFile("stream_ascii.ply", mesh, false);
+		Mesh binaryMesh, asciiMesh;
+		ReadPlyMeshFromFile("stream_binary.ply", binaryMesh);
+		ReadPlyMeshFromFile("stream_ascii.ply", asciiMesh);
+		bool pass = (binaryMesh.vertexLocations.data == mesh.vertexLocations.data)
+				&& (binaryMesh.vertexNormals.data == mesh.vertexNormals.data)
+				&& (binaryMesh.triIndexes.data == asciiMesh.triIndexes.data)
+				&& (binaryMesh.quadIndexes.data == asciiMesh.quadIndexes.data)
+				&& (binaryMesh.lineIndexes.data == asciiMesh.lineIndexes.data)
+				&& (binaryMesh.pointIndexes == asciiMesh.pointIndexes)
+				&& (binaryMesh.vertexColors.size() == asciiMesh.vertexColors.size());
+		for (int n = 0; n < N && pass; n++) {
+			pass &= distance(binaryMesh.vertexLocations[n], asciiMesh.vertexLocations[n]) < 1E-4f;
+			pass &= distance(binaryMesh.vertexColors[n], mesh.vertexColors[n]) < 1E-6f;
+		}
+		PlyPointReader reader("stream_binary.ply");
+		std::vector<float3> points, normals;
+		size_t total = 0;
+		while (size_t count = reader.read(points, &normals, nullptr, 999)) {
+			for (size_t n = 0; n < count; n++) {
+				pass &= (points[n] == mesh.vertexLocations[total + n]);
+				pass &= (normals[n] == mesh.vertexNormals[total + n]);
+			}
+			total += count;
+		}
+		pass &= (total == (size_t) N);
+		std::cout << "PLY stream " << (pass ? "passed" : "failed") << std::endl;
+		return pass;
+	}
+	bool SANITY_CHECK_OBJ_IO() {
+		const int N = 10000;
+		std::mt19937 rng(1357);
+		std::uniform_int_distribution<uint32_t> index(0, N - 1);
+		std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+		Mesh mesh;
+		for (int n = 0; n < N; n++) {
+			mesh.vertexLocations.push_back(float3(uniform(rng), uniform(rng), uniform(rng)));
+			mesh.vertexNormals.push_back(normalize(float3(uniform(rng), uniform(rng), 2.0f)));
+			mesh.vertexColors.push_back(float4(0.5f * uniform(rng) + 0.5f, 0.25f, 1.0f, 1.0f));
+		}
+		for (int n = 0; n < N; n++) {
+			mesh.triIndexes.push_back(uint3(index(rng), index(rng), index(rng)));
+			if (n % 3 == 0)
+				mesh.quadIndexes.push_back(uint4(index(rng), index(rng), index(rng), index(rng)));
+		}
+		mesh.lineIndexes.push_back(uint2(index(rng), index(rng)));
+		mesh.pointIndexes.push_back(index(rng));
+		WriteObjMeshToFile("obj_io.obj", mesh);
+		Mesh in;
+		ReadObjMeshFromFile("obj_io.obj", in);
+		bool pass = (in.triIndexes.data == mesh.triIndexes.data)
+				&& (in.quadIndexes.data == mesh.quadIndexes.data)
+				&& (in.lineIndexes.data == mesh.lineIndexes.data)
+				&& (in.pointIndexes == mesh.pointIndexes)
+				&& (in.vertexLocations.size() == mesh.vertexLocations.size())
+				&& (in.vertexNormals.size() == mesh.vertexNormals.size())
+				&& (in.vertexColors.size() == mesh.vertexColors.size());
+		for (int n = 0; n < N && pass; n++) {
+			pass &= distance(in.vertexLocations[n], mesh.vertexLocations[n]) < 1E-6f;
+			pass &= distance(in.vertexNormals[n], mesh.vertexNormals[n]) < 1E-6f;
+			pass &= distance(in.vertexColors[n], mesh.vertexColors[n]) < 1E-6f;
+		}
+		//Relative indexes, a polygon fan, mixed normals and groups.
+		std::string text = "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nv 0.5 2 0\nvn 0 0 1\nvn 0 0 -1\n"
+				"g top\nf -5//1 -4//1 -3//1 -1//1 -2//1\ng bottom\nusemtl back\nf 1//2 2//2 3//2 4//2\r\n";
+		obj::ObjFile objFile;
+		obj::ParseObjFile(text.data(), text.size(), objFile);
+		pass &= (objFile.faceCount() == 2 && objFile.groups.size() == 3
+				&& objFile.corners[3].v == 4 && objFile.corners[3].vn == 0);
+		std::ofstream("obj_io_fan.obj") << text;
+		Mesh fan;
+		ReadObjMeshFromFile("obj_io_fan.obj", fan);
+		pass &= (fan.triIndexes.size() == 3 && fan.quadIndexes.size() == 1
+				&& fan.vertexLocations.size() == 9
+				&& fan.triIndexes[2] == uint3(0, 3, 4)
+				&& fan.vertexNormals[fan.quadIndexes[0].x].z == -1.0f);
+		std::vector<Mesh> groups;
+		ReadObjMeshFromFile("obj_io_fan.obj", groups);
+		pass &= (groups.size() == 2 && groups[0].vertexLocations.size() == 5
+				&& groups[1].quadIndexes[0] == uint4(0, 1, 2, 3));
+		std::cout << "OBJ IO " << (pass ? "passed" : "failed") << std::endl;
+		return pass;
+	}
+	bool SANITY_CHECK_MESH_TOPOLOGY() {
+		//Unit cube with two quads split into triangles.
+		Mesh mesh;
+		for (int n = 0; n < 8; n++) {
+			mesh.vertexLocations.push_back(float3((float)(n & 1), (float)((n >> 1) & 1), (float)((n >> 2) & 1)));
+		}
+		mesh.quadIndexes.push_back(uint4(0, 2, 3, 1));
+		mesh.quadIndexes.push_back(uint4(4, 5, 7, 6));
+		mesh.quadIndexes.push_back(uint4(0, 1, 5, 4));
+		mesh.quadIndexes.push_back(uint4(2, 6, 7, 3));
+		mesh.triIndexes.push_back(uint3(0, 4, 6));
+		mesh.triIndexes.push_back(uint3(0, 6, 2));
+		mesh.triIndexes.push_back(uint3(1, 3, 7));
+		mesh.triIndexes.push_back(uint3(1, 7, 5));
+		//A caller holding the plain topology keeps it while a half-edge request replaces the cached one.
+		MeshTopologyPtr plain = mesh.getTopology();
+		MeshTopologyPtr topoPtr = mesh.getTopology(true);
+		const MeshTopology& topo = *topoPtr;
+		bool pass = (plain != topoPtr && !plain->hasHalfEdges() && plain->faceCount() == 8
+				&& mesh.getTopology() == topoPtr);
+		pass &= (topo.edges.size() == 14 && topo.faceCount() == 8 && topo.halfEdgeCount() == 28);
+		for (uint32_t e = 0; e < topo.edges.size(); e++) {
+			pass &= (topo.edgeFaceCount(e) == 2 && topo.findEdge(topo.edges[e].y, topo.edges[e].x) == e);
+		}
+		for (uint32_t h = 0; h < topo.halfEdgeCount(); h++) {
+			uint32_t o = topo.opposite[h];
+			pass &= (o != MeshTopology::NO_HALF_EDGE && topo.opposite[o] == h
+					&& topo.halfEdgeEdges[o] == topo.halfEdgeEdges[h]
+					&& topo.prevHalfEdge(topo.nextHalfEdge(h)) == h);
+		}
+		pass &= (topo.findEdge(0, 7) == MeshTopology::NO_HALF_EDGE && topo.ringSize(0) == 4 && topo.ringSize(3) == 3);
+		MeshListNeighborTable faceNbrs;
+		CreateFaceNeighborTable(mesh, faceNbrs);
+		MeshSetNeighborTable vertNbrs;
+		CreateVertexNeighborTable(mesh, vertNbrs);
+		pass &= (faceNbrs[0].size() == 3 && faceNbrs[4].size() == 4 && vertNbrs[0].count(6) == 1 && vertNbrs[3].size() == 3);
+		//Changing the faces must rebuild the cached topology.
+		mesh.triIndexes[1] = uint3(0, 2, 6);
+		MeshTopologyPtr changed = mesh.getTopology();
+		pass &= (changed->vertexCorners[changed->cornerOffsets[2]] == 4);
+		mesh.triIndexes[1] = uint3(0, 6, 2);
+		//Subdivided closed surfaces keep an Euler characteristic of 2 and every vertex stays finite.
+		Subdivide(mesh, SubDivisionScheme::CatmullClark);
+		Subdivide(mesh, SubDivisionScheme::Loop);
+		MeshTopologyPtr sub = mesh.getTopology();
+		pass &= ((int64_t) sub->vertexCount - (int64_t) sub->edges.size() + (int64_t) sub->faceCount() == 2);
+		for (float3 pt : mesh.vertexLocations.data) {
+			pass &= (pt.x == pt.x && pt.y == pt.y && pt.z == pt.z);
+		}
+		std::cout << "Mesh topology " << (pass ? "passed" : "failed") << std::endl;
+		return pass;
+	}
+	bool SANITY_CHECK_SUBDIVISION_STENCILS() {
+		Mesh cube;
+		for (int n = 0; n < 8; n++) {
+			cube.vertexLocations.push_back(float3((float)(n & 1), (float)((n >> 1) & 1), (float)((n >> 2) & 1)));
+		}
+		cube.quadIndexes.push_back(uint4(0, 2, 3, 1));
+		cube.quadIndexes.push_back(uint4(4, 5, 7, 6));
+		cube.quadIndexes.push_back(uint4(0, 1, 5, 4));
+		cube.quadIndexes.push_back(uint4(2, 6, 7, 3));
+		cube.quadIndexes.push_back(uint4(0, 4, 6, 2));
+		cube.quadIndexes.push_back(uint4(1, 3, 7, 5));
+		//Closed surfaces have an Euler characteristic of 2 and two faces on every edge.
+		auto closed = [](const Mesh& mesh) {
+			MeshTopologyPtr topoPtr = mesh.getTopology();
+			const MeshTopology& topo = *topoPtr;
+			bool ok = ((int64_t) topo.vertexCount - (int64_t) topo.edges.size() + (int64_t) topo.faceCount() == 2);
+			for (uint32_t e = 0; e < topo.edges.size(); e++) {
+				ok &= (topo.edgeFaceCount(e) == 2);
+			}
+			return ok;
+		};
+		SubdivisionStencils stencils;
+		stencils.build(cube, SubDivisionScheme::CatmullClark, 2);
+		Mesh refined;
+		stencils.evaluate(cube, refined);
+		bool pass = (refined.vertexLocations.size() == 98 && refined.quadIndexes.size() == 96 && refined.triIndexes.size() == 0 && closed(refined));
+		//Moving a control vertex only needs the stencils to be evaluated again.
+		Mesh deformed, expected;
+		cube.clone(deformed);
+		deformed.vertexLocations[0] = float3(-0.5f, -0.25f, 0.1f);
+		deformed.clone(expected);
+		Subdivide(expected, SubDivisionScheme::CatmullClark, 2);
+		pass &= stencils.matches(deformed);
+		stencils.evaluate(deformed, refined);
+		pass &= (refined.vertexLocations.size() == expected.vertexLocations.size());
+		for (size_t i = 0; i < refined.vertexLocations.size() && pass; i++) {
+			pass &= (distance(refined.vertexLocations[i], expected.vertexLocations[i]) < 1E-5f);
+		}
+		Mesh tris;
+		cube.clone(tris);
+		tris.convertQuadsToTriangles();
+		stencils.build(tris, SubDivisionScheme::Loop, 1);
+		stencils.evaluate(tris, refined);
+		pass &= (refined.vertexLocations.size() == 26 && refined.triIndexes.size() == 48 && closed(refined));
+		//Refining one face must leave neighboring faces split just enough to avoid cracks.
+		std::vector<uint8_t> mask(6, 0);
+		mask[0] = 1;
+		stencils.build(cube, SubDivisionScheme::CatmullClark, 2, mask);
+		stencils.evaluate(cube, refined);
+		pass &= (refined.triIndexes.size() > 0 && refined.quadIndexes.size() > 6 && closed(refined));
+		mask.assign(12, 0);
+		mask[0] = 1;
+		stencils.build(tris, SubDivisionScheme::Loop, 2, mask);
+		stencils.evaluate(tris, refined);
+		pass &= (refined.triIndexes.size() > 12 && refined.triIndexes.size() < 192 && closed(refined));
+		bool threw = false;
+		try {
+			stencils.evaluate(cube, refined);
+		} catch (const std::exception&) {
+			threw = true;
+		}
+		pass &= threw;
+		std::cout << "Subdivision stencils " << (pass ? "passed" : "failed") << std::endl;
+		return pass;
+	}
+	bool SANITY_CHECK_MESH_DECIMATION() {
+		auto closed = [](const Mesh& mesh) {
+			MeshTopologyPtr topoPtr = mesh.getTopology();
+			const MeshTopology& topo = *topoPtr;
+			bool ok = ((int64_t) topo.vertexCount - (int64_t) topo.edges.size() + (int64_t) topo.faceCount() == 2);
+			for (uint32_t e = 0; e < topo.edges.size(); e++) {
+				ok &= (topo.edgeFaceCount(e) == 2);
+			}
+			return ok;
+		};
+		//Unit sphere made from a subdivided cube.
+		Mesh sphere;
+		for (int n = 0; n < 8; n++) {
+			sphere.vertexLocations.push_back(float3((float)(n & 1), (float)((n >> 1) & 1), (float)((n >> 2) & 1)) - 0.5f);
+		}
+		sphere.quadIndexes.push_back(uint4(0, 2, 3, 1));
+		sphere.quadIndexes.push_back(uint4(4, 5, 7, 6));
+		sphere.quadIndexes.push_back(uint4(0, 1, 5, 4));
+		sphere.quadIndexes.push_back(uint4(2, 6, 7, 3));
+		sphere.quadIndexes.push_back(uint4(0, 4, 6, 2));
+		sphere.quadIndexes.push_back(uint4(1, 3, 7, 5));
+		Subdivide(sphere, SubDivisionScheme::CatmullClark, 4);
+		sphere.convertQuadsToTriangles();
+		for (float3& pt : sphere.vertexLocations.data) {
+			pt = normalize(pt);
+		}
+		sphere.updateVertexNormals();
+		const size_t triCount = sphere.triIndexes.size();
+		MeshDecimation decimate;
+		Mesh mesh;
+		sphere.clone(mesh);
+		decimate.solveToTriangleCount(mesh, triCount / 4);
+		bool pass = (mesh.triIndexes.size() <= triCount / 4 && mesh.triIndexes.size() > triCount / 5 && closed(mesh)
+				&& mesh.vertexNormals.size() == mesh.vertexLocations.size());
+		for (float3 pt : mesh.vertexLocations.data) {
+			pass &= (std::abs(length(pt) - 1.0f) < 0.05f);
+		}
+		sphere.clone(mesh);
+		decimate.solve(mesh, 0.5f);
+		pass &= (mesh.triIndexes.size() <= triCount / 2 && mesh.triIndexes.size() > 2 * triCount / 5 && closed(mesh));
+		//A flat grid collapses to a few triangles. Its boundary stays put and linear colors and texture coordinates stay exact.
+		Mesh grid;
+		const int N = 20;
+		for (int j = 0; j <= N; j++) {
+			for (int i = 0; i <= N; i++) {
+				float2 pt(i / (float) N, j / (float) N);
+				grid.vertexLocations.push_back(float3(pt.x, pt.y, 0.0f));
+				grid.vertexColors.push_back(float4(pt.x, pt.y, 0.5f * (pt.x + pt.y), 1.0f));
+			}
+		}
+		for (int j = 0; j < N; j++) {
+			for (int i = 0; i < N; i++) {
+				uint32_t v = j * (N + 1) + i;
+				grid.triIndexes.push_back(uint3(v, v + 1, v + N + 2));
+				grid.triIndexes.push_back(uint3(v, v + N + 2, v + N + 1));
+			}
+		}
+		for (uint3 tri : grid.triIndexes.data) {
+			for (int k = 0; k < 3; k++) {
+				grid.textureMap.push_back(grid.vertexLocations[tri[k]].xy());
+			}
+		}
+		//A loose vertex drawn as a point and a line to the center must survive with its indexes remapped.
+		const float3 loose(0.25f, 0.75f, 0.0f);
+		const uint32_t looseIndex = (uint32_t) grid.vertexLocations.size();
+		grid.vertexLocations.push_back(loose);
+		grid.vertexColors.push_back(float4(loose.x, loose.y, 0.5f * (loose.x + loose.y), 1.0f));
+		grid.pointIndexes.push_back(looseIndex);
+		grid.lineIndexes.push_back(uint2(looseIndex, (N / 2) * (N + 1) + N / 2));
+		decimate.solveToError(grid, 1E-8f);
+		pass &= (grid.triIndexes.size() < 50 && grid.textureMap.size() == 3 * grid.triIndexes.size()
+				&& grid.vertexColors.size() == grid.vertexLocations.size());
+		pass &= (grid.pointIndexes.size() == 1 && grid.pointIndexes[0] < grid.vertexLocations.size()
+				&& grid.vertexLocations[grid.pointIndexes[0]] == loose);
+		pass &= (grid.lineIndexes.size() == 1 && grid.lineIndexes[0].x == grid.pointIndexes[0]
+				&& grid.lineIndexes[0].y < grid.vertexLocations.size());
+		box3f box = grid.updateBoundingBox();
+		pass &= (distance(box.position, float3(0.0f)) < 1E-5f && distance(box.dimensions, float3(1.0f, 1.0f, 0.0f)) < 1E-5f);
+		for (size_t v = 0; v < grid.vertexLocations.size(); v++) {
+			float3 pt = grid.vertexLocations[v];
+			pass &= (distance(grid.vertexColors[v], float4(pt.x, pt.y, 0.5f * (pt.x + pt.y), 1.0f)) < 1E-4f);
+		}
+		for (size_t c = 0; c < grid.textureMap.size(); c++) {
+			pass &= (distance(grid.textureMap[c], grid.vertexLocations[grid.triIndexes[c / 3][c % 3]].xy()) < 1E-4f);
+		}
+		std::cout << "Mesh decimation " << (pass ? "passed" : "failed") << std::endl;
+		return pass;
+	}
 	bool SANITY_CHECK_SPARSE_SOLVE() {
 		SparseMatrix1f A(4, 3);
 		SparseMatrix1f B(3, 4);
@@ -878,13 +1688,13 @@ namespace aly {
 		//WriteMeshToFile("smoothed_before.ply", mesh);
 		/*
 		 SolveVecCG(b, L, mesh.vertexLocations, 100, 1E-6f,
-		 [this](int iter,double err) {
+		 [this](int iter,double err,double) {
 		 std::cout<<"Iteration "<<iter<<":: "<<err<<std::endl;
 		 });
 		 */
 		SolveBICGStab(b, L, mesh.vertexLocations, 500, 1E-6f,
-			[=](int iter, double err) {
-			std::cout << "Iteration " << iter << ":: " << err << std::endl;
+			[=](int iter, double err, double seconds) {
+			std::cout << "Iteration " << iter << ":: " << err << " " << seconds << " sec" << std::endl;
 			return true;
 		});
 		return true;
@@ -1064,6 +1874,275 @@ namespace aly {
 		//getchar();
 		return true;
 	}
+	bool SANITY_CHECK_COMPRESSED_VOLUME() {
+		Volume2f vol(96, 80, 70);
+		for (int k = 0; k < vol.slices; k++) {
+			for (int j = 0; j < vol.cols; j++) {
+				for (int i = 0; i < vol.rows; i++) {
+					vol(i, j, k) = float2(std::floor(8 * std::sin(0.1f * i) + k),
+							(float) (i + j));
+				}
+			}
+		}
+		bool pass = true;
+		Volume2f out;
+		WriteImageToRawFile(MakeDesktopFile("planar_volume.xml"), vol);
+		ReadImageFromRawFile(MakeDesktopFile("planar_volume.xml"), out);
+		pass &= (out.data == vol.data);
+		const CompressionType types[3] = { CompressionType::NONE,
+				CompressionType::LZ4, CompressionType::ZSTD };
+		for (CompressionType type : types) {
+			std::string file = MakeDesktopFile("compressed_volume.alyc");
+			WriteVolumeToCompressedFile(file, vol, type, 16);
+			ReadVolumeFromCompressedFile(file, out);
+			bool sliceMatch = true;
+			CompressedVolumeReader<float, 2, ImageType::FLOAT> reader(file);
+			Image2f slice;
+			for (int k : { 69, 3, 16, 15 }) {
+				reader.readSlice(k, slice);
+				for (int j = 0; j < vol.cols; j++) {
+					for (int i = 0; i < vol.rows; i++) {
+						sliceMatch &= (slice(i, j) == vol(i, j, k));
+					}
+				}
+			}
+			std::cout << type << " compressed " << vol.size() * sizeof(float2)
+					<< " bytes into " << reader.getChunkCount() << " chunks"
+					<< std::endl;
+			pass &= (out.data == vol.data) && sliceMatch;
+			reader.close();
+			//Grow the first chunk by one byte in the table so it no longer decodes to its slices.
+			CompressedVolumeHeader header;
+			uint64_t offset = 0;
+			FILE* f = fopen(file.c_str(), "r+b");
+			bool edited = (f != NULL
+					&& fread(&header, sizeof(CompressedVolumeHeader), 1, f) == 1
+					&& fseek(f, (long) header.tableOffset + sizeof(uint64_t), SEEK_SET) == 0
+					&& fread(&offset, sizeof(uint64_t), 1, f) == 1);
+			offset++;
+			edited = edited
+					&& fseek(f, (long) header.tableOffset + sizeof(uint64_t), SEEK_SET) == 0
+					&& fwrite(&offset, sizeof(uint64_t), 1, f) == 1;
+			if (f != NULL)
+				fclose(f);
+			bool rejected = false;
+			try {
+				ReadVolumeFromCompressedFile(file, out);
+			} catch (const std::exception& e) {
+				std::cout << e.what() << std::endl;
+				rejected = true;
+			}
+			pass &= edited && rejected;
+		}
+		return pass;
+	}
+	bool SANITY_CHECK_NARROW_BAND() {
+		//Band around a sphere whose radius does not line up with the tile size.
+		const int3 dims(70, 61, 53);
+		const float3 center(33.0f, 30.5f, 25.0f);
+		const float maxDistance = 3.5f;
+		auto inBand = [&](const int3& pos, float radius) {
+			return std::abs(distance(float3(pos), center) - radius) <= maxDistance;
+		};
+		NarrowBand3D band;
+		band.resize(dims);
+		band.build([&](const int3& pos) {return inBand(pos, 17.0f);});
+		bool pass = true;
+		size_t count = 0;
+		for (int k = 0; k < dims.z; k++) {
+			for (int j = 0; j < dims.y; j++) {
+				for (int i = 0; i < dims.x; i++) {
+					bool expected = inBand(int3(i, j, k), 17.0f);
+					pass &= (band.contains(int3(i, j, k)) == expected);
+					if (expected)
+						count++;
+				}
+			}
+		}
+		pass &= (band.size() == count);
+		//Move the front outward and update the band incrementally.
+		int removed = band.removeIf([&](const int3& pos) {return !inBand(pos, 19.0f);});
+		std::vector<int3> voxels;
+		band.flatten(voxels);
+		int added = 0;
+		int layer = 0;
+		do {
+			layer = 0;
+			for (int3 pos : voxels) {
+				for (int n = 0; n < 6; n++) {
+					int3 nbr = pos;
+					nbr[n / 2] += (n % 2 == 0) ? -1 : 1;
+					if (band.inside(nbr) && inBand(nbr, 19.0f) && band.insert(nbr)) {
+						layer++;
+					}
+				}
+			}
+			band.flatten(voxels);
+			added += layer;
+		} while (layer > 0);
+		pass &= !band.insert(voxels.front());
+		NarrowBand3D rebuilt;
+		rebuilt.resize(dims);
+		rebuilt.build([&](const int3& pos) {return inBand(pos, 19.0f);});
+		std::vector<int3> expected;
+		rebuilt.flatten(expected);
+		std::set<int3> a(voxels.begin(), voxels.end());
+		std::set<int3> b(expected.begin(), expected.end());
+		pass &= (a.size() == voxels.size()) && (a == b);
+		//Voxels of one tile are contiguous in the flattened list.
+		std::set<int3> tilesSeen;
+		int3 lastTile(-1);
+		for (int3 pos : voxels) {
+			int3 tile(pos.x / NarrowBand3D::TILE_SIZE, pos.y / NarrowBand3D::TILE_SIZE,
+					pos.z / NarrowBand3D::TILE_SIZE);
+			if (tile != lastTile) {
+				pass &= (tilesSeen.count(tile) == 0);
+				tilesSeen.insert(tile);
+				lastTile = tile;
+			}
+		}
+		pass &= (tilesSeen.size() == band.getTileCount());
+		//Values kept in the band read back like a dense volume clamped to the background.
+		auto sdf = [&](const int3& pos) {
+			return clamp(distance(float3(pos), center) - 17.0f, -4.0f, 4.0f);
+		};
+		NarrowBand3D field;
+		field.resize(dims, 2, 4.0f);
+		field.build([&](const int3& pos) {return inBand(pos, 17.0f);}, sdf);
+		Volume1f dense(dims.x, dims.y, dims.z);
+		field.copyTo(1, dense.ptr());
+		int valueErrors = 0;
+		for (int k = 0; k < dims.z; k++) {
+			for (int j = 0; j < dims.y; j++) {
+				for (int i = 0; i < dims.x; i++) {
+					float expected = sdf(int3(i, j, k));
+					float value = dense(i, j, k).x;
+					if (std::abs(expected) <= maxDistance) {
+						valueErrors += (value != expected);
+					} else {
+						valueErrors += (value * expected < 0 || std::abs(value) < maxDistance);
+					}
+				}
+			}
+		}
+		float interpError = 0.0f;
+		for (int n = 0; n < 1000; n++) {
+			float3 pt = center + float3(17.0f * std::cos(0.1f * n), 17.0f * std::sin(0.1f * n), 0.013f * n - 6.0f);
+			interpError = std::max(std::abs(field.interpolate(pt, 0) - dense(pt.x, pt.y, pt.z).x), interpError);
+		}
+		std::vector<float> padded(NarrowBand3D::PADDED_VOXELS);
+		int3 origin = field.getTileOrigin(0);
+		field.gather(0, 0, padded.data());
+		for (int p = 0; p < NarrowBand3D::PADDED_VOXELS; p++) {
+			int3 pos = origin + int3(p % NarrowBand3D::PADDED_SIZE,
+					(p / NarrowBand3D::PADDED_SIZE) % NarrowBand3D::PADDED_SIZE,
+					p / (NarrowBand3D::PADDED_SIZE * NarrowBand3D::PADDED_SIZE)) - int3(1);
+			valueErrors += (padded[p] != dense(pos.x, pos.y, pos.z).x);
+		}
+		int3 inner(int(center.x), int(center.y), int(center.z));
+		pass &= (field.getValuePtr(inner) == nullptr) && (field.getValue(inner) == -4.0f);
+		pass &= field.insert(inner) && (*field.getValuePtr(inner, 1) == -4.0f);
+		pass &= (valueErrors == 0) && (interpError < 1E-5f);
+		//Meshing the tiles directly matches meshing the dense copy.
+		IsoSurface isoSurface;
+		Mesh denseMesh, bandMesh;
+		isoSurface.solve(dense, denseMesh, MeshType::Triangle, true, 0.0f);
+		isoSurface.solve(field, 1, bandMesh, MeshType::Triangle, true, 0.0f);
+		std::vector<float3> densePoints(denseMesh.vertexLocations.begin(), denseMesh.vertexLocations.end());
+		Locator3f locator;
+		locator.insert(densePoints);
+		float meshError = 0.0f;
+		for (float3 pt : bandMesh.vertexLocations) {
+			meshError = std::max(distance(float3(locator.closest(pt)), pt), meshError);
+		}
+		pass &= (bandMesh.vertexLocations.size() == denseMesh.vertexLocations.size())
+				&& (bandMesh.triIndexes.size() == denseMesh.triIndexes.size())
+				&& (densePoints.size() > 0) && (meshError < 1E-4f);
+		//Contouring the tiles of a 2D band matches contouring its dense copy.
+		const int2 contourDims(75, 58);
+		const float2 contourCenter(36.5f, 28.0f);
+		auto circle = [&](const int2& pos) {
+			return clamp(distance(float2(pos), contourCenter) - 19.0f, -4.0f, 4.0f);
+		};
+		NarrowBand2D contourField;
+		contourField.resize(contourDims, 1, 4.0f);
+		contourField.build([&](const int2& pos) {return std::abs(circle(pos)) <= maxDistance;}, circle);
+		Image1f contourImage(contourDims.x, contourDims.y);
+		contourField.copyTo(0, contourImage.ptr());
+		IsoContour isoContour;
+		Vector2f densePoints2D, bandPoints2D;
+		std::vector<std::vector<uint32_t>> denseCurves, bandCurves;
+		isoContour.solve(contourImage, densePoints2D, denseCurves, 0.0f, TopologyRule2D::Connect4, Winding::Clockwise);
+		isoContour.solve(contourField, 0, bandPoints2D, bandCurves, 0.0f, TopologyRule2D::Connect4, Winding::Clockwise);
+		float contourError = 0.0f;
+		for (size_t i = 0; i < std::min(densePoints2D.size(), bandPoints2D.size()); i++) {
+			contourError = std::max(distance(densePoints2D[i], bandPoints2D[i]), contourError);
+		}
+		pass &= (bandCurves == denseCurves) && (bandPoints2D.size() == densePoints2D.size())
+				&& (densePoints2D.size() > 0) && (contourError < 1E-5f);
+		std::cout << "Narrow band contour " << bandPoints2D.size() << " vertexes, error " << contourError << std::endl;
+		std::cout << "Narrow band mesh " << bandMesh.vertexLocations.size() << " vertexes, error " << meshError << std::endl;
+		std::cout << "Narrow band values " << valueErrors << " errors, interpolation error " << interpError << std::endl;
+		std::cout << "Narrow band " << count << " voxels, removed " << removed
+				<< ", added " << added << ", " << band.getTileCount()
+				<< " tiles of " << dims.x * dims.y * dims.z / NarrowBand3D::TILE_VOXELS
+				<< std::endl;
+		return pass;
+	}
+	bool SANITY_CHECK_SPATIAL_HASH() {
+		const int N = 20000;
+		const float radius = 0.6f;
+		std::mt19937 rng(4321);
+		std::uniform_real_distribution<float> uniform(-10.0f, 10.0f);
+		std::vector<float3> samples(N);
+		for (float3& pt : samples) {
+			pt = float3(uniform(rng), uniform(rng), uniform(rng));
+		}
+		auto compare = [&](const SpatialHash3f& hash, const std::vector<float3>& pts) {
+			Locator3f locator(pts);
+			std::vector<int> offsets, indexes;
+			hash.neighbors(radius, offsets, indexes);
+			bool match = true;
+			std::vector<float3i> result;
+			for (int n = 0; n < N; n++) {
+				locator.closest(pts[n], radius, result);
+				std::set<int> expected;
+				for (float3i nbr : result) {
+					if (nbr.index != n)
+						expected.insert(nbr.index);
+				}
+				std::set<int> found(indexes.begin() + offsets[n], indexes.begin() + offsets[n + 1]);
+				match &= (found == expected) && (found.size() == (size_t) (offsets[n + 1] - offsets[n]));
+				for (int e = offsets[n] + 1; e < offsets[n + 1]; e++) {
+					match &= (distanceSqr(pts[n], pts[indexes[e - 1]]) <= distanceSqr(pts[n], pts[indexes[e]]));
+				}
+			}
+			return match;
+		};
+		auto t0 = std::chrono::steady_clock::now();
+		SpatialHash3f hash(samples, radius);
+		auto t1 = std::chrono::steady_clock::now();
+		bool pass = compare(hash, samples);
+		std::vector<float3i> hits;
+		hash.closest(float3(0.0f), 2.5f * radius, hits);
+		for (float3i hit : hits) {
+			pass &= (distance(hit, float3(0.0f)) <= 2.5f * radius) && (samples[hit.index] == float3(hit));
+		}
+		//Jitter a little so that only points near cell boundaries change bucket.
+		std::uniform_real_distribution<float> jitter(-0.01f, 0.01f);
+		int moved = 0;
+		for (int iter = 0; iter < 3; iter++) {
+			for (float3& pt : samples) {
+				pt += float3(jitter(rng), jitter(rng), jitter(rng));
+			}
+			moved += hash.update(samples, radius);
+			pass &= compare(hash, samples);
+		}
+		std::cout << "Spatial hash built " << N << " points in "
+				<< std::chrono::duration<double>(t1 - t0).count() << " sec, "
+				<< moved << " moved over 3 updates" << std::endl;
+		return pass && moved > 0 && moved < N / 8;
+	}
 	bool SANITY_CHECK_IMAGE_IO() {
 		ImageRGBAf srcRGBAf;
 		ImageRGBf srcRGBf;
@@ -58,9 +58,8 @@
 #include "graphics/AlloyIntersector.h"
 #include "graphics/AlloyMesh.h"
 
-#include <list>
-#include <queue>
 #include <vector>
+#include <cmath>
 #include <algorithm>
 namespace aly {
 static const double ZERO_TOLERANCE = 1E-6;
@@ -161,26 +160,6 @@ bool KDBox::intersectRayBox(const float3& org, const float3& dr) const {
 	}
 	return true;
 }
-void KDBoxEdge::set(KDBox* b, int dim, bool start) {
-	box = b;
-	this->start = start;
-	if (b == nullptr)
-		return;
-	switch (dim) {
-	case 0:
-		value = (start) ? b->getMin().x : b->getMax().x;
-		break;
-	case 1:
-		value = (start) ? b->getMin().y : b->getMax().y;
-		break;
-	case 2:
-		value = (start) ? b->getMin().z : b->getMax().z;
-		break;
-	default:
-		value = 0;
-	}
-
-}
 bool KDBox::intersectSegmentBox(const float3& org, const float3& end) const {
 	if (inside(org) || inside(end))
 		return true;
@@ -712,13 +691,12 @@ float3 KDTriangle::intersectionPointRay(const float3& org,
 	}
 	return NO_HIT_POINT;
 }
-double KDTriangle::distance(const float3& p, float3& lastIntersect) const {
-	float3 p1 = pts[0];
-	float3 p2 = pts[1];
-	float3 p3 = pts[2];
+namespace {
+//Distance from p to the triangle with first vertex p1 and edges kEdge0 and
+//kEdge1, shared by KDTriangle and the structure-of-arrays leaves.
+double TriangleDistance(const float3& p1, const float3& kEdge0,
+		const float3& kEdge1, const float3& p, float3& lastIntersect) {
 	float3 kDiff = (p1 - p);
-	float3 kEdge0 = (p2 - p1);
-	float3 kEdge1 = (p3 - p1);
 	float fA00 = (float) lengthSqr(kEdge0);
 	float fA01 = dot(kEdge0, kEdge1);
 	float fA11 = lengthSqr(kEdge1);
@@ -887,444 +865,785 @@ double KDTriangle::distance(const float3& p, float3& lastIntersect) const {
 	if (fSqrDistance < (float) 0.0) {
 		fSqrDistance = (float) 0.0;
 	}
-	lastIntersect = pts[0] + kEdge0 * (float) fS + kEdge1 * (float) fT;
+	lastIntersect = p1 + kEdge0 * (float) fS + kEdge1 * (float) fT;
 	return std::sqrt(fSqrDistance);
 }
+}
+double KDTriangle::distance(const float3& p, float3& lastIntersect) const {
+	return TriangleDistance(pts[0], pts[1] - pts[0], pts[2] - pts[0], p,
+			lastIntersect);
+}
+void KDTriangleArray::resize(size_t sz) {
+	x0.resize(sz);
+	y0.resize(sz);
+	z0.resize(sz);
+	x1.resize(sz);
+	y1.resize(sz);
+	z1.resize(sz);
+	x2.resize(sz);
+	y2.resize(sz);
+	z2.resize(sz);
+	ids.resize(sz);
+}
+void KDTriangleArray::set(size_t i, const float3& pt1, const float3& pt2,
+		const float3& pt3, uint64_t id) {
+	x0[i] = pt1.x;
+	y0[i] = pt1.y;
+	z0[i] = pt1.z;
+	x1[i] = pt2.x;
+	y1[i] = pt2.y;
+	z1[i] = pt2.z;
+	x2[i] = pt3.x;
+	y2[i] = pt3.y;
+	z2[i] = pt3.z;
+	ids[i] = id;
+}
+float3 KDTriangleArray::getNormal(size_t i) const {
+	float3 p0 = getPoint(i, 0);
+	return normalize(cross(getPoint(i, 1) - p0, getPoint(i, 2) - p0));
+}
+float3 KDTriangleArray::getCentroid(size_t i) const {
+	return 0.3333333f * (getPoint(i, 0) + getPoint(i, 1) + getPoint(i, 2));
+}
+void KDTriangleArray::clear() {
+	resize(0);
+}
+namespace {
+struct BVHBin {
+	float3 minPoint;
+	float3 maxPoint;
+	uint32_t count;
+	BVHBin() :
+			minPoint(1E30f), maxPoint(-1E30f), count(0) {
+	}
+	void add(const float3& minPt, const float3& maxPt) {
+		minPoint = aly::min(minPoint, minPt);
+		maxPoint = aly::max(maxPoint, maxPt);
+		count++;
+	}
+	void add(const BVHBin& bin) {
+		minPoint = aly::min(minPoint, bin.minPoint);
+		maxPoint = aly::max(maxPoint, bin.maxPoint);
+		count += bin.count;
+	}
+};
+struct BVHStackEntry {
+	uint32_t index;//Wide node, or first triangle of a leaf range.
+	uint32_t count;//Number of triangles in a leaf range, zero for nodes.
+	float dist;
+};
+//Nodes with more triangles than this are binned by all threads.
+static const uint32_t PARALLEL_BIN_SIZE = 1 << 14;
+inline float SurfaceArea(const float3& minPt, const float3& maxPt) {
+	float3 d = aly::max(maxPt - minPt, float3(0.0f));
+	return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+//Slab tests against all children of a wide node at once. Children that are
+//missed or start beyond tmax report infinity.
+inline void IntersectBoxes(const BVHWideNode& node, const float3& org,
+		const float3& invDir, float tmax, float* tnear) {
+	const float ox = org.x, oy = org.y, oz = org.z;
+	const float ix = invDir.x, iy = invDir.y, iz = invDir.z;
+#pragma omp simd
+	for (int k = 0; k < BVHWideNode::WIDTH; k++) {
+		float t1 = (node.minX[k] - ox) * ix;
+		float t2 = (node.maxX[k] - ox) * ix;
+		float tmin = std::min(t1, t2);
+		float tfar = std::max(t1, t2);
+		t1 = (node.minY[k] - oy) * iy;
+		t2 = (node.maxY[k] - oy) * iy;
+		tmin = std::max(tmin, std::min(t1, t2));
+		tfar = std::min(tfar, std::max(t1, t2));
+		t1 = (node.minZ[k] - oz) * iz;
+		t2 = (node.maxZ[k] - oz) * iz;
+		tmin = std::max(tmin, std::min(t1, t2));
+		tfar = std::min(tfar, std::max(t1, t2));
+		tmin = std::max(tmin, 0.0f);
+		tnear[k] = (tmin <= tfar && tmin <= tmax) ?
+				tmin : std::numeric_limits<float>::infinity();
+	}
+}
+//At most one of the two clamped terms per axis is non-zero. Written as a sum
+//so the loop has no branches.
+inline void DistanceSqrToBoxes(const BVHWideNode& node, const float3& pt,
+		float* dist) {
+	const float px = pt.x, py = pt.y, pz = pt.z;
+#pragma omp simd
+	for (int k = 0; k < BVHWideNode::WIDTH; k++) {
+		float dx = std::max(node.minX[k] - px, 0.0f)
+				+ std::max(px - node.maxX[k], 0.0f);
+		float dy = std::max(node.minY[k] - py, 0.0f)
+				+ std::max(py - node.maxY[k], 0.0f);
+		float dz = std::max(node.minZ[k] - pz, 0.0f)
+				+ std::max(pz - node.maxZ[k], 0.0f);
+		dist[k] = dx * dx + dy * dy + dz * dz;
+	}
+}
+//Pushes the children within bound far to near, so the nearest child is
+//visited next.
+inline void PushChildren(const BVHWideNode& node, const float* dist,
+		float bound, BVHStackEntry* stack, int& sp) {
+	int order[BVHWideNode::WIDTH];
+	int M = 0;
+	for (int k = 0; k < BVHWideNode::WIDTH; k++) {
+		if (dist[k] <= bound) {
+			int m = M++;
+			while (m > 0 && dist[order[m - 1]] < dist[k]) {
+				order[m] = order[m - 1];
+				m--;
+			}
+			order[m] = k;
+		}
+	}
+	for (int m = 0; m < M; m++) {
+		int k = order[m];
+		stack[sp++] = { node.child[k], node.count[k], dist[k] };
+	}
+}
+inline float3 SafeInverse(const float3& v) {
+	const float EPS = 1E-30f;
+	float3 d = v;
+	for (int i = 0; i < 3; i++) {
+		if (std::abs(d[i]) < EPS)
+			d[i] = (d[i] < 0) ? -EPS : EPS;
+	}
+	return float3(1.0f / d.x, 1.0f / d.y, 1.0f / d.z);
+}
+}
+const int Intersector::MAX_DEPTH;
 void Intersector::build(const Mesh& mesh, int maxDepth) {
-	root = std::shared_ptr<KDBox>(new KDBox());
+	reset();
+	size_t N = mesh.quadIndexes.size() * 2 + mesh.triIndexes.size();
+	if (N == 0)
+		return;
+	if (N >= (size_t) std::numeric_limits<uint32_t>::max())
+		throw std::runtime_error(
+				MakeString() << "Too many triangles for intersector " << N);
+	KDTriangleArray tris;
+	tris.resize(N);
+	size_t index = 0;
 	uint64_t id = 0;
-	KDTriangle* tri;
 	for (const uint4& face : mesh.quadIndexes.data) {
 		float3 pt1 = mesh.vertexLocations[face.x];
 		float3 pt2 = mesh.vertexLocations[face.y];
 		float3 pt3 = mesh.vertexLocations[face.z];
 		float3 pt4 = mesh.vertexLocations[face.w];
 		if (distanceSqr(pt1, pt3) < distanceSqr(pt2, pt4)) {
-			storage.push_back(
-					std::shared_ptr<KDTriangle>(
-							tri = new KDTriangle(pt1, pt2, pt3, id, 1)));
-			root->getChildren().push_back(tri);
-			storage.push_back(
-					std::shared_ptr<KDTriangle>(
-							tri = new KDTriangle(pt3, pt4, pt1, id, 1)));
-			root->getChildren().push_back(tri);
+			tris.set(index++, pt1, pt2, pt3, id);
+			tris.set(index++, pt3, pt4, pt1, id);
 		} else {
-			storage.push_back(
-					std::shared_ptr<KDTriangle>(
-							tri = new KDTriangle(pt1, pt2, pt4, id, 1)));
-			root->getChildren().push_back(tri);
-			storage.push_back(
-					std::shared_ptr<KDTriangle>(
-							tri = new KDTriangle(pt4, pt2, pt3, id, 1)));
-			root->getChildren().push_back(tri);
-
+			tris.set(index++, pt1, pt2, pt4, id);
+			tris.set(index++, pt4, pt2, pt3, id);
 		}
 		id++;
 	}
 	for (const uint3& face : mesh.triIndexes.data) {
-		storage.push_back(
-				std::shared_ptr<KDTriangle>(
-						tri = new KDTriangle(mesh.vertexLocations[face.x],
-								mesh.vertexLocations[face.y],
-								mesh.vertexLocations[face.z], id, 1)));
-		root->getChildren().push_back(tri);
+		tris.set(index++, mesh.vertexLocations[face.x],
+				mesh.vertexLocations[face.y], mesh.vertexLocations[face.z],
+				id);
 		id++;
 	}
-	root->update();
-	buildTree(maxDepth);
+	std::vector<float3> minPoints(N), maxPoints(N), centroids(N);
+	std::vector<uint32_t> order(N);
+#pragma omp parallel for
+	for (int n = 0; n < (int) N; n++) {
+		float3 pt1 = tris.getPoint(n, 0);
+		float3 pt2 = tris.getPoint(n, 1);
+		float3 pt3 = tris.getPoint(n, 2);
+		minPoints[n] = aly::min(aly::min(pt1, pt2), pt3);
+		maxPoints[n] = aly::max(aly::max(pt1, pt2), pt3);
+		centroids[n] = 0.5f * (minPoints[n] + maxPoints[n]);
+		order[n] = (uint32_t) n;
+	}
+	int depthLimit = std::max(maxDepth,
+			(int) std::ceil(std::log2((double) N)) + 8);
+	depthLimit = aly::clamp(depthLimit, 1, MAX_DEPTH);
+	std::vector<BVHNode> bvh;
+	bvh.reserve(2 * (N / 2 + 1));
+	buildNode(bvh, order, minPoints, maxPoints, centroids, 0, (uint32_t) N, 0,
+			depthLimit);
+	minPoint = bvh[0].minPoint;
+	maxPoint = bvh[0].maxPoint;
+	nodes.reserve(bvh.size() / 3 + 1);
+	collapseNode(bvh, 0);
+	nodes.shrink_to_fit();
+	triangleArray.resize(N);
+#pragma omp parallel for
+	for (int n = 0; n < (int) N; n++) {
+		uint32_t t = order[n];
+		triangleArray.set(n, tris.getPoint(t, 0), tris.getPoint(t, 1),
+				tris.getPoint(t, 2), tris.ids[t]);
+	}
 }
-void Intersector::buildTree(int maxDepth) {
-	std::list<KDBox*> boxes;
-	boxes.push_back(root.get());
-	int sz;
-	int splitPos;
-	KDBox* leftChild;
-	KDBox* rightChild;
-	int depthCount = 0;
-	while (boxes.size() > 0) {
-		KDBox* box = boxes.front();
-		boxes.pop_front();
-		if (box->getDepth() > maxDepth)
-			continue;
-		if (box->getDepth() > depthCount) {
-			depthCount = box->getDepth();
+uint32_t Intersector::buildNode(std::vector<BVHNode>& bvh,
+		std::vector<uint32_t>& order,
+		const std::vector<float3>& minPoints,
+		const std::vector<float3>& maxPoints,
+		const std::vector<float3>& centroids, uint32_t begin, uint32_t end,
+		int depth, int maxDepth) {
+	uint32_t index = (uint32_t) bvh.size();
+	bvh.push_back(BVHNode());
+	uint32_t count = end - begin;
+	BVHBin bounds, centroidBounds;
+	if (count >= PARALLEL_BIN_SIZE) {
+#pragma omp parallel
+		{
+			BVHBin b, c;
+#pragma omp for nowait
+			for (int i = (int) begin; i < (int) end; i++) {
+				uint32_t t = order[i];
+				b.add(minPoints[t], maxPoints[t]);
+				c.add(centroids[t], centroids[t]);
+			}
+#pragma omp critical
+			{
+				bounds.add(b);
+				centroidBounds.add(c);
+			}
 		}
-		std::vector<KDBox*>& children = box->getChildren();
-		if (children.size() < 2)
-			continue;
-		sz = (int) children.size() * 2;
-		std::vector<KDBoxEdge> edges;
-		splitPos = splitPosition(children, edges, box);
-		if (splitPos <= 0 || splitPos == sz - 1) {
-			continue;
+	} else {
+		for (uint32_t i = begin; i < end; i++) {
+			uint32_t t = order[i];
+			bounds.add(minPoints[t], maxPoints[t]);
+			centroidBounds.add(centroids[t], centroids[t]);
 		}
-		storage.push_back(
-				std::shared_ptr<KDBox>(
-						leftChild = new KDBox(box->getDepth() + 1)));
-		storage.push_back(
-				std::shared_ptr<KDBox>(
-						rightChild = new KDBox(box->getDepth() + 1)));
-		std::vector<KDBox*>& lchildren = leftChild->getChildren();
-		std::vector<KDBox*>& rchildren = rightChild->getChildren();
-		for (int i = 0; i < splitPos; i++) {
-			if (edges[i].isMin()) {
-				edges[i].getBox()->setDepth(leftChild->getDepth() + 1);
-				lchildren.push_back(edges[i].getBox());
-
+	}
+	BVHNode node;
+	node.minPoint = bounds.minPoint;
+	node.maxPoint = bounds.maxPoint;
+	node.offset = begin;
+	node.count = count;
+	if (count <= 2 || depth >= maxDepth) {
+		bvh[index] = node;
+		return index;
+	}
+	float3 extent = centroidBounds.maxPoint - centroidBounds.minPoint;
+	float3 scale;
+	for (int a = 0; a < 3; a++) {
+		scale[a] = (extent[a] > 0) ? BIN_COUNT / extent[a] : 0.0f;
+	}
+	auto binIndex = [&](uint32_t t, int axis) {
+		return std::min(BIN_COUNT - 1,
+				(int) ((centroids[t][axis] - centroidBounds.minPoint[axis])
+						* scale[axis]));
+	};
+	BVHBin bins[3][BIN_COUNT];
+	if (count >= PARALLEL_BIN_SIZE) {
+#pragma omp parallel
+		{
+			BVHBin local[3][BIN_COUNT];
+#pragma omp for nowait
+			for (int i = (int) begin; i < (int) end; i++) {
+				uint32_t t = order[i];
+				for (int a = 0; a < 3; a++) {
+					local[a][binIndex(t, a)].add(minPoints[t], maxPoints[t]);
+				}
+			}
+#pragma omp critical
+			{
+				for (int a = 0; a < 3; a++) {
+					for (int b = 0; b < BIN_COUNT; b++) {
+						bins[a][b].add(local[a][b]);
+					}
+				}
 			}
 		}
-		for (int i = splitPos + 1; i < sz; i++) {
-			if (!edges[i].isMin()) {
-				edges[i].getBox()->setDepth(rightChild->getDepth() + 1);
-				rchildren.push_back(edges[i].getBox());
+	} else {
+		for (uint32_t i = begin; i < end; i++) {
+			uint32_t t = order[i];
+			for (int a = 0; a < 3; a++) {
+				bins[a][binIndex(t, a)].add(minPoints[t], maxPoints[t]);
 			}
 		}
-		if (lchildren.size() >= children.size()
-				|| rchildren.size() >= children.size()) {
+	}
+	//Sweep the bins to find the split plane with the lowest SAH cost.
+	float bestCost = std::numeric_limits<float>::max();
+	int bestAxis = -1;
+	int bestBin = -1;
+	for (int a = 0; a < 3; a++) {
+		if (extent[a] <= 0)
 			continue;
+		float rightArea[BIN_COUNT];
+		uint32_t rightCount[BIN_COUNT];
+		BVHBin acc;
+		for (int b = BIN_COUNT - 1; b > 0; b--) {
+			acc.add(bins[a][b]);
+			rightArea[b] =
+					(acc.count > 0) ?
+							SurfaceArea(acc.minPoint, acc.maxPoint) : 0.0f;
+			rightCount[b] = acc.count;
 		}
-		leftChild->update();
-		rightChild->update();
-		children.clear();
-		children.push_back(leftChild);
-		children.push_back(rightChild);
-		box->update();
-		//std::cout << "Left: " << *leftChild<<std::endl;
-		//std::cout << "Right: " << *rightChild << std::endl;
-		boxes.push_back(leftChild);
-		boxes.push_back(rightChild);
-
+		acc = BVHBin();
+		for (int b = 0; b < BIN_COUNT - 1; b++) {
+			acc.add(bins[a][b]);
+			if (acc.count == 0 || rightCount[b + 1] == 0)
+				continue;
+			float cost = SurfaceArea(acc.minPoint, acc.maxPoint) * acc.count
+					+ rightArea[b + 1] * rightCount[b + 1];
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestAxis = a;
+				bestBin = b;
+			}
+		}
+	}
+	float area = SurfaceArea(node.minPoint, node.maxPoint);
+	float leafCost = area * count;
+	float splitCost = area + bestCost;
+	if (count <= MAX_LEAF_SIZE && (bestAxis < 0 || leafCost <= splitCost)) {
+		bvh[index] = node;
+		return index;
 	}
+	uint32_t mid;
+	if (bestAxis >= 0) {
+		mid = (uint32_t) (std::partition(order.begin() + begin,
+				order.begin() + end, [&](uint32_t t) {
+					return binIndex(t, bestAxis) <= bestBin;
+				}) - order.begin());
+	} else {
+		mid = begin;
+	}
+	if (mid == begin || mid == end) {
+		//Degenerate centroids, split in the middle to keep leaves bounded.
+		mid = begin + count / 2;
+	}
+	buildNode(bvh, order, minPoints, maxPoints, centroids, begin, mid, depth + 1,
+			maxDepth);
+	uint32_t right = buildNode(bvh, order, minPoints, maxPoints, centroids, mid,
+			end, depth + 1, maxDepth);
+	node.offset = right;
+	node.count = 0;
+	bvh[index] = node;
+	return index;
 }
-int Intersector::splitPosition(std::vector<KDBox*>& children,
-		std::vector<KDBoxEdge>& edges, KDBox* box) {
-	int nAbove = 0;
-	int nBelow = 0;
-	double pAbove = 0;
-	double pBelow = 0;
-	double cost = 0;
-	int dim = 0;
-	int bestSplit = -1;
-	double sum = 0;
-	double prod = 0;
-	double voxel;
-	double val;
-	double minCost;
-	int sz;
-	//KDBoxEdge e1, e2;
-	float3 v = box->getMax() - box->getMin();
-	if (v.x > v.y && v.x > v.z)
-		dim = 0;
-	else if (v.y > v.z)
-		dim = 1;
-	else
-		dim = 2;
-	int retry = 3;
-	voxel = 1.0 / (v.x + v.y + v.z);
-	do {
-		bestSplit = -1;
-		switch (dim) {
-		case 0:
-			sum = v.y + v.z;
-			prod = v.y * v.z;
-			break;
-		case 1:
-			sum = v.x + v.z;
-			prod = v.x * v.z;
-			break;
-		case 2:
-			sum = v.x + v.y;
-			prod = v.x * v.y;
-			break;
-		}
-
-		sz = (int) children.size() * 2;
-		edges.resize(sz);
-		for (int i = 0; i < sz; i++) {
-			KDBox* child = children[i / 2];
-			edges[i] = KDBoxEdge(child, dim, (i % 2 == 1) ? true : false);
-		}
-
-		std::sort(edges.begin(), edges.end(),
-				[](const KDBoxEdge& e1, const KDBoxEdge& e2) {
-					return (e1.getValue() < e2.getValue());
-				});
-		for (int i = 0; i < (int) edges.size() - 1; i++) {
-			KDBoxEdge& e1 = edges[i];
-			KDBoxEdge& e2 = edges[i + 1];
-			if (e1.getValue() == e2.getValue()) {
-				if (!e1.isMin() && e2.isMin()) {
-					std::swap(e1, e2);
+uint32_t Intersector::collapseNode(const std::vector<BVHNode>& bvh,
+		uint32_t index) {
+	//Open the interior child with the largest surface area until all slots
+	//are used or only leaves remain.
+	uint32_t slots[BVHWideNode::WIDTH];
+	int M = 0;
+	if (bvh[index].isLeaf()) {
+		slots[M++] = index;
+	} else {
+		slots[M++] = index + 1;
+		slots[M++] = bvh[index].offset;
+		while (M < BVHWideNode::WIDTH) {
+			int best = -1;
+			float bestArea = -1.0f;
+			for (int k = 0; k < M; k++) {
+				const BVHNode& node = bvh[slots[k]];
+				if (!node.isLeaf()) {
+					float area = SurfaceArea(node.minPoint, node.maxPoint);
+					if (area > bestArea) {
+						bestArea = area;
+						best = k;
+					}
 				}
 			}
+			if (best < 0)
+				break;
+			uint32_t opened = slots[best];
+			slots[best] = opened + 1;
+			slots[M++] = bvh[opened].offset;
 		}
-		nBelow = 0;
-		nAbove = (int) children.size();
-		// Do not assume prior minimum cost because the spherical
-		// orientation
-		// is in some sense optimal when rays are cast from outside the
-		// sphere.
-		// If minimum cost is assumed, then no branches in kd-tree will be
-		// generated
-		// minCost=intersectCost*nAbove;
-		minCost = 1E30;
-
-		KDBoxEdge e1(box, dim, true);
-		KDBoxEdge e2(box, dim, false);
-		for (int i = 0; i < sz; i++) {
-			if (!edges[i].isMin())
-				nAbove--;
-			val = edges[i].getValue();
-			if (val > e1.getValue() && e2.getValue() > val) {
-				pBelow = (sum * (val - e1.getValue()) + prod) * voxel;
-				pAbove = (sum * (e2.getValue() - val) + prod) * voxel;
-				cost = traversalCost
-						+ intersectCost
-								* (1
-										- ((nAbove == 0 || nBelow == 0) ?
-												emptyBonus : 0))
-								* (pBelow * nBelow + pAbove * nAbove);
-				if (cost < minCost) {
-					minCost = cost;
-					bestSplit = i;
-				}
+	}
+	uint32_t wideIndex = (uint32_t) nodes.size();
+	nodes.push_back(BVHWideNode());
+	BVHWideNode wide;
+	const float inf = std::numeric_limits<float>::infinity();
+	for (int k = 0; k < BVHWideNode::WIDTH; k++) {
+		if (k < M) {
+			const BVHNode& node = bvh[slots[k]];
+			wide.minX[k] = node.minPoint.x;
+			wide.minY[k] = node.minPoint.y;
+			wide.minZ[k] = node.minPoint.z;
+			wide.maxX[k] = node.maxPoint.x;
+			wide.maxY[k] = node.maxPoint.y;
+			wide.maxZ[k] = node.maxPoint.z;
+			if (node.isLeaf()) {
+				wide.child[k] = node.offset;
+				wide.count[k] = node.count;
+			} else {
+				wide.child[k] = collapseNode(bvh, slots[k]);
+				wide.count[k] = 0;
 			}
-			if (edges[i].isMin())
-				nBelow++;
+		} else {
+			wide.minX[k] = wide.minY[k] = wide.minZ[k] = inf;
+			wide.maxX[k] = wide.maxY[k] = wide.maxZ[k] = inf;
+			wide.child[k] = 0;
+			wide.count[k] = 0;
 		}
-		dim = (dim + 1) % 3;
-		retry--;
-	} while (bestSplit == -1 && retry > 0);
-	return bestSplit;
+	}
+	//Recursion may have reallocated the node array.
+	nodes[wideIndex] = wide;
+	return wideIndex;
 }
-double Intersector::intersectRayDistance(const float3& p1, const float3& v,
-		float3& lastPoint, KDTriangle*& lastTriangle) const {
-	if (root->getChildren().size() == 0)
-		throw new std::runtime_error("KD-Tree has not been initialized.");
-	std::list<KDBox*> boxes;
-	boxes.push_back(getRoot());
-	double d;
-	double mind = 1E30;
-	KDTriangle* resultTriangle = nullptr;
-	float3 resultIntersect = NO_HIT_POINT;
-	KDTriangle* tri;
-	while (boxes.size() > 0) {
-		KDBox* box = boxes.front();
-		//std::cout << *box << std::endl;
-		boxes.pop_front();
-		if (box->intersectRayBox(p1, v)) {
-			if (box->isLeaf) {
-				tri = dynamic_cast<KDTriangle*>(box);
-				float3 intersect = tri->intersectionPointRay(p1, v);
-				if (intersect != NO_HIT_POINT) {
-					d = distance(p1, intersect);
-					if (d < mind) {
-						mind = d;
-						resultTriangle = tri;
-						resultIntersect = intersect;
-					}
-				}
+int Intersector::intersectLeaf(uint32_t offset, uint32_t count,
+		const float3& org,
+		const float3& dir, float& tmax) const {
+	//Barycentric tolerance closes cracks between neighboring triangles.
+	static const float EPS = 1e-5f;
+	static const int BATCH = 16;
+	const float* x0 = triangleArray.x0.data();
+	const float* y0 = triangleArray.y0.data();
+	const float* z0 = triangleArray.z0.data();
+	const float* x1 = triangleArray.x1.data();
+	const float* y1 = triangleArray.y1.data();
+	const float* z1 = triangleArray.z1.data();
+	const float* x2 = triangleArray.x2.data();
+	const float* y2 = triangleArray.y2.data();
+	const float* z2 = triangleArray.z2.data();
+	float tvals[BATCH];
+	int hit = -1;
+	uint32_t end = offset + count;
+	for (uint32_t start = offset; start < end; start += BATCH) {
+		int M = (int) std::min((uint32_t) BATCH, end - start);
+		//Moller-Trumbore over a batch of SoA triangles, written branch free
+		//so the compiler can evaluate several triangles per instruction.
+#pragma omp simd
+		for (int k = 0; k < M; k++) {
+			uint32_t i = start + k;
+			float ex1 = x1[i] - x0[i];
+			float ey1 = y1[i] - y0[i];
+			float ez1 = z1[i] - z0[i];
+			float ex2 = x2[i] - x0[i];
+			float ey2 = y2[i] - y0[i];
+			float ez2 = z2[i] - z0[i];
+			float px = dir.y * ez2 - dir.z * ey2;
+			float py = dir.z * ex2 - dir.x * ez2;
+			float pz = dir.x * ey2 - dir.y * ex2;
+			float det = ex1 * px + ey1 * py + ez1 * pz;
+			float inv = 1.0f / det;
+			float sx = org.x - x0[i];
+			float sy = org.y - y0[i];
+			float sz = org.z - z0[i];
+			float u = (sx * px + sy * py + sz * pz) * inv;
+			float qx = sy * ez1 - sz * ey1;
+			float qy = sz * ex1 - sx * ez1;
+			float qz = sx * ey1 - sy * ex1;
+			float v = (dir.x * qx + dir.y * qy + dir.z * qz) * inv;
+			float t = (ex2 * qx + ey2 * qy + ez2 * qz) * inv;
+			bool valid = (det != 0.0f) & (u >= -EPS) & (v >= -EPS)
+					& (u + v <= 1.0f + EPS) & (t >= 0.0f);
+			tvals[k] = valid ? t : std::numeric_limits<float>::infinity();
+		}
+		for (int k = 0; k < M; k++) {
+			if (tvals[k] <= tmax) {
+				tmax = tvals[k];
+				hit = (int) (start + k);
 			}
-			boxes.insert(boxes.end(), box->getChildren().begin(),
-					box->getChildren().end());
 		}
 	}
-	lastTriangle = resultTriangle;
-	lastPoint = resultIntersect;
-	if (resultTriangle == nullptr) {
-		return NO_HIT_DISTANCE;
+	return hit;
+}
+int Intersector::intersect(const float3& org, const float3& dir, float tmax,
+		float& t) const {
+	if (nodes.size() == 0)
+		throw std::runtime_error("Intersector has not been initialized.");
+	float3 invDir = SafeInverse(dir);
+	//Each visited node replaces its entry with at most four children.
+	BVHStackEntry stack[3 * MAX_DEPTH + 4];
+	float tnear[BVHWideNode::WIDTH];
+	int sp = 0;
+	int hit = -1;
+	stack[sp++] = { 0, 0, 0.0f };
+	while (sp > 0) {
+		BVHStackEntry entry = stack[--sp];
+		if (entry.dist > tmax)
+			continue;
+		if (entry.count > 0) {
+			int h = intersectLeaf(entry.index, entry.count, org, dir, tmax);
+			if (h >= 0)
+				hit = h;
+		} else {
+			const BVHWideNode& node = nodes[entry.index];
+			IntersectBoxes(node, org, invDir, tmax, tnear);
+			PushChildren(node, tnear, tmax, stack, sp);
+		}
+	}
+	t = tmax;
+	return hit;
+}
+int Intersector::intersectRay(const float3& p1, const float3& v, float tmax,
+		float3& lastPoint, double& dist) const {
+	float t;
+	int hit = intersect(p1, v, tmax, t);
+	if (hit < 0) {
+		lastPoint = NO_HIT_POINT;
+		dist = NO_HIT_DISTANCE;
 	} else {
-		return mind;
+		lastPoint = p1 + v * t;
+		dist = distance(p1, lastPoint);
 	}
+	return hit;
 }
-double Intersector::intersectSegmentDistance(const float3& p1, const float3& p2,
-		float3& lastPoint, KDTriangle*& lastTriangle) const {
-	if (root->getChildren().size() == 0)
-		throw new std::runtime_error("KD-Tree has not been initialized.");
-	std::list<KDBox*> boxes;
-	boxes.push_back(getRoot());
-	double d;
-	double mind = 1E30;
-	KDTriangle* resultTriangle = nullptr;
-	float3 resultIntersect = NO_HIT_POINT;
-	KDTriangle* tri;
-	while (boxes.size() > 0) {
-		KDBox* box = boxes.front();
-		boxes.pop_front();
-		if (box->intersectSegmentBox(p1, p2)) {
-			if (box->isLeaf) {
-				tri = dynamic_cast<KDTriangle*>(box);
-				float3 intersect = tri->intersectionPointSegment(p1, p2);
-				if (intersect != NO_HIT_POINT) {
-					d = distance(p1, intersect);
-					if (d < mind) {
-						mind = d;
-						resultTriangle = tri;
-						resultIntersect = intersect;
+int Intersector::closest(const float3& pt, double maxDistance,
+		const float3* halfSpace, float3& lastPoint, double& dist) const {
+	if (nodes.size() == 0)
+		throw std::runtime_error("Intersector has not been initialized.");
+	const float* x0 = triangleArray.x0.data();
+	const float* y0 = triangleArray.y0.data();
+	const float* z0 = triangleArray.z0.data();
+	const float* x1 = triangleArray.x1.data();
+	const float* y1 = triangleArray.y1.data();
+	const float* z1 = triangleArray.z1.data();
+	const float* x2 = triangleArray.x2.data();
+	const float* y2 = triangleArray.y2.data();
+	const float* z2 = triangleArray.z2.data();
+	BVHStackEntry stack[3 * MAX_DEPTH + 4];
+	float boxDist[BVHWideNode::WIDTH];
+	int sp = 0;
+	int hit = -1;
+	double best = maxDistance;
+	float bestSqr = (float) std::min(best * best,
+			(double) std::numeric_limits<float>::max());
+	float3 lastIntersect;
+	stack[sp++] = { 0, 0, 0.0f };
+	while (sp > 0) {
+		BVHStackEntry entry = stack[--sp];
+		if (entry.dist > bestSqr)
+			continue;
+		if (entry.count > 0) {
+			for (uint32_t k = entry.index; k < entry.index + entry.count; k++) {
+				float3 p0(x0[k], y0[k], z0[k]);
+				double d = TriangleDistance(p0, float3(x1[k], y1[k], z1[k]) - p0,
+						float3(x2[k], y2[k], z2[k]) - p0, pt, lastIntersect);
+				if (d < best || (hit < 0 && d <= best)) {
+					if (halfSpace != nullptr
+							&& dot(lastIntersect - pt, *halfSpace) < 0) {
+						continue;
 					}
+					best = d;
+					bestSqr = (float) (d * d);
+					hit = (int) k;
+					lastPoint = lastIntersect;
 				}
 			}
-			boxes.insert(boxes.end(), box->getChildren().begin(),
-					box->getChildren().end());
+		} else {
+			const BVHWideNode& node = nodes[entry.index];
+			DistanceSqrToBoxes(node, pt, boxDist);
+			PushChildren(node, boxDist, bestSqr, stack, sp);
 		}
 	}
-	lastTriangle = resultTriangle;
-	lastPoint = resultIntersect;
-	if (resultTriangle == nullptr) {
-		return NO_HIT_DISTANCE;
+	if (hit < 0) {
+		lastPoint = NO_HIT_POINT;
+		dist = NO_HIT_DISTANCE;
 	} else {
-		return mind;
+		dist = best;
 	}
+	return hit;
 }
-double Intersector::closestPointSignedDistance(const float3& r, float3& lastPoint,
-		KDTriangle*& lastTriangle) const {
-	double d = closestPoint(r, lastPoint, lastTriangle);
-	if (d >= 0&& d!=NO_HIT_DISTANCE) {
-		float3 norm = lastTriangle->getNormal();
-		float3 center = lastTriangle->getCentroid();
-		float3 diff = r - center;
-		return sign(dot(diff, norm)) * d;
-	} else {
-		return NO_HIT_DISTANCE;
+int Intersector::closestSigned(const float3& r, double maxDistance,
+		float3& lastPoint, double& dist) const {
+	int hit = closest(r, maxDistance, nullptr, lastPoint, dist);
+	if (hit >= 0) {
+		float3 diff = r - triangleArray.getCentroid(hit);
+		dist = sign(dot(diff, triangleArray.getNormal(hit))) * dist;
 	}
+	return hit;
+}
+double Intersector::intersectRayDistance(const float3& p1, const float3& v,
+		float3& lastPoint, KDTrianglePtr& lastTriangle) const {
+	double d;
+	lastTriangle = getTriangle(
+			intersectRay(p1, v, std::numeric_limits<float>::max(), lastPoint,
+					d));
+	return d;
+}
+double Intersector::intersectSegmentDistance(const float3& p1, const float3& p2,
+		float3& lastPoint, KDTrianglePtr& lastTriangle) const {
+	double d;
+	lastTriangle = getTriangle(intersectRay(p1, p2 - p1, 1.0f, lastPoint, d));
+	return d;
+}
+double Intersector::closestPointSignedDistance(const float3& r, float3& lastPoint,
+		KDTrianglePtr& lastTriangle) const {
+	double d;
+	lastTriangle = getTriangle(closestSigned(r, 1E30, lastPoint, d));
+	return d;
 }
 double Intersector::closestPointSignedDistance(const float3& r,const float& maxDistance, float3& lastPoint,
-	KDTriangle*& lastTriangle) const {
-	double d = closestPoint(r, maxDistance, lastPoint, lastTriangle);
-	if (d >= 0&&d!= NO_HIT_DISTANCE) {
-		float3 norm = lastTriangle->getNormal();
-		float3 center = lastTriangle->getCentroid();
-		float3 diff = r - center;
-		return sign(dot(diff, norm)) * d;
-	}
-	else {
-		return NO_HIT_DISTANCE;
-	}
+	KDTrianglePtr& lastTriangle) const {
+	double d;
+	lastTriangle = getTriangle(closestSigned(r, maxDistance, lastPoint, d));
+	return d;
 }
 double Intersector::closestPoint(const float3& pt, const float& maxDistance,
-		float3& lastPoint, KDTriangle*& lastTriangle) const {
-	if (root->getChildren().size() == 0)
-		throw new std::runtime_error("KD-Tree has not been initialized.");
+		float3& lastPoint, KDTrianglePtr& lastTriangle) const {
 	double d;
-	double triangleDist = maxDistance;
-	std::priority_queue<KDBoxDistance,std::vector<KDBoxDistance>,CompareKDBox> queue;
-	queue.push(KDBoxDistance(pt, getRoot()));
-	lastTriangle = nullptr;
-	lastPoint = NO_HIT_POINT;
-	float3 lastIntersect = NO_HIT_POINT;
-	while (queue.size() > 0) {
-		KDBoxDistance boxd = queue.top();
-		queue.pop();
-		if (boxd.box->isLeaf) {
-			KDTriangle* tri = dynamic_cast<KDTriangle*>(boxd.box);
-			d = tri->distance(pt, lastIntersect);
-			if (d <= triangleDist) {
-				triangleDist = d;
-				lastTriangle = tri;
-				lastPoint = lastIntersect;
-			}
-		} else {
-			for (KDBox* child : boxd.box->getChildren()) {
-				KDBoxDistance kdb(pt, child);
-				if (kdb.dist <= maxDistance) {
-					queue.push(kdb);
-				}
-			}
+	lastTriangle = getTriangle(closest(pt, maxDistance, nullptr, lastPoint, d));
+	return d;
+}
+double Intersector::closestPoint(const float3& pt, float3& lastPoint,
+		KDTrianglePtr& lastTriangle) const {
+	double d;
+	lastTriangle = getTriangle(closest(pt, 1E30, nullptr, lastPoint, d));
+	return d;
+}
+double Intersector::closestPointOutside(const float3& r, const float3& v,
+		float3& lastPoint, KDTrianglePtr& lastTriangle) const {
+	double d;
+	lastTriangle = getTriangle(closest(r, 1E30, &v, lastPoint, d));
+	return d;
+}
+namespace {
+//Spreads the lower 10 bits of v so there are two zero bits between each.
+inline uint32_t SpreadBits(uint32_t v) {
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+//Non-finite coordinates, such as the direction of a zero-length segment, map to zero.
+inline uint32_t Quantize(float v, float scale) {
+	v *= scale;
+	return (v > 0.0f) ? (uint32_t) std::min(v, scale) : 0u;
+}
+inline uint32_t MortonCode(const float3& pt, int bits) {
+	float scale = (float) ((1 << bits) - 1);
+	return (SpreadBits(Quantize(pt.x, scale)) << 2)
+			| (SpreadBits(Quantize(pt.y, scale)) << 1)
+			| SpreadBits(Quantize(pt.z, scale));
+}
+}
+void Intersector::sortQueries(const std::vector<float3>& points,
+		const std::vector<float3>& directions,
+		std::vector<uint32_t>& order) const {
+	size_t N = points.size();
+	if (N >= (size_t) std::numeric_limits<uint32_t>::max())
+		throw std::runtime_error(
+				MakeString() << "Too many queries for intersector " << N);
+	float3 minPt = minPoint;
+	float3 extent = aly::max(maxPoint - minPt, float3(1E-6f));
+	bool hasDirections = (directions.size() == N);
+	//Key is the position code in the upper word, then the direction code.
+	std::vector<std::pair<uint64_t, uint32_t>> keys(N);
+#pragma omp parallel for
+	for (int n = 0; n < (int) N; n++) {
+		uint64_t key = (uint64_t) MortonCode((points[n] - minPt) / extent, 10)
+				<< 32;
+		if (hasDirections) {
+			key |= MortonCode(
+					0.5f * normalize(directions[n]) + float3(0.5f), 10);
 		}
+		keys[n] = std::pair<uint64_t, uint32_t>(key, (uint32_t) n);
 	}
-	if (lastTriangle == nullptr) {
-		return NO_HIT_DISTANCE;
-	} else {
-		return triangleDist;
+	std::sort(keys.begin(), keys.end());
+	order.resize(N);
+	for (size_t n = 0; n < N; n++) {
+		order[n] = keys[n].second;
 	}
 }
-double Intersector::closestPoint(const float3& pt, float3& lastPoint,
-		KDTriangle*& lastTriangle) const {
-	if (root->getChildren().size() == 0)
-		throw new std::runtime_error("KD-Tree has not been initialized.");
-	double d;
-	double mind = 1E30;
-	double triangleDist = 1E30;
-	std::priority_queue<KDBoxDistance,std::vector<KDBoxDistance>,CompareKDBox> queue;
-	queue.push(KDBoxDistance(pt, getRoot()));
-	lastTriangle = nullptr;
-	lastPoint = NO_HIT_POINT;
-	float3 lastIntersect = NO_HIT_POINT;
-	while (queue.size() > 0) {
-		KDBoxDistance boxd = queue.top();
-		queue.pop();
-		if (boxd.dist <= mind || boxd.box->isLeaf) {
-			if (boxd.box->isLeaf) {
-				mind = boxd.dist;
-				KDTriangle* tri = dynamic_cast<KDTriangle*>(boxd.box);
-				d = tri->distance(pt, lastIntersect);
-				if (d < triangleDist) {
-					triangleDist = d;
-					lastTriangle = tri;
-					lastPoint = lastIntersect;
-				}
-			} else {
-				for (KDBox* child : boxd.box->getChildren()) {
-					KDBoxDistance kdb(pt, child);
-					queue.push(kdb);
-				}
-			}
+void Intersector::intersectRayDistance(const std::vector<float3>& origins,
+		const std::vector<float3>& directions,
+		IntersectorResult& result) const {
+	if (origins.size() != directions.size())
+		throw std::runtime_error(
+				MakeString() << "Query size mismatch " << origins.size()
+						<< " != " << directions.size());
+	if (nodes.size() == 0)
+		throw std::runtime_error("Intersector has not been initialized.");
+	std::vector<uint32_t> order;
+	sortQueries(origins, directions, order);
+	result.resize(origins.size());
+#pragma omp parallel for schedule(dynamic,256)
+	for (int n = 0; n < (int) order.size(); n++) {
+		uint32_t q = order[n];
+		float t;
+		int hit = intersect(origins[q], directions[q],
+				std::numeric_limits<float>::max(), t);
+		if (hit >= 0) {
+			float3 pt = origins[q] + directions[q] * t;
+			result.points[q] = pt;
+			result.distances[q] = distance(origins[q], pt);
+			result.triangleIds[q] = (int64_t) triangleArray.ids[hit];
+		} else {
+			result.points[q] = NO_HIT_POINT;
+			result.distances[q] = NO_HIT_DISTANCE;
+			result.triangleIds[q] = -1;
 		}
 	}
-	if (lastTriangle == nullptr) {
-		return NO_HIT_DISTANCE;
-	} else {
-		return triangleDist;
+}
+void Intersector::intersectSegmentDistance(const std::vector<float3>& starts,
+		const std::vector<float3>& ends, IntersectorResult& result) const {
+	if (starts.size() != ends.size())
+		throw std::runtime_error(
+				MakeString() << "Query size mismatch " << starts.size()
+						<< " != " << ends.size());
+	if (nodes.size() == 0)
+		throw std::runtime_error("Intersector has not been initialized.");
+	std::vector<float3> directions(starts.size());
+#pragma omp parallel for
+	for (int n = 0; n < (int) starts.size(); n++) {
+		directions[n] = ends[n] - starts[n];
+	}
+	std::vector<uint32_t> order;
+	sortQueries(starts, directions, order);
+	result.resize(starts.size());
+#pragma omp parallel for schedule(dynamic,256)
+	for (int n = 0; n < (int) order.size(); n++) {
+		uint32_t q = order[n];
+		float t;
+		int hit = intersect(starts[q], directions[q], 1.0f, t);
+		if (hit >= 0) {
+			float3 pt = starts[q] + directions[q] * t;
+			result.points[q] = pt;
+			result.distances[q] = distance(starts[q], pt);
+			result.triangleIds[q] = (int64_t) triangleArray.ids[hit];
+		} else {
+			result.points[q] = NO_HIT_POINT;
+			result.distances[q] = NO_HIT_DISTANCE;
+			result.triangleIds[q] = -1;
+		}
 	}
 }
-
-double Intersector::closestPointOutside(const float3& r, const float3& v,
-		float3& lastPoint, KDTriangle*& lastTriangle) const {
-	if (root->getChildren().size() == 0)
-		throw new std::runtime_error("KD-Tree has not been initialized.");
-
-	double d;
-	double mind = 1E30;
-	double triangleDist = 1E30;
-	std::priority_queue<KDBoxDistance,std::vector<KDBoxDistance>,CompareKDBox> queue;
-	queue.push(KDBoxDistance(r, getRoot()));
-
-	lastTriangle = nullptr;
-	lastPoint = NO_HIT_POINT;
-	float3 pt;
-	float3 testv;
-	float3 lastIntersect;
-	while (queue.size() > 0) {
-		KDBoxDistance boxd = queue.top();
-		queue.pop();
-		if (boxd.dist <= mind || boxd.box->isLeaf) {
-			if (boxd.box->isLeaf) {
-				mind = boxd.dist;
-				KDTriangle* tri = dynamic_cast<KDTriangle*>(boxd.box);
-				d = tri->distance(r, lastIntersect);
-				boxd.dist = d;
-				if (d < triangleDist) {
-					pt = lastIntersect;
-					testv = pt - r;
-					// Test if point is on one side of plane
-					if (dot(testv, v) >= 0) {
-						triangleDist = d;
-						lastTriangle = tri;
-						lastPoint = pt;
-					}
-				}
-			} else {
-				for (KDBox* child : boxd.box->getChildren()) {
-					queue.push(KDBoxDistance(pt, child));
-				}
-			}
+void Intersector::closestPoint(const std::vector<float3>& points,
+		IntersectorResult& result, float maxDistance) const {
+	if (nodes.size() == 0)
+		throw std::runtime_error("Intersector has not been initialized.");
+	std::vector<uint32_t> order;
+	sortQueries(points, std::vector<float3>(), order);
+	result.resize(points.size());
+#pragma omp parallel for schedule(dynamic,256)
+	for (int n = 0; n < (int) order.size(); n++) {
+		uint32_t q = order[n];
+		double d;
+		float3 pt;
+		int hit = closest(points[q], maxDistance, nullptr, pt, d);
+		if (hit >= 0) {
+			result.points[q] = pt;
+			result.distances[q] = d;
+			result.triangleIds[q] = (int64_t) triangleArray.ids[hit];
+		} else {
+			result.points[q] = NO_HIT_POINT;
+			result.distances[q] = NO_HIT_DISTANCE;
+			result.triangleIds[q] = -1;
 		}
 	}
-	if (lastTriangle == nullptr) {
-		return NO_HIT_DISTANCE;
-	} else {
-		return mind;
+}
+void Intersector::closestPointSignedDistance(const std::vector<float3>& points,
+		IntersectorResult& result, float maxDistance) const {
+	if (nodes.size() == 0)
+		throw std::runtime_error("Intersector has not been initialized.");
+	std::vector<uint32_t> order;
+	sortQueries(points, std::vector<float3>(), order);
+	result.resize(points.size());
+#pragma omp parallel for schedule(dynamic,256)
+	for (int n = 0; n < (int) order.size(); n++) {
+		uint32_t q = order[n];
+		double d;
+		float3 pt;
+		int hit = closestSigned(points[q], maxDistance, pt, d);
+		if (hit >= 0) {
+			result.points[q] = pt;
+			result.distances[q] = d;
+			result.triangleIds[q] = (int64_t) triangleArray.ids[hit];
+		} else {
+			result.points[q] = NO_HIT_POINT;
+			result.distances[q] = NO_HIT_DISTANCE;
+			result.triangleIds[q] = -1;
+		}
 	}
 }
-
 }
@@ -22,8 +22,11 @@
 #ifndef ALLOYMESHKDTREE_H_
 #define ALLOYMESHKDTREE_H_
 #include "math/AlloyVecMath.h"
+#include <vector>
+#include <limits>
+#include <memory>
 
-//Mesh intersection implemented with a KD-tree of triangles.
+//Mesh intersection implemented with a bounding volume hierarchy of triangles.
 //The term "Intersector" is used to disambiguate this KD-tree from the one used for points.
 
 namespace aly {
@@ -88,35 +91,6 @@ namespace aly {
 		std::basic_ostream<C, R> & ss, const KDBox& a) {
 		return ss << "[" << a.minPoint << "," << a.maxPoint << ","<<a.children.size()<<"]";
 	}
-	class KDBoxEdge {
-	protected:
-		double value;
-		bool start;
-		KDBox* box;
-	public:
-		template<class C, class R> friend std::basic_ostream<C, R> & operator <<(std::basic_ostream<C, R> & ss, const KDBoxEdge& a);
-		KDBox* getBox() {
-			return box;
-		}
-		double getValue() const {
-			return value;
-		}
-		bool isMin() const {
-			return start;
-		}
-		void set(KDBox* b, int dim, bool start);
-		KDBoxEdge() :
-			value(1E30), start(true), box(nullptr) {
-		}
-		KDBoxEdge(KDBox* b, int dim, bool start) {
-			set(b, dim, start);
-		}
-		~KDBoxEdge() {}
-	};
-	template<class C, class R> std::basic_ostream<C, R> & operator <<(
-		std::basic_ostream<C, R> & ss, const KDBoxEdge& a) {
-		return ss << "<" << *a.box << ": " << ((a.start) ? "start" : "") << ": " << a.value << ">";
-	}
 	class KDSegment {
 	public:
 		float extent;
@@ -158,6 +132,9 @@ namespace aly {
 		float3 getCentroid() const {
 			return 0.3333333f * (pts[0] + pts[1] + pts[2]);
 		}
+		const float3& getPoint(int i) const {
+			return pts[i];
+		}
 		float3 fromBary(const double3& b) const {
 			return float3(
 				(float)(pts[0].x * b.x + pts[1].x * b.y + pts[2].x * b.z),
@@ -170,155 +147,239 @@ namespace aly {
 		double distance(const float3& p, float3& lastIntersect) const;
 	};
 
-	struct KDBoxDistance {
-		KDBox* box;
-		double dist;
-		KDBoxDistance(const float3& ref, KDBox* tri) :
-			box(tri) {
-			dist = tri->distanceToBox(ref);
+	typedef std::shared_ptr<KDTriangle> KDTrianglePtr;
+	//Binary bounding volume hierarchy node produced by the SAH build. Nodes are
+	//stored in depth-first order, so the left child immediately follows.
+	struct BVHNode {
+		float3 minPoint;
+		uint32_t offset;//First triangle of a leaf, or index of the right child.
+		float3 maxPoint;
+		uint32_t count;//Number of triangles in a leaf, zero for interior nodes.
+		bool isLeaf() const {
+			return (count > 0);
+		}
+	};
+	//Four-wide node traversed by the intersector. Child boxes are stored in
+	//structure-of-arrays layout so all four slab tests run together. A slot
+	//with count > 0 is a leaf range starting at child, count == 0 is an
+	//interior node, and unused slots have infinite boxes that are never hit.
+	struct BVHWideNode {
+		static const int WIDTH = 4;
+		float minX[WIDTH], minY[WIDTH], minZ[WIDTH];
+		float maxX[WIDTH], maxY[WIDTH], maxZ[WIDTH];
+		uint32_t child[WIDTH];
+		uint32_t count[WIDTH];
+	};
+	//Triangle vertices and ids in structure-of-arrays layout, ordered to
+	//match the leaves of the hierarchy.
+	struct KDTriangleArray {
+		std::vector<float> x0, y0, z0;
+		std::vector<float> x1, y1, z1;
+		std::vector<float> x2, y2, z2;
+		std::vector<uint64_t> ids;
+		void resize(size_t sz);
+		void set(size_t i, const float3& pt1, const float3& pt2, const float3& pt3, uint64_t id);
+		float3 getPoint(size_t i, int k) const {
+			return (k == 0) ? float3(x0[i], y0[i], z0[i]) :
+					((k == 1) ? float3(x1[i], y1[i], z1[i]) : float3(x2[i], y2[i], z2[i]));
+		}
+		float3 getNormal(size_t i) const;
+		float3 getCentroid(size_t i) const;
+		KDTrianglePtr getTriangle(size_t i) const {
+			return KDTrianglePtr(new KDTriangle(getPoint(i, 0), getPoint(i, 1), getPoint(i, 2), ids[i]));
+		}
+		size_t size() const {
+			return x0.size();
+		}
+		void clear();
+	};
+	//Results of a batched query in structure-of-arrays layout, indexed like
+	//the query arrays. Misses report NO_HIT_DISTANCE, NO_HIT_POINT and id -1.
+	struct IntersectorResult {
+		std::vector<double> distances;
+		std::vector<float3> points;
+		std::vector<int64_t> triangleIds;
+		void resize(size_t sz) {
+			distances.resize(sz);
+			points.resize(sz);
+			triangleIds.resize(sz);
+		}
+		size_t size() const {
+			return distances.size();
+		}
+		void clear() {
+			distances.clear();
+			points.clear();
+			triangleIds.clear();
 		}
-
 	};
-	template<class C, class R> std::basic_ostream<C, R> & operator <<(
-		std::basic_ostream<C, R> & ss, const KDBoxDistance& a) {
-		return ss << a.box << ": " << a.dist;
-	}
-	inline bool operator<(const KDBoxDistance& a, const KDBoxDistance& b) {
-		//Priority queue puts largest first, so we need to use a >= operator to get ascending order.
-		return (a.dist > b.dist);
-	}
-        struct CompareKDBox{
-                bool operator()(const KDBoxDistance& a, const KDBoxDistance& b){
-                    return (a.dist > b.dist);
-                }
-        };
 	class Intersector {
 	protected:
-		std::shared_ptr<KDBox> root;
-		std::vector<std::shared_ptr<KDBox>> storage;
-		const double intersectCost = 80;
-		const double traversalCost = 1;
-		const double emptyBonus = 0.2;
-		int splitPosition(std::vector<KDBox*>& children,
-			std::vector<KDBoxEdge>& edges, KDBox* box);
-		void buildTree(int maxDepth);
+		static const int MAX_DEPTH = 60;
+		static const int BIN_COUNT = 16;
+		static const int MAX_LEAF_SIZE = 8;
+		std::vector<BVHWideNode> nodes;
+		float3 minPoint, maxPoint;
+		KDTriangleArray triangleArray;
+		uint32_t buildNode(std::vector<BVHNode>& bvh, std::vector<uint32_t>& order,
+			const std::vector<float3>& minPoints,
+			const std::vector<float3>& maxPoints,
+			const std::vector<float3>& centroids, uint32_t begin, uint32_t end,
+			int depth, int maxDepth);
+		uint32_t collapseNode(const std::vector<BVHNode>& bvh, uint32_t index);
+		int intersectLeaf(uint32_t offset, uint32_t count, const float3& org,
+			const float3& dir, float& tmax) const;
+		int intersect(const float3& org, const float3& dir, float tmax,
+			float& t) const;
+		int closest(const float3& pt, double maxDistance,
+			const float3* halfSpace, float3& lastPoint, double& dist) const;
+		//Index returning queries behind the public interface. Misses return -1
+		//and report NO_HIT_POINT and NO_HIT_DISTANCE.
+		int intersectRay(const float3& p1, const float3& v, float tmax,
+			float3& lastPoint, double& dist) const;
+		int closestSigned(const float3& r, double maxDistance,
+			float3& lastPoint, double& dist) const;
+		KDTrianglePtr getTriangle(int hit) const {
+			return (hit >= 0) ? triangleArray.getTriangle(hit) : KDTrianglePtr();
+		}
+		void sortQueries(const std::vector<float3>& points,
+			const std::vector<float3>& directions,
+			std::vector<uint32_t>& order) const;
 	public:
 		void reset() {
-			root.reset();
-			storage.clear();
-			storage.shrink_to_fit();
+			nodes.clear();
+			nodes.shrink_to_fit();
+			triangleArray.clear();
 		}
-		KDBox* getRoot() const {
-			return root.get();
+		const std::vector<BVHWideNode>& getNodes() const {
+			return nodes;
 		}
-
+		//Builds a binned SAH hierarchy and collapses it into four-wide nodes.
+		//maxDepth is kept for compatibility and is raised when needed so leaves
+		//stay small on large meshes.
 		void build(const Mesh& mesh, int maxDepth = 16);
 		Intersector(const Mesh& mesh, int maxDepth = 16) {
 			build(mesh, maxDepth);
 		}
 		Intersector() {
 		}
+		//Overloads that report the hit triangle build it on demand from the
+		//triangle arrays.
 		double intersectRayDistance(const float3& p1, const float3& v,
-			float3& lastPoint, KDTriangle*& lastTriangle) const;
+			float3& lastPoint, KDTrianglePtr& lastTriangle) const;
 		double intersectSegmentDistance(const float3& p1, const float3& p2,
-			float3& lastPoint, KDTriangle*& lastTriangle) const;
+			float3& lastPoint, KDTrianglePtr& lastTriangle) const;
 		double closestPointSignedDistance(const float3& r, float3& lastPoint,
-			KDTriangle*& lastTriangle) const;
+			KDTrianglePtr& lastTriangle) const;
 		double closestPoint(const float3& pt, float3& lastPoint,
-			KDTriangle*& lastTriangle) const;
+			KDTrianglePtr& lastTriangle) const;
 		double closestPoint(const float3& pt,const float& maxDistance, float3& lastPoint,
-			KDTriangle*& lastTriangle) const;
-		double closestPointSignedDistance(const float3& r, const float& maxDistance, float3& lastPoint, KDTriangle*& lastTriangle) const;
+			KDTrianglePtr& lastTriangle) const;
+		double closestPointSignedDistance(const float3& r, const float& maxDistance, float3& lastPoint, KDTrianglePtr& lastTriangle) const;
 		double closestPointOutside(const float3& r, const float3& v,
-			float3& lastPoint, KDTriangle*& lastTriangle) const;
+			float3& lastPoint, KDTrianglePtr& lastTriangle) const;
 
 		double intersectRayDistance(const float3& p1, const float3& v,
 			float3& lastPoint) const {
-			KDTriangle* lastTriangle;
-			return intersectRayDistance(p1, v, lastPoint, lastTriangle);
+			double d;
+			intersectRay(p1, v, std::numeric_limits<float>::max(), lastPoint, d);
+			return d;
 		}
 		double intersectSegmentDistance(const float3& p1, const float3& p2,
 			float3& lastPoint) const {
-			KDTriangle* lastTriangle;
-			return intersectSegmentDistance(p1, p2, lastPoint, lastTriangle);
+			double d;
+			intersectRay(p1, p2 - p1, 1.0f, lastPoint, d);
+			return d;
 		}
 		double closestPointSignedDistance(const float3& r,
 			float3& lastPoint) const {
-			KDTriangle* lastTriangle;
-			return closestPointSignedDistance(r, lastPoint, lastTriangle);
+			double d;
+			closestSigned(r, 1E30, lastPoint, d);
+			return d;
 		}
 		double closestPoint(const float3& pt,const float& maxDistance, float3& lastPoint) const{
-			KDTriangle* lastTriangle;
-			return closestPoint(pt,maxDistance,lastPoint,lastTriangle);
+			double d;
+			closest(pt, maxDistance, nullptr, lastPoint, d);
+			return d;
 		}
 		double closestPoint(const float3& pt, float3& lastPoint) const {
-			KDTriangle* lastTriangle;
-			return closestPoint(pt, lastPoint, lastTriangle);
+			double d;
+			closest(pt, 1E30, nullptr, lastPoint, d);
+			return d;
 		}
 		double closestPointOutside(const float3& r, const float3& v,
 			float3& lastPoint) const {
-			KDTriangle* lastTriangle;
-			return closestPointOutside(r, v, lastPoint, lastTriangle);
+			double d;
+			closest(r, 1E30, &v, lastPoint, d);
+			return d;
 		}
 		double intersectRayDistance(const float3& p1, const float3& v) const {
 			float3 lastPoint;
-			KDTriangle* lastTriangle;
-			return intersectRayDistance(p1, v, lastPoint, lastTriangle);
+			return intersectRayDistance(p1, v, lastPoint);
 		}
 		double intersectSegmentDistance(const float3& p1, const float3& p2) const {
 			float3 lastPoint;
-			KDTriangle* lastTriangle;
-			return intersectSegmentDistance(p1, p2, lastPoint, lastTriangle);
+			return intersectSegmentDistance(p1, p2, lastPoint);
 		}
 		double closestPointSignedDistance(const float3& r) const {
 			float3 lastPoint;
-			KDTriangle* lastTriangle;
-			return closestPointSignedDistance(r, lastPoint, lastTriangle);
+			return closestPointSignedDistance(r, lastPoint);
 		}
 		double closestPointSignedDistance(const float3& r, const float& maxDistance) const {
 			float3 lastPoint;
-			KDTriangle* lastTriangle;
-			return closestPointSignedDistance(r, maxDistance, lastPoint, lastTriangle);
+			double d;
+			closestSigned(r, maxDistance, lastPoint, d);
+			return d;
 		}
 		double closestPoint(const float3& pt,const float& maxDistance) const{
 			float3 lastPoint;
-			KDTriangle* lastTriangle;
-			return closestPoint(pt,maxDistance,lastPoint,lastTriangle);
+			return closestPoint(pt, maxDistance, lastPoint);
 		}
 		double closestPoint(const float3& pt) const {
 			float3 lastPoint;
-			KDTriangle* lastTriangle;
-			return closestPoint(pt, lastPoint, lastTriangle);
+			return closestPoint(pt, lastPoint);
 		}
 		double closestPointOutside(const float3& r, const float3& v) const {
 			float3 lastPoint;
-			KDTriangle* lastTriangle;
-			return closestPointOutside(r, v, lastPoint, lastTriangle);
+			return closestPointOutside(r, v, lastPoint);
 		}
 
 		double intersectRayDistance(const float3& p1, const float3& v,
-			KDTriangle*& lastTriangle) const {
+			KDTrianglePtr& lastTriangle) const {
 			float3 lastPoint;
 			return intersectRayDistance(p1, v, lastPoint, lastTriangle);
 		}
 		double intersectSegmentDistance(const float3& p1, const float3& p2,
-			KDTriangle*& lastTriangle) const {
+			KDTrianglePtr& lastTriangle) const {
 			float3 lastPoint;
 			return intersectSegmentDistance(p1, p2, lastPoint, lastTriangle);
 		}
-		double closestPointSignedDistance(const float3& r, KDTriangle*& lastTriangle) const {
+		double closestPointSignedDistance(const float3& r, KDTrianglePtr& lastTriangle) const {
 			float3 lastPoint;
 			return closestPointSignedDistance(r, lastPoint, lastTriangle);
 		}
-		double closestPoint(const float3& pt, KDTriangle*& lastTriangle) const {
+		double closestPoint(const float3& pt, KDTrianglePtr& lastTriangle) const {
 			float3 lastPoint;
 			return closestPoint(pt, lastPoint, lastTriangle);
 		}
 		double closestPointOutside(const float3& r, const float3& v,
-			KDTriangle*& lastTriangle) const {
+			KDTrianglePtr& lastTriangle) const {
 			float3 lastPoint;
 			return closestPointOutside(r, v, lastPoint, lastTriangle);
 		}
+		//Batched queries. Queries are reordered along a Morton curve so that
+		//neighboring queries share traversal paths, then evaluated in parallel.
+		void intersectRayDistance(const std::vector<float3>& origins,
+			const std::vector<float3>& directions,
+			IntersectorResult& result) const;
+		void intersectSegmentDistance(const std::vector<float3>& starts,
+			const std::vector<float3>& ends, IntersectorResult& result) const;
+		void closestPoint(const std::vector<float3>& points,
+			IntersectorResult& result,
+			float maxDistance = std::numeric_limits<float>::max()) const;
+		void closestPointSignedDistance(const std::vector<float3>& points,
+			IntersectorResult& result,
+			float maxDistance = std::numeric_limits<float>::max()) const;
 	};
 }
 #endif
@@ -49,6 +49,41 @@ namespace aly {
 				processSquare(i, j, splits, edges);
 			}
 		}
+		traceCurves(splits, points, lines, winding);
+		img = nullptr;
+	}
+	void IsoContour::solve(const NarrowBand2D& levelset, int channel, Vector2f& points, std::vector<std::vector<uint32_t>>& lines, float isoLevel, const TopologyRule2D& topoRule, const Winding& winding) {
+		int2 dims = levelset.dimensions();
+		rows = dims.x;
+		cols = dims.y;
+		this->isoLevel = isoLevel;
+		this->channel = channel;
+		rule = topoRule;
+		band = &levelset;
+		vertCount = 0;
+		//Squares outside the allocated tiles have no sign change. Visit the rest in the same order as the dense solve.
+		std::vector<int2> squares;
+		for (int s = 0; s < (int) levelset.getTileCount(); s++) {
+			int2 origin = levelset.getTileOrigin(s);
+			int2 end = aly::min(origin + int2(NarrowBand2D::TILE_SIZE), dims - int2(1));
+			for (int j = origin.y; j < end.y; j++) {
+				for (int i = origin.x; i < end.x; i++) {
+					squares.push_back(int2(i, j));
+				}
+			}
+		}
+		std::sort(squares.begin(), squares.end(), [](const int2& a, const int2& b) {
+			return (a.x < b.x || (a.x == b.x && a.y < b.y));
+		});
+		std::map<uint64_t, EdgeSplitPtr> splits;
+		std::list<EdgePtr> edges;
+		for (int2 square : squares) {
+			processSquare(square.x, square.y, splits, edges);
+		}
+		traceCurves(splits, points, lines, winding);
+		band = nullptr;
+	}
+	void IsoContour::traceCurves(const std::map<uint64_t, EdgeSplitPtr>& splits, Vector2f& points, std::vector<std::vector<uint32_t>>& lines, const Winding& winding) {
 		std::vector<EdgeSplitPtr> pts(splits.size());
 		for (const std::pair<uint64_t, EdgeSplitPtr>& split : splits) {
 			pts[split.second->vid] = split.second;
@@ -133,7 +168,6 @@ namespace aly {
 				}
 			}
 		}
-		img = nullptr;
 	}
 	void IsoContour::solve(const Image1f& levelset, Vector2f& points, Vector2ui& indexes, float isoLevel, const TopologyRule2D& topoRule,const Winding& winding){
 		rows = levelset.width;
@@ -581,7 +615,7 @@ namespace aly {
 		}
 	}
 	float IsoContour::getValue(int i, int j) {
-		float val = (*img)(i,j) - isoLevel;
+		float val = ((band != nullptr) ? band->getValue(int2(i, j), channel) : (*img)(i, j).x) - isoLevel;
 		if (nudgeLevelSet) {
 			if (val < 0) {
 				val = std::min(val, -LEVEL_SET_TOLERANCE);
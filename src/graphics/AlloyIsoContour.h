@@ -24,6 +24,7 @@
 #include "image/AlloyImage.h"
 #include "math/AlloyVector.h"
 #include "ui/AlloyEnum.h"
+#include "vision/NarrowBand.h"
 #include <memory>
 #include <list>
 #include <map>
@@ -123,6 +124,8 @@ protected:
 	TopologyRule2D rule = TopologyRule2D::Unconstrained;
 	int rows=0, cols=0;
 	const Image1f* img;
+	const NarrowBand2D* band;
+	int channel;
 	float getValue(int x, int y);
 	float fGetOffset(uint2 v1, uint2 v2);
 	EdgeSplitPtr createSplit(std::map<uint64_t, EdgeSplitPtr>& splits, int p1x,
@@ -138,10 +141,13 @@ protected:
 			std::list<EdgePtr>& edges);
 	bool orient(const Image1f& img, const EdgeSplit2D& split1,
 			const EdgeSplit2D& split2, Edge& edge);
+	void traceCurves(const std::map<uint64_t, EdgeSplitPtr>& splits,
+			Vector2f& points, std::vector<std::vector<uint32_t>>& lines,
+			const Winding& winding);
 public:
 	IsoContour(bool nudgeLevelSet = true, float levelSetTolerance = 1E-3f) :
 			nudgeLevelSet(nudgeLevelSet), LEVEL_SET_TOLERANCE(
-					levelSetTolerance), img(nullptr) {
+					levelSetTolerance), img(nullptr), band(nullptr), channel(0) {
 
 	}
 	virtual ~IsoContour() {
@@ -154,6 +160,11 @@ public:
 			std::vector<std::vector<uint32_t>>& indexes, float isoLevel = 0.0f,
 			const TopologyRule2D& rule = TopologyRule2D::Unconstrained,
 			const Winding& winding = Winding::CounterClockwise);
+	//Contours one channel of a narrow band, visiting only squares in its allocated tiles.
+	void solve(const NarrowBand2D& band, int channel, Vector2f& points,
+			std::vector<std::vector<uint32_t>>& indexes, float isoLevel = 0.0f,
+			const TopologyRule2D& rule = TopologyRule2D::Unconstrained,
+			const Winding& winding = Winding::CounterClockwise);
 };
 }
 #endif 
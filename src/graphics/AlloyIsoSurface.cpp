@@ -402,6 +402,15 @@ void IsoSurface::solve(const Volume1f& data, Mesh& mesh, const MeshType& type,
 		bool regularize, const float& isoLevel) {
 	std::vector<int3> narrowBandList;
 	backgroundValue = 1E30f;
+	if (type == MeshType::Triangle) {
+		mesh.clear();
+		solveTri(data, mesh, isoLevel);
+		if (regularize) {
+			this->regularize(data.ptr(), mesh);
+		}
+		mesh.updateBoundingBox();
+		return;
+	}
 	static const std::vector<int3> nbrs={
 			int3(0,0,1),
 			int3(0,1,0),
@@ -426,6 +435,112 @@ void IsoSurface::solve(const Volume1f& data, Mesh& mesh, const MeshType& type,
 	}
 	solve(data, narrowBandList, mesh, type, regularize, isoLevel);
 }
+void IsoSurface::solve(const MappedVolume1f& data, Mesh& mesh,
+		const MeshType& type, const float& isoLevel) {
+	static const std::vector<int3> nbrs = { int3(0, 0, 1), int3(0, 1, 0), int3(
+			0, 1, 1), int3(1, 0, 0), int3(1, 0, 1), int3(1, 1, 0), int3(1, 1, 1) };
+	//Vertices on a shared brick face are computed twice, so weld on a fine lattice.
+	const float weldScale = 1024.0f;
+	backgroundValue = 1E30f;
+	mesh.clear();
+	std::unordered_map<int3, uint32_t> welded;
+	std::vector<int3> indexList;
+	std::vector<uint32_t> remap;
+	Mesh brickMesh;
+	ForEachBrick(data, 2,
+			[&](const Volume1f& block, const int3& brickMin, const int3& brickDims) {
+				int3 blockMin = block.position();
+				//Quad vertices average the edges around a voxel, so quads also visit a ring of neighboring cells.
+				int ring = (type == MeshType::Quad) ? 1 : 0;
+				int border = (type == MeshType::Quad) ? 0 : 1;
+				int3 lo = max(brickMin - ring, int3(border));
+				int3 hi = min(brickMin + brickDims + ring, data.dimensions() - 1);
+				indexList.clear();
+				for (int k = lo.z; k < hi.z; k++) {
+					for (int j = lo.y; j < hi.y; j++) {
+						for (int i = lo.x; i < hi.x; i++) {
+							int3 loc = int3(i, j, k) - blockMin;
+							float c = block(loc.x, loc.y, loc.z).x;
+							for (int3 n : nbrs) {
+								if (block(loc.x + n.x, loc.y + n.y, loc.z + n.z).x * c
+										<= 0) {
+									indexList.push_back(loc);
+									break;
+								}
+							}
+						}
+					}
+				}
+				if (indexList.size() == 0)
+					return;
+				if (type == MeshType::Triangle) {
+					solve(block, indexList, brickMesh, type, false, isoLevel);
+				} else {
+					this->rows = block.rows;
+					this->cols = block.cols;
+					this->slices = block.slices;
+					this->isoLevel = isoLevel;
+					std::unordered_set<int3> activeVoxels;
+					std::unordered_map<int4, EdgeInfo> activeEdges;
+					std::unordered_map<int4, EdgeInfo> brickEdges;
+					std::unordered_map<int3, uint32_t> vertexIndices;
+					brickMesh.clear();
+					findActiveVoxels(block.ptr(), indexList, activeVoxels,
+							activeEdges);
+					int3 brickLo = brickMin - blockMin;
+					int3 brickHi = brickLo + brickDims;
+					for (const auto& pair : activeEdges) {
+						int3 pivot = pair.first.xyz();
+						if (pivot.x >= brickLo.x && pivot.y >= brickLo.y
+								&& pivot.z >= brickLo.z && pivot.x < brickHi.x
+								&& pivot.y < brickHi.y && pivot.z < brickHi.z) {
+							brickEdges.insert(pair);
+						}
+					}
+					generateVertexData(block.ptr(), activeVoxels, activeEdges,
+							vertexIndices, brickMesh);
+					generateTriangles(brickEdges, vertexIndices, brickMesh);
+				}
+				bool hasNormals = (brickMesh.vertexNormals.size()
+						== brickMesh.vertexLocations.size());
+				//Vertices of apron voxels that no face uses are dropped.
+				remap.assign(brickMesh.vertexLocations.size(),
+						std::numeric_limits<uint32_t>::max());
+				auto weld = [&](uint32_t v) {
+					if (remap[v] != std::numeric_limits<uint32_t>::max())
+						return remap[v];
+					float3 pt = brickMesh.vertexLocations[v] + float3(blockMin);
+					int3 key = int3(
+							(int) std::floor(pt.x * weldScale + 0.5f),
+							(int) std::floor(pt.y * weldScale + 0.5f),
+							(int) std::floor(pt.z * weldScale + 0.5f));
+					auto found = welded.find(key);
+					if (found == welded.end()) {
+						uint32_t id = (uint32_t) mesh.vertexLocations.size();
+						welded[key] = id;
+						mesh.vertexLocations.push_back(pt);
+						if (hasNormals)
+							mesh.vertexNormals.push_back(brickMesh.vertexNormals[v]);
+						remap[v] = id;
+					} else {
+						remap[v] = found->second;
+					}
+					return remap[v];
+				};
+				for (uint3 tri : brickMesh.triIndexes.data) {
+					mesh.triIndexes.push_back(
+							uint3(weld(tri.x), weld(tri.y), weld(tri.z)));
+				}
+				for (uint4 quad : brickMesh.quadIndexes.data) {
+					mesh.quadIndexes.push_back(
+							uint4(weld(quad.x), weld(quad.y), weld(quad.z),
+									weld(quad.w)));
+				}
+			});
+	if (mesh.vertexNormals.size() != mesh.vertexLocations.size())
+		mesh.vertexNormals.clear();
+	mesh.updateBoundingBox();
+}
 void IsoSurface::solve(const Volume1f& data,const std::vector<int3>& indexList,
 		Vector3f& vertexLocations,MeshType type,
 		bool regularize, const float& isoLevel){
@@ -471,6 +586,20 @@ void IsoSurface::solve(const EndlessGridFloat& grid, Mesh& mesh,
 	backgroundValue = oldBg;
 }
 
+void IsoSurface::solve(const NarrowBand3D& band, int channel, Mesh& mesh,
+		const MeshType& type, bool regularizeTest, const float& isoLevel) {
+	mesh.clear();
+	backgroundValue = 1E30f;
+	if (type == MeshType::Triangle) {
+		solveTri(band, channel, mesh, isoLevel);
+	} else {
+		solveQuad(band, channel, mesh, isoLevel);
+	}
+	if (regularizeTest) {
+		regularize(band, channel, mesh);
+	}
+	mesh.updateBoundingBox();
+}
 void IsoSurface::solveQuads(const Volume1f& data,const std::vector<int3>& indexList,Vector3f& vertexLocations,bool regularizeTest, const float& isoLevel){
 	Mesh mesh;
 	solveQuad(data.ptr(), data.rows, data.cols, data.slices, indexList,mesh, isoLevel);
@@ -662,71 +791,452 @@ void IsoSurface::solveQuad(const EndlessGridFloat& grid, Mesh& mesh,
 void IsoSurface::solveTri(const EndlessGridFloat& grid, Mesh& mesh,
 		const float& isoLevel) {
 	this->isoLevel = isoLevel;
-	std::vector<aly::float3> &points = mesh.vertexLocations.data;
-	std::vector<uint3> &indexes = mesh.triIndexes.data;
-	std::unordered_map<int4, EdgeSplit3D> splits;
-	std::vector<IsoTriangle> triangles;
-	size_t vertexCount = 0;
-	triangleCount = 0;
 	auto leafs = grid.getLeafNodes();
+	if (leafs.size() == 0)
+		return;
 	int dim = leafs.front()->dim;
 	int bdim = dim + 1;
 	this->rows = bdim;
 	this->cols = bdim;
 	this->slices = bdim;
-	std::vector<float> data(bdim * bdim * bdim);
-	for (EndlessNodeFloat* leaf : leafs) {
-		int dim = leaf->dim;
-		int3 loc = leaf->location;
-		for (int z = 0; z < bdim; z++) {
-			for (int y = 0; y < bdim; y++) {
-				for (int x = 0; x < bdim; x++) {
-					float val;
-					if (x >= dim || y >= dim || z >= dim) {
-						val = grid.getLeafValue(loc.x + x, loc.y + y,
-								loc.z + z);
+	std::vector<IsoMeshBlock> blocks(leafs.size());
+#pragma omp parallel
+	{
+		std::vector<float> data(bdim * bdim * bdim);
+		EndlessGridAccessor<float> accessor(grid);
+#pragma omp for schedule(dynamic)
+		for (int l = 0; l < (int) leafs.size(); l++) {
+			EndlessNodeFloat* leaf = leafs[l];
+			int3 loc = leaf->location;
+			for (int z = 0; z < bdim; z++) {
+				for (int y = 0; y < bdim; y++) {
+					for (int x = 0; x < bdim; x++) {
+						float val;
+						if (x >= dim || y >= dim || z >= dim) {
+							val = accessor.getValue(loc.x + x, loc.y + y,
+									loc.z + z);
+						} else {
+							val = leaf->data[x + y * dim + z * dim * dim];
+						}
+						data[x + y * bdim + z * bdim * bdim] = val;
+					}
+				}
+			}
+			triangulateBlock(data.data(), int3(bdim), int3(0), int3(dim), loc,
+					blocks[l]);
+		}
+	}
+	stitchBlocks(blocks, mesh);
+	mesh.updateVertexNormals(true);
+}
+void IsoSurface::solveTri(const Volume1f& data, Mesh& mesh,
+		const float& isoLevel) {
+	//Thin enough to balance across threads, thick enough that seams stay small.
+	const int SLAB_THICKNESS = 16;
+	this->rows = data.rows;
+	this->cols = data.cols;
+	this->slices = data.slices;
+	this->isoLevel = isoLevel;
+	//Cells on the volume border are skipped, as in the narrow band solver.
+	int slabCount = (std::max(data.slices - 2, 0) + SLAB_THICKNESS - 1)
+			/ SLAB_THICKNESS;
+	std::vector<IsoMeshBlock> blocks(slabCount);
+	const float* vol = data.ptr();
+#pragma omp parallel for schedule(dynamic)
+	for (int s = 0; s < slabCount; s++) {
+		int z0 = 1 + s * SLAB_THICKNESS;
+		int z1 = std::min(z0 + SLAB_THICKNESS, data.slices - 1);
+		triangulateBlock(vol, data.dimensions(), int3(1, 1, z0),
+				int3(data.rows - 1, data.cols - 1, z1), int3(0), blocks[s]);
+	}
+	stitchBlocks(blocks, mesh);
+	std::vector<float3>& points = mesh.vertexLocations.data;
+	std::vector<float3>& normals = mesh.vertexNormals.data;
+	normals.resize(points.size());
+#pragma omp parallel for
+	for (int n = 0; n < (int) points.size(); n++) {
+		float3 pt = points[n];
+		float3 norm = interpolateNormal(vol, pt.x, pt.y, pt.z);
+		normals[n] = norm / length(norm);
+	}
+}
+void IsoSurface::solveTri(const NarrowBand3D& band, int channel, Mesh& mesh,
+		const float& isoLevel) {
+	int3 dims = band.dimensions();
+	this->rows = dims.x;
+	this->cols = dims.y;
+	this->slices = dims.z;
+	this->isoLevel = isoLevel;
+	//Every cell that crosses the surface has its lower corner in the band, so only allocated tiles are meshed.
+	const int tileCount = (int) band.getTileCount();
+	std::vector<IsoMeshBlock> blocks(tileCount);
+#pragma omp parallel for schedule(dynamic)
+	for (int s = 0; s < tileCount; s++) {
+		float data[NarrowBand3D::PADDED_VOXELS];
+		band.gather(s, channel, data);
+		int3 tileMin = band.getTileOrigin(s);
+		int3 tileMax = min(tileMin + int3(NarrowBand3D::TILE_SIZE), dims - 1);
+		//The gathered block starts one voxel before the tile.
+		int3 blockMin = tileMin - 1;
+		triangulateBlock(data, int3(NarrowBand3D::PADDED_SIZE),
+				max(tileMin, int3(1)) - blockMin, tileMax - blockMin, blockMin,
+				blocks[s]);
+	}
+	stitchBlocks(blocks, mesh);
+	std::vector<float3>& points = mesh.vertexLocations.data;
+	std::vector<float3>& normals = mesh.vertexNormals.data;
+	normals.resize(points.size());
+#pragma omp parallel for
+	for (int n = 0; n < (int) points.size(); n++) {
+		float3 pt = points[n];
+		float3 norm = interpolateNormal(band, channel, pt.x, pt.y, pt.z);
+		normals[n] = norm / length(norm);
+	}
+}
+void IsoSurface::solveQuad(const NarrowBand3D& band, int channel, Mesh& mesh,
+		const float& isoLevel) {
+	int3 dims = band.dimensions();
+	this->rows = dims.x;
+	this->cols = dims.y;
+	this->slices = dims.z;
+	this->isoLevel = isoLevel;
+	std::unordered_set<int3> activeVoxels;
+	std::unordered_map<int4, EdgeInfo> activeEdges;
+	std::unordered_map<int3, uint32_t> vertexIndices;
+	findActiveVoxels(band, channel, activeVoxels, activeEdges);
+	generateVertexData(band, channel, activeVoxels, activeEdges, vertexIndices,
+			mesh);
+	generateTriangles(activeEdges, vertexIndices, mesh);
+}
+void IsoSurface::findActiveVoxels(const NarrowBand3D& band, int channel,
+		std::unordered_set<int3>& activeVoxels,
+		std::unordered_map<int4, EdgeInfo>& activeEdges) {
+	const int P = NarrowBand3D::PADDED_SIZE;
+	const int axisStride[3] = { 1, P, P * P };
+	const int tileCount = (int) band.getTileCount();
+	//Edges are found one tile per task and merged afterwards.
+	std::vector<std::vector<std::pair<int4, EdgeInfo>>> tileEdges(tileCount);
+#pragma omp parallel for schedule(dynamic)
+	for (int s = 0; s < tileCount; s++) {
+		float data[NarrowBand3D::PADDED_VOXELS];
+		band.gather(s, channel, data);
+		int3 blockMin = band.getTileOrigin(s) - 1;
+		for (int3 pivot : band.getTileVoxels(s)) {
+			int3 local = pivot - blockMin;
+			int c = local.x + P * (local.y + P * local.z);
+			float fValue1 = data[c];
+			if (fValue1 == backgroundValue)
+				continue;
+			for (int a = 0; a < 3; a++) {
+				int3 axis = AXIS_OFFSET[a];
+				if (!band.inside(pivot + axis))
+					continue;
+				float fValue2 = data[c + axisStride[a]];
+				if (fValue2 != backgroundValue && fValue1 * fValue2 < 0) {
+					float3 crossing(pivot);
+					double fDelta = fValue2 - fValue1;
+					if (std::abs(fDelta) < 1E-3f) {
+						crossing += float3(axis) * 0.5f;
 					} else {
-						val = leaf->data[x + y * dim + z * dim * dim];
+						crossing += float3(axis)
+								* (float) ((isoLevel - fValue1) / fDelta);
 					}
-					data[x + y * bdim + z * bdim * bdim] = val;
+					EdgeInfo info;
+					info.point = crossing;
+					if (winding == Winding::Clockwise) {
+						info.winding = (fValue1 < 0.f);
+					} else {
+						info.winding = (fValue1 > 0.f);
+					}
+					tileEdges[s].push_back(
+							std::pair<int4, EdgeInfo>(int4(pivot, a), info));
 				}
 			}
 		}
-		for (int z = 0; z < dim; z++) {
-			for (int y = 0; y < dim; y++) {
-				for (int x = 0; x < dim; x++) {
-					triangulateUsingMarchingCubes(data.data(), splits,
-							triangles, x, y, z, loc.x, loc.y, loc.z,
-							vertexCount);
+	}
+	for (const std::vector<std::pair<int4, EdgeInfo>>& edges : tileEdges) {
+		for (const std::pair<int4, EdgeInfo>& edge : edges) {
+			activeEdges[edge.first] = edge.second;
+			int3 pivot = edge.first.xyz();
+			auto edgeNodes = EDGE_NODE_OFFSETS[edge.first.w];
+			for (int i = 0; i < 4; i++) {
+				activeVoxels.insert(pivot - edgeNodes[i]);
+			}
+		}
+	}
+}
+void IsoSurface::generateVertexData(const NarrowBand3D& band, int channel,
+		const std::unordered_set<int3>& voxels,
+		const std::unordered_map<int4, EdgeInfo>& edges,
+		std::unordered_map<int3, uint32_t>& vertexIndices, Mesh& buffer) {
+	Vector3f& vert = buffer.vertexLocations;
+	Vector3f& norm = buffer.vertexNormals;
+	float3 p[12];
+	uint32_t idxCounter = 0;
+	for (const auto& voxelID : voxels) {
+		int idx = 0;
+		for (int a = 0; a < 3; a++) {
+			for (int i = 0; i < 4; i++) {
+				int4 edgeID = int4(voxelID + EDGE_NODE_OFFSETS[a][i], a);
+				const auto iter = edges.find(edgeID);
+				if (iter != end(edges)) {
+					const auto& info = iter->second;
+					p[idx++] = info.point;
 				}
 			}
 		}
+		float3 nodePos(0.0f);
+		for (int i = 0; i < idx; i++) {
+			nodePos += p[i];
+		}
+		nodePos /= (float) idx;
+		vertexIndices[voxelID] = idxCounter++;
+		vert.push_back(nodePos);
+		norm.push_back(
+				interpolateNormal(band, channel, nodePos.x, nodePos.y,
+						nodePos.z));
 	}
-	indexes.resize(triangleCount);
-	if (winding == Winding::Clockwise) {
-		for (int k = 0; k < triangleCount; k++) {
-			IsoTriangle* triPtr = &triangles[k];
-			indexes[k] = uint3((uint32_t) triPtr->vertexIds[0],
-					(uint32_t) triPtr->vertexIds[1],
-					(uint32_t) triPtr->vertexIds[2]);
+}
+void IsoSurface::regularize(const NarrowBand3D& band, int channel,
+		Mesh& mesh) {
+	const int TRACE_ITERATIONS = 16;
+	const int REGULARIZE_ITERATIONS = 3;
+	const float TRACE_THRESHOLD = 1E-5f;
+	std::vector<float3> tmpPoints(mesh.vertexLocations.size());
+	std::vector<std::unordered_set<uint32_t>> vertNbrs;
+	CreateVertexNeighborTable(mesh, vertNbrs);
+	for (int c = 0; c < REGULARIZE_ITERATIONS; c++) {
+#pragma omp parallel for
+		for (int i = 0; i < (int) vertNbrs.size(); i++) {
+			float3 pt(0.0f);
+			int K = (int) vertNbrs[i].size();
+			if (K > 3) {
+				for (uint32_t nbr : vertNbrs[i]) {
+					pt += mesh.vertexLocations[nbr];
+				}
+				pt /= (float) K;
+			} else {
+				pt = mesh.vertexLocations[i];
+			}
+			tmpPoints[i] = pt;
+			mesh.vertexNormals[i] = normalize(
+					interpolateNormal(band, channel, pt.x, pt.y, pt.z));
 		}
-	} else if (winding == Winding::CounterClockwise) {
-		for (int k = 0; k < triangleCount; k++) {
-			IsoTriangle* triPtr = &triangles[k];
-			indexes[k] = uint3((uint32_t) triPtr->vertexIds[0],
-					(uint32_t) triPtr->vertexIds[1],
-					(uint32_t) triPtr->vertexIds[2]);
+#pragma omp parallel for
+		for (int i = 0; i < (int) mesh.vertexLocations.size(); i++) {
+			float3 norm = mesh.vertexNormals[i];
+			float3 pt = tmpPoints[i];
+			bool converged = false;
+			for (int n = 0; n < TRACE_ITERATIONS; n++) {
+				float val = interpolate(band, channel, pt.x, pt.y, pt.z);
+				pt -= 0.75f * aly::clamp(val, -1.0f, 1.0f) * norm;
+				if (std::abs(val) < TRACE_THRESHOLD) {
+					converged = true;
+					break;
+				}
+			}
+			if (converged) {
+				mesh.vertexLocations[i] = pt;
+			}
+			mesh.vertexNormals[i] = normalize(norm);
 		}
 	}
-	points.clear();
-	const size_t splitCount = splits.size();
-	points.resize(splitCount);
-	for (auto splitPtr = splits.begin(); splitPtr != splits.end(); ++splitPtr) {
-		size_t index = (splitPtr->second).vertexId;
-		aly::float3 pt = (splitPtr->second).point;
-		points[index] = pt;
+}
+void IsoSurface::triangulateBlock(const float* data, const int3& dims,
+		const int3& cellMin, const int3& cellMax, const int3& origin,
+		IsoMeshBlock& block) {
+	static const uint32_t NO_VERTEX = std::numeric_limits<uint32_t>::max();
+	block.points.clear();
+	block.triangles.clear();
+	block.seams.clear();
+	if (cellMax.x <= cellMin.x || cellMax.y <= cellMin.y
+			|| cellMax.z <= cellMin.z)
+		return;
+	//Each cube edge is keyed by its lower corner and axis, so neighboring cells share one cache slot.
+	int3 edgeCorner[12];
+	int edgeAxis[12];
+	for (int e = 0; e < 12; e++) {
+		const int* v1 = vertexOffset[edgeConnection[e][0]];
+		const int* v2 = vertexOffset[edgeConnection[e][1]];
+		edgeCorner[e] = int3(std::min(v1[0], v2[0]), std::min(v1[1], v2[1]),
+				std::min(v1[2], v2[2]));
+		edgeAxis[e] = (v1[0] != v2[0]) ? 0 : ((v1[1] != v2[1]) ? 1 : 2);
+	}
+	const size_t strideY = dims.x;
+	const size_t strideZ = (size_t) dims.x * dims.y;
+	const size_t axisStride[3] = { 1, strideY, strideZ };
+	size_t cornerOffset[8];
+	for (int v = 0; v < 8; v++) {
+		cornerOffset[v] = vertexOffset[v][0] + strideY * vertexOffset[v][1]
+				+ strideZ * vertexOffset[v][2];
+	}
+	//Edge vertices on the bottom and top plane of the current layer of cells.
+	const int sx = cellMax.x - cellMin.x + 1;
+	const int sy = cellMax.y - cellMin.y + 1;
+	const size_t planeSize = (size_t) sx * sy * 3;
+	std::vector<uint32_t> lower(planeSize, NO_VERTEX);
+	std::vector<uint32_t> upper(planeSize, NO_VERTEX);
+	uint32_t edgeVertex[12];
+	for (int z = cellMin.z; z < cellMax.z; z++) {
+		if (z > cellMin.z) {
+			lower.swap(upper);
+			std::fill(upper.begin(), upper.end(), NO_VERTEX);
+		}
+		for (int y = cellMin.y; y < cellMax.y; y++) {
+			float values[8];
+			for (int x = cellMin.x; x < cellMax.x; x++) {
+				size_t offset = x + strideY * y + strideZ * z;
+				//Corners 0,3,4,7 are corners 1,2,5,6 of the previous cell in the row.
+				if (x == cellMin.x) {
+					for (int v = 0; v < 8; v++) {
+						values[v] = data[offset + cornerOffset[v]];
+					}
+				} else {
+					values[0] = values[1];
+					values[3] = values[2];
+					values[4] = values[5];
+					values[7] = values[6];
+					values[1] = data[offset + cornerOffset[1]];
+					values[2] = data[offset + cornerOffset[2]];
+					values[5] = data[offset + cornerOffset[5]];
+					values[6] = data[offset + cornerOffset[6]];
+				}
+				int flags = 0;
+				bool background = false;
+				for (int v = 0; v < 8; v++) {
+					if (values[v] == backgroundValue)
+						background = true;
+					if (values[v] < isoLevel)
+						flags |= 1 << v;
+				}
+				if (background)
+					continue;
+				int edgeFlags = cubeEdgeFlagsCC626[flags];
+				if (edgeFlags == 0)
+					continue;
+				for (int e = 0; e < 12; e++) {
+					if ((edgeFlags & (1 << e)) == 0)
+						continue;
+					int3 c = edgeCorner[e];
+					int a = edgeAxis[e];
+					std::vector<uint32_t>& plane = (c.z == 0) ? lower : upper;
+					size_t slot = ((size_t) (y - cellMin.y + c.y) * sx
+							+ (x - cellMin.x + c.x)) * 3 + a;
+					uint32_t id = plane[slot];
+					if (id == NO_VERTEX) {
+						size_t o = offset + c.x + strideY * c.y + strideZ * c.z;
+						float val1 = data[o];
+						float val2 = data[o + axisStride[a]];
+						double delta = val2 - val1;
+						float t = (std::abs(delta) < 1E-3f) ?
+								0.5f : (float) ((isoLevel - val1) / delta);
+						int3 p = int3(x, y, z) + c;
+						float3 pt = float3(p + origin);
+						pt[a] += t;
+						id = (uint32_t) block.points.size();
+						block.points.push_back(pt);
+						plane[slot] = id;
+						//Cells on the other side of a block face share this vertex.
+						int b1 = (a + 1) % 3;
+						int b2 = (a + 2) % 3;
+						if (p[b1] == cellMin[b1] || p[b1] == cellMax[b1]
+								|| p[b2] == cellMin[b2] || p[b2] == cellMax[b2]) {
+							block.seams.push_back(
+									std::pair<int4, uint32_t>(int4(p + origin, a),
+											id));
+						}
+					}
+					edgeVertex[e] = id;
+				}
+				for (int t = 0; t < 5; t++) {
+					const int* tri = &triangleConnectionTable[16 * flags + 3 * t];
+					if (tri[0] < 0)
+						break;
+					block.triangles.push_back(
+							uint3(edgeVertex[tri[0]], edgeVertex[tri[1]],
+									edgeVertex[tri[2]]));
+				}
+			}
+		}
+	}
+}
+void IsoSurface::stitchBlocks(const std::vector<IsoMeshBlock>& blocks,
+		Mesh& mesh) {
+	static const uint32_t UNASSIGNED = std::numeric_limits<uint32_t>::max();
+	struct SeamVertex {
+		int4 key;
+		uint32_t block;
+		uint32_t id;
+	};
+	const int B = (int) blocks.size();
+	std::vector<SeamVertex> seams;
+	for (int b = 0; b < B; b++) {
+		for (const std::pair<int4, uint32_t>& seam : blocks[b].seams) {
+			seams.push_back( { seam.first, (uint32_t) b, seam.second });
+		}
+	}
+	std::sort(seams.begin(), seams.end(),
+			[](const SeamVertex& a, const SeamVertex& b) {
+				if (a.key.x != b.key.x) return a.key.x < b.key.x;
+				if (a.key.y != b.key.y) return a.key.y < b.key.y;
+				if (a.key.z != b.key.z) return a.key.z < b.key.z;
+				if (a.key.w != b.key.w) return a.key.w < b.key.w;
+				return a.block < b.block;
+			});
+	//The copy from the first block keeps its vertex, so the result does not depend on thread timing.
+	std::vector<std::vector<uint32_t>> ids(B);
+	std::vector<size_t> vertexOffsets(B + 1, 0);
+	std::vector<size_t> triangleOffsets(B + 1, 0);
+	for (int b = 0; b < B; b++) {
+		ids[b].assign(blocks[b].points.size(), UNASSIGNED);
+	}
+	std::vector<std::pair<size_t, size_t>> duplicates;
+	size_t groupStart = 0;
+	for (size_t n = 1; n < seams.size(); n++) {
+		if (seams[n].key == seams[groupStart].key) {
+			duplicates.push_back(std::pair<size_t, size_t>(n, groupStart));
+			ids[seams[n].block][seams[n].id] = UNASSIGNED - 1;
+		} else {
+			groupStart = n;
+		}
+	}
+	for (int b = 0; b < B; b++) {
+		size_t kept = 0;
+		for (uint32_t id : ids[b]) {
+			if (id == UNASSIGNED)
+				kept++;
+		}
+		vertexOffsets[b + 1] = vertexOffsets[b] + kept;
+		triangleOffsets[b + 1] = triangleOffsets[b]
+				+ blocks[b].triangles.size();
+	}
+	std::vector<float3>& points = mesh.vertexLocations.data;
+	std::vector<uint3>& indexes = mesh.triIndexes.data;
+	points.resize(vertexOffsets[B]);
+	indexes.resize(triangleOffsets[B]);
+#pragma omp parallel for schedule(dynamic)
+	for (int b = 0; b < B; b++) {
+		uint32_t next = (uint32_t) vertexOffsets[b];
+		for (size_t n = 0; n < ids[b].size(); n++) {
+			if (ids[b][n] == UNASSIGNED) {
+				points[next] = blocks[b].points[n];
+				ids[b][n] = next++;
+			}
+		}
+	}
+	for (const std::pair<size_t, size_t>& dup : duplicates) {
+		const SeamVertex& copy = seams[dup.first];
+		const SeamVertex& first = seams[dup.second];
+		ids[copy.block][copy.id] = ids[first.block][first.id];
+	}
+#pragma omp parallel for schedule(dynamic)
+	for (int b = 0; b < B; b++) {
+		size_t offset = triangleOffsets[b];
+		for (const uint3& tri : blocks[b].triangles) {
+			indexes[offset++] = uint3(ids[b][tri.x], ids[b][tri.y],
+					ids[b][tri.z]);
+		}
 	}
-	mesh.updateVertexNormals(true);
 }
 
 size_t IsoSurface::getIndex(int i, int j, int k) {
@@ -1013,7 +1523,7 @@ void IsoSurface::generateTriangles(
 	}
 }
 void IsoSurface::findActiveVoxels(const EndlessGridFloat& grid,
-		const std::list<EndlessNodeFloat*>& leafs,
+		const std::vector<EndlessNodeFloat*>& leafs,
 		std::unordered_set<int3>& activeVoxels,
 		std::unordered_map<int4, EdgeInfo>& activeEdges) {
 	int bdim = rows;
@@ -1418,6 +1928,77 @@ aly::float3 IsoSurface::interpolateNormal(const float *vol, float x, float y,
 									+ getNormal(vol, x1, y1, z1) * dx) * dy)
 							* dz));
 }
+aly::float3 IsoSurface::interpolateNormal(const NarrowBand3D& band,
+		int channel, float x, float y, float z) {
+	int x1 = (int) std::ceil(x);
+	int y1 = (int) std::ceil(y);
+	int z1 = (int) std::ceil(z);
+	int x0 = (int) std::floor(x);
+	int y0 = (int) std::floor(y);
+	int z0 = (int) std::floor(z);
+	float dx = x - x0;
+	float dy = y - y0;
+	float dz = z - z0;
+
+	float hx = 1.0f - dx;
+	float hy = 1.0f - dy;
+	float hz = 1.0f - dz;
+
+	//The eight corner gradients read 32 distinct voxels, fetch each once.
+	float block[4][4][4];
+	for (int k = 0; k < 4; k++) {
+		for (int j = 0; j < 4; j++) {
+			for (int i = 0; i < 4; i++) {
+				int outside = (i % 3 == 0) + (j % 3 == 0) + (k % 3 == 0);
+				if (outside <= 1) {
+					block[k][j][i] = band.getValue(
+							int3(x0 - 1 + i, y0 - 1 + j, z0 - 1 + k), channel);
+				}
+			}
+		}
+	}
+	auto normal = [&](int i, int j, int k) {
+		i += 1 - x0;
+		j += 1 - y0;
+		k += 1 - z0;
+		return float3(block[k][j][i + 1] - block[k][j][i - 1],
+				block[k][j + 1][i] - block[k][j - 1][i],
+				block[k + 1][j][i] - block[k - 1][j][i]);
+	};
+	return aly::float3(
+			(((normal(x0, y0, z0) * hx + normal(x1, y0, z0) * dx) * hy
+					+ (normal(x0, y1, z0) * hx + normal(x1, y1, z0) * dx) * dy)
+					* hz
+					+ ((normal(x0, y0, z1) * hx + normal(x1, y0, z1) * dx) * hy
+							+ (normal(x0, y1, z1) * hx
+									+ normal(x1, y1, z1) * dx) * dy) * dz));
+}
+float IsoSurface::interpolate(const NarrowBand3D& band, int channel, float x,
+		float y, float z) {
+	int x1 = (int) std::ceil(x);
+	int y1 = (int) std::ceil(y);
+	int z1 = (int) std::ceil(z);
+	int x0 = (int) std::floor(x);
+	int y0 = (int) std::floor(y);
+	int z0 = (int) std::floor(z);
+	float dx = x - x0;
+	float dy = y - y0;
+	float dz = z - z0;
+
+	float hx = 1.0f - dx;
+	float hy = 1.0f - dy;
+	float hz = 1.0f - dz;
+
+	return ((((band.getValue(int3(x0, y0, z0), channel) * hx
+			+ band.getValue(int3(x1, y0, z0), channel) * dx) * hy
+			+ (band.getValue(int3(x0, y1, z0), channel) * hx
+					+ band.getValue(int3(x1, y1, z0), channel) * dx) * dy) * hz
+			+ ((band.getValue(int3(x0, y0, z1), channel) * hx
+					+ band.getValue(int3(x1, y0, z1), channel) * dx) * hy
+					+ (band.getValue(int3(x0, y1, z1), channel) * hx
+							+ band.getValue(int3(x1, y1, z1), channel) * dx)
+							* dy) * dz));
+}
 size_t IsoSurface::getSafeIndex(int i, int j, int k) {
 	return clamp(k, 0, slices - 1) * (size_t) rows * (size_t) cols
 			+ clamp(j, 0, cols - 1) * (size_t) rows
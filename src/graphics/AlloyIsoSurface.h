@@ -15,6 +15,8 @@
 #include "graphics/EndlessGrid.h"
 #include "graphics/AlloyMesh.h"
 #include "image/AlloyVolume.h"
+#include "image/AlloyMappedVolume.h"
+#include "vision/NarrowBand.h"
 #include "ui/AlloyEnum.h"
 #include <unordered_map>
 #include <unordered_set>
@@ -26,6 +28,12 @@ struct EdgeInfo {
 	float3 point;
 	bool winding = false;
 };
+//Triangles and edge vertices of one block of cells, with the vertices that lie on faces shared with other blocks.
+struct IsoMeshBlock {
+	std::vector<float3> points;
+	std::vector<uint3> triangles;
+	std::vector<std::pair<int4, uint32_t>> seams;
+};
 struct EdgeSplit3D {
 private:
 	int row, col, slice;
@@ -233,12 +241,34 @@ private:
 			const float& isoLevel = 0);
 	void findActiveVoxels(
 			const EndlessGridFloat& grid,
-			const std::list<EndlessNodeFloat*>& leafs,
+			const std::vector<EndlessNodeFloat*>& leafs,
+			std::unordered_set<int3>& activeVoxels,
+			std::unordered_map<int4, EdgeInfo>& activeEdges);
+	void triangulateBlock(const float* data, const int3& dims,
+			const int3& cellMin, const int3& cellMax, const int3& origin,
+			IsoMeshBlock& block);
+	void stitchBlocks(const std::vector<IsoMeshBlock>& blocks, Mesh& mesh);
+	void solveTri(const Volume1f& data, Mesh& mesh, const float& isoLevel);
+	void solveTri(const NarrowBand3D& band, int channel, Mesh& mesh,
+			const float& isoLevel);
+	void solveQuad(const NarrowBand3D& band, int channel, Mesh& mesh,
+			const float& isoLevel);
+	void findActiveVoxels(const NarrowBand3D& band, int channel,
 			std::unordered_set<int3>& activeVoxels,
 			std::unordered_map<int4, EdgeInfo>& activeEdges);
+	void generateVertexData(const NarrowBand3D& band, int channel,
+			const std::unordered_set<int3>& voxels,
+			const std::unordered_map<int4, EdgeInfo>& edges,
+			std::unordered_map<int3, uint32_t>& vertexIndices, Mesh& buffer);
+	void regularize(const NarrowBand3D& band, int channel, Mesh& mesh);
+	aly::float3 interpolateNormal(const NarrowBand3D& band, int channel,
+			float x, float y, float z);
+	float interpolate(const NarrowBand3D& band, int channel, float x, float y,
+			float z);
 public:
 	IsoSurface();
 	~IsoSurface();
+	//Triangle meshes are extracted from the leaves of the grid in parallel.
 	void solve(
 			const EndlessGridFloat& grid,
 			Mesh& mesh,
@@ -257,9 +287,17 @@ public:
 	void solveTriangles(const Volume1f& data,const std::vector<int3>& indexList,
 			Vector3f& vertexLocations,
 			bool regularize = true, const float& isoLevel = 0);
+	//Triangle meshes are extracted from slabs of the volume in parallel.
 	void solve(const Volume1f& data,
 			Mesh& mesh, const MeshType& type = MeshType::Triangle,
 			bool regularize = true, const float& isoLevel = 0);
+	//Meshes an out-of-core volume brick by brick, welding vertices shared across brick faces. The result is not regularized.
+	void solve(const MappedVolume1f& data, Mesh& mesh,
+			const MeshType& type = MeshType::Triangle, const float& isoLevel = 0);
+	//Meshes one channel of a narrow band straight from its tiles, without a dense copy of the grid. Cells on the grid border are skipped.
+	void solve(const NarrowBand3D& band, int channel, Mesh& mesh,
+			const MeshType& type = MeshType::Triangle, bool regularize = true,
+			const float& isoLevel = 0);
 	void solve(const Volume1f& data, const std::vector<int3>& indexList,
 			aly::Vector3f vertexes,aly::Vector4ui quadIndexes,
 			bool regularize = true, const float& isoLevel = 0);
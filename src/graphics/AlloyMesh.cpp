@@ -21,6 +21,7 @@
 #include "math/AlloyVecMath.h"
 #include "graphics/AlloyMesh.h"
 #include "graphics/AlloyPLY.h"
+#include "graphics/AlloyOBJ.h"
 #include "graphics/tiny_obj_loader.h"
 #include "system/AlloyFileUtil.h"
 #include <vector>
@@ -836,8 +837,35 @@ void Mesh::clear() {
 	textureMap.clear();
 	textureImage.clear();
 	pointIndexes.clear();
+	invalidateTopology();
 	setDirty(true);
 }
+MeshTopologyPtr Mesh::getTopology(bool halfEdges) const {
+	auto isCurrent = [&](const std::shared_ptr<MeshTopology>& topo) {
+		return topo.get() != nullptr
+				&& topo->vertexCount == vertexLocations.size()
+				&& topo->triCount == triIndexes.size()
+				&& topo->quadCount == quadIndexes.size()
+				&& (!halfEdges || topo->hasHalfEdges())
+				&& topo->faceHash
+						== MeshTopology::hashFaces(triIndexes.data,
+								quadIndexes.data);
+	};
+	//Readers may race on a const mesh, so the pointer is only swapped atomically. Callers share ownership, so a swap never frees a topology in use.
+	std::shared_ptr<MeshTopology> current = std::atomic_load(&topology);
+	while (!isCurrent(current)) {
+		//Clones may share the old topology, so it is replaced rather than rebuilt in place.
+		std::shared_ptr<MeshTopology> topo(new MeshTopology());
+		topo->build(vertexLocations.size(), triIndexes.data, quadIndexes.data,
+				halfEdges);
+		//If another thread installed a topology first, current now holds it and is checked again.
+		if (std::atomic_compare_exchange_strong(&topology, &current, topo)) {
+			current = topo;
+			break;
+		}
+	}
+	return current;
+}
 bool Mesh::save(const std::string& file) {
 	try {
 		WriteMeshToFile(file, *this);
@@ -856,10 +884,74 @@ void WriteMeshToFile(const std::string& file, const Mesh& mesh) {
 		throw std::runtime_error(
 				MakeString() << "Could not write mesh file " << file);
 }
+static void AppendObjFloat(std::string& str, float value) {
+	//Same text as an ostream with precision 8.
+	char buffer[32];
+	int len = snprintf(buffer, sizeof(buffer), "%.8g", value);
+	str.append(buffer, len);
+}
+static void AppendObjIndex(std::string& str, size_t value) {
+	char buffer[24];
+	char* end = buffer + sizeof(buffer);
+	char* p = end;
+	do {
+		*(--p) = (char) ('0' + value % 10);
+		value /= 10;
+	} while (value > 0);
+	str.append(p, end - p);
+}
+/*
+ Formats blocks of records in parallel into separate buffers and writes them
+ out in order, so the file matches a sequential write.
+ */
+template<class F> static void WriteObjRecords(FILE* f, size_t count,
+		std::vector<std::string>& buffers, const F& format) {
+	const size_t BLOCK_SIZE = 1 << 14;
+	const size_t batchSize = BLOCK_SIZE * buffers.size();
+	for (size_t start = 0; start < count; start += batchSize) {
+		int blocks = (int) ((std::min(start + batchSize, count) - start
+				+ BLOCK_SIZE - 1) / BLOCK_SIZE);
+#pragma omp parallel for schedule(dynamic)
+		for (int b = 0; b < blocks; b++) {
+			std::string& str = buffers[b];
+			str.clear();
+			size_t end = std::min(start + (b + 1) * BLOCK_SIZE, count);
+			for (size_t n = start + b * BLOCK_SIZE; n < end; n++) {
+				format(n, str);
+			}
+		}
+		for (int b = 0; b < blocks; b++) {
+			if (fwrite(buffers[b].data(), 1, buffers[b].size(), f)
+					!= buffers[b].size()) {
+				throw std::runtime_error("Could not write OBJ records.");
+			}
+		}
+	}
+}
+template<int C> static void WriteObjFaces(FILE* f,
+		const std::vector<vec<uint32_t, C>>& faces, bool hasNormals,
+		bool hasTexture, size_t texOffset, std::vector<std::string>& buffers) {
+	WriteObjRecords(f, faces.size(), buffers,
+			[&](size_t n, std::string& str) {
+				str.append("f ");
+				for (int k = 0; k < C; k++) {
+					uint32_t v = faces[n][k] + 1;
+					AppendObjIndex(str, v);
+					if (hasTexture) {
+						//Texture coordinates are stored per face corner, in face order.
+						str.push_back('/');
+						AppendObjIndex(str, texOffset + C * n + k + 1);
+					}
+					if (hasNormals) {
+						str.append(hasTexture ? "/" : "//");
+						AppendObjIndex(str, v);
+					}
+					str.push_back((k < C - 1) ? ' ' : '\n');
+				}
+			});
+}
 void WriteObjMeshToFile(const std::string& file, const Mesh& mesh) {
-	uint32_t i;
-	std::ofstream out(file.c_str());
-	out << setprecision(8);
+	std::stringstream out;
 	out << "####							 \n";
 	out << "#								 \n";
 	out << "# OBJ File Created by Alloy\n";
@@ -893,106 +985,192 @@ void WriteObjMeshToFile(const std::string& file, const Mesh& mesh) {
 		mtl << "map_Kd " << fileName << "\n";
 		mtl.close();
 	}
-	if (mesh.vertexNormals.size() > 0) {
-		for (i = 0; i < mesh.vertexNormals.size(); i++) {
-			float3 n = mesh.vertexNormals[i];
-			out << "vn " << n.x << " " << n.y << " " << n.z << "\n";
-			float3 p = mesh.vertexLocations[i];
-			if (mesh.vertexColors.size() > 0) {
-				RGBAf c = mesh.vertexColors[i];
-				out << "v " << p.x << " " << p.y << " " << p.z << " " << c.x
-						<< " " << c.y << " " << c.z << "\n";
-			} else {
-				out << "v " << p.x << " " << p.y << " " << p.z << "\n";
-			}
+	FILE* f = fopen(file.c_str(), "wb");
+	if (f == NULL) {
+		throw std::runtime_error(
+				MakeString() << "Could not open " << file << " for writing.");
+	}
+	const bool hasNormals = (mesh.vertexNormals.size() > 0);
+	const bool hasColors = (mesh.vertexColors.size() > 0);
+	const bool hasTexture = (mesh.textureMap.size() > 0);
+	try {
+		std::string header = out.str();
+		if (fwrite(header.data(), 1, header.size(), f) != header.size()) {
+			throw std::runtime_error("Could not write OBJ header.");
+		}
+		std::vector<std::string> buffers(64);
+		WriteObjRecords(f, mesh.vertexLocations.size(), buffers,
+				[&](size_t i, std::string& str) {
+					if (i < mesh.vertexNormals.size()) {
+						float3 n = mesh.vertexNormals[i];
+						str.append("vn ");
+						AppendObjFloat(str, n.x);
+						str.push_back(' ');
+						AppendObjFloat(str, n.y);
+						str.push_back(' ');
+						AppendObjFloat(str, n.z);
+						str.push_back('\n');
+					}
+					float3 p = mesh.vertexLocations[i];
+					str.append("v ");
+					AppendObjFloat(str, p.x);
+					str.push_back(' ');
+					AppendObjFloat(str, p.y);
+					str.push_back(' ');
+					AppendObjFloat(str, p.z);
+					if (hasColors) {
+						RGBAf c = mesh.vertexColors[i];
+						str.push_back(' ');
+						AppendObjFloat(str, c.x);
+						str.push_back(' ');
+						AppendObjFloat(str, c.y);
+						str.push_back(' ');
+						AppendObjFloat(str, c.z);
+					}
+					str.push_back('\n');
+				});
+		WriteObjRecords(f, mesh.textureMap.size(), buffers,
+				[&](size_t i, std::string& str) {
+					float2 vt = mesh.textureMap[i];
+					str.append("vt ");
+					AppendObjFloat(str, vt.x);
+					str.push_back(' ');
+					AppendObjFloat(str, vt.y);
+					str.push_back('\n');
+				});
+		if (hasTexture && mesh.textureImage.size() > 0) {
+			const std::string material = "usemtl material_0\n";
+			if (fwrite(material.data(), 1, material.size(), f)
+					!= material.size()) {
+				throw std::runtime_error("Could not write OBJ material.");
+			}
+		}
+		WriteObjRecords(f, mesh.pointIndexes.size(), buffers,
+				[&](size_t i, std::string& str) {
+					str.append("f ");
+					AppendObjIndex(str, mesh.pointIndexes[i] + 1);
+					str.push_back('\n');
+				});
+		WriteObjFaces(f, mesh.lineIndexes.data, false, false, 0, buffers);
+		WriteObjFaces(f, mesh.triIndexes.data, hasNormals, hasTexture, 0,
+				buffers);
+		WriteObjFaces(f, mesh.quadIndexes.data, hasNormals, hasTexture,
+				3 * mesh.triIndexes.size(), buffers);
+	} catch (...) {
+		fclose(f);
+		throw;
+	}
+	if (fclose(f) != 0) {
+		throw std::runtime_error(
+				MakeString() << "Could not write " << file << ".");
+	}
+}
+template<class F> static void WritePlyRecords(FILE* f, size_t count,
+		size_t stride, std::vector<char>& buffer, const F& encode) {
+	const size_t CHUNK = 1 << 18;
+	for (size_t start = 0; start < count; start += CHUNK) {
+		size_t end = std::min(start + CHUNK, count);
+		buffer.resize((end - start) * stride);
+#pragma omp parallel for
+		for (int64_t n = start; n < (int64_t) end; n++) {
+			encode(n, &buffer[(n - start) * stride]);
 		}
-	} else {
-		for (i = 0; i < mesh.vertexLocations.size(); i++) {
-			float3 p = mesh.vertexLocations[i];
-			if (mesh.vertexColors.size() > 0) {
-				RGBAf c = mesh.vertexColors[i];
-				out << "v " << p.x << " " << p.y << " " << p.z << " " << c.x
-						<< " " << c.y << " " << c.z << "\n";
-			} else {
-				out << "v " << p.x << " " << p.y << " " << p.z << "\n";
-			}
+		if (fwrite(buffer.data(), 1, buffer.size(), f) != buffer.size()) {
+			throw std::runtime_error("Could not write PLY records.");
 		}
 	}
-
-	for (i = 0; i < mesh.textureMap.size(); i++) {
-		float2 vt = mesh.textureMap[i];
-		out << "vt " << vt.x << " " << vt.y << "\n";
-	}
-	if (mesh.textureMap.size() > 0 && mesh.textureImage.size() > 0)
-		out << "usemtl material_0\n";
-	i = 0;
-	for (uint32_t pt : mesh.pointIndexes) {
-		out << "f ";
-		out << (pt + 1) << "\n";
-		i++;
-	}
-	for (uint2 line : mesh.lineIndexes.data) {
-		out << "f ";
-		out << (line.x + 1) << " ";
-		out << (line.y + 1) << "\n";
-		i += 2;
-	}
-	for (uint3 tri : mesh.triIndexes.data) {
-		out << "f ";
-		if (mesh.vertexNormals.size() > 0 && mesh.textureMap.size() == 0) {
-			out << (tri.x + 1) << "/" << (tri.x + 1) << " ";
-			out << (tri.y + 1) << "/" << (tri.y + 1) << " ";
-			out << (tri.z + 1) << "/" << (tri.z + 1) << "\n";
-		} else if (mesh.vertexNormals.size() == 0
-				&& mesh.textureMap.size() > 0) {
-			out << (tri.x + 1) << "/" << (i + 1) << " ";
-			out << (tri.y + 1) << "/" << (i + 2) << " ";
-			out << (tri.z + 1) << "/" << (i + 3) << "\n";
-		} else if (mesh.vertexNormals.size() > 0
-				&& mesh.textureMap.size() > 0) {
-			out << (tri.x + 1) << "/" << (i + 1) << "/" << (tri.x + 1) << " ";
-			out << (tri.y + 1) << "/" << (i + 2) << "/" << (tri.y + 1) << " ";
-			out << (tri.z + 1) << "/" << (i + 3) << "/" << (tri.z + 1) << "\n";
-		} else {
-			out << (tri.x + 1) << " ";
-			out << (tri.y + 1) << " ";
-			out << (tri.z + 1) << "\n";
-		}
-		i += 3;
-	}
-	i = 0;
-	for (uint4 quad : mesh.quadIndexes.data) {
-		out << "f ";
-		if (mesh.vertexNormals.size() > 0 && mesh.textureMap.size() == 0) {
-			out << (quad.x + 1) << "/" << (quad.x + 1) << " ";
-			out << (quad.y + 1) << "/" << (quad.y + 1) << " ";
-			out << (quad.z + 1) << "/" << (quad.z + 1) << " ";
-			out << (quad.w + 1) << "/" << (quad.w + 1) << "\n";
-		} else if (mesh.vertexNormals.size() == 0
-				&& mesh.textureMap.size() > 0) {
-			out << (quad.x + 1) << "/" << (i + 1) << " ";
-			out << (quad.y + 1) << "/" << (i + 2) << " ";
-			out << (quad.z + 1) << "/" << (i + 3) << " ";
-			out << (quad.w + 1) << "/" << (i + 4) << "\n";
-		} else if (mesh.vertexNormals.size() > 0
-				&& mesh.textureMap.size() > 0) {
-			out << (quad.x + 1) << "/" << (i + 1) << "/" << (quad.x + 1) << " ";
-			out << (quad.y + 1) << "/" << (i + 2) << "/" << (quad.y + 1) << " ";
-			out << (quad.z + 1) << "/" << (i + 3) << "/" << (quad.z + 1) << " ";
-			out << (quad.w + 1) << "/" << (i + 4) << "/" << (quad.w + 1)
-					<< "\n";
-		} else {
-			out << (quad.x + 1) << " ";
-			out << (quad.y + 1) << " ";
-			out << (quad.z + 1) << " ";
-			out << (quad.w + 1) << "\n";
-		}
-		i += 4;
+}
+template<int C> static void WritePlyFaces(FILE* f,
+		const std::vector<vec<uint32_t, C>>& faces, std::vector<char>& buffer) {
+	WritePlyRecords(f, faces.size(), 1 + C * sizeof(int32_t), buffer,
+			[&](size_t n, char* record) {
+				record[0] = (char) C;
+				for (int k = 0; k < C; k++) {
+					int32_t v = (int32_t) faces[n][k];
+					std::memcpy(record + 1 + k * sizeof(int32_t), &v, sizeof(int32_t));
+				}
+			});
+}
+/*
+ Binary meshes without texture coordinates are written by encoding chunks of
+ records in parallel, with the same header as PLYReaderWriter produces.
+ */
+static void WritePlyMeshBinary(const std::string& file, const Mesh& mesh) {
+	const bool hasNormals = (mesh.vertexNormals.size() > 0);
+	const bool hasColors = (mesh.vertexColors.size() > 0);
+	const uint16_t one = 1;
+	const bool littleEndian = (*reinterpret_cast<const uint8_t*>(&one) == 1);
+	std::stringstream header;
+	header << "ply\n" << "format "
+			<< (littleEndian ? "binary_little_endian" : "binary_big_endian")
+			<< " 1.0\n" << "comment PLY File\n" << "obj_info ImageSci\n";
+	header << "element vertex " << mesh.vertexLocations.size() << "\n";
+	header << "property float32 x\nproperty float32 y\nproperty float32 z\n";
+	if (hasNormals) {
+		header
+				<< "property float32 nx\nproperty float32 ny\nproperty float32 nz\n";
+	}
+	if (hasColors) {
+		header << "property uint8 red\nproperty uint8 green\nproperty uint8 blue\n";
+	}
+	header << "element face "
+			<< (mesh.quadIndexes.size() + mesh.triIndexes.size()
+					+ mesh.lineIndexes.size() + mesh.pointIndexes.size()) << "\n";
+	header << "property list uint8 int32 vertex_indices\n" << "end_header\n";
+	FILE* f = fopen(file.c_str(), "wb");
+	if (f == NULL) {
+		throw std::runtime_error(
+				MakeString() << "Could not open " << file << " for writing.");
+	}
+	try {
+		std::string text = header.str();
+		if (fwrite(text.data(), 1, text.size(), f) != text.size()) {
+			throw std::runtime_error("Could not write PLY header.");
+		}
+		std::vector<char> buffer;
+		size_t stride = 3 * sizeof(float) + (hasNormals ? 3 * sizeof(float) : 0)
+				+ (hasColors ? 3 : 0);
+		WritePlyRecords(f, mesh.vertexLocations.size(), stride, buffer,
+				[&](size_t n, char* record) {
+					std::memcpy(record, &mesh.vertexLocations[n], 3 * sizeof(float));
+					record += 3 * sizeof(float);
+					if (hasNormals) {
+						std::memcpy(record, &mesh.vertexNormals[n], 3 * sizeof(float));
+						record += 3 * sizeof(float);
+					}
+					if (hasColors) {
+						float4 c = mesh.vertexColors[n];
+						for (int k = 0; k < 3; k++) {
+							record[k] = (char) (unsigned char) clamp(c[k] * 255.0f,
+									0.0f, 255.0f);
+						}
+					}
+				});
+		WritePlyFaces(f, mesh.quadIndexes.data, buffer);
+		WritePlyFaces(f, mesh.triIndexes.data, buffer);
+		WritePlyFaces(f, mesh.lineIndexes.data, buffer);
+		WritePlyRecords(f, mesh.pointIndexes.size(), 1 + sizeof(int32_t), buffer,
+				[&](size_t n, char* record) {
+					int32_t v = (int32_t) mesh.pointIndexes[n];
+					record[0] = 1;
+					std::memcpy(record + 1, &v, sizeof(int32_t));
+				});
+	} catch (...) {
+		fclose(f);
+		throw;
+	}
+	if (fclose(f) != 0) {
+		throw std::runtime_error(
+				MakeString() << "Could not write " << file << ".");
 	}
-	out.close();
 }
 void WritePlyMeshToFile(const std::string& file, const Mesh& mesh,
 		bool binary) {
+	if (binary && mesh.textureMap.size() == 0
+			&& mesh.textureImage.size() == 0) {
+		WritePlyMeshBinary(file, mesh);
+		return;
+	}
 	std::vector<std::string> elemNames = { "vertex", "face" };
 	int i, j, idx;
 	bool hasTexture = (mesh.textureMap.size() > 0);
@@ -1170,78 +1348,55 @@ void WritePlyMeshToFile(const std::string& file, const Mesh& mesh,
 }
 void Mesh::updateVertexNormals(bool flipSign, int SMOOTH_ITERATIONS,
 		float DOT_TOLERANCE) {
-	uint32_t sz = (uint32_t) triIndexes.size();
 	if (triIndexes.size() == 0 && quadIndexes.size() == 0)
 		return;
-	float3 pt;
-	vertexNormals.clear();
-	vertexNormals.resize(vertexLocations.size(), float3(0.0f));
-	for (uint32_t i = 0; i < sz; i++) {
+	MeshTopologyPtr topoPtr = getTopology();
+	const MeshTopology& topo = *topoPtr;
+	const uint32_t triCount = topo.triCount;
+	std::vector<float3> triNormals(triCount);
+#pragma omp parallel for
+	for (int i = 0; i < (int) triCount; i++) {
 		uint3 verts = triIndexes[i];
 		float3 v1 = vertexLocations[verts.x];
 		float3 v2 = vertexLocations[verts.y];
 		float3 v3 = vertexLocations[verts.z];
-		float3 norm = cross((v3 - v1), (v2 - v1));
-		vertexNormals[verts.x] += norm;
-		vertexNormals[verts.y] += norm;
-		vertexNormals[verts.z] += norm;
-	}
-	sz = (uint32_t) quadIndexes.size();
-	for (uint32_t i = 0; i < sz; i++) {
-		uint4 verts = quadIndexes[i];
-		float3 v1 = vertexLocations[verts.x];
-		float3 v2 = vertexLocations[verts.y];
-		float3 v3 = vertexLocations[verts.z];
-		float3 v4 = vertexLocations[verts.w];
-
-		vertexNormals[verts.x] += cross((v4 - v1), (v2 - v1));
-		vertexNormals[verts.y] += cross((v1 - v2), (v3 - v2));
-		vertexNormals[verts.z] += cross((v2 - v3), (v4 - v3));
-		vertexNormals[verts.w] += cross((v3 - v4), (v1 - v4));
+		triNormals[i] = cross((v3 - v1), (v2 - v1));
 	}
+	//Each vertex gathers from its corners in face order, so the sums match a serial scatter over the faces.
+	int vertCount = (int) vertexLocations.size();
+	vertexNormals.clear();
+	vertexNormals.resize(vertCount);
 	float sgn = (flipSign) ? -1.0f : 1.0f;
 #pragma omp parallel for
-	for (int n = 0; n < (int) vertexNormals.size(); n++) {
-		vertexNormals[n] = sgn * normalize(vertexNormals[n]);
+	for (int n = 0; n < vertCount; n++) {
+		float3 norm(0.0f);
+		for (uint32_t i = topo.cornerOffsets[n]; i < topo.cornerOffsets[n + 1];
+				i++) {
+			uint32_t h = topo.vertexCorners[i];
+			uint32_t f = topo.halfEdgeFace(h);
+			if (f < triCount) {
+				norm += triNormals[f];
+			} else {
+				uint4 verts = quadIndexes[f - triCount];
+				int k = topo.halfEdgeCorner(h);
+				float3 prev = vertexLocations[verts[(k + 3) % 4]];
+				float3 cur = vertexLocations[verts[k]];
+				float3 next = vertexLocations[verts[(k + 1) % 4]];
+				norm += cross((prev - cur), (next - cur));
+			}
+		}
+		vertexNormals[n] = sgn * normalize(norm);
 	}
 	if (SMOOTH_ITERATIONS > 0) {
-		int vertCount = (int) vertexLocations.size();
 		std::vector<float3> tmp(vertCount);
-		std::vector<std::list<int>> vertNbrs(vertCount);
-		int indexCount = (int) quadIndexes.size();
-		for (int i = 0; i < indexCount; i++) {
-			uint4 verts = quadIndexes[i];
-			int v1 = verts.x;
-			int v2 = verts.y;
-			int v3 = verts.z;
-			int v4 = verts.w;
-
-			vertNbrs[v1].push_back(v2);
-			vertNbrs[v2].push_back(v3);
-			vertNbrs[v3].push_back(v1);
-
-			vertNbrs[v3].push_back(v4);
-			vertNbrs[v4].push_back(v1);
-			vertNbrs[v1].push_back(v3);
-		}
-		indexCount = (int) triIndexes.size();
-		for (int i = 0; i < indexCount; i++) {
-			uint3 verts = triIndexes[i];
-			int v1 = verts.x;
-			int v2 = verts.y;
-			int v3 = verts.z;
-			vertNbrs[v1].push_back(v2);
-			vertNbrs[v2].push_back(v3);
-			vertNbrs[v3].push_back(v1);
-		}
 		for (int iter = 0; iter < SMOOTH_ITERATIONS; iter++) {
 #pragma omp parallel for
 			for (int i = 0; i < vertCount; i++) {
 				float3 norm = vertexNormals[i];
 				float3 avg = float3(0.0f);
-				for (int nbr : vertNbrs[i]) {
-					float3 nnorm = vertexNormals[nbr];
-					;
+				for (uint32_t r = topo.ringOffsets[i];
+						r < topo.ringOffsets[i + 1]; r++) {
+					float3 nnorm = vertexNormals[topo.ringVertices[r]];
 					if (dot(norm, nnorm) > DOT_TOLERANCE) {
 						avg += nnorm;
 					} else {
@@ -1250,7 +1405,7 @@ void Mesh::updateVertexNormals(bool flipSign, int SMOOTH_ITERATIONS,
 				}
 				tmp[i] = sgn * normalize(avg);
 			}
-			vertexNormals = tmp;
+			vertexNormals.data.swap(tmp);
 		}
 	}
 	setDirty(true);
@@ -1402,205 +1557,279 @@ void Mesh::updateVertexPositions() {
 Mesh::~Mesh() {
 	// TODO Auto-generated destructor stub
 }
+/*
+ Open addressing table from (position, normal) index pairs to mesh vertices,
+ used when OBJ faces pair a position with different normals.
+ */
+static const uint64_t OBJ_EMPTY_KEY = ~(uint64_t) 0;
+struct ObjVertexTable {
+	std::vector<uint64_t> keys;
+	std::vector<uint32_t> values;
+	int shift;
+	ObjVertexTable(size_t count) {
+		int bits = 4;
+		while (((size_t) 1 << bits) < 2 * count) {
+			bits++;
+		}
+		shift = 64 - bits;
+		keys.assign((size_t) 1 << bits, OBJ_EMPTY_KEY);
+		values.resize(keys.size());
+	}
+	//Returns the vertex for key, or assigns it next if key is new.
+	uint32_t insert(uint64_t key, uint32_t next) {
+		const size_t mask = keys.size() - 1;
+		size_t h = (size_t) ((key * 0x9E3779B97F4A7C15ULL) >> shift);
+		while (keys[h] != OBJ_EMPTY_KEY) {
+			if (keys[h] == key) {
+				return values[h];
+			}
+			h = (h + 1) & mask;
+		}
+		keys[h] = key;
+		values[h] = next;
+		return next;
+	}
+};
+/*
+ Copies faces [faceBegin,faceEnd) of an OBJ file into mesh. Points, lines,
+ triangles and quads keep their type and larger polygons are split into
+ triangle fans. If keepAllVertices is set and every corner either has no
+ normal or uses the normal with its own position index (which is how
+ WriteObjMeshToFile stores meshes), the mesh keeps the file's vertices as they
+ are. Otherwise each distinct (position, normal) pair referenced by the faces
+ becomes one vertex, in order of first use.
+ */
+static void BuildObjMesh(const obj::ObjFile& objFile, size_t faceBegin,
+		size_t faceEnd, bool keepAllVertices, Mesh& mesh) {
+	using namespace obj;
+	const size_t cornerBegin =
+			(faceBegin < faceEnd) ? objFile.faceOffsets[faceBegin] : 0;
+	const size_t cornerEnd =
+			(faceBegin < faceEnd) ? objFile.faceOffsets[faceEnd] : 0;
+	const int64_t cornerCount = cornerEnd - cornerBegin;
+	int usesNormals = 0;
+	int splitNormals = 0;
+	int usesTexture = 0;
+#pragma omp parallel for reduction(+:usesNormals,splitNormals,usesTexture)
+	for (int64_t n = 0; n < cornerCount; n++) {
+		const Corner& c = objFile.corners[cornerBegin + n];
+		if (c.vn >= 0) {
+			usesNormals = 1;
+			splitNormals += (c.vn != c.v) ? 1 : 0;
+		}
+		usesTexture += (c.vt >= 0) ? 1 : 0;
+	}
+	const bool hasColors = (objFile.colors.size() > 0);
+	std::vector<uint32_t> cornerVertex;
+	if (keepAllVertices && splitNormals == 0) {
+		const int64_t N = objFile.positions.size();
+		//Point clouds are written without normal indexes, so a full set of normals is kept too.
+		const bool hasNormals = (usesNormals > 0
+				|| objFile.normals.size() == objFile.positions.size());
+		mesh.vertexLocations.data = objFile.positions;
+		mesh.vertexColors.resize(hasColors ? N : 0);
+		mesh.vertexNormals.resize(hasNormals ? N : 0);
+#pragma omp parallel for
+		for (int64_t i = 0; i < N; i++) {
+			if (hasColors) {
+				mesh.vertexColors[i] = float4(objFile.colors[i], 1.0f);
+			}
+			if (hasNormals) {
+				mesh.vertexNormals[i] =
+						(i < (int64_t) objFile.normals.size()) ?
+								objFile.normals[i] : float3(0.0f);
+			}
+		}
+	} else {
+		std::vector<Corner> sources;
+		ObjVertexTable table(cornerCount);
+		cornerVertex.resize(cornerCount);
+		for (int64_t n = 0; n < cornerCount; n++) {
+			const Corner& c = objFile.corners[cornerBegin + n];
+			uint64_t key = ((uint64_t) (uint32_t) c.v << 32)
+					| (uint32_t) (c.vn + 1);
+			uint32_t v = table.insert(key, (uint32_t) sources.size());
+			if (v == sources.size()) {
+				sources.push_back(c);
+			}
+			cornerVertex[n] = v;
+		}
+		const int64_t N = sources.size();
+		mesh.vertexLocations.resize(N);
+		mesh.vertexColors.resize(hasColors ? N : 0);
+		mesh.vertexNormals.resize((usesNormals > 0) ? N : 0);
+#pragma omp parallel for
+		for (int64_t i = 0; i < N; i++) {
+			const Corner& c = sources[i];
+			mesh.vertexLocations[i] = objFile.positions[c.v];
+			if (hasColors) {
+				mesh.vertexColors[i] = float4(objFile.colors[c.v], 1.0f);
+			}
+			if (usesNormals > 0) {
+				mesh.vertexNormals[i] =
+						(c.vn >= 0) ? objFile.normals[c.vn] : float3(0.0f);
+			}
+		}
+	}
+	//Count the primitives in blocks of faces so each block knows where its output starts.
+	const int64_t BLOCK_SIZE = 4096;
+	const int64_t blockCount = (faceEnd - faceBegin + BLOCK_SIZE - 1)
+			/ BLOCK_SIZE;
+	std::vector<size_t> offsets(4 * (blockCount + 1), 0);
+#pragma omp parallel for
+	for (int64_t b = 0; b < blockCount; b++) {
+		size_t f0 = faceBegin + b * BLOCK_SIZE;
+		size_t f1 = std::min(f0 + BLOCK_SIZE, faceEnd);
+		size_t* count = &offsets[4 * (b + 1)];
+		for (size_t f = f0; f < f1; f++) {
+			uint32_t sz = objFile.faceOffsets[f + 1] - objFile.faceOffsets[f];
+			if (sz <= 2) {
+				count[sz - 1]++;
+			} else if (sz == 4) {
+				count[3]++;
+			} else {
+				count[2] += sz - 2;
+			}
+		}
+	}
+	for (int64_t b = 1; b <= blockCount; b++) {
+		for (int k = 0; k < 4; k++) {
+			offsets[4 * b + k] += offsets[4 * (b - 1) + k];
+		}
+	}
+	const size_t* total = &offsets[4 * blockCount];
+	mesh.pointIndexes.resize(total[0]);
+	mesh.lineIndexes.resize(total[1]);
+	mesh.triIndexes.resize(total[2]);
+	mesh.quadIndexes.resize(total[3]);
+	mesh.textureMap.resize((usesTexture > 0) ? 3 * total[2] + 4 * total[3] : 0);
+	const size_t quadTexOffset = 3 * total[2];
+	auto vertexOf = [&](uint32_t c) {
+		return (cornerVertex.size() > 0) ?
+				cornerVertex[c - cornerBegin] : (uint32_t) objFile.corners[c].v;
+	};
+	auto texOf = [&](uint32_t c) {
+		int32_t vt = objFile.corners[c].vt;
+		return (vt >= 0) ? objFile.texcoords[vt] : float2(0.0f);
+	};
+#pragma omp parallel for
+	for (int64_t b = 0; b < blockCount; b++) {
+		size_t f0 = faceBegin + b * BLOCK_SIZE;
+		size_t f1 = std::min(f0 + BLOCK_SIZE, faceEnd);
+		size_t pointIndex = offsets[4 * b];
+		size_t lineIndex = offsets[4 * b + 1];
+		size_t triIndex = offsets[4 * b + 2];
+		size_t quadIndex = offsets[4 * b + 3];
+		for (size_t f = f0; f < f1; f++) {
+			uint32_t c = objFile.faceOffsets[f];
+			uint32_t sz = objFile.faceOffsets[f + 1] - c;
+			if (sz == 1) {
+				mesh.pointIndexes[pointIndex++] = vertexOf(c);
+			} else if (sz == 2) {
+				mesh.lineIndexes[lineIndex++] = uint2(vertexOf(c),
+						vertexOf(c + 1));
+			} else if (sz == 4) {
+				if (usesTexture > 0) {
+					for (int k = 0; k < 4; k++) {
+						mesh.textureMap[quadTexOffset + 4 * quadIndex + k] =
+								texOf(c + k);
+					}
+				}
+				mesh.quadIndexes[quadIndex++] = uint4(vertexOf(c),
+						vertexOf(c + 1), vertexOf(c + 2), vertexOf(c + 3));
+			} else {
+				for (uint32_t k = 2; k < sz; k++) {
+					if (usesTexture > 0) {
+						mesh.textureMap[3 * triIndex] = texOf(c);
+						mesh.textureMap[3 * triIndex + 1] = texOf(c + k - 1);
+						mesh.textureMap[3 * triIndex + 2] = texOf(c + k);
+					}
+					mesh.triIndexes[triIndex++] = uint3(vertexOf(c),
+							vertexOf(c + k - 1), vertexOf(c + k));
+				}
+			}
+		}
+	}
+}
+static void ReadObjMaterials(const std::string& file,
+		const obj::ObjFile& objFile,
+		std::vector<tinyobj::material_t>& materials,
+		std::map<std::string, int>& materialMap) {
+	//A missing material file only costs the texture, so its warning is dropped.
+	tinyobj::MaterialFileReader reader(GetParentDirectory(file));
+	for (const std::string& name : objFile.materialLibraries) {
+		reader(name, materials, materialMap);
+	}
+}
 void ReadObjMeshFromFile(const std::string& file, std::vector<Mesh>& meshList) {
-	using namespace tinyobj;
-	std::vector<tinyobj::shape_t> shapes;
+	obj::ObjFile objFile;
+	obj::ReadObjFile(file, objFile);
 	std::vector<tinyobj::material_t> materials;
-	std::string err = tinyobj::LoadObj(shapes, materials, file.c_str(),
-			GetParentDirectory(file).c_str());
-	if (err.size() > 0)
-		throw std::runtime_error(err);
-	meshList.resize(shapes.size());
-	for (int n = 0; n < (int) shapes.size(); n++) {
+	std::map<std::string, int> materialMap;
+	ReadObjMaterials(file, objFile, materials, materialMap);
+	//Every group, object or usemtl statement starts a new mesh.
+	struct FaceRange {
+		size_t begin;
+		size_t end;
+		std::string material;
+	};
+	std::vector<FaceRange> ranges;
+	FaceRange range = { 0, 0, "" };
+	for (const obj::GroupEvent& event : objFile.groups) {
+		range.end = event.face;
+		if (range.end > range.begin) {
+			ranges.push_back(range);
+		}
+		range.begin = event.face;
+		if (event.type == obj::GroupType::Material) {
+			range.material = event.name;
+		}
+	}
+	range.end = objFile.faceCount();
+	if (range.end > range.begin) {
+		ranges.push_back(range);
+	}
+	meshList.clear();
+	meshList.resize(ranges.size());
+	for (size_t n = 0; n < ranges.size(); n++) {
 		Mesh& mesh = meshList[n];
-		tinyobj::shape_t& shape = shapes[n];
-		if (shape.mesh.positions.size() > 0) {
-			mesh.vertexLocations.resize(shape.mesh.positions.size() / 3);
-			mesh.vertexLocations.set(shape.mesh.positions.data());
-		}
-		if (shape.mesh.normals.size() > 0) {
-			mesh.vertexNormals.resize(shape.mesh.normals.size() / 3);
-			mesh.vertexNormals.set(shape.mesh.normals.data());
-		}
-		//Doesn't support reading lines!
-		if (shape.mesh.triIndices.size() > 0) {
-			mesh.triIndexes.resize(shape.mesh.triIndices.size() / 3);
-			mesh.triIndexes.set(shape.mesh.triIndices.data());
-		}
-		if (shape.mesh.quadIndices.size() > 0) {
-			mesh.quadIndexes.resize(shape.mesh.quadIndices.size() / 4);
-			mesh.quadIndexes.set(shape.mesh.quadIndices.data());
-		}
-		for (size_t i = 0; i < shape.mesh.triIndices.size(); i += 3) {
-			uint32_t vid1 = shape.mesh.triIndices[i];
-			uint32_t vid2 = shape.mesh.triIndices[i + 1];
-			uint32_t vid3 = shape.mesh.triIndices[i + 2];
-			if (shape.mesh.texcoords.size() > 0) {
-				mesh.textureMap.push_back(
-						float2(shape.mesh.texcoords[2 * vid1],
-								shape.mesh.texcoords[2 * vid1 + 1]));
-				mesh.textureMap.push_back(
-						float2(shape.mesh.texcoords[2 * vid2],
-								shape.mesh.texcoords[2 * vid2 + 1]));
-				mesh.textureMap.push_back(
-						float2(shape.mesh.texcoords[2 * vid3],
-								shape.mesh.texcoords[2 * vid3 + 1]));
-			}
-		}
-		for (size_t i = 0; i < shape.mesh.quadIndices.size(); i += 4) {
-			uint32_t vid1 = shape.mesh.quadIndices[i];
-			uint32_t vid2 = shape.mesh.quadIndices[i + 1];
-			uint32_t vid3 = shape.mesh.quadIndices[i + 2];
-			uint32_t vid4 = shape.mesh.quadIndices[i + 3];
-			if (shape.mesh.texcoords.size() > 0) {
-				mesh.textureMap.push_back(
-						float2(shape.mesh.texcoords[2 * vid1],
-								shape.mesh.texcoords[2 * vid1 + 1]));
-				mesh.textureMap.push_back(
-						float2(shape.mesh.texcoords[2 * vid2],
-								shape.mesh.texcoords[2 * vid2 + 1]));
-				mesh.textureMap.push_back(
-						float2(shape.mesh.texcoords[2 * vid3],
-								shape.mesh.texcoords[2 * vid3 + 1]));
-				mesh.textureMap.push_back(
-						float2(shape.mesh.texcoords[2 * vid4],
-								shape.mesh.texcoords[2 * vid4 + 1]));
-			}
-		}
-		std::string texName = materials[n].diffuse_texname;
-		if (texName.size() > 0) {
-			aly::ReadImageFromFile(GetParentDirectory(file) + ALY_PATH_SEPARATOR+ texName, mesh.textureImage);
+		BuildObjMesh(objFile, ranges[n].begin, ranges[n].end, false, mesh);
+		auto it = materialMap.find(ranges[n].material);
+		if (it != materialMap.end()
+				&& materials[it->second].diffuse_texname.size() > 0) {
+			aly::ReadImageFromFile(
+					GetParentDirectory(file)
+							+ materials[it->second].diffuse_texname,
+					mesh.textureImage);
 		}
 		mesh.updateBoundingBox();
 	}
-
 }
 void ReadObjMeshFromFile(const std::string& file, Mesh& mesh) {
-	using namespace tinyobj;
-	std::vector<tinyobj::shape_t> shapes;
+	obj::ObjFile objFile;
+	obj::ReadObjFile(file, objFile);
+	mesh.clear();
+	BuildObjMesh(objFile, 0, objFile.faceCount(), true, mesh);
 	std::vector<tinyobj::material_t> materials;
-	std::string err = tinyobj::LoadObj(shapes, materials, file.c_str(),
-			GetParentDirectory(file).c_str());
-	if (err.size() > 0)
-		throw std::runtime_error(err);
-
-	uint32_t positionCount = 0;
-	uint32_t colorCount = 0;
-	uint32_t normalCount = 0;
-	uint32_t texCount = 0;
-	uint32_t lineIndexCount = 0;
-	uint32_t triIndexCount = 0;
-	uint32_t quadIndexCount = 0;
-	uint32_t pointIndexCount = 0;
-	for (int n = 0; n < (int) shapes.size(); n++) {
-		shape_t& shape = shapes[n];
-		positionCount += (uint32_t) shape.mesh.positions.size();
-		colorCount += (uint32_t) shape.mesh.colors.size();
-		normalCount += (uint32_t) shape.mesh.normals.size();
-		texCount += (uint32_t) shape.mesh.texcoords.size();
-		pointIndexCount += (uint32_t) shape.mesh.pointIndices.size();
-		lineIndexCount += (uint32_t) shape.mesh.lineIndices.size();
-		triIndexCount += (uint32_t) shape.mesh.triIndices.size();
-		quadIndexCount += (uint32_t) shape.mesh.quadIndices.size();
-	}
-	mesh.vertexColors.clear();
-	mesh.vertexColors.resize(colorCount / 3);
-	mesh.vertexLocations.resize(positionCount / 3);
-	mesh.vertexNormals.resize(normalCount / 3);
-	mesh.lineIndexes.resize(lineIndexCount / 2);
-	mesh.triIndexes.resize(triIndexCount / 3);
-	mesh.quadIndexes.resize(quadIndexCount / 4);
-	mesh.pointIndexes.resize(pointIndexCount);
-	positionCount = 0;
-	colorCount = 0;
-	normalCount = 0;
-	texCount = 0;
-	pointIndexCount = 0;
-	lineIndexCount = 0;
-	triIndexCount = 0;
-	quadIndexCount = 0;
-	mesh.textureMap.clear();
-	for (int n = 0; n < (int) shapes.size(); n++) {
-		shape_t& shape = shapes[n];
-		for (size_t i = 0; i < shape.mesh.pointIndices.size(); i++) {
-			mesh.pointIndexes[pointIndexCount++] = positionCount
-					+ shape.mesh.pointIndices[i];
-		}
-		for (size_t i = 0; i < shape.mesh.lineIndices.size(); i += 2) {
-			mesh.lineIndexes[lineIndexCount++] = uint2(
-					positionCount + shape.mesh.lineIndices[i],
-					positionCount + shape.mesh.lineIndices[i + 1]);
-		}
-		for (size_t i = 0; i < shape.mesh.triIndices.size(); i += 3) {
-			mesh.triIndexes[triIndexCount++] = uint3(
-					positionCount + shape.mesh.triIndices[i],
-					positionCount + shape.mesh.triIndices[i + 1],
-					positionCount + shape.mesh.triIndices[i + 2]);
-		}
-		for (size_t i = 0; i < shape.mesh.quadIndices.size(); i += 4) {
-			mesh.quadIndexes[quadIndexCount++] = uint4(
-					positionCount + shape.mesh.quadIndices[i],
-					positionCount + shape.mesh.quadIndices[i + 1],
-					positionCount + shape.mesh.quadIndices[i + 2],
-					positionCount + shape.mesh.quadIndices[i + 3]);
-		}
-		for (size_t i = 0; i < shape.mesh.positions.size(); i += 3) {
-			mesh.vertexLocations[positionCount++] = float3(
-					shape.mesh.positions[i], shape.mesh.positions[i + 1],
-					shape.mesh.positions[i + 2]);
-		}
-		for (size_t i = 0; i < shape.mesh.colors.size(); i += 3) {
-			mesh.vertexColors[colorCount++] = float4(shape.mesh.colors[i],
-					shape.mesh.colors[i + 1], shape.mesh.colors[i + 2], 1.0f);
-		}
-		for (size_t i = 0; i < shape.mesh.normals.size(); i += 3) {
-			mesh.vertexNormals[normalCount++] = float3(shape.mesh.normals[i],
-					shape.mesh.normals[i + 1], shape.mesh.normals[i + 2]);
-		}
-		for (size_t i = 0; i < shape.mesh.triIndices.size(); i += 3) {
-			uint32_t vid1 = shape.mesh.triIndices[i];
-			uint32_t vid2 = shape.mesh.triIndices[i + 1];
-			uint32_t vid3 = shape.mesh.triIndices[i + 2];
-			if (shape.mesh.texcoords.size() > 0) {
-				mesh.textureMap.push_back(
-						float2(shape.mesh.texcoords[2 * vid1],
-								shape.mesh.texcoords[2 * vid1 + 1]));
-				mesh.textureMap.push_back(
-						float2(shape.mesh.texcoords[2 * vid2],
-								shape.mesh.texcoords[2 * vid2 + 1]));
-				mesh.textureMap.push_back(
-						float2(shape.mesh.texcoords[2 * vid3],
-								shape.mesh.texcoords[2 * vid3 + 1]));
-			}
-		}
-		for (size_t i = 0; i < shape.mesh.quadIndices.size(); i += 4) {
-			uint32_t vid1 = shape.mesh.quadIndices[i];
-			uint32_t vid2 = shape.mesh.quadIndices[i + 1];
-			uint32_t vid3 = shape.mesh.quadIndices[i + 2];
-			uint32_t vid4 = shape.mesh.quadIndices[i + 3];
-			if (shape.mesh.texcoords.size() > 0) {
-				mesh.textureMap.push_back(
-						float2(shape.mesh.texcoords[2 * vid1],
-								shape.mesh.texcoords[2 * vid1 + 1]));
-				mesh.textureMap.push_back(
-						float2(shape.mesh.texcoords[2 * vid2],
-								shape.mesh.texcoords[2 * vid2 + 1]));
-				mesh.textureMap.push_back(
-						float2(shape.mesh.texcoords[2 * vid3],
-								shape.mesh.texcoords[2 * vid3 + 1]));
-				mesh.textureMap.push_back(
-						float2(shape.mesh.texcoords[2 * vid4],
-								shape.mesh.texcoords[2 * vid4 + 1]));
-			}
-		}
-		if (n < (int) materials.size()) {
-			std::string texName = materials[n].diffuse_texname;
-			if (texName.size() > 0) {
-				aly::ReadImageFromFile(
-						GetParentDirectory(file) + ALY_PATH_SEPARATOR+ texName, mesh.textureImage);
-			}
+	std::map<std::string, int> materialMap;
+	ReadObjMaterials(file, objFile, materials, materialMap);
+	//The texture comes from the first material used that has one, or else the first in the library.
+	std::string texName;
+	for (const obj::GroupEvent& event : objFile.groups) {
+		auto it = materialMap.find(event.name);
+		if (event.type == obj::GroupType::Material && it != materialMap.end()
+				&& materials[it->second].diffuse_texname.size() > 0) {
+			texName = materials[it->second].diffuse_texname;
+			break;
 		}
 	}
+	for (size_t n = 0; n < materials.size() && texName.size() == 0; n++) {
+		texName = materials[n].diffuse_texname;
+	}
+	if (texName.size() > 0) {
+		aly::ReadImageFromFile(GetParentDirectory(file) + texName,
+				mesh.textureImage);
+	}
 	if (mesh.vertexNormals.size() == 0) {
 		mesh.updateVertexNormals();
 	}
@@ -1616,7 +1845,222 @@ void ReadMeshFromFile(const std::string& file, Mesh &mesh) {
 		throw std::runtime_error(
 				MakeString() << "Could not read file " << file);
 }
+/*
+ Fast path for binary PLY files. The file is memory mapped and fixed stride
+ records are decoded in parallel straight into the mesh. Layouts it does not
+ handle (ascii, texture coordinates, other list properties) return false and
+ go through PLYReaderWriter instead.
+ */
+static bool ReadPlyMeshMapped(const std::string& file, Mesh& mesh) {
+	ReadableMemMapFile mapped(file, true);
+	const char* data = mapped.data();
+	uint64_t fileSize = mapped.getMappedSize();
+	PlyLayout layout;
+	if (data == nullptr || !ParsePlyLayout(data, fileSize, layout)
+			|| layout.format == FileFormat::ASCII) {
+		return false;
+	}
+	bool swap = layout.needsSwap();
+	PlyVertexFormat vertexFormat;
+	const PlyLayoutElement* vertexElem = nullptr;
+	const PlyLayoutElement* faceElem = nullptr;
+	uint64_t vertexOffset = 0, faceOffset = 0;
+	//Face records are [scalars][count][indexes][scalars].
+	int facePrefix = 0, faceSuffix = 0;
+	DataType countType = DataType::StartType, indexType = DataType::StartType;
+	//Either every face has uniformCount vertexes, or faceOffsets holds where each record starts.
+	int uniformCount = -1;
+	uint64_t faceStride = 0;
+	std::vector<uint64_t> faceOffsets;
+	uint64_t offset = layout.headerSize;
+	for (const PlyLayoutElement& elem : layout.elements) {
+		if (elem.name == "vertex") {
+			if (!vertexFormat.set(elem, swap))
+				return false;
+			if (vertexFormat.hasColors()
+					&& (vertexFormat.types[PlyVertexFormat::RED] != DataType::Uint8
+							|| vertexFormat.types[PlyVertexFormat::GREEN] != DataType::Uint8
+							|| vertexFormat.types[PlyVertexFormat::BLUE] != DataType::Uint8))
+				return false;
+			vertexElem = &elem;
+			vertexOffset = offset;
+		} else if (elem.name == "face") {
+			bool foundList = false;
+			for (const PlyLayoutProperty& prop : elem.props) {
+				if (prop.countType != DataType::StartType) {
+					if (prop.name != "vertex_indices" || foundList)
+						return false;
+					countType = prop.countType;
+					indexType = prop.type;
+					foundList = true;
+				} else {
+					int sz = ply_type_size[static_cast<int>(prop.type)];
+					if (foundList)
+						faceSuffix += sz;
+					else
+						facePrefix += sz;
+				}
+			}
+			if (!foundList)
+				return false;
+			faceElem = &elem;
+			faceOffset = offset;
+			const int countSize = ply_type_size[static_cast<int>(countType)];
+			const int indexSize = ply_type_size[static_cast<int>(indexType)];
+			const int64_t F = (int64_t) elem.count;
+			if (F == 0)
+				continue;
+			if (offset + facePrefix + countSize > fileSize)
+				return false;
+			int first = ReadPlyValue<int>(data + offset + facePrefix, countType,
+					swap);
+			faceStride = facePrefix + countSize + (uint64_t) first * indexSize
+					+ faceSuffix;
+			//If the count read at every multiple of the first record's size matches, that is exactly what a sequential parse finds.
+			int mismatch = 0;
+			if (first >= 0 && offset + F * faceStride <= fileSize) {
+#pragma omp parallel for reduction(+:mismatch)
+				for (int64_t f = 0; f < F; f++) {
+					if (ReadPlyValue<int>(data + offset + f * faceStride + facePrefix,
+							countType, swap) != first)
+						mismatch++;
+				}
+			} else {
+				mismatch = 1;
+			}
+			if (mismatch == 0) {
+				uniformCount = first;
+				offset += F * faceStride;
+			} else {
+				faceOffsets.resize(F);
+				for (int64_t f = 0; f < F; f++) {
+					if (offset + facePrefix + countSize > fileSize)
+						return false;
+					int n = ReadPlyValue<int>(data + offset + facePrefix,
+							countType, swap);
+					if (n < 0)
+						return false;
+					faceOffsets[f] = offset;
+					offset += facePrefix + countSize + (uint64_t) n * indexSize
+							+ faceSuffix;
+				}
+			}
+		} else if (elem.stride < 0) {
+			return false;
+		}
+		if (elem.stride >= 0)
+			offset += elem.count * elem.stride;
+		if (offset > fileSize)
+			return false;
+	}
+	if (vertexElem == nullptr)
+		return false;
+	mesh.lineIndexes.clear();
+	mesh.triIndexes.clear();
+	mesh.quadIndexes.clear();
+	mesh.pointIndexes.clear();
+	mesh.vertexLocations.clear();
+	mesh.vertexNormals.clear();
+	mesh.vertexColors.clear();
+	mesh.textureMap.clear();
+	mesh.textureImage.clear();
+	const int64_t N = (int64_t) vertexElem->count;
+	const bool hasNormals = vertexFormat.hasNormals();
+	const bool hasColors = vertexFormat.hasColors();
+	mesh.vertexLocations.resize(N);
+	if (hasNormals)
+		mesh.vertexNormals.resize(N);
+	if (hasColors)
+		mesh.vertexColors.resize(N);
+#pragma omp parallel for
+	for (int64_t n = 0; n < N; n++) {
+		const char* record = data + vertexOffset + n * vertexFormat.stride;
+		mesh.vertexLocations[n] = float3(vertexFormat.get(record, PlyVertexFormat::X),
+				vertexFormat.get(record, PlyVertexFormat::Y),
+				vertexFormat.get(record, PlyVertexFormat::Z));
+		if (hasNormals) {
+			mesh.vertexNormals[n] = float3(
+					vertexFormat.get(record, PlyVertexFormat::NX),
+					vertexFormat.get(record, PlyVertexFormat::NY),
+					vertexFormat.get(record, PlyVertexFormat::NZ));
+		}
+		if (hasColors) {
+			mesh.vertexColors[n] = float4(
+					vertexFormat.getColor(record, PlyVertexFormat::RED),
+					vertexFormat.getColor(record, PlyVertexFormat::GREEN),
+					vertexFormat.getColor(record, PlyVertexFormat::BLUE), 1.0f);
+		}
+	}
+	if (faceElem != nullptr && faceElem->count > 0) {
+		const int64_t F = (int64_t) faceElem->count;
+		const int countSize = ply_type_size[static_cast<int>(countType)];
+		const int indexSize = ply_type_size[static_cast<int>(indexType)];
+		const int listOffset = facePrefix + countSize;
+		//Faces of each size keep their file order, as in the PLYReaderWriter path.
+		std::vector<uint32_t> slots;
+		size_t sizeCounts[5] = { 0, 0, 0, 0, 0 };
+		if (uniformCount >= 0) {
+			if (uniformCount <= 4)
+				sizeCounts[uniformCount] = F;
+		} else {
+			slots.resize(F);
+			for (int64_t f = 0; f < F; f++) {
+				int n = ReadPlyValue<int>(data + faceOffsets[f] + facePrefix,
+						countType, swap);
+				if (n <= 4)
+					slots[f] = (uint32_t) sizeCounts[n]++;
+			}
+		}
+		mesh.pointIndexes.resize(sizeCounts[1]);
+		mesh.lineIndexes.resize(sizeCounts[2]);
+		mesh.triIndexes.resize(sizeCounts[3]);
+		mesh.quadIndexes.resize(sizeCounts[4]);
+#pragma omp parallel for
+		for (int64_t f = 0; f < F; f++) {
+			const char* record;
+			int n;
+			size_t slot;
+			if (uniformCount >= 0) {
+				record = data + faceOffset + f * faceStride;
+				n = uniformCount;
+				slot = f;
+			} else {
+				record = data + faceOffsets[f];
+				n = ReadPlyValue<int>(record + facePrefix, countType, swap);
+				slot = slots[f];
+			}
+			const char* list = record + listOffset;
+			uint32_t verts[4];
+			for (int k = 0; k < n && k < 4; k++) {
+				verts[k] = ReadPlyValue<uint32_t>(list + k * indexSize, indexType,
+						swap);
+			}
+			if (n == 4) {
+				mesh.quadIndexes[slot] = uint4(verts[0], verts[1], verts[2],
+						verts[3]);
+			} else if (n == 3) {
+				mesh.triIndexes[slot] = uint3(verts[0], verts[1], verts[2]);
+			} else if (n == 2) {
+				mesh.lineIndexes[slot] = uint2(verts[0], verts[1]);
+			} else if (n == 1) {
+				mesh.pointIndexes[slot] = verts[0];
+			}
+		}
+	}
+	if (mesh.vertexLocations.size() > 0) {
+		mesh.updateBoundingBox();
+	}
+	if (mesh.vertexNormals.size() == 0
+			&& (mesh.triIndexes.size() > 0 || mesh.quadIndexes.size() > 0)) {
+		mesh.updateVertexNormals();
+	}
+	mesh.setDirty(true);
+	return true;
+}
 void ReadPlyMeshFromFile(const std::string& file, Mesh &mesh) {
+	if (ReadPlyMeshMapped(file, mesh)) {
+		return;
+	}
 	int i, j;
 	int numPts = 0, numPolys = 0;
 	PLYReaderWriter ply;
@@ -1789,7 +2233,7 @@ void ReadPlyMeshFromFile(const std::string& file, Mesh &mesh) {
 					} else if (face.nverts == 2) {
 						mesh.lineIndexes.append(
 								uint2(face.verts[0], face.verts[1]));
-					} else if (faceTex.nverts == 1) {
+					} else if (face.nverts == 1) {
 						mesh.pointIndexes.push_back(face.verts[0]);
 					}
 				}
@@ -1806,63 +2250,147 @@ void ReadPlyMeshFromFile(const std::string& file, Mesh &mesh) {
 	mesh.setDirty(true);
 }
 
+PlyPointReader::PlyPointReader() :
+		mapped(nullptr, false), dataOffset(0), count(0), position(0) {
+}
+PlyPointReader::PlyPointReader(const std::string& file) :
+		PlyPointReader() {
+	open(file);
+}
+void PlyPointReader::open(const std::string& file) {
+	close();
+	mapped.open(file, false);
+	if (!mapped.isOpen()) {
+		throw std::runtime_error(MakeString() << "Could not open " << file);
+	}
+	//Map a window large enough for any reasonable header.
+	uint64_t fileSize = mapped.getFileSize();
+	mapped.map(0, std::min(fileSize, (uint64_t) 1 << 20));
+	PlyLayout layout;
+	if (mapped.data() == nullptr
+			|| !ParsePlyLayout(mapped.data(), mapped.getMappedSize(), layout)
+			|| layout.format == FileFormat::ASCII) {
+		close();
+		throw std::runtime_error(
+				MakeString() << "Could not read binary PLY header [" << file
+						<< "]");
+	}
+	uint64_t offset = layout.headerSize;
+	bool found = false;
+	for (const PlyLayoutElement& elem : layout.elements) {
+		if (elem.name == "vertex") {
+			found = format.set(elem, layout.needsSwap());
+			break;
+		}
+		if (elem.stride < 0)
+			break;
+		offset += elem.count * elem.stride;
+	}
+	if (!found) {
+		close();
+		throw std::runtime_error(
+				MakeString() << "PLY file has no fixed size vertex records ["
+						<< file << "]");
+	}
+	count = layout.findElement("vertex")->count;
+	dataOffset = offset;
+	if (dataOffset + count * format.stride > fileSize) {
+		close();
+		throw std::runtime_error(
+				MakeString() << "PLY file is truncated [" << file << "]");
+	}
+	mapped.unmap();
+}
+void PlyPointReader::close() {
+	mapped.close();
+	format = PlyVertexFormat();
+	dataOffset = 0;
+	count = 0;
+	position = 0;
+}
+size_t PlyPointReader::read(std::vector<float3>& points,
+		std::vector<float3>* normals, std::vector<float4>* colors,
+		size_t maxCount) {
+	size_t N = (size_t) std::min((uint64_t) maxCount, count - position);
+	points.resize(N);
+	if (normals != nullptr)
+		normals->resize(hasNormals() ? N : 0);
+	if (colors != nullptr)
+		colors->resize(hasColors() ? N : 0);
+	if (N == 0)
+		return 0;
+	//Only the window for this chunk is mapped, so memory use is bounded by maxCount.
+	mapped.map(dataOffset + position * format.stride, N * format.stride);
+	const char* data = mapped.data();
+	if (data == nullptr) {
+		throw std::runtime_error("Could not map PLY vertex records.");
+	}
+	float3* normalData =
+			(normals != nullptr && hasNormals()) ? normals->data() : nullptr;
+	float4* colorData =
+			(colors != nullptr && hasColors()) ? colors->data() : nullptr;
+#pragma omp parallel for
+	for (int64_t n = 0; n < (int64_t) N; n++) {
+		const char* record = data + n * format.stride;
+		points[n] = float3(format.get(record, PlyVertexFormat::X),
+				format.get(record, PlyVertexFormat::Y),
+				format.get(record, PlyVertexFormat::Z));
+		if (normalData != nullptr) {
+			normalData[n] = float3(format.get(record, PlyVertexFormat::NX),
+					format.get(record, PlyVertexFormat::NY),
+					format.get(record, PlyVertexFormat::NZ));
+		}
+		if (colorData != nullptr) {
+			colorData[n] = float4(format.getColor(record, PlyVertexFormat::RED),
+					format.getColor(record, PlyVertexFormat::GREEN),
+					format.getColor(record, PlyVertexFormat::BLUE), 1.0f);
+		}
+	}
+	mapped.unmap();
+	position += N;
+	return N;
+}
 void CreateVertexNeighborTable(const Mesh& mesh,
 		std::vector<std::unordered_set<uint32_t>>& vertNbrs) {
+	MeshTopologyPtr topoPtr = mesh.getTopology();
+	const MeshTopology& topo = *topoPtr;
 	vertNbrs.resize(mesh.vertexLocations.size());
-	for (const uint3& face : mesh.triIndexes.data) {
-		vertNbrs[face.x].insert(face.y);
-		vertNbrs[face.y].insert(face.z);
-		vertNbrs[face.z].insert(face.x);
-		vertNbrs[face.z].insert(face.y);
-		vertNbrs[face.y].insert(face.x);
-		vertNbrs[face.x].insert(face.z);
-	}
-	for (const uint4& face : mesh.quadIndexes.data) {
-		vertNbrs[face.x].insert(face.y);
-		vertNbrs[face.y].insert(face.z);
-		vertNbrs[face.z].insert(face.w);
-		vertNbrs[face.w].insert(face.x);
-		vertNbrs[face.w].insert(face.z);
-		vertNbrs[face.z].insert(face.y);
-		vertNbrs[face.y].insert(face.x);
-		vertNbrs[face.x].insert(face.w);
+#pragma omp parallel for
+	for (int n = 0; n < (int) vertNbrs.size(); n++) {
+		std::unordered_set<uint32_t>& nbrs = vertNbrs[n];
+		nbrs.clear();
+		nbrs.reserve(topo.ringSize(n));
+		nbrs.insert(topo.ringVertices.begin() + topo.ringOffsets[n],
+				topo.ringVertices.begin() + topo.ringOffsets[n + 1]);
 	}
 }
-inline uint64_t faceHashCode(const uint2& val) {
-	return ((uint64_t) val.y) << 32 | ((uint64_t) val.x);
+//Vertex at position k of face f, where triangles come before quads.
+static inline uint32_t FaceVertex(const Mesh& mesh, const MeshTopology& topo,
+		uint32_t f, uint32_t k) {
+	return (f < topo.triCount) ?
+			mesh.triIndexes[f][k] : mesh.quadIndexes[f - topo.triCount][k];
 }
 void CreateOrderedVertexNeighborTable(const Mesh& mesh,
 		std::vector<std::vector<uint32_t>>& vertNbrsOut, bool leaveTail) {
 	//Leave tail means to not remove the duplicate vertex neighbor at the end of the neighbor list.
 	//Non-manifold vertexes will not have a tail, so the tail can be used to detect them in simple (common) cases.
+	MeshTopologyPtr topoPtr = mesh.getTopology();
+	const MeshTopology& topo = *topoPtr;
 	vertNbrsOut.resize(mesh.vertexLocations.size());
-	std::vector<std::vector<uint32_t>> vertNbrs(mesh.vertexLocations.size());
-	for (const uint3& face : mesh.triIndexes.data) {
-		vertNbrs[face.x].push_back(face.z);
-		vertNbrs[face.x].push_back(face.y);
-
-		vertNbrs[face.y].push_back(face.x);
-		vertNbrs[face.y].push_back(face.z);
-
-		vertNbrs[face.z].push_back(face.y);
-		vertNbrs[face.z].push_back(face.x);
-	}
-	for (const uint4& face : mesh.quadIndexes.data) {
-		vertNbrs[face.x].push_back(face.w);
-		vertNbrs[face.x].push_back(face.y);
-
-		vertNbrs[face.y].push_back(face.x);
-		vertNbrs[face.y].push_back(face.z);
-
-		vertNbrs[face.z].push_back(face.y);
-		vertNbrs[face.z].push_back(face.w);
-
-		vertNbrs[face.w].push_back(face.z);
-		vertNbrs[face.w].push_back(face.x);
-	}
-	int N = (int) vertNbrs.size();
+	int N = (int) vertNbrsOut.size();
+#pragma omp parallel for schedule(dynamic,1024)
 	for (int n = 0; n < N; n++) {
-		std::vector<uint32_t>& nbrs = vertNbrs[n];
+		//(previous, next) vertex pairs of every corner at n, in face order.
+		std::vector<uint32_t> nbrs(2 * topo.cornerCount(n));
+		for (uint32_t i = topo.cornerOffsets[n], j = 0;
+				i < topo.cornerOffsets[n + 1]; i++, j += 2) {
+			uint32_t h = topo.vertexCorners[i];
+			uint32_t f = topo.halfEdgeFace(h);
+			uint32_t k = topo.halfEdgeCorner(h);
+			uint32_t sz = topo.faceSize(f);
+			nbrs[j] = FaceVertex(mesh, topo, f, (k + sz - 1) % sz);
+			nbrs[j + 1] = FaceVertex(mesh, topo, f, (k + 1) % sz);
+		}
 		if (nbrs.size() > 0) {
 			vertNbrsOut[n].clear();
 			bool found;
@@ -2008,209 +2536,121 @@ bool Mesh::convertQuadsToTriangles() {
 	return ret;
 }
 void CreateFaceNeighborTable(const Mesh& mesh,
-		std::vector<std::list<uint32_t>>& faceNbrs) {
-	faceNbrs.resize(mesh.triIndexes.size() + mesh.quadIndexes.size());
-	std::map<uint64_t, std::list<uint>> edgeTable;
-	uint2 edge;
-	uint fid = 0;
-	for (const uint3& face : mesh.triIndexes.data) {
-		edge = (face.x < face.y) ?
-				uint2(face.x, face.y) : uint2(face.y, face.x);
-		edgeTable[faceHashCode(edge)].push_back(fid);
-		edge = (face.y < face.z) ?
-				uint2(face.y, face.z) : uint2(face.z, face.y);
-		edgeTable[faceHashCode(edge)].push_back(fid);
-		edge = (face.z < face.x) ?
-				uint2(face.z, face.x) : uint2(face.x, face.z);
-		edgeTable[faceHashCode(edge)].push_back(fid);
-		fid++;
-	}
-	for (const uint4& face : mesh.quadIndexes.data) {
-		edge = (face.x < face.y) ?
-				uint2(face.x, face.y) : uint2(face.y, face.x);
-		edgeTable[faceHashCode(edge)].push_back(fid);
-		edge = (face.y < face.z) ?
-				uint2(face.y, face.z) : uint2(face.z, face.y);
-		edgeTable[faceHashCode(edge)].push_back(fid);
-		edge = (face.z < face.w) ?
-				uint2(face.z, face.w) : uint2(face.w, face.z);
-		edgeTable[faceHashCode(edge)].push_back(fid);
-		edge = (face.w < face.x) ?
-				uint2(face.w, face.x) : uint2(face.x, face.w);
-		edgeTable[faceHashCode(edge)].push_back(fid);
-		fid++;
-	}
-	for (std::pair<const uint64_t, std::list<uint>>& edgeList : edgeTable) {
-		if (edgeList.second.size() == 2) {
-			uint fid1 = edgeList.second.front();
-			uint fid2 = edgeList.second.back();
-			if (fid1 != fid2) {
-				faceNbrs[fid1].push_back(fid2);
-				faceNbrs[fid2].push_back(fid1);
+		MeshListNeighborTable& faceNbrs) {
+	MeshTopologyPtr topoPtr = mesh.getTopology();
+	const MeshTopology& topo = *topoPtr;
+	int F = (int) topo.faceCount();
+	faceNbrs.resize(F);
+#pragma omp parallel for
+	for (int fid = 0; fid < F; fid++) {
+		//Neighbors across manifold edges, ordered by the upper then lower vertex of the shared edge.
+		std::pair<uint64_t, uint32_t> nbrs[4];
+		int count = 0;
+		uint32_t h0 = topo.faceHalfEdge(fid);
+		for (uint32_t h = h0; h < h0 + topo.faceSize(fid); h++) {
+			uint32_t e = topo.halfEdgeEdges[h];
+			if (topo.edgeFaceCount(e) == 2) {
+				uint32_t fid1 = topo.halfEdgeFace(
+						topo.edgeHalfEdges[topo.edgeOffsets[e]]);
+				uint32_t fid2 = topo.halfEdgeFace(
+						topo.edgeHalfEdges[topo.edgeOffsets[e] + 1]);
+				if (fid1 != fid2) {
+					uint2 edge = topo.edges[e];
+					nbrs[count++] = std::pair<uint64_t, uint32_t>(
+							((uint64_t) edge.y) << 32 | ((uint64_t) edge.x),
+							(fid1 == (uint32_t) fid) ? fid2 : fid1);
+				}
 			}
 		}
+		std::sort(nbrs, nbrs + count);
+		std::vector<uint32_t>& list = faceNbrs[fid];
+		list.resize(count);
+		for (int i = 0; i < count; i++) {
+			list[i] = nbrs[i].second;
+		}
 	}
 }
-struct FaceEdge {
-	std::list<uint> faces;
-	size_t edgePointIndex;
-};
 void SubdivideCatmullClark(Mesh& mesh) {
-	std::vector<std::list<uint32_t>> faceFaceNbrs;
-	faceFaceNbrs.resize(mesh.triIndexes.size() + mesh.quadIndexes.size());
-	std::map<uint64_t, FaceEdge> edgeTable;
-	std::set<uint2> edges;
+	MeshTopologyPtr topoPtr = mesh.getTopology();
+	const MeshTopology& topo = *topoPtr;
 	bool hasUVs = mesh.textureMap.size() > 0;
 	bool hasColor = mesh.vertexColors.size() > 0;
-	std::vector<std::pair<int, float3>> faceVerts(mesh.vertexLocations.size(),
-			std::pair<int, float3>(0, float3(0.0f)));
-	std::vector<std::pair<int, float3>> edgeVerts(mesh.vertexLocations.size(),
-			std::pair<int, float3>(0, float3(0.0f)));
-	uint2 edge;
-	uint fid = 0;
-	for (const uint3& face : mesh.triIndexes.data) {
-		edge = (face.x < face.y) ?
-				uint2(face.x, face.y) : uint2(face.y, face.x);
-		edges.insert(edge);
-		edgeTable[faceHashCode(edge)].faces.push_back(fid);
-
-		edge = (face.y < face.z) ?
-				uint2(face.y, face.z) : uint2(face.z, face.y);
-		edges.insert(edge);
-		edgeTable[faceHashCode(edge)].faces.push_back(fid);
-
-		edge = (face.z < face.x) ?
-				uint2(face.z, face.x) : uint2(face.x, face.z);
-		edges.insert(edge);
-		edgeTable[faceHashCode(edge)].faces.push_back(fid);
-		fid++;
-	}
-	for (const uint4& face : mesh.quadIndexes.data) {
-		edge = (face.x < face.y) ?
-				uint2(face.x, face.y) : uint2(face.y, face.x);
-		edges.insert(edge);
-		edgeTable[faceHashCode(edge)].faces.push_back(fid);
-
-		edge = (face.y < face.z) ?
-				uint2(face.y, face.z) : uint2(face.z, face.y);
-		edges.insert(edge);
-		edgeTable[faceHashCode(edge)].faces.push_back(fid);
-
-		edge = (face.z < face.w) ?
-				uint2(face.z, face.w) : uint2(face.w, face.z);
-		edges.insert(edge);
-		edgeTable[faceHashCode(edge)].faces.push_back(fid);
-
-		edge = (face.w < face.x) ?
-				uint2(face.w, face.x) : uint2(face.x, face.w);
-		edges.insert(edge);
-		edgeTable[faceHashCode(edge)].faces.push_back(fid);
-		fid++;
-	}
-	for (std::pair<const uint64_t, FaceEdge>& edgeList : edgeTable) {
-		if (edgeList.second.faces.size() == 2) {
-			uint fid1 = edgeList.second.faces.front();
-			uint fid2 = edgeList.second.faces.back();
-			if (fid1 != fid2) {
-				faceFaceNbrs[fid1].push_back(fid2);
-				faceFaceNbrs[fid2].push_back(fid1);
-			}
-		}
-	}
-	size_t backIndex = mesh.vertexLocations.size();
-	size_t endIndex = backIndex;
-	mesh.vertexLocations.resize(
-			endIndex + mesh.quadIndexes.size() + mesh.triIndexes.size()
-					+ edges.size());
+	const int triCount = (int) mesh.triIndexes.size();
+	const int quadCount = (int) mesh.quadIndexes.size();
+	const int faceCount = triCount + quadCount;
+	const int edgeCount = (int) topo.edges.size();
+	const int vertCount = (int) mesh.vertexLocations.size();
+	//New vertexes are the face points, then one edge point per edge in the order of topo.edges.
+	const size_t backIndex = vertCount;
+	const size_t edgeIndex = backIndex + faceCount;
+	mesh.vertexLocations.resize(edgeIndex + edgeCount);
 	if (hasColor) {
-		mesh.vertexColors.resize(
-				endIndex + mesh.quadIndexes.size() + mesh.triIndexes.size()
-						+ edges.size());
+		mesh.vertexColors.resize(edgeIndex + edgeCount);
 	}
-	for (const uint3& face : mesh.triIndexes.data) {
+#pragma omp parallel for
+	for (int i = 0; i < triCount; i++) {
+		const uint3& face = mesh.triIndexes[i];
 		float3 pt1 = mesh.vertexLocations[face.x];
 		float3 pt2 = mesh.vertexLocations[face.y];
 		float3 pt3 = mesh.vertexLocations[face.z];
-		float3 avg = 0.33333333f * (pt1 + pt2 + pt3);
-		for (int k = 0; k < 3; k++) {
-			std::pair<int, float3>& pr = faceVerts[face[k]];
-			pr.first++;
-			pr.second += avg;
-		}
 		if (hasColor) {
-			mesh.vertexColors[endIndex] = 0.3333333f
+			mesh.vertexColors[backIndex + i] = 0.3333333f
 					* (mesh.vertexColors[face.x] + mesh.vertexColors[face.y]
 							+ mesh.vertexColors[face.z]);
 		}
-		mesh.vertexLocations[endIndex++] = avg;
+		mesh.vertexLocations[backIndex + i] = 0.33333333f * (pt1 + pt2 + pt3);
 	}
-	for (const uint4& face : mesh.quadIndexes.data) {
+#pragma omp parallel for
+	for (int i = 0; i < quadCount; i++) {
+		const uint4& face = mesh.quadIndexes[i];
 		float3 pt1 = mesh.vertexLocations[face.x];
 		float3 pt2 = mesh.vertexLocations[face.y];
 		float3 pt3 = mesh.vertexLocations[face.z];
 		float3 pt4 = mesh.vertexLocations[face.w];
-		float3 avg = 0.25f * (pt1 + pt2 + pt3 + pt4);
-		for (int k = 0; k < 4; k++) {
-			std::pair<int, float3>& pr = faceVerts[face[k]];
-			pr.first++;
-			pr.second += avg;
-		}
 		if (hasColor) {
-			mesh.vertexColors[endIndex] = 0.25f
+			mesh.vertexColors[backIndex + triCount + i] = 0.25f
 					* (mesh.vertexColors[face.x] + mesh.vertexColors[face.y]
 							+ mesh.vertexColors[face.z]
 							+ mesh.vertexColors[face.w]);
 		}
-		mesh.vertexLocations[endIndex++] = avg;
+		mesh.vertexLocations[backIndex + triCount + i] = 0.25f
+				* (pt1 + pt2 + pt3 + pt4);
 	}
-	for (uint2 edge : edges) {
+#pragma omp parallel for
+	for (int e = 0; e < edgeCount; e++) {
+		uint2 edge = topo.edges[e];
 		float3 pt1 = mesh.vertexLocations[edge.x];
 		float3 pt2 = mesh.vertexLocations[edge.y];
-		FaceEdge& fe = edgeTable[faceHashCode(edge)];
-		fe.edgePointIndex = endIndex;
 		float3 avg;
-		if (fe.faces.size() < 2) {
+		if (topo.edgeFaceCount(e) < 2) {
 			avg = 0.5f * (pt1 + pt2);
 		} else {
-			avg =
-					0.25f
-							* (pt1 + pt2
-									+ mesh.vertexLocations[fe.faces.front()
-											+ backIndex]
-									+ mesh.vertexLocations[fe.faces.back()
-											+ backIndex]);
-		}
-		for (int k = 0; k < 2; k++) {
-			std::pair<int, float3>& pr = edgeVerts[edge[k]];
-			pr.first++;
-			pr.second += avg;
+			uint32_t fid1 = topo.halfEdgeFace(
+					topo.edgeHalfEdges[topo.edgeOffsets[e]]);
+			uint32_t fid2 = topo.halfEdgeFace(
+					topo.edgeHalfEdges[topo.edgeOffsets[e + 1] - 1]);
+			avg = 0.25f
+					* (pt1 + pt2 + mesh.vertexLocations[fid1 + backIndex]
+							+ mesh.vertexLocations[fid2 + backIndex]);
 		}
 		if (hasColor) {
-			mesh.vertexColors[endIndex] = 0.5f
+			mesh.vertexColors[edgeIndex + e] = 0.5f
 					* (mesh.vertexColors[edge.x] + mesh.vertexColors[edge.y]);
 		}
-		mesh.vertexLocations[endIndex++] = avg;
-
+		mesh.vertexLocations[edgeIndex + e] = avg;
 	}
-	std::vector<uint4> newQuads(
-			4 * mesh.quadIndexes.size() + 3 * mesh.triIndexes.size());
-	std::vector<float2> uvs(newQuads.size() * 4);
-	size_t faceIndex = 0;
-	size_t uvIndex = 0;
-	fid = 0;
-	endIndex = backIndex;
-	for (const uint3& face : mesh.triIndexes.data) {
-		edge = (face.x < face.y) ?
-				uint2(face.x, face.y) : uint2(face.y, face.x);
-		size_t ept1 = edgeTable[faceHashCode(edge)].edgePointIndex;
-		edge = (face.y < face.z) ?
-				uint2(face.y, face.z) : uint2(face.z, face.y);
-		size_t ept2 = edgeTable[faceHashCode(edge)].edgePointIndex;
-		edge = (face.z < face.x) ?
-				uint2(face.z, face.x) : uint2(face.x, face.z);
-		size_t ept3 = edgeTable[faceHashCode(edge)].edgePointIndex;
-
+	std::vector<uint4> newQuads(4 * quadCount + 3 * triCount);
+	std::vector<float2> uvs((hasUVs) ? newQuads.size() * 4 : 0);
+#pragma omp parallel for
+	for (int i = 0; i < triCount; i++) {
+		const uint3& face = mesh.triIndexes[i];
+		uint32_t center = (uint32_t) (backIndex + i);
+		uint32_t ept1 = (uint32_t) edgeIndex + topo.halfEdgeEdges[3 * i];
+		uint32_t ept2 = (uint32_t) edgeIndex + topo.halfEdgeEdges[3 * i + 1];
+		uint32_t ept3 = (uint32_t) edgeIndex + topo.halfEdgeEdges[3 * i + 2];
 		if (hasUVs) {
+			size_t fid = 3 * (size_t) i;
+			size_t uvIndex = 12 * (size_t) i;
 			float2 uv1 = mesh.textureMap[fid];
 			float2 uv2 = mesh.textureMap[fid + 1];
 			float2 uv3 = mesh.textureMap[fid + 2];
@@ -2233,30 +2673,25 @@ void SubdivideCatmullClark(Mesh& mesh) {
 			uvs[uvIndex++] = upt3;
 			uvs[uvIndex++] = uva;
 			uvs[uvIndex++] = upt2;
-			fid += 3;
-		}
-		newQuads[faceIndex++] = uint4(face.x, (uint32_t) ept1,
-				(uint32_t) endIndex, (uint32_t) ept3);
-		newQuads[faceIndex++] = uint4(face.y, (uint32_t) ept2,
-				(uint32_t) endIndex, (uint32_t) ept1);
-		newQuads[faceIndex++] = uint4(face.z, (uint32_t) ept3,
-				(uint32_t) endIndex, (uint32_t) ept2);
-		endIndex++;
-	}
-	for (const uint4& face : mesh.quadIndexes.data) {
-		edge = (face.x < face.y) ?
-				uint2(face.x, face.y) : uint2(face.y, face.x);
-		size_t ept1 = edgeTable[faceHashCode(edge)].edgePointIndex;
-		edge = (face.y < face.z) ?
-				uint2(face.y, face.z) : uint2(face.z, face.y);
-		size_t ept2 = edgeTable[faceHashCode(edge)].edgePointIndex;
-		edge = (face.z < face.w) ?
-				uint2(face.z, face.w) : uint2(face.w, face.z);
-		size_t ept3 = edgeTable[faceHashCode(edge)].edgePointIndex;
-		edge = (face.w < face.x) ?
-				uint2(face.w, face.x) : uint2(face.x, face.w);
-		size_t ept4 = edgeTable[faceHashCode(edge)].edgePointIndex;
+		}
+		size_t faceIndex = 3 * (size_t) i;
+		newQuads[faceIndex++] = uint4(face.x, ept1, center, ept3);
+		newQuads[faceIndex++] = uint4(face.y, ept2, center, ept1);
+		newQuads[faceIndex++] = uint4(face.z, ept3, center, ept2);
+	}
+	const size_t quadStart = 3 * (size_t) triCount;
+#pragma omp parallel for
+	for (int i = 0; i < quadCount; i++) {
+		const uint4& face = mesh.quadIndexes[i];
+		uint32_t center = (uint32_t) (backIndex + triCount + i);
+		size_t h = quadStart + 4 * (size_t) i;
+		uint32_t ept1 = (uint32_t) edgeIndex + topo.halfEdgeEdges[h];
+		uint32_t ept2 = (uint32_t) edgeIndex + topo.halfEdgeEdges[h + 1];
+		uint32_t ept3 = (uint32_t) edgeIndex + topo.halfEdgeEdges[h + 2];
+		uint32_t ept4 = (uint32_t) edgeIndex + topo.halfEdgeEdges[h + 3];
 		if (hasUVs) {
+			size_t fid = h;
+			size_t uvIndex = 4 * (quadStart + 4 * (size_t) i);
 			float2 uv1 = mesh.textureMap[fid];
 			float2 uv2 = mesh.textureMap[fid + 1];
 			float2 uv3 = mesh.textureMap[fid + 2];
@@ -2286,30 +2721,39 @@ void SubdivideCatmullClark(Mesh& mesh) {
 			uvs[uvIndex++] = upt4;
 			uvs[uvIndex++] = uva;
 			uvs[uvIndex++] = upt3;
-			fid += 4;
-		}
-		newQuads[faceIndex++] = uint4(face.x, (uint32_t) ept1,
-				(uint32_t) endIndex, (uint32_t) ept4);
-		newQuads[faceIndex++] = uint4(face.y, (uint32_t) ept2,
-				(uint32_t) endIndex, (uint32_t) ept1);
-		newQuads[faceIndex++] = uint4(face.z, (uint32_t) ept3,
-				(uint32_t) endIndex, (uint32_t) ept2);
-		newQuads[faceIndex++] = uint4(face.w, (uint32_t) ept4,
-				(uint32_t) endIndex, (uint32_t) ept3);
-
-		endIndex++;
+		}
+		size_t faceIndex = quadStart + 4 * (size_t) i;
+		newQuads[faceIndex++] = uint4(face.x, ept1, center, ept4);
+		newQuads[faceIndex++] = uint4(face.y, ept2, center, ept1);
+		newQuads[faceIndex++] = uint4(face.z, ept3, center, ept2);
+		newQuads[faceIndex++] = uint4(face.w, ept4, center, ept3);
 	}
-	for (int n = 0; n < (int) faceVerts.size(); n++) {
+	//Face and edge points are gathered in the order the faces and edges are stored, as a serial scatter would add them.
+	std::vector<float3> newVerts(vertCount);
+#pragma omp parallel for
+	for (int n = 0; n < vertCount; n++) {
 		float3 P = mesh.vertexLocations[n];
-		int fcount = faceVerts[n].first;
-		int ecount = edgeVerts[n].first;
-
-		float3 F = faceVerts[n].second / (float) fcount;
-		float3 R = edgeVerts[n].second / (float) ecount;
-
-		mesh.vertexLocations[n] = (F + 2.0f * R + (ecount - 3.0f) * P)
-				/ (float) ecount;
+		float3 F(0.0f), R(0.0f);
+		int fcount = (int) topo.cornerCount(n);
+		int ecount = (int) topo.ringSize(n);
+		for (uint32_t i = topo.cornerOffsets[n]; i < topo.cornerOffsets[n + 1];
+				i++) {
+			F += mesh.vertexLocations[backIndex
+					+ topo.halfEdgeFace(topo.vertexCorners[i])];
+		}
+		for (uint32_t r = topo.ringOffsets[n]; r < topo.ringOffsets[n + 1];
+				r++) {
+			R += mesh.vertexLocations[edgeIndex + topo.ringEdges[r]];
+		}
+		if (ecount > 0) {
+			F /= (float) fcount;
+			R /= (float) ecount;
+			newVerts[n] = (F + 2.0f * R + (ecount - 3.0f) * P) / (float) ecount;
+		} else {
+			newVerts[n] = P;
+		}
 	}
+	std::copy(newVerts.begin(), newVerts.end(), mesh.vertexLocations.data.begin());
 	if (hasUVs)
 		mesh.textureMap = uvs;
 	mesh.quadIndexes = newQuads;
@@ -2321,99 +2765,52 @@ void SubdivideCatmullClark(Mesh& mesh) {
 }
 void SubdivideLoop(Mesh& mesh) {
 	mesh.convertQuadsToTriangles();
-	std::map<uint64_t, FaceEdge> edgeTable;
-	std::set<uint2> edges;
-	uint2 edge;
-	uint fid = 0;
+	MeshTopologyPtr topoPtr = mesh.getTopology();
+	const MeshTopology& topo = *topoPtr;
 	bool hasUVs = mesh.textureMap.size() > 0;
 	bool hasColor = mesh.vertexColors.size() > 0;
-	for (const uint3& face : mesh.triIndexes.data) {
-		edge = (face.x < face.y) ?
-				uint2(face.x, face.y) : uint2(face.y, face.x);
-		edges.insert(edge);
-		edgeTable[faceHashCode(edge)].faces.push_back(fid);
-
-		edge = (face.y < face.z) ?
-				uint2(face.y, face.z) : uint2(face.z, face.y);
-		edges.insert(edge);
-		edgeTable[faceHashCode(edge)].faces.push_back(fid);
-
-		edge = (face.z < face.x) ?
-				uint2(face.z, face.x) : uint2(face.x, face.z);
-		edges.insert(edge);
-		edgeTable[faceHashCode(edge)].faces.push_back(fid);
-		fid++;
-	}
-
-	size_t backIndex = mesh.vertexLocations.size();
-	size_t endIndex = backIndex;
-	mesh.vertexLocations.resize(endIndex + edges.size());
+	const int triCount = (int) mesh.triIndexes.size();
+	const int edgeCount = (int) topo.edges.size();
+	const int vertCount = (int) mesh.vertexLocations.size();
+	const size_t backIndex = vertCount;
+	mesh.vertexLocations.resize(backIndex + edgeCount);
 	if (hasColor)
 		mesh.vertexColors.resize(mesh.vertexLocations.size());
-	for (uint2 edge : edges) {
+#pragma omp parallel for
+	for (int e = 0; e < edgeCount; e++) {
+		uint2 edge = topo.edges[e];
 		float3 pt1 = mesh.vertexLocations[edge.x];
 		float3 pt2 = mesh.vertexLocations[edge.y];
-		FaceEdge& fe = edgeTable[faceHashCode(edge)];
-		fe.edgePointIndex = endIndex;
 		float3 avg;
-		if (fe.faces.size() < 2) {
+		if (topo.edgeFaceCount(e) < 2 || edge.x == edge.y) {
 			avg = 0.5f * (pt1 + pt2);
 		} else {
-			uint3 face = mesh.triIndexes[fe.faces.front()];
-			int other1 = -1, other2 = -1;
-			if ((face.x == edge.x && face.y == edge.y)
-					|| (face.y == edge.x && face.x == edge.y)) {
-				other1 = face.z;
-			} else if ((face.y == edge.x && face.z == edge.y)
-					|| (face.z == edge.x && face.y == edge.y)) {
-				other1 = face.x;
-			} else if ((face.x == edge.x && face.z == edge.y)
-					|| (face.z == edge.x && face.x == edge.y)) {
-				other1 = face.y;
-			}
-			face = mesh.triIndexes[fe.faces.back()];
-			if ((face.x == edge.x && face.y == edge.y)
-					|| (face.y == edge.x && face.x == edge.y)) {
-				other2 = face.z;
-			} else if ((face.y == edge.x && face.z == edge.y)
-					|| (face.z == edge.x && face.y == edge.y)) {
-				other2 = face.x;
-			} else if ((face.x == edge.x && face.z == edge.y)
-					|| (face.z == edge.x && face.x == edge.y)) {
-				other2 = face.y;
-			}
-			if (other1 >= 0 && other2 >= 0) {
-				avg = 0.125f
-						* (3.0f * pt1 + 3.0f * pt2
-								+ mesh.vertexLocations[other1]
-								+ mesh.vertexLocations[other2]);
-			} else {
-				avg = 0.5f * (pt1 + pt2);
-			}
+			//The vertex opposite the edge in the first and last faces that share it.
+			uint32_t h1 = topo.edgeHalfEdges[topo.edgeOffsets[e]];
+			uint32_t h2 = topo.edgeHalfEdges[topo.edgeOffsets[e + 1] - 1];
+			uint32_t other1 = mesh.triIndexes[h1 / 3][(h1 + 2) % 3];
+			uint32_t other2 = mesh.triIndexes[h2 / 3][(h2 + 2) % 3];
+			avg = 0.125f
+					* (3.0f * pt1 + 3.0f * pt2 + mesh.vertexLocations[other1]
+							+ mesh.vertexLocations[other2]);
 		}
 		if (hasColor) {
-			mesh.vertexColors[endIndex] = 0.5f
+			mesh.vertexColors[backIndex + e] = 0.5f
 					* (mesh.vertexColors[edge.x] + mesh.vertexColors[edge.y]);
 		}
-		mesh.vertexLocations[endIndex++] = avg;
-	}
-	std::vector<uint3> newTris(4 * mesh.triIndexes.size());
-	size_t faceIndex = 0;
-	endIndex = backIndex;
-	fid = 0;
-	std::vector<float2> uvs(newTris.size() * 3);
-	size_t uvIndex = 0;
-	for (const uint3& face : mesh.triIndexes.data) {
-		edge = (face.x < face.y) ?
-				uint2(face.x, face.y) : uint2(face.y, face.x);
-		size_t ept1 = edgeTable[faceHashCode(edge)].edgePointIndex;
-		edge = (face.y < face.z) ?
-				uint2(face.y, face.z) : uint2(face.z, face.y);
-		size_t ept2 = edgeTable[faceHashCode(edge)].edgePointIndex;
-		edge = (face.z < face.x) ?
-				uint2(face.z, face.x) : uint2(face.x, face.z);
-		size_t ept3 = edgeTable[faceHashCode(edge)].edgePointIndex;
+		mesh.vertexLocations[backIndex + e] = avg;
+	}
+	std::vector<uint3> newTris(4 * triCount);
+	std::vector<float2> uvs((hasUVs) ? newTris.size() * 3 : 0);
+#pragma omp parallel for
+	for (int i = 0; i < triCount; i++) {
+		const uint3& face = mesh.triIndexes[i];
+		uint32_t ept1 = (uint32_t) backIndex + topo.halfEdgeEdges[3 * i];
+		uint32_t ept2 = (uint32_t) backIndex + topo.halfEdgeEdges[3 * i + 1];
+		uint32_t ept3 = (uint32_t) backIndex + topo.halfEdgeEdges[3 * i + 2];
 		if (hasUVs) {
+			size_t fid = 3 * (size_t) i;
+			size_t uvIndex = 12 * (size_t) i;
 			float2 uv1 = mesh.textureMap[fid];
 			float2 uv2 = mesh.textureMap[fid + 1];
 			float2 uv3 = mesh.textureMap[fid + 2];
@@ -2435,25 +2832,13 @@ void SubdivideLoop(Mesh& mesh) {
 			uvs[uvIndex++] = upt1;
 			uvs[uvIndex++] = upt2;
 			uvs[uvIndex++] = upt3;
-
-			fid += 3;
-		}
-		newTris[faceIndex++] = uint3(face.x, (uint32_t) ept1, (uint32_t) ept3);
-		newTris[faceIndex++] = uint3(face.y, (uint32_t) ept2, (uint32_t) ept1);
-		newTris[faceIndex++] = uint3(face.z, (uint32_t) ept3, (uint32_t) ept2);
-		newTris[faceIndex++] = uint3((uint32_t) ept1, (uint32_t) ept2,
-				(uint32_t) ept3);
-	}
-	std::vector<std::set<uint32_t>> vertNbrs(mesh.vertexLocations.size());
-	for (const uint3& face : mesh.triIndexes.data) {
-		vertNbrs[face.x].insert(face.y);
-		vertNbrs[face.y].insert(face.z);
-		vertNbrs[face.z].insert(face.x);
-		vertNbrs[face.z].insert(face.y);
-		vertNbrs[face.y].insert(face.x);
-		vertNbrs[face.x].insert(face.z);
+		}
+		size_t faceIndex = 4 * (size_t) i;
+		newTris[faceIndex++] = uint3(face.x, ept1, ept3);
+		newTris[faceIndex++] = uint3(face.y, ept2, ept1);
+		newTris[faceIndex++] = uint3(face.z, ept3, ept2);
+		newTris[faceIndex++] = uint3(ept1, ept2, ept3);
 	}
-	mesh.triIndexes = newTris;
 	const int MAX_VALENCE = 32;
 	static std::vector<float> valenceWeights;
 	if (valenceWeights.size() == 0) {
@@ -2464,19 +2849,25 @@ void SubdivideLoop(Mesh& mesh) {
 			valenceWeights[i] = beta;
 		}
 	}
-
-	for (int n = 0; n < (int) backIndex; n++) {
-		int N = (int) vertNbrs[n].size();
+	//Every vertex is smoothed from the positions before subdivision.
+	std::vector<float3> newVerts(vertCount);
+#pragma omp parallel for
+	for (int n = 0; n < vertCount; n++) {
+		int N = (int) topo.ringSize(n);
+		float3 pt = mesh.vertexLocations[n];
 		if (N > 0 && N < MAX_VALENCE) {
 			float beta = valenceWeights[N];
 			float alpha = (1 - N * beta);
-			float3 pt = alpha * mesh.vertexLocations[n];
-			for (uint32_t nbr : vertNbrs[n]) {
-				pt += beta * mesh.vertexLocations[nbr];
+			pt = alpha * pt;
+			for (uint32_t r = topo.ringOffsets[n]; r < topo.ringOffsets[n + 1];
+					r++) {
+				pt += beta * mesh.vertexLocations[topo.ringVertices[r]];
 			}
-			mesh.vertexLocations[n] = pt;
 		}
+		newVerts[n] = pt;
 	}
+	std::copy(newVerts.begin(), newVerts.end(), mesh.vertexLocations.data.begin());
+	mesh.triIndexes = newTris;
 	if (hasUVs)
 		mesh.textureMap = uvs;
 	if (mesh.vertexNormals.size() > 0)
@@ -2484,11 +2875,13 @@ void SubdivideLoop(Mesh& mesh) {
 	mesh.setType(GLMesh::PrimitiveType::TRIANGLES);
 	mesh.setDirty(true);
 }
-void Subdivide(Mesh& mesh, SubDivisionScheme type) {
-	if (type == SubDivisionScheme::CatmullClark) {
-		SubdivideCatmullClark(mesh);
-	} else if (type == SubDivisionScheme::Loop) {
-		SubdivideLoop(mesh);
+void Subdivide(Mesh& mesh, SubDivisionScheme type, int levels) {
+	for (int l = 0; l < levels; l++) {
+		if (type == SubDivisionScheme::CatmullClark) {
+			SubdivideCatmullClark(mesh);
+		} else if (type == SubDivisionScheme::Loop) {
+			SubdivideLoop(mesh);
+		}
 	}
 }
 } /* namespace imagesci */
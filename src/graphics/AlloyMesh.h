@@ -22,11 +22,15 @@
 #define ALLOYMESH_H_
 
 #include <mutex>
+#include <memory>
 #include "graphics/GLComponent.h"
 #include "math/AlloyVector.h"
 #include "math/AlloyVecMath.h"
 #include "image/AlloyImage.h"
 #include "ui/AlloyContext.h"
+#include "graphics/AlloyPLY.h"
+#include "graphics/AlloyMeshTopology.h"
+#include "system/AlloyMemMappedFile.h"
 #include <vector>
 #include <set>
 #include <unordered_set>
@@ -34,6 +38,8 @@
 
 namespace aly {
 bool SANITY_CHECK_SUBDIVIDE();
+bool SANITY_CHECK_PLY_STREAM();
+bool SANITY_CHECK_MESH_TOPOLOGY();
 class Mesh;
 enum class SubDivisionScheme {
 	CatmullClark, Loop
@@ -90,6 +96,7 @@ class Mesh {
 private:
 	bool dirty = false;
 	GLMesh::PrimitiveType type = GLMesh::PrimitiveType::ALL;
+	mutable std::shared_ptr<MeshTopology> topology;
 protected:
 	box3f boundingBox;
 public:
@@ -123,6 +130,7 @@ public:
 		mesh.textureImage = textureImage;
 		mesh.pose = pose;
 		mesh.type = type;
+		mesh.topology = std::atomic_load(&topology);
 		mesh.dirty = true;
 	}
 	void flipNormals();
@@ -166,6 +174,15 @@ public:
 	bool load(const std::string& file);
 	void updateVertexNormals(bool flipSign = false, int SMOOTH_ITERATIONS = 0,
 			float DOT_TOLERANCE = 0.75f);
+	/*
+	 Connectivity of the triangles and quads. It is rebuilt on demand when the vertex count or face indexes change.
+	 Concurrent calls are safe while the mesh is not being modified. A rebuild replaces the cached topology, so
+	 hold the returned pointer for as long as the topology is read; it describes the faces at the time of the call.
+	 */
+	MeshTopologyPtr getTopology(bool halfEdges = false) const;
+	void invalidateTopology() {
+		std::atomic_store(&topology, std::shared_ptr<MeshTopology>());
+	}
 
 	bool convertQuadsToTriangles();
 	void mapIntoBoundingBox(float voxelSize);
@@ -204,6 +221,44 @@ void WritePlyMeshToFile(const std::string& file, const Mesh& mesh, bool binary =
 		true);
 void WriteMeshToFile(const std::string& file, const Mesh& mesh);
 void WriteObjMeshToFile(const std::string& file, const Mesh& mesh);
+/*
+ Reads the vertices of a binary PLY file in chunks through a sliding memory
+ map, so point clouds larger than memory can be fed to other code without
+ building a Mesh. Vertex records must have a fixed stride.
+ */
+class PlyPointReader {
+protected:
+	ReadableMemMapFile mapped;
+	ply::PlyVertexFormat format;
+	uint64_t dataOffset;
+	uint64_t count;
+	uint64_t position;
+public:
+	PlyPointReader();
+	PlyPointReader(const std::string& file);
+	PlyPointReader(const PlyPointReader&) = delete;
+	PlyPointReader& operator=(const PlyPointReader&) = delete;
+	void open(const std::string& file);
+	void close();
+	uint64_t size() const {
+		return count;
+	}
+	uint64_t tell() const {
+		return position;
+	}
+	void seek(uint64_t index) {
+		position = std::min(index, count);
+	}
+	bool hasNormals() const {
+		return format.hasNormals();
+	}
+	bool hasColors() const {
+		return format.hasColors();
+	}
+	//Reads up to maxCount points from the current position and returns how many were read, or zero at the end. Normals and colors are optional.
+	size_t read(std::vector<float3>& points, std::vector<float3>* normals,
+			std::vector<float4>* colors, size_t maxCount);
+};
 typedef std::vector<std::unordered_set<uint32_t>> MeshSetNeighborTable;
 typedef std::vector<std::vector<uint32_t>> MeshListNeighborTable;
 void CreateVertexNeighborTable(const Mesh& mesh,
@@ -224,7 +279,8 @@ inline void MakeFaceNeighborTable(const Mesh& mesh,
 		MeshListNeighborTable& faceNbrs) {
 	CreateFaceNeighborTable(mesh, faceNbrs);
 }
+//Uniform subdivision. SubdivisionStencils refines part of a mesh or re-evaluates a deformed mesh without rebuilding topology.
 void Subdivide(Mesh& mesh, SubDivisionScheme type =
-		SubDivisionScheme::CatmullClark);
+		SubDivisionScheme::CatmullClark, int levels = 1);
 }
 #endif /* MESH_H_ */
@@ -501,9 +501,7 @@ namespace aly {
 			quadIndexes.push_back(uint4(4, 0, 1, 5));
 			subdivisions++;
 		}
-		for (int n = 0;n < subdivisions;n++) {
-			Subdivide(*this, scheme);
-		}
+		Subdivide(*this, scheme, subdivisions);
 		vertexNormals.resize(vertexLocations.size());
 		for (int n = 0;n < (int)vertexLocations.size();n++) {
 			float3 pt = vertexLocations[n];
@@ -0,0 +1,261 @@
+/*
+ * Copyright(C) 2015, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "graphics/AlloyMeshTopology.h"
+#include <algorithm>
+namespace aly {
+const uint32_t MeshTopology::NO_HALF_EDGE;
+/*
+ Groups items [0,count) into buckets with a counting sort and stores
+ valueOf(n) for each one. The scatter is stable, so items within a bucket stay
+ in increasing order no matter how many threads computed the buckets.
+ */
+template<class T, class B, class F> static void BucketSort(int64_t count,
+		uint32_t bucketCount, const B& bucketOf, const F& valueOf,
+		std::vector<uint32_t>& offsets, std::vector<T>& items) {
+	std::vector<uint32_t> buckets(count);
+#pragma omp parallel for
+	for (int64_t n = 0; n < count; n++) {
+		buckets[n] = bucketOf((uint32_t) n);
+	}
+	offsets.assign(bucketCount + 1, 0);
+	for (int64_t n = 0; n < count; n++) {
+		offsets[buckets[n] + 1]++;
+	}
+	for (uint32_t b = 0; b < bucketCount; b++) {
+		offsets[b + 1] += offsets[b];
+	}
+	std::vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+	items.resize(count);
+	for (int64_t n = 0; n < count; n++) {
+		items[next[buckets[n]]++] = valueOf((uint32_t) n);
+	}
+}
+static inline uint64_t MixFaceHash(uint64_t h) {
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ULL;
+	h ^= h >> 33;
+	return h;
+}
+uint64_t MeshTopology::hashFaces(const std::vector<uint3>& tris,
+		const std::vector<uint4>& quads) {
+	uint64_t hash = 0;
+	const uint64_t triTotal = tris.size();
+#pragma omp parallel for reduction(+:hash)
+	for (int64_t i = 0; i < (int64_t) tris.size(); i++) {
+		const uint3& f = tris[i];
+		hash += MixFaceHash(
+				(((uint64_t) f.x << 42) ^ ((uint64_t) f.y << 21) ^ f.z)
+						+ (uint64_t) i * 0x9E3779B97F4A7C15ULL);
+	}
+#pragma omp parallel for reduction(+:hash)
+	for (int64_t i = 0; i < (int64_t) quads.size(); i++) {
+		const uint4& f = quads[i];
+		hash += MixFaceHash(
+				(((uint64_t) f.x << 48) ^ ((uint64_t) f.y << 32)
+						^ ((uint64_t) f.z << 16) ^ f.w)
+						+ (triTotal + i) * 0x9E3779B97F4A7C15ULL);
+	}
+	return hash;
+}
+void MeshTopology::clear() {
+	vertexCount = 0;
+	triCount = 0;
+	quadCount = 0;
+	faceHash = 0;
+	edges.clear();
+	vertexEdgeOffsets.clear();
+	edgeOffsets.clear();
+	edgeHalfEdges.clear();
+	halfEdgeEdges.clear();
+	ringOffsets.clear();
+	ringVertices.clear();
+	ringEdges.clear();
+	cornerOffsets.clear();
+	vertexCorners.clear();
+	opposite.clear();
+}
+uint32_t MeshTopology::findEdge(uint32_t a, uint32_t b) const {
+	if (a > b) {
+		std::swap(a, b);
+	}
+	if (a >= vertexCount) {
+		return NO_HALF_EDGE;
+	}
+	auto begin = edges.begin() + vertexEdgeOffsets[a];
+	auto end = edges.begin() + vertexEdgeOffsets[a + 1];
+	auto it = std::lower_bound(begin, end, b,
+			[](const uint2& e, uint32_t y) {
+				return e.y < y;
+			});
+	if (it != end && it->y == b) {
+		return (uint32_t) (it - edges.begin());
+	}
+	return NO_HALF_EDGE;
+}
+void MeshTopology::build(size_t vertices, const std::vector<uint3>& tris,
+		const std::vector<uint4>& quads, bool halfEdges) {
+	clear();
+	vertexCount = (uint32_t) vertices;
+	triCount = (uint32_t) tris.size();
+	quadCount = (uint32_t) quads.size();
+	faceHash = hashFaces(tris, quads);
+	const int64_t H = (int64_t) halfEdgeCount();
+	const int64_t V = vertexCount;
+	const int64_t quadStart = 3 * (int64_t) triCount;
+	//Origin and target of every half-edge.
+	std::vector<uint2> ends(H);
+#pragma omp parallel for
+	for (int64_t t = 0; t < (int64_t) triCount; t++) {
+		const uint3& f = tris[t];
+		ends[3 * t] = uint2(f.x, f.y);
+		ends[3 * t + 1] = uint2(f.y, f.z);
+		ends[3 * t + 2] = uint2(f.z, f.x);
+	}
+#pragma omp parallel for
+	for (int64_t q = 0; q < (int64_t) quadCount; q++) {
+		const uint4& f = quads[q];
+		ends[quadStart + 4 * q] = uint2(f.x, f.y);
+		ends[quadStart + 4 * q + 1] = uint2(f.y, f.z);
+		ends[quadStart + 4 * q + 2] = uint2(f.z, f.w);
+		ends[quadStart + 4 * q + 3] = uint2(f.w, f.x);
+	}
+	auto identity = [](uint32_t n) {
+		return n;
+	};
+	BucketSort(H, vertexCount, [&](uint32_t h) {
+		return ends[h].x;
+	}, identity, cornerOffsets, vertexCorners);
+	//Half-edges grouped by lower vertex and keyed by upper vertex, so once sorted each edge is one run of the array.
+	std::vector<uint32_t> lowOffsets;
+	std::vector<uint64_t> lowKeys;
+	BucketSort(H, vertexCount, [&](uint32_t h) {
+		return std::min(ends[h].x, ends[h].y);
+	}, [&](uint32_t h) {
+		return ((uint64_t) std::max(ends[h].x, ends[h].y) << 32) | h;
+	}, lowOffsets, lowKeys);
+	vertexEdgeOffsets.resize(V + 1);
+	vertexEdgeOffsets[0] = 0;
+#pragma omp parallel for
+	for (int64_t v = 0; v < V; v++) {
+		//Buckets are small, so an insertion sort is enough.
+		uint32_t begin = lowOffsets[v], end = lowOffsets[v + 1];
+		for (uint32_t i = begin + 1; i < end; i++) {
+			uint64_t key = lowKeys[i];
+			uint32_t j = i;
+			for (; j > begin && lowKeys[j - 1] > key; j--) {
+				lowKeys[j] = lowKeys[j - 1];
+			}
+			lowKeys[j] = key;
+		}
+		uint32_t count = 0;
+		for (uint32_t i = begin; i < end; i++) {
+			if (i == begin || (lowKeys[i] >> 32) != (lowKeys[i - 1] >> 32)) {
+				count++;
+			}
+		}
+		vertexEdgeOffsets[v + 1] = count;
+	}
+	for (int64_t v = 0; v < V; v++) {
+		vertexEdgeOffsets[v + 1] += vertexEdgeOffsets[v];
+	}
+	const int64_t E = vertexEdgeOffsets[V];
+	edges.resize(E);
+	edgeOffsets.resize(E + 1);
+	edgeOffsets[E] = (uint32_t) H;
+	edgeHalfEdges.resize(H);
+	halfEdgeEdges.resize(H);
+#pragma omp parallel for
+	for (int64_t v = 0; v < V; v++) {
+		uint32_t e = vertexEdgeOffsets[v];
+		for (uint32_t i = lowOffsets[v]; i < lowOffsets[v + 1]; i++) {
+			uint32_t h = (uint32_t) lowKeys[i];
+			uint32_t hi = (uint32_t) (lowKeys[i] >> 32);
+			if (i == lowOffsets[v] || hi != edges[e].y) {
+				if (i != lowOffsets[v]) {
+					e++;
+				}
+				edges[e] = uint2((uint32_t) v, hi);
+				edgeOffsets[e] = i;
+			}
+			edgeHalfEdges[i] = h;
+			halfEdgeEdges[h] = e;
+		}
+	}
+	//Rings list lower neighbors first, found by grouping edges by their upper vertex, so both neighbors and edges come out sorted.
+	std::vector<uint32_t> upperOffsets, upperEdges;
+	BucketSort(E, vertexCount, [&](uint32_t e) {
+		return edges[e].y;
+	}, identity, upperOffsets, upperEdges);
+	ringOffsets.resize(V + 1);
+	ringOffsets[0] = 0;
+#pragma omp parallel for
+	for (int64_t v = 0; v < V; v++) {
+		uint32_t count = (upperOffsets[v + 1] - upperOffsets[v])
+				+ (vertexEdgeOffsets[v + 1] - vertexEdgeOffsets[v]);
+		//A degenerate face can produce the edge (v,v), which is in both lists and is left out.
+		if (vertexEdgeOffsets[v + 1] > vertexEdgeOffsets[v]
+				&& edges[vertexEdgeOffsets[v]].y == v) {
+			count -= 2;
+		}
+		ringOffsets[v + 1] = count;
+	}
+	for (int64_t v = 0; v < V; v++) {
+		ringOffsets[v + 1] += ringOffsets[v];
+	}
+	ringVertices.resize(ringOffsets[V]);
+	ringEdges.resize(ringOffsets[V]);
+#pragma omp parallel for
+	for (int64_t v = 0; v < V; v++) {
+		uint32_t r = ringOffsets[v];
+		for (uint32_t i = upperOffsets[v]; i < upperOffsets[v + 1]; i++) {
+			uint32_t e = upperEdges[i];
+			if (edges[e].x != v) {
+				ringVertices[r] = edges[e].x;
+				ringEdges[r++] = e;
+			}
+		}
+		for (uint32_t e = vertexEdgeOffsets[v]; e < vertexEdgeOffsets[v + 1];
+				e++) {
+			if (edges[e].y != v) {
+				ringVertices[r] = edges[e].y;
+				ringEdges[r++] = e;
+			}
+		}
+	}
+	if (halfEdges) {
+		opposite.assign(H, NO_HALF_EDGE);
+#pragma omp parallel for
+		for (int64_t e = 0; e < E; e++) {
+			if (edgeOffsets[e + 1] - edgeOffsets[e] == 2) {
+				uint32_t h0 = edgeHalfEdges[edgeOffsets[e]];
+				uint32_t h1 = edgeHalfEdges[edgeOffsets[e] + 1];
+				if (ends[h0].x == ends[h1].y && ends[h0].y == ends[h1].x
+						&& ends[h0].x != ends[h0].y) {
+					opposite[h0] = h1;
+					opposite[h1] = h0;
+				}
+			}
+		}
+	}
+}
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright(C) 2015, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef ALLOYMESHTOPOLOGY_H_
+#define ALLOYMESHTOPOLOGY_H_
+#include "math/AlloyVecMath.h"
+#include <vector>
+#include <memory>
+#include <stdint.h>
+namespace aly {
+/*
+ Connectivity of a mesh made of triangles and quads, stored in flat arrays.
+ Half-edge 3*t+k runs from corner k to corner k+1 of triangle t, and half-edges
+ of quads follow those of the triangles with four per quad, so half-edges are
+ also the face corners. Face ids count triangles first, then quads. Every array
+ is built with counting sorts and passes over the vertices; there is no
+ per-vertex allocation.
+ */
+struct MeshTopology {
+	static const uint32_t NO_HALF_EDGE = 0xFFFFFFFF;
+	uint32_t vertexCount;
+	uint32_t triCount;
+	uint32_t quadCount;
+	//Fingerprint of the face indexes, used by Mesh to tell when the topology is stale.
+	uint64_t faceHash;
+	//Unique undirected edges sorted by (x,y) with x <= y. Only degenerate faces give x == y.
+	std::vector<uint2> edges;
+	//Edges starting at vertex v are [vertexEdgeOffsets[v], vertexEdgeOffsets[v+1]).
+	std::vector<uint32_t> vertexEdgeOffsets;
+	//Half-edges on edge e are edgeHalfEdges[edgeOffsets[e]..edgeOffsets[e+1]), in increasing order.
+	std::vector<uint32_t> edgeOffsets;
+	std::vector<uint32_t> edgeHalfEdges;
+	std::vector<uint32_t> halfEdgeEdges;
+	//Sorted neighbors of vertex v and the edges that lead to them, [ringOffsets[v], ringOffsets[v+1]).
+	std::vector<uint32_t> ringOffsets;
+	std::vector<uint32_t> ringVertices;
+	std::vector<uint32_t> ringEdges;
+	//Half-edges leaving vertex v (its face corners) in increasing order, [cornerOffsets[v], cornerOffsets[v+1]).
+	std::vector<uint32_t> cornerOffsets;
+	std::vector<uint32_t> vertexCorners;
+	//Half-edge on the other side of a manifold edge, or NO_HALF_EDGE. Only filled when built with half-edges.
+	std::vector<uint32_t> opposite;
+	MeshTopology() :
+			vertexCount(0), triCount(0), quadCount(0), faceHash(0) {
+	}
+	void build(size_t vertexCount, const std::vector<uint3>& tris,
+			const std::vector<uint4>& quads, bool halfEdges = false);
+	void clear();
+	static uint64_t hashFaces(const std::vector<uint3>& tris,
+			const std::vector<uint4>& quads);
+	size_t halfEdgeCount() const {
+		return 3 * (size_t) triCount + 4 * (size_t) quadCount;
+	}
+	size_t faceCount() const {
+		return (size_t) triCount + quadCount;
+	}
+	uint32_t halfEdgeFace(uint32_t h) const {
+		return (h < 3 * triCount) ? h / 3 : triCount + (h - 3 * triCount) / 4;
+	}
+	//Position of half-edge h within its face.
+	uint32_t halfEdgeCorner(uint32_t h) const {
+		return (h < 3 * triCount) ? h % 3 : (h - 3 * triCount) % 4;
+	}
+	uint32_t faceSize(uint32_t f) const {
+		return (f < triCount) ? 3 : 4;
+	}
+	uint32_t faceHalfEdge(uint32_t f) const {
+		return (f < triCount) ? 3 * f : 3 * triCount + 4 * (f - triCount);
+	}
+	//Half-edges after and before h around its face.
+	uint32_t nextHalfEdge(uint32_t h) const {
+		uint32_t n = (h < 3 * triCount) ? 3 : 4;
+		uint32_t k = halfEdgeCorner(h);
+		return (k + 1 < n) ? h + 1 : h - k;
+	}
+	uint32_t prevHalfEdge(uint32_t h) const {
+		uint32_t n = (h < 3 * triCount) ? 3 : 4;
+		uint32_t k = halfEdgeCorner(h);
+		return (k > 0) ? h - 1 : h + n - 1;
+	}
+	uint32_t edgeFaceCount(uint32_t e) const {
+		return edgeOffsets[e + 1] - edgeOffsets[e];
+	}
+	bool isBoundaryEdge(uint32_t e) const {
+		return (edgeFaceCount(e) == 1);
+	}
+	uint32_t ringSize(uint32_t v) const {
+		return ringOffsets[v + 1] - ringOffsets[v];
+	}
+	uint32_t cornerCount(uint32_t v) const {
+		return cornerOffsets[v + 1] - cornerOffsets[v];
+	}
+	//Index of edge (a,b) in either order, or NO_HALF_EDGE if there is none.
+	uint32_t findEdge(uint32_t a, uint32_t b) const;
+	bool hasHalfEdges() const {
+		return (opposite.size() == halfEdgeCount());
+	}
+};
+typedef std::shared_ptr<const MeshTopology> MeshTopologyPtr;
+}
+#endif
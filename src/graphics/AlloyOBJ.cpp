@@ -0,0 +1,428 @@
+/*
+ * Copyright(C) 2015, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "graphics/AlloyOBJ.h"
+#include "common/AlloyCommon.h"
+#include "system/AlloyMemMappedFile.h"
+#include <cstring>
+#include <cstdlib>
+#include <stdexcept>
+#include <algorithm>
+#include <limits>
+namespace aly {
+namespace obj {
+void ObjFile::clear() {
+	positions.clear();
+	colors.clear();
+	normals.clear();
+	texcoords.clear();
+	corners.clear();
+	faceOffsets.clear();
+	groups.clear();
+	materialLibraries.clear();
+}
+static inline bool IsSpace(char c) {
+	return (c == ' ' || c == '\t' || c == '\r');
+}
+static inline bool IsDigit(char c) {
+	return (c >= '0' && c <= '9');
+}
+static inline void SkipSpace(const char*& p, const char* end) {
+	while (p < end && IsSpace(*p)) {
+		p++;
+	}
+}
+static bool ParseFloatFallback(const char*& p, const char* end, float& value) {
+	const char* s = p;
+	while (s < end && !IsSpace(*s)) {
+		s++;
+	}
+	std::string token(p, s);
+	char* stop = nullptr;
+	double d = std::strtod(token.c_str(), &stop);
+	if (stop == token.c_str()) {
+		return false;
+	}
+	p += (stop - token.c_str());
+	value = (float) d;
+	return true;
+}
+bool ParseFloat(const char*& p, const char* end, float& value) {
+	static const double POW10[] = { 1E0, 1E1, 1E2, 1E3, 1E4, 1E5, 1E6, 1E7,
+			1E8, 1E9, 1E10, 1E11, 1E12, 1E13, 1E14, 1E15, 1E16, 1E17, 1E18,
+			1E19, 1E20, 1E21, 1E22 };
+	const uint64_t MAX_MANTISSA = 100000000000000000ULL;
+	const char* s = p;
+	bool negative = false;
+	if (s < end && (*s == '-' || *s == '+')) {
+		negative = (*s == '-');
+		s++;
+	}
+	uint64_t mantissa = 0;
+	int exponent = 0;
+	bool digits = false;
+	bool truncated = false;
+	while (s < end && IsDigit(*s)) {
+		if (mantissa < MAX_MANTISSA) {
+			mantissa = 10 * mantissa + (*s - '0');
+		} else {
+			exponent++;
+			truncated = true;
+		}
+		digits = true;
+		s++;
+	}
+	if (s < end && *s == '.') {
+		s++;
+		while (s < end && IsDigit(*s)) {
+			if (mantissa < MAX_MANTISSA) {
+				mantissa = 10 * mantissa + (*s - '0');
+				exponent--;
+			} else {
+				truncated = true;
+			}
+			digits = true;
+			s++;
+		}
+	}
+	if (!digits) {
+		//inf, nan and anything else strtod accepts.
+		return ParseFloatFallback(p, end, value);
+	}
+	if (s < end && (*s == 'e' || *s == 'E')) {
+		const char* e = s + 1;
+		bool negativeExponent = false;
+		if (e < end && (*e == '-' || *e == '+')) {
+			negativeExponent = (*e == '-');
+			e++;
+		}
+		if (e < end && IsDigit(*e)) {
+			int power = 0;
+			while (e < end && IsDigit(*e)) {
+				if (power < 100000) {
+					power = 10 * power + (*e - '0');
+				}
+				e++;
+			}
+			exponent += (negativeExponent) ? -power : power;
+			s = e;
+		}
+	}
+	if (mantissa == 0) {
+		value = (negative) ? -0.0f : 0.0f;
+	} else if (!truncated && mantissa <= (1ULL << 53) && exponent >= -22
+			&& exponent <= 22) {
+		//Both the mantissa and the power of ten are exact doubles, so this is correctly rounded.
+		double d = (double) mantissa;
+		d = (exponent < 0) ? d / POW10[-exponent] : d * POW10[exponent];
+		value = (float) ((negative) ? -d : d);
+	} else {
+		return ParseFloatFallback(p, end, value);
+	}
+	p = s;
+	return true;
+}
+bool ParseInt(const char*& p, const char* end, int64_t& value) {
+	const char* s = p;
+	bool negative = false;
+	if (s < end && (*s == '-' || *s == '+')) {
+		negative = (*s == '-');
+		s++;
+	}
+	if (s >= end || !IsDigit(*s)) {
+		return false;
+	}
+	int64_t v = 0;
+	while (s < end && IsDigit(*s)) {
+		if (v < ((int64_t) 1 << 40)) {
+			v = 10 * v + (*s - '0');
+		}
+		s++;
+	}
+	value = (negative) ? -v : v;
+	p = s;
+	return true;
+}
+struct ObjChunk {
+	ObjFile data;
+	//Corner components that used relative indexes, stored as 3*corner+component.
+	std::vector<size_t> relative;
+	std::string error;
+};
+static int32_t ResolveIndex(int64_t index, size_t count, ObjChunk& chunk,
+		int component) {
+	if (index > 0 && index <= std::numeric_limits<int32_t>::max()) {
+		return (int32_t) (index - 1);
+	}
+	if (index < 0 && index >= -(int64_t) std::numeric_limits<int32_t>::max()) {
+		//Resolved against this chunk's vertices for now and shifted once the chunk offsets are known.
+		chunk.relative.push_back(3 * chunk.data.corners.size() + component);
+		return (int32_t) ((int64_t) count + index);
+	}
+	throw std::runtime_error(
+			MakeString() << "Invalid OBJ index " << index << ".");
+}
+static std::string ParseName(const char*& p, const char* end) {
+	SkipSpace(p, end);
+	const char* s = p;
+	while (p < end && !IsSpace(*p)) {
+		p++;
+	}
+	return std::string(s, p);
+}
+template<int N> static void ParseFloats(const char*& p, const char* end,
+		float* values, int required, const char* type) {
+	for (int k = 0; k < N; k++) {
+		SkipSpace(p, end);
+		if (p == end || !ParseFloat(p, end, values[k])) {
+			if (k < required) {
+				throw std::runtime_error(
+						MakeString() << "Malformed OBJ " << type << ".");
+			}
+			values[k] = 0.0f;
+		}
+	}
+}
+static void ParseObjLine(const char* p, const char* end, ObjChunk& chunk) {
+	ObjFile& out = chunk.data;
+	SkipSpace(p, end);
+	if (p == end || *p == '#') {
+		return;
+	}
+	const char* key = p;
+	while (p < end && !IsSpace(*p)) {
+		p++;
+	}
+	size_t len = p - key;
+	if (len == 1 && key[0] == 'v') {
+		float values[6];
+		int count = 3;
+		ParseFloats<3>(p, end, values, 3, "vertex");
+		SkipSpace(p, end);
+		//A fourth value alone is a homogeneous weight, three more are a color.
+		while (count < 6 && p < end && ParseFloat(p, end, values[count])) {
+			count++;
+			SkipSpace(p, end);
+		}
+		out.positions.push_back(float3(values[0], values[1], values[2]));
+		if (count == 6) {
+			out.colors.resize(out.positions.size() - 1, float3(0.0f));
+			out.colors.push_back(float3(values[3], values[4], values[5]));
+		}
+	} else if (len == 2 && key[0] == 'v' && key[1] == 'n') {
+		float values[3];
+		ParseFloats<3>(p, end, values, 3, "normal");
+		out.normals.push_back(float3(values[0], values[1], values[2]));
+	} else if (len == 2 && key[0] == 'v' && key[1] == 't') {
+		float values[2];
+		ParseFloats<2>(p, end, values, 1, "texture coordinate");
+		out.texcoords.push_back(float2(values[0], values[1]));
+	} else if (len == 1 && key[0] == 'f') {
+		size_t first = out.corners.size();
+		while (true) {
+			SkipSpace(p, end);
+			if (p == end) {
+				break;
+			}
+			Corner c;
+			c.vt = -1;
+			c.vn = -1;
+			int64_t index;
+			if (!ParseInt(p, end, index)) {
+				throw std::runtime_error("Malformed OBJ face.");
+			}
+			c.v = ResolveIndex(index, out.positions.size(), chunk, 0);
+			if (p < end && *p == '/') {
+				p++;
+				if (ParseInt(p, end, index)) {
+					c.vt = ResolveIndex(index, out.texcoords.size(), chunk, 1);
+				}
+				if (p < end && *p == '/') {
+					p++;
+					if (!ParseInt(p, end, index)) {
+						throw std::runtime_error("Malformed OBJ face.");
+					}
+					c.vn = ResolveIndex(index, out.normals.size(), chunk, 2);
+				}
+			}
+			out.corners.push_back(c);
+		}
+		if (out.corners.size() == first) {
+			throw std::runtime_error("OBJ face without vertices.");
+		}
+		out.faceOffsets.push_back((uint32_t) out.corners.size());
+	} else if (len == 1 && (key[0] == 'g' || key[0] == 'o')) {
+		GroupEvent event;
+		event.face = out.faceCount();
+		event.type = (key[0] == 'g') ? GroupType::Group : GroupType::Object;
+		event.name = ParseName(p, end);
+		out.groups.push_back(event);
+	} else if (len == 6 && std::strncmp(key, "usemtl", 6) == 0) {
+		GroupEvent event;
+		event.face = out.faceCount();
+		event.type = GroupType::Material;
+		event.name = ParseName(p, end);
+		out.groups.push_back(event);
+	} else if (len == 6 && std::strncmp(key, "mtllib", 6) == 0) {
+		while (true) {
+			std::string name = ParseName(p, end);
+			if (name.size() == 0) {
+				break;
+			}
+			out.materialLibraries.push_back(name);
+		}
+	}
+	//Other statements (s, l, p, curves) are ignored.
+}
+void ParseObjFile(const char* data, size_t size, ObjFile& out) {
+	const size_t CHUNK_SIZE = 1 << 20;
+	out.clear();
+	int chunkCount = (int) std::max((size_t) 1,
+			(size + CHUNK_SIZE - 1) / CHUNK_SIZE);
+	std::vector<size_t> bounds(chunkCount + 1, size);
+	bounds[0] = 0;
+	for (int k = 1; k < chunkCount; k++) {
+		size_t start = std::max(bounds[k - 1], (size_t) k * (size / chunkCount));
+		const char* eol = (start < size) ?
+				(const char*) std::memchr(data + start, '\n', size - start) :
+				nullptr;
+		bounds[k] = (eol != nullptr) ? (eol - data) + 1 : size;
+	}
+	std::vector<ObjChunk> chunks(chunkCount);
+#pragma omp parallel for schedule(dynamic)
+	for (int k = 0; k < chunkCount; k++) {
+		ObjChunk& chunk = chunks[k];
+		chunk.data.faceOffsets.push_back(0);
+		const char* p = data + bounds[k];
+		const char* end = data + bounds[k + 1];
+		try {
+			while (p < end) {
+				const char* eol = (const char*) std::memchr(p, '\n', end - p);
+				if (eol == nullptr) {
+					eol = end;
+				}
+				ParseObjLine(p, eol, chunk);
+				p = eol + 1;
+			}
+		} catch (std::exception& e) {
+			chunk.error = e.what();
+		}
+	}
+	//Chunk offsets into the combined arrays.
+	std::vector<size_t> positionOffsets(chunkCount + 1, 0);
+	std::vector<size_t> normalOffsets(chunkCount + 1, 0);
+	std::vector<size_t> texOffsets(chunkCount + 1, 0);
+	std::vector<size_t> cornerOffsets(chunkCount + 1, 0);
+	std::vector<size_t> faceOffsets(chunkCount + 1, 0);
+	bool hasColors = false;
+	for (int k = 0; k < chunkCount; k++) {
+		const ObjFile& chunk = chunks[k].data;
+		if (chunks[k].error.size() > 0) {
+			throw std::runtime_error(chunks[k].error);
+		}
+		positionOffsets[k + 1] = positionOffsets[k] + chunk.positions.size();
+		normalOffsets[k + 1] = normalOffsets[k] + chunk.normals.size();
+		texOffsets[k + 1] = texOffsets[k] + chunk.texcoords.size();
+		cornerOffsets[k + 1] = cornerOffsets[k] + chunk.corners.size();
+		faceOffsets[k + 1] = faceOffsets[k] + chunk.faceCount();
+		hasColors |= (chunk.colors.size() > 0);
+	}
+	if (cornerOffsets[chunkCount] > std::numeric_limits<uint32_t>::max()
+			|| positionOffsets[chunkCount]
+					> (size_t) std::numeric_limits<int32_t>::max()) {
+		throw std::runtime_error("OBJ file is too large.");
+	}
+	out.positions.resize(positionOffsets[chunkCount]);
+	out.normals.resize(normalOffsets[chunkCount]);
+	out.texcoords.resize(texOffsets[chunkCount]);
+	out.corners.resize(cornerOffsets[chunkCount]);
+	out.faceOffsets.resize(faceOffsets[chunkCount] + 1);
+	out.faceOffsets.back() = (uint32_t) cornerOffsets[chunkCount];
+	if (hasColors) {
+		out.colors.resize(out.positions.size(), float3(0.0f));
+	}
+#pragma omp parallel for schedule(dynamic)
+	for (int k = 0; k < chunkCount; k++) {
+		ObjChunk& chunk = chunks[k];
+		ObjFile& in = chunk.data;
+		const int32_t shift[3] = { (int32_t) positionOffsets[k],
+				(int32_t) texOffsets[k], (int32_t) normalOffsets[k] };
+		for (size_t r : chunk.relative) {
+			int32_t* c = &in.corners[r / 3].v;
+			c[r % 3] += shift[r % 3];
+		}
+		std::copy(in.positions.begin(), in.positions.end(),
+				out.positions.begin() + positionOffsets[k]);
+		std::copy(in.colors.begin(), in.colors.end(),
+				out.colors.begin() + positionOffsets[k]);
+		std::copy(in.normals.begin(), in.normals.end(),
+				out.normals.begin() + normalOffsets[k]);
+		std::copy(in.texcoords.begin(), in.texcoords.end(),
+				out.texcoords.begin() + texOffsets[k]);
+		std::copy(in.corners.begin(), in.corners.end(),
+				out.corners.begin() + cornerOffsets[k]);
+		for (size_t f = 0; f < in.faceCount(); f++) {
+			out.faceOffsets[faceOffsets[k] + f] = (uint32_t) (cornerOffsets[k]
+					+ in.faceOffsets[f]);
+		}
+	}
+	for (int k = 0; k < chunkCount; k++) {
+		for (GroupEvent& event : chunks[k].data.groups) {
+			event.face += faceOffsets[k];
+			out.groups.push_back(event);
+		}
+		out.materialLibraries.insert(out.materialLibraries.end(),
+				chunks[k].data.materialLibraries.begin(),
+				chunks[k].data.materialLibraries.end());
+	}
+	const int32_t positionCount = (int32_t) out.positions.size();
+	const int32_t texCount = (int32_t) out.texcoords.size();
+	const int32_t normalCount = (int32_t) out.normals.size();
+	int invalid = 0;
+#pragma omp parallel for reduction(+:invalid)
+	for (int64_t n = 0; n < (int64_t) out.corners.size(); n++) {
+		const Corner& c = out.corners[n];
+		if (c.v < 0 || c.v >= positionCount || c.vt < -1 || c.vt >= texCount
+				|| c.vn < -1 || c.vn >= normalCount) {
+			invalid++;
+		}
+	}
+	if (invalid > 0) {
+		throw std::runtime_error(
+				MakeString() << "OBJ file has " << invalid
+						<< " face corners that refer to missing vertices, texture coordinates or normals.");
+	}
+}
+void ReadObjFile(const std::string& file, ObjFile& out) {
+	ReadableMemMapFile mapped(file, true);
+	if (!mapped.isOpen()) {
+		throw std::runtime_error(MakeString() << "Could not open " << file);
+	}
+	if (mapped.getFileSize() == 0) {
+		out.clear();
+		return;
+	}
+	if (mapped.data() == nullptr) {
+		throw std::runtime_error(MakeString() << "Could not map " << file);
+	}
+	ParseObjFile(mapped.data(), mapped.getMappedSize(), out);
+}
+}
+}
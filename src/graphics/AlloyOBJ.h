@@ -0,0 +1,81 @@
+/*
+ * Copyright(C) 2015, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef ALLOYOBJ_H_
+#define ALLOYOBJ_H_
+#include "math/AlloyVecMath.h"
+#include <vector>
+#include <string>
+#include <stdint.h>
+namespace aly {
+bool SANITY_CHECK_OBJ_IO();
+namespace obj {
+/*
+ Wavefront OBJ file contents before they are turned into a mesh. Face corners
+ hold zero based indexes into the attribute arrays, or -1 when a corner has no
+ texture coordinate or normal. Colors are only present if some vertex line
+ carries them, and then hold one entry per position.
+ */
+struct Corner {
+	int32_t v;
+	int32_t vt;
+	int32_t vn;
+};
+enum class GroupType {
+	Group, Object, Material
+};
+struct GroupEvent {
+	size_t face;
+	GroupType type;
+	std::string name;
+};
+struct ObjFile {
+	std::vector<float3> positions;
+	std::vector<float3> colors;
+	std::vector<float3> normals;
+	std::vector<float2> texcoords;
+	std::vector<Corner> corners;
+	//Face n owns corners [faceOffsets[n], faceOffsets[n+1]).
+	std::vector<uint32_t> faceOffsets;
+	//Group, object and usemtl statements in file order, tagged with the face that follows them.
+	std::vector<GroupEvent> groups;
+	std::vector<std::string> materialLibraries;
+	size_t faceCount() const {
+		return (faceOffsets.size() > 0) ? faceOffsets.size() - 1 : 0;
+	}
+	void clear();
+};
+/*
+ Parses an OBJ file held in memory. The text is split into line aligned chunks
+ that are parsed in parallel and then stitched together, with relative (negative)
+ indexes resolved against the vertex counts of the chunks before them.
+ */
+void ParseObjFile(const char* data, size_t size, ObjFile& out);
+void ReadObjFile(const std::string& file, ObjFile& out);
+/*
+ Parses a decimal floating point number starting at p and advances p past it.
+ When the digits fit in 53 bits and the exponent is small the value is exact in
+ double precision before it is rounded to float; anything else goes to strtod.
+ */
+bool ParseFloat(const char*& p, const char* end, float& value);
+bool ParseInt(const char*& p, const char* end, int64_t& value);
+}
+}
+#endif
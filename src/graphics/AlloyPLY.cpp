@@ -1630,5 +1630,134 @@ void PLYReaderWriter::describeProperty(PlyProperty *prop) {
 	*elem_prop = *prop;
 }
 
+const PlyLayoutProperty* PlyLayoutElement::findProperty(
+		const std::string& name) const {
+	for (const PlyLayoutProperty& prop : props) {
+		if (prop.name == name)
+			return &prop;
+	}
+	return nullptr;
+}
+const PlyLayoutElement* PlyLayout::findElement(const std::string& name) const {
+	for (const PlyLayoutElement& elem : elements) {
+		if (elem.name == name)
+			return &elem;
+	}
+	return nullptr;
+}
+bool PlyLayout::needsSwap() const {
+	const uint16_t one = 1;
+	bool littleEndian = (*reinterpret_cast<const uint8_t*>(&one) == 1);
+	return (format == FileFormat::BINARY_LE) != littleEndian;
+}
+static DataType ParsePlyType(const std::string& name) {
+	for (int i = static_cast<int>(DataType::StartType) + 1;
+			i < static_cast<int>(DataType::EndType); i++) {
+		if (name == property_type_names[i] || name == old_property_type_names[i])
+			return static_cast<DataType>(i);
+	}
+	return DataType::StartType;
+}
+bool ParsePlyLayout(const char* data, size_t size, PlyLayout& layout) {
+	layout.elements.clear();
+	layout.comments.clear();
+	layout.headerSize = 0;
+	layout.format = FileFormat::ASCII;
+	size_t pos = 0;
+	bool first = true;
+	while (pos < size) {
+		size_t end = pos;
+		while (end < size && data[end] != '\n')
+			end++;
+		if (end == size)
+			return false;
+		std::string line(data + pos, end - pos);
+		pos = end + 1;
+		if (line.size() > 0 && line.back() == '\r')
+			line.pop_back();
+		std::vector<std::string> words;
+		std::stringstream ss(line);
+		std::string word;
+		while (ss >> word)
+			words.push_back(word);
+		if (first) {
+			if (words.size() != 1 || words[0] != "ply")
+				return false;
+			first = false;
+			continue;
+		}
+		if (words.size() == 0)
+			continue;
+		if (words[0] == "end_header") {
+			layout.headerSize = pos;
+			return true;
+		} else if (words[0] == "format" && words.size() >= 2) {
+			if (words[1] == "ascii") {
+				layout.format = FileFormat::ASCII;
+			} else if (words[1] == "binary_little_endian") {
+				layout.format = FileFormat::BINARY_LE;
+			} else if (words[1] == "binary_big_endian") {
+				layout.format = FileFormat::BINARY_BE;
+			} else {
+				return false;
+			}
+		} else if (words[0] == "comment") {
+			layout.comments.push_back(
+					line.size() > 8 ? line.substr(8) : std::string());
+		} else if (words[0] == "element" && words.size() >= 3) {
+			PlyLayoutElement elem;
+			elem.name = words[1];
+			elem.count = std::stoull(words[2]);
+			elem.stride = 0;
+			layout.elements.push_back(elem);
+		} else if (words[0] == "property" && layout.elements.size() > 0) {
+			PlyLayoutElement& elem = layout.elements.back();
+			PlyLayoutProperty prop;
+			if (words.size() >= 5 && words[1] == "list") {
+				prop.countType = ParsePlyType(words[2]);
+				prop.type = ParsePlyType(words[3]);
+				prop.name = words[4];
+				prop.offset = -1;
+				if (prop.countType == DataType::StartType)
+					return false;
+				elem.stride = -1;
+			} else if (words.size() >= 3) {
+				prop.countType = DataType::StartType;
+				prop.type = ParsePlyType(words[1]);
+				prop.name = words[2];
+				prop.offset = elem.stride;
+				if (elem.stride >= 0)
+					elem.stride += ply_type_size[static_cast<int>(prop.type)];
+			} else {
+				return false;
+			}
+			if (prop.type == DataType::StartType)
+				return false;
+			elem.props.push_back(prop);
+		}
+	}
+	return false;
+}
+PlyVertexFormat::PlyVertexFormat() :
+		stride(0), swap(false) {
+	for (int i = 0; i < FIELDS; i++) {
+		offsets[i] = -1;
+		types[i] = DataType::StartType;
+	}
+}
+bool PlyVertexFormat::set(const PlyLayoutElement& elem, bool swap) {
+	static const char* names[FIELDS] = { "x", "y", "z", "nx", "ny", "nz", "red",
+			"green", "blue" };
+	this->swap = swap;
+	stride = elem.stride;
+	if (stride <= 0)
+		return false;
+	for (int i = 0; i < FIELDS; i++) {
+		const PlyLayoutProperty* prop = elem.findProperty(names[i]);
+		offsets[i] = (prop != nullptr) ? prop->offset : -1;
+		types[i] = (prop != nullptr) ? prop->type : DataType::StartType;
+	}
+	return (offsets[X] >= 0 && offsets[Y] >= 0 && offsets[Z] >= 0);
+}
 }
 }
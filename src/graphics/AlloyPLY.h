@@ -32,6 +32,8 @@
 #include <fstream>
 #include <list>
 #include <stddef.h>
+#include <stdint.h>
+#include <cstring>
 namespace aly
 {
 	bool SANITY_CHECK_MESH_IO();
@@ -424,6 +426,140 @@ class PLYReaderWriter
         void asciiGetElement(char*);
         void binaryGetElement(char*);
 };
+/*
+ Element layout read straight from the header of a binary PLY file, for the
+ memory-mapped fast paths. An element with only scalar properties has a
+ fixed stride, so record n starts at n * stride from the element's data.
+ */
+struct PlyLayoutProperty
+{
+        std::string name;
+        DataType type;
+        DataType countType; /* StartType for scalars */
+        int offset; /* offset within a fixed stride record, -1 after a list */
+};
+struct PlyLayoutElement
+{
+        std::string name;
+        uint64_t count;
+        int stride; /* -1 if the element has list properties */
+        std::vector<PlyLayoutProperty> props;
+        const PlyLayoutProperty* findProperty(const std::string& name) const;
+};
+struct PlyLayout
+{
+        FileFormat format;
+        size_t headerSize;
+        std::vector<std::string> comments;
+        std::vector<PlyLayoutElement> elements;
+        const PlyLayoutElement* findElement(const std::string& name) const;
+        //True if binary values must be byte swapped on this machine.
+        bool needsSwap() const;
+};
+//Parses the header at the start of a mapped file. Returns false if it is not a PLY header.
+bool ParsePlyLayout(const char* data, size_t size, PlyLayout& layout);
+template<class T> inline T ReadPlyValue(const char* ptr, DataType type, bool swap)
+{
+    char bytes[8];
+    int size = ply_type_size[static_cast<int>(type)];
+    if (swap)
+    {
+        for (int i = 0; i < size; i++)
+            bytes[i] = ptr[size - 1 - i];
+    }
+    else
+    {
+        std::memcpy(bytes, ptr, size);
+    }
+    switch (type)
+    {
+        case DataType::Int8:
+        {
+            int8_t value;
+            std::memcpy(&value, bytes, sizeof(value));
+            return static_cast<T>(value);
+        }
+        case DataType::Int16:
+        {
+            int16_t value;
+            std::memcpy(&value, bytes, sizeof(value));
+            return static_cast<T>(value);
+        }
+        case DataType::Int32:
+        {
+            int32_t value;
+            std::memcpy(&value, bytes, sizeof(value));
+            return static_cast<T>(value);
+        }
+        case DataType::Uint8:
+        {
+            uint8_t value;
+            std::memcpy(&value, bytes, sizeof(value));
+            return static_cast<T>(value);
+        }
+        case DataType::Uint16:
+        {
+            uint16_t value;
+            std::memcpy(&value, bytes, sizeof(value));
+            return static_cast<T>(value);
+        }
+        case DataType::Uint32:
+        {
+            uint32_t value;
+            std::memcpy(&value, bytes, sizeof(value));
+            return static_cast<T>(value);
+        }
+        case DataType::Float32:
+        {
+            float value;
+            std::memcpy(&value, bytes, sizeof(value));
+            return static_cast<T>(value);
+        }
+        case DataType::Float64:
+        {
+            double value;
+            std::memcpy(&value, bytes, sizeof(value));
+            return static_cast<T>(value);
+        }
+        default:
+            return T(0);
+    }
+}
+/*
+ Where the position, normal and color of a vertex sit in a fixed stride
+ vertex record. Offsets are -1 for missing properties.
+ */
+struct PlyVertexFormat
+{
+        static const int X = 0, Y = 1, Z = 2, NX = 3, NY = 4, NZ = 5, RED = 6,
+                GREEN = 7, BLUE = 8, FIELDS = 9;
+        int stride;
+        bool swap;
+        int offsets[FIELDS];
+        DataType types[FIELDS];
+        PlyVertexFormat();
+        //Returns false if the element has lists or no position.
+        bool set(const PlyLayoutElement& elem, bool swap);
+        bool hasNormals() const
+        {
+            return offsets[NX] >= 0 && offsets[NY] >= 0 && offsets[NZ] >= 0;
+        }
+        bool hasColors() const
+        {
+            return offsets[RED] >= 0 && offsets[GREEN] >= 0 && offsets[BLUE] >= 0;
+        }
+        inline float get(const char* record, int field) const
+        {
+            return ReadPlyValue<float>(record + offsets[field], types[field], swap);
+        }
+        //Integer colors are scaled from [0,255] to [0,1].
+        inline float getColor(const char* record, int field) const
+        {
+            float value = get(record, field);
+            return (types[field] == DataType::Float32
+                    || types[field] == DataType::Float64) ? value : value / 255.0f;
+        }
+};
 }
 }
 #endif
@@ -0,0 +1,334 @@
+/*
+ * Copyright(C) 2015, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef ALLOYSPATIALHASH_H_
+#define ALLOYSPATIALHASH_H_
+#include "graphics/AlloyLocator.h"
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include <omp.h>
+namespace aly {
+bool SANITY_CHECK_SPATIAL_HASH();
+/*
+ Fixed radius point search on a hashed uniform grid. Points are counting
+ sorted into hash buckets in parallel, so building is O(n) and needs no
+ per-point allocation. Queries visit the cells that overlap the search
+ radius, which is cheapest when the cell size matches the query radius.
+ Moving a few points between cells is handled by update() without a full
+ rebuild: moved points are dropped from their old bucket and kept in a small
+ sorted overflow list until too many have moved.
+ */
+template<class T, int C> class SpatialHash {
+protected:
+	std::vector<vec<T, C>> points;
+	std::vector<uint32_t> keys;
+	std::vector<int> slots;
+	std::vector<uint32_t> bucketStart;
+	std::vector<int> entries;
+	std::vector<vec<T, C>> sortedPoints;
+	std::vector<std::pair<uint32_t, int>> overflow;
+	T cellSize;
+	uint32_t mask;
+	vec<int, C> cellOf(const vec<T, C>& pt) const {
+		vec<int, C> cell;
+		for (int c = 0; c < C; c++) {
+			cell[c] = (int) std::floor(pt[c] / cellSize);
+		}
+		return cell;
+	}
+	uint32_t hash(const vec<int, C>& cell) const {
+		static const uint32_t primes[4] = { 73856093u, 19349663u, 83492791u,
+				2654435761u };
+		uint32_t h = 0;
+		for (int c = 0; c < C; c++) {
+			h += (uint32_t) cell[c] * primes[c];
+		}
+		//The low bits of the product hash collide often on regular grids, so mix them before masking.
+		h ^= h >> 16;
+		h *= 0x85ebca6bu;
+		h ^= h >> 13;
+		h *= 0xc2b2ae35u;
+		h ^= h >> 16;
+		return h & mask;
+	}
+	//Calls func(index, position) once for every point in a bucket that overlaps the ball around pt.
+	template<class F> void forEachCandidate(const vec<T, C>& pt, T radius,
+			std::vector<uint32_t>& buckets, const F& func) const {
+		if (entries.size() == 0)
+			return;
+		int r = std::max(1, (int) std::ceil(radius / cellSize));
+		vec<int, C> center = cellOf(pt);
+		vec<int, C> offset(-r);
+		buckets.clear();
+		//Enumerate the (2r+1)^C neighboring cells with an odometer over the offsets.
+		for (;;) {
+			//Different cells can land in the same bucket, which must only be scanned once.
+			uint32_t b = hash(center + offset);
+			if (std::find(buckets.begin(), buckets.end(), b) == buckets.end())
+				buckets.push_back(b);
+			int c = 0;
+			while (c < C && ++offset[c] > r) {
+				offset[c] = -r;
+				c++;
+			}
+			if (c == C)
+				break;
+		}
+		for (uint32_t b : buckets) {
+			for (uint32_t e = bucketStart[b]; e < bucketStart[b + 1]; e++) {
+				if (entries[e] >= 0) {
+					func(entries[e], sortedPoints[e]);
+				}
+			}
+		}
+		if (overflow.size() > 0) {
+			for (uint32_t b : buckets) {
+				auto iter = std::lower_bound(overflow.begin(), overflow.end(),
+						std::pair<uint32_t, int>(b, -1));
+				for (; iter != overflow.end() && iter->first == b; iter++) {
+					func(iter->second, points[iter->second]);
+				}
+			}
+		}
+	}
+	void rebuild() {
+		int N = (int) points.size();
+		uint32_t B = 1;
+		while (B < (uint32_t) N)
+			B <<= 1;
+		mask = B - 1;
+		keys.resize(N);
+		slots.resize(N);
+		entries.resize(N);
+		sortedPoints.resize(N);
+		overflow.clear();
+		std::vector<std::atomic<uint32_t>> counts(B);
+#pragma omp parallel for
+		for (int n = 0; n < N; n++) {
+			uint32_t key = hash(cellOf(points[n]));
+			keys[n] = key;
+			counts[key]++;
+		}
+		bucketStart.resize(B + 1);
+		bucketStart[0] = 0;
+		for (uint32_t b = 0; b < B; b++) {
+			bucketStart[b + 1] = bucketStart[b] + counts[b];
+			counts[b] = bucketStart[b];
+		}
+#pragma omp parallel for
+		for (int n = 0; n < N; n++) {
+			entries[counts[keys[n]]++] = n;
+		}
+		//Scattering in parallel leaves buckets in arbitrary order, so sort them to keep results repeatable.
+#pragma omp parallel for schedule(dynamic,1024)
+		for (int b = 0; b < (int) B; b++) {
+			std::sort(entries.begin() + bucketStart[b],
+					entries.begin() + bucketStart[b + 1]);
+			for (uint32_t e = bucketStart[b]; e < bucketStart[b + 1]; e++) {
+				slots[entries[e]] = (int) e;
+				sortedPoints[e] = points[entries[e]];
+			}
+		}
+	}
+public:
+	SpatialHash() :
+			cellSize(1), mask(0) {
+	}
+	SpatialHash(const std::vector<vec<T, C>>& pts, T cellSize) :
+			SpatialHash() {
+		build(pts, cellSize);
+	}
+	SpatialHash(const Vector<T, C>& pts, T cellSize) :
+			SpatialHash() {
+		build(pts.data, cellSize);
+	}
+	void clear() {
+		points.clear();
+		keys.clear();
+		slots.clear();
+		bucketStart.clear();
+		entries.clear();
+		sortedPoints.clear();
+		overflow.clear();
+	}
+	size_t size() const {
+		return points.size();
+	}
+	T getCellSize() const {
+		return cellSize;
+	}
+	const vec<T, C>& operator[](size_t i) const {
+		return points[i];
+	}
+	void build(const std::vector<vec<T, C>>& pts, T cellSize) {
+		this->cellSize = cellSize;
+		points = pts;
+		rebuild();
+	}
+	void build(const Vector<T, C>& pts, T cellSize) {
+		build(pts.data, cellSize);
+	}
+	/*
+	 Moves points to new positions. Only points that change bucket are touched,
+	 and the hash is rebuilt from scratch when the point count or cell size
+	 changes or too many points have moved. Returns the number of points that
+	 changed bucket.
+	 */
+	int update(const std::vector<vec<T, C>>& pts, T cellSize) {
+		if (pts.size() != points.size() || cellSize != this->cellSize
+				|| points.size() == 0) {
+			build(pts, cellSize);
+			return (int) pts.size();
+		}
+		int N = (int) pts.size();
+		std::vector<uint32_t> newKeys(N);
+		int moved = 0;
+#pragma omp parallel for reduction(+:moved)
+		for (int n = 0; n < N; n++) {
+			points[n] = pts[n];
+			if (slots[n] >= 0)
+				sortedPoints[slots[n]] = pts[n];
+			newKeys[n] = hash(cellOf(pts[n]));
+			if (newKeys[n] != keys[n])
+				moved++;
+		}
+		if (moved == 0)
+			return 0;
+		if (overflow.size() + moved > (size_t) N / 8) {
+			rebuild();
+			return moved;
+		}
+		std::vector<std::pair<uint32_t, int>> kept;
+		kept.reserve(overflow.size() + moved);
+		for (const std::pair<uint32_t, int>& pr : overflow) {
+			if (newKeys[pr.second] == keys[pr.second]) {
+				kept.push_back(pr);
+			}
+		}
+		for (int n = 0; n < N; n++) {
+			if (newKeys[n] != keys[n]) {
+				if (slots[n] >= 0) {
+					entries[slots[n]] = -1;
+					slots[n] = -1;
+				}
+				keys[n] = newKeys[n];
+				kept.push_back(std::pair<uint32_t, int>(newKeys[n], n));
+			}
+		}
+		std::sort(kept.begin(), kept.end());
+		overflow.swap(kept);
+		return moved;
+	}
+	int update(const Vector<T, C>& pts, T cellSize) {
+		return update(pts.data, cellSize);
+	}
+	//Same results as Locator::closest(), points within maxDistance sorted from nearest to farthest.
+	void closest(const vec<T, C>& pt, T maxDistance,
+			std::vector<xvec<T, C>>& pts) const {
+		std::vector<std::pair<T, int>> tmp;
+		std::vector<uint32_t> buckets;
+		const T distSqr = maxDistance * maxDistance;
+		forEachCandidate(pt, maxDistance, buckets, [&](int idx, const vec<T, C>& pos) {
+			T d = distanceSqr(pt, pos);
+			if (d <= distSqr) {
+				tmp.push_back(std::pair<T, int>(d, idx));
+			}
+		});
+		std::sort(tmp.begin(), tmp.end());
+		pts.clear();
+		pts.reserve(tmp.size());
+		for (const std::pair<T, int>& pr : tmp) {
+			pts.push_back(xvec<T, C>(points[pr.second], pr.second));
+		}
+	}
+	void closest(const vec<T, C>& pt, T maxDistance,
+			std::vector<std::pair<xvec<T, C>, T>>& pts) const {
+		std::vector<xvec<T, C>> tmp;
+		closest(pt, maxDistance, tmp);
+		pts.clear();
+		pts.reserve(tmp.size());
+		for (const xvec<T, C>& val : tmp) {
+			pts.push_back(
+					std::pair<xvec<T, C>, T>(val, distance(pt, vec<T, C>(val))));
+		}
+	}
+	/*
+	 Finds the neighbors of every point within maxDistance in one parallel
+	 pass. Neighbors of point n are indexes[offsets[n]] to
+	 indexes[offsets[n+1]-1], sorted from nearest to farthest. The point itself
+	 is left out unless includeSelf is set.
+	 */
+	void neighbors(T maxDistance, std::vector<int>& offsets,
+			std::vector<int>& indexes, bool includeSelf = false) const {
+		int N = (int) points.size();
+		offsets.assign(N + 1, 0);
+		const T distSqr = maxDistance * maxDistance;
+		std::vector<std::vector<int>> buffers(omp_get_max_threads());
+		int threads = 1;
+		//Each thread takes one contiguous range of points so the buffers can be concatenated in thread order.
+#pragma omp parallel
+		{
+			int t = omp_get_thread_num();
+			int nt = omp_get_num_threads();
+			int begin = (int) (((int64_t) N * t) / nt);
+			int end = (int) (((int64_t) N * (t + 1)) / nt);
+			if (t == 0)
+				threads = nt;
+			std::vector<int>& buffer = buffers[t];
+			std::vector<std::pair<T, int>> tmp;
+			std::vector<uint32_t> buckets;
+			for (int n = begin; n < end; n++) {
+				const vec<T, C>& pt = points[n];
+				tmp.clear();
+				forEachCandidate(pt, maxDistance, buckets, [&](int idx, const vec<T, C>& pos) {
+					if (idx != n || includeSelf) {
+						T d = distanceSqr(pt, pos);
+						if (d <= distSqr) {
+							tmp.push_back(std::pair<T, int>(d, idx));
+						}
+					}
+				});
+				std::sort(tmp.begin(), tmp.end());
+				offsets[n + 1] = (int) tmp.size();
+				for (const std::pair<T, int>& pr : tmp) {
+					buffer.push_back(pr.second);
+				}
+			}
+		}
+		for (int n = 0; n < N; n++) {
+			offsets[n + 1] += offsets[n];
+		}
+		indexes.resize(offsets[N]);
+		size_t pos = 0;
+		for (int t = 0; t < threads; t++) {
+			std::copy(buffers[t].begin(), buffers[t].end(),
+					indexes.begin() + pos);
+			pos += buffers[t].size();
+		}
+	}
+};
+typedef SpatialHash<float, 2> SpatialHash2f;
+typedef SpatialHash<float, 3> SpatialHash3f;
+typedef SpatialHash<double, 2> SpatialHash2d;
+typedef SpatialHash<double, 3> SpatialHash3d;
+}
+#endif
@@ -0,0 +1,655 @@
+/*
+ * Copyright(C) 2015, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "graphics/AlloySubdivision.h"
+#include "graphics/AlloyMeshTopology.h"
+#include <algorithm>
+namespace aly {
+typedef std::pair<uint32_t, float> StencilEntry;
+/*
+ Fills a table from rowOf(i, entries), which may list the same index more
+ than once. Blocks of rows are generated in parallel into their own buffers,
+ then copied into place once the row offsets are known.
+ */
+template<class F> static void BuildStencilTable(size_t rows, const F& rowOf,
+		StencilTable& table) {
+	const size_t BLOCK_SIZE = 4096;
+	const int64_t blockCount = (int64_t) ((rows + BLOCK_SIZE - 1) / BLOCK_SIZE);
+	std::vector<std::vector<StencilEntry>> blocks(blockCount);
+	table.offsets.assign(rows + 1, 0);
+#pragma omp parallel
+	{
+		std::vector<StencilEntry> entries;
+#pragma omp for schedule(dynamic)
+		for (int64_t b = 0; b < blockCount; b++) {
+			std::vector<StencilEntry>& block = blocks[b];
+			size_t end = std::min(rows, (size_t) (b + 1) * BLOCK_SIZE);
+			for (size_t i = b * BLOCK_SIZE; i < end; i++) {
+				entries.clear();
+				rowOf((uint32_t) i, entries);
+				//Rows repeat a few indexes many times, so merging before sorting is cheaper.
+				size_t count = 0;
+				for (size_t j = 0; j < entries.size(); j++) {
+					size_t k = 0;
+					while (k < count && entries[k].first != entries[j].first) {
+						k++;
+					}
+					if (k < count) {
+						entries[k].second += entries[j].second;
+					} else {
+						entries[count++] = entries[j];
+					}
+				}
+				std::sort(entries.begin(), entries.begin() + count,
+						[](const StencilEntry& a, const StencilEntry& b) {
+							return a.first < b.first;
+						});
+				block.insert(block.end(), entries.begin(), entries.begin() + count);
+				table.offsets[i + 1] = (uint32_t) count;
+			}
+		}
+	}
+	for (size_t i = 0; i < rows; i++) {
+		table.offsets[i + 1] += table.offsets[i];
+	}
+	table.indexes.resize(table.offsets[rows]);
+	table.weights.resize(table.offsets[rows]);
+#pragma omp parallel for
+	for (int64_t b = 0; b < blockCount; b++) {
+		uint32_t offset = table.offsets[b * BLOCK_SIZE];
+		for (const StencilEntry& entry : blocks[b]) {
+			table.indexes[offset] = entry.first;
+			table.weights[offset++] = entry.second;
+		}
+		std::vector<StencilEntry>().swap(blocks[b]);
+	}
+}
+//Stencils of next expressed in terms of the values prev was built from.
+static void ComposeStencilTables(const StencilTable& next,
+		const StencilTable& prev, StencilTable& out) {
+	StencilTable result;
+	BuildStencilTable(next.size(),
+			[&](uint32_t i, std::vector<StencilEntry>& entries) {
+				for (uint32_t j = next.offsets[i]; j < next.offsets[i + 1]; j++) {
+					uint32_t row = next.indexes[j];
+					float w = next.weights[j];
+					for (uint32_t k = prev.offsets[row]; k < prev.offsets[row + 1]; k++) {
+						entries.push_back(StencilEntry(prev.indexes[k], w * prev.weights[k]));
+					}
+				}
+			}, result);
+	out = std::move(result);
+}
+/*
+ A corner of a refined face, described by where its value comes from in the
+ parent face: a parent corner, the midpoint of the edge after that corner, or
+ the face center.
+ */
+struct CornerSource {
+	static const uint16_t CORNER = 0;
+	static const uint16_t EDGE = 1;
+	static const uint16_t CENTER = 2;
+	uint32_t face;
+	uint16_t type;
+	uint16_t k;
+	CornerSource() :
+			face(0), type(CORNER), k(0) {
+	}
+	CornerSource(uint32_t face, uint16_t type, uint16_t k) :
+			face(face), type(type), k(k) {
+	}
+};
+/*
+ One level of refinement. Refined vertexes are the parent vertexes, then one
+ face point per refined or transition face (Catmull-Clark only), then one edge
+ point per split edge.
+ */
+struct SubdivisionLevel {
+	SubDivisionScheme scheme;
+	const std::vector<uint3>& tris;
+	const std::vector<uint4>& quads;
+	const std::vector<uint8_t>& faceMask;
+	MeshTopology topo;
+	//0 = untouched, 1 = transition, 2 = refined.
+	std::vector<uint8_t> faceState;
+	std::vector<uint8_t> selected;
+	std::vector<uint8_t> edgeSplit;
+	std::vector<uint8_t> smoothVertex;
+	//Index of the new point for each face and edge, and the face and edge of each new point.
+	std::vector<uint32_t> facePoint;
+	std::vector<uint32_t> edgePoint;
+	std::vector<uint32_t> pointFace;
+	std::vector<uint32_t> pointEdge;
+	uint32_t facePointCount = 0;
+	uint32_t edgePointCount = 0;
+	std::vector<CornerSource> triSources;
+	std::vector<CornerSource> quadSources;
+	std::vector<uint8_t> childMask;
+	SubdivisionLevel(SubDivisionScheme scheme, size_t vertexCount,
+			const std::vector<uint3>& tris, const std::vector<uint4>& quads,
+			const std::vector<uint8_t>& faceMask) :
+			scheme(scheme), tris(tris), quads(quads), faceMask(faceMask) {
+		topo.build(vertexCount, tris, quads);
+	}
+	uint32_t vertexCount() const {
+		return topo.vertexCount + facePointCount + edgePointCount;
+	}
+	uint32_t faceVertex(uint32_t f, uint32_t k) const {
+		return (f < topo.triCount) ?
+				tris[f][k] : quads[f - topo.triCount][k];
+	}
+	uint32_t faceEdge(uint32_t f, uint32_t k) const {
+		return topo.halfEdgeEdges[topo.faceHalfEdge(f) + k];
+	}
+	bool isSplit(uint32_t f, uint32_t k) const {
+		return edgeSplit[faceEdge(f, k)] != 0;
+	}
+	uint32_t sourceVertex(const CornerSource& src) const {
+		if (src.type == CornerSource::CORNER) {
+			return faceVertex(src.face, src.k);
+		} else if (src.type == CornerSource::EDGE) {
+			return topo.vertexCount + facePointCount
+					+ edgePoint[faceEdge(src.face, src.k)];
+		} else {
+			return topo.vertexCount + facePoint[src.face];
+		}
+	}
+	void classify();
+	void buildFaces();
+	void centroid(uint32_t f, float weight,
+			std::vector<StencilEntry>& entries) const {
+		uint32_t n = topo.faceSize(f);
+		for (uint32_t k = 0; k < n; k++) {
+			entries.push_back(StencilEntry(faceVertex(f, k), weight / n));
+		}
+	}
+	void edgeStencil(uint32_t e, float weight,
+			std::vector<StencilEntry>& entries) const;
+	void vertexRow(uint32_t i, std::vector<StencilEntry>& entries) const;
+	void varyingRow(uint32_t i, std::vector<StencilEntry>& entries) const;
+	void faceVaryingRow(uint32_t i, std::vector<StencilEntry>& entries) const;
+};
+void SubdivisionLevel::classify() {
+	const int64_t F = (int64_t) topo.faceCount();
+	const int64_t E = (int64_t) topo.edges.size();
+	const int64_t V = (int64_t) topo.vertexCount;
+	selected.resize(F);
+#pragma omp parallel for
+	for (int64_t f = 0; f < F; f++) {
+		selected[f] = (faceMask.size() == 0 || faceMask[f] != 0) ? 1 : 0;
+	}
+	edgeSplit.resize(E);
+#pragma omp parallel for
+	for (int64_t e = 0; e < E; e++) {
+		uint8_t split = 0;
+		for (uint32_t i = topo.edgeOffsets[e]; i < topo.edgeOffsets[e + 1];
+				i++) {
+			split |= selected[topo.halfEdgeFace(topo.edgeHalfEdges[i])];
+		}
+		edgeSplit[e] = split;
+	}
+	faceState.resize(F);
+#pragma omp parallel for
+	for (int64_t f = 0; f < F; f++) {
+		uint32_t n = topo.faceSize((uint32_t) f);
+		uint32_t splitCount = 0;
+		for (uint32_t k = 0; k < n; k++) {
+			splitCount += edgeSplit[faceEdge((uint32_t) f, k)];
+		}
+		if (selected[f]) {
+			faceState[f] = 2;
+		} else if (splitCount == 0) {
+			faceState[f] = 0;
+		} else if (scheme == SubDivisionScheme::Loop && splitCount == n) {
+			//A triangle with every edge split is refined to close the region.
+			faceState[f] = 2;
+		} else {
+			faceState[f] = 1;
+		}
+	}
+	smoothVertex.resize(V);
+#pragma omp parallel for
+	for (int64_t v = 0; v < V; v++) {
+		uint8_t smooth = 0;
+		for (uint32_t i = topo.cornerOffsets[v]; i < topo.cornerOffsets[v + 1];
+				i++) {
+			smooth |= selected[topo.halfEdgeFace(topo.vertexCorners[i])];
+		}
+		smoothVertex[v] = smooth;
+	}
+	facePoint.assign(F, 0);
+	pointFace.clear();
+	if (scheme == SubDivisionScheme::CatmullClark) {
+		for (int64_t f = 0; f < F; f++) {
+			facePoint[f] = (uint32_t) pointFace.size();
+			if (faceState[f] != 0) {
+				pointFace.push_back((uint32_t) f);
+			}
+		}
+	}
+	facePointCount = (uint32_t) pointFace.size();
+	edgePoint.resize(E);
+	pointEdge.clear();
+	for (int64_t e = 0; e < E; e++) {
+		edgePoint[e] = (uint32_t) pointEdge.size();
+		if (edgeSplit[e]) {
+			pointEdge.push_back((uint32_t) e);
+		}
+	}
+	edgePointCount = (uint32_t) pointEdge.size();
+}
+void SubdivisionLevel::buildFaces() {
+	const int64_t F = (int64_t) topo.faceCount();
+	//Children per parent face, so they can be written in parent order in parallel.
+	std::vector<uint32_t> triOffsets(F + 1, 0), quadOffsets(F + 1, 0);
+#pragma omp parallel for
+	for (int64_t f = 0; f < F; f++) {
+		uint32_t n = topo.faceSize((uint32_t) f);
+		uint32_t newTris = 0, newQuads = 0;
+		if (faceState[f] == 0) {
+			((n == 3) ? newTris : newQuads) = 1;
+		} else if (scheme == SubDivisionScheme::CatmullClark) {
+			if (faceState[f] == 2) {
+				newQuads = n;
+			} else {
+				for (uint32_t k = 0; k < n; k++) {
+					newTris += 1 + (isSplit((uint32_t) f, k) ? 1 : 0);
+				}
+			}
+		} else {
+			if (faceState[f] == 2) {
+				newTris = 4;
+			} else {
+				newTris = 1;
+				for (uint32_t k = 0; k < n; k++) {
+					newTris += (isSplit((uint32_t) f, k) ? 1 : 0);
+				}
+			}
+		}
+		triOffsets[f + 1] = newTris;
+		quadOffsets[f + 1] = newQuads;
+	}
+	for (int64_t f = 0; f < F; f++) {
+		triOffsets[f + 1] += triOffsets[f];
+		quadOffsets[f + 1] += quadOffsets[f];
+	}
+	triSources.resize(3 * (size_t) triOffsets[F]);
+	quadSources.resize(4 * (size_t) quadOffsets[F]);
+	childMask.resize(triOffsets[F] + quadOffsets[F]);
+	const uint32_t triTotal = triOffsets[F];
+#pragma omp parallel for
+	for (int64_t f = 0; f < F; f++) {
+		const uint32_t face = (uint32_t) f;
+		const uint32_t n = topo.faceSize(face);
+		CornerSource* t = &triSources[3 * (size_t) triOffsets[f]];
+		CornerSource* q = &quadSources[4 * (size_t) quadOffsets[f]];
+		auto C = [=](uint32_t k) {
+			return CornerSource(face, CornerSource::CORNER, (uint16_t) (k % n));
+		};
+		auto E = [=](uint32_t k) {
+			return CornerSource(face, CornerSource::EDGE, (uint16_t) (k % n));
+		};
+		CornerSource center(face, CornerSource::CENTER, 0);
+		if (faceState[f] == 0) {
+			CornerSource* out = (n == 3) ? t : q;
+			for (uint32_t k = 0; k < n; k++) {
+				out[k] = C(k);
+			}
+		} else if (scheme == SubDivisionScheme::CatmullClark) {
+			if (faceState[f] == 2) {
+				for (uint32_t k = 0; k < n; k++) {
+					*q++ = C(k);
+					*q++ = E(k);
+					*q++ = center;
+					*q++ = E(k + n - 1);
+				}
+			} else {
+				//Transition faces become a fan around their center through every corner and split edge.
+				CornerSource boundary[8];
+				uint32_t count = 0;
+				for (uint32_t k = 0; k < n; k++) {
+					boundary[count++] = C(k);
+					if (isSplit(face, k)) {
+						boundary[count++] = E(k);
+					}
+				}
+				for (uint32_t i = 0; i < count; i++) {
+					*t++ = boundary[i];
+					*t++ = boundary[(i + 1) % count];
+					*t++ = center;
+				}
+			}
+		} else {
+			if (faceState[f] == 2) {
+				CornerSource faces[12] = { C(0), E(0), E(2), C(1), E(1), E(0),
+						C(2), E(2), E(1), E(0), E(1), E(2) };
+				std::copy(faces, faces + 12, t);
+			} else {
+				uint32_t splitCount = 0, k = 0;
+				for (uint32_t i = 0; i < 3; i++) {
+					if (isSplit(face, i)) {
+						splitCount++;
+					}
+				}
+				if (splitCount == 1) {
+					while (!isSplit(face, k))
+						k++;
+					CornerSource faces[6] = { C(k), E(k), C(k + 2), E(k), C(k + 1),
+							C(k + 2) };
+					std::copy(faces, faces + 6, t);
+				} else {
+					//k is the edge that is not split.
+					while (isSplit(face, k))
+						k++;
+					CornerSource faces[9] = { E(k + 1), C(k + 2), E(k + 2), C(k),
+							C(k + 1), E(k + 1), C(k), E(k + 1), E(k + 2) };
+					std::copy(faces, faces + 9, t);
+				}
+			}
+		}
+		uint8_t mask = (selected[f] != 0) ? 1 : 0;
+		for (uint32_t i = triOffsets[f]; i < triOffsets[f + 1]; i++) {
+			childMask[i] = mask;
+		}
+		for (uint32_t i = quadOffsets[f]; i < quadOffsets[f + 1]; i++) {
+			childMask[triTotal + i] = mask;
+		}
+	}
+}
+void SubdivisionLevel::edgeStencil(uint32_t e, float weight,
+		std::vector<StencilEntry>& entries) const {
+	uint2 edge = topo.edges[e];
+	uint32_t count = topo.edgeFaceCount(e);
+	if (count < 2 || edge.x == edge.y) {
+		entries.push_back(StencilEntry(edge.x, 0.5f * weight));
+		entries.push_back(StencilEntry(edge.y, 0.5f * weight));
+		return;
+	}
+	uint32_t h1 = topo.edgeHalfEdges[topo.edgeOffsets[e]];
+	uint32_t h2 = topo.edgeHalfEdges[topo.edgeOffsets[e + 1] - 1];
+	if (scheme == SubDivisionScheme::CatmullClark) {
+		//Average of the end points and the centers of the first and last faces on the edge.
+		entries.push_back(StencilEntry(edge.x, 0.25f * weight));
+		entries.push_back(StencilEntry(edge.y, 0.25f * weight));
+		centroid(topo.halfEdgeFace(h1), 0.25f * weight, entries);
+		centroid(topo.halfEdgeFace(h2), 0.25f * weight, entries);
+	} else {
+		entries.push_back(StencilEntry(edge.x, 0.375f * weight));
+		entries.push_back(StencilEntry(edge.y, 0.375f * weight));
+		entries.push_back(StencilEntry(tris[h1 / 3][(h1 + 2) % 3], 0.125f * weight));
+		entries.push_back(StencilEntry(tris[h2 / 3][(h2 + 2) % 3], 0.125f * weight));
+	}
+}
+void SubdivisionLevel::vertexRow(uint32_t i,
+		std::vector<StencilEntry>& entries) const {
+	const uint32_t V = topo.vertexCount;
+	if (i < V) {
+		uint32_t N = topo.ringSize(i);
+		if (!smoothVertex[i] || N == 0) {
+			entries.push_back(StencilEntry(i, 1.0f));
+		} else if (scheme == SubDivisionScheme::CatmullClark) {
+			//(F + 2R + (N - 3)P) / N with F the average face center and R the average edge point.
+			float n = (float) N;
+			float faceWeight = 1.0f / (n * topo.cornerCount(i));
+			for (uint32_t c = topo.cornerOffsets[i]; c < topo.cornerOffsets[i + 1];
+					c++) {
+				centroid(topo.halfEdgeFace(topo.vertexCorners[c]), faceWeight,
+						entries);
+			}
+			for (uint32_t r = topo.ringOffsets[i]; r < topo.ringOffsets[i + 1];
+					r++) {
+				edgeStencil(topo.ringEdges[r], 2.0f / (n * n), entries);
+			}
+			entries.push_back(StencilEntry(i, (n - 3.0f) / n));
+		} else {
+			const uint32_t MAX_VALENCE = 32;
+			if (N < MAX_VALENCE) {
+				float x = 3 / 8.0f + 0.25f * std::cos(2.0f * ALY_PI / N);
+				float beta = (5 / 8.0f - x * x) / N;
+				entries.push_back(StencilEntry(i, 1 - N * beta));
+				for (uint32_t r = topo.ringOffsets[i];
+						r < topo.ringOffsets[i + 1]; r++) {
+					entries.push_back(StencilEntry(topo.ringVertices[r], beta));
+				}
+			} else {
+				entries.push_back(StencilEntry(i, 1.0f));
+			}
+		}
+	} else if (i < V + facePointCount) {
+		centroid(pointFace[i - V], 1.0f, entries);
+	} else {
+		edgeStencil(pointEdge[i - V - facePointCount], 1.0f, entries);
+	}
+}
+void SubdivisionLevel::varyingRow(uint32_t i,
+		std::vector<StencilEntry>& entries) const {
+	const uint32_t V = topo.vertexCount;
+	if (i < V) {
+		entries.push_back(StencilEntry(i, 1.0f));
+	} else if (i < V + facePointCount) {
+		centroid(pointFace[i - V], 1.0f, entries);
+	} else {
+		uint32_t e = pointEdge[i - V - facePointCount];
+		entries.push_back(StencilEntry(topo.edges[e].x, 0.5f));
+		entries.push_back(StencilEntry(topo.edges[e].y, 0.5f));
+	}
+}
+void SubdivisionLevel::faceVaryingRow(uint32_t i,
+		std::vector<StencilEntry>& entries) const {
+	const CornerSource& src =
+			(i < triSources.size()) ?
+					triSources[i] : quadSources[i - triSources.size()];
+	//Face corners are numbered like half-edges, which is also the layout of Mesh::textureMap.
+	uint32_t h = topo.faceHalfEdge(src.face);
+	uint32_t n = topo.faceSize(src.face);
+	if (src.type == CornerSource::CORNER) {
+		entries.push_back(StencilEntry(h + src.k, 1.0f));
+	} else if (src.type == CornerSource::EDGE) {
+		entries.push_back(StencilEntry(h + src.k, 0.5f));
+		entries.push_back(StencilEntry(h + (src.k + 1) % n, 0.5f));
+	} else {
+		for (uint32_t k = 0; k < n; k++) {
+			entries.push_back(StencilEntry(h + k, 1.0f / n));
+		}
+	}
+}
+SubdivisionStencils::SubdivisionStencils() :
+		scheme(SubDivisionScheme::CatmullClark), levels(0), controlVertexCount(
+				0), controlTriCount(0), controlQuadCount(0), controlFaceHash(0) {
+}
+void SubdivisionStencils::clear() {
+	levels = 0;
+	controlVertexCount = 0;
+	controlTriCount = 0;
+	controlQuadCount = 0;
+	controlFaceHash = 0;
+	vertexStencils.clear();
+	varyingStencils.clear();
+	faceVaryingStencils.clear();
+	tris.clear();
+	quads.clear();
+}
+void SubdivisionStencils::build(const Mesh& control,
+		SubDivisionScheme scheme, int levels,
+		const std::vector<uint8_t>& faceMask) {
+	const size_t faceCount = control.triIndexes.size()
+			+ control.quadIndexes.size();
+	if (scheme == SubDivisionScheme::Loop && control.quadIndexes.size() > 0) {
+		throw std::runtime_error(
+				"Loop subdivision stencils need a triangle mesh.");
+	}
+	if (faceMask.size() != 0 && faceMask.size() != faceCount) {
+		throw std::runtime_error(
+				MakeString() << "Face mask has " << faceMask.size()
+						<< " entries, but the mesh has " << faceCount
+						<< " faces.");
+	}
+	clear();
+	this->scheme = scheme;
+	this->levels = std::max(levels, 0);
+	controlVertexCount = (uint32_t) control.vertexLocations.size();
+	controlTriCount = (uint32_t) control.triIndexes.size();
+	controlQuadCount = (uint32_t) control.quadIndexes.size();
+	controlFaceHash = MeshTopology::hashFaces(control.triIndexes.data,
+			control.quadIndexes.data);
+	const bool hasColor = (control.vertexColors.size()
+			== control.vertexLocations.size()
+			&& control.vertexColors.size() > 0);
+	const bool hasUVs = (control.textureMap.size()
+			== 3 * controlTriCount + 4 * controlQuadCount && faceCount > 0);
+	tris = control.triIndexes.data;
+	quads = control.quadIndexes.data;
+	std::vector<uint8_t> mask = faceMask;
+	size_t vertexCount = controlVertexCount;
+	//The first level is used as is and later levels are composed onto it.
+	auto accumulate = [](int l, StencilTable& table, StencilTable& stencils) {
+		if (l == 0) {
+			std::swap(table, stencils);
+		} else {
+			ComposeStencilTables(table, stencils, stencils);
+		}
+	};
+	for (int l = 0; l < this->levels; l++) {
+		SubdivisionLevel level(scheme, vertexCount, tris, quads, mask);
+		level.classify();
+		level.buildFaces();
+		StencilTable table;
+		BuildStencilTable(level.vertexCount(),
+				[&](uint32_t i, std::vector<StencilEntry>& entries) {
+					level.vertexRow(i, entries);
+				}, table);
+		accumulate(l, table, vertexStencils);
+		if (hasColor) {
+			BuildStencilTable(level.vertexCount(),
+					[&](uint32_t i, std::vector<StencilEntry>& entries) {
+						level.varyingRow(i, entries);
+					}, table);
+			accumulate(l, table, varyingStencils);
+		}
+		if (hasUVs) {
+			BuildStencilTable(
+					level.triSources.size() + level.quadSources.size(),
+					[&](uint32_t i, std::vector<StencilEntry>& entries) {
+						level.faceVaryingRow(i, entries);
+					}, table);
+			accumulate(l, table, faceVaryingStencils);
+		}
+		std::vector<uint3> newTris(level.triSources.size() / 3);
+		std::vector<uint4> newQuads(level.quadSources.size() / 4);
+#pragma omp parallel for
+		for (int64_t t = 0; t < (int64_t) newTris.size(); t++) {
+			for (int k = 0; k < 3; k++) {
+				newTris[t][k] = level.sourceVertex(level.triSources[3 * t + k]);
+			}
+		}
+#pragma omp parallel for
+		for (int64_t q = 0; q < (int64_t) newQuads.size(); q++) {
+			for (int k = 0; k < 4; k++) {
+				newQuads[q][k] = level.sourceVertex(level.quadSources[4 * q + k]);
+			}
+		}
+		vertexCount = level.vertexCount();
+		if (faceMask.size() != 0) {
+			mask.swap(level.childMask);
+		}
+		tris.swap(newTris);
+		quads.swap(newQuads);
+	}
+	if (this->levels == 0) {
+		auto identity = [](size_t count, StencilTable& table) {
+			BuildStencilTable(count,
+					[](uint32_t i, std::vector<StencilEntry>& entries) {
+						entries.push_back(StencilEntry(i, 1.0f));
+					}, table);
+		};
+		identity(vertexCount, vertexStencils);
+		if (hasColor) {
+			identity(vertexCount, varyingStencils);
+		}
+		if (hasUVs) {
+			identity(control.textureMap.size(), faceVaryingStencils);
+		}
+	}
+}
+bool SubdivisionStencils::matches(const Mesh& control) const {
+	return (control.vertexLocations.size() == controlVertexCount
+			&& control.triIndexes.size() == controlTriCount
+			&& control.quadIndexes.size() == controlQuadCount
+			&& MeshTopology::hashFaces(control.triIndexes.data,
+					control.quadIndexes.data) == controlFaceHash);
+}
+void SubdivisionStencils::evaluate(const Vector3f& control,
+		Vector3f& refined) const {
+	if (control.size() != controlVertexCount) {
+		throw std::runtime_error(
+				MakeString() << "Subdivision stencils expect "
+						<< controlVertexCount << " control vertexes, not "
+						<< control.size() << ".");
+	}
+	std::vector<float3> result;
+	vertexStencils.apply(control.data, result);
+	refined.data.swap(result);
+}
+void SubdivisionStencils::evaluate(const Mesh& control, Mesh& refined) const {
+	if (!matches(control)) {
+		throw std::runtime_error(
+				"Subdivision stencils were built for a different mesh.");
+	}
+	const bool hasNormals = (control.vertexNormals.size() > 0);
+	const bool hasColor = (!varyingStencils.empty()
+			&& control.vertexColors.size() == controlVertexCount);
+	const bool hasUVs = (!faceVaryingStencils.empty()
+			&& control.textureMap.size() == 3 * controlTriCount + 4 * controlQuadCount);
+	std::vector<float3> points;
+	std::vector<float4> colors;
+	std::vector<float2> uvs;
+	vertexStencils.apply(control.vertexLocations.data, points);
+	if (hasColor) {
+		varyingStencils.apply(control.vertexColors.data, colors);
+	}
+	if (hasUVs) {
+		faceVaryingStencils.apply(control.textureMap.data, uvs);
+	}
+	if (&refined != &control) {
+		refined.lineIndexes = control.lineIndexes;
+		refined.pointIndexes = control.pointIndexes;
+		refined.textureImage = control.textureImage;
+		refined.pose = control.pose;
+	}
+	refined.vertexLocations.data.swap(points);
+	refined.vertexColors.data.swap(colors);
+	refined.textureMap.data.swap(uvs);
+	refined.triIndexes.data = tris;
+	refined.quadIndexes.data = quads;
+	refined.vertexNormals.clear();
+	if (hasNormals) {
+		refined.updateVertexNormals();
+	}
+	if (tris.size() > 0 && quads.size() > 0) {
+		refined.setType(GLMesh::PrimitiveType::ALL);
+	} else {
+		refined.setType(
+				(quads.size() > 0) ?
+						GLMesh::PrimitiveType::QUADS :
+						GLMesh::PrimitiveType::TRIANGLES);
+	}
+	refined.setDirty(true);
+}
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright(C) 2015, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef ALLOYSUBDIVISION_H_
+#define ALLOYSUBDIVISION_H_
+#include "graphics/AlloyMesh.h"
+#include <vector>
+namespace aly {
+bool SANITY_CHECK_SUBDIVISION_STENCILS();
+/*
+ Sparse weights that give every refined value as a weighted sum of control
+ values, stored row by row.
+ */
+struct StencilTable {
+	std::vector<uint32_t> offsets;
+	std::vector<uint32_t> indexes;
+	std::vector<float> weights;
+	StencilTable() :
+			offsets(1, 0) {
+	}
+	size_t size() const {
+		return offsets.size() - 1;
+	}
+	bool empty() const {
+		return (offsets.size() <= 1);
+	}
+	void clear() {
+		offsets.assign(1, 0);
+		indexes.clear();
+		weights.clear();
+	}
+	//dst must not alias src.
+	template<class T> void apply(const std::vector<T>& src,
+			std::vector<T>& dst) const {
+		const int64_t N = (int64_t) size();
+		dst.resize(N);
+#pragma omp parallel for
+		for (int64_t i = 0; i < N; i++) {
+			T sum(0.0f);
+			for (uint32_t j = offsets[i]; j < offsets[i + 1]; j++) {
+				sum += weights[j] * src[indexes[j]];
+			}
+			dst[i] = sum;
+		}
+	}
+};
+/*
+ Catmull-Clark or Loop subdivision factorized into stencil tables. build()
+ refines the topology once and folds every level into tables that map the
+ control mesh straight to the refined mesh, so a deformed or animated control
+ mesh is re-subdivided with evaluate() alone. An optional face mask limits
+ refinement to a region; faces next to the region are split just enough to
+ keep the refined mesh free of cracks.
+ */
+class SubdivisionStencils {
+protected:
+	SubDivisionScheme scheme;
+	int levels;
+	uint32_t controlVertexCount;
+	uint32_t controlTriCount;
+	uint32_t controlQuadCount;
+	uint64_t controlFaceHash;
+public:
+	//Refined vertexes from control vertexes, using the smooth subdivision rules.
+	StencilTable vertexStencils;
+	//Refined vertexes from control vertexes by linear interpolation, used for colors.
+	StencilTable varyingStencils;
+	//Refined face corners from control face corners, used for texture coordinates.
+	StencilTable faceVaryingStencils;
+	std::vector<uint3> tris;
+	std::vector<uint4> quads;
+	SubdivisionStencils();
+	/*
+	 Colors and texture coordinates get stencils only when the control mesh
+	 has them. faceMask selects the faces to refine, triangles first and then
+	 quads; an empty mask refines everything. Loop subdivision needs a
+	 triangle mesh.
+	 */
+	void build(const Mesh& control, SubDivisionScheme scheme, int levels = 1,
+			const std::vector<uint8_t>& faceMask = std::vector<uint8_t>());
+	void clear();
+	//Whether the stencils were built for a mesh with the same vertex count and faces.
+	bool matches(const Mesh& control) const;
+	//Writes the refined mesh. control and refined may be the same mesh.
+	void evaluate(const Mesh& control, Mesh& refined) const;
+	void evaluate(const Vector3f& control, Vector3f& refined) const;
+	SubDivisionScheme getScheme() const {
+		return scheme;
+	}
+	int getLevels() const {
+		return levels;
+	}
+	size_t getVertexCount() const {
+		return vertexStencils.size();
+	}
+};
+}
+#endif
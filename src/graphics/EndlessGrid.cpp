@@ -135,7 +135,7 @@ void FloodFill(EndlessGrid<float>& grid, float narrowBand) {
 			-1, -1, -1, -1, -1, -1, -1, -1, -1 };
 	float backgroundValue = grid.getBackgroundValue();
 	std::set<EndlessNodeFloat*> parents;
-	std::list<EndlessNodeFloat*> leafs = grid.getLeafNodes();
+	std::vector<EndlessNodeFloat*> leafs = grid.getLeafNodes();
 	for (EndlessNodeFloat* leaf : leafs) {
 		if (leaf->parent != nullptr)
 			leaf->parent->data[leaf->parent->getIndex(leaf)] = 0;
@@ -920,7 +920,7 @@ float4x4 MeshToLevelSet(const Mesh& mesh, EndlessGrid<float>& grid,
 		}
 	}
 	splats.clear();
-	std::list<EndlessNodeFloat*> leafs = grid.getLeafNodes();
+	std::vector<EndlessNodeFloat*> leafs = grid.getLeafNodes();
 	assert(leafs.size() > 0);
 	grid.allocateInternalNodes();
 	//Flood fill leaf nodes with narrowband value.
@@ -54,11 +54,13 @@ template<typename T, int N> struct Stencil {
 		return data[i - M][j - M][k - M];
 	}
 };
+template<typename T> class EndlessGridAccessor;
 template<typename T> class EndlessGrid {
+	friend class EndlessGridAccessor<T>;
 	std::vector<int> levels; //in local units
 	std::vector<int> gridSizes; //in world grid units
 	std::vector<int> cellSizes; //in world grid units
-	std::vector<std::unique_ptr<EndlessNode<T>>> nodes;
+	std::unique_ptr<EndlessNodePool<T>> pool;
 	std::unordered_map<int3, int> indexes;
 	T backgroundValue;
 	int roundDown(int val, int size) const {
@@ -70,15 +72,23 @@ template<typename T> class EndlessGrid {
 		}
 		return ret;
 	}
-
+	inline int3 getRootKey(int i, int j, int k) const {
+		int sz = gridSizes[0];
+		return int3(roundDown(i, sz), roundDown(j, sz), roundDown(k, sz));
+	}
+	//Child of an internal node at depth c, created if it does not exist.
+	inline EndlessNode<T>* allocateChild(EndlessNode<T>* node, int c,
+			const int3& pos) {
+		return node->getChild(pos.x, pos.y, pos.z, cellSizes[c], levels[c + 1],
+				backgroundValue, (c == (int) levels.size() - 2), *pool, c + 1);
+	}
 public:
 	inline void clear() {
-		nodes.clear();
+		pool->clear();
 		indexes.clear();
 	}
 	void reset(const std::initializer_list<int>& l, T bgValue) {
 		indexes.clear();
-		nodes.clear();
 		backgroundValue = bgValue;
 		levels = l;
 		gridSizes.resize(levels.size(), 0);
@@ -89,10 +99,10 @@ public:
 			gridSizes[c] = gridSizes[c + 1] * levels[c];
 			cellSizes[c] = gridSizes[c + 1];
 		}
+		pool->setDepth(levels.size());
 	}
 	void reset(const std::vector<int>& l, T bgValue) {
 		indexes.clear();
-		nodes.clear();
 		backgroundValue = bgValue;
 		levels = l;
 		gridSizes.resize(levels.size(), 0);
@@ -103,6 +113,7 @@ public:
 			gridSizes[c] = gridSizes[c + 1] * levels[c];
 			cellSizes[c] = gridSizes[c + 1];
 		}
+		pool->setDepth(levels.size());
 	}
 	inline void setBackgroundValue(T val) {
 		backgroundValue = val;
@@ -123,6 +134,7 @@ public:
 			gridSizes[c] = gridSizes[c + 1] * levels[c];
 			cellSizes[c] = gridSizes[c + 1];
 		}
+		pool.reset(new EndlessNodePool<T>(levels.size()));
 	}
 	EndlessGrid(const std::vector<int>& l, T bgValue) {
 		backgroundValue = bgValue;
@@ -135,12 +147,15 @@ public:
 			gridSizes[c] = gridSizes[c + 1] * levels[c];
 			cellSizes[c] = gridSizes[c + 1];
 		}
+		pool.reset(new EndlessNodePool<T>(levels.size()));
 	}
-
+	EndlessGrid(const EndlessGrid<T>&) = delete;
+	EndlessGrid<T>& operator=(const EndlessGrid<T>&) = delete;
 	std::vector<std::pair<int3, EndlessNode<T>*>> getNodes() const {
 		std::vector<std::pair<int3, EndlessNode<T>*>> result;
+		const std::vector<EndlessNode<T>*>& roots = pool->getNodes(0);
 		for (auto pr : indexes) {
-			result.push_back( { pr.first, nodes[pr.second].get() });
+			result.push_back( { pr.first, roots[pr.second] });
 		}
 		return result;
 	}
@@ -166,7 +181,7 @@ public:
 		return gridSizes[0];
 	}
 	inline size_t getNodeCount() const {
-		return nodes.size();
+		return pool->getNodes(0).size();
 	}
 	inline int getTreeDepth() const {
 		return (int)levels.size();
@@ -198,44 +213,48 @@ public:
 		return node;
 	}
 	inline void allocateInternalNodes() {
-		for (const std::unique_ptr<EndlessNode<T>>& node : nodes) {
-			if (!node->isLeaf())
-				node->allocate(backgroundValue);
-		}
-	}
-	inline void getLeafNodes(std::list<int3>& positions,
-			std::list<EndlessNode<T>*>& result) {
-		positions.clear();
-		result.clear();
-		for (auto node : nodes) {
-			if (node->isLeaf()) {
-				result.push_back(node);
-			} else {
-				node->getLeafNodes(positions, result, cellSizes);
+		for (int c = 0; c < (int) levels.size() - 1; c++) {
+			for (EndlessNode<T>* node : pool->getNodes(c)) {
+				if (!node->hasData())
+					node->data.resize(node->dim * node->dim * node->dim,
+							backgroundValue);
 			}
 		}
 	}
-	inline std::list<EndlessNode<T>*> getLeafNodes() const {
-		std::list<EndlessNode<T>*> result;
-		for (const std::unique_ptr<EndlessNode<T>>& node : nodes) {
-			if (node->isLeaf()) {
-				result.push_back(node.get());
-			} else {
-				node->getLeafNodes(result);
-			}
+	//Leaves in allocation order, read from the node pool without walking the tree.
+	inline std::vector<EndlessNode<T>*> getLeafNodes() const {
+		return pool->getNodes((int) levels.size() - 1);
+	}
+	inline std::vector<EndlessNode<T>*> getNodesAtDepth(int d) const {
+		return pool->getNodes(d);
+	}
+	inline size_t getLeafCount() const {
+		return pool->getNodes((int) levels.size() - 1).size();
+	}
+	/*
+	 Calls func(leaf) for every leaf in parallel. func may read anything and
+	 write the data of its own leaf, but must not create nodes.
+	 */
+	template<class F> void forEachLeaf(F func) const {
+		const std::vector<EndlessNode<T>*>& leafs = pool->getNodes(
+				(int) levels.size() - 1);
+		const int64_t N = (int64_t) leafs.size();
+#pragma omp parallel for
+		for (int64_t n = 0; n < N; n++) {
+			func(leafs[n]);
 		}
-		return result;
 	}
-	inline std::list<EndlessNode<T>*> getNodesAtDepth(int d) const {
-		std::list<EndlessNode<T>*> result;
-		for (auto node : nodes) {
-			if (d == 0) {
-				result.push_back(node);
-			} else {
-				node->getNodesAtDepth(result, d);
-			}
+	//Allocates a leaf here for every leaf allocated in other. Both grids must have the same levels.
+	template<class S> void unionTopology(const EndlessGrid<S>& other) {
+		if (other.getLevelSizes() != levels) {
+			throw std::runtime_error(
+					"Cannot union topology of grids with different levels.");
+		}
+		EndlessGridAccessor<T> accessor(*this);
+		for (EndlessNode<S>* leaf : other.getLeafNodes()) {
+			accessor.getLeaf(leaf->location.x, leaf->location.y,
+					leaf->location.z);
 		}
-		return result;
 	}
 	T& getLeafValue(int i, int j, int k) {
 		int sz = gridSizes[0];
@@ -255,8 +274,7 @@ public:
 			iii = iii % cdim;
 			jjj = jjj % cdim;
 			kkk = kkk % cdim;
-			node = node->getChild(pos.x, pos.y, pos.z, cdim, levels[c + 1],
-					backgroundValue, (c == levels.size() - 2));
+			node = allocateChild(node, c, pos);
 		}
 		return (*node)(iii, jjj, kkk);
 	}
@@ -659,7 +677,7 @@ public:
 	EndlessNode<T>* getNodeIfExists(int ti, int tj, int tk) const {
 		auto idx = indexes.find(int3(ti, tj, tk));
 		if (idx != indexes.end()) {
-			return nodes[idx->second].get();
+			return pool->getNodes(0)[idx->second];
 		} else {
 			return nullptr;
 		}
@@ -667,16 +685,135 @@ public:
 	EndlessNode<T>* getNode(int ti, int tj, int tk) {
 		auto idx = indexes.find(int3(ti, tj, tk));
 		if (idx != indexes.end()) {
-			return nodes[idx->second].get();
+			return pool->getNodes(0)[idx->second];
 		} else {
-			EndlessNode<T>* node = new EndlessNode<T>(levels[0],
-					backgroundValue, levels.size() <= 1);
-			indexes[int3(ti, tj, tk)] = (int) nodes.size();
-			node->location = int3(ti * gridSizes[0], tj * gridSizes[0],
-					tk * gridSizes[0]);
-			nodes.push_back(std::unique_ptr<EndlessNode<T>>(node));
-			return node;
+			indexes[int3(ti, tj, tk)] = (int) pool->getNodes(0).size();
+			return pool->allocate(0, levels[0], backgroundValue,
+					levels.size() <= 1, nullptr,
+					int3(ti * gridSizes[0], tj * gridSizes[0],
+							tk * gridSizes[0]));
+		}
+	}
+};
+/*
+ Caches the nodes on the path to the last voxel it visited. A lookup starts
+ from the deepest cached node that contains the voxel, so coherent access
+ (stencils, scanlines, narrow band marching) skips the root hash and most of
+ the tree walk. Use one accessor per thread, and discard it after the grid is
+ cleared. Accessors that create nodes must not run concurrently with any other
+ access to the grid.
+ */
+template<typename T> class EndlessGridAccessor {
+protected:
+	EndlessGrid<T>* grid;
+	const EndlessGrid<T>* constGrid;
+	std::vector<EndlessNode<T>*> path;
+	int depth;
+	inline bool contains(const EndlessNode<T>* node, int c, int i, int j,
+			int k) const {
+		const unsigned int sz = (unsigned int) constGrid->gridSizes[c];
+		return ((unsigned int) (i - node->location.x) < sz
+				&& (unsigned int) (j - node->location.y) < sz
+				&& (unsigned int) (k - node->location.z) < sz);
+	}
+	inline int findCached(int i, int j, int k) const {
+		for (int c = depth - 1; c >= 0; c--) {
+			if (path[c] != nullptr && contains(path[c], c, i, j, k)) {
+				return c;
+			}
 		}
+		return -1;
+	}
+	inline int3 childPosition(const EndlessNode<T>* node, int c, int i, int j,
+			int k) const {
+		const int cdim = constGrid->cellSizes[c];
+		return int3((i - node->location.x) / cdim, (j - node->location.y) / cdim,
+				(k - node->location.z) / cdim);
+	}
+public:
+	EndlessGridAccessor(EndlessGrid<T>& grid) :
+			grid(&grid), constGrid(&grid), path(grid.getTreeDepth(), nullptr), depth(
+					grid.getTreeDepth()) {
+	}
+	EndlessGridAccessor(const EndlessGrid<T>& grid) :
+			grid(nullptr), constGrid(&grid), path(grid.getTreeDepth(), nullptr), depth(
+					grid.getTreeDepth()) {
+	}
+	inline void reset() {
+		std::fill(path.begin(), path.end(), nullptr);
+	}
+	//Leaf containing the voxel, or null if it has not been allocated.
+	EndlessNode<T>* findLeaf(int i, int j, int k) {
+		int c = findCached(i, j, k);
+		if (c == depth - 1) {
+			return path[c];
+		}
+		if (c < 0) {
+			int3 key = constGrid->getRootKey(i, j, k);
+			EndlessNode<T>* root = constGrid->getNodeIfExists(key.x, key.y, key.z);
+			if (root == nullptr)
+				return nullptr;
+			path[0] = root;
+			c = 0;
+		}
+		EndlessNode<T>* node = path[c];
+		for (; c < depth - 1; c++) {
+			int3 pos = childPosition(node, c, i, j, k);
+			node = node->getChild(pos.x, pos.y, pos.z);
+			if (node == nullptr)
+				return nullptr;
+			path[c + 1] = node;
+		}
+		return node;
+	}
+	//Leaf containing the voxel, created if it does not exist.
+	EndlessNode<T>* getLeaf(int i, int j, int k) {
+		int c = findCached(i, j, k);
+		if (c == depth - 1) {
+			return path[c];
+		}
+		if (grid == nullptr) {
+			throw std::runtime_error(
+					"Cannot allocate nodes through a read-only grid accessor.");
+		}
+		if (c < 0) {
+			int3 key = grid->getRootKey(i, j, k);
+			path[0] = grid->getNode(key.x, key.y, key.z);
+			c = 0;
+		}
+		EndlessNode<T>* node = path[c];
+		for (; c < depth - 1; c++) {
+			node = grid->allocateChild(node, c, childPosition(node, c, i, j, k));
+			path[c + 1] = node;
+		}
+		return node;
+	}
+	//Leaf value, or the background value if the voxel is not allocated.
+	inline T getValue(int i, int j, int k) {
+		EndlessNode<T>* leaf = findLeaf(i, j, k);
+		if (leaf == nullptr)
+			return constGrid->getBackgroundValue();
+		return (*leaf)(i - leaf->location.x, j - leaf->location.y,
+				k - leaf->location.z);
+	}
+	inline T* getValuePtr(int i, int j, int k) {
+		EndlessNode<T>* leaf = findLeaf(i, j, k);
+		if (leaf == nullptr)
+			return nullptr;
+		return &(*leaf)(i - leaf->location.x, j - leaf->location.y,
+				k - leaf->location.z);
+	}
+	//Leaf value, allocating the leaf if it does not exist.
+	inline T& operator()(int i, int j, int k) {
+		EndlessNode<T>* leaf = getLeaf(i, j, k);
+		return (*leaf)(i - leaf->location.x, j - leaf->location.y,
+				k - leaf->location.z);
+	}
+	inline T& operator()(const int3& pos) {
+		return operator()(pos.x, pos.y, pos.z);
+	}
+	inline void setValue(int i, int j, int k, const T& value) {
+		operator()(i, j, k) = value;
 	}
 };
 
@@ -23,8 +23,12 @@
 #define INCLUDE_GRID_ENDLESSNODE_H_
 
 #include <list>
+#include <memory>
+#include <new>
+#include <type_traits>
 #include "math/AlloyVecMath.h"
 namespace aly {
+template<typename T> class EndlessNodePool;
 struct EndlessLocation: public std::vector<int3> {
 	aly::int3 nodePosition;
 	aly::int3 localPosition;
@@ -54,7 +58,7 @@ public:
 	int3 location;
 	std::vector<int> indexes;
 	std::vector<T> data;
-	std::vector<std::unique_ptr<EndlessNode<T>>> children;
+	std::vector<EndlessNode<T>*> children;
 	bool isLeaf() const {
 		return (indexes.size() == 0);
 	}
@@ -63,7 +67,7 @@ public:
 	}
 	void allocate(T backgroundValue) {
 		data.resize(dim*dim*dim,backgroundValue);
-		for(const std::unique_ptr<EndlessNode<T>>& child:children){
+		for(EndlessNode<T>* child:children){
 			if(!child->isLeaf())child->allocate(backgroundValue);
 		}
 	}
@@ -93,9 +97,9 @@ public:
 		}
 	}
 	void getLeafNodes(std::list<EndlessNode<T>*>& result) const {
-		for (const std::unique_ptr<EndlessNode<T>>& child : children) {
+		for (EndlessNode<T>* child : children) {
 			if (child->isLeaf()) {
-				result.push_back(child.get());
+				result.push_back(child);
 			} else {
 				child->getLeafNodes(result);
 			}
@@ -130,7 +134,7 @@ public:
 	}
 	inline int getIndex(EndlessNode<T>* node){
 		for(int i=0;i<children.size();i++){
-			if(children[i].get()==node){
+			if(children[i]==node){
 				for(int n=0;n<indexes.size();n++){
 					if(indexes[n]==i)return n;
 				}
@@ -198,27 +202,27 @@ public:
 		return (idx < 0 || idx >= children.size());
 	}
 	EndlessNode<T>* addChild(int i, int j, int k, int d,T bgValue,
-			bool isLeaf) {
+			bool isLeaf,EndlessNodePool<T>& pool,int depth) {
 		int& idx = indexes[i + (j + k * dim) * dim];
 		idx = (int) children.size();
-		EndlessNode<T>* node = new EndlessNode<T>(d,bgValue, isLeaf, this,location+int3(d*i, d*j, d*k));
+		EndlessNode<T>* node = pool.allocate(depth,d,bgValue, isLeaf, this,location+int3(d*i, d*j, d*k));
 		node->setId(i,j,k);
-		children.push_back(std::unique_ptr<EndlessNode<T>>(node));
+		children.push_back(node);
 		return node;
 	}
-	EndlessNode<T>* getChild(int i, int j, int k, int c, int d,T bgValue,bool isLeaf) {
+	EndlessNode<T>* getChild(int i, int j, int k, int c, int d,T bgValue,bool isLeaf,EndlessNodePool<T>& pool,int depth) {
 		//assert(i>=0&&i<dim);
 		//assert(j>=0&&j<dim);
 		//assert(k>=0&&k<dim);
 		int& idx = indexes[i + (j + k * dim) * dim];
 		if (idx < 0) {
 			idx = (int) children.size();
-			EndlessNode<T>* node = new EndlessNode<T>(d,bgValue, isLeaf, this, location+int3(c*i, c*j, c*k));
+			EndlessNode<T>* node = pool.allocate(depth,d,bgValue, isLeaf, this, location+int3(c*i, c*j, c*k));
 			node->setId(i,j,k);
-			children.push_back(std::unique_ptr<EndlessNode<T>>(node));
+			children.push_back(node);
 			return node;
 		}
-		return children[idx].get();
+		return children[idx];
 	}
 	inline EndlessNode<T>* getChild(int i, int j, int k) const {
 		if(		i<0||i>=dim||
@@ -230,10 +234,72 @@ public:
 		if (idx < 0||idx>=children.size()) {
 			return nullptr;
 		}
-		return children[idx].get();
+		return children[idx];
 	}
 
 };
+/*
+ Owns all nodes of an EndlessGrid. Nodes are constructed in place in fixed
+ size chunks, so creating a node never moves existing ones, and the nodes of
+ each tree level are kept in a flat list that can be iterated (or split across
+ threads) without walking the tree. Allocation is not thread safe.
+ */
+template<typename T> class EndlessNodePool {
+protected:
+	static const size_t CHUNK_SIZE = 256;
+	typedef typename std::aligned_storage<sizeof(EndlessNode<T>),
+			alignof(EndlessNode<T>)>::type Storage;
+	std::vector<std::unique_ptr<Storage[]>> chunks;
+	size_t chunkFill;
+	std::vector<std::vector<EndlessNode<T>*>> levels;
+public:
+	EndlessNodePool(size_t depth = 0) :
+			chunkFill(CHUNK_SIZE), levels(depth) {
+	}
+	EndlessNodePool(const EndlessNodePool<T>&) = delete;
+	EndlessNodePool<T>& operator=(const EndlessNodePool<T>&) = delete;
+	~EndlessNodePool() {
+		clear();
+	}
+	void clear() {
+		for (std::vector<EndlessNode<T>*>& level : levels) {
+			for (EndlessNode<T>* node : level) {
+				node->~EndlessNode<T>();
+			}
+			level.clear();
+		}
+		chunks.clear();
+		chunkFill = CHUNK_SIZE;
+	}
+	void setDepth(size_t depth) {
+		clear();
+		levels.resize(depth);
+	}
+	size_t getDepth() const {
+		return levels.size();
+	}
+	EndlessNode<T>* allocate(int depth, int dim, T bgValue, bool isLeaf,
+			EndlessNode<T>* parent, int3 location) {
+		if (chunkFill == CHUNK_SIZE) {
+			chunks.push_back(std::unique_ptr<Storage[]>(new Storage[CHUNK_SIZE]));
+			chunkFill = 0;
+		}
+		EndlessNode<T>* node = new (&chunks.back()[chunkFill++]) EndlessNode<T>(
+				dim, bgValue, isLeaf, parent, location);
+		levels[depth].push_back(node);
+		return node;
+	}
+	inline const std::vector<EndlessNode<T>*>& getNodes(int depth) const {
+		return levels[depth];
+	}
+	size_t size() const {
+		size_t count = 0;
+		for (const std::vector<EndlessNode<T>*>& level : levels) {
+			count += level.size();
+		}
+		return count;
+	}
+};
 }
 
 #endif /* INCLUDE_GRID_ENDLESSNODE_H_ */
@@ -6,377 +6,506 @@
  */
 
 #include "graphics/MeshDecimation.h"
+#include "graphics/AlloyMeshTopology.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
 namespace aly {
-void DeadTriangle::set(DeadVertex *v0, DeadVertex *v1, DeadVertex *v2) {
-	//assert(v0 != v1 && v1 != v2 && v2 != v0);
-	vertex[0] = v0;
-	vertex[1] = v1;
-	vertex[2] = v2;
-
-	vertex[0]->faces.insert(this);
-	vertex[1]->faces.insert(this);
-	vertex[2]->faces.insert(this);
-
-	vertex[0]->neighbors.insert(vertex[1]);
-	vertex[0]->neighbors.insert(vertex[2]);
-
-	vertex[1]->neighbors.insert(vertex[2]);
-	vertex[1]->neighbors.insert(vertex[0]);
-
-	vertex[2]->neighbors.insert(vertex[0]);
-	vertex[2]->neighbors.insert(vertex[1]);
-
-}
-void DeadVertex::remove(DeadTriangle* tri) {
-	auto ptr = faces.find(tri);
-	if (ptr != faces.end()) {
-		faces.erase(ptr);
-	}
+static const uint8_t BOUNDARY_VERTEX = 1;
+static const uint8_t LOCKED_VERTEX = 2;
+static const uint64_t NO_COLLAPSE = std::numeric_limits<uint64_t>::max();
+void Quadric::addPlane(const float3& n, const float3& pt, double weight) {
+	double nx = n.x, ny = n.y, nz = n.z;
+	double d = -(nx * pt.x + ny * pt.y + nz * pt.z);
+	a00 += weight * nx * nx;
+	a01 += weight * nx * ny;
+	a02 += weight * nx * nz;
+	a11 += weight * ny * ny;
+	a12 += weight * ny * nz;
+	a22 += weight * nz * nz;
+	b0 += weight * d * nx;
+	b1 += weight * d * ny;
+	b2 += weight * d * nz;
+	c += weight * d * d;
+	w += weight;
 }
-void DeadVertex::remove(DeadVertex* nbr) {
-	auto ptr = neighbors.find(nbr);
-	if (ptr != neighbors.end()) {
-		neighbors.erase(ptr);
-	}
-}
-bool DeadTriangle::hasVertex(DeadVertex *v) {
-	return (v == vertex[0] || v == vertex[1] || v == vertex[2]);
+Quadric& Quadric::operator+=(const Quadric& q) {
+	a00 += q.a00;
+	a01 += q.a01;
+	a02 += q.a02;
+	a11 += q.a11;
+	a12 += q.a12;
+	a22 += q.a22;
+	b0 += q.b0;
+	b1 += q.b1;
+	b2 += q.b2;
+	c += q.c;
+	w += q.w;
+	return *this;
 }
-float3 DeadTriangle::updateNormal(Mesh& mesh) {
-	return normal = computeNormal(mesh);
+double Quadric::evaluate(const float3& pt) const {
+	double x = pt.x, y = pt.y, z = pt.z;
+	return a00 * x * x + a11 * y * y + a22 * z * z
+			+ 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z)
+			+ 2.0 * (b0 * x + b1 * y + b2 * z) + c;
 }
-float3 DeadTriangle::computeNormal(Mesh& mesh) {
-	float3 v0 = mesh.vertexLocations[vertex[0]->id];
-	float3 v1 = mesh.vertexLocations[vertex[1]->id];
-	float3 v2 = mesh.vertexLocations[vertex[2]->id];
-	return normalize(cross(v2 - v0, v1 - v0));
+bool Quadric::minimize(float3& x) const {
+	const double m[9] = { a00, a01, a02, a01, a11, a12, a02, a12, a22 };
+	double3x3 A(m);
+	double det = determinant(A);
+	double trace = a00 + a11 + a22;
+	//Planes that are nearly parallel, as on flat or cylindrical patches, leave a line or plane of minima.
+	if (trace <= 0.0 || std::abs(det) < 1E-6 * trace * trace * trace) {
+		return false;
+	}
+	double3 pt = -(inverse(A) * double3(b0, b1, b2));
+	x = float3((float) pt.x, (float) pt.y, (float) pt.z);
+	return true;
 }
-void DeadTriangle::remove() {
-	if (valid) {
-		valid = false;
-		for (int i = 0; i < 3; i++) {
-			if (vertex[i]) {
-				vertex[i]->remove(this);
-			}
-		}
-		for (int i = 0; i < 3; i++) {
-			int i2 = (i + 1) % 3;
-			if (!vertex[i] || !vertex[i2])
-				continue;
-			vertex[i]->removeIfNonNeighbor(vertex[i2]);
-			vertex[i2]->removeIfNonNeighbor(vertex[i]);
+/*
+ Mean squared distance of the best point for collapsing edge e, or infinity
+ if the collapse would change the topology of the surface or fold a face over.
+ */
+static float EvaluateCollapse(const MeshTopology& topo,
+		const std::vector<uint3>& tris, const std::vector<float3>& points,
+		const std::vector<Quadric>& quadrics,
+		const std::vector<uint8_t>& vertexFlags, uint32_t e, float maxError,
+		float3& target) {
+	const float INVALID = std::numeric_limits<float>::infinity();
+	uint32_t a = topo.edges[e].x;
+	uint32_t b = topo.edges[e].y;
+	uint32_t faceCount = topo.edgeFaceCount(e);
+	if (a == b || faceCount > 2
+			|| ((vertexFlags[a] | vertexFlags[b]) & LOCKED_VERTEX)) {
+		return INVALID;
+	}
+	//An interior edge between two boundaries would pinch the surface.
+	if (faceCount == 2 && (vertexFlags[a] & BOUNDARY_VERTEX)
+			&& (vertexFlags[b] & BOUNDARY_VERTEX)) {
+		return INVALID;
+	}
+	//Link condition: only the vertexes opposite the edge may be adjacent to both ends.
+	uint32_t common = 0;
+	uint32_t i = topo.ringOffsets[a], j = topo.ringOffsets[b];
+	while (i < topo.ringOffsets[a + 1] && j < topo.ringOffsets[b + 1]) {
+		uint32_t va = topo.ringVertices[i], vb = topo.ringVertices[j];
+		if (va == vb) {
+			common++;
+			i++;
+			j++;
+		} else if (va < vb) {
+			i++;
+		} else {
+			j++;
 		}
 	}
-}
-void DeadTriangle::replaceVertex(Mesh& mesh, DeadVertex *vold,
-		DeadVertex *vnew) {
-	//assert(vold && vnew);
-	//assert(vold == vertex[0] || vold == vertex[1] || vold == vertex[2]);
-	//assert(vnew != vertex[0] && vnew != vertex[1] && vnew != vertex[2]);
-	if (vold == vertex[0]) {
-		vertex[0] = vnew;
-	} else if (vold == vertex[1]) {
-		vertex[1] = vnew;
-	} else {
-		vertex[2] = vnew;
+	if (common != faceCount) {
+		return INVALID;
 	}
-	vold->remove(this);
-	vnew->faces.insert(this);
-	for (int i = 0; i < 3; i++) {
-		vold->removeIfNonNeighbor(vertex[i]);
-		vertex[i]->removeIfNonNeighbor(vold);
+	Quadric q = quadrics[a];
+	q += quadrics[b];
+	float3 pa = points[a], pb = points[b];
+	double error;
+	if (!q.minimize(target)) {
+		float3 options[3] = { 0.5f * (pa + pb), pa, pb };
+		error = std::numeric_limits<double>::max();
+		for (const float3& pt : options) {
+			double err = q.evaluate(pt);
+			if (err < error) {
+				error = err;
+				target = pt;
+			}
+		}
+	} else {
+		error = q.evaluate(target);
 	}
-
-	vertex[0]->neighbors.insert(vertex[1]);
-	vertex[0]->neighbors.insert(vertex[2]);
-
-	vertex[1]->neighbors.insert(vertex[2]);
-	vertex[1]->neighbors.insert(vertex[0]);
-
-	vertex[2]->neighbors.insert(vertex[0]);
-	vertex[2]->neighbors.insert(vertex[1]);
-
-	updateNormal(mesh);
-}
-bool DeadVertex::hasNeighbor(DeadVertex* nbr) {
-	return (neighbors.find(nbr) != neighbors.end());
-}
-void DeadVertex::removeIfNonNeighbor(DeadVertex *n) {
-	auto ptr = neighbors.find(n);
-	if (ptr == neighbors.end())
-		return;
-	for (DeadTriangle* f : faces) {	//Why do we need this check?
-		if (f->hasVertex(n))
-			return;
+	float cost = (float) (std::max(error, 0.0) / std::max(q.w, 1E-30));
+	if (cost > maxError) {
+		return INVALID;
 	}
-	neighbors.erase(ptr);
-}
-void DeadVertex::remove() {
-	if (valid) {
-		valid = false;
-		for (DeadVertex* v : neighbors) {
-			v->remove(this);
+	//Faces that survive the collapse must not flip.
+	for (uint32_t v : { a, b }) {
+		for (uint32_t c = topo.cornerOffsets[v]; c < topo.cornerOffsets[v + 1];
+				c++) {
+			uint32_t h = topo.vertexCorners[c];
+			const uint3& tri = tris[h / 3];
+			if ((tri.x == a || tri.y == a || tri.z == a)
+					&& (tri.x == b || tri.y == b || tri.z == b)) {
+				continue;
+			}
+			float3 p0 = points[tri.x], p1 = points[tri.y], p2 = points[tri.z];
+			float3 before = cross(p1 - p0, p2 - p0);
+			switch (h % 3) {
+			case 0:
+				p0 = target;
+				break;
+			case 1:
+				p1 = target;
+				break;
+			default:
+				p2 = target;
+			}
+			float3 after = cross(p1 - p0, p2 - p0);
+			if (dot(before, after) <= 0.0f && lengthSqr(before) > 0.0f) {
+				return INVALID;
+			}
 		}
 	}
+	return cost;
 }
-
-void MeshDecimation::solve(Mesh& mesh, float decimationAmount, bool flipNormals,const std::function<bool(const std::string& message, float progress)>& monitor) {
-	if(decimationAmount<=0.0f)return;
+MeshDecimation::MeshDecimation() :
+		boundaryWeight(100.0f) {
+}
+void MeshDecimation::solve(Mesh& mesh, float decimationAmount, bool flipNormals,
+		const std::function<bool(const std::string& message, float progress)>& monitor) {
+	if (decimationAmount <= 0.0f)
+		return;
 	if (flipNormals) {
 		mesh.flipNormals();
 	}
-	Vector3f& vertexLocations = mesh.vertexLocations;
-	Vector3f& vertexNormals = mesh.vertexNormals;
-	Vector4f& vertexColors = mesh.vertexColors;
-	Vector3ui& triIndexes = mesh.triIndexes;
-	size_t vertexCount = vertexLocations.size();
-	size_t triCount = triIndexes.size();
-	heap.reserve(vertexCount);
-	vertexes.resize(vertexCount);
-	triangles.resize(triCount);
-	for (size_t i = 0; i < vertexCount; i++) {
-		vertexes[i].id = i;
+	mesh.convertQuadsToTriangles();
+	size_t triangleCount = (size_t) ((1.0f - std::min(decimationAmount, 1.0f))
+			* mesh.triIndexes.size());
+	decimate(mesh, triangleCount, std::numeric_limits<float>::infinity(),
+			monitor);
+	if (flipNormals) {
+		mesh.flipNormals();
 	}
-	for (size_t i = 0; i < triCount; i++) {
-		uint3 tri = triIndexes[i];
-		triangles[i].set(&vertexes[tri.x], &vertexes[tri.y], &vertexes[tri.z]);
-		triangles[i].updateNormal(mesh);
+}
+void MeshDecimation::solveToTriangleCount(Mesh& mesh, size_t triangleCount,
+		const std::function<bool(const std::string& message, float progress)>& monitor) {
+	decimate(mesh, triangleCount, std::numeric_limits<float>::infinity(),
+			monitor);
+}
+void MeshDecimation::solveToError(Mesh& mesh, float maxError,
+		const std::function<bool(const std::string& message, float progress)>& monitor) {
+	decimate(mesh, 0, maxError, monitor);
+}
+void MeshDecimation::decimate(Mesh& mesh, size_t targetTriangles,
+		float maxError,
+		const std::function<bool(const std::string& message, float progress)>& monitor) {
+	mesh.convertQuadsToTriangles();
+	const size_t vertexCount = mesh.vertexLocations.size();
+	const size_t startCount = mesh.triIndexes.size();
+	if (startCount <= targetTriangles) {
+		return;
 	}
-	int targetRemoveCount = static_cast<int>(decimationAmount * vertexCount);
-	size_t lastRemoveCount = -1;
-	size_t removeCount = 0;
-
-	size_t validCount = vertexCount;
-	while (vertexCount - validCount < targetRemoveCount) {
-		float amt = (targetRemoveCount- (vertexCount - mesh.vertexLocations.size()))/ (float) mesh.vertexLocations.size();
-		size_t removeCount= decimateInternal(mesh, amt,(int)validCount, (int)targetRemoveCount, monitor);
-		validCount = 0;
-		for (const DeadVertex& v : vertexes) {
-			if (v.isValid())
-				validCount++;
-		}
-		removeCount = vertexCount - validCount;
-		if (removeCount == lastRemoveCount)
-			break;
-		lastRemoveCount = removeCount;
+	std::vector<float3>& points = mesh.vertexLocations.data;
+	std::vector<uint3> tris = mesh.triIndexes.data;
+	const bool hasNormals = (mesh.vertexNormals.size() == vertexCount);
+	const bool hasColors = (mesh.vertexColors.size() == vertexCount);
+	const bool hasUVs = (mesh.textureMap.size() == 3 * startCount);
+	std::vector<float2> uvs;
+	if (hasUVs) {
+		uvs = mesh.textureMap.data;
 	}
-	if (vertexColors.size() > 0) {
-		Vector3f vertexLocationsCopy = vertexLocations;
-		Vector3f vertexNormalsCopy = vertexNormals;
-		Vector4f vertexColorCopy = vertexColors;
-		vertexLocations.clear();
-		vertexNormals.clear();
-		vertexColors.clear();
-		vertexColors.data.reserve(vertexCount);
-		vertexNormals.data.reserve(vertexCount);
-		vertexLocations.data.reserve(vertexCount);
-		for (size_t i = 0; i < vertexCount; i++) {
-			DeadVertex& vert = vertexes[i];
-			if (vert.isValid()&&vert.neighbors.size()>0) {
-				size_t id = vert.id;
-				vert.index = vertexLocations.size();
-				vertexLocations.push_back(vertexLocationsCopy[id]);
-				vertexNormals.push_back(vertexNormalsCopy[id]);
-				vertexColors.push_back(vertexColorCopy[id]);
-
+	const std::vector<uint4> noQuads;
+	MeshTopology topo;
+	topo.build(vertexCount, tris, noQuads);
+	//Face planes are weighted by area, and planes through open boundary edges hold the boundary in place.
+	std::vector<Quadric> quadrics(vertexCount);
+#pragma omp parallel for
+	for (int64_t v = 0; v < (int64_t) vertexCount; v++) {
+		Quadric& q = quadrics[v];
+		for (uint32_t c = topo.cornerOffsets[v]; c < topo.cornerOffsets[v + 1];
+				c++) {
+			const uint3& tri = tris[topo.vertexCorners[c] / 3];
+			float3 n = cross(points[tri.y] - points[tri.x],
+					points[tri.z] - points[tri.x]);
+			float len = length(n);
+			if (len > 0.0f) {
+				q.addPlane(n / len, points[tri.x], 0.5 * len);
 			}
 		}
-	} else {
-		Vector3f vertexLocationsCopy = vertexLocations;
-		Vector3f vertexNormalsCopy = vertexNormals;
-		vertexLocations.clear();
-		vertexNormals.clear();
-		vertexNormals.data.reserve(vertexCount);
-		vertexLocations.data.reserve(vertexCount);
-		for (size_t i = 0; i < vertexCount; i++) {
-			DeadVertex& vert = vertexes[i];
-			if (vert.isValid()&&vert.neighbors.size()>0) {
-				size_t id = vert.id;
-				vert.index = vertexLocations.size();
-				vertexLocations.push_back(vertexLocationsCopy[id]);
-				vertexNormals.push_back(vertexNormalsCopy[id]);
+		for (uint32_t r = topo.ringOffsets[v]; r < topo.ringOffsets[v + 1];
+				r++) {
+			uint32_t e = topo.ringEdges[r];
+			if (!topo.isBoundaryEdge(e)) {
+				continue;
+			}
+			const uint3& tri = tris[topo.edgeHalfEdges[topo.edgeOffsets[e]] / 3];
+			float3 p0 = points[v];
+			float3 p1 = points[topo.ringVertices[r]];
+			float3 n = cross(p1 - p0,
+					cross(points[tri.y] - points[tri.x],
+							points[tri.z] - points[tri.x]));
+			float len = length(n);
+			if (len > 0.0f) {
+				q.addPlane(n / len, p0, boundaryWeight * distanceSqr(p0, p1));
 			}
 		}
 	}
-	size_t faceCount = triangles.size();
-	triIndexes.clear();
-	for (int n = 0; n < faceCount; n++) {
-		DeadTriangle& tri = triangles[n];
-		if (tri.isValid()) {
-			triIndexes.push_back(
-					uint3((uint32_t)tri.vertex[0]->index, (uint32_t)tri.vertex[1]->index,
-							(uint32_t)tri.vertex[2]->index));
+	std::vector<uint8_t> vertexFlags(vertexCount);
+	std::vector<uint64_t> vertexKeys(vertexCount);
+	std::vector<float> costs;
+	std::vector<float3> targets;
+	std::vector<uint64_t> keys;
+	std::vector<float> candidates;
+	std::vector<uint32_t> winners;
+	std::vector<uint8_t> claimed;
+	std::vector<uint8_t> winning;
+	std::vector<uint8_t> deadFaces;
+	while (tris.size() > targetTriangles) {
+		if (tris.size() != startCount) {
+			topo.build(vertexCount, tris, noQuads);
 		}
-	}
-	if (flipNormals) {
-		mesh.flipNormals();
-	}
-}
-
-size_t MeshDecimation::decimateInternal(Mesh& mesh, float threshold,
-		int validCount, int targetCount,const std::function<bool(const std::string& message, float progress)>& monitor) {
-	size_t vertexCount =vertexes.size();
-	heap.reserve(vertexCount);
-	for (size_t i = 0; i < vertexCount; i++) {
-		DeadVertex* vert=&vertexes[i];
-		if(vert->isValid()){
-			computeEdgeCostAtVertex(mesh,vert);
-			heap.add(vert);
-		} else {
-			vert->collapse=nullptr;
+		const int64_t E = (int64_t) topo.edges.size();
+#pragma omp parallel for
+		for (int64_t v = 0; v < (int64_t) vertexCount; v++) {
+			uint8_t flags = 0;
+			for (uint32_t r = topo.ringOffsets[v]; r < topo.ringOffsets[v + 1];
+					r++) {
+				uint32_t count = topo.edgeFaceCount(topo.ringEdges[r]);
+				if (count == 1) {
+					flags |= BOUNDARY_VERTEX;
+				} else if (count > 2) {
+					flags |= LOCKED_VERTEX;
+				}
+			}
+			vertexFlags[v] = flags;
 		}
-	}
-	size_t removeCount = vertexCount-validCount;
-	while (vertexes.size() > 0 && !heap.isEmpty()) {
-		if (removeCount >= targetCount)
-			break;
-		if(monitor){
-			monitor("Decimate",removeCount/(float)targetCount);
+		costs.resize(E);
+		targets.resize(E);
+#pragma omp parallel for schedule(dynamic,1024)
+		for (int64_t e = 0; e < E; e++) {
+			costs[e] = EvaluateCollapse(topo, tris, points, quadrics,
+					vertexFlags, (uint32_t) e, maxError, targets[e]);
 		}
-		// get the next vertex to collapse
-		DeadVertex *mn = static_cast<DeadVertex*>(heap.remove());
-		if (mn->isValid()&&collapseEdge(mesh, mn, mn->collapse)) {
-			removeCount++;
+		//Interior collapses remove two triangles each. The cheapest quarter of the candidates compete in a round.
+		const size_t needed = (tris.size() - targetTriangles + 1) / 2;
+		candidates.clear();
+		for (int64_t e = 0; e < E; e++) {
+			if (costs[e] <= maxError) {
+				candidates.push_back(costs[e]);
+			}
 		}
-
-	}
-	heap.clear();
-	return removeCount;
-}
-bool MeshDecimation::collapseEdge(Mesh& mesh, DeadVertex *u, DeadVertex *v) {
-	// Collapse the edge uv by moving vertex u onto v
-	// Actually remove tris on uv, then update tris that
-	// have u to have v, and then remove u.
-	if (!v) {
-		// u is a vertex all by itself so just delete it
-		u->remove();
-		heap.remove(u);
-		return true;
-	}
-	float3& V = mesh.vertexLocations[v->id];
-	float3& U = mesh.vertexLocations[u->id];
-	float3 mid = 0.5f * (U + V);
-	float3 oldU = U;
-	float3 oldV = V;
-	U = mid;
-	V = mid;
-	bool flip = false;
-	for (DeadTriangle* tri : v->faces) {
-		float3 oldNormal = tri->normal;
-		float3 n = tri->updateNormal(mesh);
-		if (dot(n, mesh.vertexNormals[v->id]) < 0) {
-			flip = true;
+		if (candidates.size() == 0) {
 			break;
 		}
-	}
-	if (!flip) {
-		for (DeadTriangle *tri : u->faces) {
-			float3 n = tri->updateNormal(mesh);
-			if (dot(n, mesh.vertexNormals[u->id]) < 0) {
-				flip = true;
+		size_t k = std::max(candidates.size() / 4, (size_t) 1);
+		std::nth_element(candidates.begin(), candidates.begin() + (k - 1),
+				candidates.end());
+		const float threshold = candidates[k - 1];
+		//Costs are not negative, so their bits order like the values. The edge id breaks ties.
+		keys.resize(E);
+#pragma omp parallel for
+		for (int64_t e = 0; e < E; e++) {
+			if (costs[e] <= threshold) {
+				uint32_t bits;
+				std::memcpy(&bits, &costs[e], sizeof(uint32_t));
+				keys[e] = ((uint64_t) bits << 32) | (uint64_t) e;
+			} else {
+				keys[e] = NO_COLLAPSE;
+			}
+		}
+		/*
+		 A collapse wins if it is cheaper than every candidate touching its ends or
+		 their neighbors. Winners are then at least two edges apart, so they share
+		 no faces and can be applied in parallel. Candidates next to a winner drop
+		 out and the rest compete again until no more collapses fit.
+		 */
+		claimed.assign(vertexCount, 0);
+		winning.resize(E);
+		winners.clear();
+		size_t added = 1;
+		while (added > 0 && winners.size() < needed) {
+#pragma omp parallel for
+			for (int64_t e = 0; e < E; e++) {
+				if (claimed[topo.edges[e].x] || claimed[topo.edges[e].y]) {
+					keys[e] = NO_COLLAPSE;
+				}
+			}
+#pragma omp parallel for
+			for (int64_t v = 0; v < (int64_t) vertexCount; v++) {
+				uint64_t key = NO_COLLAPSE;
+				for (uint32_t r = topo.ringOffsets[v];
+						r < topo.ringOffsets[v + 1]; r++) {
+					key = std::min(key, keys[topo.ringEdges[r]]);
+				}
+				vertexKeys[v] = key;
+			}
+#pragma omp parallel for
+			for (int64_t e = 0; e < E; e++) {
+				uint64_t key = keys[e];
+				bool win = (key != NO_COLLAPSE);
+				for (uint32_t v : { topo.edges[e].x, topo.edges[e].y }) {
+					win &= (vertexKeys[v] >= key);
+					for (uint32_t r = topo.ringOffsets[v];
+							r < topo.ringOffsets[v + 1] && win; r++) {
+						win &= (vertexKeys[topo.ringVertices[r]] >= key);
+					}
+				}
+				winning[e] = win;
+			}
+			size_t start = winners.size();
+			for (int64_t e = 0; e < E; e++) {
+				if (winning[e]) {
+					winners.push_back((uint32_t) e);
+				}
+			}
+			for (size_t i = start; i < winners.size(); i++) {
+				for (uint32_t v : { topo.edges[winners[i]].x,
+						topo.edges[winners[i]].y }) {
+					claimed[v] = 1;
+					for (uint32_t r = topo.ringOffsets[v];
+							r < topo.ringOffsets[v + 1]; r++) {
+						claimed[topo.ringVertices[r]] = 1;
+					}
+				}
+			}
+			added = winners.size() - start;
+		}
+		if (winners.size() > needed) {
+			std::nth_element(winners.begin(), winners.begin() + needed,
+					winners.end(), [&](uint32_t e1, uint32_t e2) {
+						return costs[e1] < costs[e2];
+					});
+			winners.resize(needed);
+		}
+		deadFaces.assign(tris.size(), 0);
+#pragma omp parallel for
+		for (int64_t i = 0; i < (int64_t) winners.size(); i++) {
+			uint32_t e = winners[i];
+			uint32_t a = topo.edges[e].x;
+			uint32_t b = topo.edges[e].y;
+			float3 pa = points[a];
+			float3 pb = points[b];
+			float3 target = targets[e];
+			//Attributes are interpolated at the projection of the new point onto the edge.
+			float len2 = distanceSqr(pa, pb);
+			float t = (len2 > 0.0f) ?
+					clamp(dot(target - pa, pb - pa) / len2, 0.0f, 1.0f) : 0.5f;
+			points[a] = target;
+			quadrics[a] += quadrics[b];
+			if (hasNormals) {
+				float3 n = mix(mesh.vertexNormals[a], mesh.vertexNormals[b], t);
+				float len = length(n);
+				if (len > 0.0f) {
+					mesh.vertexNormals[a] = n / len;
+				}
+			}
+			if (hasColors) {
+				mesh.vertexColors[a] = mix(mesh.vertexColors[a],
+						mesh.vertexColors[b], t);
+			}
+			if (hasUVs) {
+				/*
+				 Texture coordinates of a face on the edge give the coordinates at
+				 both ends. Corners that share them are moved with the vertex, and
+				 corners across a seam keep their own.
+				 */
+				uint32_t f = topo.edgeHalfEdges[topo.edgeOffsets[e]] / 3;
+				const uint3& tri = tris[f];
+				float2 uvA = uvs[3 * f + ((tri.x == a) ? 0 : (tri.y == a) ? 1 : 2)];
+				float2 uvB = uvs[3 * f + ((tri.x == b) ? 0 : (tri.y == b) ? 1 : 2)];
+				float2 uv = mix(uvA, uvB, t);
+				for (uint32_t v : { a, b }) {
+					for (uint32_t c = topo.cornerOffsets[v];
+							c < topo.cornerOffsets[v + 1]; c++) {
+						float2& corner = uvs[topo.vertexCorners[c]];
+						if (corner == ((v == a) ? uvA : uvB)) {
+							corner = uv;
+						}
+					}
+				}
+			}
+			for (uint32_t c = topo.cornerOffsets[b];
+					c < topo.cornerOffsets[b + 1]; c++) {
+				uint32_t h = topo.vertexCorners[c];
+				uint3& tri = tris[h / 3];
+				if (tri.x == a || tri.y == a || tri.z == a) {
+					deadFaces[h / 3] = 1;
+				} else {
+					tri[h % 3] = a;
+				}
+			}
+		}
+		size_t count = 0;
+		for (size_t f = 0; f < tris.size(); f++) {
+			if (!deadFaces[f]) {
+				if (hasUVs) {
+					for (int c = 0; c < 3; c++) {
+						uvs[3 * count + c] = uvs[3 * f + c];
+					}
+				}
+				tris[count++] = tris[f];
+			}
+		}
+		tris.resize(count);
+		if (hasUVs) {
+			uvs.resize(3 * count);
+		}
+		if (monitor) {
+			if (!monitor("Decimating",
+					(startCount - tris.size())
+							/ (float) (startCount - targetTriangles))) {
 				break;
 			}
 		}
+		if (winners.size() == 0) {
+			break;
+		}
 	}
-	if (flip) {
-		V = oldV;
-		U = oldU;
-		return false;
+	//Drop the vertexes that were collapsed away, keeping the order of the rest. Vertexes outside the starting triangles and those used by points or lines are kept.
+	std::vector<uint32_t> remap(vertexCount, 1);
+	for (const uint3& tri : mesh.triIndexes.data) {
+		remap[tri.x] = remap[tri.y] = remap[tri.z] = 0;
 	}
-	size_t faceCount = 0;
-	for (DeadTriangle* tri : u->faces) {
-		if (tri->hasVertex(v)) {
-			faceCount++;
+	for (const uint3& tri : tris) {
+		remap[tri.x] = remap[tri.y] = remap[tri.z] = 1;
+	}
+	for (uint32_t v : mesh.pointIndexes) {
+		if (v < vertexCount) {
+			remap[v] = 1;
 		}
 	}
-	if (faceCount != 2 || v->neighbors.size() >= MAX_VALENCE
-			|| u->neighbors.size() >= MAX_VALENCE) {
-		V = oldV;
-		U = oldU;
-		return false;
+	for (const uint2& line : mesh.lineIndexes.data) {
+		if (line.x < vertexCount && line.y < vertexCount) {
+			remap[line.x] = remap[line.y] = 1;
+		}
 	}
-	// make tmp a Array of all the neighbors of u
-	std::set<DeadVertex *> tmp = u->neighbors;
-	// delete triangles on edge uv:
-	std::set<DeadTriangle*> tmpNbrs = u->faces;
-	for (DeadTriangle* tri : tmpNbrs) {
-		if (tri->hasVertex(v))
-			tri->remove();
+	uint32_t index = 0;
+	for (size_t v = 0; v < vertexCount; v++) {
+		if (remap[v]) {
+			remap[v] = index;
+			points[index] = points[v];
+			if (hasNormals) {
+				mesh.vertexNormals[index] = mesh.vertexNormals[v];
+			}
+			if (hasColors) {
+				mesh.vertexColors[index] = mesh.vertexColors[v];
+			}
+			index++;
+		} else {
+			remap[v] = MeshTopology::NO_HALF_EDGE;
+		}
 	}
-	tmpNbrs = u->faces;
-	for (DeadTriangle* tri : tmpNbrs) {
-		tri->replaceVertex(mesh, u, v);
+	points.resize(index);
+	if (hasNormals) {
+		mesh.vertexNormals.resize(index);
 	}
-	u->remove();
-	heap.remove(u);
-// recompute the edge collapse costs for neighboring vertices
-	for (DeadVertex *vert : tmp) {
-		computeEdgeCostAtVertex(mesh, vert);
-		heap.change(vert->index, vert->value);
+	if (hasColors) {
+		mesh.vertexColors.resize(index);
 	}
-	return true;
-}
-
-float MeshDecimation::computeEdgeCollapseCost(Mesh& mesh, DeadVertex *u,
-		DeadVertex *v) {
-// if we collapse edge uv by moving u to v then how
-// much different will the model change, i.e. how much "error".
-// Texture, vertex normal, and border vertex code was removed
-// to keep this demo as simple as possible.
-// The method of determining cost was designed in order
-// to exploit small and coplanar regions for
-// effective polygon reduction.
-// Is is possible to add some checks here to see if "folds"
-// would be generated.  i.e. normal of a remaining face gets
-// flipped.  I never seemed to run into this problem and
-// therefore never added code to detect this case.
-	float edgelength = distance(mesh.vertexLocations[v->id],
-			mesh.vertexLocations[u->id]);
-	float curvature = 0;
-// find the "sides" triangles that are on the edge uv
-	std::vector<DeadTriangle *> sides;
-	for (DeadTriangle* tri : u->faces) {
-		if (tri->hasVertex(v)) {
-			sides.push_back(tri);
-		}
+#pragma omp parallel for
+	for (int64_t f = 0; f < (int64_t) tris.size(); f++) {
+		uint3& tri = tris[f];
+		tri = uint3(remap[tri.x], remap[tri.y], remap[tri.z]);
 	}
-// use the triangle facing most away from the sides
-// to determine our curvature term
-	for (DeadTriangle* tri : u->faces) {
-		float mincurv = 1; // curve for face i and closer side to it
-		for (unsigned int j = 0; j < sides.size(); j++) {
-			float dotprod = dot(tri->normal, sides[j]->normal); // use Dot product of face normals.
-			mincurv = std::min(mincurv, (1 - dotprod) / 2.0f);
+	for (uint32_t& v : mesh.pointIndexes) {
+		if (v < vertexCount) {
+			v = remap[v];
 		}
-		curvature = std::max(curvature, mincurv);
-	}
-// the more coplanar the lower the curvature term
-	return edgelength * curvature;
-}
-void MeshDecimation::computeEdgeCostAtVertex(Mesh& mesh, DeadVertex *v) {
-// compute the edge collapse cost for all edges that start
-// from vertex v.  Since we are only interested in reducing
-// the object by selecting the min cost edge at each step, we
-// only cache the cost of the least cost edge at this vertex
-// (in member variable collapse) as well as the value of the
-// cost (in member variable objdist).
-	if (v->neighbors.size() == 0) {
-		// v doesn't have neighbors so it costs nothing to collapse
-		v->collapse = nullptr;
-		v->value = -0.01f;
-		return;
 	}
-	v->value = std::numeric_limits<float>::max();
-	v->collapse = nullptr;
-// search all neighboring edges for "least cost" edge
-	for (DeadVertex* vert : v->neighbors) {
-		float dist;
-		dist = computeEdgeCollapseCost(mesh, v, vert);
-		if (dist < v->value) {
-			v->collapse = vert;  // candidate for edge collapse
-			v->value = dist;             // cost of the collapse
+	for (uint2& line : mesh.lineIndexes.data) {
+		if (line.x < vertexCount && line.y < vertexCount) {
+			line = uint2(remap[line.x], remap[line.y]);
 		}
 	}
+	mesh.triIndexes.data.swap(tris);
+	if (hasUVs) {
+		mesh.textureMap.data.swap(uvs);
+	}
+	mesh.setDirty(true);
 }
 }
-
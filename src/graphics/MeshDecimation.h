@@ -8,88 +8,61 @@
 #ifndef INCLUDE_GRID_MESHPROCESSING_H_
 #define INCLUDE_GRID_MESHPROCESSING_H_
 
-#include "image/AlloyMinHeap.h"
 #include "graphics/AlloyMesh.h"
+#include <functional>
 namespace aly {
-
-struct DeadTriangle;
-struct DeadVertex;
-
-struct DeadVertex: public Indexable<float> {
-protected:
-	bool valid;
-public:
-
-	std::set<DeadVertex*> neighbors; 	// adjacent vertices
-	std::set<DeadTriangle*> faces;    	// adjacent triangles
-	DeadVertex *collapse;					// candidate vertex for collapse
-	size_t id;
-	DeadVertex(size_t id = -1) : Indexable<float>(0.0f), collapse(nullptr), id(id), valid(true) {
-	}
-	virtual ~DeadVertex(){}
-	inline bool isValid() const {
-		return valid;
-	}
-	bool hasNeighbor(DeadVertex* nbr);
-	void remove(DeadTriangle* tri);
-	void remove(DeadVertex* nbr);
-	void remove();
-	void removeIfNonNeighbor(DeadVertex *n);
-	bool operator<(const DeadVertex &rhs) const {
-		return (value < rhs.value);
-	}
-
-	bool operator<=(const DeadVertex &rhs) const {
-		return (value <= rhs.value);
-	}
-
-	bool operator>(const DeadVertex &rhs) const {
-		return (value > rhs.value);
-	}
-
-	bool operator>=(const DeadVertex &rhs) const {
-		return (value >= rhs.value);
-	}
-
-	bool operator==(const DeadVertex &rhs) const {
-		return (index == rhs.index);
-	}
-
-};
-
-struct DeadTriangle {
-	bool valid;
-public:
-	float3 normal;
-	DeadVertex* vertex[3];	// the 3 points that make this tri
-	DeadTriangle() :
-			valid(true) {
-	}
-	void set(DeadVertex *v0, DeadVertex *v1, DeadVertex *v2);
-	virtual ~DeadTriangle() {
-	}
-	float3 updateNormal(Mesh& mesh);
-	float3 computeNormal(Mesh& mesh);
-	void replaceVertex(Mesh& mesh, DeadVertex *vold, DeadVertex *vnew);
-	bool hasVertex(DeadVertex *v);
-	void remove();
-	inline bool isValid() const {
-		return valid;
+bool SANITY_CHECK_MESH_DECIMATION();
+/*
+ Symmetric 4x4 error quadric of Garland and Heckbert, stored as its upper
+ triangle: the weighted sum of squared distances of x to a set of planes is
+ x^T A x + 2 b^T x + c, and w is the sum of the weights.
+ */
+struct Quadric {
+	double a00, a01, a02, a11, a12, a22;
+	double b0, b1, b2;
+	double c;
+	double w;
+	Quadric() :
+			a00(0), a01(0), a02(0), a11(0), a12(0), a22(0), b0(0), b1(0), b2(0), c(
+					0), w(0) {
 	}
+	//Plane through pt with unit normal n.
+	void addPlane(const float3& n, const float3& pt, double weight);
+	Quadric& operator+=(const Quadric& q);
+	double evaluate(const float3& x) const;
+	//Point with the least error, or false if the planes do not pin one down.
+	bool minimize(float3& x) const;
 };
+/*
+ Quadric error edge-collapse decimation. Every round finds the cheapest
+ valid collapse of each edge in parallel, keeps the low-cost collapses whose
+ neighborhoods do not overlap and applies them in parallel, so each round
+ removes many edges at once. Vertex normals, colors and per-corner texture
+ coordinates are carried along. Quads are split into triangles first.
+ */
 class MeshDecimation {
 protected:
-	static const int MAX_VALENCE = 9;
-	std::vector<DeadTriangle> triangles;
-	std::vector<DeadVertex> vertexes;
-	BinaryMinHeap<float> heap;
-	size_t decimateInternal(Mesh& mesh, float threshold, int totalCount,int targetCount,const std::function<bool(const std::string& message, float progress)>& monitor=nullptr);
-	bool collapseEdge(Mesh& mesh, DeadVertex *u, DeadVertex *v);
-	void computeEdgeCostAtVertex(Mesh& mesh, DeadVertex *v);
-	float computeEdgeCollapseCost(Mesh& mesh, DeadVertex *u, DeadVertex *v);
+	float boundaryWeight;
+	void decimate(Mesh& mesh, size_t targetTriangles, float maxError,
+			const std::function<bool(const std::string& message, float progress)>& monitor);
 public:
-	void solve(Mesh& mesh, float decimationAmount,bool flipNormals=false,const std::function<bool(const std::string& message, float progress)>& monitor =
-			nullptr);
+	MeshDecimation();
+	//Weight of the planes that keep open boundaries in place, relative to face planes.
+	void setBoundaryWeight(float w) {
+		boundaryWeight = w;
+	}
+	//Removes decimationAmount, between 0 and 1, of the triangles.
+	void solve(Mesh& mesh, float decimationAmount, bool flipNormals = false,
+			const std::function<bool(const std::string& message, float progress)>& monitor =
+					nullptr);
+	//Decimates until the mesh has at most triangleCount triangles or nothing can be collapsed.
+	void solveToTriangleCount(Mesh& mesh, size_t triangleCount,
+			const std::function<bool(const std::string& message, float progress)>& monitor =
+					nullptr);
+	//Decimates while some collapse has a mean squared distance to the original surface below maxError.
+	void solveToError(Mesh& mesh, float maxError,
+			const std::function<bool(const std::string& message, float progress)>& monitor =
+					nullptr);
 };
 }
 
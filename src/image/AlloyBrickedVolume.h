@@ -0,0 +1,230 @@
+/*
+ * Copyright(C) 2015, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef ALLOYBRICKEDVOLUME_H_
+#define ALLOYBRICKEDVOLUME_H_
+#include "common/AlloyCommon.h"
+#include "image/AlloyVolume.h"
+#include <vector>
+namespace aly {
+bool SANITY_CHECK_BRICKED_VOLUME();
+/*
+ In-core volume stored as 8x8x8 bricks instead of x-fastest rows. The six face
+ neighbors of a voxel inside a brick are at most 64 elements away, where the
+ linear layout puts +/-z neighbors rows*cols elements away, so 3D stencils
+ stay in cache and TLB reach on large grids. Convert with set/get and visit
+ voxels with ForEachNeighborhood6.
+ */
+template<class T, int C, ImageType I> struct BrickedVolume {
+	static const int BRICK_SHIFT = 3;
+	static const int BRICK_SIZE = 1 << BRICK_SHIFT;
+	static const int BRICK_MASK = BRICK_SIZE - 1;
+	static const int BRICK_VOXELS = BRICK_SIZE * BRICK_SIZE * BRICK_SIZE;
+	typedef vec<T, C> ValueType;
+	std::vector<ValueType> data;
+	int rows;
+	int cols;
+	int slices;
+	int3 brickGrid;
+	BrickedVolume() :
+			rows(0), cols(0), slices(0), brickGrid(0) {
+	}
+	BrickedVolume(int r, int c, int s) :
+			BrickedVolume() {
+		resize(r, c, s);
+	}
+	BrickedVolume(const int3& dims) :
+			BrickedVolume() {
+		resize(dims);
+	}
+	BrickedVolume(const Volume<T, C, I>& vol) :
+			BrickedVolume() {
+		set(vol);
+	}
+	void resize(int r, int c, int s) {
+		rows = r;
+		cols = c;
+		slices = s;
+		brickGrid = int3((r + BRICK_MASK) >> BRICK_SHIFT,
+				(c + BRICK_MASK) >> BRICK_SHIFT, (s + BRICK_MASK) >> BRICK_SHIFT);
+		data.resize(brickCount() * BRICK_VOXELS);
+	}
+	void resize(const int3& dims) {
+		resize(dims.x, dims.y, dims.z);
+	}
+	int3 dimensions() const {
+		return int3(rows, cols, slices);
+	}
+	size_t size() const {
+		return (size_t) rows * cols * slices;
+	}
+	size_t brickCount() const {
+		return (size_t) brickGrid.x * brickGrid.y * brickGrid.z;
+	}
+	inline size_t offset(int i, int j, int k) const {
+		return ((i >> BRICK_SHIFT)
+				+ (size_t) brickGrid.x
+						* ((j >> BRICK_SHIFT)
+								+ (size_t) brickGrid.y * (k >> BRICK_SHIFT)))
+				* BRICK_VOXELS
+				+ ((i & BRICK_MASK)
+						+ (((j & BRICK_MASK) + ((k & BRICK_MASK) << BRICK_SHIFT))
+								<< BRICK_SHIFT));
+	}
+	inline ValueType& operator()(int i, int j, int k) {
+		return data[offset(clamp(i, 0, rows - 1), clamp(j, 0, cols - 1),
+				clamp(k, 0, slices - 1))];
+	}
+	inline const ValueType& operator()(int i, int j, int k) const {
+		return data[offset(clamp(i, 0, rows - 1), clamp(j, 0, cols - 1),
+				clamp(k, 0, slices - 1))];
+	}
+	inline ValueType& operator()(const int3& ijk) {
+		return operator()(ijk.x, ijk.y, ijk.z);
+	}
+	inline const ValueType& operator()(const int3& ijk) const {
+		return operator()(ijk.x, ijk.y, ijk.z);
+	}
+	void set(const ValueType& val) {
+		data.assign(data.size(), val);
+	}
+	void set(const T& val) {
+		data.assign(data.size(), ValueType(val));
+	}
+	void set(const Volume<T, C, I>& vol) {
+		resize(vol.rows, vol.cols, vol.slices);
+		const int64_t N = (int64_t) brickCount();
+#pragma omp parallel for
+		for (int64_t b = 0; b < N; b++) {
+			int3 lo = brickOrigin(b);
+			int3 ext = min(int3(BRICK_SIZE), dimensions() - lo);
+			ValueType* dst = &data[b * BRICK_VOXELS];
+			for (int k = 0; k < ext.z; k++) {
+				for (int j = 0; j < ext.y; j++) {
+					const ValueType* src = &vol(lo.x, lo.y + j, lo.z + k);
+					ValueType* row = dst + ((j + (k << BRICK_SHIFT)) << BRICK_SHIFT);
+					for (int i = 0; i < ext.x; i++) {
+						row[i] = src[i];
+					}
+				}
+			}
+		}
+	}
+	void get(Volume<T, C, I>& vol) const {
+		vol.resize(rows, cols, slices);
+		const int64_t N = (int64_t) brickCount();
+#pragma omp parallel for
+		for (int64_t b = 0; b < N; b++) {
+			int3 lo = brickOrigin(b);
+			int3 ext = min(int3(BRICK_SIZE), dimensions() - lo);
+			const ValueType* src = &data[b * BRICK_VOXELS];
+			for (int k = 0; k < ext.z; k++) {
+				for (int j = 0; j < ext.y; j++) {
+					ValueType* dst = &vol(lo.x, lo.y + j, lo.z + k);
+					const ValueType* row = src
+							+ ((j + (k << BRICK_SHIFT)) << BRICK_SHIFT);
+					for (int i = 0; i < ext.x; i++) {
+						dst[i] = row[i];
+					}
+				}
+			}
+		}
+	}
+	inline int3 brickOrigin(int64_t b) const {
+		return int3((int) (b % brickGrid.x), (int) ((b / brickGrid.x) % brickGrid.y),
+				(int) (b / ((int64_t) brickGrid.x * brickGrid.y))) * BRICK_SIZE;
+	}
+};
+//Face neighbors of a voxel in the order -x,+x,-y,+y,-z,+z, clamped at the volume edge.
+template<class V> struct Neighborhood6 {
+	const V* center;
+	const V* nbrs[6];
+	inline const V& value() const {
+		return *center;
+	}
+	inline const V& operator[](int n) const {
+		return *nbrs[n];
+	}
+};
+/*
+ Visits every voxel brick by brick in parallel. Neighbor addresses are the
+ center plus a delta that is fixed within a brick and only changes on brick
+ faces, where it steps into the adjacent brick (or stays on the center at the
+ volume edge), so no voxel pays for a full index computation.
+ func(offset, nbrs), where offset indexes data of any BrickedVolume
+ with the same dimensions.
+ */
+template<class T, int C, ImageType I, class F> void ForEachNeighborhood6(
+		const BrickedVolume<T, C, I>& vol, F func) {
+	typedef typename BrickedVolume<T, C, I>::ValueType V;
+	const int B = BrickedVolume<T, C, I>::BRICK_SIZE;
+	const int S = BrickedVolume<T, C, I>::BRICK_SHIFT;
+	const ptrdiff_t BV = BrickedVolume<T, C, I>::BRICK_VOXELS;
+	const int64_t N = (int64_t) vol.brickCount();
+	const int3 dims = vol.dimensions();
+	const int3 grid = vol.brickGrid;
+	//Deltas that cross from one brick face into the adjacent brick.
+	const ptrdiff_t crossX = BV - (B - 1);
+	const ptrdiff_t crossY = grid.x * BV - (B - 1) * B;
+	const ptrdiff_t crossZ = (ptrdiff_t) grid.x * grid.y * BV - (B - 1) * B * B;
+#pragma omp parallel for
+	for (int64_t b = 0; b < N; b++) {
+		const int3 lo = vol.brickOrigin(b);
+		const int3 bijk = lo / B;
+		const int3 ext = min(int3(B), dims - lo);
+		const size_t base = (size_t) b * BV;
+		const V* brick = &vol.data[base];
+		Neighborhood6<V> nbh;
+		for (int k = 0; k < ext.z; k++) {
+			const ptrdiff_t dzm = (k > 0) ? -B * B : ((bijk.z > 0) ? -crossZ : 0);
+			const ptrdiff_t dzp =
+					(k < ext.z - 1) ? B * B : ((bijk.z < grid.z - 1) ? crossZ : 0);
+			for (int j = 0; j < ext.y; j++) {
+				const ptrdiff_t dym = (j > 0) ? -B : ((bijk.y > 0) ? -crossY : 0);
+				const ptrdiff_t dyp =
+						(j < ext.y - 1) ? B : ((bijk.y < grid.y - 1) ? crossY : 0);
+				const int rowOffset = (j + (k << S)) << S;
+				for (int i = 0; i < ext.x; i++) {
+					const ptrdiff_t dxm = (i > 0) ? -1 : ((bijk.x > 0) ? -crossX : 0);
+					const ptrdiff_t dxp =
+							(i < ext.x - 1) ? 1 : ((bijk.x < grid.x - 1) ? crossX : 0);
+					const int local = rowOffset + i;
+					const V* c = brick + local;
+					nbh.center = c;
+					nbh.nbrs[0] = c + dxm;
+					nbh.nbrs[1] = c + dxp;
+					nbh.nbrs[2] = c + dym;
+					nbh.nbrs[3] = c + dyp;
+					nbh.nbrs[4] = c + dzm;
+					nbh.nbrs[5] = c + dzp;
+					func(base + local, nbh);
+				}
+			}
+		}
+	}
+}
+typedef BrickedVolume<uint8_t, 1, ImageType::UBYTE> BrickedVolume1ub;
+typedef BrickedVolume<int, 1, ImageType::INT> BrickedVolume1i;
+typedef BrickedVolume<float, 1, ImageType::FLOAT> BrickedVolume1f;
+typedef BrickedVolume<float, 2, ImageType::FLOAT> BrickedVolume2f;
+typedef BrickedVolume<float, 3, ImageType::FLOAT> BrickedVolume3f;
+typedef BrickedVolume<float, 4, ImageType::FLOAT> BrickedVolume4f;
+}
+#endif
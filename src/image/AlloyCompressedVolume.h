@@ -0,0 +1,287 @@
+/*
+ * Copyright(C) 2015, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef ALLOYCOMPRESSEDVOLUME_H_
+#define ALLOYCOMPRESSEDVOLUME_H_
+#include "common/AlloyCommon.h"
+#include "common/AlloyCompression.h"
+#include "image/AlloyVolume.h"
+#include "system/AlloyMemMappedFile.h"
+#include <cstring>
+#include <cstdio>
+#include <string>
+namespace aly {
+bool SANITY_CHECK_COMPRESSED_VOLUME();
+/*
+ Volume file made of independently compressed chunks of consecutive slices.
+ Chunks are compressed in parallel and the table of chunk offsets is written
+ after the last chunk, so writing is a single sequential pass. Readers map
+ the file and decompress chunks straight into the volume, or decompress only
+ the chunk that holds a requested slice.
+ */
+struct CompressedVolumeHeader {
+	char magic[8];
+	int32_t rows;
+	int32_t cols;
+	int32_t slices;
+	int32_t channels;
+	int32_t type;
+	int32_t typeSize;
+	int32_t compression;
+	int32_t slicesPerChunk;
+	int32_t chunkCount;
+	int32_t reserved[3];
+	uint64_t tableOffset;
+};
+template<class T, int C, ImageType I> void WriteVolumeToCompressedFile(
+		const std::string& file, const Volume<T, C, I>& vol,
+		CompressionType compression = CompressionType::LZ4,
+		int slicesPerChunk = 0) {
+	//Chunks of about 4MB keep every thread busy without hurting the compression ratio.
+	const size_t TARGET_CHUNK_BYTES = 1 << 22;
+	const size_t sliceBytes = (size_t) vol.rows * vol.cols * sizeof(vec<T, C> );
+	if (slicesPerChunk <= 0) {
+		slicesPerChunk = (int) std::max((size_t) 1,
+				TARGET_CHUNK_BYTES / std::max(sliceBytes, (size_t) 1));
+	}
+	slicesPerChunk = std::max(1, std::min(slicesPerChunk, vol.slices));
+	const int chunkCount = (vol.slices + slicesPerChunk - 1) / slicesPerChunk;
+	FILE* f = fopen(file.c_str(), "wb");
+	if (f == NULL) {
+		throw std::runtime_error(
+				MakeString() << "Could not open " << file << " for writing.");
+	}
+	CompressedVolumeHeader header;
+	std::memset(&header, 0, sizeof(CompressedVolumeHeader));
+	std::memcpy(header.magic, "ALYCHUNK", 8);
+	header.rows = vol.rows;
+	header.cols = vol.cols;
+	header.slices = vol.slices;
+	header.channels = C;
+	header.type = static_cast<int32_t>(I);
+	header.typeSize = sizeof(vec<T, C> );
+	header.compression = static_cast<int32_t>(compression);
+	header.slicesPerChunk = slicesPerChunk;
+	header.chunkCount = chunkCount;
+	std::vector<uint64_t> offsets(chunkCount + 1);
+	uint64_t offset = sizeof(CompressedVolumeHeader);
+	bool ok = (fwrite(&header, sizeof(CompressedVolumeHeader), 1, f) == 1);
+	//Compress a batch of chunks in parallel, then append them in order.
+	const int batchSize = 32;
+	std::vector<std::vector<uint8_t>> buffers(batchSize);
+	const uint8_t* src = reinterpret_cast<const uint8_t*>(vol.data.data());
+	for (int batch = 0; batch < chunkCount && ok; batch += batchSize) {
+		int batchEnd = std::min(batch + batchSize, chunkCount);
+#pragma omp parallel for schedule(dynamic)
+		for (int n = batch; n < batchEnd; n++) {
+			int k0 = n * slicesPerChunk;
+			int k1 = std::min(k0 + slicesPerChunk, vol.slices);
+			size_t bytes = (k1 - k0) * sliceBytes;
+			std::vector<uint8_t>& buffer = buffers[n - batch];
+			buffer.resize(EstimateOutputSize(bytes, compression));
+			size_t sz = Compress(src + k0 * sliceBytes, bytes, buffer.data(),
+					buffer.size(), compression);
+			buffer.resize(sz);
+		}
+		for (int n = batch; n < batchEnd && ok; n++) {
+			const std::vector<uint8_t>& buffer = buffers[n - batch];
+			offsets[n] = offset;
+			ok = (buffer.size() == 0
+					|| fwrite(buffer.data(), 1, buffer.size(), f)
+							== buffer.size());
+			offset += buffer.size();
+		}
+	}
+	offsets[chunkCount] = offset;
+	header.tableOffset = offset;
+	if (ok) {
+		ok = (fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), f)
+				== offsets.size());
+	}
+	//Rewriting the header only needs the start of the file, so no 64-bit seek is required.
+	if (ok) {
+		ok = (fseek(f, 0, SEEK_SET) == 0
+				&& fwrite(&header, sizeof(CompressedVolumeHeader), 1, f) == 1);
+	}
+	fclose(f);
+	if (!ok) {
+		throw std::runtime_error(
+				MakeString() << "Could not write " << file << ".");
+	}
+}
+template<class T, int C, ImageType I> class CompressedVolumeReader {
+protected:
+	ReadableMemMapFile mapped;
+	CompressedVolumeHeader header;
+	std::vector<uint64_t> offsets;
+	std::vector<uint8_t> cache;
+	int cachedChunk;
+	size_t sliceBytes() const {
+		return (size_t) header.rows * header.cols * sizeof(vec<T, C> );
+	}
+	int chunkSlices(int n) const {
+		return std::min(header.slicesPerChunk,
+				header.slices - n * header.slicesPerChunk);
+	}
+	//Returns false unless chunk n decodes to exactly its slices. Does not throw, so it is safe inside parallel loops.
+	bool decompressChunk(int n, uint8_t* out) const {
+		const char* base = mapped.data();
+		size_t expected = chunkSlices(n) * sliceBytes();
+		try {
+			return Decompress(reinterpret_cast<const uint8_t*>(base + offsets[n]),
+					offsets[n + 1] - offsets[n], out, expected,
+					static_cast<CompressionType>(header.compression))
+					== expected;
+		} catch (const std::exception&) {
+			return false;
+		}
+	}
+public:
+	CompressedVolumeReader() :
+			cachedChunk(-1) {
+		std::memset(&header, 0, sizeof(CompressedVolumeHeader));
+	}
+	CompressedVolumeReader(const std::string& file) :
+			CompressedVolumeReader() {
+		open(file);
+	}
+	CompressedVolumeReader(const CompressedVolumeReader&) = delete;
+	CompressedVolumeReader& operator=(const CompressedVolumeReader&) = delete;
+	void open(const std::string& file) {
+		close();
+		mapped.open(file, true);
+		const char* ptr = mapped.data();
+		size_t fileSize = mapped.getMappedSize();
+		if (ptr == nullptr || fileSize < sizeof(CompressedVolumeHeader)) {
+			close();
+			throw std::runtime_error(
+					MakeString() << "Could not open compressed volume " << file);
+		}
+		std::memcpy(&header, ptr, sizeof(CompressedVolumeHeader));
+		if (std::memcmp(header.magic, "ALYCHUNK", 8) != 0
+				|| header.channels != C
+				|| header.type != static_cast<int32_t>(I)
+				|| header.typeSize != (int32_t) sizeof(vec<T, C> )
+				|| header.slicesPerChunk <= 0 || header.slices < 0
+				|| header.rows < 0 || header.cols < 0
+				|| header.compression < static_cast<int32_t>(CompressionType::NONE)
+				|| header.compression > static_cast<int32_t>(CompressionType::ZSTD)
+				|| header.chunkCount
+						!= (header.slices + header.slicesPerChunk - 1)
+								/ header.slicesPerChunk
+				|| header.tableOffset
+						+ (header.chunkCount + 1) * sizeof(uint64_t)
+						> fileSize) {
+			close();
+			throw std::runtime_error(
+					MakeString() << "Compressed volume " << file
+							<< " does not hold " << C << " channel " << I
+							<< " data.");
+		}
+		//The table is not aligned in the file, so it is copied out.
+		offsets.resize(header.chunkCount + 1);
+		std::memcpy(offsets.data(), ptr + header.tableOffset,
+				offsets.size() * sizeof(uint64_t));
+		for (int n = 0; n < header.chunkCount; n++) {
+			if (offsets[n] > offsets[n + 1] || offsets[n + 1] > header.tableOffset) {
+				close();
+				throw std::runtime_error(
+						MakeString() << "Compressed volume " << file
+								<< " has a corrupt chunk table.");
+			}
+		}
+	}
+	void close() {
+		mapped.close();
+		offsets.clear();
+		cache.clear();
+		cachedChunk = -1;
+		std::memset(&header, 0, sizeof(CompressedVolumeHeader));
+	}
+	bool isOpen() const {
+		return (offsets.size() > 0);
+	}
+	int3 dimensions() const {
+		return int3(header.rows, header.cols, header.slices);
+	}
+	int getChunkCount() const {
+		return header.chunkCount;
+	}
+	int getSlicesPerChunk() const {
+		return header.slicesPerChunk;
+	}
+	CompressionType getCompression() const {
+		return static_cast<CompressionType>(header.compression);
+	}
+	//Decompresses every chunk in parallel directly into vol.
+	void read(Volume<T, C, I>& vol) const {
+		vol.resize(header.rows, header.cols, header.slices);
+		uint8_t* dst = reinterpret_cast<uint8_t*>(vol.data.data());
+		const size_t bytes = sliceBytes();
+		std::vector<uint8_t> valid(header.chunkCount);
+#pragma omp parallel for schedule(dynamic)
+		for (int n = 0; n < header.chunkCount; n++) {
+			valid[n] = decompressChunk(n,
+					dst + (size_t) n * header.slicesPerChunk * bytes);
+		}
+		for (int n = 0; n < header.chunkCount; n++) {
+			if (!valid[n]) {
+				throw std::runtime_error(
+						MakeString() << "Compressed volume chunk " << n
+								<< " is corrupt.");
+			}
+		}
+	}
+	//Decompresses only the chunk holding slice k. The last chunk is kept, so reading slices in order decompresses each chunk once.
+	void readSlice(int k, Image<T, C, I>& img) {
+		if (k < 0 || k >= header.slices) {
+			throw std::runtime_error(
+					MakeString() << "Slice " << k << " out of range [0,"
+							<< header.slices << ").");
+		}
+		int n = k / header.slicesPerChunk;
+		const size_t bytes = sliceBytes();
+		if (n != cachedChunk) {
+			cache.resize(header.slicesPerChunk * bytes);
+			cachedChunk = -1;
+			if (!decompressChunk(n, cache.data())) {
+				throw std::runtime_error(
+						MakeString() << "Compressed volume chunk " << n
+								<< " is corrupt.");
+			}
+			cachedChunk = n;
+		}
+		img.resize(header.rows, header.cols);
+		std::memcpy(img.data.data(),
+				cache.data() + (k - n * header.slicesPerChunk) * bytes, bytes);
+	}
+};
+template<class T, int C, ImageType I> void ReadVolumeFromCompressedFile(
+		const std::string& file, Volume<T, C, I>& vol) {
+	CompressedVolumeReader<T, C, I> reader(file);
+	reader.read(vol);
+}
+template<class T, int C, ImageType I> void ReadSliceFromCompressedFile(
+		const std::string& file, int k, Image<T, C, I>& img) {
+	CompressedVolumeReader<T, C, I> reader(file);
+	reader.readSlice(k, img);
+}
+}
+#endif
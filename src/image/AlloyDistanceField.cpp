@@ -21,10 +21,12 @@
 
 #include "image/AlloyDistanceField.h"
 #include "image/AlloyMinHeap.h"
+#include "image/AlloyBrickedVolume.h"
 #include "graphics/AlloyMesh.h"
 #include <list>
 #include <set>
 #include <queue>
+#include <omp.h>
 using namespace std;
 namespace aly {
 const ubyte1 DistanceField3f::ACTIVE = ubyte1((uint8_t) 1);
@@ -53,6 +55,570 @@ struct DfElem {
 
 	}
 };
+/*
+ Flat view of a dense volume or image (slices=1) shared by the parallel
+ marchers. Voxels are stored with i fastest, like Volume and Image.
+ */
+struct MarchGrid {
+	float* dist;
+	uint8_t* label;
+	int8_t* sign;
+	int rows;
+	int cols;
+	int slices;
+	size_t index(int i, int j, int k) const {
+		return i + (j + (size_t) k * cols) * (size_t) rows;
+	}
+	bool contains(int i, int j, int k) const {
+		return (i >= 0 && j >= 0 && k >= 0 && i < rows && j < cols
+				&& k < slices);
+	}
+};
+struct MarchCandidate {
+	size_t index;
+	float dist;
+	int8_t sign;
+};
+struct SparseMarchCandidate {
+	int3 pos;
+	float dist;
+	int8_t sign;
+};
+static const int MarchNeighborsX[6] = { -1, 1, 0, 0, 0, 0 };
+static const int MarchNeighborsY[6] = { 0, 0, -1, 1, 0, 0 };
+static const int MarchNeighborsZ[6] = { 0, 0, 0, 0, -1, 1 };
+//Godunov upwind solution of |grad T|=1 from the sorted per-axis minima a0<=a1<=a2.
+static inline float SolveEikonal(float a0, float a1, float a2) {
+	float T = a0 + 1.0f;
+	if (T > a1) {
+		float d = a0 - a1;
+		T = 0.5f * (a0 + a1 + std::sqrt(2.0f - d * d));
+		if (T > a2) {
+			float s = a0 + a1 + a2;
+			float s2 = a0 * a0 + a1 * a1 + a2 * a2;
+			T = (s + std::sqrt(std::max(0.0f, s * s - 3.0f * (s2 - 1.0f))))
+					/ 3.0f;
+		}
+	}
+	return T;
+}
+//Sign of the closest signed ACTIVE neighbor, with the neighbor sign sum as fallback.
+//Every upwind neighbor is frozen before the voxel itself, so the heap solver gets
+//the same sign regardless of the order in which equal distances are popped.
+static int8_t UpwindSign(const MarchGrid& g, int i, int j, int k) {
+	const uint8_t ACTIVE = DistanceField3f::ACTIVE.x;
+	int signSum = 0;
+	float upwind = DistanceField3f::DISTANCE_UNDEFINED;
+	int8_t upwindSign = 0;
+	for (int n = 0; n < 6; n++) {
+		int ni = i + MarchNeighborsX[n];
+		int nj = j + MarchNeighborsY[n];
+		int nk = k + MarchNeighborsZ[n];
+		if (!g.contains(ni, nj, nk)) {
+			continue;
+		}
+		size_t nidx = g.index(ni, nj, nk);
+		signSum += g.sign[nidx];
+		if (g.label[nidx] == ACTIVE && g.sign[nidx] != 0
+				&& g.dist[nidx] < upwind) {
+			upwind = g.dist[nidx];
+			upwindSign = g.sign[nidx];
+		}
+	}
+	return (upwindSign != 0) ? upwindSign : (int8_t) aly::sign(signSum);
+}
+static int8_t UpwindSign(EndlessGridAccessor<DfElem>& acc, int i, int j,
+		int k) {
+	const uint8_t ACTIVE = DistanceField3f::ACTIVE.x;
+	int signSum = 0;
+	float upwind = DistanceField3f::DISTANCE_UNDEFINED;
+	int8_t upwindSign = 0;
+	for (int n = 0; n < 6; n++) {
+		DfElem nbr = acc.getValue(i + MarchNeighborsX[n],
+				j + MarchNeighborsY[n], k + MarchNeighborsZ[n]);
+		signSum += nbr.sign;
+		if (nbr.label == ACTIVE && nbr.sign != 0 && nbr.dist < upwind) {
+			upwind = nbr.dist;
+			upwindSign = nbr.sign;
+		}
+	}
+	return (upwindSign != 0) ? upwindSign : (int8_t) aly::sign(signSum);
+}
+//Upwind update from the smallest ACTIVE neighbor on each axis, sorted in place.
+//The sign comes from the closest signed upwind neighbor, so it follows the characteristics.
+static inline float MarchActive(float* a) {
+	if (a[0] > a[1])
+		std::swap(a[0], a[1]);
+	if (a[1] > a[2])
+		std::swap(a[1], a[2]);
+	if (a[0] > a[1])
+		std::swap(a[0], a[1]);
+	return SolveEikonal(a[0], a[1], a[2]);
+}
+static float MarchActive(const MarchGrid& g, int i, int j, int k,
+		int8_t& sgn, uint8_t also = 0) {
+	const uint8_t ACTIVE = DistanceField3f::ACTIVE.x;
+	float a[3];
+	int signSum = 0;
+	float upwind = DistanceField3f::DISTANCE_UNDEFINED;
+	int8_t upwindSign = 0;
+	for (int ax = 0; ax < 3; ax++) {
+		a[ax] = DistanceField3f::DISTANCE_UNDEFINED;
+		for (int n = 2 * ax; n < 2 * ax + 2; n++) {
+			int ni = i + MarchNeighborsX[n];
+			int nj = j + MarchNeighborsY[n];
+			int nk = k + MarchNeighborsZ[n];
+			if (!g.contains(ni, nj, nk)) {
+				continue;
+			}
+			size_t nidx = g.index(ni, nj, nk);
+			signSum += g.sign[nidx];
+			if (g.label[nidx] == ACTIVE || g.label[nidx] == also) {
+				a[ax] = std::min(a[ax], g.dist[nidx]);
+				if (g.sign[nidx] != 0 && g.dist[nidx] < upwind) {
+					upwind = g.dist[nidx];
+					upwindSign = g.sign[nidx];
+				}
+			}
+		}
+	}
+	sgn = (upwindSign != 0) ? upwindSign : (int8_t) aly::sign(signSum);
+	return MarchActive(a);
+}
+static float MarchActive(EndlessGridAccessor<DfElem>& acc, int i, int j,
+		int k, int8_t& sgn, uint8_t also = 0) {
+	const uint8_t ACTIVE = DistanceField3f::ACTIVE.x;
+	float a[3];
+	int signSum = 0;
+	float upwind = DistanceField3f::DISTANCE_UNDEFINED;
+	int8_t upwindSign = 0;
+	for (int ax = 0; ax < 3; ax++) {
+		a[ax] = DistanceField3f::DISTANCE_UNDEFINED;
+		for (int n = 2 * ax; n < 2 * ax + 2; n++) {
+			DfElem nbr = acc.getValue(i + MarchNeighborsX[n],
+					j + MarchNeighborsY[n], k + MarchNeighborsZ[n]);
+			signSum += nbr.sign;
+			if (nbr.label == ACTIVE || nbr.label == also) {
+				a[ax] = std::min(a[ax], nbr.dist);
+				if (nbr.sign != 0 && nbr.dist < upwind) {
+					upwind = nbr.dist;
+					upwindSign = nbr.sign;
+				}
+			}
+		}
+	}
+	sgn = (upwindSign != 0) ? upwindSign : (int8_t) aly::sign(signSum);
+	return MarchActive(a);
+}
+/*
+ Dial's algorithm with buckets of width 1/sqrt(dimensions). The eikonal update
+ grows by at least that much from its smallest upwind neighbor, so a voxel only
+ depends on bucket peers through its larger upwind neighbors. Peers are relaxed
+ against each other in a few Jacobi passes (group marching), the whole bucket
+ is frozen at once, then its neighbors are updated in parallel and merged in
+ thread order.
+ */
+static const uint8_t MARCH_BUCKET = 4;
+static const int MARCH_RELAX_PASSES = 8;
+static void MarchBuckets(MarchGrid& g, float maxDistance) {
+	const uint8_t ACTIVE = DistanceField3f::ACTIVE.x;
+	const uint8_t NARROW_BAND = DistanceField3f::NARROW_BAND.x;
+	const int dims = (g.slices > 1) ? 3 : 2;
+	const float delta = 1.0f / std::sqrt((float) dims);
+	std::vector<std::vector<size_t>> buckets(
+			(size_t) std::ceil(maxDistance / delta) + 2);
+	std::vector<std::vector<size_t>> seeds(g.slices);
+#pragma omp parallel for
+	for (int k = 0; k < g.slices; k++) {
+		size_t start = g.index(0, 0, k);
+		size_t end = start + (size_t) g.rows * g.cols;
+		for (size_t idx = start; idx < end; idx++) {
+			if (g.label[idx] == ACTIVE) {
+				seeds[k].push_back(idx);
+			}
+		}
+	}
+	std::vector<size_t> front;
+	std::vector<float> relaxed;
+	std::vector<int8_t> relaxedSign;
+	for (std::vector<size_t>& seed : seeds) {
+		front.insert(front.end(), seed.begin(), seed.end());
+		std::vector<size_t>().swap(seed);
+	}
+	int threads = std::max(1, omp_get_max_threads());
+	std::vector<std::vector<MarchCandidate>> candidates(threads);
+	for (int b = -1; b < (int) buckets.size(); b++) {
+		if (b >= 0) {
+			front.clear();
+			for (size_t idx : buckets[b]) {
+				float d = g.dist[idx];
+				if (g.label[idx] == NARROW_BAND && d <= maxDistance
+						&& (int) (d / delta) <= b) {
+					g.label[idx] = MARCH_BUCKET;
+					front.push_back(idx);
+				}
+			}
+			std::vector<size_t>().swap(buckets[b]);
+			const int64_t M = (int64_t) front.size();
+			relaxed.resize(front.size());
+			relaxedSign.resize(front.size());
+			for (int pass = 0; pass < MARCH_RELAX_PASSES && M > 1; pass++) {
+				int changed = 0;
+#pragma omp parallel for reduction(+:changed)
+				for (int64_t n = 0; n < M; n++) {
+					size_t idx = front[n];
+					int8_t sgn;
+					float d = MarchActive(g, (int) (idx % g.rows),
+							(int) ((idx / g.rows) % g.cols),
+							(int) (idx / ((size_t) g.rows * g.cols)), sgn,
+							MARCH_BUCKET);
+					relaxed[n] = g.dist[idx];
+					relaxedSign[n] = g.sign[idx];
+					if (d < g.dist[idx] - 1E-5f) {
+						relaxed[n] = d;
+						relaxedSign[n] = sgn;
+						changed++;
+					}
+				}
+#pragma omp parallel for
+				for (int64_t n = 0; n < M; n++) {
+					g.dist[front[n]] = relaxed[n];
+					g.sign[front[n]] = relaxedSign[n];
+				}
+				if (changed == 0) {
+					break;
+				}
+			}
+			for (size_t idx : front) {
+				g.label[idx] = ACTIVE;
+			}
+		}
+		if (front.size() == 0) {
+			continue;
+		}
+		const int64_t N = (int64_t) front.size();
+#pragma omp parallel
+		{
+			std::vector<MarchCandidate>& local = candidates[omp_get_thread_num()];
+#pragma omp for
+			for (int64_t n = 0; n < N; n++) {
+				size_t idx = front[n];
+				int i = (int) (idx % g.rows);
+				int j = (int) ((idx / g.rows) % g.cols);
+				int k = (int) (idx / ((size_t) g.rows * g.cols));
+				for (int nn = 0; nn < 6; nn++) {
+					int ni = i + MarchNeighborsX[nn];
+					int nj = j + MarchNeighborsY[nn];
+					int nk = k + MarchNeighborsZ[nn];
+					if (!g.contains(ni, nj, nk)) {
+						continue;
+					}
+					size_t nidx = g.index(ni, nj, nk);
+					if (g.label[nidx] == ACTIVE) {
+						continue;
+					}
+					MarchCandidate c;
+					c.index = nidx;
+					c.dist = MarchActive(g, ni, nj, nk, c.sign);
+					local.push_back(c);
+				}
+			}
+		}
+		for (std::vector<MarchCandidate>& local : candidates) {
+			for (const MarchCandidate& c : local) {
+				g.dist[c.index] = c.dist;
+				g.sign[c.index] = c.sign;
+				g.label[c.index] = NARROW_BAND;
+				if (c.dist <= maxDistance) {
+					size_t bb = (size_t) std::max(b + 1, (int) (c.dist / delta));
+					if (bb >= buckets.size()) {
+						buckets.resize(bb + 1);
+					}
+					buckets[bb].push_back(c.index);
+				}
+			}
+			local.clear();
+		}
+	}
+}
+static void MarchBuckets(EndlessGrid<DfElem>& grid, float maxDistance) {
+	const uint8_t ACTIVE = DistanceField3f::ACTIVE.x;
+	const uint8_t NARROW_BAND = DistanceField3f::NARROW_BAND.x;
+	const float delta = 1.0f / std::sqrt(3.0f);
+	std::vector<std::vector<int3>> buckets(
+			(size_t) std::ceil(maxDistance / delta) + 2);
+	std::vector<EndlessNode<DfElem>*> leafs = grid.getLeafNodes();
+	std::vector<std::vector<int3>> seeds(leafs.size());
+#pragma omp parallel for
+	for (int64_t l = 0; l < (int64_t) leafs.size(); l++) {
+		EndlessNode<DfElem>* leaf = leafs[l];
+		int dim = leaf->dim;
+		for (int kk = 0; kk < dim; kk++) {
+			for (int jj = 0; jj < dim; jj++) {
+				for (int ii = 0; ii < dim; ii++) {
+					if ((*leaf)(ii, jj, kk).label == ACTIVE) {
+						seeds[l].push_back(leaf->location + int3(ii, jj, kk));
+					}
+				}
+			}
+		}
+	}
+	std::vector<int3> front;
+	std::vector<DfElem*> members;
+	std::vector<float> relaxed;
+	std::vector<int8_t> relaxedSign;
+	for (std::vector<int3>& seed : seeds) {
+		front.insert(front.end(), seed.begin(), seed.end());
+		std::vector<int3>().swap(seed);
+	}
+	EndlessGridAccessor<DfElem> distAcc(grid);
+	int threads = std::max(1, omp_get_max_threads());
+	std::vector<std::vector<SparseMarchCandidate>> candidates(threads);
+	for (int b = -1; b < (int) buckets.size(); b++) {
+		if (b >= 0) {
+			front.clear();
+			members.clear();
+			for (int3 pos : buckets[b]) {
+				DfElem& elem = distAcc(pos);
+				if (elem.label == NARROW_BAND && elem.dist <= maxDistance
+						&& (int) (elem.dist / delta) <= b) {
+					elem.label = MARCH_BUCKET;
+					front.push_back(pos);
+					members.push_back(&elem);
+				}
+			}
+			std::vector<int3>().swap(buckets[b]);
+			const int64_t M = (int64_t) front.size();
+			relaxed.resize(front.size());
+			relaxedSign.resize(front.size());
+			for (int pass = 0; pass < MARCH_RELAX_PASSES && M > 1; pass++) {
+				int changed = 0;
+#pragma omp parallel
+				{
+					EndlessGridAccessor<DfElem> nbrAcc(
+							(const EndlessGrid<DfElem>&) grid);
+#pragma omp for reduction(+:changed)
+					for (int64_t n = 0; n < M; n++) {
+						int3 pos = front[n];
+						int8_t sgn;
+						float d = MarchActive(nbrAcc, pos.x, pos.y, pos.z, sgn,
+								MARCH_BUCKET);
+						relaxed[n] = members[n]->dist;
+						relaxedSign[n] = members[n]->sign;
+						if (d < members[n]->dist - 1E-5f) {
+							relaxed[n] = d;
+							relaxedSign[n] = sgn;
+							changed++;
+						}
+					}
+				}
+#pragma omp parallel for
+				for (int64_t n = 0; n < M; n++) {
+					members[n]->dist = relaxed[n];
+					members[n]->sign = relaxedSign[n];
+				}
+				if (changed == 0) {
+					break;
+				}
+			}
+			for (DfElem* elem : members) {
+				elem->label = ACTIVE;
+			}
+		}
+		if (front.size() == 0) {
+			continue;
+		}
+		const int64_t N = (int64_t) front.size();
+		//Leaves are only read here. New ones are allocated by the serial merge below.
+#pragma omp parallel
+		{
+			std::vector<SparseMarchCandidate>& local =
+					candidates[omp_get_thread_num()];
+			EndlessGridAccessor<DfElem> nbrAcc((const EndlessGrid<DfElem>&) grid);
+#pragma omp for
+			for (int64_t n = 0; n < N; n++) {
+				int3 pos = front[n];
+				for (int nn = 0; nn < 6; nn++) {
+					int3 npos = pos
+							+ int3(MarchNeighborsX[nn], MarchNeighborsY[nn],
+									MarchNeighborsZ[nn]);
+					if (nbrAcc.getValue(npos.x, npos.y, npos.z).label == ACTIVE) {
+						continue;
+					}
+					SparseMarchCandidate c;
+					c.pos = npos;
+					c.dist = MarchActive(nbrAcc, npos.x, npos.y, npos.z, c.sign);
+					local.push_back(c);
+				}
+			}
+		}
+		for (std::vector<SparseMarchCandidate>& local : candidates) {
+			for (const SparseMarchCandidate& c : local) {
+				DfElem& elem = distAcc(c.pos);
+				elem.dist = c.dist;
+				elem.sign = c.sign;
+				elem.label = NARROW_BAND;
+				if (c.dist <= maxDistance) {
+					size_t bb = (size_t) std::max(b + 1, (int) (c.dist / delta));
+					if (bb >= buckets.size()) {
+						buckets.resize(bb + 1);
+					}
+					buckets[bb].push_back(c.pos);
+				}
+			}
+			local.clear();
+		}
+	}
+}
+/*
+ Gauss-Seidel sweeps over one block, alternating direction, until it stops
+ changing. Returns a bit per face (i-,i+,j-,j+,k-,k+) whose voxels changed,
+ and bit 6 if anything changed.
+ */
+static int SweepBlock(MarchGrid& g, const int3& bmin, const int3& bmax,
+		float maxDistance) {
+	const uint8_t ACTIVE = DistanceField3f::ACTIVE.x;
+	const uint8_t NARROW_BAND = DistanceField3f::NARROW_BAND.x;
+	const float TOLERANCE = 1E-5f;
+	const int maxPasses = 4 * std::max(bmax.x - bmin.x, bmax.y - bmin.y);
+	int mask = 0;
+	bool changed = true;
+	for (int pass = 0; pass < maxPasses && changed; pass++) {
+		changed = false;
+		int step = (pass % 2 == 0) ? 1 : -1;
+		int3 start = (step > 0) ? bmin : bmax - 1;
+		int3 end = (step > 0) ? bmax : bmin - 1;
+		for (int k = start.z; k != end.z; k += step) {
+			for (int j = start.y; j != end.y; j += step) {
+				for (int i = start.x; i != end.x; i += step) {
+					size_t idx = g.index(i, j, k);
+					if (g.label[idx] == ACTIVE) {
+						continue;
+					}
+					int8_t sgn;
+					float T = MarchActive(g, i, j, k, sgn, NARROW_BAND);
+					if (T > maxDistance || T >= g.dist[idx] - TOLERANCE) {
+						continue;
+					}
+					g.dist[idx] = T;
+					g.sign[idx] = sgn;
+					g.label[idx] = NARROW_BAND;
+					changed = true;
+					mask |= (1 << 6);
+					if (i == bmin.x)
+						mask |= 1;
+					if (i == bmax.x - 1)
+						mask |= 2;
+					if (j == bmin.y)
+						mask |= 4;
+					if (j == bmax.y - 1)
+						mask |= 8;
+					if (k == bmin.z)
+						mask |= 16;
+					if (k == bmax.z - 1)
+						mask |= 32;
+				}
+			}
+		}
+	}
+	return mask;
+}
+/*
+ Blocked fast iterative method. Only blocks that touch the interface, or
+ whose neighbor changed a shared face, are swept. Blocks are swept in two
+ checkerboard phases so that no two face-adjacent blocks run at once.
+ */
+static void MarchBlocks(MarchGrid& g, float maxDistance) {
+	const uint8_t ACTIVE = DistanceField3f::ACTIVE.x;
+	const uint8_t NARROW_BAND = DistanceField3f::NARROW_BAND.x;
+	const uint8_t FAR_AWAY = DistanceField3f::FAR_AWAY.x;
+	const int B = (g.slices > 1) ? 8 : 16;
+	const int3 blockSize(B, B, std::min(B, g.slices));
+	const int3 blocks((g.rows + blockSize.x - 1) / blockSize.x,
+			(g.cols + blockSize.y - 1) / blockSize.y,
+			(g.slices + blockSize.z - 1) / blockSize.z);
+	const int blockCount = blocks.x * blocks.y * blocks.z;
+	auto blockMin = [=](int b) {
+		return int3(b % blocks.x, (b / blocks.x) % blocks.y, b / (blocks.x * blocks.y)) * blockSize;
+	};
+	std::vector<uint8_t> active(blockCount, 0);
+#pragma omp parallel for
+	for (int b = 0; b < blockCount; b++) {
+		int3 bmin = blockMin(b);
+		int3 bmax = aly::min(bmin + blockSize, int3(g.rows, g.cols, g.slices));
+		for (int k = bmin.z; k < bmax.z; k++) {
+			for (int j = bmin.y; j < bmax.y; j++) {
+				for (int i = bmin.x; i < bmax.x; i++) {
+					size_t idx = g.index(i, j, k);
+					if (g.label[idx] == ACTIVE) {
+						active[b] = 1;
+					} else {
+						g.label[idx] = FAR_AWAY;
+						g.dist[idx] = DistanceField3f::DISTANCE_UNDEFINED;
+					}
+				}
+			}
+		}
+	}
+	auto activate = [&](int b, int face) {
+		int3 pos = blockMin(b) / blockSize;
+		pos[face / 2] += (face % 2 == 0) ? -1 : 1;
+		if (pos.x >= 0 && pos.y >= 0 && pos.z >= 0 && pos.x < blocks.x
+				&& pos.y < blocks.y && pos.z < blocks.z) {
+			active[pos.x + (pos.y + pos.z * blocks.y) * blocks.x] = 1;
+		}
+	};
+	//Seed voxels on a block face never change, so their neighbors start active too.
+	for (int b = 0; b < blockCount; b++) {
+		if (active[b] == 1) {
+			for (int f = 0; f < 6; f++) {
+				activate(b, f);
+			}
+		}
+	}
+	std::vector<int> work;
+	std::vector<int> masks;
+	bool running = true;
+	while (running) {
+		running = false;
+		for (int parity = 0; parity < 2; parity++) {
+			work.clear();
+			for (int b = 0; b < blockCount; b++) {
+				int3 pos = blockMin(b) / blockSize;
+				if (active[b] && ((pos.x + pos.y + pos.z) % 2) == parity) {
+					work.push_back(b);
+					active[b] = 0;
+				}
+			}
+			if (work.size() == 0) {
+				continue;
+			}
+			running = true;
+			masks.resize(work.size());
+#pragma omp parallel for schedule(dynamic)
+			for (int n = 0; n < (int) work.size(); n++) {
+				int3 bmin = blockMin(work[n]);
+				int3 bmax = aly::min(bmin + blockSize,
+						int3(g.rows, g.cols, g.slices));
+				masks[n] = SweepBlock(g, bmin, bmax, maxDistance);
+			}
+			for (int n = 0; n < (int) work.size(); n++) {
+				for (int f = 0; f < 6; f++) {
+					if (masks[n] & (1 << f)) {
+						activate(work[n], f);
+					}
+				}
+			}
+		}
+	}
+	size_t N = (size_t) g.rows * g.cols * g.slices;
+#pragma omp parallel for
+	for (int64_t idx = 0; idx < (int64_t) N; idx++) {
+		if (g.label[idx] == NARROW_BAND) {
+			g.label[idx] = ACTIVE;
+		}
+	}
+}
 float DistanceField3f::march(float IMv, float IPv, float JMv, float JPv,
 		float KMv, float KPv, int IMl, int IPl, int JMl, int JPl, int KMl,
 		int KPl) {
@@ -228,8 +794,16 @@ void DistanceField3f::solve(const Volume1f& vol, Volume1f& distVol,
 			}
 		}
 	}
-	heap.reserve(countAlive);
-	{
+	MarchGrid grid = { distVol.ptr(), labelVol.ptr(), signVol.ptr(), rows,
+			cols, slices };
+	if (method != DistanceFieldMethod::FastMarching) {
+		if (method == DistanceFieldMethod::Bucketed) {
+			MarchBuckets(grid, maxDistance);
+		} else {
+			MarchBlocks(grid, maxDistance);
+		}
+	} else {
+		heap.reserve(countAlive);
 		int koff;
 		int nj, nk, ni;
 		float newvalue;
@@ -331,6 +905,7 @@ void DistanceField3f::solve(const Volume1f& vol, Volume1f& distVol,
 			}
 			distVol(i, j, k).x = (he->value);
 			labelVol(i, j, k) = ACTIVE;
+			signVol(i, j, k).x = UpwindSign(grid, i, j, k);
 			for (koff = 0; koff < 6; koff++) {
 				ni = i + neighborsX[koff];
 				nj = j + neighborsY[koff];
@@ -442,42 +1017,42 @@ void DistanceField3f::solve(EndlessGridFloat& vol, float maxDistance) {
 	std::list<VoxelIndex> voxelList;
 	VoxelIndex* he = nullptr;
 	size_t countAlive = 0;
-	int dim;
-	int3 pos;
-
-	short NSFlag, WEFlag, FBFlag;
-	float s = 0, t = 0, w = 0;
-	float JMv = 0, JPv = 0, IMv = 0, IPv = 0, KPv = 0, KMv = 0, Cv = 0;
-	int i, j, k;
-	for (EndlessNodeFloat* leaf : vol.getLeafNodes()) {
-		dim = leaf->dim;
-		pos = leaf->location;
+	//Leaves are allocated up front so the initialization pass can write distVol in parallel.
+	distVol.unionTopology(vol);
+	vol.forEachLeaf([&](EndlessNodeFloat* leaf) {
+		EndlessGridAccessor<float> volAcc((const EndlessGridFloat&)vol);
+		EndlessGridAccessor<DfElem> distAcc(distVol);
+		short NSFlag, WEFlag, FBFlag;
+		float s = 0, t = 0, w = 0;
+		float JMv, JPv, IMv, IPv, KPv, KMv, Cv;
+		size_t leafAlive = 0;
+		int dim = leaf->dim;
+		int3 pos = leaf->location;
 		for (int kk = 0; kk < dim; kk++) {
 			for (int jj = 0; jj < dim; jj++) {
 				for (int ii = 0; ii < dim; ii++) {
-					i = pos.x + ii;
-					j = pos.y + jj;
-					k = pos.z + kk;
-					Cv = vol.getLeafValue(i, j, k, leaf);
+					int i = pos.x + ii;
+					int j = pos.y + jj;
+					int k = pos.z + kk;
+					Cv = (*leaf)(ii, jj, kk);
+					DfElem& elem = distAcc(i, j, k);
 					if (Cv == 0) {
-						DfElem& elem = distVol.getLeafValue(i, j, k);
 						elem.dist = 0;
 						elem.sign = 0;
 						elem.label = ACTIVE;
-						countAlive++;
+						leafAlive++;
 					} else {
-						DfElem& elem = distVol.getLeafValue(i, j, k);
 						if (std::abs(Cv) < BG_VALUE) {
 							elem.sign = (int8_t) aly::sign(Cv);
 							NSFlag = 0;
 							WEFlag = 0;
 							FBFlag = 0;
-							JMv = vol.getLeafValue(i, j - 1, k, leaf);
-							JPv = vol.getLeafValue(i, j + 1, k, leaf);
-							IMv = vol.getLeafValue(i - 1, j, k, leaf);
-							IPv = vol.getLeafValue(i + 1, j, k, leaf);
-							KPv = vol.getLeafValue(i, j, k + 1, leaf);
-							KMv = vol.getLeafValue(i, j, k - 1, leaf);
+							JMv = volAcc.getValue(i, j - 1, k);
+							JPv = volAcc.getValue(i, j + 1, k);
+							IMv = volAcc.getValue(i - 1, j, k);
+							IPv = volAcc.getValue(i + 1, j, k);
+							KPv = volAcc.getValue(i, j, k + 1);
+							KMv = volAcc.getValue(i, j, k - 1);
 							if (JMv * Cv < 0 && JMv != BG_VALUE) {
 								NSFlag = 1;
 								s = JMv;
@@ -533,7 +1108,7 @@ void DistanceField3f::solve(EndlessGridFloat& vol, float maxDistance) {
 							if (result == 0) {
 								elem.dist = 0;
 							} else {
-								countAlive++;
+								leafAlive++;
 								elem.label = ACTIVE;
 								result = std::sqrt(result);
 								elem.dist = (float) (1.0f / result);
@@ -545,172 +1120,171 @@ void DistanceField3f::solve(EndlessGridFloat& vol, float maxDistance) {
 				}
 			}
 		}
-	}
-	heap.reserve(countAlive);
-	int koff;
-	int nj, nk, ni;
-	float newvalue;
-	JMv = 0;
-	JPv = 0;
-	KMv = 0;
-	KPv = 0;
-	IPv = 0;
-	IMv = 0;
-	int8_t JMs = 0, JPs = 0, KMs = 0, KPs = 0, IPs = 0, IMs = 0;
-	ubyte JMl = 0;
-	ubyte JPl = 0;
-	ubyte KMl = 0;
-	ubyte KPl = 0;
-	ubyte IPl = 0;
-	ubyte IMl = 0;
-	for (EndlessNode<DfElem>* leaf : distVol.getLeafNodes()) {
-		dim = leaf->dim;
-		pos = leaf->location;
-		for (int kk = 0; kk < dim; kk++) {
-			for (int jj = 0; jj < dim; jj++) {
-				for (int ii = 0; ii < dim; ii++) {
-					i = pos.x + ii;
-					j = pos.y + jj;
-					k = pos.z + kk;
-					DfElem& elem = distVol.getLeafValue(i, j, k);
-					if (elem.label != ACTIVE) {
-						continue;
-					}
-					for (koff = 0; koff < 6; koff++) {
-						ni = i + neighborsX[koff];
-						nj = j + neighborsY[koff];
-						nk = k + neighborsZ[koff];
-						DfElem& nelem = distVol.getLeafValue(ni, nj, nk);
-						if (nelem.label != FAR_AWAY) {
+#pragma omp atomic
+		countAlive += leafAlive;
+	});
+	if (method != DistanceFieldMethod::FastMarching) {
+		MarchBuckets(distVol, maxDistance);
+	} else {
+		heap.reserve(countAlive);
+		EndlessGridAccessor<DfElem> distAcc(distVol);
+		EndlessGridAccessor<DfElem> nbrAcc(distVol);
+		int koff;
+		int nj, nk, ni;
+		float newvalue;
+		float JMv = 0, JPv = 0, IMv = 0, IPv = 0, KPv = 0, KMv = 0;
+		int8_t JMs = 0, JPs = 0, KMs = 0, KPs = 0, IPs = 0, IMs = 0;
+		ubyte JMl = 0;
+		ubyte JPl = 0;
+		ubyte KMl = 0;
+		ubyte KPl = 0;
+		ubyte IPl = 0;
+		ubyte IMl = 0;
+		for (EndlessNode<DfElem>* leaf : distVol.getLeafNodes()) {
+			int dim = leaf->dim;
+			int3 pos = leaf->location;
+			for (int kk = 0; kk < dim; kk++) {
+				for (int jj = 0; jj < dim; jj++) {
+					for (int ii = 0; ii < dim; ii++) {
+						int i = pos.x + ii;
+						int j = pos.y + jj;
+						int k = pos.z + kk;
+						if ((*leaf)(ii, jj, kk).label != ACTIVE) {
 							continue;
 						}
-						nelem.label = NARROW_BAND;
-						DfElem JM = distVol.getLeafValue(ni, nj - 1, nk, leaf);
-						JMv = JM.dist;
-						JMs = JM.sign;
-						JMl = JM.label;
+						for (koff = 0; koff < 6; koff++) {
+							ni = i + neighborsX[koff];
+							nj = j + neighborsY[koff];
+							nk = k + neighborsZ[koff];
+							DfElem& nelem = distAcc(ni, nj, nk);
+							if (nelem.label != FAR_AWAY) {
+								continue;
+							}
+							nelem.label = NARROW_BAND;
+							DfElem JM = nbrAcc.getValue(ni, nj - 1, nk);
+							JMv = JM.dist;
+							JMs = JM.sign;
+							JMl = JM.label;
 
-						DfElem JP = distVol.getLeafValue(ni, nj + 1, nk, leaf);
-						JPv = JP.dist;
-						JPs = JP.sign;
-						JPl = JP.label;
+							DfElem JP = nbrAcc.getValue(ni, nj + 1, nk);
+							JPv = JP.dist;
+							JPs = JP.sign;
+							JPl = JP.label;
 
-						DfElem KP = distVol.getLeafValue(ni, nj, nk + 1, leaf);
-						KPv = KP.dist;
-						KPs = KP.sign;
-						KPl = KP.label;
+							DfElem KP = nbrAcc.getValue(ni, nj, nk + 1);
+							KPv = KP.dist;
+							KPs = KP.sign;
+							KPl = KP.label;
 
-						DfElem KM = distVol.getLeafValue(ni, nj, nk - 1, leaf);
-						KMv = KM.dist;
-						KMs = KM.sign;
-						KMl = KM.label;
+							DfElem KM = nbrAcc.getValue(ni, nj, nk - 1);
+							KMv = KM.dist;
+							KMs = KM.sign;
+							KMl = KM.label;
 
-						DfElem IP = distVol.getLeafValue(ni + 1, nj, nk, leaf);
-						IPv = IP.dist;
-						IPs = IP.sign;
-						IPl = IP.label;
+							DfElem IP = nbrAcc.getValue(ni + 1, nj, nk);
+							IPv = IP.dist;
+							IPs = IP.sign;
+							IPl = IP.label;
 
-						DfElem IM = distVol.getLeafValue(ni - 1, nj, nk, leaf);
-						IMv = IM.dist;
-						IMs = IM.sign;
-						IMl = IM.label;
+							DfElem IM = nbrAcc.getValue(ni - 1, nj, nk);
+							IMv = IM.dist;
+							IMs = IM.sign;
+							IMl = IM.label;
 
-						nelem.sign = aly::sign(
-								JMs + JPs + IMs + IPs + KPs + KMs);
-						newvalue = march(JMv, JPv, KPv, KMv, IPv, IMv, JMl, JPl,
-								KPl, KMl, IPl, IMl);
-						nelem.dist = newvalue;
-						voxelList.push_back(
-								VoxelIndex(Coord(ni, nj, nk),
-										(float) newvalue));
-						heap.add(&voxelList.back());
+							nelem.sign = aly::sign(
+									JMs + JPs + IMs + IPs + KPs + KMs);
+							newvalue = march(JMv, JPv, KPv, KMv, IPv, IMv, JMl, JPl,
+									KPl, KMl, IPl, IMl);
+							nelem.dist = newvalue;
+							voxelList.push_back(
+									VoxelIndex(Coord(ni, nj, nk),
+											(float) newvalue));
+							heap.add(&voxelList.back());
+						}
 					}
 				}
 			}
 		}
-	}
-	vol.clear();
-	vol.setBackgroundValue(BG_VALUE);
-	while (!heap.isEmpty()) {
-		int i, j, k;
-		he = heap.remove();
-		i = he->index[0];
-		j = he->index[1];
-		k = he->index[2];
-		if (he->value > maxDistance) {
-			break;
-		}
-		DfElem elem;
-		EndlessNode<DfElem>* leaf = nullptr;
-		distVol.getLeafValue(i, j, k, leaf, elem);
-		elem.dist = he->value;
-		elem.label = ACTIVE;
-		distVol.setLeafValue(i, j, k, elem, leaf);
-		for (koff = 0; koff < 6; koff++) {
-			ni = i + neighborsX[koff];
-			nj = j + neighborsY[koff];
-			nk = k + neighborsZ[koff];
-			DfElem& nelem = distVol.getLeafValue(ni, nj, nk);
-			if (nelem.label == ACTIVE) {
-				continue;
+		while (!heap.isEmpty()) {
+			int i, j, k;
+			he = heap.remove();
+			i = he->index[0];
+			j = he->index[1];
+			k = he->index[2];
+			if (he->value > maxDistance) {
+				break;
 			}
-			DfElem JM = distVol.getLeafValue(ni, nj - 1, nk, leaf);
-			JMv = JM.dist;
-			JMs = JM.sign;
-			JMl = JM.label;
+			DfElem& elem = distAcc(i, j, k);
+			elem.dist = he->value;
+			elem.label = ACTIVE;
+			elem.sign = UpwindSign(nbrAcc, i, j, k);
+			for (koff = 0; koff < 6; koff++) {
+				ni = i + neighborsX[koff];
+				nj = j + neighborsY[koff];
+				nk = k + neighborsZ[koff];
+				DfElem& nelem = distAcc(ni, nj, nk);
+				if (nelem.label == ACTIVE) {
+					continue;
+				}
+				DfElem JM = nbrAcc.getValue(ni, nj - 1, nk);
+				JMv = JM.dist;
+				JMs = JM.sign;
+				JMl = JM.label;
 
-			DfElem JP = distVol.getLeafValue(ni, nj + 1, nk, leaf);
-			JPv = JP.dist;
-			JPs = JP.sign;
-			JPl = JP.label;
+				DfElem JP = nbrAcc.getValue(ni, nj + 1, nk);
+				JPv = JP.dist;
+				JPs = JP.sign;
+				JPl = JP.label;
 
-			DfElem KP = distVol.getLeafValue(ni, nj, nk + 1, leaf);
-			KPv = KP.dist;
-			KPs = KP.sign;
-			KPl = KP.label;
+				DfElem KP = nbrAcc.getValue(ni, nj, nk + 1);
+				KPv = KP.dist;
+				KPs = KP.sign;
+				KPl = KP.label;
 
-			DfElem KM = distVol.getLeafValue(ni, nj, nk - 1, leaf);
-			KMv = KM.dist;
-			KMs = KM.sign;
-			KMl = KM.label;
+				DfElem KM = nbrAcc.getValue(ni, nj, nk - 1);
+				KMv = KM.dist;
+				KMs = KM.sign;
+				KMl = KM.label;
 
-			DfElem IP = distVol.getLeafValue(ni + 1, nj, nk, leaf);
-			IPv = IP.dist;
-			IPs = IP.sign;
-			IPl = IP.label;
+				DfElem IP = nbrAcc.getValue(ni + 1, nj, nk);
+				IPv = IP.dist;
+				IPs = IP.sign;
+				IPl = IP.label;
 
-			DfElem IM = distVol.getLeafValue(ni - 1, nj, nk, leaf);
-			IMv = IM.dist;
-			IMs = IM.sign;
-			IMl = IM.label;
+				DfElem IM = nbrAcc.getValue(ni - 1, nj, nk);
+				IMv = IM.dist;
+				IMs = IM.sign;
+				IMl = IM.label;
 
-			nelem.sign = aly::sign(JMs + JPs + IMs + IPs + KPs + KMs);
-			newvalue = march(JMv, JPv, KPv, KMv, IPv, IMv, JMl, JPl, KPl, KMl,
-					IPl, IMl);
-			voxelList.push_back(
-					VoxelIndex(Coord(ni, nj, nk), (float) newvalue));
-			VoxelIndex* vox = &voxelList.back();
-			if (nelem.label == NARROW_BAND) {
-				heap.change(Coord(ni, nj, nk), vox);
-			} else {
-				heap.add(vox);
-				nelem.label = NARROW_BAND;
+				nelem.sign = aly::sign(JMs + JPs + IMs + IPs + KPs + KMs);
+				newvalue = march(JMv, JPv, KPv, KMv, IPv, IMv, JMl, JPl, KPl, KMl,
+						IPl, IMl);
+				voxelList.push_back(
+						VoxelIndex(Coord(ni, nj, nk), (float) newvalue));
+				VoxelIndex* vox = &voxelList.back();
+				if (nelem.label == NARROW_BAND) {
+					heap.change(Coord(ni, nj, nk), vox);
+				} else {
+					heap.add(vox);
+					nelem.label = NARROW_BAND;
+				}
 			}
 		}
+		heap.clear();
 	}
-	heap.clear();
+	vol.clear();
+	vol.setBackgroundValue(BG_VALUE);
+	EndlessGridAccessor<float> volAcc(vol);
 	for (EndlessNode<DfElem>* leaf : distVol.getLeafNodes()) {
-		dim = leaf->dim;
-		pos = leaf->location;
+		int dim = leaf->dim;
+		int3 pos = leaf->location;
 		for (int kk = 0; kk < dim; kk++) {
 			for (int jj = 0; jj < dim; jj++) {
 				for (int ii = 0; ii < dim; ii++) {
-					i = pos.x + ii;
-					j = pos.y + jj;
-					k = pos.z + kk;
-					DfElem* elem = distVol.getLeafValuePtr(i, j, k, leaf);
-					if (elem->label == ACTIVE) {
-						vol.getLeafValue(i, j, k) = elem->dist * elem->sign;
+					const DfElem& elem = (*leaf)(ii, jj, kk);
+					if (elem.label == ACTIVE) {
+						volAcc(pos.x + ii, pos.y + jj, pos.z + kk) = elem.dist
+								* elem.sign;
 					}
 				}
 			}
@@ -853,8 +1427,16 @@ void DistanceField2f::solve(const Image1f& vol, Image1f& distVol,
 		}
 	}
 
-	heap.reserve(countAlive);
-	{
+	MarchGrid grid = { distVol.ptr(), labelVol.ptr(), signVol.ptr(), width,
+			height, 1 };
+	if (method != DistanceFieldMethod::FastMarching) {
+		if (method == DistanceFieldMethod::Bucketed) {
+			MarchBuckets(grid, maxDistance);
+		} else {
+			MarchBlocks(grid, maxDistance);
+		}
+	} else {
+		heap.reserve(countAlive);
 		int koff;
 		int nj, ni;
 		float newvalue;
@@ -935,6 +1517,7 @@ void DistanceField2f::solve(const Image1f& vol, Image1f& distVol,
 			}
 			distVol(i, j).x = (he->value);
 			labelVol(i, j) = ACTIVE;
+			signVol(i, j).x = UpwindSign(grid, i, j, 0);
 			for (koff = 0; koff < 4; koff++) {
 				ni = i + neighborsX[koff];
 				nj = j + neighborsY[koff];
@@ -1188,38 +1771,55 @@ float4x4 MeshToLevelSet(const aly::Mesh& mesh, Volume1f& vol, bool rescale,
 	}
 	return T;
 }
-void RebuildDistanceField(aly::Volume1f& levelset, float maxDistance) {
-	DistanceField3f df;
+void RebuildDistanceField(aly::Volume1f& levelset, float maxDistance,
+		DistanceFieldMethod method) {
+	DistanceField3f df(method);
 	aly::Volume1f out;
 	df.solve(levelset, out, maxDistance);
 	levelset = out;
 }
+void RebuildDistanceField(const aly::MappedVolume1f& levelset,
+		aly::MappedVolume1f& out, float maxDistance) {
+	//The apron must reach every zero crossing within maxDistance of the brick.
+	int apron = (int) std::ceil(maxDistance) + 2;
+	ProcessBricks(levelset, out, apron,
+			[=](const Volume1f& in, Volume1f& block) {
+				DistanceField3f df;
+				df.solve(in, block, maxDistance);
+			});
+}
+void RebuildDistanceField(aly::MappedVolume1f& levelset, float maxDistance) {
+	if (!levelset.isWriteable()) {
+		throw std::runtime_error(
+				MakeString() << "Mapped volume " << levelset.getFile()
+						<< " is not writeable.");
+	}
+	//Bricks read their neighbors' original values, so solve into a scratch file.
+	std::string scratchFile = levelset.getFile() + ".tmp";
+	{
+		MappedVolume1f scratch(scratchFile, levelset.rows, levelset.cols,
+				levelset.slices, levelset.getBrickSize());
+		RebuildDistanceField(levelset, scratch, maxDistance);
+		ForEachBrick(scratch, 0,
+				[&](const Volume1f& block, const int3& brickMin, const int3& brickDims) {
+					levelset.setRegion(brickMin, block);
+					levelset.release(brickMin, brickMin + brickDims - 1);
+				});
+	}
+	std::remove(scratchFile.c_str());
+}
 void RebuildDistanceFieldFast(aly::Volume1f& levelset, float maxDistance) {
-	float nbrs[6];
-	float dist = 0.0f;
-	int i, j, k;
-	int dim;
-	int3 pos;
-	float current, oldVal, extreme;
-	Volume1f storage(levelset.dimensions());
-	storage.set(maxDistance + 0.5f);
-	Volume1f* in = &levelset;
-	Volume1f* out = &storage;
-#pragma om parallel for
-	for (int k = 0; k < levelset.slices; k++) {
-		for (int j = 0; j < levelset.cols; j++) {
-			for (int i = 0; i < levelset.rows; i++) {
-				current = (*in)(i, j, k);
-				nbrs[0] = (*in)(i - 1, j, k);
-				nbrs[1] = (*in)(i, j + 1, k);
-				nbrs[2] = (*in)(i, j - 1, k);
-				nbrs[3] = (*in)(i + 1, j, k);
-				nbrs[4] = (*in)(i, j, k - 1);
-				nbrs[5] = (*in)(i, j, k + 1);
-				extreme = current;
+	BrickedVolume1f in(levelset);
+	BrickedVolume1f out(levelset.dimensions());
+	out.set(maxDistance + 0.5f);
+	ForEachNeighborhood6(in,
+			[&](size_t offset, const Neighborhood6<float1>& nbrs) {
+				float current = nbrs.value().x;
+				float extreme = current;
+				float dist;
 				if (current > 0) {
-					for (int i = 0; i < 6; i++) {
-						extreme = std::min(extreme, nbrs[i]);
+					for (int n = 0; n < 6; n++) {
+						extreme = std::min(extreme, nbrs[n].x);
 					}
 					if (extreme <= 0) {
 						dist = current / (current - extreme);
@@ -1227,8 +1827,8 @@ void RebuildDistanceFieldFast(aly::Volume1f& levelset, float maxDistance) {
 						dist = 1.5f;
 					}
 				} else {
-					for (int i = 0; i < 6; i++) {
-						extreme = std::max(extreme, nbrs[i]);
+					for (int n = 0; n < 6; n++) {
+						extreme = std::max(extreme, nbrs[n].x);
 					}
 					if (extreme > 0) {
 						dist = current / (extreme - current);
@@ -1236,67 +1836,43 @@ void RebuildDistanceFieldFast(aly::Volume1f& levelset, float maxDistance) {
 						dist = -1.5f;
 					}
 				}
-				(*out)(i, j, k).x = dist;
-			}
-		}
-	}
-	in->set(0.0f);
-	std::swap(in, out);
+				out.data[offset].x = dist;
+			});
+	in.set(0.0f);
+	in.data.swap(out.data);
 	int N = (int) std::ceil(maxDistance);
 	if (N % 2 == 0)
 		N++;
 	for (int b = 0; b < N; b++) {
-#pragma omp parallel for
-		for (int k = 0; k < levelset.slices; k++) {
-			for (int j = 0; j < levelset.cols; j++) {
-				for (int i = 0; i < levelset.rows; i++) {
-					float v211 = (*in)(i + 1, j, k);
-					float v011 = (*in)(i - 1, j, k);
-					float v121 = (*in)(i, j + 1, k);
-					float v101 = (*in)(i, j - 1, k);
-					float v112 = (*in)(i, j, k + 1);
-					float v110 = (*in)(i, j, k - 1);
-					current = oldVal = (*in)(i, j, k).x;
+		ForEachNeighborhood6(in,
+				[&](size_t offset, const Neighborhood6<float1>& nbrs) {
+					float oldVal = nbrs.value().x;
+					float current = oldVal;
 					if (current < -b + 0.5f) {
 						current = -(1E10);
-						if (v011 <= 1)
-							current = max(v011, current);
-						if (v121 <= 1)
-							current = max(v121, current);
-						if (v101 <= 1)
-							current = max(v101, current);
-						if (v211 <= 1)
-							current = max(v211, current);
-						if (v110 <= 1)
-							current = max(v110, current);
-						if (v112 <= 1)
-							current = max(v112, current);
+						for (int n = 0; n < 6; n++) {
+							float v = nbrs[n].x;
+							if (v <= 1)
+								current = max(v, current);
+						}
 						current -= 1.0f;
 					} else if (current > b - 0.5f) {
 						current = (1E10);
-						if (v011 >= -1)
-							current = min(v011, current);
-						if (v121 >= -1)
-							current = min(v121, current);
-						if (v101 >= -1)
-							current = min(v101, current);
-						if (v211 >= -1)
-							current = min(v211, current);
-						if (v110 >= -1)
-							current = min(v110, current);
-						if (v112 >= -1)
-							current = min(v112, current);
+						for (int n = 0; n < 6; n++) {
+							float v = nbrs[n].x;
+							if (v >= -1)
+								current = min(v, current);
+						}
 						current += 1.0f;
 					}
 					if (oldVal * current > 0) {
-						(*out)(i, j, k).x = aly::clamp(current, -maxDistance,
+						out.data[offset].x = aly::clamp(current, -maxDistance,
 								maxDistance);
 					}
-				}
-			}
-		}
-		std::swap(in, out);
+				});
+		in.data.swap(out.data);
 	}
+	in.get(levelset);
 }
 void FloodFill(aly::Volume1f& levelset, float narrowBand,
 		float backgroundValue) {
@@ -23,15 +23,31 @@
 #include "math/AlloyVecMath.h"
 #include "image/AlloyMinHeap.h"
 #include "image/AlloyVolume.h"
+#include "image/AlloyMappedVolume.h"
 #include "graphics/EndlessGrid.h"
 namespace aly {
 	class Mesh;
 	bool SANITY_CHECK_DISTANCE_FIELD();
+	/*
+	 FastMarching is the serial heap solver and the default. Bucketed freezes a
+	 whole bucket of width 1/sqrt(dimensions) at once (Dial's untidy priority
+	 queue). Peers in a bucket can still depend on each other through their
+	 larger upwind neighbors, so they are relaxed against each other for at most
+	 8 Jacobi passes before the bucket is frozen. FastIterative sweeps blocks of
+	 the narrow band in parallel until they converge. Both use the causal upwind
+	 update, which drops axes that are not upwind where the heap solver combines
+	 every frozen axis, so their distances differ from FastMarching by a few
+	 hundredths of a voxel. All three take a voxel's sign from its closest signed
+	 upwind neighbor, so signs agree.
+	 */
+	enum class DistanceFieldMethod {
+		FastMarching, Bucketed, FastIterative
+	};
 	class DistanceField3f {
 		typedef IndexableVec<float, 3> VoxelIndex;
 		typedef vec<int, 3> Coord;
 	private:
-
+		DistanceFieldMethod method;
 
 		float march(float Nv, float Sv, float Ev, float Wv, float Fv, float Bv, int Nl, int Sl, int El, int Wl, int Fl, int Bl);
 	public:
@@ -39,15 +55,24 @@ namespace aly {
 		static const ubyte1 NARROW_BAND;
 		static const ubyte1 FAR_AWAY;
 		static const float DISTANCE_UNDEFINED;
-		DistanceField3f()  {}
+		DistanceField3f(DistanceFieldMethod method = DistanceFieldMethod::FastMarching) :
+				method(method) {
+		}
+		void setMethod(DistanceFieldMethod m) {
+			method = m;
+		}
+		DistanceFieldMethod getMethod() const {
+			return method;
+		}
 		void solve(const Volume1f& vol, Volume1f& out,float maxDistance=2.5f);
+		//Sparse grids cannot allocate leaves from parallel sweeps, so FastIterative runs as Bucketed.
 		void solve(EndlessGridFloat& vol,float maxDistance=2.5f);
 	};
 	class DistanceField2f {
 		typedef IndexableVec<float, 2> PixelIndex;
 		typedef vec<int, 2> Coord;
 	private:
-
+		DistanceFieldMethod method;
 
 		float march(float Nv, float Sv, float Fv, float Bv, int Nl, int Sl, int Fl, int Bl);
 	public:
@@ -55,12 +80,23 @@ namespace aly {
 		static const ubyte1 NARROW_BAND;
 		static const ubyte1 FAR_AWAY;
 		static const float DISTANCE_UNDEFINED;
-		DistanceField2f() {}
+		DistanceField2f(DistanceFieldMethod method = DistanceFieldMethod::FastMarching) :
+				method(method) {
+		}
+		void setMethod(DistanceFieldMethod m) {
+			method = m;
+		}
+		DistanceFieldMethod getMethod() const {
+			return method;
+		}
 		void solve(const Image1f& vol, Image1f& out, float maxDistance = 2.5f);
 	};
 	float4x4 MeshToLevelSet(const aly::Mesh& mesh,Volume1f& vol,bool rescale, float narrowBand=2.5f,bool flipSign=false,float voxelScale=0.75f);
 	void RebuildDistanceFieldFast(aly::Volume1f& levelset,float maxDistance = 2.5f);
-	void RebuildDistanceField(aly::Volume1f& levelset,float maxDistance = 2.5f);
+	void RebuildDistanceField(aly::Volume1f& levelset,float maxDistance = 2.5f,DistanceFieldMethod method=DistanceFieldMethod::FastMarching);
+	//Rebuilds an out-of-core level set one brick at a time.
+	void RebuildDistanceField(const aly::MappedVolume1f& levelset,aly::MappedVolume1f& out,float maxDistance = 2.5f);
+	void RebuildDistanceField(aly::MappedVolume1f& levelset,float maxDistance = 2.5f);
 	void FloodFill(aly::Volume1f& levelset,float narrowBand=2.5f, float backgroundValue=std::numeric_limits<float>::max());
 } /* namespace imagesci */
 
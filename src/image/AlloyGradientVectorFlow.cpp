@@ -622,4 +622,12 @@ void SolveGradientVectorFlow(const Volume1f& src, Volume3f& vectorField,
 	}
 }
 
+void SolveGradientVectorFlow(const MappedVolume1f& src,
+		MappedVolume3f& vectorField, float mu, int iterations, bool normalize,
+		int apron) {
+	ProcessBricks(src, vectorField, apron,
+			[=](const Volume1f& in, Volume3f& out) {
+				SolveGradientVectorFlow(in, out, mu, iterations, normalize);
+			});
+}
 }
@@ -23,6 +23,7 @@
 #define INCLUDE_MAPPINGFIELD_H_
 #include "image/AlloyImage.h"
 #include "image/AlloyVolume.h"
+#include "image/AlloyMappedVolume.h"
 #include "math/AlloyVecMath.h"
 namespace aly {
 	void SolveEdgeFilter(const ImageRGB& img,Image1f& out,int K=1);
@@ -37,6 +38,8 @@ namespace aly {
 	void SolveGradientVectorFlow(const Volume1f& src, Volume3f& vectorField, int iterations, bool normalize);
 	void SolveGradientVectorFlow(const Volume1f& src, Volume3f& vectorField,float mu, int iterations, bool normalize);
 	void SolveGradientVectorFlow(const Volume1f& src, Volume3f& vectorField,const Volume1f& weights,float mu,int iterations,  bool normalize);
+	//Out-of-core solve. Each brick is solved with an overlapping apron, so values near brick faces approximate the global solution.
+	void SolveGradientVectorFlow(const MappedVolume1f& src, MappedVolume3f& vectorField,float mu, int iterations, bool normalize,int apron=8);
 
 }
 #endif
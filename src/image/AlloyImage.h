@@ -27,6 +27,8 @@
 #include "common/cereal/types/vector.hpp"
 #include "common/AlloyCommon.h"
 #include "math/AlloyVecMath.h"
+#include "image/AlloyImageExpression.h"
+#include "system/AlloyMemMappedFile.h"
 #include <vector>
 #include <functional>
 #include <fstream>
@@ -77,7 +79,8 @@ template<class T, int C, ImageType I> void WriteImageToRawFile(
 		const std::string& fileName, const Image<T, C, I>& img);
 template<class T, int C, ImageType I> bool ReadImageFromRawFile(
 		const std::string& fileName, Image<T, C, I>& img);
-template<class T, int C, ImageType I> struct Image {
+template<class T, int C, ImageType I> struct Image: public ImageExpression<
+		Image<T, C, I>> {
 protected:
 	int x, y;
 	std::string hashCode;
@@ -252,6 +255,23 @@ public:
 		this->set(rhs.data);
 		return *this;
 	}
+	template<class E> Image(const ImageExpression<E>& expr) :
+			Image() {
+		*this = expr;
+	}
+	template<class E> Image<T, C, I>& operator=(
+			const ImageExpression<E>& expr) {
+		static_assert(std::is_same<typename E::ValueType, vec<T, C>>::value,
+				"Image expression has a different pixel type.");
+		const E& e = expr.derived();
+		CheckImageExpression(e);
+		dim2 dims = e.dimensions();
+		resize(dims.x, dims.y);
+		setPosition(e.position());
+		EvaluateImageExpression(data, e,
+				[](vec<T, C>& val1, const vec<T, C>& val2) {val1=val2;});
+		return *this;
+	}
 	dim2 dimensions() const {
 		return dim2(width, height);
 	}
@@ -465,50 +485,10 @@ public:
 		}
 	}
 	void downSample(Image<T, C, I>& out) const {
-		static const double Kernel[5][5] = { { 1, 4, 6, 4, 1 }, { 4, 16, 24, 16,
-				4 }, { 6, 24, 36, 24, 6 }, { 4, 16, 24, 16, 4 },
-				{ 1, 4, 6, 4, 1 } };
-		out.resize(width / 2, height / 2);
-#pragma omp parallel for
-		for (int i = 0; i < out.width; i++) {
-			for (int j = 0; j < out.height; j++) {
-				vec<double, C> vsum(0.0);
-				for (int ii = 0; ii < 5; ii++) {
-					for (int jj = 0; jj < 5; jj++) {
-						vsum += Kernel[ii][jj]
-								* vec<double, C>(
-										operator()(2 * i + ii - 2,
-												2 * j + jj - 2));
-					}
-				}
-				out(i, j) = vec<T, C>(vsum / 256.0);
-			}
-		}
+		DownSample5x5(*this, out);
 	}
 	void upSample(Image<T, C, I>& out) const {
-		static const double Kernel[5][5] = { { 1, 4, 6, 4, 1 }, { 4, 16, 24, 16,
-				4 }, { 6, 24, 36, 24, 6 }, { 4, 16, 24, 16, 4 },
-				{ 1, 4, 6, 4, 1 } };
-		if (out.size() == 0)
-			out.resize(width * 2, height * 2);
-#pragma omp parallel for
-		for (int i = 0; i < out.width; i++) {
-			for (int j = 0; j < out.height; j++) {
-				vec<double, C> vsum(0.0);
-				for (int ii = 0; ii < 5; ii++) {
-					for (int jj = 0; jj < 5; jj++) {
-						int iii = i + ii - 2;
-						int jjj = j + jj - 2;
-						if (iii % 2 == 0 && jjj % 2 == 0) {
-							vsum += Kernel[ii][jj]
-									* vec<double, C>(
-											operator()(iii / 2, jjj / 2));
-						}
-					}
-				}
-				out(i, j) = vec<T, C>(vsum / 64.0);
-			}
-		}
+		UpSample5x5(*this, out);
 	}
 	Image<T, C, I> downSample() const {
 		Image<T, C, I> out;
@@ -659,9 +639,9 @@ template<class T, int C, ImageType I> std::string Image<T, C, I>::updateHashCode
 	}
 	return hashCode;
 }
-template<class T, int C, ImageType I> void Transform(Image<T, C, I>& im1,
-		Image<T, C, I>& im2,
-		const std::function<void(vec<T, C>&, vec<T, C>&)>& func) {
+template<class T, int C, ImageType I, class F> auto Transform(
+		Image<T, C, I>& im1, Image<T, C, I>& im2, const F& func)
+				-> decltype(func(im1.data[0], im2.data[0]), void()) {
 	if (im1.dimensions() != im2.dimensions())
 		throw std::runtime_error(
 				MakeString() << "Image dimensions do not match. "
@@ -672,17 +652,18 @@ template<class T, int C, ImageType I> void Transform(Image<T, C, I>& im1,
 		func(im1.data[offset], im2.data[offset]);
 	}
 }
-template<class T, int C, ImageType I> void Transform(Image<T, C, I>& im1,
-		const std::function<void(vec<T, C>&)>& func) {
+template<class T, int C, ImageType I, class F> auto Transform(
+		Image<T, C, I>& im1, const F& func)
+				-> decltype(func(im1.data[0]), void()) {
 	size_t sz = im1.size();
 #pragma omp parallel for
 	for (size_t offset = 0; offset < sz; offset++) {
 		func(im1.data[offset]);
 	}
 }
-template<class T, int C, ImageType I> void Transform(Image<T, C, I>& im1,
-		const Image<T, C, I>& im2,
-		const std::function<void(vec<T, C>&, const vec<T, C>&)>& func) {
+template<class T, int C, ImageType I, class F> auto Transform(
+		Image<T, C, I>& im1, const Image<T, C, I>& im2, const F& func)
+				-> decltype(func(im1.data[0], im2.data[0]), void()) {
 	if (im1.dimensions() != im2.dimensions())
 		throw std::runtime_error(
 				MakeString() << "Image dimensions do not match. "
@@ -693,9 +674,10 @@ template<class T, int C, ImageType I> void Transform(Image<T, C, I>& im1,
 		func(im1.data[offset], im2.data[offset]);
 	}
 }
-template<class T, int C, ImageType I> void Transform(Image<T, C, I>& im1,
-		const Image<T, C, I>& im2, const Image<T, C, I>& im3,
-		const std::function<void(vec<T, C>&, const vec<T, C>&, const vec<T, C>&)>& func) {
+template<class T, int C, ImageType I, class F> auto Transform(
+		Image<T, C, I>& im1, const Image<T, C, I>& im2,
+		const Image<T, C, I>& im3, const F& func)
+				-> decltype(func(im1.data[0], im2.data[0], im3.data[0]), void()) {
 	if (im1.dimensions() != im2.dimensions())
 		throw std::runtime_error(
 				MakeString() << "Image dimensions do not match. "
@@ -706,12 +688,10 @@ template<class T, int C, ImageType I> void Transform(Image<T, C, I>& im1,
 		func(im1.data[offset], im2.data[offset], im3.data[offset]);
 	}
 }
-template<class T, int C, ImageType I> void Transform(Image<T, C, I>& im1,
-		const Image<T, C, I>& im2, const Image<T, C, I>& im3,
-		const Image<T, C, I>& im4,
-		const std::function<
-				void(vec<T, C>&, const vec<T, C>&, const vec<T, C>&,
-						const vec<T, C>&)>& func) {
+template<class T, int C, ImageType I, class F> auto Transform(
+		Image<T, C, I>& im1, const Image<T, C, I>& im2,
+		const Image<T, C, I>& im3, const Image<T, C, I>& im4, const F& func)
+				-> decltype(func(im1.data[0], im2.data[0], im3.data[0], im4.data[0]), void()) {
 	if (im1.dimensions() != im2.dimensions())
 		throw std::runtime_error(
 				MakeString() << "Image dimensions do not match. "
@@ -723,9 +703,9 @@ template<class T, int C, ImageType I> void Transform(Image<T, C, I>& im1,
 				im4.data[offset]);
 	}
 }
-template<class T, int C, ImageType I> void Transform(Image<T, C, I>& im1,
-		Image<T, C, I>& im2,
-		const std::function<void(int i, int j, vec<T, C>& val1, vec<T, C>& val2)>& func) {
+template<class T, int C, ImageType I, class F> auto Transform(
+		Image<T, C, I>& im1, Image<T, C, I>& im2, const F& func)
+				-> decltype(func(0, 0, im1.data[0], im2.data[0]), void()) {
 	if (im1.dimensions() != im2.dimensions())
 		throw std::runtime_error(
 				MakeString() << "Image dimensions do not match. "
@@ -738,10 +718,9 @@ template<class T, int C, ImageType I> void Transform(Image<T, C, I>& im1,
 		}
 	}
 }
-template<class T, int C, ImageType I> void Transform(Image<T, C, I>& im1,
-		Image<T, C, I>& im2,
-		const std::function<
-				void(size_t offset, vec<T, C>& val1, vec<T, C>& val2)>& func) {
+template<class T, int C, ImageType I, class F> auto Transform(
+		Image<T, C, I>& im1, Image<T, C, I>& im2, const F& func)
+				-> decltype(func(size_t(0), im1.data[0], im2.data[0]), void()) {
 	if (im1.dimensions() != im2.dimensions())
 		throw std::runtime_error(
 				MakeString() << "Image dimensions do not match. "
@@ -759,252 +738,158 @@ template<class T, class L, class R, int C, ImageType I> std::basic_ostream<L, R>
 			<< "]";
 	return ss;
 }
-template<class T, int C, ImageType I> Image<T, C, I> operator+(
-		const vec<T, C>& scalar, const Image<T, C, I>& img) {
-	Image<T, C, I> out(img.width, img.height, img.position());
-	std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T,C>& val1,const vec<T,C>& val2) {val1=scalar+val2;};
-	Transform(out, img, f);
-	return out;
-}
-
-template<class T, int C, ImageType I> Image<T, C, I> operator-(
-		const vec<T, C>& scalar, const Image<T, C, I>& img) {
-	Image<T, C, I> out(img.width, img.height, img.position());
-	std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T,C>& val1,const vec<T,C>& val2) {val1=scalar-val2;};
-	Transform(out, img, f);
-	return out;
-}
-template<class T, int C, ImageType I> Image<T, C, I> operator*(
-		const vec<T, C>& scalar, const Image<T, C, I>& img) {
-	Image<T, C, I> out(img.width, img.height, img.position());
-	std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T,C>& val1,const vec<T,C>& val2) {val1=scalar*val2;};
-	Transform(out, img, f);
-	return out;
-}
-template<class T, int C, ImageType I> Image<T, C, I> operator/(
-		const vec<T, C>& scalar, const Image<T, C, I>& img) {
-	Image<T, C, I> out(img.width, img.height, img.position());
-	std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T,C>& val1,const vec<T,C>& val2) {val1=scalar/val2;};
-	Transform(out, img, f);
-	return out;
-}
-template<class T, int C, ImageType I> Image<T, C, I> operator+(
-		const Image<T, C, I>& img, const vec<T, C>& scalar) {
-	Image<T, C, I> out(img.width, img.height, img.position());
-	std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T,C>& val1,const vec<T,C>& val2) {val1=val2+scalar;};
-	Transform(out, img, f);
-	return out;
-}
-template<class T, int C, ImageType I> Image<T, C, I> operator+(
-		const Image<T, C, I>& img, const T& scalar) {
-	Image<T, C, I> out(img.width, img.height, img.position());
-	std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T,C>& val1,const vec<T,C>& val2) {val1=val2+scalar;};
-	Transform(out, img, f);
-	return out;
-}
-template<class T, int C, ImageType I> Image<T, C, I> operator+(const T& scalar,
-		const Image<T, C, I>& img) {
-	Image<T, C, I> out(img.width, img.height, img.position());
-	std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T,C>& val1,const vec<T,C>& val2) {val1=val2+scalar;};
-	Transform(out, img, f);
-	return out;
-}
-template<class T, int C, ImageType I> Image<T, C, I> operator-(
-		const Image<T, C, I>& img, const vec<T, C>& scalar) {
-	Image<T, C, I> out(img.width, img.height, img.position());
-	std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T,C>& val1,const vec<T,C>& val2) {val1=val2-scalar;};
-	Transform(out, img, f);
-	return out;
-}
-template<class T, int C, ImageType I> Image<T, C, I> operator-(
-		const Image<T, C, I>& img, const T& scalar) {
-	Image<T, C, I> out(img.width, img.height, img.position());
-	std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T,C>& val1,const vec<T,C>& val2) {val1=val2-scalar;};
-	Transform(out, img, f);
-	return out;
-}
-template<class T, int C, ImageType I> Image<T, C, I> operator-(const T& scalar,
-		const Image<T, C, I>& img) {
-	Image<T, C, I> out(img.width, img.height, img.position());
-	std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T,C>& val1,const vec<T,C>& val2) {val1=scalar-val2;};
-	Transform(out, img, f);
-	return out;
-}
-template<class T, int C, ImageType I> Image<T, C, I> operator*(
-		const Image<T, C, I>& img, const vec<T, C>& scalar) {
-	Image<T, C, I> out(img.width, img.height, img.position());
-	std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T,C>& val1,const vec<T,C>& val2) {val1=val2*scalar;};
-	Transform(out, img, f);
-	return out;
-}
-template<class T, int C, ImageType I> Image<T, C, I> operator*(
-		const Image<T, C, I>& img, const T& scalar) {
-	Image<T, C, I> out(img.width, img.height, img.position());
-	std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T,C>& val1,const vec<T,C>& val2) {val1=val2*scalar;};
-	Transform(out, img, f);
-	return out;
-}
-template<class T, int C, ImageType I> Image<T, C, I> operator*(const T& scalar,
-		const Image<T, C, I>& img) {
-	Image<T, C, I> out(img.width, img.height, img.position());
-	std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T,C>& val1,const vec<T,C>& val2) {val1=val2*scalar;};
-	Transform(out, img, f);
-	return out;
-}
-template<class T, int C, ImageType I> Image<T, C, I> operator/(
-		const Image<T, C, I>& img, const vec<T, C>& scalar) {
-	Image<T, C, I> out(img.width, img.height, img.position());
-	std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T,C>& val1,const vec<T,C>& val2) {val1=val2/scalar;};
-	Transform(out, img, f);
-	return out;
-}
-template<class T, int C, ImageType I> Image<T, C, I> operator/(
-		const Image<T, C, I>& img, const T& scalar) {
-	Image<T, C, I> out(img.width, img.height, img.position());
-	std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T,C>& val1,const vec<T,C>& val2) {val1=val2/scalar;};
-	Transform(out, img, f);
-	return out;
-}
-template<class T, int C, ImageType I> Image<T, C, I> operator/(const T& scalar,
-		const Image<T, C, I>& img) {
-	Image<T, C, I> out(img.width, img.height, img.position());
-	std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T,C>& val1,const vec<T,C>& val2) {val1=scalar/val2;};
-	Transform(out, img, f);
-	return out;
-}
-template<class T, int C, ImageType I> Image<T, C, I> operator-(
-		const Image<T, C, I>& img) {
-	Image<T, C, I> out(img.width, img.height, img.position());
-	std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T,C>& val1,const vec<T,C>& val2) {val1=-val2;};
-	Transform(out, img, f);
-	return out;
-}
-template<class T, int C, ImageType I> Image<T, C, I>& operator+=(
-		Image<T, C, I>& out, const Image<T, C, I>& img) {
-	std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T,C>& val1,const vec<T,C>& val2) {val1+=val2;};
-	Transform(out, img, f);
+template<class T, int C, ImageType I, class E> Image<T, C, I>& operator+=(
+		Image<T, C, I>& out, const ImageExpression<E>& expr) {
+	const E& e = expr.derived();
+	if (!MatchesDimensions(e, out.dimensions()))
+		throw std::runtime_error(
+				MakeString() << "Image dimensions do not match. "
+						<< out.dimensions() << "!=" << e.dimensions());
+	EvaluateImageExpression(out.data, e,
+			[](vec<T, C>& val1, const vec<T, C>& val2) {val1+=val2;});
 	return out;
 }
-template<class T, int C, ImageType I> Image<T, C, I>& operator-=(
-		Image<T, C, I>& out, const Image<T, C, I>& img) {
-	std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T,C>& val1,const vec<T,C>& val2) {val1-=val2;};
-	Transform(out, img, f);
+template<class T, int C, ImageType I, class E> Image<T, C, I>& operator-=(
+		Image<T, C, I>& out, const ImageExpression<E>& expr) {
+	const E& e = expr.derived();
+	if (!MatchesDimensions(e, out.dimensions()))
+		throw std::runtime_error(
+				MakeString() << "Image dimensions do not match. "
+						<< out.dimensions() << "!=" << e.dimensions());
+	EvaluateImageExpression(out.data, e,
+			[](vec<T, C>& val1, const vec<T, C>& val2) {val1-=val2;});
 	return out;
 }
-template<class T, int C, ImageType I> Image<T, C, I>& operator*=(
-		Image<T, C, I>& out, const Image<T, C, I>& img) {
-	std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T,C>& val1,const vec<T,C>& val2) {val1*=val2;};
-	Transform(out, img, f);
+template<class T, int C, ImageType I, class E> Image<T, C, I>& operator*=(
+		Image<T, C, I>& out, const ImageExpression<E>& expr) {
+	const E& e = expr.derived();
+	if (!MatchesDimensions(e, out.dimensions()))
+		throw std::runtime_error(
+				MakeString() << "Image dimensions do not match. "
+						<< out.dimensions() << "!=" << e.dimensions());
+	EvaluateImageExpression(out.data, e,
+			[](vec<T, C>& val1, const vec<T, C>& val2) {val1*=val2;});
 	return out;
 }
-template<class T, int C, ImageType I> Image<T, C, I>& operator/=(
-		Image<T, C, I>& out, const Image<T, C, I>& img) {
-	std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T,C>& val1,const vec<T,C>& val2) {val1/=val2;};
-	Transform(out, img, f);
+template<class T, int C, ImageType I, class E> Image<T, C, I>& operator/=(
+		Image<T, C, I>& out, const ImageExpression<E>& expr) {
+	const E& e = expr.derived();
+	if (!MatchesDimensions(e, out.dimensions()))
+		throw std::runtime_error(
+				MakeString() << "Image dimensions do not match. "
+						<< out.dimensions() << "!=" << e.dimensions());
+	EvaluateImageExpression(out.data, e,
+			[](vec<T, C>& val1, const vec<T, C>& val2) {val1/=val2;});
 	return out;
 }
 template<class T, int C, ImageType I> Image<T, C, I>& operator+=(
 		Image<T, C, I>& out, const vec<T, C>& scalar) {
-	std::function<void(vec<T, C>&)> f = [=](vec<T,C>& val1) {val1+=scalar;};
-	Transform(out, f);
+	Transform(out, [=](vec<T,C>& val1) {val1+=scalar;});
 	return out;
 }
 template<class T, int C, ImageType I> Image<T, C, I>& operator-=(
 		Image<T, C, I>& out, const vec<T, C>& scalar) {
-	std::function<void(vec<T, C>&)> f = [=](vec<T,C>& val1) {val1-=scalar;};
-	Transform(out, f);
+	Transform(out, [=](vec<T,C>& val1) {val1-=scalar;});
 	return out;
 }
 template<class T, int C, ImageType I> Image<T, C, I>& operator*=(
 		Image<T, C, I>& out, const vec<T, C>& scalar) {
-	std::function<void(vec<T, C>&)> f = [=](vec<T,C>& val1) {val1*=scalar;};
-	Transform(out, f);
+	Transform(out, [=](vec<T,C>& val1) {val1*=scalar;});
 	return out;
 }
 template<class T, int C, ImageType I> Image<T, C, I>& operator/=(
 		Image<T, C, I>& out, const vec<T, C>& scalar) {
-	std::function<void(vec<T, C>&)> f = [=](vec<T,C>& val1) {val1/=scalar;};
-	Transform(out, f);
+	Transform(out, [=](vec<T,C>& val1) {val1/=scalar;});
 	return out;
 }
-
 template<class T, int C, ImageType I> Image<T, C, I>& operator+=(
 		Image<T, C, I>& out, const T& scalar) {
-	std::function<void(vec<T, C>&)> f = [=](vec<T,C>& val1) {val1+=scalar;};
-	Transform(out, f);
+	Transform(out, [=](vec<T,C>& val1) {val1+=scalar;});
 	return out;
 }
 template<class T, int C, ImageType I> Image<T, C, I>& operator-=(
 		Image<T, C, I>& out, const T& scalar) {
-	std::function<void(vec<T, C>&)> f = [=](vec<T,C>& val1) {val1-=scalar;};
-	Transform(out, f);
+	Transform(out, [=](vec<T,C>& val1) {val1-=scalar;});
 	return out;
 }
 template<class T, int C, ImageType I> Image<T, C, I>& operator*=(
 		Image<T, C, I>& out, const T& scalar) {
-	std::function<void(vec<T, C>&)> f = [=](vec<T,C>& val1) {val1*=scalar;};
-	Transform(out, f);
+	Transform(out, [=](vec<T,C>& val1) {val1*=scalar;});
 	return out;
 }
 template<class T, int C, ImageType I> Image<T, C, I>& operator/=(
 		Image<T, C, I>& out, const T& scalar) {
-	std::function<void(vec<T, C>&)> f = [=](vec<T,C>& val1) {val1/=scalar;};
-	Transform(out, f);
+	Transform(out, [=](vec<T,C>& val1) {val1/=scalar;});
 	return out;
 }
-
-template<class T, int C, ImageType I> Image<T, C, I> operator+(
-		const Image<T, C, I>& img1, const Image<T, C, I>& img2) {
-	Image<T, C, I> out(img1.width, img1.height);
-	std::function<void(vec<T, C>&, const vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T,C>& val1,const vec<T,C>& val2,const vec<T,C>& val3) {val1=val2+val3;};
-	Transform(out, img1, img2, f);
-	return out;
-}
-template<class T, int C, ImageType I> Image<T, C, I> operator-(
-		const Image<T, C, I>& img1, const Image<T, C, I>& img2) {
-	Image<T, C, I> out(img1.width, img1.height);
-	std::function<void(vec<T, C>&, const vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T,C>& val1,const vec<T,C>& val2,const vec<T,C>& val3) {val1=val2-val3;};
-	Transform(out, img1, img2, f);
-	return out;
+/*
+ Raw files store each channel as a separate plane. These convert between
+ planes and interleaved pixels in cache sized chunks so that each chunk is
+ one fwrite (or one pass over a memory-mapped file) instead of one call per
+ scalar. Single channel data is copied without conversion.
+ */
+template<class T, int C> void WritePlanarRawData(FILE* f,
+		const vec<T, C>* data, size_t count) {
+	const size_t CHUNK_SIZE = 1 << 16;
+	if (C == 1) {
+		if (fwrite(data, sizeof(T), count, f) != count) {
+			throw std::runtime_error("Could not write raw data.");
+		}
+		return;
+	}
+	std::vector<T> buffer(std::min(count, CHUNK_SIZE));
+	for (int c = 0; c < C; c++) {
+		for (size_t start = 0; start < count; start += CHUNK_SIZE) {
+			size_t n = std::min(CHUNK_SIZE, count - start);
+			const vec<T, C>* src = data + start;
+			for (size_t i = 0; i < n; i++) {
+				buffer[i] = src[i][c];
+			}
+			if (fwrite(buffer.data(), sizeof(T), n, f) != n) {
+				throw std::runtime_error("Could not write raw data.");
+			}
+		}
+	}
 }
-template<class T, int C, ImageType I> Image<T, C, I> operator*(
-		const Image<T, C, I>& img1, const Image<T, C, I>& img2) {
-	Image<T, C, I> out(img1.width, img1.height);
-	std::function<void(vec<T, C>&, const vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T,C>& val1,const vec<T,C>& val2,const vec<T,C>& val3) {val1=val2*val3;};
-	Transform(out, img1, img2, f);
-	return out;
+template<class T, int C> void ReadPlanarRawData(const char* raw,
+		vec<T, C>* data, size_t count) {
+	const size_t CHUNK_SIZE = 1 << 16;
+	if (C == 1) {
+		std::memcpy(data, raw, count * sizeof(T));
+		return;
+	}
+	const int64_t chunks = (int64_t) ((count + CHUNK_SIZE - 1) / CHUNK_SIZE);
+#pragma omp parallel for
+	for (int64_t b = 0; b < chunks; b++) {
+		size_t start = b * CHUNK_SIZE;
+		size_t n = std::min(CHUNK_SIZE, count - start);
+		vec<T, C>* dst = data + start;
+		for (int c = 0; c < C; c++) {
+			const char* plane = raw + (c * count + start) * sizeof(T);
+			for (size_t i = 0; i < n; i++) {
+				std::memcpy(&dst[i][c], plane + i * sizeof(T), sizeof(T));
+			}
+		}
+	}
 }
-template<class T, int C, ImageType I> Image<T, C, I> operator/(
-		const Image<T, C, I>& img1, const Image<T, C, I>& img2) {
-	Image<T, C, I> out(img1.width, img1.height);
-	std::function<void(vec<T, C>&, const vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T,C>& val1,const vec<T,C>& val2,const vec<T,C>& val3) {val1=val2/val3;};
-	Transform(out, img1, img2, f);
-	return out;
+//Maps a raw file and converts it into data, which must hold count pixels.
+template<class T, int C> void ReadPlanarRawFile(const std::string& rawFile,
+		vec<T, C>* data, size_t count) {
+	if (count == 0)
+		return;
+	ReadableMemMapFile mapped(rawFile, true);
+	if (mapped.data() == nullptr) {
+		throw std::runtime_error(
+				MakeString() << "Could not open " << rawFile << " for reading.");
+	}
+	size_t bytes = count * C * sizeof(T);
+	if (mapped.getMappedSize() < bytes) {
+		throw std::runtime_error(
+				MakeString() << "Raw file " << rawFile << " has "
+						<< mapped.getMappedSize() << " bytes, expected " << bytes
+						<< ".");
+	}
+	ReadPlanarRawData(mapped.data(), data, count);
 }
 template<class T, int C, ImageType I> void WriteImageToRawFile(
 		const std::string& file, const Image<T, C, I>& img) {
@@ -1017,13 +902,11 @@ template<class T, int C, ImageType I> void WriteImageToRawFile(
 				MakeString() << "Could not open " << vstr.str().c_str()
 						<< " for writing.");
 	}
-	for (int c = 0; c < img.channels; c++) {
-		for (int j = 0; j < img.height; j++) {
-			for (int i = 0; i < img.width; i++) {
-				T val = img(i, j)[c];
-				fwrite(&val, sizeof(T), 1, f);
-			}
-		}
+	try {
+		WritePlanarRawData(f, img.data.data(), img.size());
+	} catch (...) {
+		fclose(f);
+		throw;
 	}
 	fclose(f);
 	std::string typeName = "";
@@ -1157,21 +1040,7 @@ template<class T, int C, ImageType I> bool ReadImageFromRawFile(
 		return false;
 	}
 	img.resize(header.extents[0], header.extents[1]);
-	FILE* f = fopen(rawFile.c_str(), "rb");
-	if (f == NULL) {
-		throw std::runtime_error(
-				MakeString() << "Could not open " << rawFile
-						<< " for reading.");
-		return false;
-	}
-	for (int c = 0; c < img.channels; c++) {
-		for (int j = 0; j < img.height; j++) {
-			for (int i = 0; i < img.width; i++) {
-				fread(&img(i, j, c), sizeof(T), 1, f);
-			}
-		}
-	}
-	fclose(f);
+	ReadPlanarRawFile(rawFile, img.data.data(), img.size());
 	return true;
 }
 typedef Image<uint8_t, 4, ImageType::UBYTE> ImageRGBA;
@@ -1458,22 +1327,127 @@ template<class T, int C, ImageType I> void FlipHorizontal(Image<T, C, I>& in) {
 		}
 	}
 }
+//Accumulator used by the pyramid kernels, double for double images.
+template<class T> struct PyramidAccumulator {
+	typedef float type;
+};
+template<> struct PyramidAccumulator<double> {
+	typedef double type;
+};
+/*
+ Separable 5-tap binomial (1,4,6,4,1) reduction. Input rows are filtered and
+ decimated horizontally first, then output rows are formed in row order from
+ five filtered rows. Weights stay unnormalized until the final 1/256 scale so
+ integer images round the same way as the full 5x5 kernel.
+ */
 template<class T, int C, ImageType I> void DownSample5x5(
 		const Image<T, C, I>& in, Image<T, C, I>& out) {
-	static const float Kernel[5][5] = { { 1, 4, 6, 4, 1 }, { 4, 16, 24, 16, 4 },
-			{ 6, 24, 36, 24, 6 }, { 4, 16, 24, 16, 4 }, { 1, 4, 6, 4, 1 } };
-	out.resize(in.width / 2, in.height / 2);
+	typedef typename PyramidAccumulator<T>::type Acc;
+	const int w = in.width;
+	const int h = in.height;
+	const int ow = w / 2;
+	const int oh = h / 2;
+	out.resize(ow, oh);
+	if (ow == 0 || oh == 0)
+		return;
+	const int stride = ow * C;
+	std::vector<Acc> rows((size_t) h * stride);
+	const T* src = in.ptr();
 #pragma omp parallel for
-	for (int j = 0; j < out.height; j++) {
-		for (int i = 0; i < out.width; i++) {
-			vec<float, C> vsum(0.0);
-			for (int ii = 0; ii < 5; ii++) {
-				for (int jj = 0; jj < 5; jj++) {
-					vsum += Kernel[ii][jj]
-							* vec<float, C>(in(2 * i + ii - 2, 2 * j + jj - 2));
+	for (int j = 0; j < h; j++) {
+		const T* srcRow = src + (size_t) j * w * C;
+		Acc* hrow = &rows[(size_t) j * stride];
+		for (int i = 0; i < ow; i++) {
+			int x0 = std::max(2 * i - 2, 0) * C;
+			int x1 = std::max(2 * i - 1, 0) * C;
+			int x2 = 2 * i * C;
+			int x3 = std::min(2 * i + 1, w - 1) * C;
+			int x4 = std::min(2 * i + 2, w - 1) * C;
+			for (int c = 0; c < C; c++) {
+				hrow[i * C + c] = (Acc) srcRow[x0 + c]
+						+ Acc(4) * ((Acc) srcRow[x1 + c] + (Acc) srcRow[x3 + c])
+						+ Acc(6) * (Acc) srcRow[x2 + c] + (Acc) srcRow[x4 + c];
+			}
+		}
+	}
+	T* dst = out.ptr();
+#pragma omp parallel for
+	for (int j = 0; j < oh; j++) {
+		const Acc* r0 = &rows[(size_t) std::max(2 * j - 2, 0) * stride];
+		const Acc* r1 = &rows[(size_t) std::max(2 * j - 1, 0) * stride];
+		const Acc* r2 = &rows[(size_t) (2 * j) * stride];
+		const Acc* r3 = &rows[(size_t) std::min(2 * j + 1, h - 1) * stride];
+		const Acc* r4 = &rows[(size_t) std::min(2 * j + 2, h - 1) * stride];
+		T* dstRow = dst + (size_t) j * stride;
+#pragma omp simd
+		for (int q = 0; q < stride; q++) {
+			dstRow[q] = (T) ((r0[q] + Acc(4) * (r1[q] + r3[q]) + Acc(6) * r2[q]
+					+ r4[q]) * Acc(1.0 / 256.0));
+		}
+	}
+}
+/*
+ Polyphase form of the 5x5 binomial expansion. Even outputs take (1,6,1) from
+ the three nearest source samples and odd outputs take (4,4) from the two
+ between them, so no zero-inserted taps are visited. Fills out at its current
+ size, or at twice the input size if out is empty.
+ */
+template<class T, int C, ImageType I> void UpSample5x5(const Image<T, C, I>& in,
+		Image<T, C, I>& out) {
+	typedef typename PyramidAccumulator<T>::type Acc;
+	if (out.size() == 0)
+		out.resize(in.width * 2, in.height * 2);
+	const int w = in.width;
+	const int h = in.height;
+	const int ow = out.width;
+	const int oh = out.height;
+	if (w == 0 || h == 0 || ow == 0 || oh == 0)
+		return;
+	const int stride = ow * C;
+	std::vector<Acc> rows((size_t) h * stride);
+	const T* src = in.ptr();
+#pragma omp parallel for
+	for (int j = 0; j < h; j++) {
+		const T* srcRow = src + (size_t) j * w * C;
+		Acc* hrow = &rows[(size_t) j * stride];
+		for (int i = 0; i < ow; i++) {
+			int m = i / 2;
+			int x0 = clamp(m - 1, 0, w - 1) * C;
+			int x1 = std::min(m, w - 1) * C;
+			int x2 = std::min(m + 1, w - 1) * C;
+			if (i % 2 == 0) {
+				for (int c = 0; c < C; c++) {
+					hrow[i * C + c] = (Acc) srcRow[x0 + c]
+							+ Acc(6) * (Acc) srcRow[x1 + c]
+							+ (Acc) srcRow[x2 + c];
+				}
+			} else {
+				for (int c = 0; c < C; c++) {
+					hrow[i * C + c] = Acc(4)
+							* ((Acc) srcRow[x1 + c] + (Acc) srcRow[x2 + c]);
 				}
 			}
-			out(i, j) = vec<T, C>(vsum / 256.0f);
+		}
+	}
+	T* dst = out.ptr();
+#pragma omp parallel for
+	for (int j = 0; j < oh; j++) {
+		int m = j / 2;
+		const Acc* r1 = &rows[(size_t) std::min(m, h - 1) * stride];
+		const Acc* r2 = &rows[(size_t) std::min(m + 1, h - 1) * stride];
+		T* dstRow = dst + (size_t) j * stride;
+		if (j % 2 == 0) {
+			const Acc* r0 = &rows[(size_t) clamp(m - 1, 0, h - 1) * stride];
+#pragma omp simd
+			for (int q = 0; q < stride; q++) {
+				dstRow[q] = (T) ((r0[q] + Acc(6) * r1[q] + r2[q])
+						* Acc(1.0 / 64.0));
+			}
+		} else {
+#pragma omp simd
+			for (int q = 0; q < stride; q++) {
+				dstRow[q] = (T) ((r1[q] + r2[q]) * Acc(4.0 / 64.0));
+			}
 		}
 	}
 }
@@ -1501,26 +1475,43 @@ template<class T, int C, ImageType I> void DownSample(const Image<T, C, I>& in,
 }
 template<class T, int C, ImageType I> void UpSample(const Image<T, C, I>& in,
 		Image<T, C, I>& out) {
-	static const double Kernel[5][5] = { { 1, 4, 6, 4, 1 },
-			{ 4, 16, 24, 16, 4 }, { 6, 24, 36, 24, 6 }, { 4, 16, 24, 16, 4 }, {
-					1, 4, 6, 4, 1 } };
 	out.resize(in.width * 2, in.height * 2);
-#pragma omp parallel for
-	for (int j = 0; j < out.height; j++) {
-		for (int i = 0; i < out.width; i++) {
-			vec<double, C> vsum(0.0);
-			for (int ii = 0; ii < 5; ii++) {
-				for (int jj = 0; jj < 5; jj++) {
-					int iii = i + ii - 2;
-					int jjj = j + jj - 2;
-					if (iii % 2 == 0 && jjj % 2 == 0) {
-						vsum += Kernel[ii][jj]
-								* vec<double, C>(in(iii / 2, jjj / 2));
-					}
-				}
-			}
-			out(i, j) = vec<T, C>(vsum / 64.0);
-		}
+	UpSample5x5(in, out);
+}
+//Fills levels with in followed by levelCount-1 successive 5x5 reductions, reusing any images already in levels.
+template<class T, int C, ImageType I> void BuildGaussianPyramid(
+		const Image<T, C, I>& in, std::vector<Image<T, C, I>>& levels,
+		int levelCount) {
+	levels.resize(std::max(levelCount, 1));
+	levels[0].set(in);
+	for (int l = 1; l < (int) levels.size(); l++) {
+		DownSample5x5(levels[l - 1], levels[l]);
+	}
+}
+//Band-pass levels with the coarsest Gaussian level last. Use a signed pixel type.
+template<class T, int C, ImageType I> void BuildLaplacianPyramid(
+		const Image<T, C, I>& in, std::vector<Image<T, C, I>>& levels,
+		int levelCount) {
+	BuildGaussianPyramid(in, levels, levelCount);
+	Image<T, C, I> up;
+	for (int l = 0; l < (int) levels.size() - 1; l++) {
+		up.resize(levels[l].width, levels[l].height);
+		UpSample5x5(levels[l + 1], up);
+		levels[l] -= up;
+	}
+}
+template<class T, int C, ImageType I> void CollapseLaplacianPyramid(
+		const std::vector<Image<T, C, I>>& levels, Image<T, C, I>& out) {
+	if (levels.size() == 0) {
+		out.clear();
+		return;
+	}
+	out.set(levels.back());
+	Image<T, C, I> up;
+	for (int l = (int) levels.size() - 2; l >= 0; l--) {
+		up.resize(levels[l].width, levels[l].height);
+		UpSample5x5(out, up);
+		out = up + levels[l];
 	}
 }
 template<class T, int C, ImageType I> void Set(const Image<T, C, I>& in,
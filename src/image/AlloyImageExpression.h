@@ -0,0 +1,209 @@
+/*
+ * Copyright(C) 2015, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef ALLOYIMAGEEXPRESSION_H_
+#define ALLOYIMAGEEXPRESSION_H_
+#include "common/AlloyCommon.h"
+#include "math/AlloyVecMath.h"
+#include <type_traits>
+#include <vector>
+namespace aly {
+/*
+ Lazy element-wise arithmetic for images and volumes. Operators build a tree of
+ small nodes that is evaluated in one parallel loop when it is assigned, so an
+ expression like a*b+c*d-e makes no intermediate images.
+ Expressions hold references to their images, so evaluate them before those
+ images go out of scope (assign them rather than storing them with auto).
+ */
+template<class E> struct ImageExpression {
+	const E& derived() const {
+		return static_cast<const E&>(*this);
+	}
+};
+struct ImageExpressionNode {
+};
+//Images and volumes are stored by reference, expression nodes by value.
+template<class E> struct ImageExpressionStorage {
+	typedef typename std::conditional<
+			std::is_base_of<ImageExpressionNode, E>::value, const E, const E&>::type type;
+};
+template<class V> struct ImageExpressionScalar;
+template<class T, int C> struct ImageExpressionScalar<vec<T, C>> {
+	typedef T type;
+};
+template<class E, class D> bool MatchesDimensions(const E& expr, const D& dims,
+		std::true_type) {
+	return expr.matches(dims);
+}
+template<class E, class D> bool MatchesDimensions(const E& expr, const D& dims,
+		std::false_type) {
+	return (expr.dimensions() == dims);
+}
+template<class E, class D> bool MatchesDimensions(const E& expr, const D& dims) {
+	return MatchesDimensions(expr, dims,
+			typename std::is_base_of<ImageExpressionNode, E>::type());
+}
+struct ImageAddOp {
+	template<class V> static inline V apply(const V& a, const V& b) {
+		return a + b;
+	}
+};
+struct ImageSubtractOp {
+	template<class V> static inline V apply(const V& a, const V& b) {
+		return a - b;
+	}
+};
+struct ImageMultiplyOp {
+	template<class V> static inline V apply(const V& a, const V& b) {
+		return a * b;
+	}
+};
+struct ImageDivideOp {
+	template<class V> static inline V apply(const V& a, const V& b) {
+		return a / b;
+	}
+};
+template<class L, class R, class Op> struct ImageBinaryExpression: public ImageExpression<
+		ImageBinaryExpression<L, R, Op>>, public ImageExpressionNode {
+	typedef typename L::ValueType ValueType;
+	static_assert(std::is_same<ValueType, typename R::ValueType>::value,
+			"Image expression operands must have the same pixel type.");
+	typename ImageExpressionStorage<L>::type left;
+	typename ImageExpressionStorage<R>::type right;
+	ImageBinaryExpression(const L& left, const R& right) :
+			left(left), right(right) {
+	}
+	inline ValueType operator[](size_t i) const {
+		return Op::apply(left[i], right[i]);
+	}
+	size_t size() const {
+		return left.size();
+	}
+	auto dimensions() const -> decltype(std::declval<const L&>().dimensions()) {
+		return left.dimensions();
+	}
+	auto position() const -> decltype(std::declval<const L&>().position()) {
+		return left.position();
+	}
+	template<class D> bool matches(const D& dims) const {
+		return MatchesDimensions(left, dims) && MatchesDimensions(right, dims);
+	}
+};
+template<class E, class Op, bool ScalarFirst> struct ImageScalarExpression: public ImageExpression<
+		ImageScalarExpression<E, Op, ScalarFirst>>, public ImageExpressionNode {
+	typedef typename E::ValueType ValueType;
+	typename ImageExpressionStorage<E>::type expr;
+	const ValueType scalar;
+	ImageScalarExpression(const E& expr, const ValueType& scalar) :
+			expr(expr), scalar(scalar) {
+	}
+	inline ValueType operator[](size_t i) const {
+		return (ScalarFirst) ?
+				Op::apply(scalar, expr[i]) : Op::apply(expr[i], scalar);
+	}
+	size_t size() const {
+		return expr.size();
+	}
+	auto dimensions() const -> decltype(std::declval<const E&>().dimensions()) {
+		return expr.dimensions();
+	}
+	auto position() const -> decltype(std::declval<const E&>().position()) {
+		return expr.position();
+	}
+	template<class D> bool matches(const D& dims) const {
+		return MatchesDimensions(expr, dims);
+	}
+};
+template<class E> struct ImageNegateExpression: public ImageExpression<
+		ImageNegateExpression<E>>, public ImageExpressionNode {
+	typedef typename E::ValueType ValueType;
+	typename ImageExpressionStorage<E>::type expr;
+	ImageNegateExpression(const E& expr) :
+			expr(expr) {
+	}
+	inline ValueType operator[](size_t i) const {
+		return -expr[i];
+	}
+	size_t size() const {
+		return expr.size();
+	}
+	auto dimensions() const -> decltype(std::declval<const E&>().dimensions()) {
+		return expr.dimensions();
+	}
+	auto position() const -> decltype(std::declval<const E&>().position()) {
+		return expr.position();
+	}
+	template<class D> bool matches(const D& dims) const {
+		return MatchesDimensions(expr, dims);
+	}
+};
+//Evaluates expr into data with op(data[i],expr[i]) in one parallel loop.
+template<class V, class E, class Op> void EvaluateImageExpression(
+		std::vector<V>& data, const E& expr, const Op& op) {
+	const size_t sz = data.size();
+	V* out = data.data();
+#pragma omp parallel for
+	for (size_t offset = 0; offset < sz; offset++) {
+		op(out[offset], expr[offset]);
+	}
+}
+template<class E> void CheckImageExpression(const E& expr) {
+	if (!MatchesDimensions(expr, expr.dimensions()))
+		throw std::runtime_error(
+				MakeString() << "Image dimensions do not match in expression. "
+						<< expr.dimensions());
+}
+
+#define ALY_IMAGE_EXPRESSION_OPERATOR(OP, FUNCTOR) \
+template<class L, class R> ImageBinaryExpression<L, R, FUNCTOR> operator OP( \
+		const ImageExpression<L>& left, const ImageExpression<R>& right) { \
+	return ImageBinaryExpression<L, R, FUNCTOR>(left.derived(), right.derived()); \
+} \
+template<class E> ImageScalarExpression<E, FUNCTOR, false> operator OP( \
+		const ImageExpression<E>& expr, const typename E::ValueType& scalar) { \
+	return ImageScalarExpression<E, FUNCTOR, false>(expr.derived(), scalar); \
+} \
+template<class E> ImageScalarExpression<E, FUNCTOR, true> operator OP( \
+		const typename E::ValueType& scalar, const ImageExpression<E>& expr) { \
+	return ImageScalarExpression<E, FUNCTOR, true>(expr.derived(), scalar); \
+} \
+template<class E> ImageScalarExpression<E, FUNCTOR, false> operator OP( \
+		const ImageExpression<E>& expr, \
+		const typename ImageExpressionScalar<typename E::ValueType>::type& scalar) { \
+	return ImageScalarExpression<E, FUNCTOR, false>(expr.derived(), \
+			typename E::ValueType(scalar)); \
+} \
+template<class E> ImageScalarExpression<E, FUNCTOR, true> operator OP( \
+		const typename ImageExpressionScalar<typename E::ValueType>::type& scalar, \
+		const ImageExpression<E>& expr) { \
+	return ImageScalarExpression<E, FUNCTOR, true>(expr.derived(), \
+			typename E::ValueType(scalar)); \
+}
+ALY_IMAGE_EXPRESSION_OPERATOR(+, ImageAddOp)
+ALY_IMAGE_EXPRESSION_OPERATOR(-, ImageSubtractOp)
+ALY_IMAGE_EXPRESSION_OPERATOR(*, ImageMultiplyOp)
+ALY_IMAGE_EXPRESSION_OPERATOR(/, ImageDivideOp)
+#undef ALY_IMAGE_EXPRESSION_OPERATOR
+template<class E> ImageNegateExpression<E> operator-(
+		const ImageExpression<E>& expr) {
+	return ImageNegateExpression<E>(expr.derived());
+}
+}
+#endif
@@ -312,124 +312,235 @@ template<class T, size_t M, size_t N> struct GaussianOperators {
 		}
 	}
 };
-template<size_t M, size_t N, class T, int C, ImageType I> void Gradient(
-		const Image<T, C, I>& image, Image<T, C, I>& gX, Image<T, C, I>& gY,
-		double sigmaX = (0.607902736 * (M - 1) * 0.5),
-		double sigmaY = (0.607902736 * (N - 1) * 0.5)) {
-
-	double filterX[M][N], filterY[M][N];
-	GaussianKernelDerivative(filterX, filterY, sigmaX, sigmaY);
-
-	gX.resize(image.width, image.height);
-	gY.resize(image.width, image.height);
-#pragma omp parallel for
-	for (int j = 0; j < image.height; j++) {
-		for (int i = 0; i < image.width; i++) {
-			vec<double, C> vsumX(0.0);
-			vec<double, C> vsumY(0.0);
-			for (int ii = 0; ii < (int) M; ii++) {
-				for (int jj = 0; jj < (int) N; jj++) {
-					vec<T, C> val = image(i + ii - (int) M / 2,
-							j + jj - (int) N / 2);
-					vsumX += filterX[ii][jj] * vec<double, C>(val);
-					vsumY += filterY[ii][jj] * vec<double, C>(val);
+//One rank-1 term of a separable filter. Taps are applied at offsets
+//(k - center) from the output pixel.
+struct SeparableFilter {
+	std::vector<double> filterX;
+	std::vector<double> filterY;
+	int centerX;
+	int centerY;
+	template<class T> SeparableFilter(const std::vector<T>& filterX,
+			const std::vector<T>& filterY) :
+			filterX(filterX.begin(), filterX.end()), filterY(filterY.begin(),
+					filterY.end()), centerX((int) filterX.size() / 2), centerY(
+					(int) filterY.size() / 2) {
+	}
+	template<class T> SeparableFilter(const std::vector<T>& filterX,
+			const std::vector<T>& filterY, int centerX, int centerY) :
+			filterX(filterX.begin(), filterX.end()), filterY(filterY.begin(),
+					filterY.end()), centerX(centerX), centerY(centerY) {
+	}
+};
+//Filters accumulate in double for double images and in float otherwise.
+template<class T> struct ConvolveAccumulator {
+	typedef float type;
+};
+template<> struct ConvolveAccumulator<double> {
+	typedef double type;
+};
+enum class BorderMode {
+	Clamp = 0, Mirror = 1
+};
+inline int BorderIndex(int p, int n, BorderMode mode) {
+	if (mode == BorderMode::Clamp) {
+		return (p < 0) ? 0 : ((p >= n) ? n - 1 : p);
+	}
+	//Half-sample symmetric reflection, periodic in 2n.
+	int period = 2 * n;
+	p %= period;
+	if (p < 0)
+		p += period;
+	return (p >= n) ? period - 1 - p : p;
+}
+/*
+ Convolves image with a sum of separable filters. The image is processed in
+ tiles small enough for the horizontal pass of all rows under a tile to stay
+ in cache while the vertical pass consumes them. Rows are padded once per tile
+ so the tap loops run over interleaved channels without border branches.
+ */
+template<class T, int C, ImageType I> void ConvolveSeparable(
+		const Image<T, C, I>& image, Image<T, C, I>& out,
+		const std::vector<SeparableFilter>& filters, BorderMode border =
+				BorderMode::Clamp) {
+	if (&image == &out) {
+		Image<T, C, I> tmp = image;
+		ConvolveSeparable(tmp, out, filters, border);
+		return;
+	}
+	static const int TILE_WIDTH = 128;
+	static const int TILE_HEIGHT = 64;
+	const int w = image.width;
+	const int h = image.height;
+	out.resize(w, h);
+	if (w == 0 || h == 0)
+		return;
+	int maxM = 1, maxN = 1;
+	for (const SeparableFilter& filter : filters) {
+		maxM = std::max(maxM, (int) filter.filterX.size());
+		maxN = std::max(maxN, (int) filter.filterY.size());
+	}
+	const int tilesX = (w + TILE_WIDTH - 1) / TILE_WIDTH;
+	const int tilesY = (h + TILE_HEIGHT - 1) / TILE_HEIGHT;
+	const int rowStride = TILE_WIDTH * C;
+	typedef typename ConvolveAccumulator<T>::type A;
+	std::vector<std::vector<A>> weightsX, weightsY;
+	for (const SeparableFilter& filter : filters) {
+		weightsX.push_back(
+				std::vector<A>(filter.filterX.begin(), filter.filterX.end()));
+		weightsY.push_back(
+				std::vector<A>(filter.filterY.begin(), filter.filterY.end()));
+	}
+	const T* src = image.ptr();
+	T* dst = out.ptr();
+#pragma omp parallel
+	{
+		std::vector<A> padded((TILE_WIDTH + maxM) * C);
+		std::vector<A> rows((TILE_HEIGHT + maxN) * rowStride);
+		std::vector<A> tile(TILE_HEIGHT * rowStride);
+#pragma omp for
+		for (int t = 0; t < tilesX * tilesY; t++) {
+			const int x0 = (t % tilesX) * TILE_WIDTH;
+			const int y0 = (t / tilesX) * TILE_HEIGHT;
+			const int tw = std::min(TILE_WIDTH, w - x0);
+			const int th = std::min(TILE_HEIGHT, h - y0);
+			const int n = tw * C;
+			std::fill(tile.begin(), tile.end(), A(0));
+			for (size_t f = 0; f < filters.size(); f++) {
+				const SeparableFilter& filter = filters[f];
+				const int M = (int) weightsX[f].size();
+				const int N = (int) weightsY[f].size();
+				const A* fx = weightsX[f].data();
+				const A* fy = weightsY[f].data();
+				//Horizontal pass over every input row the tile depends on.
+				for (int r = 0; r < th + N - 1; r++) {
+					const T* srcRow = src
+							+ (size_t) BorderIndex(y0 - filter.centerY + r, h,
+									border) * w * C;
+					for (int x = 0; x < tw + M - 1; x++) {
+						const T* val = srcRow
+								+ BorderIndex(x0 - filter.centerX + x, w,
+										border) * C;
+						for (int c = 0; c < C; c++) {
+							padded[x * C + c] = (A) val[c];
+						}
+					}
+					A* hrow = &rows[r * rowStride];
+					std::fill(hrow, hrow + n, A(0));
+					for (int k = 0; k < M; k++) {
+						const A wk = fx[k];
+						const A* in = &padded[k * C];
+#pragma omp simd
+						for (int q = 0; q < n; q++) {
+							hrow[q] += wk * in[q];
+						}
+					}
+				}
+				//Vertical pass accumulates into the tile.
+				for (int y = 0; y < th; y++) {
+					A* orow = &tile[y * rowStride];
+					for (int k = 0; k < N; k++) {
+						const A wk = fy[k];
+						const A* in = &rows[(y + k) * rowStride];
+#pragma omp simd
+						for (int q = 0; q < n; q++) {
+							orow[q] += wk * in[q];
+						}
+					}
+				}
+			}
+			for (int y = 0; y < th; y++) {
+				T* dstRow = dst + ((size_t) (y0 + y) * w + x0) * C;
+				const A* orow = &tile[y * rowStride];
+				for (int q = 0; q < n; q++) {
+					dstRow[q] = (T) orow[q];
 				}
 			}
-			gX(i, j) = vec<T, C>(vsumX);
-			gY(i, j) = vec<T, C>(vsumY);
 		}
 	}
 }
+template<class T, int C, ImageType I, class F> void ConvolveSeparable(
+		const Image<T, C, I>& image, Image<T, C, I>& out,
+		const std::vector<F>& filterX, const std::vector<F>& filterY,
+		BorderMode border = BorderMode::Clamp) {
+	ConvolveSeparable(image, out,
+			std::vector<SeparableFilter> { SeparableFilter(filterX, filterY) },
+			border);
+}
+template<class T> void GaussianKernelLaplacian(
+		std::vector<SeparableFilter>& filters, int M, int N, T sigmaX,
+		T sigmaY) {
+	//The 2D Laplacian of Gaussian with its mean removed is the sum of two
+	//separable terms and a constant box term.
+	std::vector<double> gx(M), gy(N), lx(M), ly(N);
+	double sumX = 0, sumY = 0, sumLX = 0, sumLY = 0;
+	for (int i = 0; i < M; i++) {
+		double xn = (i - 0.5 * (M - 1)) / sigmaX;
+		double wx = std::exp(-0.5 * xn * xn);
+		gx[i] = wx;
+		lx[i] = wx * (xn * xn - 1) / (sigmaX * sigmaX);
+		sumX += gx[i];
+		sumLX += lx[i];
+	}
+	for (int j = 0; j < N; j++) {
+		double yn = (j - 0.5 * (N - 1)) / sigmaY;
+		double wy = std::exp(-0.5 * yn * yn);
+		gy[j] = wy;
+		ly[j] = wy * (yn * yn - 1) / (sigmaY * sigmaY);
+		sumY += gy[j];
+		sumLY += ly[j];
+	}
+	double mean = (sumLX * sumY + sumX * sumLY) / (M * N);
+	double scale = 1.0 / (sumX * sumY);
+	for (int i = 0; i < M; i++) {
+		gx[i] /= sumX;
+		lx[i] /= sumX;
+	}
+	for (int j = 0; j < N; j++) {
+		gy[j] /= sumY;
+		ly[j] /= sumY;
+	}
+	filters.clear();
+	filters.push_back(SeparableFilter(lx, gy));
+	filters.push_back(SeparableFilter(gx, ly));
+	filters.push_back(
+			SeparableFilter(std::vector<double>(M, -mean * scale),
+					std::vector<double>(N, 1.0)));
+}
+template<size_t M, size_t N, class T, int C, ImageType I> void Gradient(
+		const Image<T, C, I>& image, Image<T, C, I>& gX, Image<T, C, I>& gY,
+		double sigmaX = (0.607902736 * (M - 1) * 0.5),
+		double sigmaY = (0.607902736 * (N - 1) * 0.5)) {
+	std::vector<double> filterX, filterY, derivX, derivY;
+	GaussianKernel(filterX, (int) M, sigmaX);
+	GaussianKernel(filterY, (int) N, sigmaY);
+	GaussianKernelDerivative(derivX, (int) M, sigmaX);
+	GaussianKernelDerivative(derivY, (int) N, sigmaY);
+	ConvolveSeparable(image, gX, derivX, filterY);
+	ConvolveSeparable(image, gY, filterX, derivY);
+}
 template<size_t M, size_t N, class T, int C, ImageType I> void Laplacian(
 		const Image<T, C, I>& image, Image<T, C, I>& L,
 		double sigmaX = (0.607902736 * (M - 1) * 0.5),
 		double sigmaY = (0.607902736 * (N - 1) * 0.5)) {
-	float filter[M][N];
-	GaussianKernelLaplacian(filter, (float) sigmaX, (float) sigmaY);
-	L.resize(image.width, image.height);
-#pragma omp parallel for
-	for (int j = 0; j < image.height; j++) {
-		for (int i = 0; i < image.width; i++) {
-			vec<float, C> vsum(0.0);
-			for (int ii = 0; ii < (int) M; ii++) {
-				for (int jj = 0; jj < (int) N; jj++) {
-					vec<T, C> val = image(i + ii - (int) M / 2,
-							j + jj - (int) N / 2);
-					vsum += filter[ii][jj] * vec<float, C>(val);
-				}
-			}
-			L(i, j) = vec<T, C>(vsum);
-		}
-	}
+	std::vector<SeparableFilter> filters;
+	GaussianKernelLaplacian(filters, (int) M, (int) N, sigmaX, sigmaY);
+	ConvolveSeparable(image, L, filters);
 }
-
 template<int C> void ConvolveHorizontal(const Image<float, C, ImageType::FLOAT>& input,Image<float, C, ImageType::FLOAT>& output,const std::vector<float>& filter) {
-	const int w = input.width;
-	const int h = input.height;
-	const int hlen = filter.size();
-	output.resize(w, h);
-	int c, hL, hR;
-	if (hlen & 1) { // odd kernel size
-		c = hlen / 2;
-		hL = c;
-		hR = c;
-	} else { // even kernel size : center is shifted to the left
-		c = hlen / 2 - 1;
-		hL = c;
-		hR = c + 1;
-	}
-#pragma omp parallel for
-	for (int j = 0; j < h; j++) {
-		for (int i = 0; i < w; i++) {
-			int jx1 = c - i;
-			int jx2 = w - 1 - i + c;
-			float sum = 0.0f;
-			// Convolution with boundaries extension
-			for (int jx = 0; jx <= hR + hL; jx++) {
-				int idx_x = i - c + jx;
-				if (jx < jx1)
-					idx_x = jx1 - jx - 1;
-				if (jx > jx2)
-					idx_x = w - (jx - jx2);
-				sum += input[j * w + idx_x] * filter[jx]; //symmetric kernel? Don't flip!
-			}
-			output[j * w + i] = sum;
-		}
-	}
+	//Even kernels are centered to the left.
+	int hlen = (int) filter.size();
+	int c = (hlen & 1) ? hlen / 2 : hlen / 2 - 1;
+	ConvolveSeparable(input, output,
+			std::vector<SeparableFilter> { SeparableFilter(filter,
+					std::vector<float> { 1.0f }, c, 0) }, BorderMode::Mirror);
 }
 template<int C> void ConvolveVertical(const Image<float, C, ImageType::FLOAT>& input,Image<float, C, ImageType::FLOAT>& output,const std::vector<float>& filter) {
-	const int w = input.width;
-	const int h = input.height;
-	const int hlen = filter.size();
-	output.resize(w, h);
-	int c, hL, hR;
-	if (hlen & 1) { // odd kernel size
-		c = hlen / 2;
-		hL = c;
-		hR = c;
-	} else { // even kernel size : center is shifted to the left
-		c = hlen / 2 - 1;
-		hL = c;
-		hR = c + 1;
-	}
-#pragma omp parallel for
-	for (int j = 0; j < h; j++) {
-		for (int i = 0; i < w; i++) {
-			int jy1 = c - j;
-			int jy2 = h - 1 - j + c;
-			float sum = 0.0f;
-			// Convolution with boundaries extension
-			for (int jy = 0; jy <= hR + hL; jy++) {
-				int idx_y = j - c + jy;
-				if (jy < jy1)
-					idx_y = jy1 - jy - 1;
-				if (jy > jy2)
-					idx_y = h - (jy - jy2);
-				sum += input[idx_y * w + i] * filter[jy]; //symmetric kernel? Don't flip!
-			}
-			output[j * w + i] = sum;
-		}
-	}
+	int hlen = (int) filter.size();
+	int c = (hlen & 1) ? hlen / 2 : hlen / 2 - 1;
+	ConvolveSeparable(input, output,
+			std::vector<SeparableFilter> { SeparableFilter(
+					std::vector<float> { 1.0f }, filter, 0, c) },
+			BorderMode::Mirror);
 }
 template<int C> void Convolve(const Image<float, C, ImageType::FLOAT>& image,
 		Image<float, C, ImageType::FLOAT>& out,
@@ -456,23 +567,10 @@ template<size_t M, size_t N, class T, int C, ImageType I> void Smooth(
 		const Image<T, C, I>& image, Image<T, C, I>& B,
 		double sigmaX = (0.607902736 * (M - 1) * 0.5),
 		double sigmaY = (0.607902736 * (N - 1) * 0.5)) {
-	float filter[M][N];
-	GaussianKernel(filter, (float) sigmaX, (float) sigmaY);
-	B.resize(image.width, image.height);
-#pragma omp parallel for
-	for (int j = 0; j < image.height; j++) {
-		for (int i = 0; i < image.width; i++) {
-			vec<float, C> vsum(0.0);
-			for (int ii = 0; ii < (int) M; ii++) {
-				for (int jj = 0; jj < (int) N; jj++) {
-					vec<T, C> val = image(i + ii - (int) M / 2,
-							j + jj - (int) N / 2);
-					vsum += filter[ii][jj] * vec<float, C>(val);
-				}
-			}
-			B(i, j) = vec<T, C>(vsum);
-		}
-	}
+	std::vector<double> filterX, filterY;
+	GaussianKernel(filterX, (int) M, sigmaX);
+	GaussianKernel(filterY, (int) N, sigmaY);
+	ConvolveSeparable(image, B, filterX, filterY);
 }
 template<int C> void Smooth(const Image<float, C, ImageType::FLOAT>& image,
 		Image<float, C, ImageType::FLOAT>& out, float sigma) {
@@ -482,8 +580,8 @@ template<int C> void Smooth(const Image<float, C, ImageType::FLOAT>& image,
 	if (fsz < 3)
 		fsz = 3;
 	std::vector<float> filter;
-	GaussianKernel(filter, fsz, fsz, sigma, sigma);
-	Convolve(image, out, filter, fsz, fsz);
+	GaussianKernel(filter, fsz, sigma);
+	ConvolveSeparable(image, out, filter, filter);
 }
 template<int C> void Gradient(const Image<float, C, ImageType::FLOAT>& image,
 		Image<float, C, ImageType::FLOAT>& dx,Image<float, C, ImageType::FLOAT>& dy, float sigma) {
@@ -492,10 +590,11 @@ template<int C> void Gradient(const Image<float, C, ImageType::FLOAT>& image,
 		fsz++;
 	if (fsz < 3)
 		fsz = 3;
-	std::vector<float> filterX,filterY;
-	GaussianKernelDerivative(filterX,filterY, fsz, fsz, sigma, sigma);
-	Convolve(image, dx, filterX, fsz, fsz);
-	Convolve(image, dy, filterY, fsz, fsz);
+	std::vector<float> filter, deriv;
+	GaussianKernel(filter, fsz, sigma);
+	GaussianKernelDerivative(deriv, fsz, sigma);
+	ConvolveSeparable(image, dx, deriv, filter);
+	ConvolveSeparable(image, dy, filter, deriv);
 }
 template<class T, int C, ImageType I> void Smooth(const Image<T, C, I>& image,
 		Image<T, C, I>& B, double sigmaX, double sigmaY) {
@@ -0,0 +1,460 @@
+/*
+ * Copyright(C) 2015, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef ALLOYMAPPEDVOLUME_H_
+#define ALLOYMAPPEDVOLUME_H_
+#include "common/AlloyCommon.h"
+#include "image/AlloyVolume.h"
+#include "system/AlloyMemMappedFile.h"
+#include <cstring>
+#include <string>
+namespace aly {
+/*
+ Out-of-core volume stored in a memory-mapped file as cubic bricks. Voxels
+ are paged in by the OS on access; prefetch/release give it hints so that a
+ brick-by-brick sweep keeps only a few bricks resident. Volumes larger than
+ RAM are processed with ForEachBrick/ProcessBricks/ForEachSlice, which copy
+ bricks (plus an apron) or slices into ordinary in-core volumes and images.
+ */
+struct MappedVolumeHeader {
+	char magic[8];
+	int32_t rows;
+	int32_t cols;
+	int32_t slices;
+	int32_t brickSize;
+	int32_t channels;
+	int32_t type;
+	int32_t typeSize;
+	int32_t reserved[9];
+};
+template<class T, int C, ImageType I> class MappedVolume {
+protected:
+	WriteableMemMapFile writeFile;
+	ReadableMemMapFile readFile;
+	vec<T, C>* data;
+	bool writeable;
+	int brickSize;
+	int brickShift;
+	int3 brickGrid;
+	size_t brickVoxels;
+	std::string file;
+	void setDimensions(int r, int c, int s, int b) {
+		if (b <= 0 || (b & (b - 1)) != 0) {
+			throw std::runtime_error(
+					MakeString() << "Brick size must be a power of two " << b);
+		}
+		rows = r;
+		cols = c;
+		slices = s;
+		brickSize = b;
+		brickShift = 0;
+		while ((1 << brickShift) < b)
+			brickShift++;
+		brickGrid = int3((r + b - 1) / b, (c + b - 1) / b, (s + b - 1) / b);
+		brickVoxels = (size_t) b * b * b;
+	}
+	const BaseMemMapFile& mappedFile() const {
+		if (writeable)
+			return writeFile;
+		return readFile;
+	}
+	int3 brickOf(const int3& pt) const {
+		int3 p = clamp(pt, int3(0), dimensions() - 1);
+		return int3(p.x >> brickShift, p.y >> brickShift, p.z >> brickShift);
+	}
+	size_t byteOffset(size_t brick) const {
+		return HEADER_SIZE + brick * brickVoxels * sizeof(vec<T, C> );
+	}
+public:
+	//The header fills one page, so brick data starts on a page boundary. Bricks are not padded to whole pages; release() keeps the pages they share.
+	static const size_t HEADER_SIZE = 4096;
+	int rows;
+	int cols;
+	int slices;
+	const int channels = C;
+	const ImageType type = I;
+	MappedVolume() :
+			data(nullptr), writeable(false), brickSize(0), brickShift(0), brickGrid(
+					0), brickVoxels(0), rows(0), cols(0), slices(0) {
+	}
+	MappedVolume(const std::string& file, int r, int c, int s,
+			int brickSize = 32) :
+			MappedVolume() {
+		create(file, r, c, s, brickSize);
+	}
+	MappedVolume(const std::string& file, bool writeable = false) :
+			MappedVolume() {
+		open(file, writeable);
+	}
+	MappedVolume(const MappedVolume&) = delete;
+	MappedVolume& operator=(const MappedVolume&) = delete;
+	~MappedVolume() {
+		close();
+	}
+	void create(const std::string& fileName, int r, int c, int s,
+			int bSize = 32) {
+		close();
+		setDimensions(r, c, s, bSize);
+		writeFile.open(fileName, FileExistsPolicy::if_exists_truncate);
+		size_t bytes = HEADER_SIZE
+				+ brickCount() * brickVoxels * sizeof(vec<T, C> );
+		writeFile.map(0, bytes);
+		if (writeFile.data() == nullptr) {
+			writeFile.close();
+			throw std::runtime_error(
+					MakeString() << "Could not map " << fileName << " ("
+							<< bytes << " bytes).");
+		}
+		writeable = true;
+		file = fileName;
+		MappedVolumeHeader header;
+		std::memset(&header, 0, sizeof(MappedVolumeHeader));
+		std::memcpy(header.magic, "ALYBRICK", 8);
+		header.rows = rows;
+		header.cols = cols;
+		header.slices = slices;
+		header.brickSize = brickSize;
+		header.channels = C;
+		header.type = static_cast<int32_t>(I);
+		header.typeSize = sizeof(vec<T, C> );
+		std::memcpy(writeFile.data(), &header, sizeof(MappedVolumeHeader));
+		data = reinterpret_cast<vec<T, C>*>(writeFile.data() + HEADER_SIZE);
+	}
+	void open(const std::string& fileName, bool write = false) {
+		close();
+		const char* ptr;
+		if (write) {
+			writeFile.open(fileName, FileExistsPolicy::if_exists_map_all,
+					FileDoesNotExistPolicy::if_doesnt_exist_fail);
+			ptr = writeFile.data();
+		} else {
+			readFile.open(fileName, true);
+			ptr = readFile.data();
+		}
+		writeable = write;
+		size_t fileSize = mappedFile().getMappedSize();
+		if (ptr == nullptr || fileSize < HEADER_SIZE) {
+			close();
+			throw std::runtime_error(
+					MakeString() << "Could not open mapped volume " << fileName);
+		}
+		MappedVolumeHeader header;
+		std::memcpy(&header, ptr, sizeof(MappedVolumeHeader));
+		if (std::memcmp(header.magic, "ALYBRICK", 8) != 0 || header.channels != C
+				|| header.type != static_cast<int32_t>(I)
+				|| header.typeSize != (int32_t) sizeof(vec<T, C> )) {
+			close();
+			throw std::runtime_error(
+					MakeString() << "Mapped volume " << fileName
+							<< " does not match " << I << C);
+		}
+		setDimensions(header.rows, header.cols, header.slices,
+				header.brickSize);
+		if (fileSize < HEADER_SIZE + brickCount() * brickVoxels * sizeof(vec<T, C> )) {
+			close();
+			throw std::runtime_error(
+					MakeString() << "Mapped volume " << fileName
+							<< " is truncated.");
+		}
+		file = fileName;
+		data = reinterpret_cast<vec<T, C>*>(const_cast<char*>(ptr) + HEADER_SIZE);
+	}
+	bool flush() {
+		if (writeable)
+			return writeFile.flush();
+		return true;
+	}
+	void close() {
+		if (writeable)
+			writeFile.flush();
+		writeFile.close();
+		readFile.close();
+		data = nullptr;
+		writeable = false;
+	}
+	bool isOpen() const {
+		return (data != nullptr);
+	}
+	bool isWriteable() const {
+		return writeable;
+	}
+	const std::string& getFile() const {
+		return file;
+	}
+	int3 dimensions() const {
+		return int3(rows, cols, slices);
+	}
+	size_t size() const {
+		return (size_t) rows * cols * slices;
+	}
+	int getBrickSize() const {
+		return brickSize;
+	}
+	int3 brickDimensions() const {
+		return brickGrid;
+	}
+	size_t brickCount() const {
+		return (size_t) brickGrid.x * brickGrid.y * brickGrid.z;
+	}
+	inline size_t brickIndex(int bi, int bj, int bk) const {
+		return bi + (size_t) brickGrid.x * (bj + (size_t) brickGrid.y * bk);
+	}
+	inline size_t offset(int i, int j, int k) const {
+		const int mask = brickSize - 1;
+		return brickIndex(i >> brickShift, j >> brickShift, k >> brickShift)
+				* brickVoxels
+				+ ((i & mask)
+						+ (((j & mask) + ((k & mask) << brickShift)) << brickShift));
+	}
+	inline vec<T, C>& operator()(int i, int j, int k) {
+		return data[offset(clamp(i, 0, rows - 1), clamp(j, 0, cols - 1),
+				clamp(k, 0, slices - 1))];
+	}
+	inline const vec<T, C>& operator()(int i, int j, int k) const {
+		return data[offset(clamp(i, 0, rows - 1), clamp(j, 0, cols - 1),
+				clamp(k, 0, slices - 1))];
+	}
+	inline vec<T, C>& operator()(const int3& ijk) {
+		return operator()(ijk.x, ijk.y, ijk.z);
+	}
+	inline const vec<T, C>& operator()(const int3& ijk) const {
+		return operator()(ijk.x, ijk.y, ijk.z);
+	}
+	//Bricks are brickSize^3 voxels in x-fastest order, including padding past the volume edge.
+	vec<T, C>* brickPtr(int bi, int bj, int bk) {
+		return data + brickIndex(bi, bj, bk) * brickVoxels;
+	}
+	const vec<T, C>* brickPtr(int bi, int bj, int bk) const {
+		return data + brickIndex(bi, bj, bk) * brickVoxels;
+	}
+	void prefetchBrick(int bi, int bj, int bk) const {
+		mappedFile().prefetch(byteOffset(brickIndex(bi, bj, bk)),
+				brickVoxels * sizeof(vec<T, C> ));
+	}
+	void releaseBrick(int bi, int bj, int bk) const {
+		mappedFile().release(byteOffset(brickIndex(bi, bj, bk)),
+				brickVoxels * sizeof(vec<T, C> ));
+	}
+	//Prefetches every brick overlapping the voxel box [minPt, maxPt].
+	void prefetch(const int3& minPt, const int3& maxPt) const {
+		int3 b0 = brickOf(minPt);
+		int3 b1 = brickOf(maxPt);
+		for (int bk = b0.z; bk <= b1.z; bk++) {
+			for (int bj = b0.y; bj <= b1.y; bj++) {
+				for (int bi = b0.x; bi <= b1.x; bi++) {
+					prefetchBrick(bi, bj, bk);
+				}
+			}
+		}
+	}
+	void release(const int3& minPt, const int3& maxPt) const {
+		int3 b0 = brickOf(minPt);
+		int3 b1 = brickOf(maxPt);
+		for (int bk = b0.z; bk <= b1.z; bk++) {
+			for (int bj = b0.y; bj <= b1.y; bj++) {
+				for (int bi = b0.x; bi <= b1.x; bi++) {
+					releaseBrick(bi, bj, bk);
+				}
+			}
+		}
+	}
+	void prefetchSlice(int k) const {
+		prefetch(int3(0, 0, k), int3(rows - 1, cols - 1, k));
+	}
+	//Copies the box starting at minPt with out's dimensions, clamping at the volume edge.
+	void getRegion(const int3& minPt, Volume<T, C, I>& out) const {
+#pragma omp parallel for
+		for (int k = 0; k < out.slices; k++) {
+			int kk = clamp(minPt.z + k, 0, slices - 1);
+			for (int j = 0; j < out.cols; j++) {
+				int jj = clamp(minPt.y + j, 0, cols - 1);
+				vec<T, C>* dst = &out(0, j, k);
+				for (int i = 0; i < out.rows; i++) {
+					dst[i] = data[offset(clamp(minPt.x + i, 0, rows - 1), jj, kk)];
+				}
+			}
+		}
+	}
+	void getRegion(const int3& minPt, const int3& dims,
+			Volume<T, C, I>& out) const {
+		out.resize(dims.x, dims.y, dims.z);
+		getRegion(minPt, out);
+	}
+	//Writes in[srcMin, srcMin+dims) to this volume at dstMin, skipping voxels outside the volume.
+	void setRegion(const int3& dstMin, const Volume<T, C, I>& in,
+			const int3& srcMin, const int3& dims) {
+		int3 lo = max(int3(0), -dstMin);
+		int3 hi = min(dims, dimensions() - dstMin);
+#pragma omp parallel for
+		for (int k = lo.z; k < hi.z; k++) {
+			for (int j = lo.y; j < hi.y; j++) {
+				const vec<T, C>* src = &in(srcMin.x, srcMin.y + j, srcMin.z + k);
+				for (int i = lo.x; i < hi.x; i++) {
+					data[offset(dstMin.x + i, dstMin.y + j, dstMin.z + k)] =
+							src[i];
+				}
+			}
+		}
+	}
+	void setRegion(const int3& dstMin, const Volume<T, C, I>& in) {
+		setRegion(dstMin, in, int3(0), in.dimensions());
+	}
+	//Slices are rows x cols images.
+	void getSlice(int k, Image<T, C, I>& out) const {
+		out.resize(rows, cols);
+#pragma omp parallel for
+		for (int j = 0; j < cols; j++) {
+			for (int i = 0; i < rows; i++) {
+				out(i, j) = data[offset(i, j, k)];
+			}
+		}
+	}
+	void setSlice(int k, const Image<T, C, I>& in) {
+		if (in.width != rows || in.height != cols) {
+			throw std::runtime_error(
+					MakeString() << "Slice dimensions " << int2(in.width, in.height)
+							<< " do not match volume " << dimensions());
+		}
+#pragma omp parallel for
+		for (int j = 0; j < cols; j++) {
+			for (int i = 0; i < rows; i++) {
+				data[offset(i, j, k)] = in(i, j);
+			}
+		}
+	}
+	void set(const Volume<T, C, I>& in) {
+		if (in.dimensions() != dimensions()) {
+			throw std::runtime_error(
+					MakeString() << "Volume dimensions " << in.dimensions()
+							<< " do not match mapped volume " << dimensions());
+		}
+		setRegion(int3(0), in);
+	}
+	void set(const vec<T, C>& val) {
+		const size_t N = brickCount() * brickVoxels;
+#pragma omp parallel for
+		for (int64_t n = 0; n < (int64_t) N; n++) {
+			data[n] = val;
+		}
+	}
+	void get(Volume<T, C, I>& out) const {
+		getRegion(int3(0), dimensions(), out);
+	}
+};
+/*
+ Visits the bricks in file order as in-core copies grown by apron voxels on
+ every side, clamped at the volume edge, while the next brick is prefetched.
+ A brick is released once the last brick whose apron reaches it has been
+ visited. The block's position() is its origin in the volume.
+ func(block, brickMin, brickDims).
+ */
+template<class T, int C, ImageType I, class F> void ForEachBrick(
+		const MappedVolume<T, C, I>& in, int apron, F func) {
+	const int B = in.getBrickSize();
+	const int3 grid = in.brickDimensions();
+	const int3 dims = in.dimensions();
+	const int64_t N = (int64_t) in.brickCount();
+	Volume<T, C, I> block;
+	auto brickOrigin = [=](int64_t n) {
+		return int3((int) (n % grid.x), (int) ((n / grid.x) % grid.y),
+				(int) (n / ((int64_t) grid.x * grid.y))) * B;
+	};
+	//Brick m is last read by the brick reach steps after it in file order.
+	const int64_t reach = (int64_t) ((apron + B - 1) / B)
+			* (1 + grid.x + (int64_t) grid.x * grid.y);
+	auto releaseBrick = [&](int64_t m) {
+		int3 b = brickOrigin(m) / B;
+		in.releaseBrick(b.x, b.y, b.z);
+	};
+	for (int64_t n = 0; n < N; n++) {
+		int3 brickMin = brickOrigin(n);
+		int3 brickDims = min(int3(B), dims - brickMin);
+		int3 blockMin = brickMin - apron;
+		if (n + 1 < N) {
+			int3 nextMin = brickOrigin(n + 1);
+			in.prefetch(nextMin - apron, nextMin + B - 1 + apron);
+		}
+		in.getRegion(blockMin, brickDims + 2 * apron, block);
+		block.setPosition(blockMin);
+		func(block, brickMin, brickDims);
+		if (n >= reach) {
+			releaseBrick(n - reach);
+		}
+	}
+	for (int64_t m = std::max(N - reach, (int64_t) 0); m < N; m++) {
+		releaseBrick(m);
+	}
+}
+/*
+ Runs func on every brick of in and writes the interior of its output block
+ back to out. in and out may be the same volume if func only needs the apron
+ to be approximately up to date. func(inBlock, outBlock), where both blocks'
+ position() is their origin in the volume.
+ */
+template<class T, int C, ImageType I, class S, int D, ImageType J, class F> void ProcessBricks(
+		const MappedVolume<T, C, I>& in, MappedVolume<S, D, J>& out,
+		int apron, F func) {
+	if (in.dimensions() != out.dimensions()) {
+		throw std::runtime_error(
+				MakeString() << "Mapped volume dimensions do not match "
+						<< in.dimensions() << " " << out.dimensions());
+	}
+	if (!out.isWriteable()) {
+		throw std::runtime_error(
+				MakeString() << "Mapped volume " << out.getFile()
+						<< " is not writeable.");
+	}
+	Volume<S, D, J> outBlock;
+	ForEachBrick(in, apron,
+			[&](const Volume<T, C, I>& inBlock, const int3& brickMin, const int3& brickDims) {
+				outBlock.resize(inBlock.dimensions());
+				outBlock.setPosition(inBlock.position());
+				func(inBlock, outBlock);
+				out.setRegion(brickMin, outBlock, int3(apron), brickDims);
+				out.release(brickMin, brickMin + brickDims - 1);
+			});
+}
+//Visits each slice in order as an in-core image. func(slice, k).
+template<class T, int C, ImageType I, class F> void ForEachSlice(
+		const MappedVolume<T, C, I>& vol, F func) {
+	Image<T, C, I> slice;
+	const int B = vol.getBrickSize();
+	for (int k = 0; k < vol.slices; k++) {
+		if (k % B == 0) {
+			vol.prefetch(int3(0, 0, k), int3(vol.rows - 1, vol.cols - 1, k + B - 1));
+			if (k >= B)
+				vol.release(int3(0, 0, k - B),
+						int3(vol.rows - 1, vol.cols - 1, k - 1));
+		}
+		vol.getSlice(k, slice);
+		func(slice, k);
+	}
+	vol.release(int3(0), vol.dimensions() - 1);
+}
+typedef MappedVolume<uint8_t, 1, ImageType::UBYTE> MappedVolume1ub;
+typedef MappedVolume<uint16_t, 1, ImageType::USHORT> MappedVolume1us;
+typedef MappedVolume<int16_t, 1, ImageType::SHORT> MappedVolume1s;
+typedef MappedVolume<int, 1, ImageType::INT> MappedVolume1i;
+typedef MappedVolume<float, 1, ImageType::FLOAT> MappedVolume1f;
+typedef MappedVolume<float, 2, ImageType::FLOAT> MappedVolume2f;
+typedef MappedVolume<float, 3, ImageType::FLOAT> MappedVolume3f;
+typedef MappedVolume<float, 4, ImageType::FLOAT> MappedVolume4f;
+}
+#endif
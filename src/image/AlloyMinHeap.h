@@ -158,14 +158,6 @@ protected:
 		}
 		for (; parent * 2 <= currentSize; parent = child) {
 			child = parent * 2;
-			if (heapArray[child] == nullptr) {
-				parent = child;
-				break;
-			}
-			if (heapArray[child + 1] == nullptr) {
-				parent = child + 1;
-				break;
-			}
 			if (child != currentSize
 					&& heapArray[child + 1]->value < heapArray[child]->value) {
 				child++;
@@ -311,14 +303,6 @@ protected:
 		}
 		for (; parent * 2 <= currentSize; parent = child) {
 			child = parent * 2;
-			if (heapArray[child] == nullptr) {
-				parent = child;
-				break;
-			}
-			if (heapArray[child + 1] == nullptr) {
-				parent = child + 1;
-				break;
-			}
 			if (child != currentSize
 					&& heapArray[child + 1]->value < heapArray[child]->value) {
 				child++;
@@ -34,7 +34,8 @@ namespace aly {
 template<class T, int C, ImageType I> struct Volume;
 template<class T, int C, ImageType I> void WriteImageToRawFile(const std::string& fileName, const Volume<T, C, I>& img);
 template<class T, int C, ImageType I> bool ReadImageFromRawFile(const std::string& fileName, Volume<T, C, I>& img);
-	template<class T, int C, ImageType I> struct Volume {
+	template<class T, int C, ImageType I> struct Volume: public ImageExpression<
+		Volume<T, C, I>> {
 	private:
 		std::string hashCode;
 		int x, y, z;
@@ -201,6 +202,22 @@ template<class T, int C, ImageType I> bool ReadImageFromRawFile(const std::strin
 			this->set(rhs.data);
 			return *this;
 		}
+		template<class E> Volume(const ImageExpression<E>& expr) :
+			Volume() {
+			*this = expr;
+		}
+		template<class E> Volume<T, C, I>& operator=(
+			const ImageExpression<E>& expr) {
+			static_assert(std::is_same<typename E::ValueType, vec<T, C>>::value,
+				"Volume expression has a different voxel type.");
+			const E& e = expr.derived();
+			CheckImageExpression(e);
+			resize(e.dimensions());
+			setPosition(e.position());
+			EvaluateImageExpression(data, e,
+				[](vec<T, C>& val1, const vec<T, C>& val2) {val1 = val2;});
+			return *this;
+		}
 		int3 dimensions() const {
 			return int3(rows, cols, slices);
 		}
@@ -550,9 +567,9 @@ template<class T, int C, ImageType I> bool ReadImageFromRawFile(const std::strin
 		}
 		return hashCode;
 	}
-	template<class T, int C, ImageType I> void Transform(Volume<T, C, I>& im1,
-		Volume<T, C, I>& im2,
-		const std::function<void(vec<T, C>&, vec<T, C>&)>& func) {
+	template<class T, int C, ImageType I, class F> auto Transform(
+		Volume<T, C, I>& im1, Volume<T, C, I>& im2, const F& func)
+		-> decltype(func(im1.data[0], im2.data[0]), void()) {
 		if (im1.dimensions() != im2.dimensions())
 			throw std::runtime_error(
 				MakeString() << "Volume dimensions do not match. "
@@ -563,12 +580,10 @@ template<class T, int C, ImageType I> bool ReadImageFromRawFile(const std::strin
 			func(im1.data[offset], im2.data[offset]);
 		}
 	}
-	template<class T, int C, ImageType I> void Transform(Volume<T, C, I>& im1,
-		const Volume<T, C, I>& im2, const Volume<T, C, I>& im3,
-		const Volume<T, C, I>& im4,
-		const std::function<
-		void(vec<T, C>&, const vec<T, C>&, const vec<T, C>&,
-			const vec<T, C>&)>& func) {
+	template<class T, int C, ImageType I, class F> auto Transform(
+		Volume<T, C, I>& im1, const Volume<T, C, I>& im2,
+		const Volume<T, C, I>& im3, const Volume<T, C, I>& im4, const F& func)
+		-> decltype(func(im1.data[0], im2.data[0], im3.data[0], im4.data[0]), void()) {
 		if (im1.dimensions() != im2.dimensions())
 			throw std::runtime_error(
 				MakeString() << "Volume dimensions do not match. "
@@ -580,17 +595,18 @@ template<class T, int C, ImageType I> bool ReadImageFromRawFile(const std::strin
 				im4.data[offset]);
 		}
 	}
-	template<class T, int C, ImageType I> void Transform(Volume<T, C, I>& im1,
-		const std::function<void(vec<T, C>&)>& func) {
+	template<class T, int C, ImageType I, class F> auto Transform(
+		Volume<T, C, I>& im1, const F& func)
+		-> decltype(func(im1.data[0]), void()) {
 		size_t sz = im1.size();
 #pragma omp parallel for
 		for (int offset = 0; offset < (int)sz; offset++) {
 			func(im1.data[offset]);
 		}
 	}
-	template<class T, int C, ImageType I> void Transform(Volume<T, C, I>& im1,
-		const Volume<T, C, I>& im2,
-		const std::function<void(vec<T, C>&, const vec<T, C>&)>& func) {
+	template<class T, int C, ImageType I, class F> auto Transform(
+		Volume<T, C, I>& im1, const Volume<T, C, I>& im2, const F& func)
+		-> decltype(func(im1.data[0], im2.data[0]), void()) {
 		if (im1.dimensions() != im2.dimensions())
 			throw std::runtime_error(
 				MakeString() << "Volume dimensions do not match. "
@@ -601,9 +617,10 @@ template<class T, int C, ImageType I> bool ReadImageFromRawFile(const std::strin
 			func(im1.data[offset], im2.data[offset]);
 		}
 	}
-	template<class T, int C, ImageType I> void Transform(Volume<T, C, I>& im1,
-		const Volume<T, C, I>& im2, const Volume<T, C, I>& im3,
-		const std::function<void(vec<T, C>&, const vec<T, C>&, const vec<T, C>&)>& func) {
+	template<class T, int C, ImageType I, class F> auto Transform(
+		Volume<T, C, I>& im1, const Volume<T, C, I>& im2,
+		const Volume<T, C, I>& im3, const F& func)
+		-> decltype(func(im1.data[0], im2.data[0], im3.data[0]), void()) {
 		if (im1.dimensions() != im2.dimensions())
 			throw std::runtime_error(
 				MakeString() << "Volume dimensions do not match. "
@@ -614,10 +631,9 @@ template<class T, int C, ImageType I> bool ReadImageFromRawFile(const std::strin
 			func(im1.data[offset], im2.data[offset], im3.data[offset]);
 		}
 	}
-	template<class T, int C, ImageType I> void Transform(Volume<T, C, I>& im1,
-		Volume<T, C, I>& im2,
-		const std::function<
-		void(int i, int j, int k, vec<T, C>& val1, vec<T, C>& val2)>& func) {
+	template<class T, int C, ImageType I, class F> auto Transform(
+		Volume<T, C, I>& im1, Volume<T, C, I>& im2, const F& func)
+		-> decltype(func(0, 0, 0, im1.data[0], im2.data[0]), void()) {
 		if (im1.dimensions() != im2.dimensions())
 			throw std::runtime_error(
 				MakeString() << "Volume dimensions do not match. "
@@ -632,10 +648,9 @@ template<class T, int C, ImageType I> bool ReadImageFromRawFile(const std::strin
 			}
 		}
 	}
-	template<class T, int C, ImageType I> void Transform(Volume<T, C, I>& im1,
-		Volume<T, C, I>& im2,
-		const std::function<
-		void(size_t offset, vec<T, C>& val1, vec<T, C>& val2)>& func) {
+	template<class T, int C, ImageType I, class F> auto Transform(
+		Volume<T, C, I>& im1, Volume<T, C, I>& im2, const F& func)
+		-> decltype(func(size_t(0), im1.data[0], im2.data[0]), void()) {
 		if (im1.dimensions() != im2.dimensions())
 			throw std::runtime_error(
 				MakeString() << "Volume dimensions do not match. "
@@ -651,163 +666,68 @@ template<class T, int C, ImageType I> bool ReadImageFromRawFile(const std::strin
 		ss << "Volume (" << A.getTypeName() << "): " << A.id << " Position: "<<A.position()<<" Dimensions: [" << A.rows << "," << A.cols<< "]\n";
 		return ss;
 	}
-	template<class T, int C, ImageType I> Volume<T, C, I> operator+(
-		const vec<T, C>& scalar, const Volume<T, C, I>& img) {
-		Volume<T, C, I> out(img.rows, img.cols, img.slices, img.position());
-		std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T, C>& val1, const vec<T, C>& val2) {val1 = scalar + val2;};
-		Transform(out, img, f);
-		return out;
-	}
-
-	template<class T, int C, ImageType I> Volume<T, C, I> operator-(
-		const vec<T, C>& scalar, const Volume<T, C, I>& img) {
-		Volume<T, C, I> out(img.rows, img.cols, img.slices, img.position());
-		std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T, C>& val1, const vec<T, C>& val2) {val1 = scalar - val2;};
-		Transform(out, img, f);
-		return out;
-	}
-	template<class T, int C, ImageType I> Volume<T, C, I> operator*(
-		const vec<T, C>& scalar, const Volume<T, C, I>& img) {
-		Volume<T, C, I> out(img.rows, img.cols, img.slices, img.position());
-		std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T, C>& val1, const vec<T, C>& val2) {val1 = scalar*val2;};
-		Transform(out, img, f);
-		return out;
-	}
-	template<class T, int C, ImageType I> Volume<T, C, I> operator/(
-		const vec<T, C>& scalar, const Volume<T, C, I>& img) {
-		Volume<T, C, I> out(img.rows, img.cols, img.slices, img.position());
-		std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T, C>& val1, const vec<T, C>& val2) {val1 = scalar / val2;};
-		Transform(out, img, f);
-		return out;
-	}
-	template<class T, int C, ImageType I> Volume<T, C, I> operator+(
-		const Volume<T, C, I>& img, const vec<T, C>& scalar) {
-		Volume<T, C, I> out(img.rows, img.cols, img.slices, img.position());
-		std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T, C>& val1, const vec<T, C>& val2) {val1 = val2 + scalar;};
-		Transform(out, img, f);
-		return out;
-	}
-	template<class T, int C, ImageType I> Volume<T, C, I> operator-(
-		const Volume<T, C, I>& img, const vec<T, C>& scalar) {
-		Volume<T, C, I> out(img.rows, img.cols, img.slices, img.position());
-		std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T, C>& val1, const vec<T, C>& val2) {val1 = val2 - scalar;};
-		Transform(out, img, f);
-		return out;
-	}
-	template<class T, int C, ImageType I> Volume<T, C, I> operator*(
-		const Volume<T, C, I>& img, const vec<T, C>& scalar) {
-		Volume<T, C, I> out(img.rows, img.cols, img.slices, img.position());
-		std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T, C>& val1, const vec<T, C>& val2) {val1 = val2*scalar;};
-		Transform(out, img, f);
-		return out;
-	}
-	template<class T, int C, ImageType I> Volume<T, C, I> operator/(
-		const Volume<T, C, I>& img, const vec<T, C>& scalar) {
-		Volume<T, C, I> out(img.rows, img.cols, img.slices, img.position());
-		std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T, C>& val1, const vec<T, C>& val2) {val1 = val2 / scalar;};
-		Transform(out, img, f);
-		return out;
-	}
-	template<class T, int C, ImageType I> Volume<T, C, I> operator-(
-		const Volume<T, C, I>& img) {
-		Volume<T, C, I> out(img.rows, img.cols, img.slices, img.position());
-		std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T, C>& val1, const vec<T, C>& val2) {val1 = -val2;};
-		Transform(out, img, f);
-		return out;
-	}
-	template<class T, int C, ImageType I> Volume<T, C, I>& operator+=(
-		Volume<T, C, I>& out, const Volume<T, C, I>& img) {
-		std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T, C>& val1, const vec<T, C>& val2) {val1 += val2;};
-		Transform(out, img, f);
+	template<class T, int C, ImageType I, class E> Volume<T, C, I>& operator+=(
+		Volume<T, C, I>& out, const ImageExpression<E>& expr) {
+		const E& e = expr.derived();
+		if (!MatchesDimensions(e, out.dimensions()))
+			throw std::runtime_error(
+				MakeString() << "Volume dimensions do not match. "
+				<< out.dimensions() << "!=" << e.dimensions());
+		EvaluateImageExpression(out.data, e,
+			[](vec<T, C>& val1, const vec<T, C>& val2) {val1 += val2;});
 		return out;
 	}
-	template<class T, int C, ImageType I> Volume<T, C, I>& operator-=(
-		Volume<T, C, I>& out, const Volume<T, C, I>& img) {
-		std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T, C>& val1, const vec<T, C>& val2) {val1 -= val2;};
-		Transform(out, img, f);
+	template<class T, int C, ImageType I, class E> Volume<T, C, I>& operator-=(
+		Volume<T, C, I>& out, const ImageExpression<E>& expr) {
+		const E& e = expr.derived();
+		if (!MatchesDimensions(e, out.dimensions()))
+			throw std::runtime_error(
+				MakeString() << "Volume dimensions do not match. "
+				<< out.dimensions() << "!=" << e.dimensions());
+		EvaluateImageExpression(out.data, e,
+			[](vec<T, C>& val1, const vec<T, C>& val2) {val1 -= val2;});
 		return out;
 	}
-	template<class T, int C, ImageType I> Volume<T, C, I>& operator*=(
-		Volume<T, C, I>& out, const Volume<T, C, I>& img) {
-		std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T, C>& val1, const vec<T, C>& val2) {val1 *= val2;};
-		Transform(out, img, f);
+	template<class T, int C, ImageType I, class E> Volume<T, C, I>& operator*=(
+		Volume<T, C, I>& out, const ImageExpression<E>& expr) {
+		const E& e = expr.derived();
+		if (!MatchesDimensions(e, out.dimensions()))
+			throw std::runtime_error(
+				MakeString() << "Volume dimensions do not match. "
+				<< out.dimensions() << "!=" << e.dimensions());
+		EvaluateImageExpression(out.data, e,
+			[](vec<T, C>& val1, const vec<T, C>& val2) {val1 *= val2;});
 		return out;
 	}
-	template<class T, int C, ImageType I> Volume<T, C, I>& operator/=(
-		Volume<T, C, I>& out, const Volume<T, C, I>& img) {
-		std::function<void(vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T, C>& val1, const vec<T, C>& val2) {val1 /= val2;};
-		Transform(out, img, f);
+	template<class T, int C, ImageType I, class E> Volume<T, C, I>& operator/=(
+		Volume<T, C, I>& out, const ImageExpression<E>& expr) {
+		const E& e = expr.derived();
+		if (!MatchesDimensions(e, out.dimensions()))
+			throw std::runtime_error(
+				MakeString() << "Volume dimensions do not match. "
+				<< out.dimensions() << "!=" << e.dimensions());
+		EvaluateImageExpression(out.data, e,
+			[](vec<T, C>& val1, const vec<T, C>& val2) {val1 /= val2;});
 		return out;
 	}
-
 	template<class T, int C, ImageType I> Volume<T, C, I>& operator+=(
 		Volume<T, C, I>& out, const vec<T, C>& scalar) {
-		std::function<void(vec<T, C>&)> f = [=](vec<T, C>& val1) {val1 += scalar;};
-		Transform(out, f);
+		Transform(out, [=](vec<T, C>& val1) {val1 += scalar;});
 		return out;
 	}
 	template<class T, int C, ImageType I> Volume<T, C, I>& operator-=(
 		Volume<T, C, I>& out, const vec<T, C>& scalar) {
-		std::function<void(vec<T, C>&)> f = [=](vec<T, C>& val1) {val1 -= scalar;};
-		Transform(out, f);
+		Transform(out, [=](vec<T, C>& val1) {val1 -= scalar;});
 		return out;
 	}
 	template<class T, int C, ImageType I> Volume<T, C, I>& operator*=(
 		Volume<T, C, I>& out, const vec<T, C>& scalar) {
-		std::function<void(vec<T, C>&)> f = [=](vec<T, C>& val1) {val1 *= scalar;};
-		Transform(out, f);
+		Transform(out, [=](vec<T, C>& val1) {val1 *= scalar;});
 		return out;
 	}
 	template<class T, int C, ImageType I> Volume<T, C, I>& operator/=(
 		Volume<T, C, I>& out, const vec<T, C>& scalar) {
-		std::function<void(vec<T, C>&)> f = [=](vec<T, C>& val1) {val1 /= scalar;};
-		Transform(out, f);
-		return out;
-	}
-
-	template<class T, int C, ImageType I> Volume<T, C, I> operator+(
-		const Volume<T, C, I>& img1, const Volume<T, C, I>& img2) {
-		Volume<T, C, I> out(img1.rows, img1.cols, img1.slices);
-		std::function<void(vec<T, C>&, const vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T, C>& val1, const vec<T, C>& val2, const vec<T, C>& val3) {val1 = val2 + val3;};
-		Transform(out, img1, img2, f);
-		return out;
-	}
-	template<class T, int C, ImageType I> Volume<T, C, I> operator-(
-		const Volume<T, C, I>& img1, const Volume<T, C, I>& img2) {
-		Volume<T, C, I> out(img1.rows, img1.cols, img1.slices);
-		std::function<void(vec<T, C>&, const vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T, C>& val1, const vec<T, C>& val2, const vec<T, C>& val3) {val1 = val2 - val3;};
-		Transform(out, img1, img2, f);
-		return out;
-	}
-	template<class T, int C, ImageType I> Volume<T, C, I> operator*(
-		const Volume<T, C, I>& img1, const Volume<T, C, I>& img2) {
-		Volume<T, C, I> out(img1.rows, img1.cols, img1.slices);
-		std::function<void(vec<T, C>&, const vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T, C>& val1, const vec<T, C>& val2, const vec<T, C>& val3) {val1 = val2*val3;};
-		Transform(out, img1, img2, f);
-		return out;
-	}
-	template<class T, int C, ImageType I> Volume<T, C, I> operator/(
-		const Volume<T, C, I>& img1, const Volume<T, C, I>& img2) {
-		Volume<T, C, I> out(img1.rows, img1.cols, img1.slices);
-		std::function<void(vec<T, C>&, const vec<T, C>&, const vec<T, C>&)> f =
-			[=](vec<T, C>& val1, const vec<T, C>& val2, const vec<T, C>& val3) {val1 = val2 / val3;};
-		Transform(out, img1, img2, f);
+		Transform(out, [=](vec<T, C>& val1) {val1 /= scalar;});
 		return out;
 	}
 	template<class T, int C, ImageType I> void Stack(const std::vector<Image<T,C,I>>& images,Volume<T, C, I>& volume){
@@ -882,21 +802,7 @@ template<class T, int C, ImageType I> bool ReadImageFromRawFile(const std::strin
 			return false;
 		}
 		img.resize(header.extents[0],header.extents[1],header.extents[2]);
-		FILE* f = fopen(rawFile.c_str(), "rb");
-		if (f == NULL) {
-			throw std::runtime_error(MakeString() << "Could not open " <<rawFile<< " for reading.");
-			return false;
-		}
-		for (int c = 0; c < img.channels; c++) {
-			for (int k = 0; k < img.slices; k++) {
-				for (int j = 0; j < img.cols; j++) {
-					for (int i = 0; i < img.rows; i++) {
-						fread(&img(i,j,k,c), sizeof(T), 1, f);
-					}
-				}
-			}
-		}
-		fclose(f);
+		ReadPlanarRawFile(rawFile, img.data.data(), img.size());
 		return true;
 	}
 
@@ -911,15 +817,11 @@ template<class T, int C, ImageType I> bool ReadImageFromRawFile(const std::strin
 				MakeString() << "Could not open " << vstr.str().c_str()
 				<< " for writing.");
 		}
-		for (int c = 0; c < img.channels; c++) {
-			for (int k = 0; k < img.slices; k++) {
-				for (int j = 0; j < img.cols; j++) {
-					for (int i = 0; i < img.rows; i++) {
-						T val = img(i, j, k)[c];
-						fwrite(&val, sizeof(T), 1, f);
-					}
-				}
-			}
+		try {
+			WritePlanarRawData(f, img.data.data(), img.size());
+		} catch (...) {
+			fclose(f);
+			throw;
 		}
 		fclose(f);
 		std::string typeName = "";
@@ -146,6 +146,12 @@ bool SANITY_CHECK() {
 	SANITY_CHECK_MACHINEID();
 	//SANITY_CHECK_HOUDINI();
 	//ret &= SANITY_CHECK_LOCATOR();
+	//SANITY_CHECK_SPATIAL_HASH();
+	//SANITY_CHECK_PLY_STREAM();
+	//SANITY_CHECK_OBJ_IO();
+	//SANITY_CHECK_MESH_TOPOLOGY();
+	//SANITY_CHECK_SUBDIVISION_STENCILS();
+	//SANITY_CHECK_MESH_DECIMATION();
 	//SANITY_CHECK_ANY();
 	//SANITY_CHECK_SVD();
 	//SANITY_CHECK_ALGO();
@@ -154,11 +160,16 @@ bool SANITY_CHECK() {
 	//SANITY_CHECK_CEREAL();
 	//SANITY_CHECK_KDTREE();
 	//SANITY_CHECK_PYRAMID();
+	//SANITY_CHECK_BRICKED_VOLUME();
+	//SANITY_CHECK_MAXFLOW();
+	//SANITY_CHECK_EXECUTOR();
 	//SANITY_CHECK_SPARSE_SOLVE();
 	//SANITY_CHECK_DENSE_SOLVE();
 	//SANITY_CHECK_DENSE_MATRIX();
 	//SANITY_CHECK_IMAGE_PROCESSING();
 	//SANITY_CHECK_IMAGE_IO();
+	//SANITY_CHECK_COMPRESSED_VOLUME();
+	//SANITY_CHECK_NARROW_BAND();
 	//SANITY_CHECK_ROBUST_SOLVE();
 	//SANITY_CHECK_SUBDIVIDE();
 	//SANITY_CHECK_XML();
@@ -41,14 +41,10 @@ void LaplaceFill(const Image4f& sourceImg, Image4f& targetImg, int iterations,
 			}
 		});
 	} else {
-		std::vector<Image4f> srcPyramid(levels);
-		std::vector<Image4f> tarPyramid(levels);
-		srcPyramid[0] = sourceImg;
-		tarPyramid[0] = targetImg;
-		for (int l = 1; l < levels; l++) {
-			srcPyramid[l - 1].downSample(srcPyramid[l]);
-			tarPyramid[l - 1].downSample(tarPyramid[l]);
-		}
+		std::vector<Image4f> srcPyramid;
+		std::vector<Image4f> tarPyramid;
+		BuildGaussianPyramid(sourceImg, srcPyramid, levels);
+		BuildGaussianPyramid(targetImg, tarPyramid, levels);
 		for (int l = levels - 1; l >= 1; l--) {
 			if (iterationMonitor) {
 				if (!iterationMonitor(l, 0))
@@ -200,14 +196,10 @@ void LaplaceFill(const Image2f& sourceImg, Image2f& targetImg, int iterations,
 			return iterationMonitor(0, iter);
 		});
 	} else {
-		std::vector<Image2f> srcPyramid(levels);
-		std::vector<Image2f> tarPyramid(levels);
-		srcPyramid[0] = sourceImg;
-		tarPyramid[0] = targetImg;
-		for (int l = 1; l < levels; l++) {
-			srcPyramid[l - 1].downSample(srcPyramid[l]);
-			tarPyramid[l - 1].downSample(tarPyramid[l]);
-		}
+		std::vector<Image2f> srcPyramid;
+		std::vector<Image2f> tarPyramid;
+		BuildGaussianPyramid(sourceImg, srcPyramid, levels);
+		BuildGaussianPyramid(targetImg, tarPyramid, levels);
 		for (int l = levels - 1; l >= 1; l--) {
 			if (iterationMonitor) {
 				if (!iterationMonitor(l, 0))
@@ -366,17 +358,12 @@ void PoissonInpaint(const Image4f& sourceImg, const Image4f& targetImg,
 					}
 				});
 	} else {
-		std::vector<Image4f> srcPyramid(levels);
-		std::vector<Image4f> tarPyramid(levels);
-		std::vector<Image4f> outPyramid(levels);
-		srcPyramid[0] = sourceImg;
-		tarPyramid[0] = targetImg;
-		outPyramid[0] = outImg;
-		for (int l = 1; l < levels; l++) {
-			srcPyramid[l - 1].downSample(srcPyramid[l]);
-			tarPyramid[l - 1].downSample(tarPyramid[l]);
-			outPyramid[l - 1].downSample(outPyramid[l]);
-		}
+		std::vector<Image4f> srcPyramid;
+		std::vector<Image4f> tarPyramid;
+		std::vector<Image4f> outPyramid;
+		BuildGaussianPyramid(sourceImg, srcPyramid, levels);
+		BuildGaussianPyramid(targetImg, tarPyramid, levels);
+		BuildGaussianPyramid(outImg, outPyramid, levels);
 		for (int l = levels - 1; l >= 1; l--) {
 			if (iterationMonitor) {
 				if (!iterationMonitor(l, 0))
@@ -494,17 +481,12 @@ void PoissonInpaint(const Image2f& sourceImg, const Image2f& targetImg,
 					}
 				});
 	} else {
-		std::vector<Image2f> srcPyramid(levels);
-		std::vector<Image2f> tarPyramid(levels);
-		std::vector<Image2f> outPyramid(levels);
-		srcPyramid[0] = sourceImg;
-		tarPyramid[0] = targetImg;
-		outPyramid[0] = outImg;
-		for (int l = 1; l < levels; l++) {
-			srcPyramid[l - 1].downSample(srcPyramid[l]);
-			tarPyramid[l - 1].downSample(tarPyramid[l]);
-			outPyramid[l - 1].downSample(outPyramid[l]);
-		}
+		std::vector<Image2f> srcPyramid;
+		std::vector<Image2f> tarPyramid;
+		std::vector<Image2f> outPyramid;
+		BuildGaussianPyramid(sourceImg, srcPyramid, levels);
+		BuildGaussianPyramid(targetImg, tarPyramid, levels);
+		BuildGaussianPyramid(outImg, outPyramid, levels);
 		for (int l = levels - 1; l >= 1; l--) {
 			if (iterationMonitor) {
 				if (!iterationMonitor(l, 0))
@@ -619,14 +601,10 @@ void PoissonBlend(const Image4f& sourceImg, Image4f& targetImg, int iterations,
 			}
 		});
 	} else {
-		std::vector<Image4f> srcPyramid(levels);
-		std::vector<Image4f> tarPyramid(levels);
-		srcPyramid[0] = sourceImg;
-		tarPyramid[0] = targetImg;
-		for (int l = 1; l < levels; l++) {
-			srcPyramid[l - 1].downSample(srcPyramid[l]);
-			tarPyramid[l - 1].downSample(tarPyramid[l]);
-		}
+		std::vector<Image4f> srcPyramid;
+		std::vector<Image4f> tarPyramid;
+		BuildGaussianPyramid(sourceImg, srcPyramid, levels);
+		BuildGaussianPyramid(targetImg, tarPyramid, levels);
 		for (int l = levels - 1; l >= 1; l--) {
 			if (iterationMonitor) {
 				if (!iterationMonitor(l, 0))
@@ -672,14 +650,10 @@ void PoissonBlend(const Image2f& sourceImg, Image2f& targetImg, int iterations,
 			}
 		});
 	} else {
-		std::vector<Image2f> srcPyramid(levels);
-		std::vector<Image2f> tarPyramid(levels);
-		srcPyramid[0] = sourceImg;
-		tarPyramid[0] = targetImg;
-		for (int l = 1; l < levels; l++) {
-			srcPyramid[l - 1].downSample(srcPyramid[l]);
-			tarPyramid[l - 1].downSample(tarPyramid[l]);
-		}
+		std::vector<Image2f> srcPyramid;
+		std::vector<Image2f> tarPyramid;
+		BuildGaussianPyramid(sourceImg, srcPyramid, levels);
+		BuildGaussianPyramid(targetImg, tarPyramid, levels);
 		for (int l = levels - 1; l >= 1; l--) {
 			if (iterationMonitor) {
 				if (!iterationMonitor(l, 0))
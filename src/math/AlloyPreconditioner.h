@@ -0,0 +1,557 @@
+/*
+ * Copyright(C) 2015, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef ALLOYPRECONDITIONER_H_
+#define ALLOYPRECONDITIONER_H_
+#include "math/AlloyVector.h"
+#include "math/AlloySparseMatrix.h"
+#include <chrono>
+#include <memory>
+namespace aly {
+/*
+ * Preconditioner interface for SolveCG and SolveBICGStab. setup() is called
+ * by the solver with the system matrix before the first iteration, apply()
+ * approximates z=inv(A)*r. Cumulative wall time spent in both is recorded so
+ * callers can compare preconditioners.
+ */
+template<class T, int C> class SparsePreconditioner {
+protected:
+	virtual void build(const CompressedSparseMatrix<T, 1>& A)=0;
+	virtual void solve(Vector<T, C>& z, const Vector<T, C>& r)=0;
+public:
+	double setupTime;
+	double applyTime;
+	int applyCount;
+	SparsePreconditioner() :
+			setupTime(0.0), applyTime(0.0), applyCount(0) {
+	}
+	void setup(const CompressedSparseMatrix<T, 1>& A) {
+		if (A.rows != A.cols)
+			throw std::runtime_error(
+					MakeString() << "Preconditioner requires square matrix ["
+							<< A.rows << "," << A.cols << "]");
+		auto startTime = std::chrono::steady_clock::now();
+		build(A);
+		setupTime += std::chrono::duration<double>(
+				std::chrono::steady_clock::now() - startTime).count();
+	}
+	void apply(Vector<T, C>& z, const Vector<T, C>& r) {
+		auto startTime = std::chrono::steady_clock::now();
+		z.resize(r.size());
+		solve(z, r);
+		applyTime += std::chrono::duration<double>(
+				std::chrono::steady_clock::now() - startTime).count();
+		applyCount++;
+	}
+	virtual ~SparsePreconditioner() {
+	}
+};
+template<class T, int C> class JacobiPreconditioner: public SparsePreconditioner<
+		T, C> {
+protected:
+	std::vector<double> invDiagonal;
+	virtual void build(const CompressedSparseMatrix<T, 1>& A) override {
+		invDiagonal.resize(A.rows);
+#pragma omp parallel for
+		for (size_t i = 0; i < A.rows; i++) {
+			double d = A.get(i, i).x;
+			invDiagonal[i] = (std::abs(d) > 1E-16) ? 1.0 / d : 1.0;
+		}
+	}
+	virtual void solve(Vector<T, C>& z, const Vector<T, C>& r) override {
+#pragma omp parallel for
+		for (size_t i = 0; i < r.size(); i++) {
+			z.data[i] = vec<T, C>(vec<double, C>(r.data[i]) * invDiagonal[i]);
+		}
+	}
+};
+/*
+ * Zero fill-in incomplete Cholesky factorization A~L*L' for symmetric
+ * positive definite matrices. Only the lower triangle of A is read.
+ */
+template<class T, int C> class IncompleteCholeskyPreconditioner: public SparsePreconditioner<
+		T, C> {
+protected:
+	CompressedSparseMatrix<double, 1> L;
+	CompressedSparseMatrix<double, 1> U;
+	virtual void build(const CompressedSparseMatrix<T, 1>& A) override {
+		size_t N = A.rows;
+		L.rows = L.cols = N;
+		L.rowOffsets.assign(N + 1, 0);
+		for (size_t i = 0; i < N; i++) {
+			size_t count = 0;
+			for (size_t k = A.rowOffsets[i]; k < A.rowOffsets[i + 1]; k++) {
+				if (A.columns[k] < i)
+					count++;
+			}
+			L.rowOffsets[i + 1] = L.rowOffsets[i] + count + 1;
+		}
+		L.columns.resize(L.rowOffsets[N]);
+		L.values.resize(L.rowOffsets[N]);
+		for (size_t i = 0; i < N; i++) {
+			size_t dest = L.rowOffsets[i];
+			double diag = 0.0;
+			for (size_t k = A.rowOffsets[i]; k < A.rowOffsets[i + 1]; k++) {
+				uint32_t j = A.columns[k];
+				if (j < i) {
+					L.columns[dest] = j;
+					L.values[dest] = vec<double, 1>(A.values[k].x);
+					dest++;
+				} else if (j == i) {
+					diag = A.values[k].x;
+				}
+			}
+			L.columns[dest] = (uint32_t) i;
+			L.values[dest] = vec<double, 1>(diag);
+		}
+		for (size_t i = 0; i < N; i++) {
+			size_t rowStart = L.rowOffsets[i];
+			size_t rowEnd = L.rowOffsets[i + 1] - 1;
+			for (size_t ki = rowStart; ki < rowEnd; ki++) {
+				size_t k = L.columns[ki];
+				//Sparse dot product of rows i and k over columns less than k.
+				double sum = L.values[ki].x;
+				size_t pi = rowStart;
+				size_t pk = L.rowOffsets[k];
+				size_t kEnd = L.rowOffsets[k + 1] - 1;
+				while (pi < ki && pk < kEnd) {
+					if (L.columns[pi] == L.columns[pk]) {
+						sum -= L.values[pi].x * L.values[pk].x;
+						pi++;
+						pk++;
+					} else if (L.columns[pi] < L.columns[pk]) {
+						pi++;
+					} else {
+						pk++;
+					}
+				}
+				L.values[ki].x = sum / L.values[kEnd].x;
+			}
+			double diag = L.values[rowEnd].x;
+			double orig = diag;
+			for (size_t ki = rowStart; ki < rowEnd; ki++) {
+				diag -= L.values[ki].x * L.values[ki].x;
+			}
+			//Break down guard, fall back to the unfactored diagonal.
+			if (diag <= 1E-12 * std::abs(orig)) {
+				diag = (std::abs(orig) > 1E-16) ? std::abs(orig) : 1.0;
+			}
+			L.values[rowEnd].x = std::sqrt(diag);
+		}
+		U = L.transpose();
+	}
+	virtual void solve(Vector<T, C>& z, const Vector<T, C>& r) override {
+		size_t N = L.rows;
+		std::vector<vec<double, C>> y(N);
+		for (size_t i = 0; i < N; i++) {
+			vec<double, C> sum(r.data[i]);
+			size_t end = L.rowOffsets[i + 1] - 1;
+			for (size_t k = L.rowOffsets[i]; k < end; k++) {
+				sum -= L.values[k].x * y[L.columns[k]];
+			}
+			y[i] = sum / L.values[end].x;
+		}
+		for (size_t i = N; i > 0; i--) {
+			size_t row = i - 1;
+			size_t start = U.rowOffsets[row];
+			vec<double, C> sum = y[row];
+			for (size_t k = start + 1; k < U.rowOffsets[row + 1]; k++) {
+				sum -= U.values[k].x * y[U.columns[k]];
+			}
+			y[row] = sum / U.values[start].x;
+		}
+#pragma omp parallel for
+		for (size_t i = 0; i < N; i++) {
+			z.data[i] = vec<T, C>(y[i]);
+		}
+	}
+};
+/*
+ * Zero fill-in incomplete LU factorization for general square matrices.
+ * L has unit diagonal and shares storage with U in a copy of A's pattern.
+ */
+template<class T, int C> class IncompleteLUPreconditioner: public SparsePreconditioner<
+		T, C> {
+protected:
+	CompressedSparseMatrix<double, 1> LU;
+	std::vector<size_t> diagonalIndex;
+	virtual void build(const CompressedSparseMatrix<T, 1>& A) override {
+		size_t N = A.rows;
+		LU.rows = A.rows;
+		LU.cols = A.cols;
+		LU.rowOffsets = A.rowOffsets;
+		LU.columns = A.columns;
+		LU.values.resize(A.values.size());
+		for (size_t k = 0; k < A.values.size(); k++) {
+			LU.values[k].x = A.values[k].x;
+		}
+		diagonalIndex.assign(N, std::numeric_limits<size_t>::max());
+		for (size_t i = 0; i < N; i++) {
+			for (size_t k = LU.rowOffsets[i]; k < LU.rowOffsets[i + 1]; k++) {
+				if (LU.columns[k] == i) {
+					diagonalIndex[i] = k;
+					break;
+				}
+			}
+			if (diagonalIndex[i] == std::numeric_limits<size_t>::max())
+				throw std::runtime_error(
+						MakeString() << "ILU(0) requires non-zero diagonal at row "
+								<< i);
+		}
+		std::vector<size_t> position(N, std::numeric_limits<size_t>::max());
+		for (size_t i = 0; i < N; i++) {
+			size_t start = LU.rowOffsets[i];
+			size_t end = LU.rowOffsets[i + 1];
+			for (size_t k = start; k < end; k++) {
+				position[LU.columns[k]] = k;
+			}
+			for (size_t ki = start; ki < diagonalIndex[i]; ki++) {
+				size_t k = LU.columns[ki];
+				double pivot = LU.values[diagonalIndex[k]].x;
+				if (std::abs(pivot) < 1E-16)
+					pivot = (pivot < 0) ? -1E-16 : 1E-16;
+				double lik = LU.values[ki].x / pivot;
+				LU.values[ki].x = lik;
+				for (size_t kj = diagonalIndex[k] + 1; kj < LU.rowOffsets[k + 1];
+						kj++) {
+					size_t p = position[LU.columns[kj]];
+					if (p != std::numeric_limits<size_t>::max()) {
+						LU.values[p].x -= lik * LU.values[kj].x;
+					}
+				}
+			}
+			for (size_t k = start; k < end; k++) {
+				position[LU.columns[k]] = std::numeric_limits<size_t>::max();
+			}
+		}
+	}
+	virtual void solve(Vector<T, C>& z, const Vector<T, C>& r) override {
+		size_t N = LU.rows;
+		std::vector<vec<double, C>> y(N);
+		for (size_t i = 0; i < N; i++) {
+			vec<double, C> sum(r.data[i]);
+			for (size_t k = LU.rowOffsets[i]; k < diagonalIndex[i]; k++) {
+				sum -= LU.values[k].x * y[LU.columns[k]];
+			}
+			y[i] = sum;
+		}
+		for (size_t i = N; i > 0; i--) {
+			size_t row = i - 1;
+			vec<double, C> sum = y[row];
+			for (size_t k = diagonalIndex[row] + 1; k < LU.rowOffsets[row + 1];
+					k++) {
+				sum -= LU.values[k].x * y[LU.columns[k]];
+			}
+			double d = LU.values[diagonalIndex[row]].x;
+			y[row] = sum / ((std::abs(d) > 1E-16) ? d : 1E-16);
+		}
+#pragma omp parallel for
+		for (size_t i = 0; i < N; i++) {
+			z.data[i] = vec<T, C>(y[i]);
+		}
+	}
+};
+/*
+ * Smoothed aggregation algebraic multigrid. Each application is one V-cycle
+ * with damped Jacobi smoothing, which keeps the preconditioner symmetric so
+ * it can be used with CG as well as BiCGStab.
+ */
+template<class T, int C> class AlgebraicMultigridPreconditioner: public SparsePreconditioner<
+		T, C> {
+protected:
+	struct Level {
+		CompressedSparseMatrix<T, 1> A;
+		CompressedSparseMatrix<T, 1> P;
+		CompressedSparseMatrix<T, 1> R;
+		std::vector<double> invDiagonal;
+		double omega;
+		Vector<T, C> x, b, r;
+	};
+	std::vector<Level> levels;
+	std::vector<double> coarseLU;
+	std::vector<size_t> coarsePivot;
+	size_t coarseSize;
+	static double Gershgorin(const CompressedSparseMatrix<T, 1>& A,
+			const std::vector<double>& invDiagonal) {
+		double rho = 0.0;
+		for (size_t i = 0; i < A.rows; i++) {
+			double sum = 0.0;
+			for (size_t k = A.rowOffsets[i]; k < A.rowOffsets[i + 1]; k++) {
+				sum += std::abs((double) A.values[k].x);
+			}
+			rho = std::max(rho, sum * std::abs(invDiagonal[i]));
+		}
+		return rho;
+	}
+	size_t aggregate(const CompressedSparseMatrix<T, 1>& A,
+			const std::vector<double>& invDiagonal,
+			std::vector<int>& aggregates) const {
+		const int UNASSIGNED = -1;
+		size_t N = A.rows;
+		std::vector<std::vector<uint32_t>> strong(N);
+#pragma omp parallel for
+		for (size_t i = 0; i < N; i++) {
+			for (size_t k = A.rowOffsets[i]; k < A.rowOffsets[i + 1]; k++) {
+				uint32_t j = A.columns[k];
+				if (j == i)
+					continue;
+				double aij = A.values[k].x;
+				if (aij * aij
+						>= strengthThreshold * strengthThreshold
+								* std::abs(1.0 / invDiagonal[i])
+								* std::abs(1.0 / invDiagonal[j])) {
+					strong[i].push_back(j);
+				}
+			}
+		}
+		aggregates.assign(N, UNASSIGNED);
+		int count = 0;
+		//Root nodes whose strong neighborhood is untouched seed aggregates.
+		for (size_t i = 0; i < N; i++) {
+			if (aggregates[i] != UNASSIGNED)
+				continue;
+			bool free = true;
+			for (uint32_t j : strong[i]) {
+				if (aggregates[j] != UNASSIGNED) {
+					free = false;
+					break;
+				}
+			}
+			if (free) {
+				aggregates[i] = count;
+				for (uint32_t j : strong[i]) {
+					aggregates[j] = count;
+				}
+				count++;
+			}
+		}
+		//Leftover nodes join a neighboring aggregate.
+		std::vector<int> assigned = aggregates;
+		for (size_t i = 0; i < N; i++) {
+			if (assigned[i] != UNASSIGNED)
+				continue;
+			for (uint32_t j : strong[i]) {
+				if (assigned[j] != UNASSIGNED) {
+					aggregates[i] = assigned[j];
+					break;
+				}
+			}
+		}
+		//Anything still unassigned forms new aggregates.
+		for (size_t i = 0; i < N; i++) {
+			if (aggregates[i] != UNASSIGNED)
+				continue;
+			aggregates[i] = count;
+			for (uint32_t j : strong[i]) {
+				if (aggregates[j] == UNASSIGNED)
+					aggregates[j] = count;
+			}
+			count++;
+		}
+		return (size_t) count;
+	}
+	void factorCoarse(const CompressedSparseMatrix<T, 1>& A) {
+		size_t N = A.rows;
+		coarseSize = N;
+		coarseLU.assign(N * N, 0.0);
+		coarsePivot.resize(N);
+		for (size_t i = 0; i < N; i++) {
+			for (size_t k = A.rowOffsets[i]; k < A.rowOffsets[i + 1]; k++) {
+				coarseLU[i * N + A.columns[k]] = A.values[k].x;
+			}
+		}
+		for (size_t k = 0; k < N; k++) {
+			size_t p = k;
+			double maxVal = std::abs(coarseLU[k * N + k]);
+			for (size_t i = k + 1; i < N; i++) {
+				double v = std::abs(coarseLU[i * N + k]);
+				if (v > maxVal) {
+					maxVal = v;
+					p = i;
+				}
+			}
+			coarsePivot[k] = p;
+			if (p != k) {
+				for (size_t j = 0; j < N; j++) {
+					std::swap(coarseLU[k * N + j], coarseLU[p * N + j]);
+				}
+			}
+			double pivot = coarseLU[k * N + k];
+			if (std::abs(pivot) < 1E-16) {
+				//Singular coarse operator (e.g. pure Neumann), regularize.
+				pivot = coarseLU[k * N + k] = 1E-16;
+			}
+			for (size_t i = k + 1; i < N; i++) {
+				double f = coarseLU[i * N + k] /= pivot;
+				if (f == 0.0)
+					continue;
+				for (size_t j = k + 1; j < N; j++) {
+					coarseLU[i * N + j] -= f * coarseLU[k * N + j];
+				}
+			}
+		}
+	}
+	void solveCoarse(Vector<T, C>& x, const Vector<T, C>& b) const {
+		size_t N = coarseSize;
+		std::vector<vec<double, C>> y(N);
+		for (size_t i = 0; i < N; i++) {
+			y[i] = vec<double, C>(b.data[i]);
+		}
+		for (size_t k = 0; k < N; k++) {
+			if (coarsePivot[k] != k)
+				std::swap(y[k], y[coarsePivot[k]]);
+		}
+		for (size_t i = 0; i < N; i++) {
+			for (size_t j = 0; j < i; j++) {
+				y[i] -= coarseLU[i * N + j] * y[j];
+			}
+		}
+		for (size_t i = N; i > 0; i--) {
+			size_t row = i - 1;
+			for (size_t j = row + 1; j < N; j++) {
+				y[row] -= coarseLU[row * N + j] * y[j];
+			}
+			y[row] /= coarseLU[row * N + row];
+		}
+		for (size_t i = 0; i < N; i++) {
+			x.data[i] = vec<T, C>(y[i]);
+		}
+	}
+	void smooth(Level& level, bool zeroGuess) {
+		size_t N = level.A.rows;
+		if (zeroGuess && smoothIterations <= 0) {
+			level.x.setZero();
+		}
+		for (int s = 0; s < smoothIterations; s++) {
+			if (zeroGuess && s == 0) {
+#pragma omp parallel for
+				for (size_t i = 0; i < N; i++) {
+					level.x.data[i] = vec<T, C>(
+							vec<double, C>(level.b.data[i])
+									* (level.omega * level.invDiagonal[i]));
+				}
+			} else {
+				SubtractMultiply(level.r, level.b, level.A, level.x);
+#pragma omp parallel for
+				for (size_t i = 0; i < N; i++) {
+					level.x.data[i] += vec<T, C>(
+							vec<double, C>(level.r.data[i])
+									* (level.omega * level.invDiagonal[i]));
+				}
+			}
+		}
+	}
+	void cycle(size_t l) {
+		Level& level = levels[l];
+		if (l + 1 == levels.size()) {
+			solveCoarse(level.x, level.b);
+			return;
+		}
+		Level& next = levels[l + 1];
+		smooth(level, true);
+		SubtractMultiply(level.r, level.b, level.A, level.x);
+		Multiply(next.b, level.R, level.r);
+		cycle(l + 1);
+		AddMultiply(level.x, level.x, level.P, next.x);
+		smooth(level, false);
+	}
+	virtual void build(const CompressedSparseMatrix<T, 1>& A) override {
+		levels.clear();
+		levels.push_back(Level());
+		levels.back().A = A;
+		while (true) {
+			Level& level = levels.back();
+			size_t N = level.A.rows;
+			level.x.resize(N);
+			level.b.resize(N);
+			level.r.resize(N);
+			level.invDiagonal.resize(N);
+#pragma omp parallel for
+			for (size_t i = 0; i < N; i++) {
+				double d = level.A.get(i, i).x;
+				level.invDiagonal[i] = (std::abs(d) > 1E-16) ? 1.0 / d : 1.0;
+			}
+			double rho = Gershgorin(level.A, level.invDiagonal);
+			level.omega = (rho > 0.0) ? 4.0 / (3.0 * rho) : 1.0;
+			if (N <= coarsestSize || (int) levels.size() >= maxLevels) {
+				break;
+			}
+			std::vector<int> aggregates;
+			size_t M = aggregate(level.A, level.invDiagonal, aggregates);
+			if (M >= N || M == 0) {
+				break;
+			}
+			std::vector<double> weights(M, 0.0);
+			for (size_t i = 0; i < N; i++) {
+				weights[aggregates[i]] += 1.0;
+			}
+			for (double& w : weights) {
+				w = 1.0 / std::sqrt(w);
+			}
+			//Smoothed prolongator P=(I-omega*inv(D)*A)*P0 built row by row.
+			SparseMatrix<T, 1> P(N, M);
+#pragma omp parallel for
+			for (size_t i = 0; i < N; i++) {
+				std::map<size_t, vec<T, 1>>& row = P[i];
+				double scale = level.omega * level.invDiagonal[i];
+				row[aggregates[i]].x += (T) weights[aggregates[i]];
+				for (size_t k = level.A.rowOffsets[i];
+						k < level.A.rowOffsets[i + 1]; k++) {
+					int agg = aggregates[level.A.columns[k]];
+					row[agg].x -= (T) (scale * level.A.values[k].x
+							* weights[agg]);
+				}
+			}
+			level.P.set(P);
+			level.R = level.P.transpose();
+			CompressedSparseMatrix<T, 1> AP;
+			Multiply(AP, level.A, level.P);
+			Level coarse;
+			Multiply(coarse.A, level.R, AP);
+			levels.push_back(coarse);
+		}
+		factorCoarse(levels.back().A);
+		Level& coarse = levels.back();
+		coarse.x.resize(coarse.A.rows);
+		coarse.b.resize(coarse.A.rows);
+	}
+	virtual void solve(Vector<T, C>& z, const Vector<T, C>& r) override {
+		levels.front().b = r;
+		cycle(0);
+		z = levels.front().x;
+	}
+public:
+	double strengthThreshold;
+	size_t coarsestSize;
+	int maxLevels;
+	int smoothIterations;
+	AlgebraicMultigridPreconditioner(double strengthThreshold = 0.08,
+			size_t coarsestSize = 256, int maxLevels = 16, int smoothIterations =
+					1) :
+			coarseSize(0), strengthThreshold(strengthThreshold), coarsestSize(
+					coarsestSize), maxLevels(maxLevels), smoothIterations(
+					smoothIterations) {
+	}
+	size_t getLevelCount() const {
+		return levels.size();
+	}
+};
+}
+#endif
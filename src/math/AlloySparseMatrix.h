@@ -31,6 +31,7 @@
 #include <vector>
 #include <list>
 #include <map>
+#include <omp.h>
 
 namespace aly {
 
@@ -145,6 +146,126 @@ public:
 		return A;
 	}
 };
+/*
+ * Frozen compressed-row (CSR) copy of a SparseMatrix. Column indices and
+ * values are stored contiguously row after row so that matrix-vector
+ * products stream through memory instead of walking std::map nodes. For C>1
+ * each non-zero is a vec<T,C>, which gives a block-row layout with 1xC blocks.
+ * The matrix is immutable; assemble with SparseMatrix and convert.
+ */
+template<class T, int C> struct CompressedSparseMatrix {
+	std::vector<size_t> rowOffsets;
+	std::vector<uint32_t> columns;
+	std::vector<vec<T, C>> values;
+	size_t rows, cols;
+	CompressedSparseMatrix() :
+			rows(0), cols(0) {
+	}
+	CompressedSparseMatrix(const SparseMatrix<T, C>& A) :
+			rows(0), cols(0) {
+		set(A);
+	}
+	template<class Archive> void serialize(Archive & archive) {
+		archive(CEREAL_NVP(rows), CEREAL_NVP(cols), CEREAL_NVP(rowOffsets),
+				CEREAL_NVP(columns),
+				cereal::make_nvp(MakeString() << "values" << C, values));
+	}
+	void set(const SparseMatrix<T, C>& A) {
+		if (A.cols > (size_t) std::numeric_limits<uint32_t>::max())
+			throw std::runtime_error(
+					MakeString() << "Too many columns for compressed matrix "
+							<< A.cols);
+		rows = A.rows;
+		cols = A.cols;
+		rowOffsets.resize(rows + 1);
+		rowOffsets[0] = 0;
+#pragma omp parallel for
+		for (size_t i = 0; i < rows; i++) {
+			rowOffsets[i + 1] = A[i].size();
+		}
+		for (size_t i = 0; i < rows; i++) {
+			rowOffsets[i + 1] += rowOffsets[i];
+		}
+		columns.resize(rowOffsets[rows]);
+		values.resize(rowOffsets[rows]);
+#pragma omp parallel for
+		for (size_t i = 0; i < rows; i++) {
+			size_t k = rowOffsets[i];
+			for (const std::pair<const size_t, vec<T, C>>& pr : A[i]) {
+				columns[k] = (uint32_t) pr.first;
+				values[k] = pr.second;
+				k++;
+			}
+		}
+	}
+	size_t size() const {
+		return values.size();
+	}
+	size_t rowSize(size_t i) const {
+		return rowOffsets[i + 1] - rowOffsets[i];
+	}
+	vec<T, C> get(size_t i, size_t j) const {
+		if (i >= rows || j >= cols)
+			throw std::runtime_error(
+					MakeString() << "Index (" << i << "," << j
+							<< ") exceeds matrix bounds [" << rows << ","
+							<< cols << "]");
+		const uint32_t* start = columns.data() + rowOffsets[i];
+		const uint32_t* end = columns.data() + rowOffsets[i + 1];
+		const uint32_t* pos = std::lower_bound(start, end, (uint32_t) j);
+		if (pos == end || *pos != j) {
+			return vec<T, C>(T(0));
+		}
+		return values[pos - columns.data()];
+	}
+	vec<T, C> operator()(size_t i, size_t j) const {
+		return get(i, j);
+	}
+	SparseMatrix<T, C> toSparseMatrix() const {
+		SparseMatrix<T, C> A(rows, cols);
+#pragma omp parallel for
+		for (size_t i = 0; i < rows; i++) {
+			std::map<size_t, vec<T, C>>& row = A[i];
+			for (size_t k = rowOffsets[i]; k < rowOffsets[i + 1]; k++) {
+				row.insert(row.end(),
+						std::pair<size_t, vec<T, C>>(columns[k], values[k]));
+			}
+		}
+		return A;
+	}
+	CompressedSparseMatrix<T, C> transpose() const {
+		CompressedSparseMatrix<T, C> M;
+		M.rows = cols;
+		M.cols = rows;
+		M.rowOffsets.assign(cols + 1, 0);
+		M.columns.resize(columns.size());
+		M.values.resize(values.size());
+		for (uint32_t j : columns) {
+			M.rowOffsets[j + 1]++;
+		}
+		for (size_t j = 0; j < cols; j++) {
+			M.rowOffsets[j + 1] += M.rowOffsets[j];
+		}
+		std::vector<size_t> cursor(M.rowOffsets.begin(), M.rowOffsets.end() - 1);
+		//Rows are visited in order, so columns of the transpose stay sorted.
+		for (size_t i = 0; i < rows; i++) {
+			for (size_t k = rowOffsets[i]; k < rowOffsets[i + 1]; k++) {
+				size_t dest = cursor[columns[k]]++;
+				M.columns[dest] = (uint32_t) i;
+				M.values[dest] = values[k];
+			}
+		}
+		return M;
+	}
+	Vector<T, C> diagonal() const {
+		Vector<T, C> D(std::min(rows, cols));
+#pragma omp parallel for
+		for (size_t i = 0; i < D.size(); i++) {
+			D.data[i] = get(i, i);
+		}
+		return D;
+	}
+};
 template<class A, class B, class T, int C> std::basic_ostream<A, B> & operator <<(
 		std::basic_ostream<A, B> & ss, const SparseMatrix<T, C>& M) {
 	for (size_t i = 0; i < M.rows; i++) {
@@ -604,6 +725,243 @@ template<class T, int C> void SubtractMultiplyVec(Vector<T, C>& out,
 		out[i] = b[i] - vec<T, C>(sum);
 	}
 }
+/*
+ * Kernels for CompressedSparseMatrix. Rows are independent, so products are
+ * split across threads by row and the inner loop over a row's non-zeros is a
+ * contiguous gather that the compiler can vectorize. Transposed products
+ * scatter into per-thread accumulators that are reduced afterwards.
+ */
+template<class T, int C> inline vec<double, C> MultiplyRow(
+		const CompressedSparseMatrix<T, 1>& A, size_t i,
+		const vec<T, C>* __restrict v) {
+	const uint32_t* __restrict cols = A.columns.data();
+	const vec<T, 1>* __restrict vals = A.values.data();
+	size_t start = A.rowOffsets[i];
+	size_t end = A.rowOffsets[i + 1];
+	vec<double, C> sum(0.0);
+	for (int c = 0; c < C; c++) {
+		double s = 0.0;
+#pragma omp simd reduction(+:s)
+		for (size_t k = start; k < end; k++) {
+			s += (double) v[cols[k]][c] * (double) vals[k].x;
+		}
+		sum[c] = s;
+	}
+	return sum;
+}
+template<class T, int C> inline vec<double, C> MultiplyRowVec(
+		const CompressedSparseMatrix<T, C>& A, size_t i,
+		const vec<T, C>* __restrict v) {
+	const uint32_t* __restrict cols = A.columns.data();
+	const vec<T, C>* __restrict vals = A.values.data();
+	size_t start = A.rowOffsets[i];
+	size_t end = A.rowOffsets[i + 1];
+	vec<double, C> sum(0.0);
+	for (int c = 0; c < C; c++) {
+		double s = 0.0;
+#pragma omp simd reduction(+:s)
+		for (size_t k = start; k < end; k++) {
+			s += (double) v[cols[k]][c] * (double) vals[k][c];
+		}
+		sum[c] = s;
+	}
+	return sum;
+}
+template<class T, int C> void Multiply(Vector<T, C>& out,
+		const CompressedSparseMatrix<T, 1>& A, const Vector<T, C>& v) {
+	out.resize(A.rows);
+	const vec<T, C>* vptr = v.data.data();
+#pragma omp parallel for
+	for (size_t i = 0; i < A.rows; i++) {
+		out.data[i] = vec<T, C>(MultiplyRow(A, i, vptr));
+	}
+}
+template<class T, int C> void AddMultiply(Vector<T, C>& out,
+		const Vector<T, C>& b, const CompressedSparseMatrix<T, 1>& A,
+		const Vector<T, C>& v) {
+	out.resize(A.rows);
+	const vec<T, C>* vptr = v.data.data();
+#pragma omp parallel for
+	for (size_t i = 0; i < A.rows; i++) {
+		out.data[i] = b.data[i] + vec<T, C>(MultiplyRow(A, i, vptr));
+	}
+}
+template<class T, int C> void SubtractMultiply(Vector<T, C>& out,
+		const Vector<T, C>& b, const CompressedSparseMatrix<T, 1>& A,
+		const Vector<T, C>& v) {
+	out.resize(A.rows);
+	const vec<T, C>* vptr = v.data.data();
+#pragma omp parallel for
+	for (size_t i = 0; i < A.rows; i++) {
+		out.data[i] = b.data[i] - vec<T, C>(MultiplyRow(A, i, vptr));
+	}
+}
+template<class T, int C> void MultiplyVec(Vector<T, C>& out,
+		const CompressedSparseMatrix<T, C>& A, const Vector<T, C>& v) {
+	out.resize(A.rows);
+	const vec<T, C>* vptr = v.data.data();
+#pragma omp parallel for
+	for (size_t i = 0; i < A.rows; i++) {
+		out.data[i] = vec<T, C>(MultiplyRowVec(A, i, vptr));
+	}
+}
+template<class T, int C> void AddMultiplyVec(Vector<T, C>& out,
+		const Vector<T, C>& b, const CompressedSparseMatrix<T, C>& A,
+		const Vector<T, C>& v) {
+	out.resize(A.rows);
+	const vec<T, C>* vptr = v.data.data();
+#pragma omp parallel for
+	for (size_t i = 0; i < A.rows; i++) {
+		out.data[i] = b.data[i] + vec<T, C>(MultiplyRowVec(A, i, vptr));
+	}
+}
+template<class T, int C> void SubtractMultiplyVec(Vector<T, C>& out,
+		const Vector<T, C>& b, const CompressedSparseMatrix<T, C>& A,
+		const Vector<T, C>& v) {
+	out.resize(A.rows);
+	const vec<T, C>* vptr = v.data.data();
+#pragma omp parallel for
+	for (size_t i = 0; i < A.rows; i++) {
+		out.data[i] = b.data[i] - vec<T, C>(MultiplyRowVec(A, i, vptr));
+	}
+}
+template<class T, int C> Vector<T, C> operator*(
+		const CompressedSparseMatrix<T, C>& A, const Vector<T, C>& v) {
+	Vector<T, C> out(A.rows);
+	MultiplyVec(out, A, v);
+	return out;
+}
+template<class T, int C> void MultiplyTranspose(Vector<T, C>& out,
+		const CompressedSparseMatrix<T, 1>& A, const Vector<T, C>& v) {
+	out.resize(A.cols);
+	int threads = std::max(1, omp_get_max_threads());
+	std::vector<std::vector<vec<double, C>>> partial(threads);
+#pragma omp parallel
+	{
+		int tid = omp_get_thread_num();
+		std::vector<vec<double, C>>& acc = partial[tid];
+		acc.assign(A.cols, vec<double, C>(0.0));
+#pragma omp for
+		for (size_t i = 0; i < A.rows; i++) {
+			vec<double, C> vi(v.data[i]);
+			for (size_t k = A.rowOffsets[i]; k < A.rowOffsets[i + 1]; k++) {
+				acc[A.columns[k]] += vi * (double) A.values[k].x;
+			}
+		}
+	}
+#pragma omp parallel for
+	for (size_t j = 0; j < A.cols; j++) {
+		vec<double, C> sum(0.0);
+		for (int t = 0; t < threads; t++) {
+			if (partial[t].size() > 0)
+				sum += partial[t][j];
+		}
+		out.data[j] = vec<T, C>(sum);
+	}
+}
+template<class T, int C> void MultiplyTransposeVec(Vector<T, C>& out,
+		const CompressedSparseMatrix<T, C>& A, const Vector<T, C>& v) {
+	out.resize(A.cols);
+	int threads = std::max(1, omp_get_max_threads());
+	std::vector<std::vector<vec<double, C>>> partial(threads);
+#pragma omp parallel
+	{
+		int tid = omp_get_thread_num();
+		std::vector<vec<double, C>>& acc = partial[tid];
+		acc.assign(A.cols, vec<double, C>(0.0));
+#pragma omp for
+		for (size_t i = 0; i < A.rows; i++) {
+			vec<double, C> vi(v.data[i]);
+			for (size_t k = A.rowOffsets[i]; k < A.rowOffsets[i + 1]; k++) {
+				acc[A.columns[k]] += vi * vec<double, C>(A.values[k]);
+			}
+		}
+	}
+#pragma omp parallel for
+	for (size_t j = 0; j < A.cols; j++) {
+		vec<double, C> sum(0.0);
+		for (int t = 0; t < threads; t++) {
+			if (partial[t].size() > 0)
+				sum += partial[t][j];
+		}
+		out.data[j] = vec<T, C>(sum);
+	}
+}
+template<class T, int C> void Multiply(CompressedSparseMatrix<T, C>& out,
+		const CompressedSparseMatrix<T, C>& A,
+		const CompressedSparseMatrix<T, C>& B) {
+	if (A.cols != B.rows)
+		throw std::runtime_error(
+				MakeString()
+						<< "Cannot multiply matrices. Inner dimensions do not match. "
+						<< "[" << A.rows << "," << A.cols << "] * [" << B.rows
+						<< "," << B.cols << "]");
+	out.rows = A.rows;
+	out.cols = B.cols;
+	out.rowOffsets.assign(A.rows + 1, 0);
+	//Symbolic pass counts the distinct columns of each output row.
+#pragma omp parallel
+	{
+		std::vector<size_t> marker(B.cols, std::numeric_limits<size_t>::max());
+#pragma omp for
+		for (size_t i = 0; i < A.rows; i++) {
+			size_t count = 0;
+			for (size_t ka = A.rowOffsets[i]; ka < A.rowOffsets[i + 1]; ka++) {
+				size_t k = A.columns[ka];
+				for (size_t kb = B.rowOffsets[k]; kb < B.rowOffsets[k + 1];
+						kb++) {
+					size_t j = B.columns[kb];
+					if (marker[j] != i) {
+						marker[j] = i;
+						count++;
+					}
+				}
+			}
+			out.rowOffsets[i + 1] = count;
+		}
+	}
+	for (size_t i = 0; i < A.rows; i++) {
+		out.rowOffsets[i + 1] += out.rowOffsets[i];
+	}
+	out.columns.resize(out.rowOffsets[A.rows]);
+	out.values.resize(out.rowOffsets[A.rows]);
+	//Numeric pass accumulates into a dense row buffer and emits sorted columns.
+#pragma omp parallel
+	{
+		std::vector<size_t> marker(B.cols, std::numeric_limits<size_t>::max());
+		std::vector<vec<double, C>> accum(B.cols);
+#pragma omp for
+		for (size_t i = 0; i < A.rows; i++) {
+			size_t start = out.rowOffsets[i];
+			size_t end = start;
+			for (size_t ka = A.rowOffsets[i]; ka < A.rowOffsets[i + 1]; ka++) {
+				size_t k = A.columns[ka];
+				vec<double, C> a(A.values[ka]);
+				for (size_t kb = B.rowOffsets[k]; kb < B.rowOffsets[k + 1];
+						kb++) {
+					size_t j = B.columns[kb];
+					if (marker[j] != i) {
+						marker[j] = i;
+						accum[j] = vec<double, C>(0.0);
+						out.columns[end++] = (uint32_t) j;
+					}
+					accum[j] += a * vec<double, C>(B.values[kb]);
+				}
+			}
+			std::sort(out.columns.begin() + start, out.columns.begin() + end);
+			for (size_t k = start; k < end; k++) {
+				out.values[k] = vec<T, C>(accum[out.columns[k]]);
+			}
+		}
+	}
+}
+template<class T, int C> CompressedSparseMatrix<T, C> operator*(
+		const CompressedSparseMatrix<T, C>& A,
+		const CompressedSparseMatrix<T, C>& B) {
+	CompressedSparseMatrix<T, C> out;
+	Multiply(out, A, B);
+	return out;
+}
 template<class T, int C> void WriteSparseMatrixToFile(const std::string& file,
 		const SparseMatrix<T, C>& matrix) {
 	std::ofstream os(file);
@@ -630,6 +988,16 @@ typedef SparseMatrix<double, 4> SparseMatrix4d;
 typedef SparseMatrix<double, 3> SparseMatrix3d;
 typedef SparseMatrix<double, 2> SparseMatrix2d;
 typedef SparseMatrix<double, 1> SparseMatrix1d;
+
+typedef CompressedSparseMatrix<float, 4> CompressedSparseMatrix4f;
+typedef CompressedSparseMatrix<float, 3> CompressedSparseMatrix3f;
+typedef CompressedSparseMatrix<float, 2> CompressedSparseMatrix2f;
+typedef CompressedSparseMatrix<float, 1> CompressedSparseMatrix1f;
+
+typedef CompressedSparseMatrix<double, 4> CompressedSparseMatrix4d;
+typedef CompressedSparseMatrix<double, 3> CompressedSparseMatrix3d;
+typedef CompressedSparseMatrix<double, 2> CompressedSparseMatrix2d;
+typedef CompressedSparseMatrix<double, 1> CompressedSparseMatrix1d;
 }
 
 #endif
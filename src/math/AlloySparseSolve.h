@@ -23,14 +23,25 @@
 #include "math/AlloyVector.h"
 #include "math/AlloySparseMatrix.h"
 #include "math/AlloyVecMath.h"
+#include "math/AlloyPreconditioner.h"
+#include <chrono>
 namespace aly {
 bool SANITY_CHECK_ALGO();
 bool SANITY_CHECK_SPARSE_SOLVE();
+/*
+ * Iteration monitors receive the iteration, the mean squared residual and the
+ * wall time in seconds since the solve started. Returning false stops the solve.
+ */
+inline double SolveTime(const std::chrono::steady_clock::time_point& startTime) {
+	return std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - startTime).count();
+}
 template<class T, int C> void SolveVecCG(const Vector<T, C>& b,
-		const SparseMatrix<T, C>& A, Vector<T, C>& x, int iters = 100,
+		const CompressedSparseMatrix<T, C>& A, Vector<T, C>& x, int iters = 100,
 		T tolerance = 1E-6f,
-		const std::function<bool(int, double)>& iterationMonitor = nullptr) {
+		const std::function<bool(int, double, double)>& iterationMonitor = nullptr) {
 	const double ZERO_TOLERANCE = 1E-16;
+	auto startTime = std::chrono::steady_clock::now();
 	vec<double, C> err(0.0);
 	size_t N = b.size();
 	Vector<T, C> p(N);
@@ -44,7 +55,7 @@ template<class T, int C> void SolveVecCG(const Vector<T, C>& b,
 	err = lengthVecSqr(*rcurrent);
 	double e = lengthL1(err) / N;
 	if (iterationMonitor) {
-		if (!iterationMonitor(0, e))return;
+		if (!iterationMonitor(0, e, SolveTime(startTime)))return;
 	}
 	for (int iter = 0; iter < iters; iter++) {
 		MultiplyVec(Ap, A, p);
@@ -60,7 +71,7 @@ template<class T, int C> void SolveVecCG(const Vector<T, C>& b,
 		vec<double, C> err = lengthVecSqr(*rnext);
 		double e = lengthL1(err) / N;
 		if (iterationMonitor) {
-			if (!iterationMonitor(iter + 1, e))return;
+			if (!iterationMonitor(iter + 1, e, SolveTime(startTime)))return;
 		}
 		if (e < tolerance)
 			break;
@@ -75,11 +86,70 @@ template<class T, int C> void SolveVecCG(const Vector<T, C>& b,
 		std::swap(rcurrent, rnext);
 	}
 }
+/*
+ * Preconditioned conjugate gradient. The preconditioner must be symmetric
+ * positive definite (Jacobi, IC(0) and the AMG V-cycle are).
+ */
+template<class T, int C> void SolvePreconditionedCG(const Vector<T, C>& b,
+		const CompressedSparseMatrix<T, 1>& A, Vector<T, C>& x,
+		SparsePreconditioner<T, C>& preconditioner, int iters = 100,
+		T tolerance = 1E-6f,
+		const std::function<bool(int, double, double)>& iterationMonitor = nullptr) {
+	const double ZERO_TOLERANCE = 1E-16;
+	auto startTime = std::chrono::steady_clock::now();
+	size_t N = b.size();
+	Vector<T, C> r(N), z(N), p(N), Ap(N);
+	preconditioner.setup(A);
+	SubtractMultiply(r, b, A, x);
+	double e = lengthL1(lengthVecSqr(r)) / N;
+	if (iterationMonitor) {
+		if (!iterationMonitor(0, e, SolveTime(startTime)))return;
+	}
+	if (e < tolerance)
+		return;
+	preconditioner.apply(z, r);
+	p = z;
+	vec<double, C> rz = dotVec(r, z);
+	for (int iter = 0; iter < iters; iter++) {
+		Multiply(Ap, A, p);
+		vec<double, C> denom = dotVec(p, Ap);
+		for (int c = 0; c < C; c++) {
+			if (std::abs(denom[c]) < ZERO_TOLERANCE) {
+				denom[c] = (denom[c] < 0) ? -ZERO_TOLERANCE : ZERO_TOLERANCE;
+			}
+		}
+		vec<T, C> alpha = vec<T, C>(rz / denom);
+		ScaleAdd(x, alpha, p);
+		ScaleSubtract(r, r, alpha, Ap);
+		e = lengthL1(lengthVecSqr(r)) / N;
+		if (iterationMonitor) {
+			if (!iterationMonitor(iter + 1, e, SolveTime(startTime)))return;
+		}
+		if (e < tolerance)
+			break;
+		preconditioner.apply(z, r);
+		vec<double, C> rzNext = dotVec(r, z);
+		for (int c = 0; c < C; c++) {
+			if (std::abs(rz[c]) < ZERO_TOLERANCE) {
+				rz[c] = (rz[c] < 0) ? -ZERO_TOLERANCE : ZERO_TOLERANCE;
+			}
+		}
+		ScaleAdd(p, z, vec<T, C>(rzNext / rz), p);
+		rz = rzNext;
+	}
+}
 template<class T, int C> void SolveCG(const Vector<T, C>& b,
-		const SparseMatrix<T, 1>& A, Vector<T, C>& x, int iters = 100,
+		const CompressedSparseMatrix<T, 1>& A, Vector<T, C>& x, int iters = 100,
 		T tolerance = 1E-6f,
-		const std::function<bool(int, double)>& iterationMonitor = nullptr) {
+		const std::function<bool(int, double, double)>& iterationMonitor = nullptr,
+		SparsePreconditioner<T, C>* preconditioner = nullptr) {
+	if (preconditioner) {
+		SolvePreconditionedCG(b, A, x, *preconditioner, iters, tolerance,
+				iterationMonitor);
+		return;
+	}
 	const double ZERO_TOLERANCE = 1E-16;
+	auto startTime = std::chrono::steady_clock::now();
 	vec<double, C> err(0.0);
 	size_t N = b.size();
 	Vector<T, C> p(N);
@@ -93,7 +163,7 @@ template<class T, int C> void SolveCG(const Vector<T, C>& b,
 	err = lengthVecSqr(*rcurrent);
 	double e = lengthL1(err) / N;
 	if (iterationMonitor) {
-		if (!iterationMonitor(0, e))return;
+		if (!iterationMonitor(0, e, SolveTime(startTime)))return;
 	}
 	for (int iter = 0; iter < iters; iter++) {
 		Multiply(Ap, A, p);
@@ -109,7 +179,7 @@ template<class T, int C> void SolveCG(const Vector<T, C>& b,
 		vec<double, C> err = lengthVecSqr(*rnext);
 		double e = lengthL1(err) / N;
 		if (iterationMonitor) {
-			if (!iterationMonitor(iter + 1, e))return;
+			if (!iterationMonitor(iter + 1, e, SolveTime(startTime)))return;
 		}
 		if (e < tolerance)
 			break;
@@ -125,10 +195,11 @@ template<class T, int C> void SolveCG(const Vector<T, C>& b,
 	}
 }
 template<class T, int C> void SolveVecBICGStab(const Vector<T, C>& b,
-		const SparseMatrix<T, C>& A, Vector<T, C>& x, int iters = 100,
+		const CompressedSparseMatrix<T, C>& A, Vector<T, C>& x, int iters = 100,
 		T tolerance = 1E-6f,
-		const std::function<bool(int, double)>& iterationMonitor = nullptr) {
+		const std::function<bool(int, double, double)>& iterationMonitor = nullptr) {
 	const double ZERO_TOLERANCE = 1E-16;
+	auto startTime = std::chrono::steady_clock::now();
 	size_t N = b.size();
 	Vector<T, C> p(N);
 	Vector<T, C> Ap(N);
@@ -155,7 +226,7 @@ template<class T, int C> void SolveVecBICGStab(const Vector<T, C>& b,
 	err = lengthVecSqr(r);
 	double e = lengthL1(err) / N;
 	if (iterationMonitor) {
-		if (!iterationMonitor(0, e))return;
+		if (!iterationMonitor(0, e, SolveTime(startTime)))return;
 	}
 	for (int iter = 0; iter < iters; iter++) {
 		rhoNext = dotVec(rinit, r);
@@ -179,18 +250,83 @@ template<class T, int C> void SolveVecBICGStab(const Vector<T, C>& b,
 		vec<double, C> err = lengthVecSqr(delta);
 		double e = lengthL1(err) / N;
 		if (iterationMonitor) {
-			if (!iterationMonitor(iter + 1, e))return;
+			if (!iterationMonitor(iter + 1, e, SolveTime(startTime)))return;
 		}
 		if (e < tolerance)
 			break;
 
 	}
 }
+/*
+ * Right preconditioned BiCGStab, the residual it reports is that of the
+ * unpreconditioned system.
+ */
+template<class T, int C> void SolvePreconditionedBICGStab(
+		const Vector<T, C>& b, const CompressedSparseMatrix<T, 1>& A,
+		Vector<T, C>& x, SparsePreconditioner<T, C>& preconditioner,
+		int iters = 100, T tolerance = 1E-6f,
+		const std::function<bool(int, double, double)>& iterationMonitor = nullptr) {
+	const double ZERO_TOLERANCE = 1E-16;
+	auto startTime = std::chrono::steady_clock::now();
+	size_t N = b.size();
+	Vector<T, C> r(N), rinit, p(N), phat(N), v(N), s(N), shat(N), t(N);
+	v.set(vec<T, C>(T(0)));
+	p.set(vec<T, C>(T(0)));
+	vec<double, C> rhoNext(1);
+	vec<double, C> rho(1);
+	vec<T, C> alpha(1), beta(1);
+	vec<T, C> omega(1);
+	preconditioner.setup(A);
+	SubtractMultiply(r, b, A, x);
+	rinit = r;
+	double e = lengthL1(lengthVecSqr(r)) / N;
+	if (iterationMonitor) {
+		if (!iterationMonitor(0, e, SolveTime(startTime)))return;
+	}
+	if (e < tolerance)
+		return;
+	for (int iter = 0; iter < iters; iter++) {
+		rhoNext = dotVec(rinit, r);
+		beta = vec<T, C>((rhoNext / rho)) * (alpha / omega);
+		ScaleAdd(p, r, beta, p, -beta * omega, v);
+		preconditioner.apply(phat, p);
+		Multiply(v, A, phat);
+		alpha = vec<T, C>(rhoNext / dotVec(rinit, v));
+		ScaleSubtract(s, r, alpha, v);
+		if (lengthL1(s) < N * ZERO_TOLERANCE) {
+			ScaleAdd(x, alpha, phat);
+			if (iterationMonitor) {
+				iterationMonitor(iter + 1, lengthL1(lengthVecSqr(s)) / N,
+						SolveTime(startTime));
+			}
+			break;
+		}
+		preconditioner.apply(shat, s);
+		Multiply(t, A, shat);
+		omega = vec<T, C>(dotVec(t, s) / dotVec(t, t));
+		ScaleAdd(x, x, alpha, phat, omega, shat);
+		ScaleSubtract(r, s, omega, t);
+		rho = rhoNext;
+		e = lengthL1(lengthVecSqr(r)) / N;
+		if (iterationMonitor) {
+			if (!iterationMonitor(iter + 1, e, SolveTime(startTime)))return;
+		}
+		if (e < tolerance)
+			break;
+	}
+}
 template<class T, int C> void SolveBICGStab(const Vector<T, C>& b,
-		const SparseMatrix<T, 1>& A, Vector<T, C>& x, int iters = 100,
+		const CompressedSparseMatrix<T, 1>& A, Vector<T, C>& x, int iters = 100,
 		T tolerance = 1E-6f,
-		const std::function<bool(int, double)>& iterationMonitor = nullptr) {
+		const std::function<bool(int, double, double)>& iterationMonitor = nullptr,
+		SparsePreconditioner<T, C>* preconditioner = nullptr) {
+	if (preconditioner) {
+		SolvePreconditionedBICGStab(b, A, x, *preconditioner, iters,
+				tolerance, iterationMonitor);
+		return;
+	}
 	const double ZERO_TOLERANCE = 1E-16;
+	auto startTime = std::chrono::steady_clock::now();
 
 	size_t N = b.size();
 	Vector<T, C> p(N);
@@ -215,7 +351,7 @@ template<class T, int C> void SolveBICGStab(const Vector<T, C>& b,
 	err = lengthVecSqr(r);
 	double e = lengthL1(err) / N;
 	if (iterationMonitor) {
-		if (!iterationMonitor(0, e))return;
+		if (!iterationMonitor(0, e, SolveTime(startTime)))return;
 	}
 	for (int iter = 0; iter < iters; iter++) {
 		rhoNext = dotVec(rinit, r);
@@ -239,12 +375,46 @@ template<class T, int C> void SolveBICGStab(const Vector<T, C>& b,
 		vec<double, C> err = lengthVecSqr(delta);
 		double e = lengthL1(err) / N;
 		if (iterationMonitor) {
-			if (!iterationMonitor(iter + 1, e))return;
+			if (!iterationMonitor(iter + 1, e, SolveTime(startTime)))return;
 		}
 		if (e < tolerance)
 			break;
 
 	}
 }
+/*
+ * Map-based entry points. The matrix is frozen into compressed-row form once
+ * per solve so every iteration runs on the streaming SpMV kernels.
+ */
+template<class T, int C> void SolveVecCG(const Vector<T, C>& b,
+		const SparseMatrix<T, C>& A, Vector<T, C>& x, int iters = 100,
+		T tolerance = 1E-6f,
+		const std::function<bool(int, double, double)>& iterationMonitor = nullptr) {
+	SolveVecCG(b, CompressedSparseMatrix<T, C>(A), x, iters, tolerance,
+			iterationMonitor);
+}
+template<class T, int C> void SolveCG(const Vector<T, C>& b,
+		const SparseMatrix<T, 1>& A, Vector<T, C>& x, int iters = 100,
+		T tolerance = 1E-6f,
+		const std::function<bool(int, double, double)>& iterationMonitor = nullptr,
+		SparsePreconditioner<T, C>* preconditioner = nullptr) {
+	SolveCG(b, CompressedSparseMatrix<T, 1>(A), x, iters, tolerance,
+			iterationMonitor, preconditioner);
+}
+template<class T, int C> void SolveVecBICGStab(const Vector<T, C>& b,
+		const SparseMatrix<T, C>& A, Vector<T, C>& x, int iters = 100,
+		T tolerance = 1E-6f,
+		const std::function<bool(int, double, double)>& iterationMonitor = nullptr) {
+	SolveVecBICGStab(b, CompressedSparseMatrix<T, C>(A), x, iters, tolerance,
+			iterationMonitor);
+}
+template<class T, int C> void SolveBICGStab(const Vector<T, C>& b,
+		const SparseMatrix<T, 1>& A, Vector<T, C>& x, int iters = 100,
+		T tolerance = 1E-6f,
+		const std::function<bool(int, double, double)>& iterationMonitor = nullptr,
+		SparsePreconditioner<T, C>* preconditioner = nullptr) {
+	SolveBICGStab(b, CompressedSparseMatrix<T, 1>(A), x, iters, tolerance,
+			iterationMonitor, preconditioner);
+}
 }
 #endif
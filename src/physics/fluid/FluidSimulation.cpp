@@ -30,6 +30,8 @@ namespace aly {
 const float FluidSimulation::GRAVITY = 9.8067f;
 const float RELAXATION_KERNEL_WIDTH = 1.4;
 const float SPRING_STIFFNESS = 50.0;
+//Particles per parallel chunk in the grid to particle transfers; each chunk runs as one simd loop.
+const int PARTICLE_BLOCK = 256;
 static int frameCounter = 0;
 void FluidSimulation::setup(const aly::ParameterPanePtr& pane) {
 }
@@ -55,30 +57,26 @@ void FluidSimulation::computeParticleDensity(float maxDensity) {
 	float scale = 1.0f / fluidVoxelSize;
 #pragma omp parallel for
 	for (int n = 0; n < (int) particles.size(); n++) {
-		FluidParticlePtr& p = particles[n];
-		if (p->mObjectType == ObjectType::WALL) {
-			p->mDensity = 1.0;
+		if (particles.mObjectType[n] == ObjectType::WALL) {
+			particles.mDensity[n] = 1.0;
 			continue;
 		}
-		float2& pt = p->mLocation;
-		int i = clamp((int) (scale * p->mLocation[0]), 0, gridSize.x - 1);
-		int j = clamp((int) (scale * p->mLocation[1]), 0, gridSize.y - 1);
-		//Search in small region
-		std::vector<FluidParticle*> neighbors =
-				particleLocator->getNeigboringCellParticles(i, j, 1, 1);
+		const float2& pt = particles.mLocation[n];
+		int i = clamp((int) (scale * pt[0]), 0, gridSize.x - 1);
+		int j = clamp((int) (scale * pt[1]), 0, gridSize.y - 1);
 		float wsum = 0.0;
-		//Density a function of how close particles are to their neighbors.
-		for (FluidParticle* np : neighbors) {
-			if (np->mObjectType == ObjectType::WALL)
-				continue;
-			float d2 = distanceSquared(np->mLocation, pt);
-			float w = np->mMass
+		//Density a function of how close particles are to their neighbors, searched in a small region.
+		particleLocator->forEachCellParticle(i, j, 1, 1, [&](int m) {
+			if (particles.mObjectType[m] == ObjectType::WALL)
+				return;
+			float d2 = distanceSquared(particles.mLocation[m], pt);
+			float w = particles.mMass[m]
 					* smoothKernel(d2,
 							4.0f * fluidParticleDiameter * fluidVoxelSize);
 			wsum += w;
-		}
+		});
 		//Estimate density in region using current particle configuration.
-		p->mDensity = wsum / maxDensity;
+		particles.mDensity[n] = wsum / maxDensity;
 	}
 }
 void FluidSimulation::placeWalls() {
@@ -209,18 +207,17 @@ void FluidSimulation::repositionParticles(std::vector<int>& indices) {
 // Shuffle
 	shuffleCoordinates(waters);
 	for (int n = 0; n < indices.size(); n++) {
-		FluidParticlePtr& p = particles[indices[n]];
-		p->mLocation[0] = fluidVoxelSize
+		float2& pt = particles.mLocation[indices[n]];
+		pt[0] = fluidVoxelSize
 				* (waters[n][0] + 0.25 + 0.5 * (rand() % 101) / 100);
-		p->mLocation[1] = fluidVoxelSize
+		pt[1] = fluidVoxelSize
 				* (waters[n][1] + 0.25 + 0.5 * (rand() % 101) / 100);
 	}
 	particleLocator->update(particles);
 	for (int n = 0; n < indices.size(); n++) {
-		FluidParticlePtr &p = particles[indices[n]];
 		float2 u(0.0f);
-		resampleParticles(p->mLocation, u, fluidVoxelSize);
-		p->mVelocity = u;
+		resampleParticles(particles.mLocation[indices[n]], u, fluidVoxelSize);
+		particles.mVelocity[indices[n]] = u;
 	}
 }
 void FluidSimulation::addParticle(float2 pt, float2 center, ObjectType type) {
@@ -246,7 +243,6 @@ void FluidSimulation::addParticle(float2 pt, float2 center, ObjectType type) {
 		}
 	}
 	if (inside_obj) {
-		FluidParticle *p = new FluidParticle;
 		//float2 axis(((rand() % MAX_INT) / (MAX_INT - 1.0)) * 2.0f - 1.0f,((rand() % MAX_INT) / (MAX_INT - 1.0)) * 2.0f - 1.0f);
 		//axis=normalize(axis);
 		float ang = MAX_ANGLE * (rand() % MAX_INT) / (MAX_INT - 1.0);
@@ -255,17 +251,10 @@ void FluidSimulation::addParticle(float2 pt, float2 center, ObjectType type) {
 		R(1, 0) = std::sin(ang);
 		R(0, 1) = -std::sin(ang);
 		R(1, 1) = std::cos(ang);
-		if (inside_obj->mType == ObjectType::FLUID) {
-			p->mLocation = center + R * (pt - center);
-		} else {
-			p->mLocation = pt;
-		}
-		p->mVelocity = float2(0.0);
-		p->mNormal = float2(0.0);
-		p->mDensity = 10.0;
-		p->mObjectType = inside_obj->mType;
-		p->mMass = 1.0;
-		particles.push_back(FluidParticlePtr(p));
+		particles.add(
+				(inside_obj->mType == ObjectType::FLUID) ?
+						center + R * (pt - center) : pt, float2(0.0),
+				inside_obj->mType, 1.0f, 10.0f);
 	}
 }
 bool FluidSimulation::init() {
@@ -279,18 +268,15 @@ bool FluidSimulation::init() {
 	float h = fluidParticleDiameter * fluidVoxelSize;
 	for (int j = 0; j < 10; j++) {
 		for (int i = 0; i < 10; i++) {
-			FluidParticle *p = new FluidParticle;
-			p->mLocation = float2((i + 0.5) * h, (j + 0.5) * h);
-			p->mObjectType = ObjectType::FLUID;
-			p->mMass = 1.0;
-			particles.push_back(std::unique_ptr<FluidParticle>(p));
+			particles.add(float2((i + 0.5) * h, (j + 0.5) * h), float2(0.0f),
+					ObjectType::FLUID, 1.0f, 0.0f);
 		}
 	}
 	particleLocator->update(particles);
 	computeParticleDensity(1.0f);
 	maxDensity = 0.0;
-	for (FluidParticlePtr& p : particles) {
-		maxDensity = max(maxDensity, p->mDensity);
+	for (float density : particles.mDensity) {
+		maxDensity = max(maxDensity, density);
 	}
 	particles.clear();
 	float2 center;
@@ -323,26 +309,23 @@ bool FluidSimulation::init() {
 		}
 	}
 	particleLocator->update(particles);
-	particleLocator->markAsWater(labelImage, wallWeightImage, fluidParticleDiameter);
+	particleLocator->markAsWater(particles, labelImage, wallWeightImage, fluidParticleDiameter);
 // Remove Particles That Stuck On Wal Cells
 	float scale = 1.0f / fluidVoxelSize;
-	int eraseCount=0;
-	for (std::vector<FluidParticlePtr>::iterator iter = particles.begin();
-			iter != particles.end();) {
-		FluidParticlePtr& p = *iter;
-		if (p->mObjectType == ObjectType::WALL) {
-			iter++;
+#pragma omp parallel for
+	for (int n = 0; n < (int) particles.size(); n++) {
+		particles.mRemoveIndicator[n] = 0;
+		if (particles.mObjectType[n] == ObjectType::WALL) {
 			continue;
 		}
-		int i = clamp((int) (scale * p->mLocation[0]), 0, gridSize.x - 1);
-		int j = clamp((int) (scale * p->mLocation[1]), 0, gridSize.y - 1);
+		int i = clamp((int) (scale * particles.mLocation[n][0]), 0, gridSize.x - 1);
+		int j = clamp((int) (scale * particles.mLocation[n][1]), 0, gridSize.y - 1);
 		if (labelImage(i, j).x == static_cast<char>(ObjectType::WALL)) {
-			iter = particles.erase(iter);
-			eraseCount++;
-		} else {
-			iter++;
+			particles.mRemoveIndicator[n] = 1;
 		}
 	}
+	particles.compact();
+	particleLocator->sort(particles);
 	computeWallNormals();
 	updateParticleVolume();
 	computeParticleDensity(maxDensity);
@@ -367,19 +350,15 @@ void FluidSimulation::pourWater(int limit, float maxDensity) {
 		for (float z = w + w / 2.0; z < 1.0 - w / 2.0; z += w) {
 			if (hypot(x - mPourPosition[0], z - mPourPosition[1])
 					< mPourRadius) {
-				FluidParticle *p = new FluidParticle;
-				p->mLocation = float2(x,
-						1.0 - wallThickness
-								- 2.5 * fluidParticleDiameter
-										* fluidVoxelSize);
-				p->mVelocity = float2(0.0,
-						-0.5 * fluidVoxelSize * fluidParticleDiameter
-								/ simulationTimeStep);
-				p->mNormal = float2(0.0);
-				p->mObjectType = ObjectType::FLUID;
-				p->mDensity = maxDensity;
-				p->mMass = 1.0;
-				particles.push_back(FluidParticlePtr(p));
+				particles.add(
+						float2(x,
+								1.0 - wallThickness
+										- 2.5 * fluidParticleDiameter
+												* fluidVoxelSize),
+						float2(0.0,
+								-0.5 * fluidVoxelSize * fluidParticleDiameter
+										/ simulationTimeStep),
+						ObjectType::FLUID, 1.0f, maxDensity);
 				cnt++;
 			}
 		}
@@ -388,30 +367,57 @@ void FluidSimulation::pourWater(int limit, float maxDensity) {
 void FluidSimulation::addExternalForce() {
 	float velocity = simulationTimeStep * GRAVITY;
 //Add gravity acceleration to all particles
-	int count = 0;
 #pragma omp parallel for
 	for (int n = 0; n < (int) particles.size(); n++) {
-		if (particles[n]->mObjectType == ObjectType::FLUID) {
-			particles[n]->mVelocity[1] += velocity;
-			count++;
+		if (particles.mObjectType[n] == ObjectType::FLUID) {
+			particles.mVelocity[n][1] += velocity;
 		}
 	}
 }
+/*
+ Bilinear sample of a two channel image, matching Image2f::operator()(x, y, c)
+ inside the grid, written with integer clamps and no calls so particle loops
+ that sample the grid vectorize. Clamping x and y to [-1, size] first makes
+ truncation equal to floor; beyond the edge both taps read the edge texel.
+ */
+static inline float SampleChannel(const float* data, int width, int height,
+		float x, float y, int c) {
+	x = std::min(std::max(x, -1.0f), (float) width);
+	y = std::min(std::max(y, -1.0f), (float) height);
+	int i = (int) (x + 1.0f) - 1;
+	int j = (int) (y + 1.0f) - 1;
+	float dx = x - i;
+	float dy = y - j;
+	int i0 = std::min(std::max(i, 0), width - 1);
+	int i1 = std::min(std::max(i + 1, 0), width - 1);
+	int j0 = std::min(std::max(j, 0), height - 1) * width;
+	int j1 = std::min(std::max(j + 1, 0), height - 1) * width;
+	float v00 = data[2 * (i0 + j0) + c];
+	float v10 = data[2 * (i1 + j0) + c];
+	float v01 = data[2 * (i0 + j1) + c];
+	float v11 = data[2 * (i1 + j1) + c];
+	return ((v00 * (1.0f - dx) + v10 * dx) * (1.0f - dy)
+			+ (v01 * (1.0f - dx) + v11 * dx) * dy);
+}
+//Staggered velocity at p, where scale maps world units to cells.
+static inline float2 SampleVelocity(const float* data, int width, int height,
+		float scale, float2 p) {
+	return float2(
+			SampleChannel(data, width, height, scale * p[0], scale * p[1] - 0.5f, 0),
+			SampleChannel(data, width, height, scale * p[0] - 0.5f, scale * p[1], 1));
+}
 float2 FluidSimulation::interpolate(const Image2f& img, float2 p) {
-	float2 u;
-	float scale = 1.0 / fluidVoxelSize;
-	u.x = img(scale * p[0], scale * p[1] - 0.5, 0);
-	u.y = img(scale * p[0] - 0.5, scale * p[1], 1);
-	return u;
+	return SampleVelocity(img.ptr(), img.width, img.height,
+			1.0f / fluidVoxelSize, p);
 }
 void FluidSimulation::advectParticles() {
 // Advect Particle Through Grid
 #pragma omp parallel for
 	for (int n = 0; n < (int) particles.size(); n++) {
-		FluidParticlePtr& p = particles[n];
-		if (p->mObjectType == ObjectType::FLUID) {
-			p->mLocation += ((float) simulationTimeStep)
-					* interpolate(contour.fluidParticles.velocityImage, p->mLocation);
+		if (particles.mObjectType[n] == ObjectType::FLUID) {
+			float2& pt = particles.mLocation[n];
+			pt += ((float) simulationTimeStep)
+					* interpolate(contour.fluidParticles.velocityImage, pt);
 		}
 	}
 //Update localization
@@ -424,68 +430,64 @@ void FluidSimulation::advectParticles() {
 //Correct particle locations
 #pragma omp parallel for
 	for (int n = 0; n < (int) particles.size(); n++) {
-		FluidParticlePtr& p = particles[n];
-		if (p->mObjectType == ObjectType::FLUID) {
-			p->mLocation[0] = clamp(p->mLocation[0], r, mx - r);
-			p->mLocation[1] = clamp(p->mLocation[1], r, my - r);
-			int i = clamp((int) (p->mLocation[0] * scale), 0, gridSize.x - 1);
-			int j = clamp((int) (p->mLocation[1] * scale), 0, gridSize.y - 1);
-			std::vector<FluidParticle*> neighbors =
-					particleLocator->getNeigboringCellParticles(i, j, 1, 1);
-			for (int n = 0; n < neighbors.size(); n++) {
-				FluidParticle *np = neighbors[n];
-				if (np->mObjectType == ObjectType::WALL) {
-					float dist = distance(p->mLocation, np->mLocation);
+		if (particles.mObjectType[n] == ObjectType::FLUID) {
+			float2& pt = particles.mLocation[n];
+			float2& vel = particles.mVelocity[n];
+			pt[0] = clamp(pt[0], r, mx - r);
+			pt[1] = clamp(pt[1], r, my - r);
+			int i = clamp((int) (pt[0] * scale), 0, gridSize.x - 1);
+			int j = clamp((int) (pt[1] * scale), 0, gridSize.y - 1);
+			particleLocator->forEachCellParticle(i, j, 1, 1, [&](int m) {
+				if (particles.mObjectType[m] == ObjectType::WALL) {
+					const float2& wpt = particles.mLocation[m];
+					float dist = distance(pt, wpt);
 					if (dist < re) {
-						float2 normal = np->mNormal;
-						if (normal[0] == 0.0 && normal[1] == 0.0
-								&& normal[2] == 0.0 && dist) {
-							normal = (p->mLocation - np->mLocation) / dist;
+						float2 normal = particles.mNormal[m];
+						if (normal[0] == 0.0 && normal[1] == 0.0 && dist) {
+							normal = (pt - wpt) / dist;
 						}
-						p->mLocation += (re - dist) * normal;
-						float dotprod = dot(p->mVelocity, normal);
-						p->mVelocity -= dotprod * normal;
+						pt += (re - dist) * normal;
+						float dotprod = dot(vel, normal);
+						vel -= dotprod * normal;
 					}
 				}
-			}
+			});
 		}
 	}
 
 // Remove Particles That Stuck On The Up-Down Wall Cells...
 #pragma omp parallel for
 	for (int n = 0; n < (int) particles.size(); n++) {
-		FluidParticlePtr& p = particles[n];
-		p->mRemoveIndicator = false;
+		const float2& pt = particles.mLocation[n];
+		particles.mRemoveIndicator[n] = 0;
 		// Focus on Only Fluid Particle
-		if (p->mObjectType == ObjectType::FLUID) {
-			int i = clamp((int) (p->mLocation[0] * scale), 0, gridSize.x - 1);
-			int j = clamp((int) (p->mLocation[1] * scale), 0, gridSize.y - 1);
+		if (particles.mObjectType[n] == ObjectType::FLUID) {
+			int i = clamp((int) (pt[0] * scale), 0, gridSize.x - 1);
+			int j = clamp((int) (pt[1] * scale), 0, gridSize.y - 1);
 			// If Stuck On Wall Cells Just Reposition
 			if (labelImage(i, j).x == static_cast<char>(ObjectType::WALL)) {
-				p->mRemoveIndicator = true;
+				particles.mRemoveIndicator[n] = 1;
 			}
-			i = clamp((int) (p->mLocation[0] * scale), 2, gridSize.x - 3);
-			j = clamp((int) (p->mLocation[1] * scale), 2, gridSize.y - 3);
-			if (p->mDensity < 0.04
+			i = clamp((int) (pt[0] * scale), 2, gridSize.x - 3);
+			j = clamp((int) (pt[1] * scale), 2, gridSize.y - 3);
+			if (particles.mDensity[n] < 0.04
 					&& (labelImage(i, max(0, j - 1)).x
 							== static_cast<char>(ObjectType::WALL)
 							|| labelImage(i, min(gridSize.y - 1, j + 1)).x
 									== static_cast<char>(ObjectType::WALL))) {
 				// Put Into Reposition List
-				p->mRemoveIndicator = true;
+				particles.mRemoveIndicator[n] = 1;
 			}
 		}
 
 	}
 // Reposition If Necessary
 	std::vector<int> reposition_indices;
-	size_t n = 0;
-	for (FluidParticlePtr& p : particles) {
-		if (p->mRemoveIndicator) {
-			p->mRemoveIndicator = false;
+	for (int n = 0; n < (int) particles.size(); n++) {
+		if (particles.mRemoveIndicator[n]) {
+			particles.mRemoveIndicator[n] = 0;
 			reposition_indices.push_back(n);
 		}
-		n++;
 	}
 
 // Store Stuck Particle Number
@@ -501,8 +503,8 @@ void FluidSimulation::cleanup() {
 	particles.clear();
 }
 bool FluidSimulation::stepInternal() {
-//Rebuild location data structure
-	particleLocator->update(particles);
+//Rebuild location data structure and keep particles stored in cell order
+	particleLocator->sort(particles);
 //Compute density for each cell, capped by max density as pre-computed
 	computeParticleDensity(maxDensity);
 //Add external gravity force
@@ -579,11 +581,11 @@ void FluidSimulation::project() {
 #pragma omp parallel for
 	for (int j = 0; j < laplacianImage.height; j++) {
 		for (int i = 0; i < laplacianImage.width; i++) {
-			laplacianImage(i, j).x = particleLocator->getLevelSetValue(i, j,
+			laplacianImage(i, j).x = particleLocator->getLevelSetValue(particles, i, j,
 					wallWeightImage, fluidParticleDiameter);
 		}
 	}
-	SolveLaplace2d(labelImage, laplacianImage, pessureImage, divergenceImage, fluidVoxelSize);
+	SolveLaplace2d(labelImage, laplacianImage, pessureImage, divergenceImage, fluidVoxelSize, LaplacePreconditioner::Multigrid);
 // Subtract Pressure Gradient
 #pragma omp parallel for
 	for (int j = 0; j < contour.fluidParticles.velocityImage.height; j++) {
@@ -703,21 +705,36 @@ void FluidSimulation::solvePicFlip() {
 	particleLocator->update(particles);
 	mapParticlesToGrid();
 	//WriteImageToRawFile(MakeString()<<GetDesktopDirectory()<<ALY_PATH_SEPARATOR<<"velocity_"<<mSimulationIteration<<".xml",mVelocity);
-	particleLocator->markAsWater(labelImage, wallWeightImage, fluidParticleDiameter);
+	particleLocator->markAsWater(particles, labelImage, wallWeightImage, fluidParticleDiameter);
 	copyGridToBuffer();
 	enforceBoundaryCondition();
 	//WriteImageToRawFile(MakeString()<<GetDesktopDirectory()<<ALY_PATH_SEPARATOR<<"velocity_enforced"<<mSimulationIteration<<".xml",mVelocity);
 	project();
 	enforceBoundaryCondition();
 	extrapolateVelocity();
+	int N = (int) particles.size();
+	const Image2f& grid = contour.fluidParticles.velocityImage;
+	const float* current = grid.ptr();
+	const float* last = lastVelocityImage.ptr();
+	const float scale = 1.0f / fluidVoxelSize;
+	const float blend = picFlipBlendWeight;
+	float2* location = particles.mLocation.data();
+	float2* velocity = particles.mVelocity.data();
 #pragma omp parallel for
-	for (int n = 0; n < (int) particles.size(); n++) {
-		FluidParticlePtr& p = particles[n];
-		float2 currentVelocity = interpolate(contour.fluidParticles.velocityImage, p->mLocation);
-		float2 velocity = p->mVelocity + currentVelocity
-				- interpolate(lastVelocityImage, p->mLocation);
-		p->mVelocity = (1.0f - picFlipBlendWeight) * currentVelocity
-				+ picFlipBlendWeight * velocity;
+	for (int b = 0; b < N; b += PARTICLE_BLOCK) {
+		int end = std::min(b + PARTICLE_BLOCK, N);
+#pragma omp simd
+		for (int n = b; n < end; n++) {
+			//Scalar locals only; vec locals become per-lane arrays that block vectorization.
+			float px = scale * location[n].x;
+			float py = scale * location[n].y;
+			float u = SampleChannel(current, grid.width, grid.height, px, py - 0.5f, 0);
+			float v = SampleChannel(current, grid.width, grid.height, px - 0.5f, py, 1);
+			float lastU = SampleChannel(last, lastVelocityImage.width, lastVelocityImage.height, px, py - 0.5f, 0);
+			float lastV = SampleChannel(last, lastVelocityImage.width, lastVelocityImage.height, px - 0.5f, py, 1);
+			velocity[n].x = u + blend * (velocity[n].x - lastU);
+			velocity[n].y = v + blend * (velocity[n].y - lastV);
+		}
 	}
 }
 void FluidSimulation::updateParticleVolume() {
@@ -726,11 +743,10 @@ void FluidSimulation::updateParticleVolume() {
 	contour.fluidParticles.velocities.clear();
 	contour.fluidParticles.radius = 0.5f * fluidParticleDiameter;
 	for (int n = 0; n < (int) particles.size(); n++) {
-		FluidParticle* p = particles[n].get();
-		if (p->mObjectType == ObjectType::FLUID) {
-			float2 l = p->mLocation / voxelSize;
+		if (particles.mObjectType[n] == ObjectType::FLUID) {
+			float2 l = particles.mLocation[n] / voxelSize;
 			contour.fluidParticles.particles.push_back(l);
-			contour.fluidParticles.velocities.push_back(p->mVelocity);
+			contour.fluidParticles.velocities.push_back(particles.mVelocity[n]);
 		}
 	}
 	/*
@@ -815,60 +831,42 @@ void FluidSimulation::mapParticlesToGrid() {
 // Compute Mapping
 	int2 dims(contour.fluidParticles.velocityImage.width, contour.fluidParticles.velocityImage.height);
 	float scale = 1.0f / fluidVoxelSize;
+	float h2 = RELAXATION_KERNEL_WIDTH * RELAXATION_KERNEL_WIDTH;
+	//Weighted average of one velocity component over the particles near a face. Non-fluid particles get zero weight so each run of indexes stays a branch free simd loop.
+	auto splat = [&](int i, int j, int w, int h, float2 face, int c) {
+		float sumw = 0.0f;
+		float sumv = 0.0f;
+		particleLocator->forEachWallRange(i, j, w, h, [&](const int* indexes, int count) {
+			float runw = 0.0f;
+			float runv = 0.0f;
+#pragma omp simd reduction(+:runw,runv)
+			for (int k = 0; k < count; k++) {
+				int n = indexes[k];
+				const float2& pt = particles.mLocation[n];
+				float dx = clamp(scale * pt[0], 0.0f, (float) dims[0]) - face[0];
+				float dy = clamp(scale * pt[1], 0.0f, (float) dims[1]) - face[1];
+				float r2 = std::max(dx * dx + dy * dy, 1.0e-5f);
+				float wt = (particles.mObjectType[n] == ObjectType::FLUID) ?
+						particles.mMass[n] * std::max(h2 / r2 - 1.0f, 0.0f) : 0.0f;
+				runv += wt * particles.mVelocity[n][c];
+				runw += wt;
+			}
+			sumw += runw;
+			sumv += runv;
+		});
+		return sumw ? sumv / sumw : 0.0f;
+	};
+	//Each face gathers from the particles around it, so faces are written by exactly one thread without atomics.
 #pragma omp parallel for
 	for (int j = 0; j < contour.fluidParticles.velocityImage.height; j++) {
 		for (int i = 0; i < contour.fluidParticles.velocityImage.width; i++) {
-			// Variales for Particle Sorter
-			std::vector<FluidParticle*> neighbors;
 			// Map X Grids
 			if (j < dims[1]) {
-				float2 px(i, j + 0.5);
-				float sumw = 0.0;
-				float sumx = 0.0;
-				neighbors = particleLocator->getNeigboringWallParticles(i, j,
-						1, 2);
-				for (int n = 0; n < neighbors.size(); n++) {
-					FluidParticle *p = neighbors[n];
-					if (p->mObjectType == ObjectType::FLUID) {
-						float x = clamp(scale * p->mLocation[0], 0.0f,
-								(float) dims[0]);
-						float y = clamp(scale * p->mLocation[1], 0.0f,
-								(float) dims[1]);
-						float2 pos(x, y);
-						float w = p->mMass
-								* sharpKernel(distanceSquared(pos, px),
-										RELAXATION_KERNEL_WIDTH);
-						sumx += w * p->mVelocity[0];
-						sumw += w;
-					}
-				}
-				contour.fluidParticles.velocityImage(i, j, 0) = sumw ? sumx / sumw : 0.0;
+				contour.fluidParticles.velocityImage(i, j, 0) = splat(i, j, 1, 2, float2(i, j + 0.5f), 0);
 			}
 			// Map Y Grids
 			if (i < dims[0]) {
-				float2 py(i + 0.5, j);
-				float sumw = 0.0;
-				float sumy = 0.0;
-				neighbors = particleLocator->getNeigboringWallParticles(i, j,
-						2, 1);
-				for (int n = 0; n < neighbors.size(); n++) {
-					FluidParticle *p = neighbors[n];
-					if (p->mObjectType == ObjectType::FLUID) {
-						float x = clamp(scale * p->mLocation[0], 0.0f,
-								(float) dims[0]);
-						float y = clamp(scale * p->mLocation[1], 0.0f,
-								(float) dims[1]);
-						float z = clamp(scale * p->mLocation[2], 0.0f,
-								(float) dims[2]);
-						float2 pos(x, y);
-						float w = p->mMass
-								* sharpKernel(distanceSquared(pos, py),
-										RELAXATION_KERNEL_WIDTH);
-						sumy += w * p->mVelocity[1];
-						sumw += w;
-					}
-				}
-				contour.fluidParticles.velocityImage(i, j, 1) = sumw ? sumy / sumw : 0.0;
+				contour.fluidParticles.velocityImage(i, j, 1) = splat(i, j, 2, 1, float2(i + 0.5f, j), 1);
 			}
 		}
 	}
@@ -902,8 +900,6 @@ bool FluidSimulation::updateContour() {
 	return false;
 }
 void FluidSimulation::resampleParticles(float2& p, float2& u, float re) {
-// Variables for Neighboring Particles
-	std::vector<FluidParticle*> neighbors;
 	int2 cell_size = particleLocator->getGridSize();
 	float wsum = 0.0;
 	float2 save(u);
@@ -912,15 +908,14 @@ void FluidSimulation::resampleParticles(float2& p, float2& u, float re) {
 	int i = clamp((int) (p[0] * scale), 0, cell_size[0] - 1);
 	int j = clamp((int) (p[1] * scale), 0, cell_size[1] - 1);
 // Gather Neighboring Particles
-	neighbors = particleLocator->getNeigboringCellParticles(i, j, 1, 1);
-	for (FluidParticle *np : neighbors) {
-		if (np->mObjectType == ObjectType::FLUID) {
-			float dist2 = distanceSquared(p, np->mLocation);
-			float w = np->mMass * sharpKernel(dist2, re);
-			u += w * np->mVelocity;
+	particleLocator->forEachCellParticle(i, j, 1, 1, [&](int n) {
+		if (particles.mObjectType[n] == ObjectType::FLUID) {
+			float dist2 = distanceSquared(p, particles.mLocation[n]);
+			float w = particles.mMass[n] * sharpKernel(dist2, re);
+			u += w * particles.mVelocity[n];
 			wsum += w;
 		}
-	}
+	});
 	if (wsum) {
 		u /= wsum;
 	} else {
@@ -928,8 +923,8 @@ void FluidSimulation::resampleParticles(float2& p, float2& u, float re) {
 	}
 }
 
-void FluidSimulation::correctParticles(std::vector<FluidParticlePtr>& particles,
-		float dt, float re) {
+void FluidSimulation::correctParticles(FluidParticleSet& particles, float dt,
+		float re) {
 // Variables for Neighboring Particles
 	int2 cell_size = particleLocator->getGridSize();
 	particleLocator->update(particles);
@@ -937,88 +932,87 @@ void FluidSimulation::correctParticles(std::vector<FluidParticlePtr>& particles,
 // Compute Pseudo Moved Point
 #pragma omp parallel for
 	for (int n = 0; n < (int) particles.size(); n++) {
-		if (particles[n]->mObjectType == ObjectType::FLUID) {
-			FluidParticle *p = particles[n].get();
+		if (particles.mObjectType[n] == ObjectType::FLUID) {
+			const float2& pt = particles.mLocation[n];
 			float2 spring(0.0f);
-			int i = clamp((int) (p->mLocation[0] * scale), 0, cell_size[0] - 1);
-			int j = clamp((int) (p->mLocation[1] * scale), 0, cell_size[1] - 1);
-			std::vector<FluidParticle*> neighbors =
-					particleLocator->getNeigboringCellParticles(i, j, 1, 1);
-			for (int n = 0; n < neighbors.size(); n++) {
-				FluidParticle *np = neighbors[n];
-				if (p != np) {
-					float dist = distance(p->mLocation, np->mLocation);
-					float w = SPRING_STIFFNESS * np->mMass
+			int i = clamp((int) (pt[0] * scale), 0, cell_size[0] - 1);
+			int j = clamp((int) (pt[1] * scale), 0, cell_size[1] - 1);
+			particleLocator->forEachCellParticle(i, j, 1, 1, [&](int m) {
+				if (n != m) {
+					const float2& npt = particles.mLocation[m];
+					float dist = distance(pt, npt);
+					float w = SPRING_STIFFNESS * particles.mMass[m]
 							* smoothKernel(dist * dist, re);
 					if (dist > 0.1 * re) {
-						spring += w * (p->mLocation - np->mLocation) / dist
-								* re;
+						spring += w * (pt - npt) / dist * re;
 					} else {
-						if (np->mObjectType == ObjectType::FLUID) {
+						if (particles.mObjectType[m] == ObjectType::FLUID) {
 							spring += 0.01f * re / dt * (rand() % 101) / 100.0f;
 						} else {
-							spring += 0.05f * re / dt * np->mNormal;
+							spring += 0.05f * re / dt * particles.mNormal[m];
 						}
 					}
 				}
-			}
-			p->mTmp[0] = p->mLocation + dt * spring;
+			});
+			particles.mTmp[0][n] = pt + dt * spring;
 		}
 	}
 // Resample New Velocity
 #pragma omp parallel for
 	for (int n = 0; n < (int) particles.size(); n++) {
-		if (particles[n]->mObjectType == ObjectType::FLUID) {
-			FluidParticle *p = particles[n].get();
-			p->mTmp[1] = p->mVelocity;
-			resampleParticles(p->mTmp[0], p->mTmp[1], re);
+		if (particles.mObjectType[n] == ObjectType::FLUID) {
+			particles.mTmp[1][n] = particles.mVelocity[n];
+			resampleParticles(particles.mTmp[0][n], particles.mTmp[1][n], re);
 		}
 	}
 
 // Update
 #pragma omp parallel for
 	for (int n = 0; n < (int) particles.size(); n++) {
-		if (particles[n]->mObjectType == ObjectType::FLUID) {
-			FluidParticle *p = particles[n].get();
-			p->mLocation = p->mTmp[0];
-			p->mVelocity = p->mTmp[1];
+		if (particles.mObjectType[n] == ObjectType::FLUID) {
+			particles.mLocation[n] = particles.mTmp[0][n];
+			particles.mVelocity[n] = particles.mTmp[1][n];
 		}
 	}
 }
 void FluidSimulation::mapGridToParticles() {
+	int N = (int) particles.size();
+	const Image2f& grid = contour.fluidParticles.velocityImage;
+	const float* data = grid.ptr();
+	const float scale = 1.0f / fluidVoxelSize;
+	const float2* location = particles.mLocation.data();
+	float2* velocity = particles.mVelocity.data();
 #pragma omp parallel for
-	for (int n = 0; n < (int) particles.size(); n++) {
-		FluidParticlePtr& p = particles[n];
-		p->mVelocity = interpolate(contour.fluidParticles.velocityImage, p->mLocation);
-	}
-}
-double FluidSimulation::implicit_func(std::vector<FluidParticle*>& neighbors,
-		float2& p, float radius, float voxelSize) {
-	double phi = 8.0f * radius;
-	float scale = 1.0f / particleLocator->getVoxelSize();
-	for (int m = 0; m < neighbors.size(); m++) {
-		FluidParticle &np = *neighbors[m];
-		double d = distance(np.mLocation, p) * scale;
-		if (np.mObjectType == ObjectType::WALL) {
-			if (d < radius)
-				return 4.5 * radius;
-			continue;
-		}
-		if (d < phi) {
-			phi = d;
+	for (int b = 0; b < N; b += PARTICLE_BLOCK) {
+		int end = std::min(b + PARTICLE_BLOCK, N);
+#pragma omp simd
+		for (int n = b; n < end; n++) {
+			velocity[n] = SampleVelocity(data, grid.width, grid.height, scale, location[n]);
 		}
 	}
-//std::cout<<"IMPLICIT "<<phi<<" "<<density<<" "<<voxelSize<<std::endl;
-	return phi - radius;
 }
 double FluidSimulation::implicit_func(float2& p, float radius) {
 	int2 cell_size = particleLocator->getGridSize();
 	float scale = 1.0f / particleLocator->getVoxelSize();
-	std::vector<FluidParticle *> neighbors =
-			particleLocator->getNeigboringCellParticles(
-					clamp((int) (p[0] * scale), 0, cell_size[0] - 1),
-					clamp((int) (p[1] * scale), 0, cell_size[1] - 1), 2, 2);
-	return implicit_func(neighbors, p, radius, particleLocator->getVoxelSize());
+	double phi = 8.0f * radius;
+	bool insideWall = false;
+	particleLocator->forEachCellParticle(
+			clamp((int) (p[0] * scale), 0, cell_size[0] - 1),
+			clamp((int) (p[1] * scale), 0, cell_size[1] - 1), 2, 2,
+			[&](int n) {
+				double d = distance(particles.mLocation[n], p) * scale;
+				if (particles.mObjectType[n] == ObjectType::WALL) {
+					if (d < radius)
+						insideWall = true;
+					return;
+				}
+				if (d < phi) {
+					phi = d;
+				}
+			});
+	if (insideWall)
+		return 4.5 * radius;
+	return phi - radius;
 }
 void FluidSimulation::computeWallNormals() {
 // mParticleLocator Particles
@@ -1029,44 +1023,42 @@ void FluidSimulation::computeWallNormals() {
 	float my = fluidVoxelSize * gridSize.y;
 //#pragma omp parallel for
 	for (int n = 0; n < (int) particles.size(); n++) {
-		FluidParticlePtr& p = particles[n];
-		int i = clamp((int) (p->mLocation[0] * scale), 0, gridSize.x - 1);
-		int j = clamp((int) (p->mLocation[1] * scale), 0, gridSize.y - 1);
+		const float2& pt = particles.mLocation[n];
+		float2& normal = particles.mNormal[n];
+		int i = clamp((int) (pt[0] * scale), 0, gridSize.x - 1);
+		int j = clamp((int) (pt[1] * scale), 0, gridSize.y - 1);
 		wallNormalImage(i, j) = float2(0.0f);
-		p->mNormal = float2(0.0);
-		if (p->mObjectType == ObjectType::WALL) {
-			if (p->mLocation[0] <= (mx + 0.1) * wallThickness) {
-				p->mNormal[0] = 1.0;
+		normal = float2(0.0);
+		if (particles.mObjectType[n] == ObjectType::WALL) {
+			if (pt[0] <= (mx + 0.1) * wallThickness) {
+				normal[0] = 1.0;
 			}
-			if (p->mLocation[0] >= mx - (mx - 0.1) * wallThickness) {
-				p->mNormal[0] = -1.0;
+			if (pt[0] >= mx - (mx - 0.1) * wallThickness) {
+				normal[0] = -1.0;
 			}
-			if (p->mLocation[1] <= (my + 0.1) * wallThickness) {
-				p->mNormal[1] = 1.0;
+			if (pt[1] <= (my + 0.1) * wallThickness) {
+				normal[1] = 1.0;
 			}
-			if (p->mLocation[1] >= my - (my - 0.1) * wallThickness) {
-				p->mNormal[1] = -1.0;
+			if (pt[1] >= my - (my - 0.1) * wallThickness) {
+				normal[1] = -1.0;
 			}
-			if (p->mNormal[0] == 0.0 && p->mNormal[1] == 0.0) {
-				std::vector<FluidParticle*> neighbors =
-						particleLocator->getNeigboringCellParticles(i, j, 3,
-								3);
-				for (int n = 0; n < (int) neighbors.size(); n++) {
-					FluidParticle *np = neighbors[n];
-					if (p.get() != np && np->mObjectType == ObjectType::WALL) {
-						float d = distance(p->mLocation, np->mLocation);
+			if (normal[0] == 0.0 && normal[1] == 0.0) {
+				particleLocator->forEachCellParticle(i, j, 3, 3, [&](int m) {
+					if (n != m && particles.mObjectType[m] == ObjectType::WALL) {
+						const float2& npt = particles.mLocation[m];
+						float d = distance(pt, npt);
 						float w = 1.0 / d;
-						p->mNormal += w * (p->mLocation - np->mLocation) / d;
+						normal += w * (pt - npt) / d;
 					}
-				}
+				});
 			}
 		}
-		p->mNormal = normalize(p->mNormal);
-		wallNormalImage(i, j) = p->mNormal;
+		normal = normalize(normal);
+		wallNormalImage(i, j) = normal;
 	}
 
 	particleLocator->update(particles);
-	particleLocator->markAsWater(labelImage, wallWeightImage, fluidParticleDiameter);
+	particleLocator->markAsWater(particles, labelImage, wallWeightImage, fluidParticleDiameter);
 
 // Compute Perimeter Normal
 #pragma omp parallel for
@@ -72,7 +72,7 @@ protected:
 	std::vector<std::shared_ptr<SimulationObject>> fluidObjects;
 	std::vector<std::shared_ptr<SimulationObject>> wallObjects;
 	std::vector<std::shared_ptr<SimulationObject>> airObjects;
-	std::vector<FluidParticlePtr> particles;
+	FluidParticleSet particles;
 	void copyGridToBuffer();
 	void subtractGrid();
 	void placeObjects();
@@ -100,12 +100,9 @@ protected:
 	void shuffleCoordinates(std::vector<int2> &waters);
 	float linear(Image1f& q, float x, float y, float z);
 	void resampleParticles(float2& p, float2& u, float re);
-	void correctParticles(std::vector<FluidParticlePtr>& particle, float dt,
-			float re);
+	void correctParticles(FluidParticleSet& particles, float dt, float re);
 	bool updateContour();
 	double implicit_func(float2& p, float density);
-	double implicit_func(std::vector<FluidParticle*> &neighbors, float2& p,
-			float density, float voxelSize);
 	void mapParticlesToGrid();
 	void mapGridToParticles();
 
@@ -28,6 +28,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <functional>
 
 #include "physics/fluid/SimulationObjects.h"
 using namespace std;
@@ -154,7 +155,7 @@ static void buildPreconditioner(Image1d& P, const Image1f& L,
 		const Image1ub& A) {
 	double a = 0.25;
 	P.resize(A.width, A.height);
-#pragma omp parallel for
+	//Each row depends on the one below it, so the factorization is sequential.
 	for (int j = 0; j < A.height; j++) {
 		for (int i = 0; i < A.width; i++) {
 			if (A(i, j).x == static_cast<char>(ObjectType::FLUID)) {
@@ -175,7 +176,7 @@ static void applyPreconditioner(Image1f& z, const Image1f& r, const Image1d& P,
 		const Image1f& L, const Image1ub& A) {
 	Image1d q(P.width, P.height);
 	q.set(double1(0.0));
-#pragma omp parallel for
+// L q = r, which is a sequential sweep
 	for (int j = 0; j < q.height; j++) {
 		for (int i = 0; i < q.width; i++) {
 			if (A(i, j).x == static_cast<char>(ObjectType::FLUID)) {
@@ -189,8 +190,8 @@ static void applyPreconditioner(Image1f& z, const Image1f& r, const Image1d& P,
 		}
 	}
 // L^T z = q
-	for (int i = q.width - 1; i >= 0; i--) {
-		for (int j = q.height - 1; j >= 0; j--) {
+	for (int j = q.height - 1; j >= 0; j--) {
+		for (int i = q.width - 1; i >= 0; i--) {
 			if (A(i, j).x == static_cast<char>(ObjectType::FLUID)) {
 				double right = A_ref(A, i, j, i + 1, j) * P_ref(P, A, i, j)
 						* P_ref(z, A, i + 1, j);
@@ -203,9 +204,213 @@ static void applyPreconditioner(Image1f& z, const Image1f& r, const Image1d& P,
 	}
 }
 
+/*
+ Geometric multigrid for the masked, variable-coefficient system that
+ compute_Ax applies. Each level stores the diagonal and the couplings to
+ the east and north neighbors, so (Ax)_c = diag_c x_c - sum w_cn x_n.
+ Coarse levels are built by Galerkin aggregation of 2x2 blocks, which keeps
+ the operator symmetric and the fluid mask exact without re-labeling cells.
+ */
+struct LaplaceLevel {
+	int width;
+	int height;
+	std::vector<float> diag;
+	std::vector<float> east;
+	std::vector<float> north;
+	std::vector<float> x;
+	std::vector<float> b;
+	std::vector<float> r;
+	void resize(int w, int h) {
+		width = w;
+		height = h;
+		size_t N = (size_t) w * h;
+		diag.assign(N, 0.0f);
+		east.assign(N, 0.0f);
+		north.assign(N, 0.0f);
+		x.assign(N, 0.0f);
+		b.assign(N, 0.0f);
+		r.assign(N, 0.0f);
+	}
+	inline float neighborSum(int i, int j, const std::vector<float>& v) const {
+		size_t c = i + (size_t) j * width;
+		float sum = 0.0f;
+		if (i > 0)
+			sum += east[c - 1] * v[c - 1];
+		if (i < width - 1)
+			sum += east[c] * v[c + 1];
+		if (j > 0)
+			sum += north[c - width] * v[c - width];
+		if (j < height - 1)
+			sum += north[c] * v[c + width];
+		return sum;
+	}
+};
+static const int MULTIGRID_SMOOTH_ITERATIONS = 2;
+static const int MULTIGRID_COARSEST_SIZE = 8;
+static const int MULTIGRID_COARSEST_ITERATIONS = 32;
+static void buildFinestLevel(LaplaceLevel& level, const Image1ub& A,
+		const Image1f& L, float voxelSize) {
+	float h2 = voxelSize * voxelSize;
+	level.resize(A.width, A.height);
+#pragma omp parallel for
+	for (int j = 0; j < A.height; j++) {
+		for (int i = 0; i < A.width; i++) {
+			if (A(i, j).x != static_cast<char>(ObjectType::FLUID))
+				continue;
+			size_t c = i + (size_t) j * A.width;
+			//Out of bounds and wall neighbors reflect the center value, as in x_ref.
+			float diag = 4.0f;
+			int q[][2] = { { i - 1, j }, { i + 1, j }, { i, j - 1 }, { i, j + 1 } };
+			for (int m = 0; m < 4; m++) {
+				int qi = q[m][0];
+				int qj = q[m][1];
+				if (qi < 0 || qi > A.width - 1 || qj < 0 || qj > A.height - 1
+						|| A(qi, qj).x == static_cast<char>(ObjectType::WALL)) {
+					diag -= 1.0f;
+				} else if (A(qi, qj).x == static_cast<char>(ObjectType::AIR)) {
+					diag -= L(qi, qj).x / std::min(1.0e-6f, L(i, j).x);
+				}
+			}
+			level.diag[c] = diag / h2;
+			if (i < A.width - 1
+					&& A(i + 1, j).x == static_cast<char>(ObjectType::FLUID))
+				level.east[c] = 1.0f / h2;
+			if (j < A.height - 1
+					&& A(i, j + 1).x == static_cast<char>(ObjectType::FLUID))
+				level.north[c] = 1.0f / h2;
+		}
+	}
+}
+static void buildCoarseLevel(LaplaceLevel& coarse, const LaplaceLevel& fine) {
+	coarse.resize((fine.width + 1) / 2, (fine.height + 1) / 2);
+#pragma omp parallel for
+	for (int J = 0; J < coarse.height; J++) {
+		for (int I = 0; I < coarse.width; I++) {
+			float diag = 0.0f, east = 0.0f, north = 0.0f;
+			for (int b = 0; b < 2; b++) {
+				int j = 2 * J + b;
+				if (j >= fine.height)
+					break;
+				for (int a = 0; a < 2; a++) {
+					int i = 2 * I + a;
+					if (i >= fine.width)
+						break;
+					size_t c = i + (size_t) j * fine.width;
+					diag += fine.diag[c];
+					//Couplings inside the block are counted twice by the Galerkin product.
+					if (a == 0)
+						diag -= 2.0f * fine.east[c];
+					else
+						east += fine.east[c];
+					if (b == 0)
+						diag -= 2.0f * fine.north[c];
+					else
+						north += fine.north[c];
+				}
+			}
+			size_t C = I + (size_t) J * coarse.width;
+			coarse.diag[C] = diag;
+			coarse.east[C] = (I < coarse.width - 1) ? east : 0.0f;
+			coarse.north[C] = (J < coarse.height - 1) ? north : 0.0f;
+		}
+	}
+}
+static void buildMultigrid(std::vector<LaplaceLevel>& levels, const Image1ub& A,
+		const Image1f& L, float voxelSize) {
+	levels.clear();
+	levels.push_back(LaplaceLevel());
+	buildFinestLevel(levels.back(), A, L, voxelSize);
+	while (std::max(levels.back().width, levels.back().height)
+			> MULTIGRID_COARSEST_SIZE) {
+		LaplaceLevel coarse;
+		buildCoarseLevel(coarse, levels.back());
+		levels.push_back(std::move(coarse));
+	}
+}
+//Gauss-Seidel on one color of the checkerboard. Cells of a color only couple to the other color, so rows update in parallel.
+static void smoothRedBlack(LaplaceLevel& level, int color) {
+#pragma omp parallel for
+	for (int j = 0; j < level.height; j++) {
+		for (int i = (j + color) % 2; i < level.width; i += 2) {
+			size_t c = i + (size_t) j * level.width;
+			if (level.diag[c] > 0.0f) {
+				level.x[c] = (level.b[c] + level.neighborSum(i, j, level.x))
+						/ level.diag[c];
+			}
+		}
+	}
+}
+//Pre-smoothing sweeps red then black and post-smoothing black then red, so the cycle is a symmetric preconditioner.
+static void vcycle(std::vector<LaplaceLevel>& levels, int l) {
+	LaplaceLevel& level = levels[l];
+	std::fill(level.x.begin(), level.x.end(), 0.0f);
+	if (l == (int) levels.size() - 1) {
+		for (int k = 0; k < MULTIGRID_COARSEST_ITERATIONS; k++) {
+			smoothRedBlack(level, 0);
+			smoothRedBlack(level, 1);
+			smoothRedBlack(level, 1);
+			smoothRedBlack(level, 0);
+		}
+		return;
+	}
+	for (int k = 0; k < MULTIGRID_SMOOTH_ITERATIONS; k++) {
+		smoothRedBlack(level, 0);
+		smoothRedBlack(level, 1);
+	}
+#pragma omp parallel for
+	for (int j = 0; j < level.height; j++) {
+		for (int i = 0; i < level.width; i++) {
+			size_t c = i + (size_t) j * level.width;
+			level.r[c] = (level.diag[c] > 0.0f) ?
+					level.b[c] - level.diag[c] * level.x[c]
+							+ level.neighborSum(i, j, level.x) :
+					0.0f;
+		}
+	}
+	LaplaceLevel& coarse = levels[l + 1];
+#pragma omp parallel for
+	for (int J = 0; J < coarse.height; J++) {
+		for (int I = 0; I < coarse.width; I++) {
+			float sum = 0.0f;
+			for (int j = 2 * J; j < std::min(2 * J + 2, level.height); j++) {
+				for (int i = 2 * I; i < std::min(2 * I + 2, level.width); i++) {
+					sum += level.r[i + (size_t) j * level.width];
+				}
+			}
+			coarse.b[I + (size_t) J * coarse.width] = sum;
+		}
+	}
+	vcycle(levels, l + 1);
+#pragma omp parallel for
+	for (int j = 0; j < level.height; j++) {
+		for (int i = 0; i < level.width; i++) {
+			size_t c = i + (size_t) j * level.width;
+			if (level.diag[c] > 0.0f)
+				level.x[c] += coarse.x[i / 2 + (size_t) (j / 2) * coarse.width];
+		}
+	}
+	for (int k = 0; k < MULTIGRID_SMOOTH_ITERATIONS; k++) {
+		smoothRedBlack(level, 1);
+		smoothRedBlack(level, 0);
+	}
+}
+static void applyMultigrid(Image1f& z, const Image1f& r,
+		std::vector<LaplaceLevel>& levels) {
+	LaplaceLevel& fine = levels[0];
+#pragma omp parallel for
+	for (int n = 0; n < (int) r.size(); n++) {
+		fine.b[n] = r[n].x;
+	}
+	vcycle(levels, 0);
+#pragma omp parallel for
+	for (int n = 0; n < (int) z.size(); n++) {
+		z[n].x = fine.x[n];
+	}
+}
 // Conjugate Gradient Method
-static void conjGrad(const Image1ub& A, const Image1d& P, const Image1f& L,
-		Image1f& x, const Image1f& b, float voxelSize) {
+static int conjGrad(const Image1ub& A, const Image1f& L, Image1f& x,
+		const Image1f& b, float voxelSize,
+		const std::function<void(Image1f& z, const Image1f& r)>& precondition) {
 // Pre-allocate Memory
 	Image1f r(x.width, x.height);
 	Image1f z(x.width, x.height);
@@ -213,12 +418,13 @@ static void conjGrad(const Image1ub& A, const Image1d& P, const Image1f& L,
 	compute_Ax(A, L, x, z, voxelSize);                // z = applyA(x)
 	op(A, b, z, r, -1.0);                  // r = b-Ax
 	double error2_0 = product(A, r, r);    // error2_0 = r . r
-	applyPreconditioner(z, r, P, L, A);		// Apply Conditioner z = f(r)
+	precondition(z, r);						// Apply Conditioner z = f(r)
 	copy(s, z);								// s = z
 	int V = x.width*x.height;
 	double eps = 1.0e-2 * (V);
 	double a = product(A, z, r);			// a = z . r
-	for (int k = 0; k < V; k++) {
+	int k = 0;
+	for (; k < V; k++) {
 		if(error2_0==0)break;
 		compute_Ax(A, L, s, z, voxelSize);			// z = applyA(s)
 		double alpha = a / product(A, z, s);	// alpha = a/(z . s)
@@ -232,19 +438,32 @@ static void conjGrad(const Image1ub& A, const Image1d& P, const Image1f& L,
 
 		//std::cout<<k<<") Error "<<error2<<"/"<<error2_0<<std::endl;
 		if (error2 <= eps&&k>=4)
-			break;
-		applyPreconditioner(z, r, P, L, A);	// Apply Conditioner z = f(r)
+			return k + 1;
+		precondition(z, r);					// Apply Conditioner z = f(r)
 		double a2 = product(A, z, r);		// a2 = z . r
 		double beta = a2 / a;                     // beta = a2 / a
 		op(A, z, s, s, beta);				// s = z + beta*s
 		a = a2;
 	}
+	return k;
 }
 
-void SolveLaplace2d(const Image1ub& A, const Image1f& L, Image1f& x,const Image1f& b, float voxelSize) {
-	Image1d P;
-	buildPreconditioner(P, L, A);
-	conjGrad(A, P, L, x, b, voxelSize);
+int SolveLaplace2d(const Image1ub& A, const Image1f& L, Image1f& x,const Image1f& b, float voxelSize, LaplacePreconditioner preconditioner) {
+	if (preconditioner == LaplacePreconditioner::Multigrid) {
+		std::vector<LaplaceLevel> levels;
+		buildMultigrid(levels, A, L, voxelSize);
+		return conjGrad(A, L, x, b, voxelSize,
+				[&](Image1f& z, const Image1f& r) {
+					applyMultigrid(z, r, levels);
+				});
+	} else {
+		Image1d P;
+		buildPreconditioner(P, L, A);
+		return conjGrad(A, L, x, b, voxelSize,
+				[&](Image1f& z, const Image1f& r) {
+					applyPreconditioner(z, r, P, L, A);
+				});
+	}
 }
 
 }
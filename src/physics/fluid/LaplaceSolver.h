@@ -26,5 +26,9 @@
 #include "physics/fluid/SimulationObjects.h"
 #include "image/AlloyImage.h"
 namespace aly {
-void SolveLaplace2d(const Image1ub& A,const Image1f& L, Image1f& x,const Image1f& b,float voxelSize);
+enum class LaplacePreconditioner {
+	IncompleteCholesky, Multigrid
+};
+//Returns the number of conjugate gradient iterations.
+int SolveLaplace2d(const Image1ub& A,const Image1f& L, Image1f& x,const Image1f& b,float voxelSize,LaplacePreconditioner preconditioner=LaplacePreconditioner::IncompleteCholesky);
 }
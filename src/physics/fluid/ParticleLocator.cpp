@@ -26,67 +26,80 @@
 #include "physics/fluid/ParticleLocator.h"
 
 #include <math.h>
+#include <atomic>
+#include <algorithm>
 using namespace std;
 namespace aly {
 ParticleLocator::ParticleLocator(int2 dims, float voxelSize) :
 		mVoxelSize(voxelSize), mGridSize(dims) {
-	cells.resize(dims.x * dims.y, FluidCell());
+	cellStart.resize(dims.x * dims.y + 1, 0);
 }
 ParticleLocator::~ParticleLocator() {
 }
-
-void ParticleLocator::update(std::vector<FluidParticlePtr>& particles) {
-	// Clear All Cells
+void ParticleLocator::bin(const FluidParticleSet& particles) {
+	int N = (int) particles.size();
+	int cellCount = mGridSize.x * mGridSize.y;
+	float scale = 1.0f / mVoxelSize;
+	particleCells.resize(N);
+	cellParticles.resize(N);
+	std::vector<std::atomic<int>> counts(cellCount);
 #pragma omp parallel for
-	for (int n = 0; n < (int) cells.size(); n++) {
-		cells[n].clear();
+	for (int c = 0; c < cellCount; c++) {
+		counts[c] = 0;
 	}
-	float scale = 1.0f / mVoxelSize;
-	// Store Into The Cells
-	for (FluidParticlePtr& p : particles) {
-		int i = clamp((int) (scale * p->mLocation[0]), 0, mGridSize[0] - 1);
-		int j = clamp((int) (scale * p->mLocation[1]), 0, mGridSize[1] - 1);
-		int k = clamp((int) (scale * p->mLocation[2]), 0, mGridSize[2] - 1);
-		getCell(i, j).push_back(p.get());
+#pragma omp parallel for
+	for (int n = 0; n < N; n++) {
+		const float2& pt = particles.mLocation[n];
+		int i = clamp((int) (scale * pt[0]), 0, mGridSize[0] - 1);
+		int j = clamp((int) (scale * pt[1]), 0, mGridSize[1] - 1);
+		int c = i + j * mGridSize.x;
+		particleCells[n] = c;
+		counts[c]++;
 	}
-}
-
-FluidCell ParticleLocator::getNeigboringWallParticles(int i, int j, int w,
-		int h) {
-	FluidCell res;
-	for (int si = max(i - w, 0); si <= min(i + w - 1, mGridSize[0] - 1); si++) {
-		for (int sj = max(j - h, 0); sj <= min(j + h - 1, mGridSize[1] - 1);
-				sj++) {
-			for (FluidParticle* p : getCell(si, sj)) {
-				res.push_back(p);
-			}
+	cellStart.resize(cellCount + 1);
+	cellStart[0] = 0;
+	for (int c = 0; c < cellCount; c++) {
+		cellStart[c + 1] = cellStart[c] + counts[c];
+		counts[c] = cellStart[c];
+	}
+#pragma omp parallel for
+	for (int n = 0; n < N; n++) {
+		cellParticles[counts[particleCells[n]]++] = n;
+	}
+	//Scattering in parallel leaves cells in arbitrary order, so sort them to keep results repeatable.
+#pragma omp parallel for schedule(dynamic,256)
+	for (int c = 0; c < cellCount; c++) {
+		if (cellStart[c + 1] - cellStart[c] > 1) {
+			std::sort(cellParticles.begin() + cellStart[c],
+					cellParticles.begin() + cellStart[c + 1]);
 		}
 	}
-	return res;
 }
-
-FluidCell ParticleLocator::getNeigboringCellParticles(int i, int j, int w,
-		int h) {
-	FluidCell res;
-	for (int si = max(i - w, 0); si <= min(i + w, mGridSize[0] - 1); si++) {
-		for (int sj = max(j - h, 0); sj <= min(j + h, mGridSize[1] - 1); sj++) {
-			for (FluidParticle* p : getCell(si, sj)) {
-				res.push_back(p);
-			}
-		}
+void ParticleLocator::update(const FluidParticleSet& particles) {
+	bin(particles);
+}
+void ParticleLocator::sort(FluidParticleSet& particles) {
+	bin(particles);
+	particles.permute(cellParticles);
+	for (int n = 0; n < (int) cellParticles.size(); n++) {
+		cellParticles[n] = n;
 	}
-	return res;
 }
 size_t ParticleLocator::getParticleCount(int i, int j) const {
-	return getCell(i, j).size();
+	int c = clamp(i, 0, mGridSize.x - 1)
+			+ clamp(j, 0, mGridSize.y - 1) * mGridSize.x;
+	return cellStart[c + 1] - cellStart[c];
 }
 
-float ParticleLocator::getLevelSetValue(int i, int j, Image1f& halfwall,
-		float density) {
+float ParticleLocator::getLevelSetValue(const FluidParticleSet& particles,
+		int i, int j, Image1f& halfwall, float density) const {
 	float accm = 0.0;
-	for (FluidParticle* p : getCell(i, j)) {
-		if (p->mObjectType == ObjectType::FLUID) {
-			accm += p->mDensity;
+	int c = clamp(i, 0, mGridSize.x - 1)
+			+ clamp(j, 0, mGridSize.y - 1) * mGridSize.x;
+	for (int k = cellStart[c]; k < cellStart[c + 1]; k++) {
+		int n = cellParticles[k];
+		if (particles.mObjectType[n] == ObjectType::FLUID) {
+			accm += particles.mDensity[n];
 		} else {
 			return 1.0;
 		}
@@ -95,30 +108,32 @@ float ParticleLocator::getLevelSetValue(int i, int j, Image1f& halfwall,
 	const float alpha = 0.2f;
 	return alpha * MAX_VOLUME - accm;
 }
-void ParticleLocator::markAsWater(Image1ub& A, Image1f& halfwall,
-		float density) {
+void ParticleLocator::markAsWater(const FluidParticleSet& particles,
+		Image1ub& A, Image1f& halfwall, float density) const {
 #pragma omp parallel for
 	for (int j = 0; j < A.height; j++) {
 		for (int i = 0; i < A.width; i++) {
 			A(i, j).x = static_cast<char>(ObjectType::AIR);
-			for (FluidParticle* p : getCell(i, j)) {
-				if (p->mObjectType == ObjectType::WALL) {
+			int c = clamp(i, 0, mGridSize.x - 1)
+					+ clamp(j, 0, mGridSize.y - 1) * mGridSize.x;
+			for (int k = cellStart[c]; k < cellStart[c + 1]; k++) {
+				if (particles.mObjectType[cellParticles[k]]
+						== ObjectType::WALL) {
 					A(i, j) = static_cast<char>(ObjectType::WALL);
 					break;
 				}
 			}
 			if (A(i, j).x != static_cast<char>(ObjectType::WALL))
 				A(i, j).x = static_cast<char>(
-						getLevelSetValue(i, j, halfwall, density) < 0.0 ?
+						getLevelSetValue(particles, i, j, halfwall, density) < 0.0 ?
 								ObjectType::FLUID : ObjectType::AIR);
 		}
 	}
 }
 void ParticleLocator::deleteAllParticles() {
-#pragma omp parallel for
-	for (int n = 0; n < (int) cells.size(); n++) {
-		cells[n].clear();
-	}
+	std::fill(cellStart.begin(), cellStart.end(), 0);
+	cellParticles.clear();
+	particleCells.clear();
 }
 
 }
@@ -30,35 +30,76 @@
 #ifndef _PARTICLE_LOCATOR_H
 #define _PARTICLE_LOCATOR_H
 namespace aly {
-typedef std::vector<FluidParticle*> FluidCell;
+/*
+ Particles are binned with a counting sort into a compressed row layout, so
+ the particles of cells (i0..i1,j) are one contiguous range of indexes.
+ The locator keeps no reference to the particle set; queries that read
+ particle attributes take the set they were binned from.
+ */
 class ParticleLocator {
 protected:
 	int2 mGridSize;
 	float mVoxelSize;
-	std::vector<FluidCell> cells;
+	std::vector<int> cellStart;
+	std::vector<int> cellParticles;
+	std::vector<int> particleCells;
+	void bin(const FluidParticleSet& particles);
+	template<class F> void forEachRange(int i0, int i1, int j0, int j1,
+			F func) const {
+		i0 = std::max(i0, 0);
+		i1 = std::min(i1, mGridSize.x - 1);
+		j0 = std::max(j0, 0);
+		j1 = std::min(j1, mGridSize.y - 1);
+		if (i0 > i1)
+			return;
+		for (int j = j0; j <= j1; j++) {
+			int start = cellStart[i0 + j * mGridSize.x];
+			int end = cellStart[i1 + 1 + j * mGridSize.x];
+			if (end > start)
+				func(&cellParticles[start], end - start);
+		}
+	}
+	template<class F> void forEachParticle(int i0, int i1, int j0, int j1,
+			F func) const {
+		forEachRange(i0, i1, j0, j1, [&](const int* indexes, int count) {
+			for (int k = 0; k < count; k++) {
+				func(indexes[k]);
+			}
+		});
+	}
 public:
 	ParticleLocator(int2 dims, float voxelSize);
 	~ParticleLocator();
-
-	void update(std::vector<FluidParticlePtr>& particles);
-	FluidCell getNeigboringWallParticles(int i, int j,int w = 1, int h = 1);
-	FluidCell getNeigboringCellParticles(int i, int j,int w = 1, int h = 1);
-	float getLevelSetValue(int i, int j, Image1f& halfwall,float density);
+	void update(const FluidParticleSet& particles);
+	//Bins particles and reorders their storage by cell, so neighbor queries read memory in order.
+	void sort(FluidParticleSet& particles);
+	//Visits particles in cells [i-w,i+w-1]x[j-h,j+h-1].
+	template<class F> void forEachWallParticle(int i, int j, int w, int h,
+			F func) const {
+		forEachParticle(i - w, i + w - 1, j - h, j + h - 1, func);
+	}
+	//Same cells as forEachWallParticle, passed as (indexes, count) runs for vectorized loops.
+	template<class F> void forEachWallRange(int i, int j, int w, int h,
+			F func) const {
+		forEachRange(i - w, i + w - 1, j - h, j + h - 1, func);
+	}
+	//Visits particles in cells [i-w,i+w]x[j-h,j+h].
+	template<class F> void forEachCellParticle(int i, int j, int w, int h,
+			F func) const {
+		forEachParticle(i - w, i + w, j - h, j + h, func);
+	}
+	float getLevelSetValue(const FluidParticleSet& particles, int i, int j,
+			Image1f& halfwall, float density) const;
 	const int2& getGridSize() {
 		return mGridSize;
 	}
 	float getVoxelSize() {
 		return mVoxelSize;
 	}
-	size_t getParticleCount(int i, int j) const ;
-	void markAsWater(Image1ub& A, Image1f& halfwall,float density);
+	size_t getParticleCount(int i, int j) const;
+	void markAsWater(const FluidParticleSet& particles, Image1ub& A,
+			Image1f& halfwall, float density) const;
 	void deleteAllParticles();
-	inline FluidCell& getCell(int i,int j){
-		return cells[clamp(i,0,mGridSize.x-1)+clamp(j,0,mGridSize.y-1)*mGridSize.x];
-	}
-	inline const FluidCell& getCell(int i,int j) const {
-		return cells[clamp(i,0,mGridSize.x-1)+clamp(j,0,mGridSize.y-1)*mGridSize.x];
-	}
 };
 }
 #endif
@@ -110,5 +110,88 @@ bool SphereObject::insideShell(float2& pt) {
 		return false;
 	}
 }
+void FluidParticleSet::clear() {
+	mLocation.clear();
+	mVelocity.clear();
+	mNormal.clear();
+	mObjectType.clear();
+	mRemoveIndicator.clear();
+	mTmp[0].clear();
+	mTmp[1].clear();
+	mMass.clear();
+	mDensity.clear();
+}
+void FluidParticleSet::reserve(size_t n) {
+	mLocation.reserve(n);
+	mVelocity.reserve(n);
+	mNormal.reserve(n);
+	mObjectType.reserve(n);
+	mRemoveIndicator.reserve(n);
+	mTmp[0].reserve(n);
+	mTmp[1].reserve(n);
+	mMass.reserve(n);
+	mDensity.reserve(n);
+}
+int FluidParticleSet::add(const float2& location, const float2& velocity,
+		ObjectType type, float mass, float density) {
+	int n = (int) mLocation.size();
+	mLocation.push_back(location);
+	mVelocity.push_back(velocity);
+	mNormal.push_back(float2(0.0f));
+	mObjectType.push_back(type);
+	mRemoveIndicator.push_back(0);
+	mTmp[0].push_back(float2(0.0f));
+	mTmp[1].push_back(float2(0.0f));
+	mMass.push_back(mass);
+	mDensity.push_back(density);
+	return n;
+}
+template<class T> void CompactParticleArray(std::vector<T>& data,
+		const std::vector<uint8_t>& remove) {
+	size_t m = 0;
+	for (size_t n = 0; n < data.size(); n++) {
+		if (!remove[n]) {
+			data[m++] = data[n];
+		}
+	}
+	data.resize(m);
+}
+void FluidParticleSet::compact() {
+	std::vector<uint8_t> remove;
+	remove.swap(mRemoveIndicator);
+	CompactParticleArray(mLocation, remove);
+	CompactParticleArray(mVelocity, remove);
+	CompactParticleArray(mNormal, remove);
+	CompactParticleArray(mObjectType, remove);
+	CompactParticleArray(mTmp[0], remove);
+	CompactParticleArray(mTmp[1], remove);
+	CompactParticleArray(mMass, remove);
+	CompactParticleArray(mDensity, remove);
+	mRemoveIndicator.assign(mLocation.size(), 0);
+}
+template<class T> void PermuteParticleArray(std::vector<T>& data,
+		const std::vector<int>& order, std::vector<T>& buffer) {
+	buffer.resize(order.size());
+#pragma omp parallel for
+	for (int n = 0; n < (int) order.size(); n++) {
+		buffer[n] = data[order[n]];
+	}
+	data.swap(buffer);
+}
+void FluidParticleSet::permute(const std::vector<int>& order) {
+	std::vector<float2> buffer2;
+	std::vector<float> buffer1;
+	std::vector<ObjectType> bufferType;
+	std::vector<uint8_t> bufferFlag;
+	PermuteParticleArray(mLocation, order, buffer2);
+	PermuteParticleArray(mVelocity, order, buffer2);
+	PermuteParticleArray(mNormal, order, buffer2);
+	PermuteParticleArray(mTmp[0], order, buffer2);
+	PermuteParticleArray(mTmp[1], order, buffer2);
+	PermuteParticleArray(mObjectType, order, bufferType);
+	PermuteParticleArray(mRemoveIndicator, order, bufferFlag);
+	PermuteParticleArray(mMass, order, buffer1);
+	PermuteParticleArray(mDensity, order, buffer1);
+}
 }
 
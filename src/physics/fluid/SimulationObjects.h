@@ -101,18 +101,34 @@ public:
 	virtual bool inside(float2& pt);
 	virtual bool insideShell(float2& pt);
 };
-struct FluidParticle {
-	float2 mLocation;
-	float2 mVelocity;
-	float2 mNormal;
-	ObjectType mObjectType;
-	//char mVisible;
-	bool mRemoveIndicator;
-	float2 mTmp[2];
-	float mMass;
-	float mDensity;
+/*
+ Particles are stored as parallel arrays so the transfer loops stream through
+ contiguous memory instead of chasing one heap object per particle.
+ */
+struct FluidParticleSet {
+	std::vector<float2> mLocation;
+	std::vector<float2> mVelocity;
+	std::vector<float2> mNormal;
+	std::vector<ObjectType> mObjectType;
+	std::vector<uint8_t> mRemoveIndicator;
+	std::vector<float2> mTmp[2];
+	std::vector<float> mMass;
+	std::vector<float> mDensity;
+	size_t size() const {
+		return mLocation.size();
+	}
+	bool empty() const {
+		return mLocation.empty();
+	}
+	void clear();
+	void reserve(size_t n);
+	int add(const float2& location, const float2& velocity, ObjectType type,
+			float mass, float density);
+	//Removes particles whose remove indicator is set, keeping the rest in order.
+	void compact();
+	//Reorders particles so that particle n becomes the old particle order[n].
+	void permute(const std::vector<int>& order);
 };
 typedef std::shared_ptr<SimulationObject> SimulationObjectPtr;
-typedef std::shared_ptr<FluidParticle> FluidParticlePtr;
 }
 #endif /* INCLUDE_FLUID_SIMULATIONOBJECTS_H_ */
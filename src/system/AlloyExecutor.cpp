@@ -0,0 +1,394 @@
+/*
+ * Copyright(C) 2015, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "system/AlloyExecutor.h"
+#include <algorithm>
+namespace aly {
+struct Executor::Pool: public std::enable_shared_from_this<Executor::Pool> {
+	struct WorkerQueue {
+		std::mutex lock;
+		std::deque<std::function<void()>> tasks[PRIORITY_COUNT];
+	};
+	struct TimedTask {
+		Clock::time_point time;
+		uint64_t order;
+		std::function<void()> func;
+		TaskPriority priority;
+		const bool* cancel;
+		//Reversed so the heap keeps the earliest task at the front.
+		bool operator<(const TimedTask& other) const {
+			return (time > other.time || (time == other.time && order > other.order));
+		}
+	};
+	struct PeriodicTask {
+		std::function<bool(uint64_t)> func;
+		std::function<void()> finish;
+		std::chrono::milliseconds period;
+		TaskPriority priority;
+		const bool* cancel;
+		uint64_t iteration = 0;
+		std::promise<void> result;
+	};
+	std::vector<std::unique_ptr<WorkerQueue>> queues;
+	std::vector<std::thread> workers;
+	std::mutex workerLock;
+	std::atomic<int> workerCount;
+	std::atomic<int> sleepingCount;
+	std::atomic<int64_t> pendingCount;
+	std::atomic<uint64_t> completedCount;
+	std::atomic<uint64_t> nextQueue;
+	std::atomic<bool> stallWatch;
+	std::atomic<bool> shutdown;
+	std::mutex sleepLock;
+	std::condition_variable sleepCondition;
+	std::thread timerThread;
+	std::mutex timerLock;
+	std::condition_variable timerCondition;
+	std::vector<TimedTask> timers;
+	uint64_t timerOrder;
+	bool cancelRequested;
+	int minWorkers;
+	int maxWorkers;
+	//Pool that owns the calling thread, so posts from inside a task stay on its deque.
+	static thread_local Pool* currentPool;
+	static thread_local int currentWorker;
+	Pool(int threads, int maxThreads);
+	void start();
+	void stop();
+	bool addWorker();
+	void workerLoop(int index);
+	void timerLoop();
+	bool pop(int index, std::function<void()>& func);
+	void post(const std::function<void()>& func, TaskPriority priority);
+	void postAt(const std::function<void()>& func, Clock::time_point time,
+			TaskPriority priority, const bool* cancel);
+	void step(const std::shared_ptr<PeriodicTask>& periodic);
+};
+thread_local Executor::Pool* Executor::Pool::currentPool = nullptr;
+thread_local int Executor::Pool::currentWorker = -1;
+Executor::Pool::Pool(int threads, int maxThreads) :
+		workerCount(0), sleepingCount(0), pendingCount(0), completedCount(0), nextQueue(
+				0), stallWatch(false), shutdown(false), timerOrder(0), cancelRequested(
+				false) {
+	int hardwareThreads = std::max(1, (int) std::thread::hardware_concurrency());
+	if (threads <= 0)
+		threads = hardwareThreads;
+	if (maxThreads <= 0)
+		maxThreads = std::max(64, 4 * hardwareThreads);
+	minWorkers = threads;
+	maxWorkers = std::max(threads, maxThreads);
+	//Queues are allocated up front so thieves never see the vector reallocate.
+	queues.resize(maxWorkers);
+	for (std::unique_ptr<WorkerQueue>& queue : queues) {
+		queue.reset(new WorkerQueue());
+	}
+	workers.reserve(maxWorkers);
+}
+void Executor::Pool::start() {
+	for (int n = 0; n < minWorkers; n++) {
+		addWorker();
+	}
+	timerThread = std::thread(&Pool::timerLoop, shared_from_this());
+}
+void Executor::Pool::stop() {
+	shutdown = true;
+	{
+		std::lock_guard<std::mutex> lockMe(sleepLock);
+		sleepCondition.notify_all();
+	}
+	{
+		std::lock_guard<std::mutex> lockMe(timerLock);
+		timerCondition.notify_all();
+	}
+	//A pool thread cannot join itself. Its own reference keeps the pool alive until it exits.
+	std::thread::id self = std::this_thread::get_id();
+	if (timerThread.joinable()) {
+		if (timerThread.get_id() == self) {
+			timerThread.detach();
+		} else {
+			timerThread.join();
+		}
+	}
+	std::lock_guard<std::mutex> lockMe(workerLock);
+	for (std::thread& worker : workers) {
+		if (worker.get_id() == self) {
+			worker.detach();
+		} else if (worker.joinable()) {
+			worker.join();
+		}
+	}
+}
+Executor::Executor(int threads, int maxThreads) :
+		pool(std::make_shared<Pool>(threads, maxThreads)) {
+	pool->start();
+}
+Executor::~Executor() {
+	pool->stop();
+}
+std::shared_ptr<Executor>& Executor::getDefaultExecutor() {
+	static std::shared_ptr<Executor> executor = std::shared_ptr<Executor>(
+			new Executor());
+	return executor;
+}
+int Executor::getWorkerCount() const {
+	return pool->workerCount;
+}
+bool Executor::isWorkerThread() const {
+	return (Pool::currentPool == pool.get());
+}
+bool Executor::Pool::addWorker() {
+	std::lock_guard<std::mutex> lockMe(workerLock);
+	int index = workerCount;
+	if (index >= maxWorkers || shutdown)
+		return false;
+	workerCount++;
+	workers.push_back(std::thread(&Pool::workerLoop, shared_from_this(), index));
+	return true;
+}
+void Executor::post(const std::function<void()>& func, TaskPriority priority) {
+	pool->post(func, priority);
+}
+void Executor::Pool::post(const std::function<void()>& func,
+		TaskPriority priority) {
+	if (shutdown)
+		return;
+	int p = std::min(std::max((int) priority, 0), PRIORITY_COUNT - 1);
+	int index =
+			(currentPool == this) ?
+					currentWorker : (int) (nextQueue++ % (uint64_t) workerCount.load());
+	{
+		WorkerQueue& queue = *queues[index];
+		std::lock_guard<std::mutex> lockMe(queue.lock);
+		queue.tasks[p].push_back(func);
+	}
+	pendingCount++;
+	if (sleepingCount > 0) {
+		std::lock_guard<std::mutex> lockMe(sleepLock);
+		sleepCondition.notify_one();
+	}
+	//Let the timer watch for workers that are all stuck in long tasks.
+	if (!stallWatch.load() && !stallWatch.exchange(true)) {
+		std::lock_guard<std::mutex> lockMe(timerLock);
+		timerCondition.notify_one();
+	}
+}
+void Executor::postAt(const std::function<void()>& func, Clock::time_point time,
+		TaskPriority priority, const bool* cancel) {
+	pool->postAt(func, time, priority, cancel);
+}
+void Executor::Pool::postAt(const std::function<void()>& func,
+		Clock::time_point time, TaskPriority priority, const bool* cancel) {
+	if (shutdown)
+		return;
+	std::lock_guard<std::mutex> lockMe(timerLock);
+	TimedTask timed;
+	timed.time = time;
+	timed.order = timerOrder++;
+	timed.func = func;
+	timed.priority = priority;
+	timed.cancel = cancel;
+	bool earliest = timers.empty() || time < timers.front().time;
+	timers.push_back(std::move(timed));
+	std::push_heap(timers.begin(), timers.end());
+	if (earliest)
+		timerCondition.notify_one();
+}
+void Executor::notifyCanceled() {
+	std::lock_guard<std::mutex> lockMe(pool->timerLock);
+	pool->cancelRequested = true;
+	pool->timerCondition.notify_one();
+}
+bool Executor::Pool::pop(int index, std::function<void()>& func) {
+	if (pendingCount <= 0)
+		return false;
+	const int count = workerCount;
+	for (int p = 0; p < PRIORITY_COUNT; p++) {
+		{
+			WorkerQueue& queue = *queues[index];
+			std::lock_guard<std::mutex> lockMe(queue.lock);
+			if (!queue.tasks[p].empty()) {
+				func = std::move(queue.tasks[p].front());
+				queue.tasks[p].pop_front();
+				return true;
+			}
+		}
+		for (int n = 1; n < count; n++) {
+			WorkerQueue& victim = *queues[(index + n) % count];
+			std::lock_guard<std::mutex> lockMe(victim.lock);
+			if (!victim.tasks[p].empty()) {
+				func = std::move(victim.tasks[p].back());
+				victim.tasks[p].pop_back();
+				return true;
+			}
+		}
+	}
+	return false;
+}
+void Executor::Pool::workerLoop(int index) {
+	currentPool = this;
+	currentWorker = index;
+	std::function<void()> func;
+	while (!shutdown) {
+		if (pop(index, func)) {
+			pendingCount--;
+			try {
+				func();
+			} catch (...) {
+
+			}
+			func = nullptr;
+			completedCount++;
+		} else {
+			std::unique_lock<std::mutex> lockMe(sleepLock);
+			sleepingCount++;
+			sleepCondition.wait(lockMe, [this] {
+				return (pendingCount > 0 || shutdown);
+			});
+			sleepingCount--;
+		}
+	}
+}
+void Executor::Pool::timerLoop() {
+	const std::chrono::milliseconds STALL_INTERVAL(20);
+	uint64_t lastCompleted = completedCount;
+	Clock::time_point lastProgress = Clock::now();
+	std::vector<TimedTask> ready;
+	std::unique_lock<std::mutex> lockMe(timerLock);
+	while (!shutdown) {
+		Clock::time_point now = Clock::now();
+		if (cancelRequested) {
+			cancelRequested = false;
+			auto mid = std::partition(timers.begin(), timers.end(),
+					[](const TimedTask& timed) {
+						return (timed.cancel == nullptr || !*timed.cancel);
+					});
+			for (auto iter = mid; iter != timers.end(); iter++) {
+				ready.push_back(std::move(*iter));
+			}
+			timers.erase(mid, timers.end());
+			std::make_heap(timers.begin(), timers.end());
+		}
+		while (!timers.empty() && timers.front().time <= now) {
+			std::pop_heap(timers.begin(), timers.end());
+			ready.push_back(std::move(timers.back()));
+			timers.pop_back();
+		}
+		if (ready.size() > 0) {
+			lockMe.unlock();
+			for (TimedTask& timed : ready) {
+				post(timed.func, timed.priority);
+			}
+			ready.clear();
+			lockMe.lock();
+			continue;
+		}
+		//Queued work with no task finishing and nobody asleep means every worker is stuck in a long task.
+		uint64_t completed = completedCount;
+		if (completed != lastCompleted || pendingCount <= 0 || sleepingCount > 0) {
+			lastCompleted = completed;
+			lastProgress = now;
+		} else if (now - lastProgress >= STALL_INTERVAL) {
+			addWorker();
+			lastProgress = now;
+		}
+		//Cleared before pendingCount is read so a concurrent post either sees the flag down or is seen here.
+		stallWatch = false;
+		Clock::time_point wakeTime =
+				timers.empty() ? now + std::chrono::seconds(1) : timers.front().time;
+		if (pendingCount > 0)
+			wakeTime = std::min(wakeTime, now + STALL_INTERVAL);
+		timerCondition.wait_until(lockMe, wakeTime);
+	}
+}
+std::future<void> Executor::schedule(const std::function<void()>& func,
+		std::chrono::milliseconds delay, TaskPriority priority,
+		const bool* cancel, const std::function<void()>& onCancel) {
+	std::shared_ptr<std::promise<void>> result = std::make_shared<
+			std::promise<void>>();
+	std::future<void> future = result->get_future();
+	postAt([=]() {
+		try {
+			if (cancel != nullptr && *cancel) {
+				if (onCancel)
+					onCancel();
+			} else if (func) {
+				func();
+			}
+			result->set_value();
+		} catch (...) {
+			result->set_exception(std::current_exception());
+		}
+	}, Clock::now() + delay, priority, cancel);
+	return future;
+}
+std::future<void> Executor::schedulePeriodic(
+		const std::function<bool(uint64_t)>& func,
+		std::chrono::milliseconds period, TaskPriority priority,
+		const bool* cancel, const std::function<void()>& finish) {
+	std::shared_ptr<Pool::PeriodicTask> periodic = std::make_shared<
+			Pool::PeriodicTask>();
+	periodic->func = func;
+	periodic->finish = finish;
+	periodic->period = period;
+	periodic->priority = priority;
+	periodic->cancel = cancel;
+	std::future<void> future = periodic->result.get_future();
+	Pool* owner = pool.get();
+	pool->post([owner, periodic]() {
+		owner->step(periodic);
+	}, priority);
+	return future;
+}
+void Executor::Pool::step(const std::shared_ptr<PeriodicTask>& periodic) {
+	Clock::time_point start = Clock::now();
+	const bool* cancel = periodic->cancel;
+	std::exception_ptr error;
+	bool more = (cancel == nullptr || !*cancel);
+	if (more && periodic->func) {
+		try {
+			more = periodic->func(periodic->iteration++);
+		} catch (...) {
+			error = std::current_exception();
+			more = false;
+		}
+	}
+	if (more && (cancel == nullptr || !*cancel) && !shutdown) {
+		std::shared_ptr<PeriodicTask> next = periodic;
+		postAt([this, next]() {
+			step(next);
+		}, start + periodic->period, periodic->priority, cancel);
+		return;
+	}
+	if (periodic->finish) {
+		try {
+			periodic->finish();
+		} catch (...) {
+			if (!error)
+				error = std::current_exception();
+		}
+	}
+	if (error) {
+		periodic->result.set_exception(error);
+	} else {
+		periodic->result.set_value();
+	}
+}
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright(C) 2015, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef ALLOYEXECUTOR_H_
+#define ALLOYEXECUTOR_H_
+#include <thread>
+#include <functional>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <future>
+#include <memory>
+namespace aly {
+bool SANITY_CHECK_EXECUTOR();
+enum class TaskPriority {
+	High = 0, Normal = 1, Low = 2
+};
+/*
+ Pool of worker threads shared by WorkerTask, RecurrentTask, TimerTask and
+ anything else that needs background work, so tasks no longer pay for a
+ thread each. Every worker owns a deque per priority. Workers take their own
+ tasks from the front and idle workers steal from the back of other deques.
+ Cancellation tokens are plain bool flags, the same ones handed out by
+ WorkerTask::isCanceledPtr(). Delayed and periodic tasks wait on one timer
+ thread, which also adds a worker when queued work makes no progress because
+ every worker is blocked in a long task. Destroying the Executor stops the
+ pool. A pool thread that drops the last reference is detached and frees the
+ pool when it exits.
+ */
+class Executor {
+public:
+	typedef std::chrono::steady_clock Clock;
+	static const int PRIORITY_COUNT = 3;
+protected:
+	//Worker state. Every pool thread holds a reference, so a task may release the last Executor.
+	struct Pool;
+	std::shared_ptr<Pool> pool;
+public:
+	//Defaults to one worker per hardware thread, growing to at most maxThreads under stalls.
+	Executor(int threads = 0, int maxThreads = 0);
+	Executor(const Executor&) = delete;
+	Executor& operator=(const Executor&) = delete;
+	~Executor();
+	static std::shared_ptr<Executor>& getDefaultExecutor();
+	int getWorkerCount() const;
+	bool isWorkerThread() const;
+	//Queues func. Calls from a worker push onto that worker's own deque.
+	void post(const std::function<void()>& func, TaskPriority priority =
+			TaskPriority::Normal);
+	//Queues func at the given time, or as soon as *cancel is set and notifyCanceled() is called.
+	void postAt(const std::function<void()>& func, Clock::time_point time,
+			TaskPriority priority = TaskPriority::Normal,
+			const bool* cancel = nullptr);
+	//Wakes the timer so delayed tasks whose token was set are released early.
+	void notifyCanceled();
+	/*
+	 Runs func on a worker. The future holds its result or exception. If *cancel
+	 is set before func starts, func is dropped and the future reports
+	 std::future_errc::broken_promise.
+	 */
+	template<class F> std::future<typename std::result_of<F()>::type> submit(
+			F func, TaskPriority priority = TaskPriority::Normal,
+			const bool* cancel = nullptr) {
+		typedef typename std::result_of<F()>::type R;
+		std::shared_ptr<std::packaged_task<R()>> task = std::make_shared<
+				std::packaged_task<R()>>(func);
+		std::future<R> result = task->get_future();
+		post([task, cancel]() {
+			if (cancel == nullptr || !*cancel) {
+				(*task)();
+			}
+		}, priority);
+		return result;
+	}
+	//Runs func after delay, or onCancel instead if *cancel is set first.
+	std::future<void> schedule(const std::function<void()>& func,
+			std::chrono::milliseconds delay, TaskPriority priority =
+					TaskPriority::Normal, const bool* cancel = nullptr,
+			const std::function<void()>& onCancel = nullptr);
+	/*
+	 Runs func(iteration) every period, measured from the start of one iteration
+	 to the next, until it returns false, throws, or *cancel is set. Workers are
+	 free between iterations. finish runs on a worker after the last iteration and
+	 before the future becomes ready.
+	 */
+	std::future<void> schedulePeriodic(const std::function<bool(uint64_t)>& func,
+			std::chrono::milliseconds period, TaskPriority priority =
+					TaskPriority::Normal, const bool* cancel = nullptr,
+			const std::function<void()>& finish = nullptr);
+};
+inline std::shared_ptr<Executor>& AlloyDefaultExecutor() {
+	return Executor::getDefaultExecutor();
+}
+typedef std::shared_ptr<Executor> ExecutorPtr;
+}
+#endif /* ALLOYEXECUTOR_H_ */
@@ -8,6 +8,7 @@
  */
 #include "system/AlloyMemMappedFile.h"
 #include "system/AlloyFileUtil.h"
+#include <algorithm>
 #ifdef ALY_WINDOWS
 	#include <windows.h>
 #else
@@ -100,6 +101,32 @@ namespace aly
         mapped_size_ = 0;
     }
 
+    void BaseMemMapFile::prefetch(size_t offset, size_t size) const
+    {
+        if (! data_ || offset >= mapped_size_) return;
+        size = std::min(size, mapped_size_ - offset);
+	#ifndef ALY_WINDOWS
+        size_t page = granularity_;
+        size_t start = (size_t)(data_ + offset) / page * page;
+        size_t end = (size_t)(data_ + offset + size);
+        ::madvise((void*)start, end - start, MADV_WILLNEED);
+    #endif
+    }
+    void BaseMemMapFile::release(size_t offset, size_t size) const
+    {
+        if (! data_ || offset >= mapped_size_) return;
+        size = std::min(size, mapped_size_ - offset);
+        size_t page = granularity_;
+        //Only whole pages inside the range are dropped.
+        size_t start = ((size_t)(data_ + offset) + page - 1) / page * page;
+        size_t end = (size_t)(data_ + offset + size) / page * page;
+        if (end <= start) return;
+	#ifdef ALY_WINDOWS
+        ::VirtualUnlock((void*)start, end - start);
+    #else
+        ::madvise((void*)start, end - start, MADV_DONTNEED);
+    #endif
+    }
     size_t BaseMemMapFile::query_file_size_()
     {
 	#ifdef ALY_WINDOWS
@@ -29,6 +29,9 @@ namespace aly
         size_t getFileSize() const { return file_size_; }
         void unmap();
         void close();
+        //Paging hints for [offset, offset+size) of the mapped range.
+        void prefetch(size_t offset, size_t size) const;
+        void release(size_t offset, size_t size) const;
         bool isOpen() const
         {
             return file_handle_ !=
@@ -23,12 +23,12 @@
 #include "ui/AlloyWorker.h"
 namespace aly {
 WorkerTask::WorkerTask(const std::function<void()>& func) :
-		executionTask(func), endTask() {
+		executor(AlloyDefaultExecutor()), executionTask(func), endTask() {
 
 }
 WorkerTask::WorkerTask(const std::function<void()>& func,
 		const std::function<void()>& end) :
-		executionTask(func), endTask(end) {
+		executor(AlloyDefaultExecutor()), executionTask(func), endTask(end) {
 
 }
 bool WorkerTask::isRunning() const {
@@ -43,7 +43,6 @@ bool WorkerTask::isComplete() const {
 }
 void WorkerTask::task() {
 	running = true;
-	requestCancel = false;
 	if (executionTask) {
 		try {
 			executionTask();
@@ -58,6 +57,9 @@ void WorkerTask::task() {
 	requestCancel = false;
 	complete = true;
 }
+std::future<void> WorkerTask::launch() {
+	return executor->submit([this] {task();}, priority, &requestCancel);
+}
 void WorkerTask::done() {
 	if (endTask)
 		endTask();
@@ -65,13 +67,15 @@ void WorkerTask::done() {
 bool WorkerTask::execute(bool block) {
 	if (stateChange.try_lock()) {
 		if (block) {
+			requestCancel = false;
 			task();
 		} else {
-			if (workerThread.joinable()) {
+			if (pending.valid()) {
 				stateChange.unlock();
 				return false;
 			}
-			workerThread = std::thread(&WorkerTask::task, this);
+			requestCancel = false;
+			pending = launch();
 		}
 		stateChange.unlock();
 		return true;
@@ -84,17 +88,15 @@ WorkerTask::~WorkerTask() {
 }
 bool WorkerTask::cancel(bool block) {
 	if (stateChange.try_lock()) {
-		if (block) {
-			if (workerThread.joinable()) {
-				if (!requestCancel) {
-					requestCancel = true;
-					workerThread.join();
-				}
-			} else {
-				stateChange.unlock();
-				return true;
+		if (pending.valid()) {
+			requestCancel = true;
+			executor->notifyCanceled();
+			if (block) {
+				//A task canceled before it started is dropped, which leaves a broken promise.
+				pending.wait();
+				pending = std::future<void>();
 			}
-		} else {
+		} else if (!block) {
 			requestCancel = true;
 		}
 		stateChange.unlock();
@@ -115,19 +117,41 @@ RecurrentTask::RecurrentTask(const std::function<bool(uint64_t)>& func,
 				timeout) {
 
 }
-
+RecurrentTask::~RecurrentTask() {
+	cancel();
+}
+bool RecurrentTask::iterate(uint64_t iteration) {
+	running = true;
+	if (recurrentTask) {
+		try {
+			return recurrentTask(iteration);
+		} catch (std::exception&) {
+			return false;
+		}
+	}
+	return true;
+}
+void RecurrentTask::finish() {
+	if (!requestCancel) {
+		done();
+	}
+	running = false;
+	requestCancel = false;
+	complete = true;
+}
+std::future<void> RecurrentTask::launch() {
+	return executor->schedulePeriodic([this](uint64_t iteration) {
+		return iterate(iteration);
+	}, std::chrono::milliseconds(aly::max(0L, timeout)), priority,
+			&requestCancel, [this] {finish();});
+}
+//Blocking loop used by execute(true).
 void RecurrentTask::step() {
 	uint64_t iter = 0;
 	while (!requestCancel) {
 		auto currentTime = std::chrono::steady_clock::now();
-		if (recurrentTask) {
-			try {
-				if (!recurrentTask(iter++))
-					break;
-			} catch (std::exception&) {
-				break;
-			}
-		}
+		if (!iterate(iter++))
+			break;
 		if (requestCancel)
 			break;
 		auto nextTime = std::chrono::steady_clock::now();
@@ -146,21 +170,18 @@ TimerTask::TimerTask(const std::function<void()>& successFunc,
 				samplingTime) {
 
 }
-
-void TimerTask::task() {
+TimerTask::~TimerTask() {
+	cancel();
+}
+std::future<void> TimerTask::launch() {
 	running = true;
-	requestCancel = false;
 	complete = false;
-	auto currentTime = std::chrono::steady_clock::now();
-	while (!requestCancel) {
-		std::this_thread::sleep_for(std::chrono::milliseconds(samplingTime));
-		auto nextTime = std::chrono::steady_clock::now();
-		long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-				nextTime - currentTime).count();
-		if (ms >= timeout)
-			break;
-	}
-	if (requestCancel) {
+	return executor->schedule([this] {fire(false);},
+			std::chrono::milliseconds(aly::max(0L, timeout)), priority,
+			&requestCancel, [this] {fire(true);});
+}
+void TimerTask::fire(bool canceled) {
+	if (canceled) {
 		if (endTask)
 			endTask();
 		complete = false;
@@ -176,5 +197,18 @@ void TimerTask::task() {
 	running = false;
 	requestCancel = false;
 }
+void TimerTask::task() {
+	running = true;
+	complete = false;
+	auto currentTime = std::chrono::steady_clock::now();
+	while (!requestCancel) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(samplingTime));
+		auto nextTime = std::chrono::steady_clock::now();
+		long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+				nextTime - currentTime).count();
+		if (ms >= timeout)
+			break;
+	}
+	fire(requestCancel);
+}
 }
-
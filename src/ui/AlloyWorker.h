@@ -25,17 +25,26 @@
 #include <functional>
 #include <chrono>
 #include <mutex>
+#include "system/AlloyExecutor.h"
 namespace aly {
+/*
+ Handle to a task that runs on the shared executor instead of a thread of its
+ own. execute(true) still runs the task on the calling thread.
+ */
 class WorkerTask {
 protected:
-	std::thread workerThread;
+	ExecutorPtr executor;
+	std::future<void> pending;
 	std::mutex stateChange;
 	const std::function<void()> executionTask;
 	const std::function<void()> endTask;
+	TaskPriority priority = TaskPriority::Normal;
 	bool running = false;
 	bool complete = false;
 	bool requestCancel = false;
 	virtual void task();
+	//Queues the task on the executor. Scheduled tasks override this.
+	virtual std::future<void> launch();
 	void done();
 public:
 	bool isRunning() const;
@@ -44,19 +53,29 @@ public:
 		return &requestCancel;
 	}
 	bool isComplete() const;
-
+	void setPriority(TaskPriority p) {
+		priority = p;
+	}
+	TaskPriority getPriority() const {
+		return priority;
+	}
 	WorkerTask(const std::function<void()>& func);
 	WorkerTask(const std::function<void()>& func, const std::function<void()>& end);
 	bool execute(bool block=false);
 	bool cancel(bool block=true);
 	virtual ~WorkerTask();
 };
+//Calls func every timeout milliseconds. Workers are free between iterations.
 class RecurrentTask: public WorkerTask {
 protected:
 	const std::function<bool(uint64_t iteration)> recurrentTask;
 	long timeout;
 	void step();
+	bool iterate(uint64_t iteration);
+	void finish();
+	virtual std::future<void> launch() override;
 public:
+	//Takes effect on the next execute().
 	void setTimeout(long milliseconds) {
 		timeout = milliseconds;
 	}
@@ -64,12 +83,17 @@ public:
 			long milliseconds);
 	RecurrentTask(const std::function<bool(uint64_t iteration)>& func,
 			const std::function<void()>& end, long milliseconds);
+	virtual ~RecurrentTask();
 };
+//Calls successFunc after timeout milliseconds, or failureFunc if canceled first.
 class TimerTask: public WorkerTask {
 protected:
 	long timeout;
+	//Polling interval for execute(true). Queued timers are woken by cancel() instead.
 	long samplingTime;
 	virtual void task() override;
+	void fire(bool canceled);
+	virtual std::future<void> launch() override;
 public:
 	void setTimeout(long milliseconds) {
 		timeout = milliseconds;
@@ -77,6 +101,7 @@ public:
 	TimerTask(const std::function<void()>& successFunc,
 			const std::function<void()>& failureFunc, long milliseconds,
 			long samplingTime);
+	virtual ~TimerTask();
 };
 typedef std::shared_ptr<WorkerTask> WorkerTaskPtr;
 typedef std::shared_ptr<RecurrentTask> RecurrentTaskPtr;
@@ -19,49 +19,58 @@
  * THE SOFTWARE.
  */
 #include "vision/ActiveManifold2D.h"
+#include <omp.h>
 
 namespace aly {
 
 void ActiveManifold2D::rebuildNarrowBand() {
-	activeList.clear();
-	for (int band = 1; band <= maxLayers; band++) {
+	const float maxValue = maxLayers + 1.0f;
+	band.resize(initialLevelSet.dimensions(), 3, MAX_DISTANCE + 0.5f);
+	band.build([this](const int2& pos) {
+		return (std::abs(initialLevelSet(pos.x, pos.y).x) <= MAX_DISTANCE);
+	}, [this, maxValue](const int2& pos) {
+		return clamp(initialLevelSet(pos.x, pos.y).x, -maxValue, maxValue);
+	});
+	band.flatten(activeList);
+}
+void ActiveManifold2D::copyChannel(int from, int to) {
 #pragma omp parallel for
-		for (int i = 0; i < (int) activeList.size(); i++) {
-			int2 pos = activeList[i];
-			updateDistanceField(pos.x, pos.y, band);
-		}
-	}
-	for (int j = 0; j < swapLevelSet.height; j++) {
-		for (int i = 0; i < swapLevelSet.width; i++) {
-			if (std::abs(swapLevelSet(i, j)) <= MAX_DISTANCE) {
-				activeList.push_back(int2(i, j));
-			}
+	for (int s = 0; s < (int) band.getTileCount(); s++) {
+		const float* in = band.getTileValues(s, from);
+		float* out = band.getTileValues(s, to);
+#pragma omp simd
+		for (int l = 0; l < NarrowBand2D::TILE_VOXELS; l++) {
+			out[l] = in[l];
 		}
 	}
-	deltaLevelSet.clear();
-	deltaLevelSet.resize(activeList.size(), 0.0f);
 }
-void ActiveManifold2D::plugLevelSet(int i, int j, size_t index) {
-	float v11;
-	float v01;
-	float v12;
-	float v10;
-	float v21;
-	v11 = levelSet(i, j);
-	float sgn = sign(v11);
-	v11 = sgn * v11;
-	v01 = sgn * levelSet(i - 1, j);
-	v12 = sgn * levelSet(i, j + 1);
-	v10 = sgn * levelSet(i, j - 1);
-	v21 = sgn * levelSet(i + 1, j);
-	if (v11 > 0 && v11 < 0.5f && v01 > 0 && v12 > 0 && v10 > 0 && v21 > 0) {
-		levelSet(i, j) = sgn * MAX_DISTANCE;
+void ActiveManifold2D::plugLevelSet(int slot, const float* v) {
+	const float maxDistance = MAX_DISTANCE;
+	float* out = band.getTileValues(slot, DELTA);
+	uint8_t sel[NarrowBand2D::TILE_VOXELS];
+	selectVoxels(slot, [](float val) {return true;}, sel);
+	for (int y = 0; y < NarrowBand2D::TILE_SIZE; y++) {
+#pragma omp simd
+		for (int x = 0; x < NarrowBand2D::TILE_SIZE; x++) {
+			int l = x + y * NarrowBand2D::TILE_SIZE;
+			int c = PaddedIndex(x, y);
+			float v11 = v[c];
+			//A zero pixel never plugs, so the sign only has to separate the halves.
+			float sgn = (v11 > 0) ? 1.0f : -1.0f;
+			float plugged = (v11 > 0) ? maxDistance : -maxDistance;
+			float s11 = sgn * v11;
+			bool plug = (s11 > 0) & (s11 < 0.5f) & (sgn * v[c - PX] > 0)
+					& (sgn * v[c + PY] > 0) & (sgn * v[c - PY] > 0)
+					& (sgn * v[c + PX] > 0);
+			float prev = out[l];
+			out[l] = ((sel[l] != 0) & plug) ? plugged : prev;
+		}
 	}
 }
 bool ActiveManifold2D::updateContour() {
 	if (requestUpdateContour) {
 		std::lock_guard<std::mutex> lockMe(contourLock);
-		isoContour.solve(levelSet, contour.vertexLocations, contour.indexes, 0.0f,
+		isoContour.solve(band, LEVEL, contour.vertexLocations, contour.indexes, 0.0f,
 				(preserveTopology) ?
 						TopologyRule2D::Connect4 :
 						TopologyRule2D::Unconstrained, Winding::Clockwise);
@@ -73,10 +82,12 @@ bool ActiveManifold2D::updateContour() {
 Manifold2D* ActiveManifold2D::getManifold() {
 	return &contour;
 }
-Image1f& ActiveManifold2D::getLevelSet() {
-	return levelSet;
-}
-const Image1f& ActiveManifold2D::getLevelSet() const {
+Image1f ActiveManifold2D::getLevelSet() const {
+	int2 dims = band.dimensions();
+	Image1f levelSet(dims.x, dims.y);
+	if (levelSet.size() > 0) {
+		band.copyTo(LEVEL, levelSet.ptr());
+	}
 	return levelSet;
 }
 ActiveManifold2D::ActiveManifold2D(const std::shared_ptr<ManifoldCache2D>& cache) :
@@ -134,17 +145,6 @@ bool ActiveManifold2D::init() {
 	}
 	simulationIteration = 0;
 	simulationTime = 0;
-
-	levelSet.resize(dims.x, dims.y);
-	swapLevelSet.resize(dims.x, dims.y);
-#pragma omp parallel for
-	for (int i = 0; i < (int) initialLevelSet.size(); i++) {
-		float val = clamp(initialLevelSet[i], -(maxLayers + 1.0f),
-				(maxLayers + 1.0f));
-		levelSet[i] = val;
-		swapLevelSet[i] = val;
-	}
-
 	rebuildNarrowBand();
 	requestUpdateContour = true;
 	if (cache.get() != nullptr) {
@@ -155,174 +155,106 @@ bool ActiveManifold2D::init() {
 	}
 	return true;
 }
-void ActiveManifold2D::pressureAndAdvectionMotion(int i, int j, size_t gid) {
-	float v11 = swapLevelSet(i, j).x;
-	float2 grad;
-	if (v11 > 0.5f || v11 < -0.5f) {
-		deltaLevelSet[gid] = 0;
-		return;
-	}
-
-	float v00 = swapLevelSet(i - 1, j - 1).x;
-	float v01 = swapLevelSet(i - 1, j).x;
-	float v10 = swapLevelSet(i, j - 1).x;
-	float v21 = swapLevelSet(i + 1, j).x;
-	float v20 = swapLevelSet(i + 1, j - 1).x;
-	float v22 = swapLevelSet(i + 1, j + 1).x;
-	float v02 = swapLevelSet(i - 1, j + 1).x;
-	float v12 = swapLevelSet(i, j + 1).x;
-
-	float DxNeg = v11 - v01;
-	float DxPos = v21 - v11;
-	float DyNeg = v11 - v10;
-	float DyPos = v12 - v11;
-
-	float DxNegMin = min(DxNeg, 0.0f);
-	float DxNegMax = max(DxNeg, 0.0f);
-	float DxPosMin = min(DxPos, 0.0f);
-	float DxPosMax = max(DxPos, 0.0f);
-	float DyNegMin = min(DyNeg, 0.0f);
-	float DyNegMax = max(DyNeg, 0.0f);
-	float DyPosMin = min(DyPos, 0.0f);
-	float DyPosMax = max(DyPos, 0.0f);
-	float GradientSqrPos = DxNegMax * DxNegMax + DxPosMin * DxPosMin
-			+ DyNegMax * DyNegMax + DyPosMin * DyPosMin;
-	float GradientSqrNeg = DxPosMax * DxPosMax + DxNegMin * DxNegMin
-			+ DyPosMax * DyPosMax + DyNegMin * DyNegMin;
-
-	float DxCtr = 0.5f * (v21 - v01);
-	float DyCtr = 0.5f * (v12 - v10);
-
-	float DxxCtr = v21 - v11 - v11 + v01;
-	float DyyCtr = v12 - v11 - v11 + v10;
-	float DxyCtr = (v22 - v02 - v20 + v00) * 0.25f;
-
-	float numer = 0.5f
-			* (DyCtr * DyCtr * DxxCtr - 2 * DxCtr * DyCtr * DxyCtr
-					+ DxCtr * DxCtr * DyyCtr);
-	float denom = DxCtr * DxCtr + DyCtr * DyCtr;
-	float kappa = 0;
-
-	const float maxCurvatureForce = 10.0f;
-	if (fabs(denom) > 1E-5f) {
-		kappa = curvatureParam.toFloat() * numer / denom;
-	} else {
-		kappa = curvatureParam.toFloat() * numer * sign(denom) * 1E5f;
-	}
-	if (kappa < -maxCurvatureForce) {
-		kappa = -maxCurvatureForce;
-	} else if (kappa > maxCurvatureForce) {
-		kappa = maxCurvatureForce;
-	}
-	float force = pressureParam.toFloat() * pressureImage(i, j).x;
-	float pressure = 0;
-	if (force > 0) {
-		pressure = -force * std::sqrt(GradientSqrPos);
-	} else if (force < 0) {
-		pressure = -force * std::sqrt(GradientSqrNeg);
-	}
-
-	// Level set force should be the opposite sign of advection force so it
-	// moves in the direction of the force.
-
-	float2 vec = vecFieldImage(i, j);
-	float forceX = advectionParam.toFloat() * vec.x;
-	float forceY = advectionParam.toFloat() * vec.y;
-	float advection = 0;
-
-	// Dot product force with upwind gradient
-	if (forceX > 0) {
-		advection = forceX * DxNeg;
-	} else if (forceX < 0) {
-		advection = forceX * DxPos;
-	}
-	if (forceY > 0) {
-		advection += forceY * DyNeg;
-	} else if (forceY < 0) {
-		advection += forceY * DyPos;
+void ActiveManifold2D::pressureAndAdvectionMotion(int slot, const float* v,
+		const uint8_t* sel) {
+	const float curvature = curvatureParam.toFloat();
+	const float pressureWeight = pressureParam.toFloat();
+	const float advectionWeight = advectionParam.toFloat();
+	const int2 origin = band.getTileOrigin(slot);
+	const int2 extent = tileExtent(slot);
+	float* delta = band.getTileValues(slot, DELTA);
+	for (int y = 0; y < extent.y; y++) {
+		const float1* pressureRow = &pressureImage(origin.x, origin.y + y);
+		const float2* vecRow = &vecFieldImage(origin.x, origin.y + y);
+		float gradientSqrPos[NarrowBand2D::TILE_SIZE];
+		float gradientSqrNeg[NarrowBand2D::TILE_SIZE];
+#pragma omp simd
+		for (int x = 0; x < extent.x; x++) {
+			int l = x + y * NarrowBand2D::TILE_SIZE;
+			int c = PaddedIndex(x, y);
+			float v11 = v[c];
+			float DxNeg = v11 - v[c - PX];
+			float DxPos = v[c + PX] - v11;
+			float DyNeg = v11 - v[c - PY];
+			float DyPos = v[c + PY] - v11;
+			//Selects only pick between values every lane computes, so GCC can vectorize without -fno-trapping-math.
+			float DxNeg2 = DxNeg * DxNeg;
+			float DxPos2 = DxPos * DxPos;
+			float DyNeg2 = DyNeg * DyNeg;
+			float DyPos2 = DyPos * DyPos;
+			gradientSqrPos[x] = ((DxNeg > 0) ? DxNeg2 : 0.0f)
+					+ ((DxPos < 0) ? DxPos2 : 0.0f)
+					+ ((DyNeg > 0) ? DyNeg2 : 0.0f)
+					+ ((DyPos < 0) ? DyPos2 : 0.0f);
+			gradientSqrNeg[x] = ((DxPos > 0) ? DxPos2 : 0.0f)
+					+ ((DxNeg < 0) ? DxNeg2 : 0.0f)
+					+ ((DyPos > 0) ? DyPos2 : 0.0f)
+					+ ((DyNeg < 0) ? DyNeg2 : 0.0f);
+			float kappa = Curvature(v, c, curvature);
+			// Level set force should be the opposite sign of advection force so it
+			// moves in the direction of the force.
+			float forceX = advectionWeight * vecRow[x].x;
+			float forceY = advectionWeight * vecRow[x].y;
+			// Dot product force with upwind gradient
+			float advection = UpwindAdvection(forceX, forceY, DxNeg, DxPos, DyNeg, DyPos);
+			delta[l] = -advection + kappa;
+		}
+		//std::sqrt may set errno, so the pressure term is added outside the vectorized loop.
+		for (int x = 0; x < extent.x; x++) {
+			int l = x + y * NarrowBand2D::TILE_SIZE;
+			float force = pressureWeight * pressureRow[x].x;
+			if (sel[l]) {
+				delta[l] += -force * std::sqrt(
+						(force > 0) ? gradientSqrPos[x] : gradientSqrNeg[x]);
+			}
+		}
 	}
-	deltaLevelSet[gid] = -advection + kappa + pressure;
 }
-void ActiveManifold2D::advectionMotion(int i, int j, size_t gid) {
-	float v11 = swapLevelSet(i, j).x;
-	float2 grad;
-	if (v11 > 0.5f || v11 < -0.5f) {
-		deltaLevelSet[gid] = 0;
-		return;
-	}
-
-	float v00 = swapLevelSet(i - 1, j - 1).x;
-	float v01 = swapLevelSet(i - 1, j).x;
-	float v10 = swapLevelSet(i, j - 1).x;
-	float v21 = swapLevelSet(i + 1, j).x;
-	float v20 = swapLevelSet(i + 1, j - 1).x;
-	float v22 = swapLevelSet(i + 1, j + 1).x;
-	float v02 = swapLevelSet(i - 1, j + 1).x;
-	float v12 = swapLevelSet(i, j + 1).x;
-
-	float DxNeg = v11 - v01;
-	float DxPos = v21 - v11;
-	float DyNeg = v11 - v10;
-	float DyPos = v12 - v11;
-
-	float DxCtr = 0.5f * (v21 - v01);
-	float DyCtr = 0.5f * (v12 - v10);
-
-	float DxxCtr = v21 - v11 - v11 + v01;
-	float DyyCtr = v12 - v11 - v11 + v10;
-	float DxyCtr = (v22 - v02 - v20 + v00) * 0.25f;
-
-	float numer = 0.5f
-			* (DyCtr * DyCtr * DxxCtr - 2 * DxCtr * DyCtr * DxyCtr
-					+ DxCtr * DxCtr * DyyCtr);
-	float denom = DxCtr * DxCtr + DyCtr * DyCtr;
-	float kappa = 0;
-
-	const float maxCurvatureForce = 10.0f;
-	if (fabs(denom) > 1E-5f) {
-		kappa = curvatureParam.toFloat() * numer / denom;
-	} else {
-		kappa = curvatureParam.toFloat() * numer * sign(denom) * 1E5f;
-	}
-	if (kappa < -maxCurvatureForce) {
-		kappa = -maxCurvatureForce;
-	} else if (kappa > maxCurvatureForce) {
-		kappa = maxCurvatureForce;
-	}
-
-	// Level set force should be the opposite sign of advection force so it
-	// moves in the direction of the force.
-
-	float2 vec = vecFieldImage(i, j);
-	float forceX = advectionParam.toFloat() * vec.x;
-	float forceY = advectionParam.toFloat() * vec.y;
-	float advection = 0;
-
-	// Dot product force with upwind gradient
-	if (forceX > 0) {
-		advection = forceX * DxNeg;
-	} else if (forceX < 0) {
-		advection = forceX * DxPos;
-	}
-	if (forceY > 0) {
-		advection += forceY * DyNeg;
-	} else if (forceY < 0) {
-		advection += forceY * DyPos;
+void ActiveManifold2D::advectionMotion(int slot, const float* v,
+		const uint8_t* sel) {
+	const float curvature = curvatureParam.toFloat();
+	const float advectionWeight = advectionParam.toFloat();
+	const int2 origin = band.getTileOrigin(slot);
+	const int2 extent = tileExtent(slot);
+	float* delta = band.getTileValues(slot, DELTA);
+	for (int y = 0; y < extent.y; y++) {
+		const float2* vecRow = &vecFieldImage(origin.x, origin.y + y);
+#pragma omp simd
+		for (int x = 0; x < extent.x; x++) {
+			int l = x + y * NarrowBand2D::TILE_SIZE;
+			int c = PaddedIndex(x, y);
+			float v11 = v[c];
+			float DxNeg = v11 - v[c - PX];
+			float DxPos = v[c + PX] - v11;
+			float DyNeg = v11 - v[c - PY];
+			float DyPos = v[c + PY] - v11;
+			float kappa = Curvature(v, c, curvature);
+			// Level set force should be the opposite sign of advection force so it
+			// moves in the direction of the force.
+			float forceX = advectionWeight * vecRow[x].x;
+			float forceY = advectionWeight * vecRow[x].y;
+			// Dot product force with upwind gradient
+			float advection = UpwindAdvection(forceX, forceY, DxNeg, DxPos, DyNeg, DyPos);
+			delta[l] = -advection + kappa;
+		}
 	}
-	deltaLevelSet[gid] = -advection + kappa;
 }
-void ActiveManifold2D::applyForces(int i, int j, size_t index, float timeStep) {
-	float delta;
-	float old = swapLevelSet(i, j);
-	if (std::abs(old) > 0.5f)
-		return;
-	if (clampSpeed) {
-		delta = timeStep * clamp(deltaLevelSet[index], -1.0f, 1.0f);
-	} else {
-		delta = timeStep * deltaLevelSet[index];
+void ActiveManifold2D::applyForces(int slot, float timeStep) {
+	const float* swap = band.getTileValues(slot, SWAP);
+	const float* delta = band.getTileValues(slot, DELTA);
+	float* level = band.getTileValues(slot, LEVEL);
+	const float maxSpeed = (clampSpeed) ? 1.0f : 1E30f;
+	uint8_t sel[NarrowBand2D::TILE_VOXELS];
+	selectVoxels(slot, [](float val) {return std::abs(val) <= 0.5f;}, sel);
+#pragma omp simd
+	for (int l = 0; l < NarrowBand2D::TILE_VOXELS; l++) {
+		float prev = level[l];
+		float old = swap[l];
+		float speed = delta[l];
+		float base = (sel[l] != 0) ? old : prev;
+		speed = (sel[l] != 0) ? speed : 0.0f;
+		level[l] = base + timeStep * clamp(speed, -maxSpeed, maxSpeed);
 	}
-	old += delta;
-	levelSet(i, j) = float1(old);
 }
 bool ActiveManifold2D::getBitValue(int i) {
 	const char lut4_8[] = { 123, -13, -5, -13, -69, 51, -69, 51, -128, -13,
@@ -339,230 +271,225 @@ bool ActiveManifold2D::getBitValue(int i) {
 }
 
 int ActiveManifold2D::deleteElements() {
-	std::vector<int2> newList;
-	for (int i = 0; i < (int) activeList.size(); i++) {
-		int2 pos = activeList[i];
-		float val = swapLevelSet(pos.x, pos.y);
+	int diff = band.removeIf([this](const int2& pos) {
+		float* swap = band.getValuePtr(pos, SWAP);
+		float val = *swap;
 		if (std::abs(val) <= MAX_DISTANCE) {
-			newList.push_back(pos);
-		} else {
-			val = sign(val) * (MAX_DISTANCE + 0.5f);
-			levelSet(pos.x, pos.y) = val;
-			swapLevelSet(pos.x, pos.y) = val;
+			return false;
 		}
-	}
-	int diff = (int) (activeList.size() - newList.size());
-	activeList = newList;
+		val = sign(val) * (MAX_DISTANCE + 0.5f);
+		*band.getValuePtr(pos, LEVEL) = val;
+		*swap = val;
+		return true;
+	});
+	band.flatten(activeList);
 	return diff;
 }
 int ActiveManifold2D::addElements() {
 	const int xShift[4] = { -1, 1, 0, 0 };
 	const int yShift[4] = { 0, 0, -1, 1 };
-	std::vector<int2> newList;
-	int sz = (int) activeList.size();
-	float INDICATOR = (float) std::max(levelSet.width, levelSet.height);
-	for (int offset = 0; offset < 4; offset++) {
-		int xOff = xShift[offset];
-		int yOff = yShift[offset];
-		for (int n = 0; n < sz; n++) {
-			int2 pos = activeList[n];
-			int2 pos2 = int2(pos.x + xOff, pos.y + yOff);
-			float val1 = std::abs(levelSet(pos.x, pos.y));
-			float val2 = std::abs(levelSet(pos2.x, pos2.y));
-			if (val1 <= MAX_DISTANCE - 1.0f && val2 >= MAX_DISTANCE
-					&& val2 < INDICATOR) {
-				levelSet(pos2.x, pos2.y) = INDICATOR + offset;
+	//Candidates are gathered per thread and inserted serially, so the band only changes in one place.
+	std::vector<std::vector<int2>> candidates(omp_get_max_threads());
+#pragma omp parallel for
+	for (int n = 0; n < (int) activeList.size(); n++) {
+		int2 pos = activeList[n];
+		if (std::abs(band.getValue(pos, LEVEL)) > MAX_DISTANCE - 1.0f) {
+			continue;
+		}
+		std::vector<int2>& local = candidates[omp_get_thread_num()];
+		for (int offset = 0; offset < 4; offset++) {
+			int2 pos2 = int2(pos.x + xShift[offset], pos.y + yShift[offset]);
+			if (band.inside(pos2) && !band.contains(pos2)) {
+				local.push_back(pos2);
 			}
 		}
 	}
-	for (int offset = 0; offset < 4; offset++) {
-		int xOff = xShift[offset];
-		int yOff = yShift[offset];
-		for (int n = 0; n < sz; n++) {
-			int2 pos = activeList[n];
-			int2 pos2 = int2(pos.x + xOff, pos.y + yOff);
-			float val1 = levelSet(pos.x, pos.y);
-			float val2 = levelSet(pos2.x, pos2.y);
-			if (std::abs(val1) <= MAX_DISTANCE - 1.0f
-					&& val2 == INDICATOR + offset) {
-				activeList.push_back(pos2);
-				val2 = swapLevelSet(pos2.x, pos2.y);
-				val2 = sign(val2) * MAX_DISTANCE;
-				swapLevelSet(pos2.x, pos2.y) = val2;
-				levelSet(pos2.x, pos2.y) = val2;
+	int added = 0;
+	for (const std::vector<int2>& local : candidates) {
+		for (int2 pos2 : local) {
+			if (band.insert(pos2)) {
+				float* swap = band.getValuePtr(pos2, SWAP);
+				float val2 = sign(*swap) * MAX_DISTANCE;
+				*swap = val2;
+				*band.getValuePtr(pos2, LEVEL) = val2;
+				added++;
 			}
 		}
 	}
-	return (int) (activeList.size() - sz);
+	band.flatten(activeList);
+	return added;
 }
-void ActiveManifold2D::applyForcesTopoRule(int i, int j, int offset,
-		size_t index, float timeStep) {
-	float v11 = swapLevelSet(i, j).x;
-	if (std::abs(v11) > 0.5f) {
-		levelSet(i, j) = v11;
-		return;
-	}
-	float delta;
-	if (clampSpeed) {
-		delta = timeStep * aly::clamp(deltaLevelSet[index], -1.0f, 1.0f);
-	} else {
-		delta = timeStep * deltaLevelSet[index];
-	}
+//Moves the front pixels whose coordinates have the parity of offset. v holds the tile's LEVEL channel from before the pass.
+void ActiveManifold2D::applyForcesTopoRule(int slot, const float* v,
+		int offset, float timeStep) {
+	const float* swap = band.getTileValues(slot, SWAP);
+	const float* delta = band.getTileValues(slot, DELTA);
+	float* level = band.getTileValues(slot, LEVEL);
+	const float maxSpeed = (clampSpeed) ? 1.0f : 1E30f;
 	const int xShift[4] = { 0, 0, 1, 1 };
 	const int yShift[4] = { 0, 1, 0, 1 };
-	int xOff = xShift[offset];
-	int yOff = yShift[offset];
-	if (i % 2 != xOff || j % 2 != yOff)
-		return;
-	float oldValue = swapLevelSet(i, j);
-	float newValue = oldValue + delta;
-	int mask = 0;
-	if (newValue * oldValue <= 0) {
-		mask |= ((levelSet(i - 1, j - 1).x < 0) ? (1 << 0) : 0);
-		mask |= ((levelSet(i - 1, j + 0).x < 0) ? (1 << 1) : 0);
-		mask |= ((levelSet(i - 1, j + 1).x < 0) ? (1 << 2) : 0);
-		mask |= ((levelSet(i + 0, j - 1).x < 0) ? (1 << 3) : 0);
-		mask |= ((levelSet(i + 0, j + 0).x < 0) ? (1 << 4) : 0);
-		mask |= ((levelSet(i + 0, j + 1).x < 0) ? (1 << 5) : 0);
-		mask |= ((levelSet(i + 1, j - 1).x < 0) ? (1 << 6) : 0);
-		mask |= ((levelSet(i + 1, j + 0).x < 0) ? (1 << 7) : 0);
-		mask |= ((levelSet(i + 1, j + 1).x < 0) ? (1 << 8) : 0);
-		if (!getBitValue(mask)) {
-			newValue = sign(oldValue);
+	uint8_t sel[NarrowBand2D::TILE_VOXELS];
+	selectVoxels(slot, [](float val) {return std::abs(val) <= 0.5f;}, sel);
+	//Tile origins are even, so local and grid coordinates have the same parity.
+	for (int y = yShift[offset]; y < NarrowBand2D::TILE_SIZE; y += 2) {
+		for (int x = xShift[offset]; x < NarrowBand2D::TILE_SIZE; x += 2) {
+			int l = x + y * NarrowBand2D::TILE_SIZE;
+			if (!sel[l])
+				continue;
+			int c = PaddedIndex(x, y);
+			float oldValue = swap[l];
+			float newValue = oldValue
+					+ timeStep * clamp(delta[l], -maxSpeed, maxSpeed);
+			if (newValue * oldValue <= 0) {
+				int mask = 0;
+				mask |= ((v[c - PX - PY] < 0) ? (1 << 0) : 0);
+				mask |= ((v[c - PX] < 0) ? (1 << 1) : 0);
+				mask |= ((v[c - PX + PY] < 0) ? (1 << 2) : 0);
+				mask |= ((v[c - PY] < 0) ? (1 << 3) : 0);
+				mask |= ((v[c] < 0) ? (1 << 4) : 0);
+				mask |= ((v[c + PY] < 0) ? (1 << 5) : 0);
+				mask |= ((v[c + PX - PY] < 0) ? (1 << 6) : 0);
+				mask |= ((v[c + PX] < 0) ? (1 << 7) : 0);
+				mask |= ((v[c + PX + PY] < 0) ? (1 << 8) : 0);
+				if (!getBitValue(mask)) {
+					newValue = sign(oldValue);
+				}
+			}
+			level[l] = newValue;
 		}
 	}
-	levelSet(i, j) = newValue;
 }
-void ActiveManifold2D::pressureMotion(int i, int j, size_t gid) {
-	float v11 = swapLevelSet(i, j).x;
-	float2 grad;
-	if (std::abs(v11) > 0.5f) {
-		deltaLevelSet[gid] = 0;
-		return;
-	}
-	float v00 = swapLevelSet(i - 1, j - 1).x;
-	float v01 = swapLevelSet(i - 1, j).x;
-	float v10 = swapLevelSet(i, j - 1).x;
-	float v21 = swapLevelSet(i + 1, j).x;
-	float v20 = swapLevelSet(i + 1, j - 1).x;
-	float v22 = swapLevelSet(i + 1, j + 1).x;
-	float v02 = swapLevelSet(i - 1, j + 1).x;
-	float v12 = swapLevelSet(i, j + 1).x;
-	float DxNeg = v11 - v01;
-	float DxPos = v21 - v11;
-	float DyNeg = v11 - v10;
-	float DyPos = v12 - v11;
-	float DxNegMin = std::min(DxNeg, 0.0f);
-	float DxNegMax = std::max(DxNeg, 0.0f);
-	float DxPosMin = std::min(DxPos, 0.0f);
-	float DxPosMax = std::max(DxPos, 0.0f);
-	float DyNegMin = std::min(DyNeg, 0.0f);
-	float DyNegMax = std::max(DyNeg, 0.0f);
-	float DyPosMin = std::min(DyPos, 0.0f);
-	float DyPosMax = std::max(DyPos, 0.0f);
-
-	float DxCtr = 0.5f * (v21 - v01);
-	float DyCtr = 0.5f * (v12 - v10);
-
-	float DxxCtr = v21 - v11 - v11 + v01;
-	float DyyCtr = v12 - v11 - v11 + v10;
-	float DxyCtr = (v22 - v02 - v20 + v00) * 0.25f;
-
-	float numer = 0.5f
-			* (DyCtr * DyCtr * DxxCtr - 2 * DxCtr * DyCtr * DxyCtr
-					+ DxCtr * DxCtr * DyyCtr);
-	float denom = DxCtr * DxCtr + DyCtr * DyCtr;
-	float kappa = 0;
-	const float maxCurvatureForce = 10.0f;
-	if (std::abs(denom) > 1E-5f) {
-		kappa = curvatureParam.toFloat() * numer / denom;
-	} else {
-		kappa = curvatureParam.toFloat() * numer * sign(denom) * 1E5f;
-	}
-	if (kappa < -maxCurvatureForce) {
-		kappa = -maxCurvatureForce;
-	} else if (kappa > maxCurvatureForce) {
-		kappa = maxCurvatureForce;
-	}
-	float force = pressureParam.toFloat() * pressureImage(i, j).x;
-	float pressure = 0;
-	if (force > 0) {
-		float GradientSqrPos = DxNegMax * DxNegMax + DxPosMin * DxPosMin
-				+ DyNegMax * DyNegMax + DyPosMin * DyPosMin;
-		pressure = -force * std::sqrt(GradientSqrPos);
-	} else if (force < 0) {
-		float GradientSqrNeg = DxPosMax * DxPosMax + DxNegMin * DxNegMin
-				+ DyPosMax * DyPosMax + DyNegMin * DyNegMin;
-		pressure = -force * std::sqrt(GradientSqrNeg);
+void ActiveManifold2D::pressureMotion(int slot, const float* v,
+		const uint8_t* sel) {
+	const float curvature = curvatureParam.toFloat();
+	const float pressureWeight = pressureParam.toFloat();
+	const int2 origin = band.getTileOrigin(slot);
+	const int2 extent = tileExtent(slot);
+	float* delta = band.getTileValues(slot, DELTA);
+	for (int y = 0; y < extent.y; y++) {
+		const float1* pressureRow = &pressureImage(origin.x, origin.y + y);
+		float gradientSqrPos[NarrowBand2D::TILE_SIZE];
+		float gradientSqrNeg[NarrowBand2D::TILE_SIZE];
+#pragma omp simd
+		for (int x = 0; x < extent.x; x++) {
+			int l = x + y * NarrowBand2D::TILE_SIZE;
+			int c = PaddedIndex(x, y);
+			float v11 = v[c];
+			float DxNeg = v11 - v[c - PX];
+			float DxPos = v[c + PX] - v11;
+			float DyNeg = v11 - v[c - PY];
+			float DyPos = v[c + PY] - v11;
+			float DxNeg2 = DxNeg * DxNeg;
+			float DxPos2 = DxPos * DxPos;
+			float DyNeg2 = DyNeg * DyNeg;
+			float DyPos2 = DyPos * DyPos;
+			gradientSqrPos[x] = ((DxNeg > 0) ? DxNeg2 : 0.0f)
+					+ ((DxPos < 0) ? DxPos2 : 0.0f)
+					+ ((DyNeg > 0) ? DyNeg2 : 0.0f)
+					+ ((DyPos < 0) ? DyPos2 : 0.0f);
+			gradientSqrNeg[x] = ((DxPos > 0) ? DxPos2 : 0.0f)
+					+ ((DxNeg < 0) ? DxNeg2 : 0.0f)
+					+ ((DyPos > 0) ? DyPos2 : 0.0f)
+					+ ((DyNeg < 0) ? DyNeg2 : 0.0f);
+			float kappa = Curvature(v, c, curvature);
+			delta[l] = kappa;
+		}
+		for (int x = 0; x < extent.x; x++) {
+			int l = x + y * NarrowBand2D::TILE_SIZE;
+			float force = pressureWeight * pressureRow[x].x;
+			if (sel[l]) {
+				delta[l] += -force * std::sqrt(
+						(force > 0) ? gradientSqrPos[x] : gradientSqrNeg[x]);
+			}
+		}
 	}
-	deltaLevelSet[gid] = kappa + pressure;
 }
-void ActiveManifold2D::updateDistanceField(int i, int j, int band) {
-	float v11;
-	float v01;
-	float v12;
-	float v10;
-	float v21;
-	float activeLevelSet = swapLevelSet(i, j).x;
-	if (std::abs(activeLevelSet) <= 0.5f) {
-		return;
-	}
-	v11 = levelSet(i, j);
-	float oldVal = v11;
-	v01 = levelSet(i - 1, j);
-	v12 = levelSet(i, j + 1);
-	v10 = levelSet(i, j - 1);
-	v21 = levelSet(i + 1, j);
-	if (v11 < -band + 0.5f) {
-		v11 = -1E30f;
-		v11 = (v01 > 1) ? v11 : max(v01, v11);
-		v11 = (v12 > 1) ? v11 : max(v12, v11);
-		v11 = (v10 > 1) ? v11 : max(v10, v11);
-		v11 = (v21 > 1) ? v11 : max(v21, v11);
-		v11 -= 1.0f;
-	} else if (v11 > band - 0.5f) {
-		v11 = 1E30f;
-		v11 = (v01 < -1) ? v11 : min(v01, v11);
-		v11 = (v12 < -1) ? v11 : min(v12, v11);
-		v11 = (v10 < -1) ? v11 : min(v10, v11);
-		v11 = (v21 < -1) ? v11 : min(v21, v11);
-		v11 += 1.0f;
-	}
-
-	if (oldVal * v11 > 0) {
-		levelSet(i, j) = v11;
-	} else {
-		levelSet(i, j) = oldVal;
+void ActiveManifold2D::updateDistanceField(int slot, const float* v,
+		int layer) {
+	const float maxDistance = MAX_DISTANCE;
+	const float lower = -layer + 0.5f;
+	const float upper = layer - 0.5f;
+	float* out = band.getTileValues(slot, DELTA);
+	uint8_t sel[NarrowBand2D::TILE_VOXELS];
+	selectVoxels(slot, [](float val) {return std::abs(val) > 0.5f;}, sel);
+	for (int y = 0; y < NarrowBand2D::TILE_SIZE; y++) {
+#pragma omp simd
+		for (int x = 0; x < NarrowBand2D::TILE_SIZE; x++) {
+			int l = x + y * NarrowBand2D::TILE_SIZE;
+			int c = PaddedIndex(x, y);
+			float v11 = v[c];
+			float v01 = v[c - PX];
+			float v21 = v[c + PX];
+			float v10 = v[c - PY];
+			float v12 = v[c + PY];
+			float inner = -(maxDistance + 0.5f);
+			inner = (v01 > 1) ? inner : max(v01, inner);
+			inner = (v12 > 1) ? inner : max(v12, inner);
+			inner = (v10 > 1) ? inner : max(v10, inner);
+			inner = (v21 > 1) ? inner : max(v21, inner);
+			float outer = (maxDistance + 0.5f);
+			outer = (v01 < -1) ? outer : min(v01, outer);
+			outer = (v12 < -1) ? outer : min(v12, outer);
+			outer = (v10 < -1) ? outer : min(v10, outer);
+			outer = (v21 < -1) ? outer : min(v21, outer);
+			bool below = (v11 < lower);
+			bool above = (v11 > upper);
+			float next = (below) ? inner : ((above) ? outer : v11);
+			next += (below) ? -1.0f : ((above) ? 1.0f : 0.0f);
+			float prev = out[l];
+			out[l] = ((sel[l] != 0) & (v11 * next > 0)) ? next : prev;
+		}
 	}
 }
 
 float ActiveManifold2D::evolve(float maxStep) {
-	if (pressureImage.size() > 0) {
-		if (vecFieldImage.size() > 0) {
-#pragma omp parallel for
-			for (int i = 0; i < (int) activeList.size(); i++) {
-				int2 pos = activeList[i];
-				pressureAndAdvectionMotion(pos.x, pos.y, i);
-			}
+	bool pressure = (pressureImage.size() > 0);
+	bool advection = (vecFieldImage.size() > 0);
+#pragma omp parallel for schedule(dynamic)
+	for (int s = 0; s < (int) band.getTileCount(); s++) {
+		float* delta = band.getTileValues(s, DELTA);
+		std::fill(delta, delta + NarrowBand2D::TILE_VOXELS, 0.0f);
+		if (!pressure && !advection) {
+			continue;
+		}
+		uint8_t sel[NarrowBand2D::TILE_VOXELS];
+		if (selectVoxels(s, [](float val) {return std::abs(val) <= 0.5f;}, sel) == 0) {
+			continue;
+		}
+		float v[NarrowBand2D::PADDED_VOXELS];
+		band.gather(s, SWAP, v);
+		if (pressure && advection) {
+			pressureAndAdvectionMotion(s, v, sel);
+		} else if (pressure) {
+			pressureMotion(s, v, sel);
 		} else {
-#pragma omp parallel for
-			for (int i = 0; i < (int) activeList.size(); i++) {
-				int2 pos = activeList[i];
-				pressureMotion(pos.x, pos.y, i);
-			}
+			advectionMotion(s, v, sel);
 		}
-	} else if (vecFieldImage.size() > 0) {
-#pragma omp parallel for
-		for (int i = 0; i < (int) activeList.size(); i++) {
-			int2 pos = activeList[i];
-			advectionMotion(pos.x, pos.y, i);
+#pragma omp simd
+		for (int l = 0; l < NarrowBand2D::TILE_VOXELS; l++) {
+			delta[l] = (sel[l] != 0) ? delta[l] : 0.0f;
 		}
 	}
+	return updateLevelSet(maxStep);
+}
+float ActiveManifold2D::updateLevelSet(float maxStep) {
+	const int tileCount = (int) band.getTileCount();
 	float timeStep = (float) maxStep;
 	if (!clampSpeed) {
+		std::vector<float> tileDelta(tileCount, 0.0f);
+#pragma omp parallel for
+		for (int s = 0; s < tileCount; s++) {
+			const float* delta = band.getTileValues(s, DELTA);
+			float maxDelta = 0.0f;
+#pragma omp simd reduction(max:maxDelta)
+			for (int l = 0; l < NarrowBand2D::TILE_VOXELS; l++) {
+				maxDelta = std::max(std::abs(delta[l]), maxDelta);
+			}
+			tileDelta[s] = maxDelta;
+		}
 		float maxDelta = 0.0f;
-		for (float delta : deltaLevelSet) {
-			maxDelta = std::max(std::abs(delta), maxDelta);
+		for (float delta : tileDelta) {
+			maxDelta = std::max(delta, maxDelta);
 		}
 		const float maxSpeed = 0.999f;
 		timeStep = (float) (maxStep
@@ -570,44 +497,47 @@ float ActiveManifold2D::evolve(float maxStep) {
 	}
 	contourLock.lock();
 	if (preserveTopology) {
+		//Every tile is gathered before any tile of the same pass is written.
+		std::vector<float> blocks(tileCount * (size_t) NarrowBand2D::PADDED_VOXELS);
 		for (int nn = 0; nn < 4; nn++) {
 #pragma omp parallel for
-			for (int i = 0; i < (int) activeList.size(); i++) {
-				int2 pos = activeList[i];
-				applyForcesTopoRule(pos.x, pos.y, nn, i, timeStep);
+			for (int s = 0; s < tileCount; s++) {
+				band.gather(s, LEVEL, &blocks[s * (size_t) NarrowBand2D::PADDED_VOXELS]);
+			}
+#pragma omp parallel for
+			for (int s = 0; s < tileCount; s++) {
+				applyForcesTopoRule(s, &blocks[s * (size_t) NarrowBand2D::PADDED_VOXELS], nn, timeStep);
 			}
 		}
 	} else {
 #pragma omp parallel for
-		for (int i = 0; i < (int) activeList.size(); i++) {
-			int2 pos = activeList[i];
-			applyForces(pos.x, pos.y, i, timeStep);
+		for (int s = 0; s < tileCount; s++) {
+			applyForces(s, timeStep);
 		}
 	}
-	for (int band = 1; band <= maxLayers; band++) {
-#pragma omp parallel for
-		for (int i = 0; i < (int) activeList.size(); i++) {
-			int2 pos = activeList[i];
-			updateDistanceField(pos.x, pos.y, band);
+	//Each layer reads the whole band before any tile is written back.
+	copyChannel(LEVEL, DELTA);
+	for (int layer = 1; layer <= maxLayers; layer++) {
+#pragma omp parallel for schedule(dynamic)
+		for (int s = 0; s < tileCount; s++) {
+			float v[NarrowBand2D::PADDED_VOXELS];
+			band.gather(s, LEVEL, v);
+			updateDistanceField(s, v, layer);
 		}
+		copyChannel(DELTA, LEVEL);
 	}
-#pragma omp parallel for
-	for (int i = 0; i < (int) activeList.size(); i++) {
-		int2 pos = activeList[i];
-		plugLevelSet(pos.x, pos.y, i);
+#pragma omp parallel for schedule(dynamic)
+	for (int s = 0; s < tileCount; s++) {
+		float v[NarrowBand2D::PADDED_VOXELS];
+		band.gather(s, LEVEL, v);
+		plugLevelSet(s, v);
 	}
+	copyChannel(DELTA, LEVEL);
 	requestUpdateContour = true;
 	contourLock.unlock();
-
-#pragma omp parallel for
-	for (int i = 0; i < (int) activeList.size(); i++) {
-		int2 pos = activeList[i];
-		swapLevelSet(pos.x, pos.y) = levelSet(pos.x, pos.y);
-	}
+	copyChannel(LEVEL, SWAP);
 	deleteElements();
 	addElements();
-	deltaLevelSet.clear();
-	deltaLevelSet.resize(activeList.size(), 0.0f);
 	return timeStep;
 }
 bool ActiveManifold2D::stepInternal() {
@@ -25,6 +25,7 @@
 #include "image/AlloyImage.h"
 #include "graphics/AlloyIsoContour.h"
 #include "vision/ManifoldCache2D.h"
+#include "vision/NarrowBand.h"
 #include <vector>
 #include <list>
 #include <tuple>
@@ -48,28 +49,89 @@ protected:
 	const int maxLayers = 3;
 	bool requestUpdateContour;
 	Image1f initialLevelSet;
-	Image1f levelSet;
-	Image1f swapLevelSet;
 	Image1f pressureImage;
 	Image2f vecFieldImage;
-	std::vector<float> deltaLevelSet;
 	std::vector<int2> activeList;
+	//Holds the level set. Only tiles near the contour are allocated.
+	NarrowBand2D band;
+	//Channels of the band. DELTA holds each pixel's update and is reused as scratch.
+	static const int LEVEL = 0;
+	static const int SWAP = 1;
+	static const int DELTA = 2;
+	//Strides of a tile gathered with a one pixel border.
+	static const int PX = 1;
+	static const int PY = NarrowBand2D::PADDED_SIZE;
+	static int PaddedIndex(int x, int y) {
+		return PX * (x + 1) + PY * (y + 1);
+	}
+	//Clamped curvature at index c of a gathered tile.
+	static float Curvature(const float* v, int c, float weight) {
+		float v11 = v[c];
+		float v01 = v[c - PX];
+		float v21 = v[c + PX];
+		float v10 = v[c - PY];
+		float v12 = v[c + PY];
+		float DxCtr = 0.5f * (v21 - v01);
+		float DyCtr = 0.5f * (v12 - v10);
+		float DxxCtr = v21 - v11 - v11 + v01;
+		float DyyCtr = v12 - v11 - v11 + v10;
+		float DxyCtr = (v[c + PX + PY] - v[c - PX + PY] - v[c + PX - PY]
+				+ v[c - PX - PY]) * 0.25f;
+		float numer = 0.5f
+				* (DyCtr * DyCtr * DxxCtr - 2 * DxCtr * DyCtr * DxyCtr
+						+ DxCtr * DxCtr * DyyCtr);
+		float denom = DxCtr * DxCtr + DyCtr * DyCtr;
+		const float maxCurvatureForce = 10.0f;
+		//denom is a sum of squares, so a lower bound stands in for the branch on its size.
+		float kappa = weight * numer / std::max(denom, 1E-5f);
+		return clamp(kappa, -maxCurvatureForce, maxCurvatureForce);
+	}
+	//Force dotted with the upwind differences. Both sides are weighted rather than selected, so every lane runs the same arithmetic.
+	static float UpwindAdvection(float forceX, float forceY, float DxNeg,
+			float DxPos, float DyNeg, float DyPos) {
+		return (std::max(forceX, 0.0f) * DxNeg + std::min(forceX, 0.0f) * DxPos)
+				+ (std::max(forceY, 0.0f) * DyNeg
+						+ std::min(forceY, 0.0f) * DyPos);
+	}
 	std::mutex contourLock;
 	bool getBitValue(int i);
 	void rescale(aly::Image1f& pressureForce);
-	void pressureMotion(int i, int j, size_t index);
-	void pressureAndAdvectionMotion(int i, int j, size_t index);
-	void advectionMotion(int i, int j, size_t index);
-	void applyForces(int i, int j, size_t index, float timeStep);
-	void plugLevelSet(int i, int j, size_t index);
-	void updateDistanceField(int i, int j, int band);
+	//Sets sel for the tile's band pixels whose SWAP value passes test and clears it elsewhere. Returns the number set.
+	template<class F> int selectVoxels(int slot, const F& test, uint8_t* sel) const {
+		const float* swap = band.getTileValues(slot, SWAP);
+		int count = 0;
+		for (int l = 0; l < NarrowBand2D::TILE_VOXELS; l++) {
+			sel[l] = (band.isActive(slot, l) && test(swap[l])) ? 1 : 0;
+			count += sel[l];
+		}
+		return count;
+	}
+	//Number of the tile's columns and rows that lie inside the grid.
+	int2 tileExtent(int slot) const {
+		const int size = NarrowBand2D::TILE_SIZE;
+		int2 origin = band.getTileOrigin(slot);
+		int2 dims = band.dimensions();
+		return int2(std::min(size, dims.x - origin.x),
+				std::min(size, dims.y - origin.y));
+	}
+	//Motion kernels read the SWAP channel of a tile gathered into v and write DELTA for its pixels inside the grid. Pixels outside sel are cleared afterwards.
+	void pressureMotion(int slot, const float* v, const uint8_t* sel);
+	void pressureAndAdvectionMotion(int slot, const float* v,
+			const uint8_t* sel);
+	void advectionMotion(int slot, const float* v, const uint8_t* sel);
+	void applyForces(int slot, float timeStep);
+	void applyForcesTopoRule(int slot, const float* v, int offset,
+			float timeStep);
+	void plugLevelSet(int slot, const float* v);
+	void updateDistanceField(int slot, const float* v, int layer);
+	void copyChannel(int from, int to);
 	int deleteElements();
 	int addElements();
 	virtual float evolve(float maxStep);
+	//Applies the motion in DELTA, redistances the band and moves it with the contour.
+	float updateLevelSet(float maxStep);
 	void rebuildNarrowBand();
 	bool updateContour();
-	void applyForcesTopoRule(int i, int j, int offset, size_t index,
-			float timeStep);
 	virtual bool stepInternal() override;
 public:
 	aly::Breadcrumbs2D crumbs;
@@ -114,8 +176,8 @@ public:
 		advectionParam.setValue(c);
 	}
 	Manifold2D* getManifold();
-	Image1f& getLevelSet();
-	const Image1f& getLevelSet() const;
+	//Copies the level set out of the narrow band into a dense image.
+	Image1f getLevelSet() const;
 	virtual bool init() override;
 	virtual void cleanup() override;
 	virtual void setup(const aly::ParameterPanePtr& pane) override;
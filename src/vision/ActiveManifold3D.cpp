@@ -19,51 +19,66 @@
  * THE SOFTWARE.
  */
 #include "vision/ActiveManifold3D.h"
+#include <omp.h>
 namespace aly {
 
 void ActiveManifold3D::rebuildNarrowBand() {
-	activeList.clear();
-	for (int band = 1; band <= maxLayers; band++) {
+	const float maxValue = maxLayers + 1.0f;
+	band.resize(initialLevelSet.dimensions(), 3, MAX_DISTANCE + 0.5f);
+	band.build([this](const int3& pos) {
+		return (std::abs(initialLevelSet(pos.x, pos.y, pos.z).x) <= MAX_DISTANCE);
+	}, [this, maxValue](const int3& pos) {
+		return clamp(initialLevelSet(pos.x, pos.y, pos.z).x, -maxValue, maxValue);
+	});
+	band.flatten(activeList);
+}
+void ActiveManifold3D::copyChannel(int from, int to) {
 #pragma omp parallel for
-		for (int i = 0; i < (int) activeList.size(); i++) {
-			int3 pos = activeList[i];
-			updateDistanceField(pos.x, pos.y, pos.z, band);
+	for (int s = 0; s < (int) band.getTileCount(); s++) {
+		const float* in = band.getTileValues(s, from);
+		float* out = band.getTileValues(s, to);
+#pragma omp simd
+		for (int l = 0; l < NarrowBand3D::TILE_VOXELS; l++) {
+			out[l] = in[l];
 		}
 	}
-	for (int k = 0; k < swapLevelSet.slices; k++) {
-		for (int j = 0; j < swapLevelSet.cols; j++) {
-			for (int i = 0; i < swapLevelSet.rows; i++) {
-				if (std::abs(swapLevelSet(i, j, k).x) <= MAX_DISTANCE) {
-					activeList.push_back(int3(i, j, k));
-				}
+}
+void ActiveManifold3D::plugLevelSet(int slot, const float* v) {
+	const float maxDistance = MAX_DISTANCE;
+	float* out = band.getTileValues(slot, DELTA);
+	uint8_t sel[NarrowBand3D::TILE_VOXELS];
+	selectVoxels(slot, [](float val) {return true;}, sel);
+	for (int z = 0; z < NarrowBand3D::TILE_SIZE; z++) {
+		for (int y = 0; y < NarrowBand3D::TILE_SIZE; y++) {
+			const int row = NarrowBand3D::TILE_SIZE * (y + NarrowBand3D::TILE_SIZE * z);
+			if (!RowSelected(sel, row)) {
+				continue;
+			}
+#pragma omp simd
+			for (int x = 0; x < NarrowBand3D::TILE_SIZE; x++) {
+				int l = row + x;
+				int c = PaddedIndex(x, y, z);
+				float v111 = v[c];
+				float v011 = v[c - PX];
+				float v211 = v[c + PX];
+				float v101 = v[c - PY];
+				float v121 = v[c + PY];
+				float v110 = v[c - PZ];
+				float v112 = v[c + PZ];
+				//Same test as sign(v111)*v111 <= 0 and sign(v111)*neighbor < 0 for every neighbor, without multiplying by a selected sign.
+				bool pos = (v111 > 0);
+				bool neg = (v111 < 0);
+				float nbrMax = std::max(std::max(std::max(v011, v211), std::max(v101, v121)), std::max(v110, v112));
+				float nbrMin = std::min(std::min(std::min(v011, v211), std::min(v101, v121)), std::min(v110, v112));
+				//if (v111 > 0 && v111 < 0.5f && v011 > 0 && v121 > 0 && v101 > 0 && v211 > 0 && v112 > 0 && v110 > 0) {
+				bool plug = (std::abs(v111) <= 0.0f)
+						& ((pos & (nbrMax < 0)) | (neg & (nbrMin > 0)));
+				float plugged = (pos) ? maxDistance : ((neg) ? -maxDistance : 0.0f);
+				float prev = out[l];
+				out[l] = ((sel[l] != 0) & plug) ? plugged : prev;
 			}
 		}
 	}
-	deltaLevelSet.clear();
-	deltaLevelSet.resize(activeList.size(), 0.0f);
-}
-void ActiveManifold3D::plugLevelSet(int i, int j, int k, size_t index) {
-	float v111;
-	float v011;
-	float v121;
-	float v101;
-	float v211;
-	float v112;
-	float v110;
-	v111 = levelSet(i, j, k);
-	float sgn = aly::sign(v111);
-	v111 = sgn * v111;
-	v011 = sgn * levelSet(i - 1, j, k);
-	v121 = sgn * levelSet(i, j + 1, k);
-	v101 = sgn * levelSet(i, j - 1, k);
-	v211 = sgn * levelSet(i + 1, j, k);
-	v110 = sgn * levelSet(i, j, k - 1);
-	v112 = sgn * levelSet(i, j, k + 1);
-	//if (v111 > 0 && v111 < 0.5f && v011 > 0 && v121 > 0 && v101 > 0 && v211 > 0 && v112 > 0 && v110 > 0) {
-	if (v111 <= 0 && v111 >= -0.5f && v011 < 0 && v121 < 0 && v101 < 0
-			&& v211 < 0 && v112 < 0 && v110 < 0) {
-		levelSet(i, j, k) = sgn * MAX_DISTANCE;
-	}
 }
 void ActiveManifold3D::cleanup() {
 	if (cache.get() != nullptr)
@@ -74,7 +89,7 @@ bool ActiveManifold3D::updateSurface() {
 	if (requestUpdateSurface) {
 		std::lock_guard<std::mutex> lockMe(contourLock);
 		Mesh mesh;
-		isoSurface.solve(levelSet, activeList, mesh, contour.meshType, true, 0.0f);
+		isoSurface.solve(band, LEVEL, mesh, contour.meshType, true, 0.0f);
 		mesh.updateVertexNormals(false);
 		contour.vertexLocations = mesh.vertexLocations;
 		contour.vertexNormals = mesh.vertexNormals;
@@ -88,10 +103,12 @@ bool ActiveManifold3D::updateSurface() {
 Manifold3D* ActiveManifold3D::getManifold() {
 	return &contour;
 }
-Volume1f& ActiveManifold3D::getLevelSet() {
-	return levelSet;
-}
-const Volume1f& ActiveManifold3D::getLevelSet() const {
+Volume1f ActiveManifold3D::getLevelSet() const {
+	int3 dims = band.dimensions();
+	Volume1f levelSet(dims.x, dims.y, dims.z);
+	if (levelSet.size() > 0) {
+		band.copyTo(LEVEL, levelSet.ptr());
+	}
 	return levelSet;
 }
 ActiveManifold3D::ActiveManifold3D(
@@ -146,15 +163,6 @@ bool ActiveManifold3D::init() {
 	crumbs.clear();
 	simulationIteration = 0;
 	simulationTime = 0;
-	levelSet.resize(dims.x, dims.y, dims.z);
-	swapLevelSet.resize(dims.x, dims.y, dims.z);
-#pragma omp parallel for
-	for (int i = 0; i < (int) initialLevelSet.size(); i++) {
-		float val = clamp(initialLevelSet[i], -(maxLayers + 1.0f),
-				(maxLayers + 1.0f));
-		levelSet[i] = val;
-		swapLevelSet[i] = val;
-	}
 	rebuildNarrowBand();
 	//Only rebuild first contour if it doesn't exist yet!
 	if(contour.vertexLocations.size()==0){
@@ -170,457 +178,346 @@ bool ActiveManifold3D::init() {
 	}
 	return true;
 }
-void ActiveManifold3D::pressureAndAdvectionMotion(int i, int j, int k,
-		size_t gid) {
-	float v111 = swapLevelSet(i, j, k).x;
-	float2 grad;
-	if (v111 > 0.5f || v111 < -0.5f) {
-		deltaLevelSet[gid] = 0;
-		return;
-	}
-	float v010 = swapLevelSet(i - 1, j, k - 1);
-	float v120 = swapLevelSet(i, j + 1, k - 1);
-	float v110 = swapLevelSet(i, j, k - 1);
-	float v100 = swapLevelSet(i, j - 1, k - 1);
-	float v210 = swapLevelSet(i + 1, j, k - 1);
-	float v001 = swapLevelSet(i - 1, j - 1, k);
-	float v011 = swapLevelSet(i - 1, j, k);
-	float v101 = swapLevelSet(i, j - 1, k);
-	float v211 = swapLevelSet(i + 1, j, k);
-	float v201 = swapLevelSet(i + 1, j - 1, k);
-	float v221 = swapLevelSet(i + 1, j + 1, k);
-	float v021 = swapLevelSet(i - 1, j + 1, k);
-	float v121 = swapLevelSet(i, j + 1, k);
-	float v012 = swapLevelSet(i - 1, j, k + 1);
-	float v122 = swapLevelSet(i, j + 1, k + 1);
-	float v112 = swapLevelSet(i, j, k + 1);
-	float v102 = swapLevelSet(i, j - 1, k + 1);
-	float v212 = swapLevelSet(i + 1, j, k + 1);
-
-	float DxNeg = v111 - v011;
-	float DxPos = v211 - v111;
-	float DyNeg = v111 - v101;
-	float DyPos = v121 - v111;
-	float DzNeg = v111 - v110;
-	float DzPos = v112 - v111;
-	float DxNegMin = min(DxNeg, 0.0f);
-	float DxNegMax = max(DxNeg, 0.0f);
-	float DxPosMin = min(DxPos, 0.0f);
-	float DxPosMax = max(DxPos, 0.0f);
-	float DyNegMin = min(DyNeg, 0.0f);
-	float DyNegMax = max(DyNeg, 0.0f);
-	float DyPosMin = min(DyPos, 0.0f);
-	float DyPosMax = max(DyPos, 0.0f);
-	float DzNegMin = min(DzNeg, 0.0f);
-	float DzNegMax = max(DzNeg, 0.0f);
-	float DzPosMin = min(DzPos, 0.0f);
-	float DzPosMax = max(DzPos, 0.0f);
-
-	float GradientSqrPos = DxNegMax * DxNegMax + DxPosMin * DxPosMin
-			+ DyNegMax * DyNegMax + DyPosMin * DyPosMin + DzNegMax * DzNegMax
-			+ DzPosMin * DzPosMin;
-	float GradientSqrNeg = DxPosMax * DxPosMax + DxNegMin * DxNegMin
-			+ DyPosMax * DyPosMax + DyNegMin * DyNegMin + DzPosMax * DzPosMax
-			+ DzNegMin * DzNegMin;
-
-	float DxCtr = 0.5f * (v211 - v011);
-	float DyCtr = 0.5f * (v121 - v101);
-	float DzCtr = 0.5f * (v112 - v110);
-	float DxxCtr = v211 - v111 - v111 + v011;
-	float DyyCtr = v121 - v111 - v111 + v101;
-	float DzzCtr = v112 - v111 - v111 + v110;
-	float DxyCtr = (v221 - v021 - v201 + v001) * 0.25f;
-	float DxzCtr = (v212 - v012 - v210 + v010) * 0.25f;
-	float DyzCtr = (v122 - v102 - v120 + v100) * 0.25f;
-
-	float numer = 0.5f
-			* ((DyyCtr + DzzCtr) * DxCtr * DxCtr
-					+ (DxxCtr + DzzCtr) * DyCtr * DyCtr
-					+ (DxxCtr + DyyCtr) * DzCtr * DzCtr
-					- 2 * DxCtr * DyCtr * DxyCtr - 2 * DxCtr * DzCtr * DxzCtr
-					- 2 * DyCtr * DzCtr * DyzCtr);
-	float denom = DxCtr * DxCtr + DyCtr * DyCtr + DzCtr * DzCtr;
-	float kappa = 0;
-	const float maxCurvatureForce = 10.0f;
-	if (std::abs(denom) > 1E-5f) {
-		kappa = curvatureParam.toFloat() * numer / denom;
-	} else {
-		kappa = curvatureParam.toFloat() * numer * sign(denom) * 1E5;
-	}
-	if (kappa < -maxCurvatureForce) {
-		kappa = -maxCurvatureForce;
-	} else if (kappa > maxCurvatureForce) {
-		kappa = maxCurvatureForce;
-	}
-	float pressure = 0;
-	// Level set force should be the opposite sign of advection force so it
-	// moves in the direction of the force.
-
-	float3 vec = vecFieldImage(i, j, k);
-	float forceX = advectionParam.toFloat() * vec.x;
-	float forceY = advectionParam.toFloat() * vec.y;
-	float forceZ = advectionParam.toFloat() * vec.z;
-
-	float advection = 0;
-	// Dot product force with upwind gradient
-	if (forceX > 0) {
-		advection = forceX * DxNeg;
-	} else if (forceX < 0) {
-		advection = forceX * DxPos;
-	}
-	if (forceY > 0) {
-		advection += forceY * DyNeg;
-	} else if (forceY < 0) {
-		advection += forceY * DyPos;
-	}
-	if (forceZ > 0) {
-		advection += forceZ * DzNeg;
-	} else if (forceZ < 0) {
-		advection += forceZ * DzPos;
-	}
-	float force = pressureParam.toFloat() * pressureImage(i, j, k).x;
-	if (force > 0) {
-		pressure = -force * std::sqrt(GradientSqrPos);
-	} else if (force < 0) {
-		pressure = -force * std::sqrt(GradientSqrNeg);
+void ActiveManifold3D::pressureAndAdvectionMotion(int slot, const float* v,
+		const uint8_t* sel) {
+	const float curvature = curvatureParam.toFloat();
+	const float pressureWeight = pressureParam.toFloat();
+	const float advectionWeight = advectionParam.toFloat();
+	const int3 origin = band.getTileOrigin(slot);
+	const int3 extent = tileExtent(slot);
+	float* delta = band.getTileValues(slot, DELTA);
+	for (int z = 0; z < extent.z; z++) {
+		for (int y = 0; y < extent.y; y++) {
+			const int row = NarrowBand3D::TILE_SIZE * (y + NarrowBand3D::TILE_SIZE * z);
+			if (!RowSelected(sel, row)) {
+				continue;
+			}
+			const float1* pressureRow = &pressureImage(origin.x, origin.y + y,
+					origin.z + z);
+			const float3* vecRow = &vecFieldImage(origin.x, origin.y + y,
+					origin.z + z);
+			float gradientSqrPos[NarrowBand3D::TILE_SIZE];
+			float gradientSqrNeg[NarrowBand3D::TILE_SIZE];
+#pragma omp simd
+			for (int x = 0; x < extent.x; x++) {
+				int l = row + x;
+				int c = PaddedIndex(x, y, z);
+				float v111 = v[c];
+				float DxNeg = v111 - v[c - PX];
+				float DxPos = v[c + PX] - v111;
+				float DyNeg = v111 - v[c - PY];
+				float DyPos = v[c + PY] - v111;
+				float DzNeg = v111 - v[c - PZ];
+				float DzPos = v[c + PZ] - v111;
+				//Selects only pick between values every lane computes, so GCC can vectorize without -fno-trapping-math.
+				float DxNeg2 = DxNeg * DxNeg;
+				float DxPos2 = DxPos * DxPos;
+				float DyNeg2 = DyNeg * DyNeg;
+				float DyPos2 = DyPos * DyPos;
+				float DzNeg2 = DzNeg * DzNeg;
+				float DzPos2 = DzPos * DzPos;
+				gradientSqrPos[x] = ((DxNeg > 0) ? DxNeg2 : 0.0f)
+						+ ((DxPos < 0) ? DxPos2 : 0.0f)
+						+ ((DyNeg > 0) ? DyNeg2 : 0.0f)
+						+ ((DyPos < 0) ? DyPos2 : 0.0f)
+						+ ((DzNeg > 0) ? DzNeg2 : 0.0f)
+						+ ((DzPos < 0) ? DzPos2 : 0.0f);
+				gradientSqrNeg[x] = ((DxPos > 0) ? DxPos2 : 0.0f)
+						+ ((DxNeg < 0) ? DxNeg2 : 0.0f)
+						+ ((DyPos > 0) ? DyPos2 : 0.0f)
+						+ ((DyNeg < 0) ? DyNeg2 : 0.0f)
+						+ ((DzPos > 0) ? DzPos2 : 0.0f)
+						+ ((DzNeg < 0) ? DzNeg2 : 0.0f);
+				float kappa = MeanCurvature(v, c, curvature);
+				// Level set force should be the opposite sign of advection force so it
+				// moves in the direction of the force.
+				float forceX = advectionWeight * vecRow[x].x;
+				float forceY = advectionWeight * vecRow[x].y;
+				float forceZ = advectionWeight * vecRow[x].z;
+				// Dot product force with upwind gradient
+				float advection = UpwindAdvection(forceX, forceY, forceZ, DxNeg,
+						DxPos, DyNeg, DyPos, DzNeg, DzPos);
+				delta[l] = -advection + kappa;
+			}
+			//std::sqrt may set errno, so the pressure term is added outside the vectorized loop.
+			for (int x = 0; x < extent.x; x++) {
+				int l = row + x;
+				float force = pressureWeight * pressureRow[x].x;
+				if (sel[l]) {
+					delta[l] += -force * std::sqrt(
+							(force > 0) ? gradientSqrPos[x] : gradientSqrNeg[x]);
+				}
+			}
+		}
 	}
-	deltaLevelSet[gid] = -advection + kappa + pressure;
 }
-void ActiveManifold3D::advectionMotion(int i, int j, int k, size_t gid) {
-	float v111 = swapLevelSet(i, j, k).x;
-	float2 grad;
-	if (v111 > 0.5f || v111 < -0.5f) {
-		deltaLevelSet[gid] = 0;
-		return;
-	}
-
-	float v010 = swapLevelSet(i - 1, j, k - 1);
-	float v120 = swapLevelSet(i, j + 1, k - 1);
-	float v110 = swapLevelSet(i, j, k - 1);
-	float v100 = swapLevelSet(i, j - 1, k - 1);
-	float v210 = swapLevelSet(i + 1, j, k - 1);
-	float v001 = swapLevelSet(i - 1, j - 1, k);
-	float v011 = swapLevelSet(i - 1, j, k);
-	float v101 = swapLevelSet(i, j - 1, k);
-	float v211 = swapLevelSet(i + 1, j, k);
-	float v201 = swapLevelSet(i + 1, j - 1, k);
-	float v221 = swapLevelSet(i + 1, j + 1, k);
-	float v021 = swapLevelSet(i - 1, j + 1, k);
-	float v121 = swapLevelSet(i, j + 1, k);
-	float v012 = swapLevelSet(i - 1, j, k + 1);
-	float v122 = swapLevelSet(i, j + 1, k + 1);
-	float v112 = swapLevelSet(i, j, k + 1);
-	float v102 = swapLevelSet(i, j - 1, k + 1);
-	float v212 = swapLevelSet(i + 1, j, k + 1);
-
-	float DxNeg = v111 - v011;
-	float DxPos = v211 - v111;
-	float DyNeg = v111 - v101;
-	float DyPos = v121 - v111;
-	float DzNeg = v111 - v110;
-	float DzPos = v112 - v111;
-
-	float DxCtr = 0.5f * (v211 - v011);
-	float DyCtr = 0.5f * (v121 - v101);
-	float DzCtr = 0.5f * (v112 - v110);
-	float DxxCtr = v211 - v111 - v111 + v011;
-	float DyyCtr = v121 - v111 - v111 + v101;
-	float DzzCtr = v112 - v111 - v111 + v110;
-	float DxyCtr = (v221 - v021 - v201 + v001) * 0.25f;
-	float DxzCtr = (v212 - v012 - v210 + v010) * 0.25f;
-	float DyzCtr = (v122 - v102 - v120 + v100) * 0.25f;
-
-	float numer = 0.5f
-			* ((DyyCtr + DzzCtr) * DxCtr * DxCtr
-					+ (DxxCtr + DzzCtr) * DyCtr * DyCtr
-					+ (DxxCtr + DyyCtr) * DzCtr * DzCtr
-					- 2 * DxCtr * DyCtr * DxyCtr - 2 * DxCtr * DzCtr * DxzCtr
-					- 2 * DyCtr * DzCtr * DyzCtr);
-	float denom = DxCtr * DxCtr + DyCtr * DyCtr + DzCtr * DzCtr;
-
-	float kappa = 0;
-
-	const float maxCurvatureForce = 10.0f;
-	if (fabs(denom) > 1E-5f) {
-		kappa = curvatureParam.toFloat() * numer / denom;
-	} else {
-		kappa = curvatureParam.toFloat() * numer * sign(denom) * 1E5f;
-	}
-	if (kappa < -maxCurvatureForce) {
-		kappa = -maxCurvatureForce;
-	} else if (kappa > maxCurvatureForce) {
-		kappa = maxCurvatureForce;
-	}
-
-	// Level set force should be the opposite sign of advection force so it
-	// moves in the direction of the force.
-
-	float3 vec = vecFieldImage(i, j, k);
-	float forceX = advectionParam.toFloat() * vec.x;
-	float forceY = advectionParam.toFloat() * vec.y;
-	float forceZ = advectionParam.toFloat() * vec.z;
-	float advection = 0;
-	// Dot product force with upwind gradient
-	if (forceX > 0) {
-		advection = forceX * DxNeg;
-	} else if (forceX < 0) {
-		advection = forceX * DxPos;
-	}
-	if (forceY > 0) {
-		advection += forceY * DyNeg;
-	} else if (forceY < 0) {
-		advection += forceY * DyPos;
-	}
-	if (forceZ > 0) {
-		advection += forceZ * DzNeg;
-	} else if (forceZ < 0) {
-		advection += forceZ * DzPos;
+void ActiveManifold3D::advectionMotion(int slot, const float* v,
+		const uint8_t* sel) {
+	const float curvature = curvatureParam.toFloat();
+	const float advectionWeight = advectionParam.toFloat();
+	const int3 origin = band.getTileOrigin(slot);
+	const int3 extent = tileExtent(slot);
+	float* delta = band.getTileValues(slot, DELTA);
+	for (int z = 0; z < extent.z; z++) {
+		for (int y = 0; y < extent.y; y++) {
+			const int row = NarrowBand3D::TILE_SIZE * (y + NarrowBand3D::TILE_SIZE * z);
+			if (!RowSelected(sel, row)) {
+				continue;
+			}
+			const float3* vecRow = &vecFieldImage(origin.x, origin.y + y,
+					origin.z + z);
+#pragma omp simd
+			for (int x = 0; x < extent.x; x++) {
+				int l = row + x;
+				int c = PaddedIndex(x, y, z);
+				float v111 = v[c];
+				float DxNeg = v111 - v[c - PX];
+				float DxPos = v[c + PX] - v111;
+				float DyNeg = v111 - v[c - PY];
+				float DyPos = v[c + PY] - v111;
+				float DzNeg = v111 - v[c - PZ];
+				float DzPos = v[c + PZ] - v111;
+				float kappa = MeanCurvature(v, c, curvature);
+				// Level set force should be the opposite sign of advection force so it
+				// moves in the direction of the force.
+				float forceX = advectionWeight * vecRow[x].x;
+				float forceY = advectionWeight * vecRow[x].y;
+				float forceZ = advectionWeight * vecRow[x].z;
+				// Dot product force with upwind gradient
+				float advection = UpwindAdvection(forceX, forceY, forceZ, DxNeg,
+						DxPos, DyNeg, DyPos, DzNeg, DzPos);
+				delta[l] = -advection + kappa;
+			}
+		}
 	}
-
-	deltaLevelSet[gid] = -advection + kappa;
 }
-void ActiveManifold3D::applyForces(int i, int j, int k, size_t index,
-		float timeStep) {
-	float delta;
-	float old = swapLevelSet(i, j, k);
-	if (std::abs(old) > 0.5f)
-		return;
-	if (clampSpeed) {
-		delta = timeStep * clamp(deltaLevelSet[index], -1.0f, 1.0f);
-	} else {
-		delta = timeStep * deltaLevelSet[index];
+void ActiveManifold3D::applyForces(int slot, float timeStep) {
+	const float* swap = band.getTileValues(slot, SWAP);
+	const float* delta = band.getTileValues(slot, DELTA);
+	float* level = band.getTileValues(slot, LEVEL);
+	const float maxSpeed = (clampSpeed) ? 1.0f : 1E30f;
+	uint8_t sel[NarrowBand3D::TILE_VOXELS];
+	selectVoxels(slot, [](float val) {return std::abs(val) <= 0.5f;}, sel);
+#pragma omp simd
+	for (int l = 0; l < NarrowBand3D::TILE_VOXELS; l++) {
+		float prev = level[l];
+		float old = swap[l];
+		float speed = delta[l];
+		float base = (sel[l] != 0) ? old : prev;
+		speed = (sel[l] != 0) ? speed : 0.0f;
+		level[l] = base + timeStep * clamp(speed, -maxSpeed, maxSpeed);
 	}
-	old += delta;
-	levelSet(i, j, k) = float1(old);
 }
 
 int ActiveManifold3D::deleteElements() {
-	std::vector<int3> newList;
-	for (int i = 0; i < (int) activeList.size(); i++) {
-		int3 pos = activeList[i];
-		float val = swapLevelSet(pos.x, pos.y, pos.z);
+	int diff = band.removeIf([this](const int3& pos) {
+		float* swap = band.getValuePtr(pos, SWAP);
+		float val = *swap;
 		if (std::abs(val) <= MAX_DISTANCE) {
-			newList.push_back(pos);
-		} else {
-			val = sign(val) * (MAX_DISTANCE + 0.5f);
-			levelSet(pos.x, pos.y, pos.z) = val;
-			swapLevelSet(pos.x, pos.y, pos.z) = val;
+			return false;
 		}
-	}
-	int diff = (int) (activeList.size() - newList.size());
-	activeList = newList;
+		val = sign(val) * (MAX_DISTANCE + 0.5f);
+		*band.getValuePtr(pos, LEVEL) = val;
+		*swap = val;
+		return true;
+	});
+	band.flatten(activeList);
 	return diff;
 }
 int ActiveManifold3D::addElements() {
 	const int xNeighborhood[6] = { -1, 1, 0, 0, 0, 0 };
 	const int yNeighborhood[6] = { 0, 0, -1, 1, 0, 0 };
 	const int zNeighborhood[6] = { 0, 0, 0, 0, -1, 1 };
-	std::vector<int2> newList;
-	int sz = (int) activeList.size();
-	float INDICATOR = (float) std::max(std::max(levelSet.rows, levelSet.cols),
-			levelSet.slices);
-	for (int offset = 0; offset < 6; offset++) {
-		int xOff = xNeighborhood[offset];
-		int yOff = yNeighborhood[offset];
-		int zOff = zNeighborhood[offset];
-		for (int n = 0; n < sz; n++) {
-			int3 pos = activeList[n];
-			int3 pos2 = int3(pos.x + xOff, pos.y + yOff, pos.z + zOff);
-			float val1 = std::abs(levelSet(pos.x, pos.y, pos.z));
-			float val2 = std::abs(levelSet(pos2.x, pos2.y, pos2.z));
-			if (val1 <= MAX_DISTANCE - 1.0f && val2 >= MAX_DISTANCE
-					&& val2 < INDICATOR) {
-				levelSet(pos2.x, pos2.y, pos2.z) = INDICATOR + offset;
+	//Candidates are gathered per thread and inserted serially, so the band only changes in one place.
+	std::vector<std::vector<int3>> candidates(omp_get_max_threads());
+#pragma omp parallel for
+	for (int n = 0; n < (int) activeList.size(); n++) {
+		int3 pos = activeList[n];
+		if (std::abs(band.getValue(pos, LEVEL)) > MAX_DISTANCE - 1.0f) {
+			continue;
+		}
+		std::vector<int3>& local = candidates[omp_get_thread_num()];
+		for (int offset = 0; offset < 6; offset++) {
+			int3 pos2 = int3(pos.x + xNeighborhood[offset],
+					pos.y + yNeighborhood[offset], pos.z + zNeighborhood[offset]);
+			if (band.inside(pos2) && !band.contains(pos2)) {
+				local.push_back(pos2);
 			}
 		}
 	}
-	for (int offset = 0; offset < 6; offset++) {
-		int xOff = xNeighborhood[offset];
-		int yOff = yNeighborhood[offset];
-		int zOff = zNeighborhood[offset];
-		for (int n = 0; n < sz; n++) {
-			int3 pos = activeList[n];
-			int3 pos2 = int3(pos.x + xOff, pos.y + yOff, pos.z + zOff);
-			float val1 = levelSet(pos.x, pos.y, pos.z);
-			float val2 = levelSet(pos2.x, pos2.y, pos2.z);
-			if (std::abs(val1) <= MAX_DISTANCE - 1.0f
-					&& val2 == INDICATOR + offset) {
-				activeList.push_back(pos2);
-				val2 = swapLevelSet(pos2.x, pos2.y, pos2.z);
-				val2 = aly::sign(val2) * MAX_DISTANCE;
-				swapLevelSet(pos2.x, pos2.y, pos2.z) = val2;
-				levelSet(pos2.x, pos2.y, pos2.z) = val2;
+	int added = 0;
+	for (const std::vector<int3>& local : candidates) {
+		for (int3 pos2 : local) {
+			if (band.insert(pos2)) {
+				float* swap = band.getValuePtr(pos2, SWAP);
+				float val2 = aly::sign(*swap) * MAX_DISTANCE;
+				*swap = val2;
+				*band.getValuePtr(pos2, LEVEL) = val2;
+				added++;
 			}
 		}
 	}
-	return (int) (activeList.size() - sz);
+	band.flatten(activeList);
+	return added;
 }
-void ActiveManifold3D::pressureMotion(int i, int j, int k, size_t gid) {
-	float v111 = swapLevelSet(i, j, k).x;
-	float3 grad;
-	if (std::abs(v111) > 0.5f) {
-		deltaLevelSet[gid] = 0;
-		return;
-	}
-	float v010 = swapLevelSet(i - 1, j, k - 1).x;
-	float v120 = swapLevelSet(i, j + 1, k - 1).x;
-	float v110 = swapLevelSet(i, j, k - 1).x;
-	float v100 = swapLevelSet(i, j - 1, k - 1).x;
-	float v210 = swapLevelSet(i + 1, j, k - 1).x;
-	float v001 = swapLevelSet(i - 1, j - 1, k).x;
-	float v011 = swapLevelSet(i - 1, j, k).x;
-	float v101 = swapLevelSet(i, j - 1, k).x;
-	float v211 = swapLevelSet(i + 1, j, k).x;
-	float v201 = swapLevelSet(i + 1, j - 1, k).x;
-	float v221 = swapLevelSet(i + 1, j + 1, k).x;
-	float v021 = swapLevelSet(i - 1, j + 1, k).x;
-	float v121 = swapLevelSet(i, j + 1, k).x;
-	float v012 = swapLevelSet(i - 1, j, k + 1).x;
-	float v122 = swapLevelSet(i, j + 1, k + 1).x;
-	float v112 = swapLevelSet(i, j, k + 1).x;
-	float v102 = swapLevelSet(i, j - 1, k + 1).x;
-	float v212 = swapLevelSet(i + 1, j, k + 1).x;
-
-	float DxNeg = v111 - v011;
-	float DxPos = v211 - v111;
-	float DyNeg = v111 - v101;
-	float DyPos = v121 - v111;
-	float DzNeg = v111 - v110;
-	float DzPos = v112 - v111;
-
-	float DxNegMin = std::min(DxNeg, 0.0f);
-	float DxNegMax = std::max(DxNeg, 0.0f);
-	float DxPosMin = std::min(DxPos, 0.0f);
-	float DxPosMax = std::max(DxPos, 0.0f);
-	float DyNegMin = std::min(DyNeg, 0.0f);
-	float DyNegMax = std::max(DyNeg, 0.0f);
-	float DyPosMin = std::min(DyPos, 0.0f);
-	float DyPosMax = std::max(DyPos, 0.0f);
-	float DzNegMin = std::min(DzNeg, 0.0f);
-	float DzNegMax = std::max(DzNeg, 0.0f);
-	float DzPosMin = std::min(DzPos, 0.0f);
-	float DzPosMax = std::max(DzPos, 0.0f);
-
-	float DxCtr = 0.5f * (v211 - v011);
-	float DyCtr = 0.5f * (v121 - v101);
-	float DzCtr = 0.5f * (v112 - v110);
-	float DxxCtr = v211 - v111 - v111 + v011;
-	float DyyCtr = v121 - v111 - v111 + v101;
-	float DzzCtr = v112 - v111 - v111 + v110;
-	float DxyCtr = (v221 - v021 - v201 + v001) * 0.25f;
-	float DxzCtr = (v212 - v012 - v210 + v010) * 0.25f;
-	float DyzCtr = (v122 - v102 - v120 + v100) * 0.25f;
-
-	float numer = 0.5f
-			* ((DyyCtr + DzzCtr) * DxCtr * DxCtr
-					+ (DxxCtr + DzzCtr) * DyCtr * DyCtr
-					+ (DxxCtr + DyyCtr) * DzCtr * DzCtr
-					- 2 * DxCtr * DyCtr * DxyCtr - 2 * DxCtr * DzCtr * DxzCtr
-					- 2 * DyCtr * DzCtr * DyzCtr);
-	float denom = DxCtr * DxCtr + DyCtr * DyCtr + DzCtr * DzCtr;
-	float kappa = 0;
-	const float maxCurvatureForce = 10.0f;
-
-	if (std::abs(denom) > 1E-5f) {
-		kappa = curvatureParam.toFloat() * numer / denom;
-	} else {
-		kappa = curvatureParam.toFloat() * numer * sign(denom) * 1E5f;
-	}
-	if (kappa < -maxCurvatureForce) {
-		kappa = -maxCurvatureForce;
-	} else if (kappa > maxCurvatureForce) {
-		kappa = maxCurvatureForce;
-	}
-	float force = pressureParam.toFloat() * pressureImage(i, j, k).x;
-	float pressure = 0;
-	if (force > 0) {
-		float GradientSqrPos = DxNegMax * DxNegMax + DxPosMin * DxPosMin
-				+ DyNegMax * DyNegMax + DyPosMin * DyPosMin
-				+ DzNegMax * DzNegMax + DzPosMin * DzPosMin;
-		pressure = -force * std::sqrt(GradientSqrPos);
-	} else if (force < 0) {
-		float GradientSqrNeg = DxPosMax * DxPosMax + DxNegMin * DxNegMin
-				+ DyPosMax * DyPosMax + DyNegMin * DyNegMin
-				+ DzPosMax * DzPosMax + DzNegMin * DzNegMin;
-		pressure = -force * std::sqrt(GradientSqrNeg);
+void ActiveManifold3D::pressureMotion(int slot, const float* v,
+		const uint8_t* sel) {
+	const float curvature = curvatureParam.toFloat();
+	const float pressureWeight = pressureParam.toFloat();
+	const int3 origin = band.getTileOrigin(slot);
+	const int3 extent = tileExtent(slot);
+	float* delta = band.getTileValues(slot, DELTA);
+	for (int z = 0; z < extent.z; z++) {
+		for (int y = 0; y < extent.y; y++) {
+			const int row = NarrowBand3D::TILE_SIZE * (y + NarrowBand3D::TILE_SIZE * z);
+			if (!RowSelected(sel, row)) {
+				continue;
+			}
+			const float1* pressureRow = &pressureImage(origin.x, origin.y + y,
+					origin.z + z);
+			float gradientSqrPos[NarrowBand3D::TILE_SIZE];
+			float gradientSqrNeg[NarrowBand3D::TILE_SIZE];
+#pragma omp simd
+			for (int x = 0; x < extent.x; x++) {
+				int l = row + x;
+				int c = PaddedIndex(x, y, z);
+				float v111 = v[c];
+				float DxNeg = v111 - v[c - PX];
+				float DxPos = v[c + PX] - v111;
+				float DyNeg = v111 - v[c - PY];
+				float DyPos = v[c + PY] - v111;
+				float DzNeg = v111 - v[c - PZ];
+				float DzPos = v[c + PZ] - v111;
+				float DxNeg2 = DxNeg * DxNeg;
+				float DxPos2 = DxPos * DxPos;
+				float DyNeg2 = DyNeg * DyNeg;
+				float DyPos2 = DyPos * DyPos;
+				float DzNeg2 = DzNeg * DzNeg;
+				float DzPos2 = DzPos * DzPos;
+				gradientSqrPos[x] = ((DxNeg > 0) ? DxNeg2 : 0.0f)
+						+ ((DxPos < 0) ? DxPos2 : 0.0f)
+						+ ((DyNeg > 0) ? DyNeg2 : 0.0f)
+						+ ((DyPos < 0) ? DyPos2 : 0.0f)
+						+ ((DzNeg > 0) ? DzNeg2 : 0.0f)
+						+ ((DzPos < 0) ? DzPos2 : 0.0f);
+				gradientSqrNeg[x] = ((DxPos > 0) ? DxPos2 : 0.0f)
+						+ ((DxNeg < 0) ? DxNeg2 : 0.0f)
+						+ ((DyPos > 0) ? DyPos2 : 0.0f)
+						+ ((DyNeg < 0) ? DyNeg2 : 0.0f)
+						+ ((DzPos > 0) ? DzPos2 : 0.0f)
+						+ ((DzNeg < 0) ? DzNeg2 : 0.0f);
+				float kappa = MeanCurvature(v, c, curvature);
+				delta[l] = kappa;
+			}
+			for (int x = 0; x < extent.x; x++) {
+				int l = row + x;
+				float force = pressureWeight * pressureRow[x].x;
+				if (sel[l]) {
+					delta[l] += -force * std::sqrt(
+							(force > 0) ? gradientSqrPos[x] : gradientSqrNeg[x]);
+				}
+			}
+		}
 	}
-	deltaLevelSet[gid] = kappa + pressure;
 }
-void ActiveManifold3D::updateDistanceField(int i, int j, int k, int band) {
-	float v111;
-	float v011;
-	float v121;
-	float v101;
-	float v211;
-	float v110;
-	float v112;
-	float activeLevelSet = swapLevelSet(i, j, k).x;
-	if (std::abs(activeLevelSet) <= 0.5f) {
-		return;
-	}
-	v111 = levelSet(i, j, k);
-	float oldVal = v111;
-	v011 = levelSet(i - 1, j, k);
-	v121 = levelSet(i, j + 1, k);
-	v101 = levelSet(i, j - 1, k);
-	v211 = levelSet(i + 1, j, k);
-	v110 = levelSet(i, j, k - 1);
-	v112 = levelSet(i, j, k + 1);
-
-	if (v111 < -band + 0.5f) {
-		v111 = -(MAX_DISTANCE + 0.5f);
-		v111 = (v011 > 1) ? v111 : max(v011, v111);
-		v111 = (v121 > 1) ? v111 : max(v121, v111);
-		v111 = (v101 > 1) ? v111 : max(v101, v111);
-		v111 = (v211 > 1) ? v111 : max(v211, v111);
-		v111 = (v110 > 1) ? v111 : max(v110, v111);
-		v111 = (v112 > 1) ? v111 : max(v112, v111);
-		v111 -= 1.0f;
-	} else if (v111 > band - 0.5f) {
-		v111 = (MAX_DISTANCE + 0.5f);
-		v111 = (v011 < -1) ? v111 : min(v011, v111);
-		v111 = (v121 < -1) ? v111 : min(v121, v111);
-		v111 = (v101 < -1) ? v111 : min(v101, v111);
-		v111 = (v211 < -1) ? v111 : min(v211, v111);
-		v111 = (v110 < -1) ? v111 : min(v110, v111);
-		v111 = (v112 < -1) ? v111 : min(v112, v111);
-		v111 += 1.0f;
-	}
-
-	if (oldVal * v111 > 0) {
-		levelSet(i, j, k).x = v111;
-	} else {
-		levelSet(i, j, k).x = oldVal;
+void ActiveManifold3D::updateDistanceField(int slot, const float* v,
+		int layer) {
+	const float maxDistance = MAX_DISTANCE;
+	const float lower = -layer + 0.5f;
+	const float upper = layer - 0.5f;
+	float* out = band.getTileValues(slot, DELTA);
+	uint8_t sel[NarrowBand3D::TILE_VOXELS];
+	selectVoxels(slot, [](float val) {return std::abs(val) > 0.5f;}, sel);
+	for (int z = 0; z < NarrowBand3D::TILE_SIZE; z++) {
+		for (int y = 0; y < NarrowBand3D::TILE_SIZE; y++) {
+			const int row = NarrowBand3D::TILE_SIZE * (y + NarrowBand3D::TILE_SIZE * z);
+			if (!RowSelected(sel, row)) {
+				continue;
+			}
+#pragma omp simd
+			for (int x = 0; x < NarrowBand3D::TILE_SIZE; x++) {
+				int l = row + x;
+				int c = PaddedIndex(x, y, z);
+				float v111 = v[c];
+				float v011 = v[c - PX];
+				float v211 = v[c + PX];
+				float v101 = v[c - PY];
+				float v121 = v[c + PY];
+				float v110 = v[c - PZ];
+				float v112 = v[c + PZ];
+				float inner = -(maxDistance + 0.5f);
+				inner = (v011 > 1) ? inner : max(v011, inner);
+				inner = (v121 > 1) ? inner : max(v121, inner);
+				inner = (v101 > 1) ? inner : max(v101, inner);
+				inner = (v211 > 1) ? inner : max(v211, inner);
+				inner = (v110 > 1) ? inner : max(v110, inner);
+				inner = (v112 > 1) ? inner : max(v112, inner);
+				float outer = (maxDistance + 0.5f);
+				outer = (v011 < -1) ? outer : min(v011, outer);
+				outer = (v121 < -1) ? outer : min(v121, outer);
+				outer = (v101 < -1) ? outer : min(v101, outer);
+				outer = (v211 < -1) ? outer : min(v211, outer);
+				outer = (v110 < -1) ? outer : min(v110, outer);
+				outer = (v112 < -1) ? outer : min(v112, outer);
+				bool below = (v111 < lower);
+				bool above = (v111 > upper);
+				float next = (below) ? inner : ((above) ? outer : v111);
+				next += (below) ? -1.0f : ((above) ? 1.0f : 0.0f);
+				float prev = out[l];
+				out[l] = ((sel[l] != 0) & (v111 * next > 0)) ? next : prev;
+			}
+		}
 	}
 }
 
 float ActiveManifold3D::evolve(float maxStep) {
-	if (pressureImage.size() > 0) {
-		if (vecFieldImage.size() > 0) {
-#pragma omp parallel for
-			for (int i = 0; i < (int) activeList.size(); i++) {
-				int3 pos = activeList[i];
-				pressureAndAdvectionMotion(pos.x, pos.y, pos.z, i);
-			}
+	bool pressure = (pressureImage.size() > 0);
+	bool advection = (vecFieldImage.size() > 0);
+#pragma omp parallel for schedule(dynamic)
+	for (int s = 0; s < (int) band.getTileCount(); s++) {
+		float* delta = band.getTileValues(s, DELTA);
+		std::fill(delta, delta + NarrowBand3D::TILE_VOXELS, 0.0f);
+		if (!pressure && !advection) {
+			continue;
+		}
+		uint8_t sel[NarrowBand3D::TILE_VOXELS];
+		if (selectVoxels(s, [](float val) {return std::abs(val) <= 0.5f;}, sel) == 0) {
+			continue;
+		}
+		float v[NarrowBand3D::PADDED_VOXELS];
+		band.gather(s, SWAP, v);
+		if (pressure && advection) {
+			pressureAndAdvectionMotion(s, v, sel);
+		} else if (pressure) {
+			pressureMotion(s, v, sel);
 		} else {
-#pragma omp parallel for
-			for (int i = 0; i < (int) activeList.size(); i++) {
-				int3 pos = activeList[i];
-				pressureMotion(pos.x, pos.y, pos.z, i);
-			}
+			advectionMotion(s, v, sel);
 		}
-	} else if (vecFieldImage.size() > 0) {
-#pragma omp parallel for
-		for (int i = 0; i < (int) activeList.size(); i++) {
-			int3 pos = activeList[i];
-			advectionMotion(pos.x, pos.y, pos.z, i);
+#pragma omp simd
+		for (int l = 0; l < NarrowBand3D::TILE_VOXELS; l++) {
+			delta[l] = (sel[l] != 0) ? delta[l] : 0.0f;
 		}
 	}
+	return updateLevelSet(maxStep);
+}
+float ActiveManifold3D::updateLevelSet(float maxStep) {
+	const int tileCount = (int) band.getTileCount();
 	float timeStep = (float) maxStep;
 	if (!clampSpeed) {
+		std::vector<float> tileDelta(tileCount, 0.0f);
+#pragma omp parallel for
+		for (int s = 0; s < tileCount; s++) {
+			const float* delta = band.getTileValues(s, DELTA);
+			float maxDelta = 0.0f;
+#pragma omp simd reduction(max:maxDelta)
+			for (int l = 0; l < NarrowBand3D::TILE_VOXELS; l++) {
+				maxDelta = std::max(std::abs(delta[l]), maxDelta);
+			}
+			tileDelta[s] = maxDelta;
+		}
 		float maxDelta = 0.0f;
-		for (float delta : deltaLevelSet) {
-			maxDelta = std::max(std::abs(delta), maxDelta);
+		for (float delta : tileDelta) {
+			maxDelta = std::max(delta, maxDelta);
 		}
 		const float maxSpeed = 0.999f;
 		timeStep = (float) (maxStep
@@ -628,34 +525,32 @@ float ActiveManifold3D::evolve(float maxStep) {
 	}
 	contourLock.lock();
 #pragma omp parallel for
-	for (int i = 0; i < (int) activeList.size(); i++) {
-		int3 pos = activeList[i];
-		applyForces(pos.x, pos.y, pos.z, i, timeStep);
-	}
-	for (int band = 1; band <= maxLayers; band++) {
-#pragma omp parallel for
-		for (int i = 0; i < (int) activeList.size(); i++) {
-			int3 pos = activeList[i];
-			updateDistanceField(pos.x, pos.y, pos.z, band);
+	for (int s = 0; s < tileCount; s++) {
+		applyForces(s, timeStep);
+	}
+	//Each layer reads the whole band before any tile is written back.
+	copyChannel(LEVEL, DELTA);
+	for (int layer = 1; layer <= maxLayers; layer++) {
+#pragma omp parallel for schedule(dynamic)
+		for (int s = 0; s < tileCount; s++) {
+			float v[NarrowBand3D::PADDED_VOXELS];
+			band.gather(s, LEVEL, v);
+			updateDistanceField(s, v, layer);
 		}
+		copyChannel(DELTA, LEVEL);
 	}
-#pragma omp parallel for
-	for (int i = 0; i < (int) activeList.size(); i++) {
-		int3 pos = activeList[i];
-		plugLevelSet(pos.x, pos.y, pos.z, i);
+#pragma omp parallel for schedule(dynamic)
+	for (int s = 0; s < tileCount; s++) {
+		float v[NarrowBand3D::PADDED_VOXELS];
+		band.gather(s, LEVEL, v);
+		plugLevelSet(s, v);
 	}
+	copyChannel(DELTA, LEVEL);
 	requestUpdateSurface = true;
 	contourLock.unlock();
-
-#pragma omp parallel for
-	for (int i = 0; i < (int) activeList.size(); i++) {
-		int3 pos = activeList[i];
-		swapLevelSet(pos.x, pos.y, pos.z) = levelSet(pos.x, pos.y, pos.z);
-	}
+	copyChannel(LEVEL, SWAP);
 	deleteElements();
 	addElements();
-	deltaLevelSet.clear();
-	deltaLevelSet.resize(activeList.size(), 0.0f);
 	return timeStep;
 }
 bool ActiveManifold3D::stepInternal() {
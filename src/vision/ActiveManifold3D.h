@@ -27,6 +27,7 @@
 #include "graphics/AlloyIsoSurface.h"
 #include "vision/Manifold3D.h"
 #include "vision/ManifoldCache3D.h"
+#include "vision/NarrowBand.h"
 namespace aly {
 class ActiveManifold3D: public Simulation {
 protected:
@@ -44,25 +45,112 @@ protected:
 	const int maxLayers = 3;
 	bool requestUpdateSurface;
 	Volume1f initialLevelSet;
-	Volume1f levelSet;
-	Volume1f swapLevelSet;
 	Volume1f pressureImage;
 	Volume3f vecFieldImage;
-	std::vector<float> deltaLevelSet;
 	std::vector<int3> activeList;
+	//Holds the level set. Only tiles near the surface are allocated.
+	NarrowBand3D band;
+	//Channels of the band. DELTA holds each voxel's update and is reused as scratch.
+	static const int LEVEL = 0;
+	static const int SWAP = 1;
+	static const int DELTA = 2;
+	//Strides of a tile gathered with a one voxel border.
+	static const int PX = 1;
+	static const int PY = NarrowBand3D::PADDED_SIZE;
+	static const int PZ = NarrowBand3D::PADDED_SIZE * NarrowBand3D::PADDED_SIZE;
+	static int PaddedIndex(int x, int y, int z) {
+		return PX * (x + 1) + PY * (y + 1) + PZ * (z + 1);
+	}
+	//Clamped mean curvature at index c of a gathered tile.
+	static float MeanCurvature(const float* v, int c, float weight) {
+		float v111 = v[c];
+		float v011 = v[c - PX];
+		float v211 = v[c + PX];
+		float v101 = v[c - PY];
+		float v121 = v[c + PY];
+		float v110 = v[c - PZ];
+		float v112 = v[c + PZ];
+		float DxCtr = 0.5f * (v211 - v011);
+		float DyCtr = 0.5f * (v121 - v101);
+		float DzCtr = 0.5f * (v112 - v110);
+		float DxxCtr = v211 - v111 - v111 + v011;
+		float DyyCtr = v121 - v111 - v111 + v101;
+		float DzzCtr = v112 - v111 - v111 + v110;
+		float DxyCtr = (v[c + PX + PY] - v[c - PX + PY] - v[c + PX - PY]
+				+ v[c - PX - PY]) * 0.25f;
+		float DxzCtr = (v[c + PX + PZ] - v[c - PX + PZ] - v[c + PX - PZ]
+				+ v[c - PX - PZ]) * 0.25f;
+		float DyzCtr = (v[c + PY + PZ] - v[c - PY + PZ] - v[c + PY - PZ]
+				+ v[c - PY - PZ]) * 0.25f;
+		float numer = 0.5f
+				* ((DyyCtr + DzzCtr) * DxCtr * DxCtr
+						+ (DxxCtr + DzzCtr) * DyCtr * DyCtr
+						+ (DxxCtr + DyyCtr) * DzCtr * DzCtr
+						- 2 * DxCtr * DyCtr * DxyCtr
+						- 2 * DxCtr * DzCtr * DxzCtr
+						- 2 * DyCtr * DzCtr * DyzCtr);
+		float denom = DxCtr * DxCtr + DyCtr * DyCtr + DzCtr * DzCtr;
+		const float maxCurvatureForce = 10.0f;
+		//denom is a sum of squares, so a lower bound stands in for the branch on its size.
+		float kappa = weight * numer / std::max(denom, 1E-5f);
+		return clamp(kappa, -maxCurvatureForce, maxCurvatureForce);
+	}
+	//Force dotted with the upwind differences. Both sides are weighted rather than selected, so every lane runs the same arithmetic.
+	static float UpwindAdvection(float forceX, float forceY, float forceZ,
+			float DxNeg, float DxPos, float DyNeg, float DyPos, float DzNeg,
+			float DzPos) {
+		return (std::max(forceX, 0.0f) * DxNeg + std::min(forceX, 0.0f) * DxPos)
+				+ (std::max(forceY, 0.0f) * DyNeg
+						+ std::min(forceY, 0.0f) * DyPos)
+				+ (std::max(forceZ, 0.0f) * DzNeg
+						+ std::min(forceZ, 0.0f) * DzPos);
+	}
 	std::mutex contourLock;
 	aly::HorizontalSliderPtr pressureSlider,curavtureSlider,advectionSlider;
 	bool getBitValue(int i);
 	void rescale(aly::Volume1f& pressureForce);
-	void pressureMotion(int i, int j, int k, size_t index);
-	void pressureAndAdvectionMotion(int i, int j, int k, size_t index);
-	void advectionMotion(int i, int j, int k, size_t index);
-	void applyForces(int i, int j, int k, size_t index, float timeStep);
-	void plugLevelSet(int i, int j, int k, size_t index);
-	void updateDistanceField(int i, int j, int k, int band);
+	//Sets sel for the tile's band voxels whose SWAP value passes test and clears it elsewhere. Returns the number set.
+	template<class F> int selectVoxels(int slot, const F& test, uint8_t* sel) const {
+		const float* swap = band.getTileValues(slot, SWAP);
+		int count = 0;
+		for (int l = 0; l < NarrowBand3D::TILE_VOXELS; l++) {
+			sel[l] = (band.isActive(slot, l) && test(swap[l])) ? 1 : 0;
+			count += sel[l];
+		}
+		return count;
+	}
+	//True if sel is set for any voxel of the tile row that starts at index row.
+	static bool RowSelected(const uint8_t* sel, int row) {
+		for (int x = 0; x < NarrowBand3D::TILE_SIZE; x++) {
+			if (sel[row + x]) {
+				return true;
+			}
+		}
+		return false;
+	}
+	//Number of the tile's columns, rows and slices that lie inside the grid.
+	int3 tileExtent(int slot) const {
+		const int size = NarrowBand3D::TILE_SIZE;
+		int3 origin = band.getTileOrigin(slot);
+		int3 dims = band.dimensions();
+		return int3(std::min(size, dims.x - origin.x),
+				std::min(size, dims.y - origin.y),
+				std::min(size, dims.z - origin.z));
+	}
+	//Motion kernels read the SWAP channel of a tile gathered into v and write DELTA for its voxels inside the grid. Voxels outside sel are cleared afterwards.
+	void pressureMotion(int slot, const float* v, const uint8_t* sel);
+	void pressureAndAdvectionMotion(int slot, const float* v,
+			const uint8_t* sel);
+	void advectionMotion(int slot, const float* v, const uint8_t* sel);
+	void applyForces(int slot, float timeStep);
+	void plugLevelSet(int slot, const float* v);
+	void updateDistanceField(int slot, const float* v, int layer);
+	void copyChannel(int from, int to);
 	int deleteElements();
 	int addElements();
 	virtual float evolve(float maxStep);
+	//Applies the motion in DELTA, redistances the band and moves it with the surface.
+	float updateLevelSet(float maxStep);
 	void rebuildNarrowBand();
 
 	bool updateSurface();
@@ -109,8 +197,8 @@ public:
 		advectionParam.setValue(c);
 	}
 	Manifold3D* getManifold();
-	Volume1f& getLevelSet();
-	const Volume1f& getLevelSet() const;
+	//Copies the level set out of the narrow band into a dense volume. The solver itself never builds this copy.
+	Volume1f getLevelSet() const;
 	virtual bool init() override;
 	virtual void cleanup() override;
 	std::shared_ptr<ManifoldCache3D> getCache() const {
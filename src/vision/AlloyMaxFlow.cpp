@@ -553,15 +553,12 @@ bool MaxFlow::step() {
 	}
 	const int UPDATE_INTERVAL = 256;
 	if (iterationCount % UPDATE_INTERVAL == 0) {
-		for (auto iter = activeList.begin(); iter != activeList.end(); iter++) {
+		for (auto iter = activeList.begin(); iter != activeList.end();) {
 			Node* node = *iter;
 			if (!node->active) {
-				activeList.erase(iter);
-				if (!activeList.empty()) {
-					iter--;
-				} else {
-					break;
-				}
+				iter = activeList.erase(iter);
+			} else {
+				iter++;
 			}
 		}
 	}
@@ -904,5 +901,603 @@ void FastMaxFlow::setEdgeCapacity(int i, int j, int dir, float w1, float w2) {
 	edgeCapacity[reverse[dir]][index(i, j, dir)] = w2;
 }
 
+const uint8_t GridMaxFlow::PARENT_NONE = 255;
+const uint8_t GridMaxFlow::PARENT_TERMINAL = 254;
+const uint8_t GridMaxFlow::PARENT_ORPHAN = 253;
+const int GridMaxFlow::INF_DISTANCE = std::numeric_limits<int>::max();
+GridMaxFlow::GridMaxFlow(int width, int height, int depth, int connectivity) :
+		width(0), height(0), depth(1), connectivity(4), paddedDims(0), totalFlow(
+				0.0), timestamp(0), activeHead(0), orphanHead(0) {
+	resize(width, height, depth, connectivity);
+}
+void GridMaxFlow::resize(int w, int h, int d, int conn) {
+	if (conn != 4 && conn != 8 && conn != 6 && conn != 26) {
+		throw std::runtime_error(
+				MakeString() << "Unsupported grid connectivity " << conn);
+	}
+	width = w;
+	height = h;
+	depth = std::max(d, 1);
+	connectivity = conn;
+	paddedDims = int3(width + 2, height + 2, (depth > 1) ? depth + 2 : 1);
+	//Opposite directions are stored in pairs so that the reverse of d is d^1.
+	offsets.clear();
+	const bool planar = (conn == 4 || conn == 8);
+	for (int norm = 1; norm <= 3; norm++) {
+		for (int dx = 1; dx >= -1; dx--) {
+			for (int dy = 1; dy >= -1; dy--) {
+				for (int dz = 1; dz >= -1; dz--) {
+					int3 off(dx, dy, dz);
+					if (std::abs(dx) + std::abs(dy) + std::abs(dz) != norm)
+						continue;
+					if (planar && dz != 0)
+						continue;
+					if ((conn == 4 || conn == 6) && norm > 1)
+						continue;
+					//First non-zero component positive picks one of each pair.
+					int lead = (dx != 0) ? dx : ((dy != 0) ? dy : dz);
+					if (lead < 0)
+						continue;
+					offsets.push_back(off);
+					offsets.push_back(-off);
+				}
+			}
+		}
+	}
+	nodeOffsets.resize(offsets.size());
+	for (size_t dir = 0; dir < offsets.size(); dir++) {
+		nodeOffsets[dir] = offsets[dir].x
+				+ (int64_t) paddedDims.x
+						* (offsets[dir].y + (int64_t) paddedDims.y * offsets[dir].z);
+	}
+	reset();
+}
+void GridMaxFlow::reset() {
+	size_t N = paddedDims.x * (size_t) paddedDims.y * paddedDims.z;
+	edgeCapacity.assign(N * offsets.size(), 0.0f);
+	terminalCapacity.assign(N, 0.0f);
+	parents.assign(N, PARENT_NONE);
+	sinkTree.assign(N, 0);
+	activeFlags.assign(N, 0);
+	timestamps.assign(N, 0);
+	distances.assign(N, 0);
+	labels.assign(N, 2);
+	activeQueue.clear();
+	orphanQueue.clear();
+	activeHead = 0;
+	orphanHead = 0;
+	timestamp = 0;
+	totalFlow = 0.0;
+}
+void GridMaxFlow::setEdgeCapacity(int i, int j, int k, int dir, float fwdCap,
+		float revCap) {
+	int3 off = offsets[dir];
+	if (!inside(i, j, k) || !inside(i + off.x, j + off.y, k + off.z))
+		return;
+	size_t n = index(i, j, k);
+	edgeCapacity[n * offsets.size() + dir] = fwdCap;
+	edgeCapacity[neighbor(n, dir) * offsets.size() + (dir ^ 1)] = revCap;
+}
+void GridMaxFlow::addNodeCapacity(int i, int j, int k, float sourceCapacity,
+		float sinkCapacity) {
+	size_t n = index(i, j, k);
+	float delta = terminalCapacity[n];
+	if (delta > 0) {
+		sourceCapacity += delta;
+	} else {
+		sinkCapacity -= delta;
+	}
+	totalFlow += std::min(sourceCapacity, sinkCapacity);
+	terminalCapacity[n] = sourceCapacity - sinkCapacity;
+}
+void GridMaxFlow::setActive(size_t n) {
+	if (!activeFlags[n]) {
+		activeFlags[n] = 1;
+		activeQueue.push_back(n);
+	}
+}
+size_t GridMaxFlow::nextActive() {
+	while (activeHead < activeQueue.size()) {
+		size_t n = activeQueue[activeHead++];
+		activeFlags[n] = 0;
+		if (parents[n] != PARENT_NONE) {
+			return n;
+		}
+	}
+	activeQueue.clear();
+	activeHead = 0;
+	return std::numeric_limits<size_t>::max();
+}
+void GridMaxFlow::setOrphan(size_t n) {
+	parents[n] = PARENT_ORPHAN;
+	orphanQueue.push_back(n);
 }
+void GridMaxFlow::augment(size_t src, int dir) {
+	const int K = (int) offsets.size();
+	size_t sink = neighbor(src, dir);
+	float bottleneck = edgeCapacity[src * K + dir];
+	size_t n;
+	for (n = src; parents[n] != PARENT_TERMINAL;) {
+		int pd = parents[n];
+		size_t p = neighbor(n, pd);
+		bottleneck = std::min(bottleneck, edgeCapacity[p * K + (pd ^ 1)]);
+		n = p;
+	}
+	bottleneck = std::min(bottleneck, terminalCapacity[n]);
+	for (n = sink; parents[n] != PARENT_TERMINAL;) {
+		int pd = parents[n];
+		bottleneck = std::min(bottleneck, edgeCapacity[n * K + pd]);
+		n = neighbor(n, pd);
+	}
+	bottleneck = std::min(bottleneck, -terminalCapacity[n]);
 
+	edgeCapacity[src * K + dir] -= bottleneck;
+	edgeCapacity[sink * K + (dir ^ 1)] += bottleneck;
+	for (n = src; parents[n] != PARENT_TERMINAL;) {
+		int pd = parents[n];
+		size_t p = neighbor(n, pd);
+		edgeCapacity[n * K + pd] += bottleneck;
+		edgeCapacity[p * K + (pd ^ 1)] -= bottleneck;
+		if (edgeCapacity[p * K + (pd ^ 1)] <= 0) {
+			setOrphan(n);
+		}
+		n = p;
+	}
+	terminalCapacity[n] -= bottleneck;
+	if (terminalCapacity[n] <= 0) {
+		setOrphan(n);
+	}
+	for (n = sink; parents[n] != PARENT_TERMINAL;) {
+		int pd = parents[n];
+		size_t p = neighbor(n, pd);
+		edgeCapacity[p * K + (pd ^ 1)] += bottleneck;
+		edgeCapacity[n * K + pd] -= bottleneck;
+		if (edgeCapacity[n * K + pd] <= 0) {
+			setOrphan(n);
+		}
+		n = p;
+	}
+	terminalCapacity[n] += bottleneck;
+	if (terminalCapacity[n] >= 0) {
+		setOrphan(n);
+	}
+	totalFlow += bottleneck;
+}
+void GridMaxFlow::processSourceOrphan(size_t n) {
+	const int K = (int) offsets.size();
+	int minDir = PARENT_NONE;
+	int minDist = INF_DISTANCE;
+	for (int dir = 0; dir < K; dir++) {
+		size_t nbr = neighbor(n, dir);
+		if (edgeCapacity[nbr * K + (dir ^ 1)] > 0 && !sinkTree[nbr]
+				&& parents[nbr] != PARENT_NONE) {
+			//Distance to the source through nbr, or INF if nbr hangs off an orphan.
+			int d = 0;
+			size_t m = nbr;
+			while (true) {
+				if (timestamps[m] == timestamp) {
+					d += distances[m];
+					break;
+				}
+				int pd = parents[m];
+				d++;
+				if (pd == PARENT_TERMINAL) {
+					timestamps[m] = timestamp;
+					distances[m] = 1;
+					break;
+				}
+				if (pd == PARENT_ORPHAN) {
+					d = INF_DISTANCE;
+					break;
+				}
+				m = neighbor(m, pd);
+			}
+			if (d < INF_DISTANCE) {
+				if (d < minDist) {
+					minDir = dir;
+					minDist = d;
+				}
+				for (m = nbr; timestamps[m] != timestamp;
+						m = neighbor(m, parents[m])) {
+					timestamps[m] = timestamp;
+					distances[m] = d--;
+				}
+			}
+		}
+	}
+	parents[n] = (uint8_t) minDir;
+	if (minDir != PARENT_NONE) {
+		timestamps[n] = timestamp;
+		distances[n] = minDist + 1;
+	} else {
+		for (int dir = 0; dir < K; dir++) {
+			size_t nbr = neighbor(n, dir);
+			int pd = parents[nbr];
+			if (!sinkTree[nbr] && pd != PARENT_NONE) {
+				if (edgeCapacity[nbr * K + (dir ^ 1)] > 0)
+					setActive(nbr);
+				if (pd != PARENT_TERMINAL && pd != PARENT_ORPHAN
+						&& neighbor(nbr, pd) == n) {
+					setOrphan(nbr);
+				}
+			}
+		}
+	}
+}
+void GridMaxFlow::processSinkOrphan(size_t n) {
+	const int K = (int) offsets.size();
+	int minDir = PARENT_NONE;
+	int minDist = INF_DISTANCE;
+	for (int dir = 0; dir < K; dir++) {
+		size_t nbr = neighbor(n, dir);
+		if (edgeCapacity[n * K + dir] > 0 && sinkTree[nbr]
+				&& parents[nbr] != PARENT_NONE) {
+			int d = 0;
+			size_t m = nbr;
+			while (true) {
+				if (timestamps[m] == timestamp) {
+					d += distances[m];
+					break;
+				}
+				int pd = parents[m];
+				d++;
+				if (pd == PARENT_TERMINAL) {
+					timestamps[m] = timestamp;
+					distances[m] = 1;
+					break;
+				}
+				if (pd == PARENT_ORPHAN) {
+					d = INF_DISTANCE;
+					break;
+				}
+				m = neighbor(m, pd);
+			}
+			if (d < INF_DISTANCE) {
+				if (d < minDist) {
+					minDir = dir;
+					minDist = d;
+				}
+				for (m = nbr; timestamps[m] != timestamp;
+						m = neighbor(m, parents[m])) {
+					timestamps[m] = timestamp;
+					distances[m] = d--;
+				}
+			}
+		}
+	}
+	parents[n] = (uint8_t) minDir;
+	if (minDir != PARENT_NONE) {
+		timestamps[n] = timestamp;
+		distances[n] = minDist + 1;
+	} else {
+		for (int dir = 0; dir < K; dir++) {
+			size_t nbr = neighbor(n, dir);
+			int pd = parents[nbr];
+			if (sinkTree[nbr] && pd != PARENT_NONE) {
+				if (edgeCapacity[n * K + dir] > 0)
+					setActive(nbr);
+				if (pd != PARENT_TERMINAL && pd != PARENT_ORPHAN
+						&& neighbor(nbr, pd) == n) {
+					setOrphan(nbr);
+				}
+			}
+		}
+	}
+}
+void GridMaxFlow::solve(
+		const std::function<bool(const std::string& message, float progress)>& monitor) {
+	const int K = (int) offsets.size();
+	const size_t NONE = std::numeric_limits<size_t>::max();
+	const uint64_t UPDATE_INTERVAL = 1 << 16;
+	activeQueue.clear();
+	orphanQueue.clear();
+	activeHead = 0;
+	orphanHead = 0;
+	timestamp = 0;
+	std::fill(activeFlags.begin(), activeFlags.end(), 0);
+	for (int k = 0; k < depth; k++) {
+		for (int j = 0; j < height; j++) {
+			for (int i = 0; i < width; i++) {
+				size_t n = index(i, j, k);
+				timestamps[n] = 0;
+				if (terminalCapacity[n] != 0) {
+					sinkTree[n] = (terminalCapacity[n] < 0) ? 1 : 0;
+					parents[n] = PARENT_TERMINAL;
+					distances[n] = 1;
+					setActive(n);
+				} else {
+					parents[n] = PARENT_NONE;
+				}
+			}
+		}
+	}
+	if (monitor) {
+		if (!monitor("Solving Max-Flow ...", 0.0f))
+			return;
+	}
+	size_t current = NONE;
+	uint64_t iteration = 0;
+	while (true) {
+		if (current != NONE) {
+			activeFlags[current] = 0;
+			if (parents[current] == PARENT_NONE)
+				current = NONE;
+		}
+		if (current == NONE) {
+			current = nextActive();
+			if (current == NONE)
+				break;
+		}
+		//Grow the tree of the current node until it touches the other tree.
+		size_t joinNode = NONE;
+		int joinDir = 0;
+		size_t n = current;
+		if (!sinkTree[n]) {
+			for (int dir = 0; dir < K; dir++) {
+				if (edgeCapacity[n * K + dir] > 0) {
+					size_t nbr = neighbor(n, dir);
+					if (parents[nbr] == PARENT_NONE) {
+						sinkTree[nbr] = 0;
+						parents[nbr] = (uint8_t) (dir ^ 1);
+						timestamps[nbr] = timestamps[n];
+						distances[nbr] = distances[n] + 1;
+						setActive(nbr);
+					} else if (sinkTree[nbr]) {
+						joinNode = n;
+						joinDir = dir;
+						break;
+					} else if (timestamps[nbr] <= timestamps[n]
+							&& distances[nbr] > distances[n]) {
+						parents[nbr] = (uint8_t) (dir ^ 1);
+						timestamps[nbr] = timestamps[n];
+						distances[nbr] = distances[n] + 1;
+					}
+				}
+			}
+		} else {
+			for (int dir = 0; dir < K; dir++) {
+				size_t nbr = neighbor(n, dir);
+				if (edgeCapacity[nbr * K + (dir ^ 1)] > 0) {
+					if (parents[nbr] == PARENT_NONE) {
+						sinkTree[nbr] = 1;
+						parents[nbr] = (uint8_t) (dir ^ 1);
+						timestamps[nbr] = timestamps[n];
+						distances[nbr] = distances[n] + 1;
+						setActive(nbr);
+					} else if (!sinkTree[nbr]) {
+						joinNode = nbr;
+						joinDir = dir ^ 1;
+						break;
+					} else if (timestamps[nbr] <= timestamps[n]
+							&& distances[nbr] > distances[n]) {
+						parents[nbr] = (uint8_t) (dir ^ 1);
+						timestamps[nbr] = timestamps[n];
+						distances[nbr] = distances[n] + 1;
+					}
+				}
+			}
+		}
+		timestamp++;
+		if (joinNode != NONE) {
+			//Keep the current node active while its tree is repaired.
+			activeFlags[current] = 1;
+			augment(joinNode, joinDir);
+			while (orphanHead < orphanQueue.size()) {
+				size_t orphan = orphanQueue[orphanHead++];
+				if (sinkTree[orphan]) {
+					processSinkOrphan(orphan);
+				} else {
+					processSourceOrphan(orphan);
+				}
+			}
+			orphanQueue.clear();
+			orphanHead = 0;
+		} else {
+			current = NONE;
+		}
+		//Drop processed entries so the queue does not grow without bound.
+		if (activeHead > 4096 && 2 * activeHead > activeQueue.size()) {
+			activeQueue.erase(activeQueue.begin(),
+					activeQueue.begin() + activeHead);
+			activeHead = 0;
+		}
+		if (monitor && (++iteration) % UPDATE_INTERVAL == 0) {
+			if (!monitor(MakeString() << "Solving Max-Flow [" << totalFlow << "]",
+					activeHead / (float) std::max(activeQueue.size(), (size_t) 1)))
+				break;
+		}
+	}
+	for (size_t n = 0; n < parents.size(); n++) {
+		labels[n] =
+				(parents[n] == PARENT_NONE) ? 2 : ((sinkTree[n]) ? 1 : 0);
+	}
+}
+void GridMaxFlow::globalRelabel(std::vector<float>& excess,
+		std::vector<int>& heights) {
+	const int K = (int) offsets.size();
+	std::vector<size_t>& queue = activeQueue;
+	queue.clear();
+	std::fill(heights.begin(), heights.end(), INF_DISTANCE);
+	for (int k = 0; k < depth; k++) {
+		for (int j = 0; j < height; j++) {
+			for (int i = 0; i < width; i++) {
+				size_t n = index(i, j, k);
+				if (excess[n] < 0) {
+					heights[n] = 1;
+					queue.push_back(n);
+				}
+			}
+		}
+	}
+	//Breadth first search from the sink over reversed residual arcs.
+	for (size_t head = 0; head < queue.size(); head++) {
+		size_t n = queue[head];
+		int h = heights[n] + 1;
+		for (int dir = 0; dir < K; dir++) {
+			size_t nbr = neighbor(n, dir);
+			if (heights[nbr] == INF_DISTANCE
+					&& edgeCapacity[nbr * K + (dir ^ 1)] > 0) {
+				heights[nbr] = h;
+				queue.push_back(nbr);
+			}
+		}
+	}
+	queue.clear();
+}
+void GridMaxFlow::dischargeRegion(const int3& minPt, const int3& maxPt,
+		std::vector<float>& excess, std::vector<int>& heights,
+		std::vector<size_t>& queue) {
+	const int K = (int) offsets.size();
+	const int maxHeight = (int) std::min(
+			(size_t) INF_DISTANCE - 1, (size_t) width * height * depth + 1);
+	auto inRegion = [&](size_t n) {
+		int64_t t = (int64_t)n;
+		int x = (int)(t % paddedDims.x) - 1;
+		t /= paddedDims.x;
+		int y = (int)(t % paddedDims.y) - 1;
+		int z = (int)(t / paddedDims.y) - ((depth > 1) ? 1 : 0);
+		return (x >= minPt.x && y >= minPt.y && z >= minPt.z && x <= maxPt.x && y <= maxPt.y && z <= maxPt.z);
+	};
+	size_t relabelBudget = (size_t) (maxPt.x - minPt.x + 1)
+			* (maxPt.y - minPt.y + 1) * (maxPt.z - minPt.z + 1);
+	queue.clear();
+	for (int k = minPt.z; k <= maxPt.z; k++) {
+		for (int j = minPt.y; j <= maxPt.y; j++) {
+			for (int i = minPt.x; i <= maxPt.x; i++) {
+				size_t n = index(i, j, k);
+				if (excess[n] > 0 && heights[n] < INF_DISTANCE) {
+					queue.push_back(n);
+				}
+			}
+		}
+	}
+	for (size_t head = 0; head < queue.size(); head++) {
+		//Nodes are queued again each time they regain excess, so the consumed prefix is dropped to bound the queue.
+		if (head >= 4096 && 2 * head >= queue.size()) {
+			queue.erase(queue.begin(), queue.begin() + head);
+			head = 0;
+		}
+		size_t n = queue[head];
+		while (excess[n] > 0) {
+			int h = heights[n];
+			for (int dir = 0; dir < K && excess[n] > 0; dir++) {
+				float& cap = edgeCapacity[n * K + dir];
+				if (cap > 0) {
+					size_t nbr = neighbor(n, dir);
+					if (heights[nbr] == h - 1) {
+						float flow = std::min(excess[n], cap);
+						cap -= flow;
+						edgeCapacity[nbr * K + (dir ^ 1)] += flow;
+						excess[n] -= flow;
+						if (inRegion(nbr)) {
+							bool wasActive = (excess[nbr] > 0);
+							excess[nbr] += flow;
+							if (!wasActive && excess[nbr] > 0) {
+								queue.push_back(nbr);
+							}
+						} else {
+							//Neighboring blocks are idle, but two blocks may feed the same node.
+#pragma omp atomic
+							excess[nbr] += flow;
+						}
+					}
+				}
+			}
+			if (excess[n] <= 0)
+				break;
+			int minHeight = INF_DISTANCE;
+			for (int dir = 0; dir < K; dir++) {
+				if (edgeCapacity[n * K + dir] > 0) {
+					int nh = heights[neighbor(n, dir)];
+					if (nh < minHeight)
+						minHeight = nh;
+				}
+			}
+			if (minHeight >= maxHeight) {
+				heights[n] = INF_DISTANCE;
+				break;
+			}
+			heights[n] = minHeight + 1;
+			//Local labels drift from the true distances, so hand back to a global relabel after one relabel per node.
+			if (--relabelBudget == 0)
+				return;
+		}
+	}
+}
+void GridMaxFlow::solveParallel(
+		const std::function<bool(const std::string& message, float progress)>& monitor,
+		int blockSize) {
+	const size_t N = parents.size();
+	std::vector<float> excess = terminalCapacity;
+	std::vector<int> heights(N, INF_DISTANCE);
+	std::vector<float> sinkCapacity(N);
+	for (size_t n = 0; n < N; n++) {
+		sinkCapacity[n] = std::max(-terminalCapacity[n], 0.0f);
+	}
+	blockSize = std::max(blockSize, 1);
+	int3 blocks((width + blockSize - 1) / blockSize,
+			(height + blockSize - 1) / blockSize,
+			(depth + blockSize - 1) / blockSize);
+	int colors = (depth > 1) ? 8 : 4;
+	if (monitor) {
+		if (!monitor("Solving Max-Flow ...", 0.0f))
+			return;
+	}
+	globalRelabel(excess, heights);
+	int phase = 0;
+	while (true) {
+		size_t activeCount = 0;
+#pragma omp parallel for reduction(+:activeCount)
+		for (int64_t n = 0; n < (int64_t) N; n++) {
+			if (excess[n] > 0 && heights[n] < INF_DISTANCE)
+				activeCount++;
+		}
+		if (activeCount == 0)
+			break;
+		if (monitor) {
+			if (!monitor(
+					MakeString() << "Solving Max-Flow [phase " << phase << ", "
+							<< activeCount << " active]",
+					1.0f - activeCount / (float) (width * height * depth)))
+				break;
+		}
+		//Blocks of one color never touch, so each color is discharged in parallel.
+		for (int c = 0; c < colors; c++) {
+			int3 parity(c & 1, (c >> 1) & 1, (c >> 2) & 1);
+			int3 colorBlocks((blocks.x - parity.x + 1) / 2,
+					(blocks.y - parity.y + 1) / 2, (blocks.z - parity.z + 1) / 2);
+			int64_t count = (int64_t) colorBlocks.x * colorBlocks.y
+					* colorBlocks.z;
+#pragma omp parallel
+			{
+				std::vector<size_t> queue;
+#pragma omp for schedule(dynamic)
+				for (int64_t b = 0; b < count; b++) {
+					int3 bijk(2 * (int) (b % colorBlocks.x) + parity.x,
+							2 * (int) ((b / colorBlocks.x) % colorBlocks.y)
+									+ parity.y,
+							2 * (int) (b / ((int64_t) colorBlocks.x * colorBlocks.y))
+									+ parity.z);
+					int3 minPt = bijk * blockSize;
+					int3 maxPt = aly::min(minPt + int3(blockSize - 1),
+							int3(width - 1, height - 1, depth - 1));
+					dischargeRegion(minPt, maxPt, excess, heights, queue);
+				}
+			}
+		}
+		globalRelabel(excess, heights);
+		phase++;
+	}
+	double flow = 0.0;
+	for (size_t n = 0; n < N; n++) {
+		flow += sinkCapacity[n] - std::max(-excess[n], 0.0f);
+		labels[n] = (heights[n] < INF_DISTANCE) ? 1 : 0;
+	}
+	totalFlow += flow;
+	//Residual capacities now describe the final cut, so the terminal state is cleared.
+	for (size_t n = 0; n < N; n++) {
+		terminalCapacity[n] = 0.0f;
+	}
+}
+
+}
@@ -30,6 +30,7 @@
 #define INCLUDE_CORE_ALLOYMAXFLOW_H_
 
 #include <list>
+#include <functional>
 
 #include "math/AlloyVecMath.h"
 namespace aly {
@@ -179,6 +180,122 @@ public:
 	void setTerminalCapacity(int i, int j, float srcW, float sinkW);
 	void setEdgeCapacity(int i, int j, int dir, float w1, float w2);
 };
+/*
+ Max-flow for 4/8-connected images and 6/26-connected volumes. Edges are
+ implicit: every node keeps the residual capacity of its arcs in a flat array
+ indexed by neighbor direction, and the grid is padded by one node on each
+ side so that neighbors never need bounds checks. Direction d and d^1 are
+ opposite (see getNeighborOffset()).
+ solve() runs Boykov-Kolmogorov with array based FIFO queues and gives the
+ same flow as MaxFlow on the equivalent graph. solveParallel() runs
+ push-relabel over blocks of the grid in parallel, alternating between block
+ colors so that no two neighboring blocks are discharged at the same time.
+ */
+class GridMaxFlow {
+protected:
+	static const uint8_t PARENT_NONE;
+	static const uint8_t PARENT_TERMINAL;
+	static const uint8_t PARENT_ORPHAN;
+	static const int INF_DISTANCE;
+	int width;
+	int height;
+	int depth;
+	int connectivity;
+	int3 paddedDims;
+	double totalFlow;
+	uint32_t timestamp;
+	std::vector<int3> offsets;
+	std::vector<int64_t> nodeOffsets;
+	std::vector<float> edgeCapacity;
+	std::vector<float> terminalCapacity;
+	std::vector<uint8_t> parents;
+	std::vector<uint8_t> sinkTree;
+	std::vector<uint8_t> activeFlags;
+	std::vector<uint32_t> timestamps;
+	std::vector<int> distances;
+	std::vector<size_t> activeQueue;
+	std::vector<size_t> orphanQueue;
+	size_t activeHead;
+	size_t orphanHead;
+	std::vector<uint8_t> labels;
+	inline size_t index(int i, int j, int k) const {
+		return (size_t) (i + 1)
+				+ paddedDims.x
+						* ((size_t) (j + 1)
+								+ paddedDims.y * (size_t) (k + ((depth > 1) ? 1 : 0)));
+	}
+	inline size_t neighbor(size_t n, int dir) const {
+		return (size_t) ((int64_t) n + nodeOffsets[dir]);
+	}
+	inline bool inside(int i, int j, int k) const {
+		return (i >= 0 && j >= 0 && k >= 0 && i < width && j < height
+				&& k < depth);
+	}
+	void setActive(size_t n);
+	size_t nextActive();
+	void setOrphan(size_t n);
+	void augment(size_t src, int dir);
+	void processSourceOrphan(size_t n);
+	void processSinkOrphan(size_t n);
+	void globalRelabel(std::vector<float>& excess, std::vector<int>& heights);
+	void dischargeRegion(const int3& minPt, const int3& maxPt,
+			std::vector<float>& excess, std::vector<int>& heights,
+			std::vector<size_t>& queue);
+public:
+	GridMaxFlow(int width = 0, int height = 0, int depth = 1,
+			int connectivity = 4);
+	void resize(int width, int height, int depth = 1, int connectivity = 4);
+	void reset();
+	inline int getNeighborCount() const {
+		return (int) offsets.size();
+	}
+	inline int3 getNeighborOffset(int dir) const {
+		return offsets[dir];
+	}
+	inline int getWidth() const {
+		return width;
+	}
+	inline int getHeight() const {
+		return height;
+	}
+	inline int getDepth() const {
+		return depth;
+	}
+	inline float getTotalFlow() const {
+		return (float) totalFlow;
+	}
+	void setEdgeCapacity(int i, int j, int k, int dir, float fwdCap,
+			float revCap);
+	void setEdgeCapacity(int i, int j, int dir, float fwdCap, float revCap) {
+		setEdgeCapacity(i, j, 0, dir, fwdCap, revCap);
+	}
+	void addNodeCapacity(int i, int j, int k, float sourceCapacity,
+			float sinkCapacity);
+	void addNodeCapacity(int i, int j, float sourceCapacity,
+			float sinkCapacity) {
+		addNodeCapacity(i, j, 0, sourceCapacity, sinkCapacity);
+	}
+	void addSourceCapacity(int i, int j, int k, float cap) {
+		addNodeCapacity(i, j, k, cap, 0.0f);
+	}
+	void addSinkCapacity(int i, int j, int k, float cap) {
+		addNodeCapacity(i, j, k, 0.0f, cap);
+	}
+	//0 for source, 1 for sink and 2 for nodes that belong to neither tree (either side is a minimum cut).
+	inline int getLabel(int i, int j, int k = 0) const {
+		return labels[index(i, j, k)];
+	}
+	inline bool isSource(int i, int j, int k = 0) const {
+		return (labels[index(i, j, k)] == 0);
+	}
+	void solve(
+			const std::function<bool(const std::string& message, float progress)>& monitor =
+					nullptr);
+	void solveParallel(
+			const std::function<bool(const std::string& message, float progress)>& monitor =
+					nullptr, int blockSize = 64);
+};
+bool SANITY_CHECK_MAXFLOW();
 template<class C, class R> std::basic_ostream<C, R> & operator <<(
 		std::basic_ostream<C, R> & ss, const MaxFlow::NodeType& n) {
 	switch (n) {
@@ -1002,7 +1002,7 @@ void MultiIsoSurface::generateTriangles(
 	}
 }
 void MultiIsoSurface::findActiveVoxels(const EndlessGridFloatInt& grid,
-		const std::list<EndlessNodeFloatInt*>& leafs,
+		const std::vector<EndlessNodeFloatInt*>& leafs,
 		std::unordered_set<int3>& activeVoxels,
 		std::unordered_map<int4, EdgeInfo>& activeEdges, int label) {
 	int bdim = rows;
@@ -118,7 +118,7 @@ private:
 			Mesh& mesh,int label);
 	void findActiveVoxels(
 			const EndlessGridFloatInt& grid,
-			const std::list<EndlessNodeFloatInt*>& leafs,
+			const std::vector<EndlessNodeFloatInt*>& leafs,
 			std::unordered_set<int3>& activeVoxels,
 			std::unordered_map<int4, EdgeInfo>& activeEdges,
 			int label);
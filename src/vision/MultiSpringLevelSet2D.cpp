@@ -188,33 +188,24 @@ namespace aly {
 		return pt;
 	}
 	void MultiSpringLevelSet2D::updateNearestNeighbors(float maxDistance) {
-		locator.reset(new Locator2f(contour.vertexes));
+		locator.update(contour.vertexes, maxDistance);
+		std::vector<int> offsets, indexes;
+		locator.neighbors(maxDistance, offsets, indexes);
 		nearestNeighbors.clear();
 		nearestNeighbors.resize(contour.vertexes.size(), std::vector<uint32_t>());
 		int N = (int)contour.vertexes.size();
 #pragma omp parallel for
 		for (int i = 0;i < N;i += 2) {
-			float2 pt0 = contour.vertexes[i];
-			float2 pt1 = contour.vertexes[i + 1];
 			int l1=contour.particleLabels[i / 2];
-			std::vector<float2i> result;
-			locator->closest(pt0, maxDistance, result);
-			for (auto pr : result) {
-				if ((int)pr.index != i && (int)pr.index != i + 1) {
-					int l2 = contour.particleLabels[pr.index / 2];
-					if (l2 == l1) {
-						nearestNeighbors[i].push_back((uint32_t)pr.index);
-						break;
-					}
-				}
-			}
-			locator->closest(pt1, maxDistance, result);
-			for (auto pr : result) {
-				if ((int)pr.index != i && (int)pr.index != i + 1) {
-					int l2 = contour.particleLabels[pr.index / 2];
-					if (l2 == l1) {
-						nearestNeighbors[i + 1].push_back((uint32_t)pr.index);
-						break;
+			for (int v = i;v <= i + 1;v++) {
+				for (int e = offsets[v];e < offsets[v + 1];e++) {
+					int nbr = indexes[e];
+					if (nbr != i && nbr != i + 1) {
+						int l2 = contour.particleLabels[nbr / 2];
+						if (l2 == l1) {
+							nearestNeighbors[v].push_back((uint32_t)nbr);
+							break;
+						}
 					}
 				}
 			}
@@ -278,7 +269,7 @@ namespace aly {
 		const float planeThreshold=std::cos(ToRadians(80.0f));
 		//do {
 			//invalid = 0;
-			locator.reset(new Locator2f(oldVertexes));
+			SpatialHash2f oldLocator(oldVertexes, maxDistance);
 			std::vector<int> retrack;
 			for (size_t i = 0; i < contour.particles.size(); i++) {
 				if (std::isinf(contour.correspondence[i].x)
@@ -303,7 +294,7 @@ namespace aly {
 				std::vector<float2i> result;
 				float2 q1(std::numeric_limits<float>::infinity());
 				float2 q2(std::numeric_limits<float>::infinity());
-				locator->closest(pt0, maxDistance, result); //Query against vertex ends
+				oldLocator.closest(pt0, maxDistance, result); //Query against vertex ends
 				for (auto pr : result) {
 					int qid = pr.index / E;
 					q1 = oldCorrespondences[qid];
@@ -324,7 +315,7 @@ namespace aly {
 					}
 				}
 				result.clear();
-				locator->closest(pt1, maxDistance, result);
+				oldLocator.closest(pt1, maxDistance, result);
 				for (auto pr : result) {
 					int qid = pr.index / E;
 					q2 = oldCorrespondences[qid];
@@ -25,7 +25,7 @@
 #include "vision/ManifoldCache2D.h"
 #include "vision/MultiActiveContour2D.h"
 #include "graphics/shaders/ContourShaders.h"
-#include "graphics/AlloyLocator.h"
+#include "graphics/AlloySpatialHash.h"
 namespace aly {
 	class MultiSpringLevelSet2D : public MultiActiveContour2D {
 	public:
@@ -37,7 +37,7 @@ namespace aly {
 		static float SPRING_CONSTANT;
 		static float SHARPNESS;
 	protected:
-		std::shared_ptr<Locator2f> locator;
+		SpatialHash2f locator;
 		aly::Vector2f oldCorrespondences;
 		std::array<Vector2f, 4> oldVelocities;
 		aly::Vector2f oldVertexes;
@@ -0,0 +1,415 @@
+/*
+ * Copyright(C) 2015, Blake C. Lucas, Ph.D. (img.science@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef INCLUDE_NARROWBAND_H_
+#define INCLUDE_NARROWBAND_H_
+#include "math/AlloyMath.h"
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+namespace aly {
+bool SANITY_CHECK_NARROW_BAND();
+/*
+ Sparse set of active voxels grouped into square (2D) or cubic (3D) tiles.
+ Only tiles that touch the band are allocated, and each keeps its voxels in
+ a list plus a bit mask for constant time membership tests. The band is
+ flattened tile by tile, so loops over the flattened list walk the grid one
+ tile at a time.
+
+ The band can also own the field it tracks. Each allocated tile stores its
+ voxels' values for every channel, and every other tile reads as the
+ background value with that tile's sign, so no dense copy of the grid is
+ needed. Reads outside the grid clamp to the border like Volume and Image.
+ */
+template<int D> class NarrowBand {
+public:
+	typedef vec<int, D> Index;
+	static const int TILE_SHIFT = (D == 3) ? 3 : 4;
+	static const int TILE_SIZE = 1 << TILE_SHIFT;
+	static const int TILE_VOXELS = 1 << (D * TILE_SHIFT);
+	static const int MASK_WORDS = TILE_VOXELS / 64;
+	//Width of a tile gathered with a one voxel border on every side.
+	static const int PADDED_SIZE = TILE_SIZE + 2;
+	static const int PADDED_VOXELS = (D == 3) ?
+			PADDED_SIZE * PADDED_SIZE * PADDED_SIZE : PADDED_SIZE * PADDED_SIZE;
+protected:
+	struct Tile {
+		size_t id;
+		bool dirty;
+		uint64_t mask[MASK_WORDS];
+		std::vector<Index> voxels;
+		std::vector<float> values;
+	};
+	Index dims;
+	Index tileDims;
+	int channels;
+	float background;
+	std::vector<int> tileSlots;
+	std::vector<int8_t> tileSigns;
+	std::vector<Tile> tiles;
+	Index clampIndex(const Index& pos) const {
+		Index out;
+		for (int d = 0; d < D; d++) {
+			out[d] = aly::clamp(pos[d], 0, dims[d] - 1);
+		}
+		return out;
+	}
+	Index localOffset(int l) const {
+		Index off;
+		for (int d = 0; d < D; d++) {
+			off[d] = (l >> (d * TILE_SHIFT)) & (TILE_SIZE - 1);
+		}
+		return off;
+	}
+	int8_t valueSign(const Tile& tile) const {
+		double sum = 0.0;
+		for (int l = 0; l < TILE_VOXELS; l++) {
+			sum += tile.values[l];
+		}
+		return (sum < 0.0) ? -1 : 1;
+	}
+	float lookup(const Index& pos, int c) const {
+		size_t id = tileId(pos);
+		int slot = tileSlots[id];
+		if (slot < 0)
+			return tileSigns[id] * background;
+		return tiles[slot].values[c * TILE_VOXELS + localIndex(pos)];
+	}
+	size_t tileId(const Index& pos) const {
+		size_t id = 0;
+		for (int d = D - 1; d >= 0; d--) {
+			id = id * tileDims[d] + (pos[d] >> TILE_SHIFT);
+		}
+		return id;
+	}
+	int localIndex(const Index& pos) const {
+		int idx = 0;
+		for (int d = D - 1; d >= 0; d--) {
+			idx = (idx << TILE_SHIFT) | (pos[d] & (TILE_SIZE - 1));
+		}
+		return idx;
+	}
+	Index tileOrigin(size_t id) const {
+		Index origin;
+		for (int d = 0; d < D; d++) {
+			origin[d] = (int) (id % tileDims[d]) << TILE_SHIFT;
+			id /= tileDims[d];
+		}
+		return origin;
+	}
+	void clearTile(Tile& tile) {
+		std::fill(tile.mask, tile.mask + MASK_WORDS, (uint64_t) 0);
+		tile.voxels.clear();
+		tile.dirty = false;
+	}
+	//Drops tiles that no longer hold any voxels. A dropped tile keeps the sign of its first channel.
+	void compact() {
+		size_t n = 0;
+		for (size_t s = 0; s < tiles.size(); s++) {
+			if (tiles[s].voxels.size() > 0) {
+				if (n != s) {
+					std::swap(tiles[n], tiles[s]);
+				}
+				tileSlots[tiles[n].id] = (int) n;
+				n++;
+			} else {
+				if (tiles[s].values.size() > 0) {
+					tileSigns[tiles[s].id] = valueSign(tiles[s]);
+				}
+				tileSlots[tiles[s].id] = -1;
+			}
+		}
+		tiles.resize(n);
+	}
+public:
+	NarrowBand() :
+			dims(0), tileDims(0), channels(0), background(0.0f) {
+	}
+	//Values are only stored if channels > 0. Unallocated tiles read as +/- background.
+	void resize(const Index& d, int c = 0, float bg = 0.0f) {
+		dims = d;
+		channels = c;
+		background = bg;
+		size_t count = 1;
+		for (int n = 0; n < D; n++) {
+			tileDims[n] = (dims[n] + TILE_SIZE - 1) >> TILE_SHIFT;
+			count *= tileDims[n];
+		}
+		tileSlots.assign(count, -1);
+		tileSigns.assign(count, 1);
+		tiles.clear();
+	}
+	void clear() {
+		std::fill(tileSlots.begin(), tileSlots.end(), -1);
+		std::fill(tileSigns.begin(), tileSigns.end(), 1);
+		tiles.clear();
+	}
+	Index dimensions() const {
+		return dims;
+	}
+	int getChannels() const {
+		return channels;
+	}
+	float getBackground() const {
+		return background;
+	}
+	Index getTileOrigin(int slot) const {
+		return tileOrigin(tiles[slot].id);
+	}
+	//Values of one channel of a tile, indexed like the tile's voxels with x fastest.
+	float* getTileValues(int slot, int c) {
+		return &tiles[slot].values[c * TILE_VOXELS];
+	}
+	const float* getTileValues(int slot, int c) const {
+		return &tiles[slot].values[c * TILE_VOXELS];
+	}
+	const std::vector<Index>& getTileVoxels(int slot) const {
+		return tiles[slot].voxels;
+	}
+	bool isActive(int slot, int l) const {
+		return ((tiles[slot].mask[l >> 6] >> (l & 63)) & 1) != 0;
+	}
+	float getValue(const Index& pos, int c = 0) const {
+		return lookup(clampIndex(pos), c);
+	}
+	//Returns nullptr if the voxel's tile is not allocated.
+	float* getValuePtr(const Index& pos, int c = 0) {
+		int slot = tileSlots[tileId(pos)];
+		if (slot < 0)
+			return nullptr;
+		return &tiles[slot].values[c * TILE_VOXELS + localIndex(pos)];
+	}
+	//Multilinear interpolation, matching Volume and Image.
+	float interpolate(const vec<float, D>& pt, int c = 0) const {
+		Index base;
+		vec<float, D> frac;
+		for (int d = 0; d < D; d++) {
+			base[d] = static_cast<int>(std::floor(pt[d]));
+			frac[d] = pt[d] - base[d];
+		}
+		float value = 0.0f;
+		for (int n = 0; n < (1 << D); n++) {
+			Index pos;
+			float w = 1.0f;
+			for (int d = 0; d < D; d++) {
+				int bit = (n >> d) & 1;
+				pos[d] = base[d] + bit;
+				w *= (bit) ? frac[d] : 1.0f - frac[d];
+			}
+			value += w * getValue(pos, c);
+		}
+		return value;
+	}
+	/*
+	 Copies one channel of a tile and a one voxel border around it into a
+	 block of PADDED_VOXELS values, x fastest. Positions outside the grid
+	 clamp to the border, so stencils can run over the whole block.
+	 */
+	void gather(int slot, int c, float* out) const {
+		Index origin = tileOrigin(tiles[slot].id);
+		int last = dims[0] - 1;
+		for (int r = 0; r < PADDED_VOXELS / PADDED_SIZE; r++) {
+			Index pos = origin;
+			int q = r;
+			for (int d = 1; d < D; d++) {
+				pos[d] += (q % PADDED_SIZE) - 1;
+				q /= PADDED_SIZE;
+			}
+			pos = clampIndex(pos);
+			float* row = out + r * PADDED_SIZE;
+			Index end = pos;
+			end[0] = std::max(origin[0] - 1, 0);
+			row[0] = lookup(end, c);
+			end[0] = std::min(origin[0] + TILE_SIZE, last);
+			row[PADDED_SIZE - 1] = lookup(end, c);
+			//The row inside the tile's x range comes from a single tile.
+			size_t id = tileId(pos);
+			int s = tileSlots[id];
+			if (s < 0) {
+				std::fill(row + 1, row + 1 + TILE_SIZE, tileSigns[id] * background);
+			} else {
+				const float* values = &tiles[s].values[c * TILE_VOXELS + localIndex(pos)];
+				int count = std::min(TILE_SIZE, dims[0] - origin[0]);
+				std::copy(values, values + count, row + 1);
+				std::fill(row + 1 + count, row + 1 + TILE_SIZE, values[count - 1]);
+			}
+		}
+	}
+	//Writes one channel to a dense grid, x fastest.
+	void copyTo(int c, float* out) const {
+#pragma omp parallel for schedule(dynamic)
+		for (int id = 0; id < (int) tileSlots.size(); id++) {
+			Index origin = tileOrigin(id);
+			int slot = tileSlots[id];
+			for (int l = 0; l < TILE_VOXELS; l++) {
+				Index pos = origin + localOffset(l);
+				bool ok = true;
+				size_t index = 0;
+				for (int d = D - 1; d >= 0; d--) {
+					ok &= (pos[d] < dims[d]);
+					index = index * dims[d] + pos[d];
+				}
+				if (ok) {
+					out[index] = (slot < 0) ?
+									tileSigns[id] * background :
+									tiles[slot].values[c * TILE_VOXELS + l];
+				}
+			}
+		}
+	}
+	size_t getTileCount() const {
+		return tiles.size();
+	}
+	size_t size() const {
+		size_t count = 0;
+		for (const Tile& tile : tiles) {
+			count += tile.voxels.size();
+		}
+		return count;
+	}
+	bool inside(const Index& pos) const {
+		for (int d = 0; d < D; d++) {
+			if (pos[d] < 0 || pos[d] >= dims[d])
+				return false;
+		}
+		return true;
+	}
+	bool contains(const Index& pos) const {
+		int slot = tileSlots[tileId(pos)];
+		if (slot < 0)
+			return false;
+		int idx = localIndex(pos);
+		return ((tiles[slot].mask[idx >> 6] >> (idx & 63)) & 1) != 0;
+	}
+	//Adds one voxel, allocating its tile if needed. Returns false if it was already in the band.
+	bool insert(const Index& pos) {
+		size_t id = tileId(pos);
+		int slot = tileSlots[id];
+		if (slot < 0) {
+			slot = (int) tiles.size();
+			tiles.push_back(Tile());
+			Tile& tile = tiles.back();
+			clearTile(tile);
+			tile.id = id;
+			tile.values.assign(channels * TILE_VOXELS, tileSigns[id] * background);
+			tileSlots[id] = slot;
+		}
+		Tile& tile = tiles[slot];
+		int idx = localIndex(pos);
+		uint64_t bit = (uint64_t) 1 << (idx & 63);
+		if (tile.mask[idx >> 6] & bit)
+			return false;
+		tile.mask[idx >> 6] |= bit;
+		tile.voxels.push_back(pos);
+		tile.dirty = true;
+		return true;
+	}
+	//Scans every tile of the grid in parallel and keeps the voxels for which inBand(pos) is true.
+	template<class F> void build(const F& inBand) {
+		build(inBand, [this](const Index& pos) {
+			return background;
+		});
+	}
+	/*
+	 Same as build(inBand), and also sets every channel of the kept tiles to
+	 valueAt(pos). Tiles that are dropped keep the sign of their values.
+	 */
+	template<class F, class V> void build(const F& inBand, const V& valueAt) {
+		std::vector<Tile> all(tileSlots.size());
+#pragma omp parallel for schedule(dynamic)
+		for (int id = 0; id < (int) all.size(); id++) {
+			Tile& tile = all[id];
+			clearTile(tile);
+			tile.id = id;
+			tile.values.resize(channels * TILE_VOXELS);
+			Index origin = tileOrigin(id);
+			for (int l = 0; l < TILE_VOXELS; l++) {
+				Index pos = origin + localOffset(l);
+				bool ok = true;
+				for (int d = 0; d < D; d++) {
+					ok &= (pos[d] < dims[d]);
+				}
+				if (channels > 0) {
+					float val = valueAt(clampIndex(pos));
+					for (int c = 0; c < channels; c++) {
+						tile.values[c * TILE_VOXELS + l] = val;
+					}
+				}
+				if (ok && inBand(pos)) {
+					tile.mask[l >> 6] |= (uint64_t) 1 << (l & 63);
+					tile.voxels.push_back(pos);
+				}
+			}
+			if (tile.voxels.size() == 0 && channels > 0) {
+				tileSigns[id] = valueSign(tile);
+				std::vector<float>().swap(tile.values);
+			}
+		}
+		tiles.swap(all);
+		compact();
+	}
+	//Removes voxels for which remove(pos) is true, one tile per task. Returns the number removed.
+	template<class F> int removeIf(const F& remove) {
+		int removed = 0;
+#pragma omp parallel for schedule(dynamic) reduction(+:removed)
+		for (int s = 0; s < (int) tiles.size(); s++) {
+			Tile& tile = tiles[s];
+			size_t n = 0;
+			for (size_t v = 0; v < tile.voxels.size(); v++) {
+				Index pos = tile.voxels[v];
+				if (remove(pos)) {
+					int idx = localIndex(pos);
+					tile.mask[idx >> 6] &= ~((uint64_t) 1 << (idx & 63));
+					removed++;
+				} else {
+					tile.voxels[n++] = pos;
+				}
+			}
+			tile.voxels.resize(n);
+		}
+		compact();
+		return removed;
+	}
+	//Writes all voxels tile by tile, each tile in grid order.
+	void flatten(std::vector<Index>& out) {
+		std::vector<size_t> offsets(tiles.size() + 1, 0);
+		for (size_t s = 0; s < tiles.size(); s++) {
+			offsets[s + 1] = offsets[s] + tiles[s].voxels.size();
+		}
+		out.resize(offsets.back());
+#pragma omp parallel for schedule(dynamic)
+		for (int s = 0; s < (int) tiles.size(); s++) {
+			Tile& tile = tiles[s];
+			if (tile.dirty) {
+				std::sort(tile.voxels.begin(), tile.voxels.end(),
+						[this](const Index& a, const Index& b) {
+							return localIndex(a) < localIndex(b);
+						});
+				tile.dirty = false;
+			}
+			std::copy(tile.voxels.begin(), tile.voxels.end(),
+					out.begin() + offsets[s]);
+		}
+	}
+};
+typedef NarrowBand<2> NarrowBand2D;
+typedef NarrowBand<3> NarrowBand3D;
+}
+#endif
@@ -165,7 +165,7 @@ void SpringLevelSet2D::refineContour(int iterations, float proximity,
 	int N = (int) contour.vertexLocations.size();
 	Vector2f delta(N);
 	const float planeThreshold = std::cos(ToRadians(80.0f));
-	Locator2f particleLocator(contour.particles);
+	SpatialHash2f particleLocator(contour.particles, proximity);
 	for (int iter = 0; iter < iterations; iter++) {
 		for (std::vector<uint32_t> curve : contour.indexes) {
 			uint32_t cur = 0, prev = 0, next = 0;
@@ -279,27 +279,22 @@ float2 SpringLevelSet2D::traceInitial(float2 pt) {
 	return pt;
 }
 void SpringLevelSet2D::updateNearestNeighbors(float maxDistance) {
-	locator.reset(new Locator2f(contour.vertexes));
+	//Springl vertexes move less than a cell per step, so most of the hash is reused.
+	locator.update(contour.vertexes, maxDistance);
+	std::vector<int> offsets, indexes;
+	locator.neighbors(maxDistance, offsets, indexes);
 	nearestNeighbors.clear();
 	nearestNeighbors.resize(contour.vertexes.size(), std::list<uint32_t>());
 	int N = (int) contour.vertexes.size();
 #pragma omp parallel for
 	for (int i = 0; i < N; i += 2) {
-		float2 pt0 = contour.vertexes[i];
-		float2 pt1 = contour.vertexes[i + 1];
-		std::vector<float2i> result;
-		locator->closest(pt0, maxDistance, result);
-		for (float2i nbr : result) {
-			if ((int) nbr.index != i && (int) nbr.index != i + 1) {
-				nearestNeighbors[i].push_back((uint32_t) nbr.index);
-				break;
-			}
-		}
-		locator->closest(pt1, maxDistance, result);
-		for (float2i nbr : result) {
-			if ((int) nbr.index != i && (int) nbr.index != i + 1) {
-				nearestNeighbors[i + 1].push_back((uint32_t) nbr.index);
-				break;
+		for (int v = i; v <= i + 1; v++) {
+			for (int e = offsets[v]; e < offsets[v + 1]; e++) {
+				int nbr = indexes[e];
+				if (nbr != i && nbr != i + 1) {
+					nearestNeighbors[v].push_back((uint32_t) nbr);
+					break;
+				}
 			}
 		}
 	}
@@ -307,7 +302,7 @@ void SpringLevelSet2D::updateNearestNeighbors(float maxDistance) {
 int SpringLevelSet2D::fill() {
 	{
 		std::lock_guard < std::mutex > lockMe(contourLock);
-		isoContour.solve(levelSet, contour.vertexLocations, contour.indexes,
+		isoContour.solve(band, LEVEL, contour.vertexLocations, contour.indexes,
 				0.0f,
 				(preserveTopology) ?
 						TopologyRule2D::Connect4 :
@@ -360,7 +355,7 @@ void SpringLevelSet2D::updateTracking(float maxDistance) {
 	const float planeThreshold = std::cos(ToRadians(80.0f));
 	//do {
 	//invalid = 0;
-	locator.reset(new Locator2f(oldVertexes));
+	SpatialHash2f oldLocator(oldVertexes, maxDistance);
 	std::vector<int> retrack;
 	for (size_t i = 0; i < contour.particles.size(); i++) {
 		if (std::isinf(contour.correspondence[i].x)
@@ -384,7 +379,7 @@ void SpringLevelSet2D::updateTracking(float maxDistance) {
 		std::vector<float2i> result;
 		float2 q1(std::numeric_limits<float>::infinity());
 		float2 q2(std::numeric_limits<float>::infinity());
-		locator->closest(pt0, maxDistance, result); //Query against vertex ends
+		oldLocator.closest(pt0, maxDistance, result); //Query against vertex ends
 		for (auto pr : result) {
 			int qid = pr.index / E;
 			q1 = oldCorrespondences[qid];
@@ -405,7 +400,7 @@ void SpringLevelSet2D::updateTracking(float maxDistance) {
 			}
 		}
 		result.clear();
-		locator->closest(pt1, maxDistance, result);
+		oldLocator.closest(pt1, maxDistance, result);
 		for (auto pr : result) {
 			int qid = pr.index / E;
 			q2 = oldCorrespondences[qid];
@@ -485,7 +480,7 @@ int SpringLevelSet2D::contract() {
 		float2 pt = contour.particles[i];
 		float d1 = distance(contour.vertexes[2 * i + 1], pt);
 		float d2 = distance(contour.vertexes[2 * i], pt);
-		if (std::abs(levelSet(pt.x, pt.y).x) <= 1.25f * EXTENT
+		if (std::abs(band.interpolate(pt, LEVEL)) <= 1.25f * EXTENT
 				&& d1 > 3.0f * PARTICLE_RADIUS && d2 > 3.0f * PARTICLE_RADIUS
 				&& d1 < 1.5f && d2 < 1.5f) {
 			particles.push_back(pt);
@@ -586,61 +581,18 @@ void SpringLevelSet2D::computeForce(size_t idx, float2& f1, float2& f2,
 	}
 }
 void SpringLevelSet2D::updateSignedLevelSet(float maxStep) {
-#pragma omp parallel for
-	for (int i = 0; i < (int) activeList.size(); i++) {
-		int2 pos = activeList[i];
-		distanceFieldMotion(pos.x, pos.y, i);
-	}
-	float timeStep = (float) maxStep;
-	if (!clampSpeed) {
-		float maxDelta = 0.0f;
-		for (float delta : deltaLevelSet) {
-			maxDelta = std::max(std::abs(delta), maxDelta);
-		}
-		const float maxSpeed = 0.999f;
-		timeStep = (float) (maxStep
-				* ((maxDelta > maxSpeed) ? (maxSpeed / maxDelta) : maxSpeed));
-	}
-	contourLock.lock();
-	if (preserveTopology) {
-		for (int nn = 0; nn < 4; nn++) {
-#pragma omp parallel for
-			for (int i = 0; i < (int) activeList.size(); i++) {
-				int2 pos = activeList[i];
-				applyForcesTopoRule(pos.x, pos.y, nn, i, timeStep);
-			}
-		}
-	} else {
-#pragma omp parallel for
-		for (int i = 0; i < (int) activeList.size(); i++) {
-			int2 pos = activeList[i];
-			applyForces(pos.x, pos.y, i, timeStep);
-		}
-	}
-	for (int band = 1; band <= maxLayers; band++) {
-#pragma omp parallel for
-		for (int i = 0; i < (int) activeList.size(); i++) {
-			int2 pos = activeList[i];
-			updateDistanceField(pos.x, pos.y, band);
+#pragma omp parallel for schedule(dynamic)
+	for (int s = 0; s < (int) band.getTileCount(); s++) {
+		float* delta = band.getTileValues(s, DELTA);
+		std::fill(delta, delta + NarrowBand2D::TILE_VOXELS, 0.0f);
+		uint8_t sel[NarrowBand2D::TILE_VOXELS];
+		if (selectVoxels(s, [](float val) {return std::abs(val) <= 0.5f;}, sel) > 0) {
+			float v[NarrowBand2D::PADDED_VOXELS];
+			band.gather(s, SWAP, v);
+			distanceFieldMotion(s, v, sel);
 		}
 	}
-#pragma omp parallel for
-	for (int i = 0; i < (int) activeList.size(); i++) {
-		int2 pos = activeList[i];
-		plugLevelSet(pos.x, pos.y, i);
-	}
-	requestUpdateContour = true;
-	contourLock.unlock();
-
-#pragma omp parallel for
-	for (int i = 0; i < (int) activeList.size(); i++) {
-		int2 pos = activeList[i];
-		swapLevelSet(pos.x, pos.y) = levelSet(pos.x, pos.y);
-	}
-	deleteElements();
-	addElements();
-	deltaLevelSet.clear();
-	deltaLevelSet.resize(activeList.size(), 0.0f);
+	updateLevelSet(maxStep);
 }
 float SpringLevelSet2D::advect(float maxStep) {
 	Vector2f f(contour.particles.size());
@@ -753,11 +705,11 @@ float2 SpringLevelSet2D::getScaledGradientValue(float i, float j,
 	float v01;
 	float v11;
 	if (signedIso) {
-		v21 = std::abs(levelSet(i + 1, j).x);
-		v12 = std::abs(levelSet(i, j + 1).x);
-		v10 = std::abs(levelSet(i, j - 1).x);
-		v01 = std::abs(levelSet(i - 1, j).x);
-		v11 = std::abs(levelSet(i, j).x);
+		v21 = std::abs(band.interpolate(float2(i + 1, j), LEVEL));
+		v12 = std::abs(band.interpolate(float2(i, j + 1), LEVEL));
+		v10 = std::abs(band.interpolate(float2(i, j - 1), LEVEL));
+		v01 = std::abs(band.interpolate(float2(i - 1, j), LEVEL));
+		v11 = std::abs(band.interpolate(float2(i, j), LEVEL));
 	} else {
 		v21 = unsignedLevelSet(i + 1, j).x;
 		v12 = unsignedLevelSet(i, j + 1).x;
@@ -770,65 +722,30 @@ float2 SpringLevelSet2D::getScaledGradientValue(float i, float j,
 	float len = max(1E-6f, length(grad));
 	return -(v11 * grad / len);
 }
-void SpringLevelSet2D::distanceFieldMotion(int i, int j, size_t gid) {
-	float v11 = swapLevelSet(i, j).x;
-	float2 grad;
-	if (std::abs(v11) > 0.5f) {
-		deltaLevelSet[gid] = 0;
-		return;
-	}
-	float v00 = swapLevelSet(i - 1, j - 1).x;
-	float v01 = swapLevelSet(i - 1, j).x;
-	float v10 = swapLevelSet(i, j - 1).x;
-	float v21 = swapLevelSet(i + 1, j).x;
-	float v20 = swapLevelSet(i + 1, j - 1).x;
-	float v22 = swapLevelSet(i + 1, j + 1).x;
-	float v02 = swapLevelSet(i - 1, j + 1).x;
-	float v12 = swapLevelSet(i, j + 1).x;
-
-	float DxNeg = v11 - v01;
-	float DxPos = v21 - v11;
-	float DyNeg = v11 - v10;
-	float DyPos = v12 - v11;
-
-	float DxCtr = 0.5f * (v21 - v01);
-	float DyCtr = 0.5f * (v12 - v10);
-
-	float DxxCtr = v21 - v11 - v11 + v01;
-	float DyyCtr = v12 - v11 - v11 + v10;
-	float DxyCtr = (v22 - v02 - v20 + v00) * 0.25f;
-
-	float numer = 0.5f
-			* (DyCtr * DyCtr * DxxCtr - 2 * DxCtr * DyCtr * DxyCtr
-					+ DxCtr * DxCtr * DyyCtr);
-	float denom = DxCtr * DxCtr + DyCtr * DyCtr;
-	float kappa = 0;
-
-	const float maxCurvatureForce = 10.0f;
-	if (std::abs(denom) > 1E-5f) {
-		kappa = curvatureParam.toFloat() * numer / denom;
-	} else {
-		kappa = curvatureParam.toFloat() * numer * sign(denom) * 1E5f;
-	}
-	if (kappa < -maxCurvatureForce) {
-		kappa = -maxCurvatureForce;
-	} else if (kappa > maxCurvatureForce) {
-		kappa = maxCurvatureForce;
-	}
-	grad = getScaledGradientValue(i, j);
-	float advection = 0;
-	// Dot product force with upwind gradient
-	if (grad.x > 0) {
-		advection = grad.x * DxNeg;
-	} else if (grad.x < 0) {
-		advection = grad.x * DxPos;
-	}
-	if (grad.y > 0) {
-		advection += grad.y * DyNeg;
-	} else if (grad.y < 0) {
-		advection += grad.y * DyPos;
+void SpringLevelSet2D::distanceFieldMotion(int slot, const float* v,
+		const uint8_t* sel) {
+	const float curvature = curvatureParam.toFloat();
+	const int2 origin = band.getTileOrigin(slot);
+	float* delta = band.getTileValues(slot, DELTA);
+	for (int y = 0; y < NarrowBand2D::TILE_SIZE; y++) {
+		for (int x = 0; x < NarrowBand2D::TILE_SIZE; x++) {
+			int l = x + y * NarrowBand2D::TILE_SIZE;
+			if (!sel[l])
+				continue;
+			int c = PaddedIndex(x, y);
+			float v11 = v[c];
+			float DxNeg = v11 - v[c - PX];
+			float DxPos = v[c + PX] - v11;
+			float DyNeg = v11 - v[c - PY];
+			float DyPos = v[c + PY] - v11;
+			float kappa = Curvature(v, c, curvature);
+			float2 grad = getScaledGradientValue(origin.x + x, origin.y + y);
+			// Dot product force with upwind gradient
+			float advection = ((grad.x > 0) ? grad.x * DxNeg : grad.x * DxPos)
+					+ ((grad.y > 0) ? grad.y * DyNeg : grad.y * DyPos);
+			delta[l] = -advection + kappa;
+		}
 	}
-	deltaLevelSet[gid] = -advection + kappa;
 }
 bool SpringLevelSet2D::init() {
 	ActiveManifold2D::init();
@@ -941,7 +858,7 @@ bool SpringLevelSet2D::stepInternal() {
 			updateTracking(3 * NEAREST_NEIGHBOR_DISTANCE);
 		} else {
 			std::lock_guard < std::mutex > lockMe(contourLock);
-			isoContour.solve(levelSet, contour.vertexLocations, contour.indexes,
+			isoContour.solve(band, LEVEL, contour.vertexLocations, contour.indexes,
 					0.0f,
 					(preserveTopology) ?
 							TopologyRule2D::Connect4 :
@@ -25,7 +25,7 @@
 #include "vision/ActiveManifold2D.h"
 #include "vision/ManifoldCache2D.h"
 #include "graphics/shaders/ContourShaders.h"
-#include "graphics/AlloyLocator.h"
+#include "graphics/AlloySpatialHash.h"
 namespace aly {
 	void Decompose(const float2x2& M, float& theta, float& phi, float& sx, float& sy);
 	float2x2 Compose(const float& theta,const float& phi,const float& sx,const float& sy);
@@ -42,7 +42,7 @@ namespace aly {
 		static float SHARPNESS;
 	protected:
 		std::list<Orphan2D> orphans;
-		std::shared_ptr<Locator2f> locator;
+		SpatialHash2f locator;
 		aly::Vector2f oldCorrespondences;
 		std::array<Vector2f, 4> oldVelocities;
 		aly::Vector2f oldVertexes;
@@ -67,7 +67,7 @@ namespace aly {
 		void updateSignedLevelSet(float maxStep=0.5f);
 		float2 getScaledGradientValue(int i, int j);
 		float2 getScaledGradientValue(float i, float j,bool signedIso);
-		void distanceFieldMotion(int i, int j, size_t index);
+		void distanceFieldMotion(int slot, const float* v, const uint8_t* sel);
 		virtual void computeForce(size_t idx, float2& p1, float2& p2, float2& p);
 		void relax(size_t idx, float timeStep, float2& f1, float2& f2);
 		std::shared_ptr<UnsignedDistanceShader> unsignedShader;
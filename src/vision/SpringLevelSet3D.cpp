@@ -67,7 +67,8 @@ void SpringLevelSet3D::setSpringls(const Vector3f& particles,
 
 void SpringLevelSet3D::updateUnsignedLevelSet(float narrowBand) {
 	size_t N = contour.particles.size();
-	unsignedLevelSet.resize(levelSet.rows, levelSet.cols, levelSet.slices);
+	int3 dims = band.dimensions();
+	unsignedLevelSet.resize(dims.x, dims.y, dims.z);
 	unsignedLevelSet.set(narrowBand);
 	if (contour.meshType == MeshType::Triangle) {
 //#pragma omp parallel for
@@ -184,7 +185,10 @@ void SpringLevelSet3D::updateNearestNeighbors(float maxDistance) {
 	nearestNeighbors.clear();
 	if (contour.vertexes.size() == 0)
 		return;
-	locator.reset(new Locator3f(contour.vertexes));
+	//Springl vertexes move less than a cell per step, so most of the hash is reused.
+	locator.update(contour.vertexes, maxDistance);
+	std::vector<int> offsets, indexes;
+	locator.neighbors(maxDistance, offsets, indexes);
 	nearestNeighbors.resize(contour.vertexes.size(),
 			std::vector<SpringlEdge>());
 	int N = (int) contour.particles.size();
@@ -192,18 +196,17 @@ void SpringLevelSet3D::updateNearestNeighbors(float maxDistance) {
 #pragma omp parallel for
 	for (int n = 0; n < N; n++) {
 		for (int k = 0; k < K; k++) {
-			std::vector<float3i> result;
 			size_t index = ((size_t) n) * K + k;
 			float3 q = contour.vertexes[index];
-			locator->closest(q, maxDistance, result);
 			std::vector<SpringlEdge>& edges = nearestNeighbors[index];
 			std::map<uint32_t, SpringlEdge> nMap;
-			for (auto pr : result) {
-				uint32_t nn = pr.index / K;
+			for (int e = offsets[index]; e < offsets[index + 1]; e++) {
+				int idx = indexes[e];
+				uint32_t nn = idx / K;
 				if (nn != n) {
-					int kk = pr.index - K * nn;
+					int kk = idx - K * nn;
 					SpringlEdge edge(nn, kk,
-							DistanceToEdgeSqr(q, pr,
+							DistanceToEdgeSqr(q, contour.vertexes[idx],
 									contour.vertexes[nn * K + (kk + 1) % K]));
 					auto pos = nMap.find(nn);
 					if (pos != nMap.end()) {
@@ -244,7 +247,7 @@ void SpringLevelSet3D::refineContour(aly::Mesh& isosurf, int iterations,
 	int N = isosurf.vertexLocations.size();
 	Vector3f& points = isosurf.vertexLocations;
 	Vector3f& normals = isosurf.vertexNormals;
-	Locator3f matcher(contour.particles);
+	SpatialHash3f matcher(contour.particles, proximity);
 	Vector3f newPoints = points;
 	const float planeThreshold = std::cos(ToRadians(80.0f));
 	std::vector<std::unordered_set<uint32_t>> nbrTable;
@@ -312,7 +315,7 @@ int SpringLevelSet3D::fill() {
 	//std::vector<int> histogram(11, 0);
 	int fillCount = 0;
 	float d;
-	Locator3f matcher(contour.vertexes);
+	SpatialHash3f matcher(contour.vertexes, NEAREST_NEIGHBOR_DISTANCE);
 	if (contour.meshType == MeshType::Triangle) {
 		for (int n = 0; n < contour.triIndexes.size(); n++) {
 			uint3 tri = contour.triIndexes[n];
@@ -409,7 +412,7 @@ void SpringLevelSet3D::updateTracking(float maxDistance) {
 	const float planeThreshold = std::cos(ToRadians(80.0f));
 	//do {
 	//invalid = 0;
-	locator.reset(new Locator3f(oldVertexes));
+	SpatialHash3f oldLocator(oldVertexes, maxDistance);
 	std::vector<int> retrack;
 	for (size_t i = 0; i < contour.particles.size(); i++) {
 		if (std::isinf(contour.correspondence[i].x)
@@ -434,7 +437,7 @@ void SpringLevelSet3D::updateTracking(float maxDistance) {
 		float4 q(0.0f);
 		for (int e = 0; e < E; e++) {
 			v = contour.vertexes[pid * E + e];
-			locator->closest(v, maxDistance, result); //Query against vertex ends
+			oldLocator.closest(v, maxDistance, result); //Query against vertex ends
 			for (auto pr : result) {
 				int qid = pr.index / E;
 				float3 oldQ = oldCorrespondences[qid];
@@ -511,7 +514,7 @@ int SpringLevelSet3D::contract() {
 			float d1 = distance(v1 = contour.vertexes[off], pt);
 			float d2 = distance(v2 = contour.vertexes[off + 1], pt);
 			float d3 = distance(v3 = contour.vertexes[off + 2], pt);
-			if (std::abs(levelSet(pt.x, pt.y, pt.z).x) <= CONTRACT_DISTANCE) {
+			if (std::abs(band.interpolate(pt, LEVEL)) <= CONTRACT_DISTANCE) {
 				minEdgeLength = 1E30;
 				maxEdgeLength = -1E30;
 				area = 0.0f;
@@ -554,7 +557,7 @@ int SpringLevelSet3D::contract() {
 			float d2 = distance(v2 = contour.vertexes[off + 1], pt);
 			float d3 = distance(v3 = contour.vertexes[off + 2], pt);
 			float d4 = distance(v4 = contour.vertexes[off + 3], pt);
-			if (std::abs(levelSet(pt.x, pt.y, pt.z).x) <= CONTRACT_DISTANCE) {
+			if (std::abs(band.interpolate(pt, LEVEL)) <= CONTRACT_DISTANCE) {
 				minEdgeLength = 1E30;
 				maxEdgeLength = -1E30;
 				area = 0.0f;
@@ -622,7 +625,7 @@ void SpringLevelSet3D::computeForce(size_t idx, float timeStep, float3& f1,
 	float3 p2 = contour.vertexes[4 * idx + 1];
 	float3 p3 = contour.vertexes[4 * idx + 2];
 	float3 p4 = contour.vertexes[4 * idx + 3];
-	const double voxelSize = 1.0 / levelSet.rows;
+	const double voxelSize = 1.0 / band.dimensions().x;
 	if (temporalScheme == TemporalScheme::FirstOrder) {
 		if (advectionFunc) {
 			f = float3(advectionFunc(double3(p), voxelSize, simulationTime));
@@ -727,7 +730,7 @@ void SpringLevelSet3D::computeForce(size_t idx, float timeStep, float3& f1,
 	float3 p1 = contour.vertexes[3 * idx];
 	float3 p2 = contour.vertexes[3 * idx + 1];
 	float3 p3 = contour.vertexes[3 * idx + 2];
-	const double voxelSize = 1.0 / levelSet.rows;
+	const double voxelSize = 1.0 / band.dimensions().x;
 	double3 k1, k2, k3, k4;
 	if (temporalScheme == TemporalScheme::FirstOrder) {
 		if (advectionFunc) {
@@ -815,52 +818,18 @@ void SpringLevelSet3D::computeForce(size_t idx, float timeStep, float3& f1,
 	}
 }
 void SpringLevelSet3D::updateSignedLevelSet(float maxStep) {
-#pragma omp parallel for
-	for (int i = 0; i < (int) activeList.size(); i++) {
-		int3 pos = activeList[i];
-		distanceFieldMotion(pos.x, pos.y, pos.z, i);
-	}
-	float timeStep = (float) maxStep;
-	if (!clampSpeed) {
-		float maxDelta = 0.0f;
-		for (float delta : deltaLevelSet) {
-			maxDelta = std::max(std::abs(delta), maxDelta);
+#pragma omp parallel for schedule(dynamic)
+	for (int s = 0; s < (int) band.getTileCount(); s++) {
+		float* delta = band.getTileValues(s, DELTA);
+		std::fill(delta, delta + NarrowBand3D::TILE_VOXELS, 0.0f);
+		uint8_t sel[NarrowBand3D::TILE_VOXELS];
+		if (selectVoxels(s, [](float val) {return std::abs(val) <= 0.5f;}, sel) > 0) {
+			float v[NarrowBand3D::PADDED_VOXELS];
+			band.gather(s, SWAP, v);
+			distanceFieldMotion(s, v, sel);
 		}
-		const float maxSpeed = 0.999f;
-		timeStep = (float) (maxStep
-				* ((maxDelta > maxSpeed) ? (maxSpeed / maxDelta) : maxSpeed));
-	}
-	contourLock.lock();
-
-#pragma omp parallel for
-	for (int i = 0; i < (int) activeList.size(); i++) {
-		int3 pos = activeList[i];
-		applyForces(pos.x, pos.y, pos.z, i, timeStep);
-	}
-	for (int band = 1; band <= maxLayers; band++) {
-#pragma omp parallel for
-		for (int i = 0; i < (int) activeList.size(); i++) {
-			int3 pos = activeList[i];
-			updateDistanceField(pos.x, pos.y, pos.z, band);
-		}
-	}
-#pragma omp parallel for
-	for (int i = 0; i < (int) activeList.size(); i++) {
-		int3 pos = activeList[i];
-		plugLevelSet(pos.x, pos.y, pos.z, i);
-	}
-	requestUpdateSurface = true;
-	contourLock.unlock();
-
-#pragma omp parallel for
-	for (int i = 0; i < (int) activeList.size(); i++) {
-		int3 pos = activeList[i];
-		swapLevelSet(pos.x, pos.y, pos.z) = levelSet(pos.x, pos.y, pos.z);
 	}
-	deleteElements();
-	addElements();
-	deltaLevelSet.clear();
-	deltaLevelSet.resize(activeList.size(), 0.0f);
+	updateLevelSet(maxStep);
 }
 float SpringLevelSet3D::advect(float maxStep) {
 	int N = (int) contour.particles.size();
@@ -1002,13 +971,13 @@ float3 SpringLevelSet3D::getScaledGradientValue(int i, int j, int k) {
 	return -(v111 * grad / len);
 }
 float3 SpringLevelSet3D::getGradientValue(float i, float j, float k) {
-	float v211 = levelSet(i + 1, j, k).x;
-	float v121 = levelSet(i, j + 1, k).x;
-	float v101 = levelSet(i, j - 1, k).x;
-	float v011 = levelSet(i - 1, j, k).x;
-	float v110 = levelSet(i, j, k - 1).x;
-	float v112 = levelSet(i, j, k + 1).x;
-	float v111 = levelSet(i, j, k).x;
+	float v211 = band.interpolate(float3(i + 1, j, k), LEVEL);
+	float v121 = band.interpolate(float3(i, j + 1, k), LEVEL);
+	float v101 = band.interpolate(float3(i, j - 1, k), LEVEL);
+	float v011 = band.interpolate(float3(i - 1, j, k), LEVEL);
+	float v110 = band.interpolate(float3(i, j, k - 1), LEVEL);
+	float v112 = band.interpolate(float3(i, j, k + 1), LEVEL);
+	float v111 = band.interpolate(float3(i, j, k), LEVEL);
 	float3 grad;
 	grad.x = 0.5f * (v211 - v011);
 	grad.y = 0.5f * (v121 - v101);
@@ -1027,13 +996,13 @@ float3 SpringLevelSet3D::getScaledGradientValue(float i, float j, float k,
 	float v110;
 	float v112;
 	if (signedIso) {
-		v211 = std::abs(levelSet(i + 1, j, k).x);
-		v121 = std::abs(levelSet(i, j + 1, k).x);
-		v101 = std::abs(levelSet(i, j - 1, k).x);
-		v011 = std::abs(levelSet(i - 1, j, k).x);
-		v110 = std::abs(levelSet(i, j, k - 1).x);
-		v112 = std::abs(levelSet(i, j, k + 1).x);
-		v111 = std::abs(levelSet(i, j, k).x);
+		v211 = std::abs(band.interpolate(float3(i + 1, j, k), LEVEL));
+		v121 = std::abs(band.interpolate(float3(i, j + 1, k), LEVEL));
+		v101 = std::abs(band.interpolate(float3(i, j - 1, k), LEVEL));
+		v011 = std::abs(band.interpolate(float3(i - 1, j, k), LEVEL));
+		v110 = std::abs(band.interpolate(float3(i, j, k - 1), LEVEL));
+		v112 = std::abs(band.interpolate(float3(i, j, k + 1), LEVEL));
+		v111 = std::abs(band.interpolate(float3(i, j, k), LEVEL));
 	} else {
 		v211 = std::abs(unsignedLevelSet(i + 1, j, k).x);
 		v121 = std::abs(unsignedLevelSet(i, j + 1, k).x);
@@ -1049,115 +1018,38 @@ float3 SpringLevelSet3D::getScaledGradientValue(float i, float j, float k,
 	float len = max(1E-6f, length(grad));
 	return -(v111 * grad / len);
 }
-void SpringLevelSet3D::distanceFieldMotion(int i, int j, int k, size_t gid) {
-	float v111 = swapLevelSet(i, j, k).x;
-	if (v111 > 0.5f || v111 < -0.5f) {
-		deltaLevelSet[gid] = 0;
-		return;
-	}
-	float v010 = swapLevelSet(i - 1, j, k - 1);
-	float v120 = swapLevelSet(i, j + 1, k - 1);
-	float v110 = swapLevelSet(i, j, k - 1);
-	float v100 = swapLevelSet(i, j - 1, k - 1);
-	float v210 = swapLevelSet(i + 1, j, k - 1);
-	float v001 = swapLevelSet(i - 1, j - 1, k);
-	float v011 = swapLevelSet(i - 1, j, k);
-	float v101 = swapLevelSet(i, j - 1, k);
-	float v211 = swapLevelSet(i + 1, j, k);
-	float v201 = swapLevelSet(i + 1, j - 1, k);
-	float v221 = swapLevelSet(i + 1, j + 1, k);
-	float v021 = swapLevelSet(i - 1, j + 1, k);
-	float v121 = swapLevelSet(i, j + 1, k);
-	float v012 = swapLevelSet(i - 1, j, k + 1);
-	float v122 = swapLevelSet(i, j + 1, k + 1);
-	float v112 = swapLevelSet(i, j, k + 1);
-	float v102 = swapLevelSet(i, j - 1, k + 1);
-	float v212 = swapLevelSet(i + 1, j, k + 1);
-
-	float DxNeg = v111 - v011;
-	float DxPos = v211 - v111;
-	float DyNeg = v111 - v101;
-	float DyPos = v121 - v111;
-	float DzNeg = v111 - v110;
-	float DzPos = v112 - v111;
-	float DxNegMin = min(DxNeg, 0.0f);
-	float DxNegMax = max(DxNeg, 0.0f);
-	float DxPosMin = min(DxPos, 0.0f);
-	float DxPosMax = max(DxPos, 0.0f);
-	float DyNegMin = min(DyNeg, 0.0f);
-	float DyNegMax = max(DyNeg, 0.0f);
-	float DyPosMin = min(DyPos, 0.0f);
-	float DyPosMax = max(DyPos, 0.0f);
-	float DzNegMin = min(DzNeg, 0.0f);
-	float DzNegMax = max(DzNeg, 0.0f);
-	float DzPosMin = min(DzPos, 0.0f);
-	float DzPosMax = max(DzPos, 0.0f);
-
-	float GradientSqrPos = DxNegMax * DxNegMax + DxPosMin * DxPosMin
-			+ DyNegMax * DyNegMax + DyPosMin * DyPosMin + DzNegMax * DzNegMax
-			+ DzPosMin * DzPosMin;
-	float GradientSqrNeg = DxPosMax * DxPosMax + DxNegMin * DxNegMin
-			+ DyPosMax * DyPosMax + DyNegMin * DyNegMin + DzPosMax * DzPosMax
-			+ DzNegMin * DzNegMin;
-
-	float DxCtr = 0.5f * (v211 - v011);
-	float DyCtr = 0.5f * (v121 - v101);
-	float DzCtr = 0.5f * (v112 - v110);
-	float DxxCtr = v211 - v111 - v111 + v011;
-	float DyyCtr = v121 - v111 - v111 + v101;
-	float DzzCtr = v112 - v111 - v111 + v110;
-	float DxyCtr = (v221 - v021 - v201 + v001) * 0.25f;
-	float DxzCtr = (v212 - v012 - v210 + v010) * 0.25f;
-	float DyzCtr = (v122 - v102 - v120 + v100) * 0.25f;
-	float curvWeight = curvatureParam.toFloat();
-	float numer = 0.0, denom = 0.0f;
-	float kappa = 0;
-	if (curvWeight > 0) {
-		numer = 0.5f
-				* ((DyyCtr + DzzCtr) * DxCtr * DxCtr
-						+ (DxxCtr + DzzCtr) * DyCtr * DyCtr
-						+ (DxxCtr + DyyCtr) * DzCtr * DzCtr
-						- 2 * DxCtr * DyCtr * DxyCtr
-						- 2 * DxCtr * DzCtr * DxzCtr
-						- 2 * DyCtr * DzCtr * DyzCtr);
-		denom = DxCtr * DxCtr + DyCtr * DyCtr + DzCtr * DzCtr;
-		const float maxCurvatureForce = 10.0f;
-		if (std::abs(denom) > 1E-5f) {
-			kappa = curvWeight * numer / denom;
-		} else {
-			kappa = curvWeight * numer * sign(denom) * 1E5;
-		}
-		if (kappa < -maxCurvatureForce) {
-			kappa = -maxCurvatureForce;
-		} else if (kappa > maxCurvatureForce) {
-			kappa = maxCurvatureForce;
+void SpringLevelSet3D::distanceFieldMotion(int slot, const float* v,
+		const uint8_t* sel) {
+	const float curvature = curvatureParam.toFloat();
+	const int3 origin = band.getTileOrigin(slot);
+	float* delta = band.getTileValues(slot, DELTA);
+	for (int z = 0; z < NarrowBand3D::TILE_SIZE; z++) {
+		for (int y = 0; y < NarrowBand3D::TILE_SIZE; y++) {
+			for (int x = 0; x < NarrowBand3D::TILE_SIZE; x++) {
+				int l = x + NarrowBand3D::TILE_SIZE * (y + NarrowBand3D::TILE_SIZE * z);
+				if (!sel[l])
+					continue;
+				int c = PaddedIndex(x, y, z);
+				float v111 = v[c];
+				float DxNeg = v111 - v[c - PX];
+				float DxPos = v[c + PX] - v111;
+				float DyNeg = v111 - v[c - PY];
+				float DyPos = v[c + PY] - v111;
+				float DzNeg = v111 - v[c - PZ];
+				float DzPos = v[c + PZ] - v111;
+				float kappa = (curvature > 0) ? MeanCurvature(v, c, curvature) : 0.0f;
+				// Level set force should be the opposite sign of advection force so it
+				// moves in the direction of the force.
+				float3 grad = getScaledGradientValue(origin.x + x, origin.y + y,
+						origin.z + z);
+				// Dot product force with upwind gradient
+				float advection = ((grad.x > 0) ? grad.x * DxNeg : grad.x * DxPos)
+						+ ((grad.y > 0) ? grad.y * DyNeg : grad.y * DyPos)
+						+ ((grad.z > 0) ? grad.z * DzNeg : grad.z * DzPos);
+				delta[l] = -advection + kappa;
+			}
 		}
 	}
-	float pressure = 0;
-// Level set force should be the opposite sign of advection force so it
-// moves in the direction of the force.
-
-	float3 grad = getScaledGradientValue(i, j, k);
-	float advection = 0;
-// Dot product force with upwind gradient
-	if (grad.x > 0) {
-		advection = grad.x * DxNeg;
-	} else if (grad.x < 0) {
-		advection = grad.x * DxPos;
-	}
-
-	if (grad.y > 0) {
-		advection += grad.y * DyNeg;
-	} else if (grad.y < 0) {
-		advection += grad.y * DyPos;
-	}
-
-	if (grad.z > 0) {
-		advection += grad.z * DzNeg;
-	} else if (grad.z < 0) {
-		advection += grad.z * DzPos;
-	}
-	deltaLevelSet[gid] = -advection + kappa;
 }
 void SpringLevelSet3D::setSpringls(const aly::Mesh& mesh) {
 	contour.vertexLocations = mesh.vertexLocations;
@@ -1304,7 +1196,7 @@ bool SpringLevelSet3D::stepInternal() {
 			{
 				Mesh tmpMesh;
 				std::lock_guard<std::mutex> lockMe(contourLock);
-				isoSurface.solve(levelSet, activeList, tmpMesh,contour.meshType, false, 0.0f);
+				isoSurface.solve(band, LEVEL, tmpMesh, contour.meshType, false, 0.0f);
 				tmpMesh.updateVertexNormals(false);
 				refineContour(tmpMesh, 4, 2.0f, 0.5f);
 				contour.quadIndexes = tmpMesh.quadIndexes;
@@ -1330,8 +1222,8 @@ bool SpringLevelSet3D::stepInternal() {
 		} else {
 			std::lock_guard<std::mutex> lockMe(contourLock);
 			Mesh mesh;
-			isoSurface.solve(levelSet, activeList, mesh, contour.meshType,
-					false, 0.0f);
+			isoSurface.solve(band, LEVEL, mesh, contour.meshType, false,
+					0.0f);
 			mesh.updateVertexNormals(false);
 			refineContour(mesh, 4, 2.0f, 0.5f);
 			contour.vertexLocations = mesh.vertexLocations;
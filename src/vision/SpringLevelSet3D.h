@@ -25,7 +25,7 @@
 #include "vision/ActiveManifold3D.h"
 #include "vision/ManifoldCache3D.h"
 #include "graphics/shaders/ContourShaders.h"
-#include "graphics/AlloyLocator.h"
+#include "graphics/AlloySpatialHash.h"
 namespace aly {
 	struct SpringlEdge {
 		uint32_t id;
@@ -61,7 +61,7 @@ namespace aly {
 		static double ENRIGHT_PERIOD;
 		static const std::function<double3(double3,double,double)> ENRIGHT_FUNCTION;
 	protected:
-		std::shared_ptr<Locator3f> locator;
+		SpatialHash3f locator;
 		aly::Vector3f oldCorrespondences;
 		aly::Vector3f oldParticles;
 		aly::Vector3f oldNormals;
@@ -88,7 +88,7 @@ namespace aly {
 		float3 getScaledGradientValue(int i, int j, int k);
 		float3 getGradientValue(float i,float j,float k);
 		float3 getScaledGradientValue(float i, float j,float k, bool signedIso);
-		void distanceFieldMotion(int i, int j, int k, size_t index);
+		void distanceFieldMotion(int slot, const float* v, const uint8_t* sel);
 		virtual void computeForce(size_t idx,float timeStep, float3& p1, float3& p2, float3& p3, float3& p);
 		virtual void computeForce(size_t idx,float timeStep, float3& p1, float3& p2, float3& p3, float3& p4, float3& p);
 		void relax(size_t idx, float timeStep, Vector3f& update);